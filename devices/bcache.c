@@ -0,0 +1,444 @@
+#include "devices/bcache.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* A caching block device.
+
+   A bcache device has the size and contents of a slow BACKING
+   device, and keeps copies of its hot sectors on a faster CACHE
+   device.  The cache device holds a header in sector 0, then the
+   mapping table, then the cached sectors themselves, one per
+   slot.  The slots are grouped into sets of BCACHE_WAYS, and a
+   backing sector may only be cached in the set given by its
+   number modulo the number of sets, so that finding it takes a
+   look at BCACHE_WAYS table entries.
+
+   Reads that hit come from the cache device.  A sector that
+   misses is read from the backing device and promoted into the
+   cache once it has missed BCACHE_PROMOTE times recently, so that
+   a one-pass scan does not flush out the working set.  Writes are
+   write-back: they go to the cache device, to the sector's slot
+   or to a clean slot of its set, and a background thread copies
+   dirty slots to the backing device.  Only when every slot of the
+   set is dirty does a write go straight to the backing device.
+
+   The table on the cache device always describes the slots, so
+   the cache, dirty sectors included, survives a reboot or crash:
+   a slot is marked free on disk before it is given a new sector,
+   and its new entry is written only after its data.  As with a
+   stripe, nothing on the backing device records the cache, so
+   the two must be assembled the same way on every boot until the
+   dirty sectors are written back. */
+
+/* Slots per set. */
+#define BCACHE_WAYS 4
+
+/* Misses that make a sector hot enough to be promoted. */
+#define BCACHE_PROMOTE 2
+
+/* Miss counters, indexed by a hash of the sector number.  They
+   are halved every BCACHE_HEAT_SIZE misses, so that only recent
+   misses count. */
+#define BCACHE_HEAT_SIZE 4096
+
+/* Background write-back: every BCACHE_WB_INTERVAL ms, write back
+   up to BCACHE_WB_BATCH dirty slots. */
+#define BCACHE_WB_INTERVAL 250
+#define BCACHE_WB_BATCH 32
+
+/* Identifies a cache device's header. */
+#define BCACHE_MAGIC 0x48434342
+
+/* Cache device header, in its sector 0. */
+struct bcache_header
+  {
+    uint32_t magic;                     /* BCACHE_MAGIC. */
+    uint32_t slot_cnt;                  /* Number of slots. */
+    block_sector_t backing_size;        /* Sectors on backing device. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 12];
+  };
+
+/* Mapping table entry, one per slot. */
+struct bcache_entry
+  {
+    block_sector_t sector;              /* Backing sector cached. */
+    uint32_t flags;                     /* ENTRY_* flags. */
+  };
+
+#define ENTRY_VALID 0x1                 /* Slot holds SECTOR. */
+#define ENTRY_DIRTY 0x2                 /* Newer than backing device. */
+
+/* Table entries per sector. */
+#define ENTRIES_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (struct bcache_entry))
+
+/* A caching device. */
+struct bcache
+  {
+    struct block *backing;              /* Slow device. */
+    struct block *cache;                /* Fast device. */
+    struct lock lock;                   /* Protects all below. */
+    size_t slot_cnt;                    /* Number of slots. */
+    size_t set_cnt;                     /* SLOT_CNT / BCACHE_WAYS. */
+    block_sector_t data_start;          /* First slot's sector. */
+    struct bcache_entry *table;         /* One entry per slot. */
+    uint32_t *gens;                     /* Writes to each slot. */
+    uint32_t *last_use;                 /* Clock at each slot's last use. */
+    uint32_t clock;                     /* Advanced on every access. */
+    uint8_t heat[BCACHE_HEAT_SIZE];     /* Recent misses, by hash. */
+    size_t heat_misses;                 /* Misses since last halving. */
+    size_t dirty_cnt;                   /* Dirty slots. */
+    size_t wb_cursor;                   /* Next slot to write back. */
+  };
+
+/* Statistics, over all caching devices. */
+static unsigned long long hit_cnt;      /* Reads from the cache device. */
+static unsigned long long miss_cnt;     /* Reads from the backing device. */
+static unsigned long long promote_cnt;  /* Sectors promoted on read. */
+static unsigned long long write_hit_cnt; /* Writes to the cache device. */
+static unsigned long long write_around_cnt; /* Writes past a dirty set. */
+static unsigned long long writeback_cnt; /* Slots written back. */
+static bool any_bcache;                 /* Was a device created? */
+
+static struct block_operations bcache_operations;
+static thread_func writeback_daemon NO_RETURN;
+
+/* Writes the table sector that holds slot SLOT's entry to the
+   cache device. */
+static void
+store_entry (struct bcache *bc, size_t slot)
+{
+  size_t first = slot / ENTRIES_PER_SECTOR * ENTRIES_PER_SECTOR;
+
+  block_write (bc->cache, 1 + slot / ENTRIES_PER_SECTOR, &bc->table[first]);
+}
+
+/* Registers and returns a block device named NAME that caches
+   BACKING's sectors on CACHE.  If CACHE already holds a cache of
+   a device of BACKING's size, its table is kept, otherwise CACHE
+   is set up empty.  The new device has type BLOCK_FILESYS. */
+struct block *
+bcache_create (const char *name, struct block *backing, struct block *cache)
+{
+  struct bcache *bc;
+  struct bcache_header *h;
+  block_sector_t cache_size = block_size (cache);
+  size_t table_sectors, i;
+  char extra_info[128];
+
+  if (cache_size < 2 + BCACHE_WAYS)
+    PANIC ("%s: cache device %s is too small", name, block_name (cache));
+
+  bc = malloc (sizeof *bc);
+  h = malloc (sizeof *h);
+  if (bc == NULL || h == NULL)
+    PANIC ("%s: out of memory", name);
+  bc->backing = backing;
+  bc->cache = cache;
+  lock_init (&bc->lock);
+
+  /* Each slot takes a sector of data plus its share of the
+     table. */
+  bc->slot_cnt = ((uint64_t) (cache_size - 1) * ENTRIES_PER_SECTOR
+                  / (ENTRIES_PER_SECTOR + 1));
+  bc->slot_cnt -= bc->slot_cnt % BCACHE_WAYS;
+  bc->set_cnt = bc->slot_cnt / BCACHE_WAYS;
+  table_sectors = DIV_ROUND_UP (bc->slot_cnt, ENTRIES_PER_SECTOR);
+  bc->data_start = 1 + table_sectors;
+  ASSERT (bc->data_start + bc->slot_cnt <= cache_size);
+
+  bc->table = malloc (table_sectors * BLOCK_SECTOR_SIZE);
+  bc->gens = calloc (bc->slot_cnt, sizeof *bc->gens);
+  bc->last_use = calloc (bc->slot_cnt, sizeof *bc->last_use);
+  if (bc->table == NULL || bc->gens == NULL || bc->last_use == NULL)
+    PANIC ("%s: out of memory for a %zu-slot table", name, bc->slot_cnt);
+  bc->clock = 0;
+  memset (bc->heat, 0, sizeof bc->heat);
+  bc->heat_misses = 0;
+  bc->dirty_cnt = 0;
+  bc->wb_cursor = 0;
+
+  /* Keep an existing cache of this backing device, dirty sectors
+     and all, or start afresh. */
+  block_read (cache, 0, h);
+  if (h->magic == BCACHE_MAGIC && h->slot_cnt == bc->slot_cnt
+      && h->backing_size == block_size (backing))
+    {
+      for (i = 0; i < table_sectors; i++)
+        block_read (cache, 1 + i, bc->table + i * ENTRIES_PER_SECTOR);
+      for (i = 0; i < bc->slot_cnt; i++)
+        if (bc->table[i].flags & ENTRY_DIRTY)
+          bc->dirty_cnt++;
+    }
+  else
+    {
+      memset (bc->table, 0, table_sectors * BLOCK_SECTOR_SIZE);
+      for (i = 0; i < table_sectors; i++)
+        block_write (cache, 1 + i, bc->table + i * ENTRIES_PER_SECTOR);
+      memset (h, 0, sizeof *h);
+      h->magic = BCACHE_MAGIC;
+      h->slot_cnt = bc->slot_cnt;
+      h->backing_size = block_size (backing);
+      block_write (cache, 0, h);
+    }
+  free (h);
+
+  any_bcache = true;
+  thread_create ("bcache-wb", PRI_DEFAULT, writeback_daemon, bc);
+  snprintf (extra_info, sizeof extra_info, "%s cached on %s, %zu slots",
+            block_name (backing), block_name (cache), bc->slot_cnt);
+  return block_register (name, BLOCK_FILESYS, extra_info,
+                         block_size (backing), &bcache_operations, bc);
+}
+
+/* Returns the first slot of the set that may cache SECTOR. */
+static size_t
+set_of (const struct bcache *bc, block_sector_t sector)
+{
+  return sector % bc->set_cnt * BCACHE_WAYS;
+}
+
+/* Returns the slot that caches SECTOR, or SIZE_MAX if none does.
+   The device's lock must be held. */
+static size_t
+find_slot (const struct bcache *bc, block_sector_t sector)
+{
+  size_t first = set_of (bc, sector);
+  size_t i;
+
+  for (i = first; i < first + BCACHE_WAYS; i++)
+    if ((bc->table[i].flags & ENTRY_VALID) && bc->table[i].sector == sector)
+      return i;
+  return SIZE_MAX;
+}
+
+/* Returns the slot in SECTOR's set to give SECTOR: a free one if
+   there is one, otherwise the least recently used clean one, or
+   SIZE_MAX if every slot is dirty.  The device's lock must be
+   held. */
+static size_t
+victim_slot (const struct bcache *bc, block_sector_t sector)
+{
+  size_t first = set_of (bc, sector);
+  size_t victim = SIZE_MAX;
+  size_t i;
+
+  for (i = first; i < first + BCACHE_WAYS; i++)
+    {
+      uint32_t flags = bc->table[i].flags;
+      if (!(flags & ENTRY_VALID))
+        return i;
+      if (!(flags & ENTRY_DIRTY)
+          && (victim == SIZE_MAX
+              || (bc->clock - bc->last_use[i]
+                  > bc->clock - bc->last_use[victim])))
+        victim = i;
+    }
+  return victim;
+}
+
+/* Records a use of SLOT. */
+static void
+touch (struct bcache *bc, size_t slot)
+{
+  bc->last_use[slot] = ++bc->clock;
+}
+
+/* Puts SECTOR, whose contents are in BUFFER, into SLOT, dirty if
+   DIRTY is true.  Whatever SLOT held must be clean.  The device's
+   lock must be held. */
+static void
+install (struct bcache *bc, size_t slot, block_sector_t sector,
+         const void *buffer, bool dirty)
+{
+  struct bcache_entry *e = &bc->table[slot];
+
+  ASSERT (!(e->flags & ENTRY_DIRTY));
+  if (e->flags & ENTRY_VALID)
+    {
+      e->flags = 0;
+      store_entry (bc, slot);
+    }
+  block_write (bc->cache, bc->data_start + slot, buffer);
+  e->sector = sector;
+  e->flags = ENTRY_VALID | (dirty ? ENTRY_DIRTY : 0);
+  store_entry (bc, slot);
+  if (dirty)
+    bc->dirty_cnt++;
+  bc->gens[slot]++;
+  touch (bc, slot);
+}
+
+/* Counts a read miss on SECTOR and returns true if that makes
+   SECTOR hot enough to promote. */
+static bool
+heat_up (struct bcache *bc, block_sector_t sector)
+{
+  uint8_t *h = &bc->heat[(sector * 2654435761u) % BCACHE_HEAT_SIZE];
+
+  if (++bc->heat_misses >= BCACHE_HEAT_SIZE)
+    {
+      size_t i;
+      for (i = 0; i < BCACHE_HEAT_SIZE; i++)
+        bc->heat[i] /= 2;
+      bc->heat_misses = 0;
+    }
+  if (*h < UINT8_MAX)
+    ++*h;
+  return *h >= BCACHE_PROMOTE;
+}
+
+/* Reads sector SECTOR from caching device BC_ into BUFFER. */
+static void
+bcache_read (void *bc_, block_sector_t sector, void *buffer)
+{
+  struct bcache *bc = bc_;
+  size_t slot;
+
+  lock_acquire (&bc->lock);
+  slot = find_slot (bc, sector);
+  if (slot != SIZE_MAX)
+    {
+      hit_cnt++;
+      touch (bc, slot);
+      block_read (bc->cache, bc->data_start + slot, buffer);
+    }
+  else
+    {
+      miss_cnt++;
+      block_read (bc->backing, sector, buffer);
+      if (heat_up (bc, sector)
+          && (slot = victim_slot (bc, sector)) != SIZE_MAX)
+        {
+          promote_cnt++;
+          install (bc, slot, sector, buffer, false);
+        }
+    }
+  lock_release (&bc->lock);
+}
+
+/* Writes sector SECTOR to caching device BC_ from BUFFER. */
+static void
+bcache_write (void *bc_, block_sector_t sector, const void *buffer)
+{
+  struct bcache *bc = bc_;
+  size_t slot;
+
+  lock_acquire (&bc->lock);
+  slot = find_slot (bc, sector);
+  if (slot != SIZE_MAX)
+    {
+      /* Mark the slot dirty on disk before changing its data, so
+         that a crash in between leaves at worst a needless
+         write-back. */
+      write_hit_cnt++;
+      if (!(bc->table[slot].flags & ENTRY_DIRTY))
+        {
+          bc->table[slot].flags |= ENTRY_DIRTY;
+          store_entry (bc, slot);
+          bc->dirty_cnt++;
+        }
+      block_write (bc->cache, bc->data_start + slot, buffer);
+      bc->gens[slot]++;
+      touch (bc, slot);
+    }
+  else if ((slot = victim_slot (bc, sector)) != SIZE_MAX)
+    {
+      write_hit_cnt++;
+      install (bc, slot, sector, buffer, true);
+    }
+  else
+    {
+      write_around_cnt++;
+      block_write (bc->backing, sector, buffer);
+    }
+  lock_release (&bc->lock);
+}
+
+/* Writes back up to BCACHE_WB_BATCH of BC's dirty slots, using
+   BUFFER, one sector long.  The device's lock is released while
+   each sector is written to the backing device; a slot written
+   again meanwhile stays dirty. */
+static void
+write_back (struct bcache *bc, void *buffer)
+{
+  size_t done, scanned;
+
+  lock_acquire (&bc->lock);
+  for (done = scanned = 0;
+       (done < BCACHE_WB_BATCH && scanned < bc->slot_cnt
+        && bc->dirty_cnt > 0);
+       scanned++)
+    {
+      size_t slot = bc->wb_cursor;
+      struct bcache_entry *e = &bc->table[slot];
+      block_sector_t sector = e->sector;
+      uint32_t gen = bc->gens[slot];
+
+      bc->wb_cursor = (slot + 1) % bc->slot_cnt;
+      if (!(e->flags & ENTRY_DIRTY))
+        continue;
+
+      block_read (bc->cache, bc->data_start + slot, buffer);
+      lock_release (&bc->lock);
+      block_write (bc->backing, sector, buffer);
+      lock_acquire (&bc->lock);
+
+      /* Dirty slots are never given another sector, so only a
+         newer write can have changed the slot. */
+      ASSERT (e->sector == sector && (e->flags & ENTRY_DIRTY));
+      if (bc->gens[slot] == gen)
+        {
+          e->flags &= ~ENTRY_DIRTY;
+          store_entry (bc, slot);
+          bc->dirty_cnt--;
+        }
+      writeback_cnt++;
+      done++;
+    }
+  lock_release (&bc->lock);
+}
+
+/* Background write-back thread for the caching device AUX. */
+static void
+writeback_daemon (void *aux)
+{
+  struct bcache *bc = aux;
+  void *buffer = malloc (BLOCK_SECTOR_SIZE);
+
+  if (buffer == NULL)
+    PANIC ("bcache: out of memory for write-back");
+  for (;;)
+    {
+      timer_msleep (BCACHE_WB_INTERVAL);
+      write_back (bc, buffer);
+    }
+}
+
+/* Prints statistics for caching devices, if any exist. */
+void
+bcache_print_stats (void)
+{
+  if (!any_bcache)
+    return;
+  printf ("Block cache tier: %llu read hits, %llu misses, %llu promoted, "
+          "%llu writes cached, %llu written around, %llu written back\n",
+          hit_cnt, miss_cnt, promote_cnt, write_hit_cnt, write_around_cnt,
+          writeback_cnt);
+}
+
+static struct block_operations bcache_operations =
+  {
+    bcache_read,
+    bcache_write,
+    NULL,
+    NULL,
+    NULL
+  };
@@ -0,0 +1,10 @@
+#ifndef DEVICES_BCACHE_H
+#define DEVICES_BCACHE_H
+
+struct block;
+
+struct block *bcache_create (const char *name, struct block *backing,
+                             struct block *cache);
+void bcache_print_stats (void);
+
+#endif /* devices/bcache.h */
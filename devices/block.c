@@ -3,7 +3,90 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/tracepoint.h"
+#include "threads/vaddr.h"
+
+/* Request queue.
+
+   Each device that is not stacked on another has a queue of
+   pending requests and a dispatcher thread.  block_submit() adds
+   a request to the queue and returns; the dispatcher carries it
+   out and calls its completion function.  The synchronous calls
+   submit a request and sleep until it completes.
+   The dispatcher serves requests in C-SCAN order: it moves upward
+   through the sectors from where the last request ended, taking
+   the pending request with the lowest starting sector at or past
+   that point, and wraps around to the lowest pending sector when
+   there is none.  It also merges requests in the same direction
+   that continue one another into a single driver call, up to
+   MERGE_MAX sectors, staging them in a bounce buffer.
+
+   Stacked devices, such as partitions, pass their requests
+   straight to the device below, which queues them.
+
+   So that one process streaming a big file cannot starve the
+   others, each queue also sorts its requests into flows by the
+   thread that submitted them, and shares the device among flows
+   by start-time fair queuing.  Each request is tagged with a
+   virtual start time, the later of the queue's virtual time and
+   the end of its flow's previous request, and pushes its flow's
+   end on by its size divided by the flow's weight.  The
+   dispatcher picks the flow whose earliest request has the
+   lowest tag, advances the queue's virtual time to that tag, and
+   serves that flow's requests in C-SCAN order, so that a lone
+   flow is served exactly as above.  A flow may also be capped
+   in sectors per second, enforced with a token bucket: a flow
+   that has run out of tokens is passed over until it earns more,
+   and if every pending flow is out, the dispatcher sleeps.
+
+   Weights and caps come from the submitting thread's io_weight
+   and io_rate, set by SYS_IOPRIO.  Write-back by the buffer
+   cache's own threads counts as theirs, not the writer's. */
+
+/* Most sectors in one merged request. */
+#define MERGE_MAX (2 * PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Flows tracked per queue.  A thread that finds every flow busy
+   shares the first one. */
+#define FLOW_CNT 16
+
+/* Timer ticks of transfers that a capped flow may save up. */
+#define FLOW_BURST_TICKS (TIMER_FREQ / 4)
+
+/* A flow of requests from one thread. */
+struct block_flow
+  {
+    tid_t owner;                        /* Submitting thread. */
+    unsigned weight;                    /* Share of the device. */
+    unsigned rate;                      /* Sectors per second, or 0. */
+    uint64_t finish;                    /* Virtual time at which the
+                                           flow's last request ends. */
+    int64_t tokens;                     /* Sectors it may still move,
+                                           times TIMER_FREQ. */
+    int64_t refill;                     /* Timer ticks at last refill. */
+    unsigned pending;                   /* Requests queued. */
+  };
+
+/* A device's request queue. */
+struct block_queue
+  {
+    struct lock lock;                   /* Protects members below. */
+    struct condition pending;           /* Signaled when a request
+                                           is added. */
+    struct list requests;               /* Pending block_requests. */
+    block_sector_t head;                /* Sector after the last
+                                           request dispatched. */
+    uint64_t vtime;                     /* Virtual time. */
+    struct block_flow flows[FLOW_CNT];  /* Submitters' flows. */
+    uint8_t *bounce;                    /* MERGE_MAX sectors. */
+    struct block_stats stats;           /* All but read_cnt and
+                                           write_cnt are kept here. */
+  };
 
 /* A block device. */
 struct block
@@ -19,6 +102,8 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+
+    struct block_queue *queue;          /* Null if stacked. */
   };
 
 /* List of all block devices. */
@@ -28,6 +113,9 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void submit_wait (struct block *, block_sector_t, size_t cnt,
+                         void *buffer, bool write);
+static thread_func dispatcher NO_RETURN;
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -121,8 +209,10 @@ void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
   check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
+  TRACEPOINT (TP_BLOCK_READ, sector, 1, block->type);
+  submit_wait (block, sector, 1, buffer, false);
   block->read_cnt++;
+  thread_current ()->rusage.read_sectors++;
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -135,8 +225,435 @@ block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
   check_sector (block, sector);
   ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
+  TRACEPOINT (TP_BLOCK_WRITE, sector, 1, block->type);
+  submit_wait (block, sector, 1, (void *) buffer, true);
   block->write_cnt++;
+  thread_current ()->rusage.write_sectors++;
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Drivers that support it do so in as few transfers as
+   they can.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *buffer)
+{
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  TRACEPOINT (TP_BLOCK_READ, sector, cnt, block->type);
+  submit_wait (block, sector, cnt, buffer, false);
+  block->read_cnt += cnt;
+  thread_current ()->rusage.read_sectors += cnt;
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving the
+   data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      size_t cnt, const void *buffer)
+{
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  ASSERT (block->type != BLOCK_FOREIGN);
+  TRACEPOINT (TP_BLOCK_WRITE, sector, cnt, block->type);
+  submit_wait (block, sector, cnt, (void *) buffer, true);
+  block->write_cnt += cnt;
+  thread_current ()->rusage.write_sectors += cnt;
+}
+
+/* Has BLOCK's driver transfer CNT sectors starting at SECTOR
+   between the device and BUFFER, which must have room for CNT *
+   BLOCK_SECTOR_SIZE bytes. */
+static void
+transfer (struct block *block, block_sector_t sector, size_t cnt,
+          void *buffer, bool write)
+{
+  const struct block_operations *ops = block->ops;
+  uint8_t *p = buffer;
+  size_t i;
+
+  if (write && ops->write_multiple != NULL)
+    ops->write_multiple (block->aux, sector, cnt, buffer);
+  else if (!write && ops->read_multiple != NULL)
+    ops->read_multiple (block->aux, sector, cnt, buffer);
+  else
+    for (i = 0; i < cnt; i++)
+      if (write)
+        ops->write (block->aux, sector + i, p + i * BLOCK_SECTOR_SIZE);
+      else
+        ops->read (block->aux, sector + i, p + i * BLOCK_SECTOR_SIZE);
+}
+
+/* Returns the device at the bottom of BLOCK's stack, which is
+   BLOCK itself if it is not stacked. */
+static struct block *
+bottom (struct block *block)
+{
+  block_sector_t sector = 0;
+
+  while (block->ops->lower != NULL)
+    block = block->ops->lower (block->aux, &sector);
+  return block;
+}
+
+/* Returns the index of the running thread's flow in Q, setting
+   one up if it has none.  Q's lock must be held. */
+static int
+find_flow (struct block_queue *q)
+{
+  struct thread *t = thread_current ();
+  struct block_flow *f;
+  int i, idle = -1;
+
+  ASSERT (lock_held_by_current_thread (&q->lock));
+
+  for (i = 0; i < FLOW_CNT; i++)
+    if (q->flows[i].owner == t->tid)
+      break;
+    else if (idle < 0 && q->flows[i].pending == 0)
+      idle = i;
+  if (i >= FLOW_CNT)
+    {
+      i = idle >= 0 ? idle : 0;
+      f = &q->flows[i];
+      if (f->pending == 0)
+        {
+          f->owner = t->tid;
+          f->finish = q->vtime;
+          f->tokens = 0;
+          f->refill = timer_ticks ();
+        }
+    }
+
+  f = &q->flows[i];
+  if (f->owner == t->tid)
+    {
+      f->weight = t->io_weight;
+      if (f->rate == 0 && t->io_rate != 0)
+        f->refill = timer_ticks ();
+      f->rate = t->io_rate;
+    }
+  return i;
+}
+
+/* Adds R, which is about to be queued in Q, to its submitter's
+   flow and gives it its virtual start time.  Q's lock must be
+   held. */
+static void
+add_to_flow (struct block_queue *q, struct block_request *r)
+{
+  struct block_flow *f;
+
+  r->flow = find_flow (q);
+  f = &q->flows[r->flow];
+  r->tag = f->finish > q->vtime ? f->finish : q->vtime;
+  f->finish = r->tag + (uint64_t) r->cnt * IOPRIO_WEIGHT_MAX / f->weight;
+  f->pending++;
+}
+
+/* Returns true if flow F, which has requests pending, is not held
+   back by its bandwidth cap as of timer tick NOW, after crediting
+   it with the tokens it has earned since it was last checked. */
+static bool
+flow_ready (struct block_flow *f, int64_t now)
+{
+  int64_t burst;
+
+  if (f->rate == 0)
+    return true;
+
+  burst = (int64_t) f->rate * FLOW_BURST_TICKS;
+  if (burst < MERGE_MAX * TIMER_FREQ)
+    burst = MERGE_MAX * TIMER_FREQ;
+  f->tokens += (now - f->refill) * f->rate;
+  if (f->tokens > burst)
+    f->tokens = burst;
+  f->refill = now;
+  return f->tokens > 0;
+}
+
+/* Removes R, about to be dispatched, from Q and charges its flow
+   for it.  Q's lock must be held. */
+static void
+take_request (struct block_queue *q, struct block_request *r)
+{
+  struct block_flow *f = &q->flows[r->flow];
+
+  list_remove (&r->elem);
+  f->pending--;
+  if (f->rate != 0)
+    f->tokens -= (int64_t) r->cnt * TIMER_FREQ;
+}
+
+/* Queues R on the device that carries out its transfer: R's
+   device itself, or the device at the bottom of its stack, with
+   R's sector translated accordingly. */
+static void
+enqueue (struct block_request *r)
+{
+  struct block_queue *q;
+
+  while (r->block->ops->lower != NULL)
+    r->block = r->block->ops->lower (r->block->aux, &r->sector);
+  q = r->block->queue;
+
+  lock_acquire (&q->lock);
+  r->start = timer_tsc ();
+  if (++q->stats.depth > q->stats.max_depth)
+    q->stats.max_depth = q->stats.depth;
+  add_to_flow (q, r);
+  list_push_back (&q->requests, &r->elem);
+  cond_signal (&q->pending, &q->lock);
+  lock_release (&q->lock);
+}
+
+/* Submits R, which must be filled in as described in
+   devices/block.h, and returns without waiting for the transfer.
+   R->done is called once it is complete. */
+void
+block_submit (struct block_request *r)
+{
+  if (r->cnt == 0)
+    {
+      r->done (r);
+      return;
+    }
+  check_sector (r->block, r->sector);
+  check_sector (r->block, r->sector + r->cnt - 1);
+  if (r->write)
+    {
+      ASSERT (r->block->type != BLOCK_FOREIGN);
+      r->block->write_cnt += r->cnt;
+      thread_current ()->rusage.write_sectors += r->cnt;
+    }
+  else
+    {
+      r->block->read_cnt += r->cnt;
+      thread_current ()->rusage.read_sectors += r->cnt;
+    }
+  enqueue (r);
+}
+
+/* Completion function for submit_wait(). */
+static void
+wake_submitter (struct block_request *r)
+{
+  sema_up (r->aux);
+}
+
+/* Carries out a transfer of CNT sectors starting at SECTOR
+   between BLOCK and BUFFER through BLOCK's request queue, and
+   waits for it to complete. */
+static void
+submit_wait (struct block *block, block_sector_t sector, size_t cnt,
+             void *buffer, bool write)
+{
+  struct block_request r;
+  struct semaphore done;
+
+  sema_init (&done, 0);
+  r.block = block;
+  r.sector = sector;
+  r.cnt = cnt;
+  r.buffer = buffer;
+  r.write = write;
+  r.done = wake_submitter;
+  r.aux = &done;
+  enqueue (&r);
+  sema_down (&done);
+}
+
+/* Removes and returns the request in Q to serve next: the one
+   that C-SCAN picks from the flow due next.  Returns a null
+   pointer if every flow with requests pending is at its
+   bandwidth cap.  Q must not be empty and its lock must be
+   held. */
+static struct block_request *
+next_request (struct block_queue *q)
+{
+  struct block_request *first = NULL, *ahead = NULL, *lowest = NULL;
+  bool ready[FLOW_CNT];
+  bool throttled = false;
+  int64_t now = timer_ticks ();
+  struct list_elem *e;
+  int i;
+
+  ASSERT (lock_held_by_current_thread (&q->lock));
+  ASSERT (!list_empty (&q->requests));
+
+  for (i = 0; i < FLOW_CNT; i++)
+    {
+      ready[i] = q->flows[i].pending > 0 && flow_ready (&q->flows[i], now);
+      if (q->flows[i].pending > 0 && !ready[i])
+        throttled = true;
+    }
+  if (throttled)
+    q->stats.throttle_cnt++;
+
+  /* The flow due next. */
+  for (e = list_begin (&q->requests); e != list_end (&q->requests);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (ready[r->flow] && (first == NULL || r->tag < first->tag))
+        first = r;
+    }
+  if (first == NULL)
+    return NULL;
+  if (first->tag > q->vtime)
+    q->vtime = first->tag;
+
+  /* C-SCAN within it. */
+  for (e = list_begin (&q->requests); e != list_end (&q->requests);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->flow != first->flow)
+        continue;
+      if (r->sector >= q->head && (ahead == NULL || r->sector < ahead->sector))
+        ahead = r;
+      if (lowest == NULL || r->sector < lowest->sector)
+        lowest = r;
+    }
+  if (ahead == NULL)
+    ahead = lowest;
+  take_request (q, ahead);
+  return ahead;
+}
+
+/* Removes from Q and returns a request in the same direction as
+   FIRST that starts at sector END, if there is one, it fits with
+   the TOTAL sectors gathered so far in a merge, and its flow is
+   not at its bandwidth cap.  Any flow's request may join, since
+   it costs almost nothing extra.  Returns a null pointer
+   otherwise.  Q's lock must be held. */
+static struct block_request *
+next_merge (struct block_queue *q, const struct block_request *first,
+            block_sector_t end, size_t total)
+{
+  struct list_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&q->lock));
+
+  for (e = list_begin (&q->requests); e != list_end (&q->requests);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      const struct block_flow *f = &q->flows[r->flow];
+      if (r->sector == end && r->write == first->write
+          && total + r->cnt <= MERGE_MAX
+          && (f->rate == 0 || f->tokens > 0))
+        {
+          take_request (q, r);
+          return r;
+        }
+    }
+  return NULL;
+}
+
+/* Dispatcher thread for block device BLOCK_.  Takes requests off
+   the device's queue in C-SCAN order, merges those that continue
+   one another, has the driver carry them out, and calls their
+   completion functions. */
+static void
+dispatcher (void *block_)
+{
+  struct block *block = block_;
+  struct block_queue *q = block->queue;
+
+  for (;;)
+    {
+      struct block_request *batch[MERGE_MAX];
+      size_t batch_cnt, total, i;
+
+      lock_acquire (&q->lock);
+      for (;;)
+        {
+          while (list_empty (&q->requests))
+            cond_wait (&q->pending, &q->lock);
+          batch[0] = next_request (q);
+          if (batch[0] != NULL)
+            break;
+
+          /* Everything pending is capped.  Wait for tokens. */
+          lock_release (&q->lock);
+          timer_sleep (1);
+          lock_acquire (&q->lock);
+        }
+      batch_cnt = 1;
+      total = batch[0]->cnt;
+      if (total < MERGE_MAX)
+        {
+          struct block_request *r;
+          while ((r = next_merge (q, batch[0], batch[0]->sector + total,
+                                  total)) != NULL)
+            {
+              batch[batch_cnt++] = r;
+              total += r->cnt;
+            }
+        }
+      if (batch[0]->sector != q->head)
+        q->stats.seek_cnt++;
+      q->head = batch[0]->sector + total;
+      q->stats.merge_cnt += batch_cnt - 1;
+      q->stats.heat[(uint64_t) batch[0]->sector * BLOCKSTATS_HEAT_CNT
+                    / block->size] += total;
+      lock_release (&q->lock);
+
+      if (batch_cnt == 1)
+        transfer (block, batch[0]->sector, total, batch[0]->buffer,
+                  batch[0]->write);
+      else
+        {
+          uint8_t *p = q->bounce;
+
+          if (batch[0]->write)
+            for (i = 0; i < batch_cnt; i++)
+              {
+                memcpy (p, batch[i]->buffer, batch[i]->cnt * BLOCK_SECTOR_SIZE);
+                p += batch[i]->cnt * BLOCK_SECTOR_SIZE;
+              }
+          transfer (block, batch[0]->sector, total, q->bounce,
+                    batch[0]->write);
+          if (!batch[0]->write)
+            for (i = 0; i < batch_cnt; i++)
+              {
+                memcpy (batch[i]->buffer, p, batch[i]->cnt * BLOCK_SECTOR_SIZE);
+                p += batch[i]->cnt * BLOCK_SECTOR_SIZE;
+              }
+        }
+
+      lock_acquire (&q->lock);
+      for (i = 0; i < batch_cnt; i++)
+        {
+          uint64_t cycles = (timer_tsc () - batch[i]->start) >> 10;
+          int bucket = 0;
+
+          while (cycles > 0 && bucket < BLOCKSTATS_LATENCY_CNT - 1)
+            {
+              cycles >>= 1;
+              bucket++;
+            }
+          q->stats.latency[bucket]++;
+        }
+      q->stats.request_cnt += batch_cnt;
+      q->stats.depth -= batch_cnt;
+      lock_release (&q->lock);
+
+      for (i = 0; i < batch_cnt; i++)
+        batch[i]->done (batch[i]);
+    }
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,13 +677,54 @@ block_type (struct block *block)
   return block->type;
 }
 
-/* Prints statistics for each block device used for a Pintos role. */
+/* Stores a snapshot of BLOCK's statistics into STATS.  For a
+   stacked device, all but the sector counts come from the device
+   at the bottom of the stack. */
+void
+block_get_stats (struct block *block, struct block_stats *stats)
+{
+  struct block_queue *q = bottom (block)->queue;
+
+  lock_acquire (&q->lock);
+  *stats = q->stats;
+  lock_release (&q->lock);
+  stats->read_cnt = block->read_cnt;
+  stats->write_cnt = block->write_cnt;
+}
+
+/* Prints BLOCK's request queue statistics. */
+static void
+print_queue_stats (struct block *block)
+{
+  struct block_stats stats;
+  int i;
+
+  block_get_stats (block, &stats);
+  printf ("%s: %llu requests, %llu merged, %llu seeks, %llu throttled, "
+          "max depth %u, %llu bytes\n",
+          block->name, stats.request_cnt, stats.merge_cnt, stats.seek_cnt,
+          stats.throttle_cnt, stats.max_depth,
+          (stats.read_cnt + stats.write_cnt) * BLOCK_SECTOR_SIZE);
+  printf ("%s: latency (log2 cycles):", block->name);
+  for (i = 0; i < BLOCKSTATS_LATENCY_CNT; i++)
+    if (stats.latency[i] > 0)
+      printf (" %d:%u", i + 10, stats.latency[i]);
+  printf ("\n%s: sectors by 1/%d of disk:", block->name, BLOCKSTATS_HEAT_CNT);
+  for (i = 0; i < BLOCKSTATS_HEAT_CNT; i++)
+    printf (" %llu", stats.heat[i]);
+  printf ("\n");
+}
+
+/* Prints statistics for each block device used for a Pintos role,
+   then request queue statistics for each device that has been
+   used. */
 void
 block_print_stats (void)
 {
+  struct list_elem *e;
   int i;
 
-  for (i = 0; i < BLOCK_CNT; i++)
+  for (i = 0; i < BLOCK_ROLE_CNT; i++)
     {
       struct block *block = block_by_role[i];
       if (block != NULL)
@@ -176,6 +734,14 @@ block_print_stats (void)
                   block->read_cnt, block->write_cnt);
         }
     }
+
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
+    {
+      struct block *block = list_entry (e, struct block, list_elem);
+      if (block->queue != NULL && block->queue->stats.request_cnt > 0)
+        print_queue_stats (block);
+    }
 }
 
 /* Registers a new block device with the given NAME.  If
@@ -189,6 +755,8 @@ block_register (const char *name, enum block_type type,
                 const struct block_operations *ops, void *aux)
 {
   struct block *block = malloc (sizeof *block);
+  int i;
+
   if (block == NULL)
     PANIC ("Failed to allocate memory for block device descriptor");
 
@@ -200,6 +768,30 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->queue = NULL;
+  if (ops->lower == NULL)
+    {
+      struct block_queue *q = malloc (sizeof *q);
+      if (q == NULL)
+        PANIC ("Failed to allocate memory for block device queue");
+      lock_init (&q->lock);
+      cond_init (&q->pending);
+      list_init (&q->requests);
+      q->head = 0;
+      q->vtime = 0;
+      for (i = 0; i < FLOW_CNT; i++)
+        {
+          q->flows[i].owner = TID_ERROR;
+          q->flows[i].pending = 0;
+          q->flows[i].weight = IOPRIO_WEIGHT_DEFAULT;
+          q->flows[i].rate = 0;
+        }
+      q->bounce = palloc_get_multiple (PAL_ASSERT,
+                                       MERGE_MAX * BLOCK_SECTOR_SIZE / PGSIZE);
+      memset (&q->stats, 0, sizeof q->stats);
+      block->queue = q;
+      thread_create (block->name, PRI_MAX, dispatcher, block);
+    }
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -1,8 +1,11 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <list.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <syscall-nr.h>
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,18 +56,65 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt, void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* Asynchronous block I/O.
+
+   The submitter fills in the first group of members and passes
+   the request to block_submit(), which returns at once.  When the
+   transfer is complete, DONE is called with the request, from the
+   device's dispatcher thread.  DONE must not sleep; it should
+   typically just up a semaphore.  The request and its buffer must
+   stay valid until then. */
+struct block_request;
+typedef void block_done_func (struct block_request *);
+
+struct block_request
+  {
+    struct block *block;                /* Device. */
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+    void *buffer;                       /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    bool write;                         /* Write (else read)? */
+    block_done_func *done;              /* Called on completion. */
+    void *aux;                          /* For use by DONE. */
+
+    /* Owned by the block layer. */
+    struct list_elem elem;              /* Element in request queue. */
+    uint64_t start;                     /* CPU cycle count when queued. */
+    int flow;                           /* Index of submitter's flow. */
+    uint64_t tag;                       /* Virtual start time. */
+  };
+
+void block_submit (struct block_request *);
+
 /* Statistics. */
+void block_get_stats (struct block *, struct block_stats *);
 void block_print_stats (void);
 
 /* Lower-level interface to block device drivers. */
 
+/* READ_MULTIPLE and WRITE_MULTIPLE transfer CNT consecutive
+   sectors at once.  They are optional: if null, the block layer
+   transfers one sector at a time with READ and WRITE.
+
+   LOWER is non-null for a device stacked on another one, such as a
+   partition.  It returns the device below and translates *SECTOR
+   into a sector on that device.  The block layer queues and
+   schedules requests only on devices that are not stacked. */
 struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+    void (*read_multiple) (void *aux, block_sector_t, size_t cnt,
+                           void *buffer);
+    void (*write_multiple) (void *aux, block_sector_t, size_t cnt,
+                            const void *buffer);
+    struct block *(*lower) (void *aux, block_sector_t *sector);
   };
 
 struct block *block_register (const char *name, enum block_type,
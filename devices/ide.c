@@ -9,9 +9,15 @@
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   Transfers use bus-master DMA when the PCI IDE controller and
+   the disk both support it, so that the CPU does not have to move
+   every word through the data register.  Otherwise they fall back
+   to PIO. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -30,10 +36,25 @@
 #define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /* Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /* Alt Status (r/o). */
 
+/* Bus master IDE port addresses, relative to the channel's
+   bus master base found through PCI. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prd(CHANNEL) ((CHANNEL)->bm_base + 4)     /* PRD table. */
+
+/* Bus master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus master Status Register bits. */
+#define BM_STA_ERR 0x02         /* Transfer failed (write 1 to clear). */
+#define BM_STA_INTR 0x04        /* Interrupt raised (write 1 to clear). */
+
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +70,33 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Most sectors moved by one READ or WRITE command.  The sector
+   count register is 8 bits wide. */
+#define MAX_TRANSFER 128
+
+/* Most sectors per interrupt we ask for in multiple mode. */
+#define MAX_MULTIPLE 16
+
+/* A physical region descriptor, one entry in the table that tells
+   the bus master where in memory a DMA transfer goes.  A region
+   may not cross a 64 kB boundary; a size of 0 means 64 kB. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address of region. */
+    uint16_t size;              /* Bytes in region. */
+    uint16_t flags;             /* PRD_EOT on the last entry. */
+  };
+#define PRD_EOT 0x8000          /* End of table. */
+
+/* Entries per PRD table.  A MAX_TRANSFER run of 64 kB crosses at
+   most one 64 kB boundary. */
+#define PRD_CNT 2
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +105,9 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per interrupt in multiple
+                                   mode, or 0 if not in use. */
+    bool dma;                   /* Does the disk support DMA? */
   };
 
 /* An ATA channel (aka controller).
@@ -66,11 +117,16 @@ struct channel
     char name[8];               /* Name, e.g. "ide0". */
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
+    uint16_t bm_base;           /* Bus master base port, or 0 if the
+                                   channel can only do PIO. */
+    struct prd *prd;            /* PRD table for DMA transfers. */
 
     struct lock lock;           /* Must acquire to access the controller. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
+    struct intr_work unexpected_work;   /* Reports unexpected interrupts. */
+    unsigned unexpected_cnt;    /* Unexpected interrupts not yet reported. */
 
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
@@ -79,14 +135,24 @@ struct channel
 #define CHANNEL_CNT 2
 static struct channel channels[CHANNEL_CNT];
 
+/* PRD tables, aligned so that none crosses a 64 kB boundary, as
+   the bus master requires. */
+static struct prd prd_tables[CHANNEL_CNT][PRD_CNT]
+  __attribute__ ((aligned (sizeof (struct prd) * PRD_CNT)));
+
 static struct block_operations ide_operations;
 
+static uint16_t find_bus_master (void);
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
+static void set_multiple_mode (struct ata_disk *, int sectors);
 static void issue_pio_command (struct channel *, uint8_t command);
+static bool can_dma (const struct ata_disk *, const void *buffer);
+static void dma_transfer (struct ata_disk *, block_sector_t, size_t cnt,
+                          void *buffer, bool write);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
 
@@ -96,13 +162,18 @@ static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
 static void interrupt_handler (struct intr_frame *);
+static intr_work_func report_unexpected;
 
 /* Initialize the disk subsystem and detect disks. */
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
 
+  if (bm_base != 0)
+    printf ("ide: bus master DMA at port 0x%04x\n", (unsigned) bm_base);
+
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
       struct channel *c = &channels[chan_no];
@@ -123,9 +194,14 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
+      c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
+      c->prd = prd_tables[chan_no];
       lock_init (&c->lock);
+      lock_set_name (&c->lock, "ide channel");
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      intr_work_init (&c->unexpected_work, report_unexpected, c);
+      c->unexpected_cnt = 0;
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +212,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -159,6 +237,82 @@ ide_init (void)
 
 static char *descramble_ata_string (char *, int size);
 
+/* PCI configuration space ports and offsets. */
+#define PCI_CONFIG_ADDR 0xcf8   /* Configuration address. */
+#define PCI_CONFIG_DATA 0xcfc   /* Configuration data. */
+#define PCI_REG_ID 0x00         /* Device and vendor ID. */
+#define PCI_REG_COMMAND 0x04    /* Status and command. */
+#define PCI_REG_CLASS 0x08      /* Class, subclass, interface, revision. */
+#define PCI_REG_HEADER 0x0c     /* Header type in bits 16...23. */
+#define PCI_REG_BAR4 0x20       /* Base address register 4. */
+#define PCI_CMD_MASTER 0x04     /* Bus master enable. */
+
+/* Reads the 32-bit register at byte offset REG in the PCI
+   configuration space of BUS:DEV.FUNC. */
+static uint32_t
+pci_read (int bus, int dev, int func, int reg)
+{
+  outl (PCI_CONFIG_ADDR,
+        0x80000000 | (bus << 16) | (dev << 11) | (func << 8) | reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes DATA to the 32-bit register at byte offset REG in the
+   PCI configuration space of BUS:DEV.FUNC. */
+static void
+pci_write (int bus, int dev, int func, int reg, uint32_t data)
+{
+  outl (PCI_CONFIG_ADDR,
+        0x80000000 | (bus << 16) | (dev << 11) | (func << 8) | reg);
+  outl (PCI_CONFIG_DATA, data);
+}
+
+/* Looks on the PCI bus for an IDE controller that drives the
+   legacy channels and can act as a bus master.  If there is one,
+   enables bus mastering and returns its bus master base port.
+   Returns 0 otherwise. */
+static uint16_t
+find_bus_master (void)
+{
+  int bus, dev, func;
+
+  for (bus = 0; bus < 256; bus++)
+    for (dev = 0; dev < 32; dev++)
+      for (func = 0; func < 8; func++)
+        {
+          uint32_t class, bar;
+
+          if ((pci_read (bus, dev, func, PCI_REG_ID) & 0xffff) == 0xffff)
+            {
+              if (func == 0)
+                break;
+              continue;
+            }
+
+          /* Class 1, subclass 1 is an IDE controller.  Interface
+             bit 7 means bus master capable; bits 0 and 2 mean a
+             channel is in native rather than legacy mode. */
+          class = pci_read (bus, dev, func, PCI_REG_CLASS);
+          bar = pci_read (bus, dev, func, PCI_REG_BAR4);
+          if ((class >> 16) == 0x0101
+              && (class & 0x8000) != 0
+              && (class & 0x0500) == 0
+              && (bar & 1) != 0)
+            {
+              uint32_t cmd = pci_read (bus, dev, func, PCI_REG_COMMAND);
+              pci_write (bus, dev, func, PCI_REG_COMMAND,
+                         (cmd & 0xffff) | PCI_CMD_MASTER);
+              return bar & 0xfffc;
+            }
+
+          /* Only multi-function devices have functions 1...7. */
+          if (func == 0
+              && !(pci_read (bus, dev, func, PCI_REG_HEADER) & 0x800000))
+            break;
+        }
+  return 0;
+}
+
 /* Resets an ATA channel and waits for any devices present on it
    to finish the reset. */
 static void
@@ -281,6 +435,16 @@ identify_ata_device (struct ata_disk *d)
     }
   input_sector (c, id);
 
+  /* Use READ/WRITE MULTIPLE if the disk supports it, so that a
+     transfer interrupts once per several sectors.  The low byte of
+     word 47 is the most sectors per interrupt. */
+  if ((id[47 * 2] & 0xff) > 0)
+    set_multiple_mode (d, (id[47 * 2] & 0xff) < MAX_MULTIPLE
+                          ? id[47 * 2] & 0xff : MAX_MULTIPLE);
+
+  /* Bit 8 of word 49 says whether the disk can do DMA. */
+  d->dma = (id[49 * 2 + 1] & 0x01) != 0;
+
   /* Calculate capacity.
      Read model name and serial number. */
   capacity = *(uint32_t *) &id[60 * 2];
@@ -337,63 +501,162 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes.  Each
+   command moves up to MAX_TRANSFER sectors, with one interrupt per
+   sector, or per D->multiple sectors in multiple mode.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read_multiple (void *d_, block_sector_t sec_no, size_t cnt, void *buffer)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  size_t per_intr = d->multiple > 0 ? d->multiple : 1;
+  uint8_t *p = buffer;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_TRANSFER ? cnt : MAX_TRANSFER;
+      size_t done, i;
+
+      if (can_dma (d, p))
+        {
+          dma_transfer (d, sec_no, n, p, false);
+          p += n * BLOCK_SECTOR_SIZE;
+          sec_no += n;
+          cnt -= n;
+          continue;
+        }
+
+      select_sector (d, sec_no, n);
+      issue_pio_command (c, d->multiple > 0
+                            ? CMD_READ_MULTIPLE : CMD_READ_SECTOR_RETRY);
+      for (done = 0; done < n; )
+        {
+          sema_down (&c->completion_wait);
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                   d->name, sec_no + done);
+          for (i = 0; i < per_intr && done < n; i++, done++)
+            {
+              input_sector (c, p);
+              p += BLOCK_SECTOR_SIZE;
+            }
+        }
+      sec_no += n;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes.  Returns
+   after the disk has acknowledged receiving the data.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_write_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                    const void *buffer)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  size_t per_intr = d->multiple > 0 ? d->multiple : 1;
+  const uint8_t *p = buffer;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_TRANSFER ? cnt : MAX_TRANSFER;
+      size_t done, i;
+
+      if (can_dma (d, p))
+        {
+          dma_transfer (d, sec_no, n, (void *) p, true);
+          p += n * BLOCK_SECTOR_SIZE;
+          sec_no += n;
+          cnt -= n;
+          continue;
+        }
+
+      select_sector (d, sec_no, n);
+      issue_pio_command (c, d->multiple > 0
+                            ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR_RETRY);
+      for (done = 0; done < n; )
+        {
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, sec_no + done);
+          for (i = 0; i < per_intr && done < n; i++, done++)
+            {
+              output_sector (c, p);
+              p += BLOCK_SECTOR_SIZE;
+            }
+          sema_down (&c->completion_wait);
+        }
+      sec_no += n;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
 
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes. */
+static void
+ide_read (void *d, block_sector_t sec_no, void *buffer)
+{
+  ide_read_multiple (d, sec_no, 1, buffer);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data. */
+static void
+ide_write (void *d, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multiple (d, sec_no, 1, buffer);
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple,
+    NULL
   };
-
+
+/* Puts disk D into multiple mode with SECTORS sectors per
+   interrupt.  Leaves D->multiple at 0 if the disk refuses. */
+static void
+set_multiple_mode (struct ata_disk *d, int sectors)
+{
+  struct channel *c = d->channel;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), sectors);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if (!(inb (reg_status (c)) & STA_ERR))
+    d->multiple = sectors;
+}
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO to the disk's sector selection registers, to
+   transfer CNT sectors, which must be between 1 and
+   MAX_TRANSFER.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= MAX_TRANSFER);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -414,6 +677,73 @@ issue_pio_command (struct channel *c, uint8_t command)
   outb (reg_command (c), command);
 }
 
+/* Returns true if a transfer between disk D and BUFFER can use
+   DMA: the channel has a bus master, the disk supports DMA, and
+   BUFFER is a word-aligned kernel address, which the kernel maps
+   to contiguous physical memory. */
+static bool
+can_dma (const struct ata_disk *d, const void *buffer)
+{
+  return (d->channel->bm_base != 0
+          && d->dma
+          && is_kernel_vaddr (buffer)
+          && ((uintptr_t) buffer & 1) == 0);
+}
+
+/* Transfers CNT sectors, at most MAX_TRANSFER, starting at SEC_NO
+   between disk D and BUFFER by bus-master DMA: from the disk into
+   BUFFER if WRITE is false, from BUFFER to the disk otherwise.
+   Sleeps until the completion interrupt.  The channel lock must
+   be held. */
+static void
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              void *buffer, bool write)
+{
+  struct channel *c = d->channel;
+  uintptr_t addr = vtop (buffer);
+  size_t left = cnt * BLOCK_SECTOR_SIZE;
+  uint8_t direction = write ? 0 : BM_CMD_READ;
+  uint8_t bm_status;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+  ASSERT (cnt >= 1 && cnt <= MAX_TRANSFER);
+
+  /* Describe the buffer, splitting it at 64 kB boundaries. */
+  for (i = 0; left > 0; i++)
+    {
+      size_t room = 0x10000 - (addr & 0xffff);
+      size_t size = left < room ? left : room;
+
+      ASSERT (i < PRD_CNT);
+      c->prd[i].addr = addr;
+      c->prd[i].size = size & 0xffff;
+      c->prd[i].flags = 0;
+      addr += size;
+      left -= size;
+    }
+  c->prd[i - 1].flags = PRD_EOT;
+
+  /* Set up the bus master, then start the disk and the bus
+     master in that order. */
+  outl (reg_bm_prd (c), vtop (c->prd));
+  outb (reg_bm_command (c), direction);
+  outb (reg_bm_status (c), BM_STA_ERR | BM_STA_INTR);
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_command (c), direction | BM_CMD_START);
+
+  sema_down (&c->completion_wait);
+
+  outb (reg_bm_command (c), direction);
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_status (c), BM_STA_ERR | BM_STA_INTR);
+  wait_while_busy (d);
+  if ((bm_status & BM_STA_ERR) || (inb (reg_status (c)) & STA_ERR))
+    PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+           d->name, write ? "write" : "read", sec_no);
+}
+
 /* Reads a sector from channel C's data register in PIO mode into
    SECTOR, which must have room for BLOCK_SECTOR_SIZE bytes. */
 static void
@@ -517,11 +847,37 @@ interrupt_handler (struct intr_frame *f)
             sema_up (&c->completion_wait);      /* Wake up waiter. */
           }
         else
-          printf ("%s: unexpected interrupt\n", c->name);
+          {
+            /* Printing to the console is slow, so leave it to
+               deferred work instead of keeping interrupts off. */
+            c->unexpected_cnt++;
+            intr_defer (&c->unexpected_work);
+          }
         return;
       }
 
   NOT_REACHED ();
 }
 
+/* Reports the unexpected interrupts counted on channel C_. */
+static void
+report_unexpected (void *c_)
+{
+  struct channel *c = c_;
+  enum intr_level old_level;
+  unsigned cnt;
+
+  old_level = intr_disable ();
+  cnt = c->unexpected_cnt;
+  c->unexpected_cnt = 0;
+  intr_set_level (old_level);
+
+  if (cnt == 0)
+    return;
+  if (cnt == 1)
+    printf ("%s: unexpected interrupt\n", c->name);
+  else
+    printf ("%s: %u unexpected interrupts\n", c->name, cnt);
+}
+
 
@@ -2,15 +2,20 @@
 #include <debug.h>
 #include "devices/intq.h"
 #include "devices/serial.h"
+#include "threads/poll.h"
 
 /* Stores keys from the keyboard and serial port. */
 static struct intq buffer;
 
+/* Threads in poll() on the console input. */
+static struct poll_queue pollers;
+
 /* Initializes the input buffer. */
 void
 input_init (void) 
 {
   intq_init (&buffer);
+  poll_queue_init (&pollers);
 }
 
 /* Adds a key to the input buffer.
@@ -23,6 +28,7 @@ input_putc (uint8_t key)
 
   intq_putc (&buffer, key);
   serial_notify ();
+  poll_wake (&pollers);
 }
 
 /* Retrieves a key from the input buffer.
@@ -41,6 +47,50 @@ input_getc (void)
   return key;
 }
 
+/* Moves up to SIZE bytes from the input buffer into BUF and
+   returns the number moved.  If the buffer is empty, waits for a
+   key to be pressed if BLOCK is true, and otherwise returns 0.
+   Interrupts are off while BUF is filled, so it must not be user
+   memory. */
+size_t
+input_read (uint8_t *buf, size_t size, bool block) 
+{
+  enum intr_level old_level;
+  size_t cnt = 0;
+
+  if (size == 0)
+    return 0;
+  old_level = intr_disable ();
+  if (block || !intq_empty (&buffer))
+    {
+      buf[cnt++] = intq_getc (&buffer);
+      while (cnt < size && !intq_empty (&buffer))
+        buf[cnt++] = intq_getc (&buffer);
+      serial_notify ();
+    }
+  intr_set_level (old_level);
+  return cnt;
+}
+
+/* Returns true if a key is waiting in the input buffer. */
+bool
+input_ready (void) 
+{
+  enum intr_level old_level = intr_disable ();
+  bool ready = !intq_empty (&buffer);
+
+  intr_set_level (old_level);
+  return ready;
+}
+
+/* Adds W to the waiters that each key added to the input buffer
+   wakes by upping SEMA. */
+void
+input_poll_add (struct poll_waiter *w, struct semaphore *sema) 
+{
+  poll_queue_add (&pollers, w, sema);
+}
+
 /* Returns true if the input buffer is full,
    false otherwise.
    Interrupts must be off. */
@@ -2,11 +2,18 @@
 #define DEVICES_INPUT_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+struct poll_waiter;
+struct semaphore;
+
 void input_init (void);
 void input_putc (uint8_t);
 uint8_t input_getc (void);
+size_t input_read (uint8_t *, size_t, bool block);
 bool input_full (void);
+bool input_ready (void);
+void input_poll_add (struct poll_waiter *, struct semaphore *);
 
 #endif /* devices/input.h */
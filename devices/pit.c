@@ -11,9 +11,6 @@
 #define PIT_PORT_CONTROL          0x43                /* Control port. */
 #define PIT_PORT_COUNTER(CHANNEL) (0x40 + (CHANNEL))  /* Counter port. */
 
-/* PIT cycles per second. */
-#define PIT_HZ 1193180
-
 /* Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
 
@@ -81,3 +78,45 @@ pit_configure_channel (int channel, int mode, int frequency)
   outb (PIT_PORT_COUNTER (channel), count >> 8);
   intr_set_level (old_level);
 }
+
+/* Starts a one-shot count of COUNT PIT cycles on CHANNEL, using
+   mode 0 ("interrupt on terminal count"): the channel's output
+   drops to 0 and rises to 1 when the count runs out, which on
+   channel 0 raises a single timer interrupt.  The channel stays
+   quiet after that until it is reprogrammed. */
+void
+pit_start_oneshot (int channel, uint16_t count)
+{
+  enum intr_level old_level;
+
+  ASSERT (channel == 0 || channel == 2);
+  ASSERT (count != 0);
+
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, (channel << 6) | 0x30);
+  outb (PIT_PORT_COUNTER (channel), count);
+  outb (PIT_PORT_COUNTER (channel), count >> 8);
+  intr_set_level (old_level);
+}
+
+/* Returns the current count of CHANNEL, and stores the state of
+   its output in *OUT.  Uses the read-back command to latch the
+   status and the count together. */
+uint16_t
+pit_read_channel (int channel, bool *out)
+{
+  enum intr_level old_level;
+  uint8_t status, lo, hi;
+
+  ASSERT (channel == 0 || channel == 2);
+
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, 0xc0 | (2 << channel));
+  status = inb (PIT_PORT_COUNTER (channel));
+  lo = inb (PIT_PORT_COUNTER (channel));
+  hi = inb (PIT_PORT_COUNTER (channel));
+  intr_set_level (old_level);
+
+  *out = (status & 0x80) != 0;
+  return lo | (hi << 8);
+}
@@ -0,0 +1,79 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <string.h>
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A RAM disk.
+
+   The disk's sectors are kept in a run of pages from the user
+   pool, so that its size does not eat into the kernel pool, and
+   each transfer is a memcpy.  Its contents are gone at shutdown,
+   so it suits scratch files and test runs that format their file
+   system with -f on every boot.  It is registered as a raw
+   device, so it takes a role only when named by an option such
+   as -filesys or -scratch. */
+
+static struct block_operations ramdisk_operations;
+
+/* Registers and returns a RAM disk named NAME of SIZE sectors,
+   which reads as zeros until written.  Panics if there is not
+   enough memory. */
+struct block *
+ramdisk_create (const char *name, block_sector_t size)
+{
+  size_t page_cnt = DIV_ROUND_UP (size * BLOCK_SECTOR_SIZE, PGSIZE);
+  uint8_t *base;
+
+  if (size == 0)
+    PANIC ("%s: RAM disk must have at least one sector", name);
+  base = palloc_get_multiple (PAL_USER | PAL_ZERO, page_cnt);
+  if (base == NULL)
+    PANIC ("%s: not enough memory for a %zu-page RAM disk", name, page_cnt);
+  return block_register (name, BLOCK_RAW, "RAM disk", size,
+                         &ramdisk_operations, base);
+}
+
+/* Reads CNT sectors starting at SECTOR from the RAM disk whose
+   memory starts at BASE into BUFFER. */
+static void
+ramdisk_read_multiple (void *base, block_sector_t sector, size_t cnt,
+                       void *buffer)
+{
+  memcpy (buffer, (uint8_t *) base + sector * BLOCK_SECTOR_SIZE,
+          cnt * BLOCK_SECTOR_SIZE);
+}
+
+/* Writes CNT sectors starting at SECTOR to the RAM disk whose
+   memory starts at BASE from BUFFER. */
+static void
+ramdisk_write_multiple (void *base, block_sector_t sector, size_t cnt,
+                        const void *buffer)
+{
+  memcpy ((uint8_t *) base + sector * BLOCK_SECTOR_SIZE, buffer,
+          cnt * BLOCK_SECTOR_SIZE);
+}
+
+/* Reads sector SECTOR from the RAM disk at BASE into BUFFER. */
+static void
+ramdisk_read (void *base, block_sector_t sector, void *buffer)
+{
+  ramdisk_read_multiple (base, sector, 1, buffer);
+}
+
+/* Writes sector SECTOR to the RAM disk at BASE from BUFFER. */
+static void
+ramdisk_write (void *base, block_sector_t sector, const void *buffer)
+{
+  ramdisk_write_multiple (base, sector, 1, buffer);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    ramdisk_read_multiple,
+    ramdisk_write_multiple,
+    NULL
+  };
@@ -0,0 +1,8 @@
+#ifndef DEVICES_RAMDISK_H
+#define DEVICES_RAMDISK_H
+
+#include "devices/block.h"
+
+struct block *ramdisk_create (const char *name, block_sector_t size);
+
+#endif /* devices/ramdisk.h */
@@ -47,6 +47,17 @@
 /* Line Status Register. */
 #define LSR_DR 0x01             /* Data Ready: received data byte is in RBR. */
 #define LSR_THRE 0x20           /* THR Empty. */
+
+/* FIFO Control Register bits. */
+#define FCR_ENABLE 0x01         /* Enable the FIFOs. */
+#define FCR_CLEAR_RECV 0x02     /* Empty the receive FIFO. */
+#define FCR_CLEAR_XMIT 0x04     /* Empty the transmit FIFO. */
+
+/* Interrupt Identification Register bits. */
+#define IIR_FIFO 0xc0           /* FIFOs are enabled. */
+
+/* Bytes the 16550A's transmit FIFO holds. */
+#define XMIT_FIFO_SIZE 16
 
 /* Transmission mode. */
 static enum { UNINIT, POLL, QUEUE } mode;
@@ -54,6 +65,10 @@ static enum { UNINIT, POLL, QUEUE } mode;
 /* Data to be transmitted. */
 static struct intq txq;
 
+/* Bytes that may be written to THR at once when it is empty: the
+   FIFO's size, or 1 on a UART without a working FIFO. */
+static int xmit_burst;
+
 static void set_serial (int bps);
 static void putc_poll (uint8_t);
 static void write_ier (void);
@@ -68,7 +83,9 @@ init_poll (void)
 {
   ASSERT (mode == UNINIT);
   outb (IER_REG, 0);                    /* Turn off all interrupts. */
-  outb (FCR_REG, 0);                    /* Disable FIFO. */
+  outb (FCR_REG, FCR_ENABLE | FCR_CLEAR_RECV | FCR_CLEAR_XMIT);
+  xmit_burst = ((inb (IIR_REG) & IIR_FIFO) == IIR_FIFO
+                ? XMIT_FIFO_SIZE : 1);  /* Did the FIFO turn on? */
   set_serial (9600);                    /* 9.6 kbps, N-8-1. */
   outb (MCR_REG, MCR_OUT2);             /* Required to enable interrupts. */
   intq_init (&txq);
@@ -218,10 +235,16 @@ serial_interrupt (struct intr_frame *f UNUSED)
   while (!input_full () && (inb (LSR_REG) & LSR_DR) != 0)
     input_putc (inb (RBR_REG));
 
-  /* As long as we have a byte to transmit, and the hardware is
-     ready to accept a byte for transmission, transmit a byte. */
-  while (!intq_empty (&txq) && (inb (LSR_REG) & LSR_THRE) != 0) 
-    outb (THR_REG, intq_getc (&txq));
+  /* If the hardware is ready to accept bytes for transmission,
+     fill its FIFO from the queue.  THRE means the whole FIFO is
+     empty, so a full burst fits without checking LSR again. */
+  if ((inb (LSR_REG) & LSR_THRE) != 0)
+    {
+      int i;
+
+      for (i = 0; i < xmit_burst && !intq_empty (&txq); i++)
+        outb (THR_REG, intq_getc (&txq));
+    }
 
   /* Update interrupt enable register based on queue status. */
   write_ier ();
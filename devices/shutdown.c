@@ -2,16 +2,45 @@
 #include <console.h>
 #include <stdio.h>
 #include "devices/kbd.h"
-#include "devices/serial.h"
 #include "devices/timer.h"
+#include "threads/arena.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/profile.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/tracepoint.h"
+#include "threads/workqueue.h"
 #ifdef USERPROG
+#include "userprog/aio.h"
 #include "userprog/exception.h"
+#include "userprog/futex.h"
+#include "userprog/image.h"
+#include "userprog/pipe.h"
+#include "userprog/syscall.h"
 #endif
 #ifdef FILESYS
+#include "devices/bcache.h"
 #include "devices/block.h"
+#include "filesys/cache.h"
+#include "filesys/checksum.h"
+#include "filesys/dcache.h"
+#include "filesys/directory.h"
+#include "filesys/inode.h"
 #include "filesys/filesys.h"
+#include "filesys/free-extent.h"
+#include "filesys/journal.h"
+#include "filesys/refcount.h"
+#endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/shm.h"
+#include "vm/swap.h"
 #endif
 
 /* Keyboard control register port. */
@@ -90,6 +119,9 @@ shutdown_power_off (void)
   const char s[] = "Shutdown";
   const char *p;
 
+#ifdef USERPROG
+  image_flush ();
+#endif
 #ifdef FILESYS
   filesys_done ();
 #endif
@@ -97,7 +129,7 @@ shutdown_power_off (void)
   print_stats ();
 
   printf ("Powering off...\n");
-  serial_flush ();
+  console_flush ();
 
   /* This is a special power-off sequence supported by Bochs and
      QEMU, but not by physical hardware. */
@@ -118,14 +150,44 @@ shutdown_power_off (void)
 static void
 print_stats (void)
 {
+  init_print_stats ();
   timer_print_stats ();
+  intr_print_stats ();
   thread_print_stats ();
+  palloc_print_stats ();
+  malloc_print_stats ();
+  arena_print_stats ();
+  slab_print_stats ();
+  workqueue_print_stats ();
+  lock_print_stats ();
+  profile_dump ();
+  tracepoint_dump ();
 #ifdef FILESYS
   block_print_stats ();
+  bcache_print_stats ();
+  cache_print_stats ();
+  dcache_print_stats ();
+  dir_print_stats ();
+  inode_print_stats ();
+  journal_print_stats ();
+  checksum_print_stats ();
+  refcount_print_stats ();
+  free_extent_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
 #ifdef USERPROG
   exception_print_stats ();
+  syscall_print_stats ();
+  image_print_stats ();
+  pipe_print_stats ();
+  futex_print_stats ();
+  aio_print_stats ();
+#endif
+#ifdef VM
+  frame_print_stats ();
+  page_print_stats ();
+  shm_print_stats ();
+  swap_print_stats ();
 #endif
 }
@@ -0,0 +1,160 @@
+#include "devices/stripe.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* A striped (RAID-0) block device.
+
+   The device's sectors are divided into chunks of STRIPE_CHUNK
+   sectors, which are dealt out to the member devices in turn:
+   chunk 0 to the first member, chunk 1 to the second, and so on,
+   wrapping around after the last member.  A transfer that spans
+   several chunks is split into one request per chunk, and all of
+   them are submitted before waiting, so that members on
+   different IDE channels work at the same time.
+
+   Nothing is stored on the members to describe the stripe, so it
+   must be assembled from the same members in the same order on
+   every boot. */
+
+/* Sectors per chunk. */
+#define STRIPE_CHUNK 8
+
+/* Most requests in flight per transfer. */
+#define STRIPE_BATCH 16
+
+/* A striped device. */
+struct stripe
+  {
+    struct block *members[STRIPE_MAX];  /* Member devices. */
+    size_t cnt;                         /* Number of members. */
+  };
+
+static struct block_operations stripe_operations;
+
+/* Registers and returns a block device named NAME that stripes
+   over the CNT devices in MEMBERS, which must be between 2 and
+   STRIPE_MAX.  Its size is the largest multiple of the chunk size
+   that fits on the smallest member, times CNT.  The new device
+   has type BLOCK_FILESYS. */
+struct block *
+stripe_create (const char *name, struct block **members, size_t cnt)
+{
+  struct stripe *s;
+  block_sector_t member_size;
+  char extra_info[128];
+  size_t i;
+
+  if (cnt < 2 || cnt > STRIPE_MAX)
+    PANIC ("%s: stripe needs between 2 and %d devices", name, STRIPE_MAX);
+
+  s = malloc (sizeof *s);
+  if (s == NULL)
+    PANIC ("Failed to allocate memory for stripe descriptor");
+  s->cnt = cnt;
+  member_size = block_size (members[0]);
+  strlcpy (extra_info, "striped over", sizeof extra_info);
+  for (i = 0; i < cnt; i++)
+    {
+      s->members[i] = members[i];
+      if (block_size (members[i]) < member_size)
+        member_size = block_size (members[i]);
+      strlcat (extra_info, i == 0 ? " " : ", ", sizeof extra_info);
+      strlcat (extra_info, block_name (members[i]), sizeof extra_info);
+    }
+  member_size -= member_size % STRIPE_CHUNK;
+
+  return block_register (name, BLOCK_FILESYS, extra_info, member_size * cnt,
+                         &stripe_operations, s);
+}
+
+/* Completion function for stripe_transfer()'s requests. */
+static void
+stripe_done (struct block_request *r)
+{
+  sema_up (r->aux);
+}
+
+/* Transfers CNT sectors starting at SECTOR between stripe S and
+   BUFFER: from S into BUFFER if WRITE is false, from BUFFER to S
+   otherwise. */
+static void
+stripe_transfer (struct stripe *s, block_sector_t sector, size_t cnt,
+                 void *buffer, bool write)
+{
+  struct block_request reqs[STRIPE_BATCH];
+  struct semaphore done;
+  uint8_t *p = buffer;
+
+  sema_init (&done, 0);
+  while (cnt > 0)
+    {
+      size_t req_cnt, i;
+
+      for (req_cnt = 0; req_cnt < STRIPE_BATCH && cnt > 0; req_cnt++)
+        {
+          struct block_request *r = &reqs[req_cnt];
+          block_sector_t chunk = sector / STRIPE_CHUNK;
+          block_sector_t ofs = sector % STRIPE_CHUNK;
+
+          r->block = s->members[chunk % s->cnt];
+          r->sector = chunk / s->cnt * STRIPE_CHUNK + ofs;
+          r->cnt = STRIPE_CHUNK - ofs < cnt ? STRIPE_CHUNK - ofs : cnt;
+          r->buffer = p;
+          r->write = write;
+          r->done = stripe_done;
+          r->aux = &done;
+
+          sector += r->cnt;
+          cnt -= r->cnt;
+          p += r->cnt * BLOCK_SECTOR_SIZE;
+          block_submit (r);
+        }
+      for (i = 0; i < req_cnt; i++)
+        sema_down (&done);
+    }
+}
+
+/* Reads sector SECTOR from stripe S into BUFFER. */
+static void
+stripe_read (void *s, block_sector_t sector, void *buffer)
+{
+  stripe_transfer (s, sector, 1, buffer, false);
+}
+
+/* Writes sector SECTOR to stripe S from BUFFER. */
+static void
+stripe_write (void *s, block_sector_t sector, const void *buffer)
+{
+  stripe_transfer (s, sector, 1, (void *) buffer, true);
+}
+
+/* Reads CNT sectors starting at SECTOR from stripe S into
+   BUFFER. */
+static void
+stripe_read_multiple (void *s, block_sector_t sector, size_t cnt,
+                      void *buffer)
+{
+  stripe_transfer (s, sector, cnt, buffer, false);
+}
+
+/* Writes CNT sectors starting at SECTOR to stripe S from
+   BUFFER. */
+static void
+stripe_write_multiple (void *s, block_sector_t sector, size_t cnt,
+                       const void *buffer)
+{
+  stripe_transfer (s, sector, cnt, (void *) buffer, true);
+}
+
+static struct block_operations stripe_operations =
+  {
+    stripe_read,
+    stripe_write,
+    stripe_read_multiple,
+    stripe_write_multiple,
+    NULL
+  };
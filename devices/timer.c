@@ -1,10 +1,13 @@
 #include "devices/timer.h"
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stdio.h>
 #include "devices/pit.h"
 #include "threads/interrupt.h"
+#include "threads/loader.h"
+#include "threads/profile.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
   
@@ -17,18 +20,74 @@
 #error TIMER_FREQ <= 1000 recommended
 #endif
 
-/* Number of timer ticks since OS booted. */
+/* Number of timer ticks since OS booted.  Written only by the
+   timer interrupt handler, so readers use ticks_seq instead of
+   disabling interrupts. */
 static int64_t ticks;
+static struct seqlock ticks_seq;
 
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Time-stamp counter cycles per second, or 0 before
+   timer_calibrate() measures it against the timer interrupt,
+   over TSC_CALIBRATE_TICKS ticks. */
+static uint64_t tsc_hz;
+#define TSC_CALIBRATE_TICKS 5
+
+/* Nanoseconds per second. */
+#define NS_PER_SEC 1000000000
+
+/* Tickless idle.
+
+   Normally the timer interrupts TIMER_FREQ times a second, even
+   when there is nothing to do.  With tickless idle, just before
+   the idle thread halts, timer_idle_begin() switches the timer to
+   a single count that runs out at the next tick anything waits
+   for, so that the CPU stays halted for several ticks at a time.
+   The ticks in between are credited when the count runs out, or
+   by timer_idle_end() if another interrupt makes a thread ready
+   first.  A 16-bit count covers at most IDLE_MAX_TICKS ticks.
+   Controlled by kernel command-line option "-tickless". */
+bool timer_tickless;
+
+/* PIT cycles per timer tick. */
+#define TICK_CYCLES ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+#define IDLE_MAX_TICKS (UINT16_MAX / TICK_CYCLES)
+
+/* Ticks covered by the running one-shot count, or 0 if the timer
+   is periodic.  Protected by disabling interrupts. */
+static int idle_span;
+
+/* Statistics. */
+static unsigned long long tickless_cnt; /* One-shot counts started. */
+static unsigned long long skipped_cnt;  /* Ticks without interrupts. */
+
+/* A thread sleeping in timer_sleep() or timer_sema_down(). */
+struct sleeper
+  {
+    int64_t wakeup;                     /* Tick to wake up at. */
+    struct thread *thread;              /* Sleeping thread. */
+    struct semaphore *sema;             /* Semaphore to up instead of
+                                           unblocking THREAD, or null. */
+    bool queued;                        /* Still in sleep_list? */
+    struct list_elem elem;              /* Element in sleep_list. */
+  };
+
+/* Sleeping threads, in ascending order of wakeup tick.
+   Protected by disabling interrupts. */
+static struct list sleep_list;
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
+static void precise_sleep (int64_t ns);
+static void calibrate_tsc (void);
+static bool sleeper_less (const struct list_elem *,
+                          const struct list_elem *, void *aux);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
@@ -37,6 +96,8 @@ timer_init (void)
 {
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
+  list_init (&sleep_list);
+  seqlock_init (&ticks_seq);
 }
 
 /* Calibrates loops_per_tick, used to implement brief delays. */
@@ -64,15 +125,24 @@ timer_calibrate (void)
       loops_per_tick |= test_bit;
 
   printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+
+  calibrate_tsc ();
+  printf ("Time-stamp counter runs at %'"PRIu64" kHz.\n", tsc_hz / 1000);
 }
 
 /* Returns the number of timer ticks since the OS booted. */
 int64_t
 timer_ticks (void) 
 {
-  enum intr_level old_level = intr_disable ();
-  int64_t t = ticks;
-  intr_set_level (old_level);
+  unsigned seq;
+  int64_t t;
+
+  do
+    {
+      seq = seqlock_read_begin (&ticks_seq);
+      t = ticks;
+    }
+  while (seqlock_read_retry (&ticks_seq, seq));
   return t;
 }
 
@@ -84,16 +154,94 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
+/* Returns the current time in nanoseconds, from the time-stamp
+   counter.  Only differences between two values are meaningful.
+   Before timer_calibrate(), falls back to the timer ticks. */
+uint64_t
+timer_now_ns (void)
+{
+  if (tsc_hz == 0)
+    return timer_ticks () * (NS_PER_SEC / TIMER_FREQ);
+  return timer_tsc_to_ns (timer_tsc ());
+}
+
+/* Converts CYCLES time-stamp counter cycles into nanoseconds.
+   Returns 0 before timer_calibrate(). */
+uint64_t
+timer_tsc_to_ns (uint64_t cycles)
+{
+  if (tsc_hz == 0)
+    return 0;
+  return (cycles / tsc_hz * NS_PER_SEC
+          + cycles % tsc_hz * NS_PER_SEC / tsc_hz);
+}
+
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
-   be turned on. */
+   be turned on.
+
+   The thread blocks on the sleep queue and is woken by the timer
+   interrupt, instead of spinning through the ready list. */
 void
 timer_sleep (int64_t ticks) 
 {
-  int64_t start = timer_ticks ();
+  struct sleeper s;
+  enum intr_level old_level;
+
+  ASSERT (intr_get_level () == INTR_ON);
+  if (ticks <= 0)
+    return;
+
+  old_level = intr_disable ();
+  s.wakeup = ticks + timer_ticks ();
+  s.thread = thread_current ();
+  s.sema = NULL;
+  s.queued = true;
+  list_insert_ordered (&sleep_list, &s.elem, sleeper_less, NULL);
+  thread_block ();
+  intr_set_level (old_level);
+}
+
+/* Downs SEMA, as sema_down() does, but waits no more than TICKS
+   timer ticks for it.  Returns true if SEMA was downed, false if
+   the time ran out first.  Interrupts must be turned on. */
+bool
+timer_sema_down (struct semaphore *sema, int64_t ticks) 
+{
+  struct sleeper s;
+  enum intr_level old_level;
+  bool success;
 
   ASSERT (intr_get_level () == INTR_ON);
-  while (timer_elapsed (start) < ticks) 
-    thread_yield ();
+  if (sema_try_down (sema))
+    return true;
+  if (ticks <= 0)
+    return false;
+
+  /* Either the semaphore's owner or the timer interrupt ups SEMA;
+     the interrupt also takes S off the sleep list, which tells the
+     two apart. */
+  old_level = intr_disable ();
+  s.wakeup = ticks + timer_ticks ();
+  s.thread = thread_current ();
+  s.sema = sema;
+  s.queued = true;
+  list_insert_ordered (&sleep_list, &s.elem, sleeper_less, NULL);
+  sema_down (sema);
+  success = s.queued;
+  if (s.queued)
+    list_remove (&s.elem);
+  intr_set_level (old_level);
+  return success;
+}
+
+/* Orders sleepers by ascending wakeup tick. */
+static bool
+sleeper_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct sleeper *a = list_entry (a_, struct sleeper, elem);
+  const struct sleeper *b = list_entry (b_, struct sleeper, elem);
+  return a->wakeup < b->wakeup;
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -104,20 +252,20 @@ timer_msleep (int64_t ms)
   real_time_sleep (ms, 1000);
 }
 
-/* Sleeps for approximately US microseconds.  Interrupts must be
-   turned on. */
+/* Sleeps for US microseconds, to within the resolution of the
+   time-stamp counter.  Interrupts must be turned on. */
 void
 timer_usleep (int64_t us) 
 {
-  real_time_sleep (us, 1000 * 1000);
+  precise_sleep (us * 1000);
 }
 
-/* Sleeps for approximately NS nanoseconds.  Interrupts must be
-   turned on. */
+/* Sleeps for NS nanoseconds, to within the resolution of the
+   time-stamp counter.  Interrupts must be turned on. */
 void
 timer_nsleep (int64_t ns) 
 {
-  real_time_sleep (ns, 1000 * 1000 * 1000);
+  precise_sleep (ns);
 }
 
 /* Busy-waits for approximately MS milliseconds.  Interrupts need
@@ -159,19 +307,138 @@ timer_ndelay (int64_t ns)
   real_time_delay (ns, 1000 * 1000 * 1000);
 }
 
+/* Called by the idle thread, with interrupts off, just before it
+   halts.  If tickless idle is on, replaces the periodic timer
+   interrupt by one at the earliest tick that something waits for:
+   the first sleeper's wakeup, or, for the multi-level feedback
+   queue scheduler, the once-a-second load average update. */
+void
+timer_idle_begin (void)
+{
+  int64_t span = IDLE_MAX_TICKS;
+  bool out;
+  uint16_t first;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!timer_tickless || idle_span != 0)
+    return;
+  if (!list_empty (&sleep_list))
+    {
+      struct sleeper *s = list_entry (list_front (&sleep_list),
+                                      struct sleeper, elem);
+      if (s->wakeup - ticks < span)
+        span = s->wakeup - ticks;
+    }
+  if (thread_mlfqs && TIMER_FREQ - ticks % TIMER_FREQ < span)
+    span = TIMER_FREQ - ticks % TIMER_FREQ;
+  if (span < 2)
+    return;
+
+  /* Keep the ticks in phase: the first one is due when the
+     periodic count, which counts down from TICK_CYCLES, would
+     have run out. */
+  first = pit_read_channel (0, &out);
+  if (first == 0 || first > TICK_CYCLES)
+    first = TICK_CYCLES;
+  idle_span = span;
+  tickless_cnt++;
+  pit_start_oneshot (0, first + (span - 1) * TICK_CYCLES);
+}
+
+/* Called with interrupts off whenever the idle thread gives up the
+   CPU.  If a one-shot count from timer_idle_begin() is still
+   running, credits the ticks that have passed and arranges for
+   the next one to arrive on time. */
+void
+timer_idle_end (void)
+{
+  uint16_t count;
+  bool expired;
+  int passed;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (idle_span == 0)
+    return;
+  count = pit_read_channel (0, &expired);
+  if (expired)
+    {
+      /* The timer interrupt is on its way and will do the
+         accounting. */
+      return;
+    }
+
+  /* Tick boundaries fall where COUNT is a multiple of
+     TICK_CYCLES.  Count down to the next one, which
+     timer_interrupt() treats as the end of a one-tick span. */
+  passed = idle_span - 1 - (count - 1) / TICK_CYCLES;
+  idle_span = 1;
+  pit_start_oneshot (0, (count - 1) % TICK_CYCLES + 1);
+  if (passed > 0)
+    {
+      seqlock_write_begin (&ticks_seq);
+      ticks += passed;
+      seqlock_write_end (&ticks_seq);
+      skipped_cnt += passed;
+      thread_tick_idle (passed);
+    }
+}
+
 /* Prints timer statistics. */
 void
 timer_print_stats (void) 
 {
   printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
+  if (timer_tickless)
+    printf ("Timer: %llu tickless idle periods, %llu ticks skipped\n",
+            tickless_cnt, skipped_cnt);
 }
 
 /* Timer interrupt handler. */
 static void
-timer_interrupt (struct intr_frame *args UNUSED)
+timer_interrupt (struct intr_frame *args)
 {
-  ticks++;
-  thread_tick ();
+  int skipped = 0;
+
+  if (idle_span != 0)
+    {
+      bool expired;
+
+      /* If the one-shot count ran out, it stood for IDLE_SPAN
+         ticks.  Otherwise, this is a periodic tick that was
+         already pending when the count was started. */
+      pit_read_channel (0, &expired);
+      if (expired)
+        skipped = idle_span - 1;
+      idle_span = 0;
+      pit_configure_channel (0, 2, TIMER_FREQ);
+    }
+
+  seqlock_write_begin (&ticks_seq);
+  ticks += skipped + 1;
+  seqlock_write_end (&ticks_seq);
+  if (skipped > 0)
+    {
+      skipped_cnt += skipped;
+      thread_tick_idle (skipped);
+    }
+  while (!list_empty (&sleep_list))
+    {
+      struct sleeper *s = list_entry (list_front (&sleep_list),
+                                      struct sleeper, elem);
+      if (s->wakeup > ticks)
+        break;
+      list_pop_front (&sleep_list);
+      s->queued = false;
+      if (s->sema != NULL)
+        sema_up (s->sema);
+      else
+        thread_unblock (s->thread);
+    }
+  if (profile_enabled)
+    profile_sample (args);
+  thread_tick (args->cs != SEL_KCSEG);
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -239,8 +506,58 @@ real_time_sleep (int64_t num, int32_t denom)
 static void
 real_time_delay (int64_t num, int32_t denom)
 {
+  if (tsc_hz != 0)
+    {
+      /* Watch the time-stamp counter, which unlike a loop count
+         does not depend on how fast the loop happens to run. */
+      uint64_t end = timer_tsc () + num * tsc_hz / denom;
+      while (timer_tsc () < end)
+        barrier ();
+      return;
+    }
+
   /* Scale the numerator and denominator down by 1000 to avoid
      the possibility of overflow. */
   ASSERT (denom % 1000 == 0);
   busy_wait (loops_per_tick * num / 1000 * TIMER_FREQ / (denom / 1000)); 
 }
+
+/* Sleeps for NS nanoseconds.  Blocks for as many timer ticks as
+   certainly fit in NS, which may end anywhere within the last
+   tick, then busy-waits on the time-stamp counter for the rest. */
+static void
+precise_sleep (int64_t ns)
+{
+  uint64_t end = timer_now_ns () + ns;
+  int64_t ticks = ns / (NS_PER_SEC / TIMER_FREQ);
+
+  ASSERT (intr_get_level () == INTR_ON);
+  if (ns <= 0)
+    return;
+  if (ticks > 0)
+    timer_sleep (ticks);
+  while (timer_now_ns () < end)
+    barrier ();
+}
+
+/* Measures tsc_hz by counting time-stamp counter cycles across
+   TSC_CALIBRATE_TICKS timer ticks.  Interrupts must be on. */
+static void
+calibrate_tsc (void)
+{
+  int64_t start;
+  uint64_t tsc;
+
+  ASSERT (intr_get_level () == INTR_ON);
+
+  /* Wait for a timer tick. */
+  start = ticks;
+  while (ticks == start)
+    barrier ();
+
+  tsc = timer_tsc ();
+  start = ticks;
+  while (ticks - start < TSC_CALIBRATE_TICKS)
+    barrier ();
+  tsc_hz = (timer_tsc () - tsc) * TIMER_FREQ / TSC_CALIBRATE_TICKS;
+}
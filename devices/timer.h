@@ -2,28 +2,53 @@
 #define DEVICES_TIMER_H
 
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
+/* Stop the periodic tick while idle?
+   Controlled by kernel command-line option "-tickless". */
+extern bool timer_tickless;
+
 void timer_init (void);
 void timer_calibrate (void);
 
 int64_t timer_ticks (void);
 int64_t timer_elapsed (int64_t);
 
+/* High-resolution clock, from the CPU's time-stamp counter. */
+uint64_t timer_now_ns (void);
+uint64_t timer_tsc_to_ns (uint64_t cycles);
+
+/* Returns the CPU's time-stamp counter, which counts CPU cycles
+   since the CPU was reset. */
+static inline uint64_t
+timer_tsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
 /* Sleep and yield the CPU to other threads. */
 void timer_sleep (int64_t ticks);
 void timer_msleep (int64_t milliseconds);
 void timer_usleep (int64_t microseconds);
 void timer_nsleep (int64_t nanoseconds);
+struct semaphore;
+bool timer_sema_down (struct semaphore *, int64_t ticks);
 
 /* Busy waits. */
 void timer_mdelay (int64_t milliseconds);
 void timer_udelay (int64_t microseconds);
 void timer_ndelay (int64_t nanoseconds);
 
+/* Tickless idle. */
+void timer_idle_begin (void);
+void timer_idle_end (void);
+
 void timer_print_stats (void);
 
 #endif /* devices/timer.h */
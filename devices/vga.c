@@ -14,6 +14,10 @@
 #define COL_CNT 80
 #define ROW_CNT 25
 
+/* Rows in the 32 kB of video memory at 0xb8000, of which the
+   display shows ROW_CNT starting at row TOP. */
+#define BUF_ROWS (0x8000 / (COL_CNT * 2))
+
 /* Current cursor position.  (0,0) is in the upper left corner of
    the display. */
 static size_t cx, cy;
@@ -21,7 +25,16 @@ static size_t cx, cy;
 /* Attribute value for gray text on a black background. */
 #define GRAY_ON_BLACK 0x07
 
-/* Framebuffer.  See [FREEVGA] under "VGA Text Mode Operation".
+/* Video memory, and the row of it at the top of the display.
+   Scrolling advances TOP and points the CRTC's start address at
+   it, so that a line costs the same however full the screen is;
+   only when the display reaches the end of video memory are its
+   rows moved back to the start. */
+static uint8_t (*buf)[COL_CNT][2];
+static size_t top;
+
+/* Framebuffer, the rows of BUF that are on display.  See [FREEVGA]
+   under "VGA Text Mode Operation".
    The character at (x,y) is fb[y][x][0].
    The attribute at (x,y) is fb[y][x][1]. */
 static uint8_t (*fb)[COL_CNT][2];
@@ -29,6 +42,7 @@ static uint8_t (*fb)[COL_CNT][2];
 static void clear_row (size_t y);
 static void cls (void);
 static void newline (void);
+static void move_start (void);
 static void move_cursor (void);
 static void find_cursor (size_t *x, size_t *y);
 
@@ -40,7 +54,9 @@ init (void)
   static bool inited;
   if (!inited)
     {
-      fb = ptov (0xb8000);
+      buf = fb = ptov (0xb8000);
+      top = 0;
+      move_start ();
       find_cursor (&cx, &cy);
       inited = true; 
     }
@@ -108,6 +124,9 @@ cls (void)
 {
   size_t y;
 
+  fb = buf;
+  top = 0;
+  move_start ();
   for (y = 0; y < ROW_CNT; y++)
     clear_row (y);
 
@@ -139,17 +158,36 @@ newline (void)
   if (cy >= ROW_CNT)
     {
       cy = ROW_CNT - 1;
-      memmove (&fb[0], &fb[1], sizeof fb[0] * (ROW_CNT - 1));
+      if (top + ROW_CNT < BUF_ROWS)
+        top++;
+      else
+        {
+          memmove (&buf[0], &buf[top + 1], sizeof buf[0] * (ROW_CNT - 1));
+          top = 0;
+        }
+      fb = buf + top;
       clear_row (ROW_CNT - 1);
+      move_start ();
     }
 }
 
+/* Points the CRTC's start address at row TOP of video memory. */
+static void
+move_start (void)
+{
+  /* See [FREEVGA] under "CRTC Registers", Start Address High and
+     Low. */
+  uint16_t sp = COL_CNT * top;
+  outw (0x3d4, 0x0c | (sp & 0xff00));
+  outw (0x3d4, 0x0d | (sp << 8));
+}
+
 /* Moves the hardware cursor to (cx,cy). */
 static void
 move_cursor (void) 
 {
   /* See [FREEVGA] under "Manipulating the Text-mode Cursor". */
-  uint16_t cp = cx + COL_CNT * cy;
+  uint16_t cp = cx + COL_CNT * (top + cy);
   outw (0x3d4, 0x0e | (cp & 0xff00));
   outw (0x3d4, 0x0f | (cp << 8));
 }
@@ -0,0 +1,54 @@
+/* iostat.c
+
+   Prints statistics for each block device named on the command
+   line, or for hda if none is given. */
+
+#include <stdio.h>
+#include <syscall.h>
+
+static bool show (const char *device);
+
+int
+main (int argc, char *argv[]) 
+{
+  bool success = true;
+  int i;
+
+  if (argc < 2)
+    return show ("hda") ? EXIT_SUCCESS : EXIT_FAILURE;
+  for (i = 1; i < argc; i++)
+    if (!show (argv[i]))
+      success = false;
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Prints the statistics for DEVICE.  Returns true if successful,
+   false if there is no such device. */
+static bool
+show (const char *device) 
+{
+  struct block_stats s;
+  int i;
+
+  if (!blockstats (device, &s))
+    {
+      printf ("%s: no such device\n", device);
+      return false;
+    }
+
+  printf ("%s: %llu sectors read, %llu written\n",
+          device, s.read_cnt, s.write_cnt);
+  printf ("%s: %llu requests, %llu merged, %llu seeks, %llu throttled, "
+          "depth %u, max depth %u\n",
+          device, s.request_cnt, s.merge_cnt, s.seek_cnt, s.throttle_cnt,
+          s.depth, s.max_depth);
+  printf ("%s: latency (log2 cycles):", device);
+  for (i = 0; i < BLOCKSTATS_LATENCY_CNT; i++)
+    if (s.latency[i] > 0)
+      printf (" %d:%u", i + 10, s.latency[i]);
+  printf ("\n%s: heat:", device);
+  for (i = 0; i < BLOCKSTATS_HEAT_CNT; i++)
+    printf (" %llu", s.heat[i]);
+  printf ("\n");
+  return true;
+}
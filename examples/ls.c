@@ -5,8 +5,9 @@
    named.
 
    By default, only the name of each file is printed.  If "-l" is
-   given as the first argument, the type, size, and inumber of
-   each file is also printed.  This won't work until project 4. */
+   given as the first argument, the type, size, inumber and
+   allocated sectors of each file are also printed, with one
+   stat() call per file.  This won't work until project 4. */
 
 #include <syscall.h>
 #include <stdio.h>
@@ -24,39 +25,37 @@ list_dir (const char *dir, bool verbose)
 
   if (isdir (dir_fd))
     {
-      char name[READDIR_MAX_LEN];
+      static struct readdir_record records[32];
+      int cnt, i;
 
       printf ("%s", dir);
       if (verbose)
         printf (" (inumber %d)", inumber (dir_fd));
       printf (":\n");
 
-      while (readdir (dir_fd, name)) 
-        {
-          printf ("%s", name); 
-          if (verbose) 
-            {
-              char full_name[128];
-              int entry_fd;
+      while ((cnt = readdir_batch (dir_fd, records, 32)) > 0)
+        for (i = 0; i < cnt; i++)
+          {
+            struct readdir_record *r = &records[i];
 
-              snprintf (full_name, sizeof full_name, "%s/%s", dir, name);
-              entry_fd = open (full_name);
+            printf ("%s", r->name); 
+            if (verbose && r->is_dir)
+              printf (": directory, inumber %d", r->inumber);
+            else if (verbose) 
+              {
+                char full_name[128];
+                struct stat st;
 
-              printf (": ");
-              if (entry_fd != -1)
-                {
-                  if (isdir (entry_fd))
-                    printf ("directory");
-                  else
-                    printf ("%d-byte file", filesize (entry_fd));
-                  printf (", inumber %d", inumber (entry_fd));
-                }
-              else
-                printf ("open failed");
-              close (entry_fd);
-            }
-          printf ("\n");
-        }
+                snprintf (full_name, sizeof full_name, "%s/%s", dir, r->name);
+                printf (": ");
+                if (stat (full_name, &st))
+                  printf ("%u-byte file, inumber %d, %u sectors",
+                          st.size, st.inumber, st.blocks);
+                else
+                  printf ("stat failed");
+              }
+            printf ("\n");
+          }
     }
   else 
     printf ("%s: not a directory\n", dir);
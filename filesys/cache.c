@@ -0,0 +1,1692 @@
+#include "filesys/cache.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/checksum.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "threads/workqueue.h"
+
+/* Buffer cache.
+
+   Every sector that the file system reads or writes goes through
+   this fixed-size cache of CACHE_SIZE sectors.  Writes are
+   write-back: a dirty sector stays in memory until it is chosen
+   for eviction or until cache_flush() is called, which
+   filesys_done() does at shutdown.
+
+   Replacement follows the "2Q" algorithm, so that a one-pass
+   scan through a large file cannot flush out frequently used
+   sectors such as inodes, the free map and directories.  A sector
+   read into the cache joins a1in, a FIFO queue, and hits there do
+   not change its place.  Evicting a sector from a1in remembers
+   its number, but not its contents, in a1out.  A sector that
+   misses while it is remembered in a1out has been used more than
+   once recently, so it joins am, an LRU list, instead.  Victims
+   are taken from a1in while it holds more than A1IN_MAX entries,
+   and otherwise from am.  A scan thus only cycles sectors
+   through a1in and a1out, leaving am alone.
+
+   Metadata: callers read and write inodes, index blocks,
+   directories and the free map with the cache_*_meta() functions
+   and the logged ones, which tag the entry as metadata.  Metadata
+   skips a1in and goes straight to am, and file data is evicted
+   before any metadata as long as metadata fills no more than
+   META_MAX entries.  A few sectors that nearly every operation
+   needs can be held in the cache outright with cache_hold().
+
+   Read-ahead: cache_readahead() queues a run of sectors that is
+   likely to be read soon, and a background job loads it into the
+   cache so that the reader does not have to wait for the disk
+   when it gets there.  Each run, merged with queued runs that
+   directly follow it, is loaded with multi-sector reads, as are
+   the spans passed to cache_load().  On a file system formatted
+   with clusters of several sectors, a file data sector that
+   misses brings in its whole cluster with one read.
+
+   Warm-up: at shutdown, cache_warm_list() describes the sectors
+   the cache holds as a few runs, which filesys_done() keeps in
+   the superblock.  At the next boot cache_warm() reads them back
+   in the background, in sector order, into entries that are still
+   free, so that the root directory, the free map and frequently
+   run programs do not each have to miss in turn.
+
+   Write-behind: a flusher thread wakes every cache_flush_interval
+   milliseconds and writes back up to cache_flush_batch dirty
+   sectors, sweeping upward in sector order, so that dirty data
+   does not pile up until eviction or shutdown.  Each wakeup also
+   commits the journal's running transaction first.
+   Runs of consecutive dirty sectors go out in one multi-sector
+   write, and several runs are submitted to the disk at once so
+   that it can schedule them together.
+
+   Dirty throttling: a thread that writes file data faster than
+   the flusher can keep up would otherwise fill the cache with
+   dirty sectors, leaving every reader that misses to wait for a
+   write-back before it can read.  Each dirty entry remembers the
+   thread that last dirtied it.  Once more than DIRTY_MAX entries
+   are dirty, a thread that has dirtied at least DIRTY_THREAD_MIN
+   of them writes its own back, lowest sector first, before each
+   further write, until the cache is under the limit again.  Heavy
+   writers thus pay for their own write-backs, light writers and
+   metadata updates are not slowed, and readers can count on about
+   CACHE_SIZE - DIRTY_MAX clean entries to evict without waiting.
+
+   Logged sectors: metadata written with cache_write_logged()
+   belongs to the journal's running transaction, and must not
+   reach its home location on disk before the transaction is
+   committed.  Such entries are "logged": they are neither evicted
+   nor written back until cache_log_release() unpins them, after
+   which they are ordinary dirty entries again.  At most
+   JOURNAL_MAX entries are logged at once.
+
+   Locking: cache_lock protects which sector each entry holds and
+   the entries' state, but it is never held during disk I/O, so
+   that a miss on one sector does not stall hits and misses on
+   others.  An entry being read from disk is marked "loading";
+   a thread that wants the same sector waits for that read
+   instead of starting its own.  An entry being written back is
+   marked "writing" and is not evicted until the write is done,
+   so that the sector cannot be read back from disk before its
+   new contents get there.  A thread using an entry's contents
+   "pins" it, which also keeps it from being evicted, and copies
+   them under the entry's own lock.  io_lock serializes use of
+   the bounce buffer by write-backs and multi-sector loads.
+   Locks are acquired in the order io_lock, cache_lock, entry
+   lock. */
+
+/* A cached sector. */
+struct cache_entry
+  {
+    block_sector_t sector;              /* Sector held, if valid. */
+    bool valid;                         /* Holds a sector? */
+    bool dirty;                         /* Modified since read? */
+    bool frequent;                      /* In am rather than a1in? */
+    bool meta;                          /* Holds metadata? */
+    bool logged;                        /* Pinned by the journal? */
+    bool loading;                       /* Contents not yet read? */
+    bool writing;                       /* Write-back in progress? */
+    unsigned pin_cnt;                   /* Threads using the contents. */
+    struct thread *dirtier;             /* Thread that last dirtied it. */
+    struct condition loaded;            /* Signaled when loading ends. */
+    struct lock lock;                   /* Protects data. */
+    uint8_t *data;                      /* BLOCK_SECTOR_SIZE bytes. */
+    struct list_elem elem;              /* In free_list, a1in or am. */
+  };
+
+/* Cache entries and the lock that protects their state. */
+static struct cache_entry cache[CACHE_SIZE];
+static struct lock cache_lock;
+
+/* Signaled when an entry may have become evictable. */
+static struct condition entry_free;
+
+/* Replacement lists, protected by cache_lock.  Each list runs
+   from its next victim at the front to its newest entry at the
+   back. */
+#define A1IN_MAX (CACHE_SIZE / 2)
+static struct list free_list;           /* Entries holding no sector. */
+static struct list a1in;                /* Sectors used once, FIFO. */
+static size_t a1in_cnt;                 /* Number of entries in a1in. */
+static struct list am;                  /* Sectors used again, LRU. */
+
+/* a1out: numbers of the sectors most recently evicted from a1in,
+   a ring from oldest to newest, protected by cache_lock. */
+#define A1OUT_MAX (CACHE_SIZE / 2)
+static block_sector_t a1out[A1OUT_MAX];
+static size_t a1out_head;               /* Oldest sector. */
+static size_t a1out_cnt;                /* Number of sectors. */
+
+/* Metadata retention, protected by cache_lock.  Metadata is kept
+   in preference to file data while it fills no more than
+   META_MAX entries, and at most HOLD_MAX sectors may be held. */
+#define META_MAX (CACHE_SIZE * 3 / 4)
+#define HOLD_MAX 8
+static size_t meta_cnt;                 /* Entries holding metadata. */
+static size_t hold_cnt;                 /* Sectors held. */
+
+/* Dirty throttling limits.  See "Dirty throttling" above. */
+#define DIRTY_MAX (CACHE_SIZE / 2)
+#define DIRTY_THREAD_MIN (CACHE_SIZE / 16)
+
+/* Statistics. */
+static unsigned long long hit_cnt;      /* Lookups satisfied. */
+static unsigned long long miss_cnt;     /* Lookups that read the disk. */
+static unsigned long long coalesced_cnt; /* Lookups that waited for a read. */
+static unsigned long long writeback_cnt; /* Dirty sectors written. */
+static unsigned long long readahead_cnt; /* Sectors read ahead. */
+static unsigned long long cluster_cnt;  /* Clusters loaded whole. */
+static unsigned long long warmed_cnt;   /* Sectors read by warm-up. */
+static unsigned long long direct_cnt;   /* Sectors that bypassed the cache. */
+static unsigned long long dropped_cnt;  /* Entries freed by cache_drop(). */
+static unsigned long long synced_cnt;   /* Sectors written by cache_sync(). */
+static unsigned long long throttle_cnt; /* Writes delayed by throttling. */
+static unsigned long long throttled_cnt; /* Sectors written by throttling. */
+static unsigned long long a1in_hit_cnt; /* Hits on sectors in a1in. */
+static unsigned long long am_hit_cnt;   /* Hits on sectors in am. */
+static unsigned long long a1out_hit_cnt; /* Misses remembered by a1out. */
+static unsigned long long cold_miss_cnt; /* Other misses. */
+static unsigned long long meta_hit_cnt; /* Hits on metadata. */
+static unsigned long long meta_miss_cnt; /* Misses on metadata. */
+
+/* Number of logged entries, protected by cache_lock. */
+static size_t logged_cnt;
+
+/* Read-ahead queue, a ring of sector runs to load, protected by
+   cache_lock.  readahead_work drains it. */
+#define READAHEAD_MAX 16
+static struct cache_range readahead_queue[READAHEAD_MAX];
+static size_t readahead_head;           /* Next run to load. */
+static size_t readahead_queued;         /* Runs in queue. */
+static struct work readahead_work;
+
+/* Sector runs to warm the cache with, and the job that loads
+   them. */
+static struct cache_range warm_ranges[CACHE_SIZE];
+static size_t warm_range_cnt;
+static struct work warm_work;
+
+/* Bounce buffer for multi-sector transfers of up to CACHE_IO_MAX
+   sectors, protected by io_lock.  Cache entries are not
+   contiguous in memory, so runs are staged here. */
+#define CACHE_IO_MAX (PGSIZE / BLOCK_SECTOR_SIZE)
+static uint8_t *io_buffer;
+static struct lock io_lock;
+
+/* Write-behind settings.  Set by the kernel command line options
+   "-flush-interval" and "-flush-batch" before cache_init(). */
+unsigned cache_flush_interval = 500;
+unsigned cache_flush_batch = 16;
+
+/* Sector at which the next write-behind sweep continues. */
+static block_sector_t flush_cursor;
+
+static struct cache_entry *cache_lookup (block_sector_t);
+static work_func readahead_run;
+static work_func warm_run;
+static thread_func flush_daemon NO_RETURN;
+
+/* Initializes the buffer cache. */
+void
+cache_init (void)
+{
+  size_t per_page = PGSIZE / BLOCK_SECTOR_SIZE;
+  uint8_t *pages;
+  size_t i;
+
+  pages = palloc_get_multiple (PAL_ASSERT, DIV_ROUND_UP (CACHE_SIZE, per_page));
+  list_init (&free_list);
+  list_init (&a1in);
+  list_init (&am);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      e->valid = false;
+      e->dirty = false;
+      e->logged = false;
+      e->meta = false;
+      e->loading = false;
+      e->writing = false;
+      e->pin_cnt = 0;
+      e->dirtier = NULL;
+      cond_init (&e->loaded);
+      lock_init (&e->lock);
+      e->data = pages + i * BLOCK_SECTOR_SIZE;
+      list_push_back (&free_list, &e->elem);
+    }
+  io_buffer = palloc_get_page (PAL_ASSERT);
+  lock_init (&io_lock);
+  lock_set_name (&io_lock, "cache io");
+  lock_init (&cache_lock);
+  lock_set_name (&cache_lock, "cache");
+  cond_init (&entry_free);
+
+  work_init (&readahead_work, readahead_run, NULL);
+  work_init (&warm_work, warm_run, NULL);
+  if (cache_flush_interval > 0 && cache_flush_batch > 0)
+    thread_create ("flusher", PRI_DEFAULT + 1, flush_daemon, NULL);
+}
+
+/* Returns true if E may be written back along with a neighbor:
+   it holds a sector that is dirty and not logged. */
+static bool
+writable (const struct cache_entry *e)
+{
+  return e != NULL && e->dirty && !e->logged;
+}
+
+/* Copies the contents of entry E into BUFFER and marks E clean
+   and being written.
+   The cache lock must be held. */
+static void
+stage (struct cache_entry *e, uint8_t *buffer)
+{
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+  ASSERT (writable (e) && !e->writing);
+
+  lock_acquire (&e->lock);
+  memcpy (buffer, e->data, BLOCK_SECTOR_SIZE);
+  lock_release (&e->lock);
+  e->dirty = false;
+  e->writing = true;
+}
+
+/* Marks the CNT entries in ENTRIES as no longer being written.
+   The cache lock must be held. */
+static void
+unstage (struct cache_entry **entries, size_t cnt)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (i = 0; i < cnt; i++)
+    entries[i]->writing = false;
+  if (cnt > 0)
+    cond_broadcast (&entry_free, &cache_lock);
+}
+
+/* Writes dirty entry E back to disk together with the dirty
+   sectors around it that it continues or that continue it, up to
+   CACHE_IO_MAX sectors in all, in one multi-sector write through
+   io_buffer.  Evicting one sector of a sequentially written file
+   thus cleans its neighbors too, so that they need no write of
+   their own when their turn comes.  Logged neighbors are left
+   alone.
+   The I/O lock and the cache lock must be held.  The cache lock
+   is released during the write, so the caller must look at the
+   cache afresh afterward. */
+static void
+writeback (struct cache_entry *e)
+{
+  struct cache_entry *entries[CACHE_IO_MAX];
+  block_sector_t first = e->sector;
+  size_t cnt;
+
+  ASSERT (lock_held_by_current_thread (&io_lock));
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+  ASSERT (e->valid && writable (e));
+
+  while (first > 0 && e->sector - (first - 1) < CACHE_IO_MAX
+         && writable (cache_lookup (first - 1)))
+    first--;
+  for (cnt = 0; cnt < CACHE_IO_MAX; cnt++)
+    {
+      struct cache_entry *next = cache_lookup (first + cnt);
+      if (!writable (next))
+        break;
+      stage (next, io_buffer + cnt * BLOCK_SECTOR_SIZE);
+      entries[cnt] = next;
+    }
+  ASSERT (cnt > 0 && !e->dirty);
+
+  lock_release (&cache_lock);
+  checksum_update (first, io_buffer, cnt);
+  block_write_multiple (fs_device, first, cnt, io_buffer);
+  lock_acquire (&cache_lock);
+  unstage (entries, cnt);
+  writeback_cnt += cnt;
+}
+
+/* Writes back entry E, if it is still dirty and not logged,
+   taking the I/O lock if the caller does not already hold it.
+   The cache lock must be held.  It is released meanwhile. */
+static void
+clean (struct cache_entry *e)
+{
+  bool had_io = lock_held_by_current_thread (&io_lock);
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  if (!had_io)
+    {
+      lock_release (&cache_lock);
+      lock_acquire (&io_lock);
+      lock_acquire (&cache_lock);
+    }
+  if (e->valid && writable (e))
+    writeback (e);
+  if (!had_io)
+    lock_release (&io_lock);
+}
+
+/* Adds SECTOR to a1out as its newest member, forgetting the
+   oldest one if a1out is full.
+   The cache lock must be held. */
+static void
+a1out_add (block_sector_t sector)
+{
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  if (a1out_cnt == A1OUT_MAX)
+    {
+      a1out_head = (a1out_head + 1) % A1OUT_MAX;
+      a1out_cnt--;
+    }
+  a1out[(a1out_head + a1out_cnt) % A1OUT_MAX] = sector;
+  a1out_cnt++;
+}
+
+/* Removes SECTOR from a1out.  Returns true if it was there,
+   false otherwise.
+   The cache lock must be held. */
+static bool
+a1out_remove (block_sector_t sector)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (i = 0; i < a1out_cnt; i++)
+    if (a1out[(a1out_head + i) % A1OUT_MAX] == sector)
+      {
+        for (; i + 1 < a1out_cnt; i++)
+          a1out[(a1out_head + i) % A1OUT_MAX]
+            = a1out[(a1out_head + i + 1) % A1OUT_MAX];
+        a1out_cnt--;
+        return true;
+      }
+  return false;
+}
+
+/* Returns the entry nearest the front of LIST that may be
+   evicted, that is, one that is not logged, pinned, loading or
+   writing, or a null pointer if there is none.  Metadata entries
+   are passed over if SPARE_META is true.
+   The cache lock must be held. */
+static struct cache_entry *
+victim (struct list *list, bool spare_meta)
+{
+  struct list_elem *elem;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (elem = list_begin (list); elem != list_end (list);
+       elem = list_next (elem))
+    {
+      struct cache_entry *e = list_entry (elem, struct cache_entry, elem);
+      if (!e->logged && e->pin_cnt == 0 && !e->loading && !e->writing
+          && !(spare_meta && e->meta))
+        return e;
+    }
+  return NULL;
+}
+
+/* Takes entry E off its replacement list and makes it hold no
+   sector, discarding its contents.
+   The cache lock must be held. */
+static void
+forget (struct cache_entry *e)
+{
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+  ASSERT (e->valid && !e->logged && e->pin_cnt == 0);
+
+  list_remove (&e->elem);
+  if (!e->frequent)
+    a1in_cnt--;
+  if (e->meta)
+    {
+      e->meta = false;
+      meta_cnt--;
+    }
+  e->valid = false;
+  e->dirty = false;
+}
+
+/* Chooses an entry to hold a new sector and returns it, with its
+   old contents discarded and off every replacement list.  If the
+   chosen entry is dirty, writes it back and returns a null
+   pointer instead; likewise, waits and returns a null pointer if
+   no entry could be chosen.  Either way the cache lock was
+   released meanwhile, so the caller must look at the cache afresh
+   and try again.
+   The cache lock must be held. */
+static struct cache_entry *
+evict (void)
+{
+  struct cache_entry *e = NULL;
+  bool spare_meta;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  if (!list_empty (&free_list))
+    return list_entry (list_pop_front (&free_list), struct cache_entry, elem);
+
+  for (spare_meta = meta_cnt <= META_MAX; ; spare_meta = false)
+    {
+      if (a1in_cnt > A1IN_MAX)
+        e = victim (&a1in, spare_meta);
+      if (e == NULL)
+        e = victim (&am, spare_meta);
+      if (e == NULL)
+        e = victim (&a1in, spare_meta);
+      if (e != NULL || !spare_meta)
+        break;
+    }
+  if (e == NULL)
+    {
+      cond_wait (&entry_free, &cache_lock);
+      return NULL;
+    }
+  if (e->dirty)
+    {
+      clean (e);
+      return NULL;
+    }
+
+  if (!e->frequent)
+    a1out_add (e->sector);
+  forget (e);
+  return e;
+}
+
+/* Makes entry E, just chosen by evict(), hold SECTOR, whose
+   contents are still to be filled in.  META is true if SECTOR
+   holds metadata.  E joins am if it is metadata or a1out
+   remembers SECTOR, and a1in otherwise.
+   The cache lock must be held. */
+static void
+claim (struct cache_entry *e, block_sector_t sector, bool meta)
+{
+  bool remembered;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  e->sector = sector;
+  e->valid = true;
+  e->dirty = false;
+  e->loading = true;
+  remembered = a1out_remove (sector);
+  if (remembered)
+    a1out_hit_cnt++;
+  else
+    cold_miss_cnt++;
+  e->meta = meta;
+  if (meta)
+    {
+      meta_miss_cnt++;
+      meta_cnt++;
+    }
+  e->frequent = remembered || meta;
+  if (e->frequent)
+    list_push_back (&am, &e->elem);
+  else
+    {
+      list_push_back (&a1in, &e->elem);
+      a1in_cnt++;
+    }
+}
+
+/* Records a hit on entry E.  META is true if the caller is
+   accessing it as metadata, which moves E from a1in to am.
+   The cache lock must be held. */
+static void
+touch (struct cache_entry *e, bool meta)
+{
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  hit_cnt++;
+  if (meta)
+    {
+      meta_hit_cnt++;
+      if (!e->meta)
+        {
+          e->meta = true;
+          meta_cnt++;
+        }
+    }
+  if (e->frequent)
+    am_hit_cnt++;
+  else
+    {
+      a1in_hit_cnt++;
+      if (!meta)
+        return;
+      a1in_cnt--;
+      e->frequent = true;
+    }
+  list_remove (&e->elem);
+  list_push_back (&am, &e->elem);
+}
+
+/* Marks entry E's contents as filled in and wakes the threads
+   waiting for them.
+   The cache lock must be held. */
+static void
+finish_loading (struct cache_entry *e)
+{
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+  ASSERT (e->loading);
+
+  e->loading = false;
+  cond_broadcast (&e->loaded, &cache_lock);
+  cond_broadcast (&entry_free, &cache_lock);
+}
+
+/* Returns the entry holding SECTOR, or a null pointer if SECTOR
+   is not cached.
+   The cache lock must be held. */
+static struct cache_entry *
+cache_lookup (block_sector_t sector)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].valid && cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Returns the entry holding SECTOR, pinned, loading it into the
+   cache if it is not already present.  If another thread is
+   already reading SECTOR, waits for that read instead of
+   starting another.  If READ is false, the caller is about to
+   overwrite the whole sector, so a missing sector is not read
+   from disk and stays loading until cache_unpin().  META is true
+   if SECTOR holds metadata. */
+static struct cache_entry *
+cache_pin (block_sector_t sector, bool read, bool meta)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      e = cache_lookup (sector);
+      if (e != NULL)
+        {
+          if (e->loading)
+            {
+              coalesced_cnt++;
+              cond_wait (&e->loaded, &cache_lock);
+              continue;
+            }
+          touch (e, meta);
+          e->pin_cnt++;
+          lock_release (&cache_lock);
+          return e;
+        }
+      e = evict ();
+      if (e != NULL)
+        break;
+    }
+
+  miss_cnt++;
+  claim (e, sector, meta);
+  e->pin_cnt = 1;
+  lock_release (&cache_lock);
+  if (read)
+    {
+      block_read (fs_device, sector, e->data);
+      checksum_verify (sector, e->data, 1);
+      lock_acquire (&cache_lock);
+      finish_loading (e);
+      lock_release (&cache_lock);
+    }
+  return e;
+}
+
+/* Unpins entry E, pinned by cache_pin(), marking it dirty if
+   DIRTY is true. */
+static void
+cache_unpin (struct cache_entry *e, bool dirty)
+{
+  lock_acquire (&cache_lock);
+  ASSERT (e->pin_cnt > 0);
+  if (dirty)
+    {
+      e->dirty = true;
+      e->dirtier = thread_current ();
+    }
+  if (e->loading)
+    finish_loading (e);
+  if (--e->pin_cnt == 0)
+    cond_broadcast (&entry_free, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Loads the CNT sectors starting at SECTOR into the cache,
+   reading each run of them that is not already cached with one
+   disk read.  Returns the number of sectors read from disk.
+   The I/O lock and the cache lock must be held.  The cache lock
+   is released during each read. */
+static size_t
+load_span (block_sector_t sector, size_t cnt)
+{
+  struct cache_entry *entries[CACHE_IO_MAX];
+  size_t loaded = 0;
+
+  ASSERT (lock_held_by_current_thread (&io_lock));
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  while (cnt > 0)
+    {
+      size_t n, i;
+
+      if (cache_lookup (sector) != NULL)
+        {
+          sector++;
+          cnt--;
+          continue;
+        }
+      for (n = 1; n < cnt && n < CACHE_IO_MAX; n++)
+        if (cache_lookup (sector + n) != NULL)
+          break;
+
+      /* Claim the entries first, because evicting may write
+         back through io_buffer.  If evicting had to release the
+         cache lock, another thread may have loaded some of the
+         remaining sectors meanwhile, so the run ends there. */
+      for (i = 0; i < n; )
+        {
+          struct cache_entry *e = evict ();
+          if (e == NULL)
+            {
+              size_t j;
+              for (j = i; j < n; j++)
+                if (cache_lookup (sector + j) != NULL)
+                  break;
+              n = j;
+              continue;
+            }
+          claim (e, sector + i, false);
+          entries[i++] = e;
+        }
+      if (n == 0)
+        continue;
+
+      lock_release (&cache_lock);
+      block_read_multiple (fs_device, sector, n, io_buffer);
+      checksum_verify (sector, io_buffer, n);
+      lock_acquire (&cache_lock);
+      for (i = 0; i < n; i++)
+        {
+          memcpy (entries[i]->data, io_buffer + i * BLOCK_SECTOR_SIZE,
+                  BLOCK_SECTOR_SIZE);
+          finish_loading (entries[i]);
+        }
+      sector += n;
+      cnt -= n;
+      loaded += n;
+    }
+  return loaded;
+}
+
+/* Makes sure that the CNT consecutive sectors starting at SECTOR
+   are cached, so that a large read of them costs a few
+   multi-sector disk reads instead of one read per sector.
+   CNT is capped at A1IN_MAX, the share of the cache that newly
+   read sectors may fill, so that loading cannot evict sectors of
+   the same span. */
+void
+cache_load (block_sector_t sector, size_t cnt)
+{
+  size_t loaded;
+
+  if (cnt > A1IN_MAX)
+    cnt = A1IN_MAX;
+
+  lock_acquire (&io_lock);
+  lock_acquire (&cache_lock);
+  loaded = load_span (sector, cnt);
+  miss_cnt += loaded;
+  lock_release (&cache_lock);
+  lock_release (&io_lock);
+}
+
+/* Reads SIZE bytes starting at byte offset OFS within SECTOR
+   into BUFFER.  META is true if SECTOR holds metadata. */
+static void
+read_sector (block_sector_t sector, void *buffer, off_t ofs, off_t size,
+             bool meta)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_pin (sector, true, meta);
+  lock_acquire (&e->lock);
+  memcpy (buffer, e->data + ofs, size);
+  lock_release (&e->lock);
+  cache_unpin (e, false);
+}
+
+/* Counts the dirty entries and, among them, the unlogged file
+   data entries that thread T dirtied last.  Returns the number
+   of dirty entries, stores the number of T's entries in *OWN and
+   the lowest-numbered of them that may be written back now, if
+   any, in *NEXT.
+   The cache lock must be held. */
+static size_t
+count_dirty (struct thread *t, size_t *own, struct cache_entry **next)
+{
+  size_t dirty = 0;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  *own = 0;
+  *next = NULL;
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      if (!e->valid || !e->dirty)
+        continue;
+      dirty++;
+      if (e->dirtier == t && !e->meta && !e->logged)
+        {
+          ++*own;
+          if (!e->writing && (*next == NULL || e->sector < (*next)->sector))
+            *next = e;
+        }
+    }
+  return dirty;
+}
+
+/* Before the running thread dirties another sector of file data,
+   writes back the sectors it has already dirtied while the cache
+   holds more than DIRTY_MAX dirty entries and at least
+   DIRTY_THREAD_MIN of those are the running thread's. */
+static void
+throttle (void)
+{
+  struct thread *t = thread_current ();
+  struct cache_entry *next;
+  size_t own;
+
+  lock_acquire (&cache_lock);
+  if (count_dirty (t, &own, &next) <= DIRTY_MAX || own < DIRTY_THREAD_MIN)
+    {
+      lock_release (&cache_lock);
+      return;
+    }
+  lock_release (&cache_lock);
+
+  lock_acquire (&io_lock);
+  lock_acquire (&cache_lock);
+  throttle_cnt++;
+  while (count_dirty (t, &own, &next) > DIRTY_MAX
+         && own >= DIRTY_THREAD_MIN && next != NULL)
+    {
+      unsigned long long before = writeback_cnt;
+      writeback (next);
+      throttled_cnt += writeback_cnt - before;
+    }
+  lock_release (&cache_lock);
+  lock_release (&io_lock);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR, starting at byte
+   offset OFS within the sector.  META is true if SECTOR holds
+   metadata. */
+static void
+write_sector (block_sector_t sector, const void *buffer, off_t ofs,
+              off_t size, bool meta)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  if (!meta)
+    throttle ();
+  e = cache_pin (sector, size < BLOCK_SECTOR_SIZE, meta);
+  lock_acquire (&e->lock);
+  memcpy (e->data + ofs, buffer, size);
+  lock_release (&e->lock);
+  cache_unpin (e, true);
+}
+
+/* Fills SECTOR with zeros without reading it from disk.  META is
+   true if SECTOR holds metadata. */
+static void
+zero_sector (block_sector_t sector, bool meta)
+{
+  struct cache_entry *e;
+
+  if (!meta)
+    throttle ();
+  e = cache_pin (sector, false, meta);
+  lock_acquire (&e->lock);
+  memset (e->data, 0, BLOCK_SECTOR_SIZE);
+  lock_release (&e->lock);
+  cache_unpin (e, true);
+}
+
+/* Makes sure that the whole cluster holding SECTOR is cached,
+   reading the part that is not with one transfer instead of one
+   sector at a time as the file is read. */
+static void
+load_cluster (block_sector_t sector)
+{
+  block_sector_t first = sector / filesys_cluster * filesys_cluster;
+  size_t cnt = filesys_cluster;
+  bool cached;
+
+  lock_acquire (&cache_lock);
+  cached = cache_lookup (sector) != NULL;
+  if (!cached)
+    cluster_cnt++;
+  lock_release (&cache_lock);
+  if (!cached)
+    {
+      if (first + cnt > block_size (fs_device))
+        cnt = block_size (fs_device) - first;
+      cache_load (first, cnt);
+    }
+}
+
+/* Reads SIZE bytes starting at byte offset OFS within SECTOR
+   into BUFFER. */
+void
+cache_read (block_sector_t sector, void *buffer, off_t ofs, off_t size)
+{
+  if (filesys_cluster > 1)
+    load_cluster (sector);
+  read_sector (sector, buffer, ofs, size, false);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR, starting at byte
+   offset OFS within the sector.  The data reaches the disk
+   later, when the sector is evicted or flushed. */
+void
+cache_write (block_sector_t sector, const void *buffer, off_t ofs, off_t size)
+{
+  write_sector (sector, buffer, ofs, size, false);
+}
+
+/* Fills SECTOR with zeros without reading it from disk. */
+void
+cache_zero (block_sector_t sector)
+{
+  zero_sector (sector, false);
+}
+
+/* Like cache_read(), but for a metadata sector, which the cache
+   keeps in preference to file data. */
+void
+cache_read_meta (block_sector_t sector, void *buffer, off_t ofs, off_t size)
+{
+  read_sector (sector, buffer, ofs, size, true);
+}
+
+/* Like cache_write(), but for a metadata sector. */
+void
+cache_write_meta (block_sector_t sector, const void *buffer,
+                  off_t ofs, off_t size)
+{
+  write_sector (sector, buffer, ofs, size, true);
+}
+
+/* Like cache_zero(), but for a metadata sector. */
+void
+cache_zero_meta (block_sector_t sector)
+{
+  zero_sector (sector, true);
+}
+
+/* Holds metadata SECTOR in the cache until cache_unhold(), so
+   that it is never evicted.  Returns true if successful, false
+   if too many sectors are already held. */
+bool
+cache_hold (block_sector_t sector)
+{
+  lock_acquire (&cache_lock);
+  if (hold_cnt >= HOLD_MAX)
+    {
+      lock_release (&cache_lock);
+      return false;
+    }
+  hold_cnt++;
+  lock_release (&cache_lock);
+
+  cache_pin (sector, true, true);
+  return true;
+}
+
+/* Lets SECTOR, held by a successful cache_hold(), be evicted
+   again. */
+void
+cache_unhold (block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = cache_lookup (sector);
+  ASSERT (e != NULL && e->pin_cnt > 0);
+  ASSERT (hold_cnt > 0);
+  hold_cnt--;
+  lock_release (&cache_lock);
+
+  cache_unpin (e, false);
+}
+
+/* Asks the read-ahead job to load the CNT sectors starting at
+   SECTOR into the cache.  Returns without waiting.  The request
+   is dropped if the read-ahead queue is full. */
+void
+cache_readahead (block_sector_t sector, size_t cnt)
+{
+  lock_acquire (&cache_lock);
+  if (cnt > 0 && readahead_queued < READAHEAD_MAX)
+    {
+      size_t idx = (readahead_head + readahead_queued) % READAHEAD_MAX;
+      readahead_queue[idx].start = sector;
+      readahead_queue[idx].cnt = cnt;
+      readahead_queued++;
+      work_queue (&readahead_work, WORK_LOW);
+    }
+  lock_release (&cache_lock);
+}
+
+/* Read-ahead job.  Until the queue is empty, loads the sectors
+   of each queued run that are not already cached, together with
+   any queued runs that directly follow it, up to A1IN_MAX
+   sectors at a time so that a run cannot evict itself. */
+static void
+readahead_run (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t sector;
+      size_t cnt;
+
+      lock_acquire (&io_lock);
+      lock_acquire (&cache_lock);
+      if (readahead_queued == 0)
+        {
+          lock_release (&cache_lock);
+          lock_release (&io_lock);
+          return;
+        }
+      sector = readahead_queue[readahead_head].start;
+      cnt = readahead_queue[readahead_head].cnt;
+      readahead_head = (readahead_head + 1) % READAHEAD_MAX;
+      readahead_queued--;
+      while (readahead_queued > 0
+             && readahead_queue[readahead_head].start == sector + cnt
+             && cnt + readahead_queue[readahead_head].cnt <= A1IN_MAX)
+        {
+          cnt += readahead_queue[readahead_head].cnt;
+          readahead_head = (readahead_head + 1) % READAHEAD_MAX;
+          readahead_queued--;
+        }
+      if (cnt > A1IN_MAX)
+        cnt = A1IN_MAX;
+      readahead_cnt += load_span (sector, cnt);
+      lock_release (&cache_lock);
+      lock_release (&io_lock);
+    }
+}
+
+/* qsort() comparison function for sector numbers. */
+static int
+compare_sectors (const void *a_, const void *b_)
+{
+  const block_sector_t *a = a_;
+  const block_sector_t *b = b_;
+
+  return *a < *b ? -1 : *a > *b;
+}
+
+/* Sorts the CNT sectors in SECTORS and stores the runs of
+   consecutive ones in RANGES, which must have room for CNT runs.
+   Returns the number of runs. */
+static size_t
+make_ranges (block_sector_t *sectors, size_t cnt, struct cache_range *ranges)
+{
+  size_t range_cnt = 0;
+  size_t i;
+
+  qsort (sectors, cnt, sizeof *sectors, compare_sectors);
+  for (i = 0; i < cnt; i++)
+    if (range_cnt > 0 && sectors[i] == (ranges[range_cnt - 1].start
+                                        + ranges[range_cnt - 1].cnt))
+      ranges[range_cnt - 1].cnt++;
+    else
+      {
+        ranges[range_cnt].start = sectors[i];
+        ranges[range_cnt].cnt = 1;
+        range_cnt++;
+      }
+  return range_cnt;
+}
+
+/* Largest gap between sectors that cache_prefetch() reads through
+   rather than starting a new run. */
+#define PREFETCH_GAP 4
+
+/* Asks the read-ahead job to load the CNT sectors in SECTORS, in
+   any order, into the cache, and returns without waiting.
+   SECTORS is sorted in place.  Sectors up to PREFETCH_GAP apart
+   are loaded in one run, gap included, since a few sectors more
+   cost less than another seek.  Runs that do not fit in the
+   read-ahead queue are dropped. */
+void
+cache_prefetch (block_sector_t *sectors, size_t cnt)
+{
+  block_sector_t start = 0;
+  size_t run = 0;
+  size_t i;
+
+  qsort (sectors, cnt, sizeof *sectors, compare_sectors);
+  for (i = 0; i < cnt; i++)
+    {
+      if (run > 0 && sectors[i] < start + run)
+        continue;
+      if (run > 0 && sectors[i] <= start + run + PREFETCH_GAP
+          && sectors[i] - start < A1IN_MAX)
+        run = sectors[i] - start + 1;
+      else
+        {
+          cache_readahead (start, run);
+          start = sectors[i];
+          run = 1;
+        }
+    }
+  cache_readahead (start, run);
+}
+
+/* Stores in RANGES, in sector order, at most MAX runs of
+   consecutive sectors that the cache holds, and returns the
+   number stored.  If the cached sectors fall into more than MAX
+   runs, the least used are left out: those on a1in before those
+   on am, least recently used first. */
+size_t
+cache_warm_list (struct cache_range *ranges, size_t max)
+{
+  block_sector_t by_use[CACHE_SIZE], sorted[CACHE_SIZE];
+  struct cache_range runs[CACHE_SIZE];
+  struct list *lists[] = {&am, &a1in};
+  size_t cnt = 0;
+  size_t range_cnt, i;
+
+  /* List the cached sectors from most to least used. */
+  lock_acquire (&cache_lock);
+  for (i = 0; i < sizeof lists / sizeof *lists; i++)
+    {
+      struct list_elem *elem;
+
+      for (elem = list_rbegin (lists[i]); elem != list_rend (lists[i]);
+           elem = list_prev (elem))
+        {
+          struct cache_entry *e = list_entry (elem, struct cache_entry, elem);
+          if (!e->loading)
+            by_use[cnt++] = e->sector;
+        }
+    }
+  lock_release (&cache_lock);
+
+  /* Drop the least used sectors until the rest fit. */
+  for (;;)
+    {
+      memcpy (sorted, by_use, cnt * sizeof *sorted);
+      range_cnt = make_ranges (sorted, cnt, runs);
+      if (range_cnt <= max)
+        break;
+      cnt--;
+    }
+  memcpy (ranges, runs, range_cnt * sizeof *ranges);
+  return range_cnt;
+}
+
+/* Starts loading the CNT sector runs in RANGES, as returned by
+   cache_warm_list() at the last shutdown, into the cache.
+   Returns without waiting.  Runs that lie outside the file system
+   are ignored.  Only entries that hold no sector are filled, so
+   warming up never evicts a sector that has been used. */
+void
+cache_warm (const struct cache_range *ranges, size_t cnt)
+{
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  warm_range_cnt = 0;
+  for (i = 0; i < cnt && warm_range_cnt < CACHE_SIZE; i++)
+    if (ranges[i].cnt > 0 && ranges[i].start < block_size (fs_device)
+        && ranges[i].cnt <= block_size (fs_device) - ranges[i].start)
+      warm_ranges[warm_range_cnt++] = ranges[i];
+  if (warm_range_cnt > 0)
+    work_queue (&warm_work, WORK_LOW);
+  lock_release (&cache_lock);
+}
+
+/* Warm-up job.  Loads the runs queued by cache_warm() while there
+   are free entries to hold them. */
+static void
+warm_run (void *aux UNUSED)
+{
+  size_t i;
+
+  lock_acquire (&io_lock);
+  lock_acquire (&cache_lock);
+  for (i = 0; i < warm_range_cnt; i++)
+    {
+      size_t cnt = list_size (&free_list);
+
+      if (cnt == 0)
+        break;
+      if (cnt > warm_ranges[i].cnt)
+        cnt = warm_ranges[i].cnt;
+      warmed_cnt += load_span (warm_ranges[i].start, cnt);
+    }
+  warm_range_cnt = 0;
+  lock_release (&cache_lock);
+  lock_release (&io_lock);
+}
+
+/* Returns the dirty, unlogged entry with the lowest sector
+   number that is at least FROM, or a null pointer if there is
+   none.
+   The cache lock must be held. */
+static struct cache_entry *
+next_dirty (block_sector_t from)
+{
+  struct cache_entry *best = NULL;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      if (e->valid && writable (e) && e->sector >= from
+          && (best == NULL || e->sector < best->sector))
+        best = e;
+    }
+  return best;
+}
+
+/* Completion function for flush_some()'s and cache_read_pages()'s
+   requests. */
+static void
+flush_done (struct block_request *r)
+{
+  sema_up (r->aux);
+}
+
+/* Writes back up to MAX dirty sectors, at most CACHE_IO_MAX,
+   starting at the lowest dirty sector at or after *CURSOR and
+   wrapping around at the end of the disk.  Each run of
+   consecutive dirty sectors is submitted as one request as soon
+   as it is staged, and all of them are in flight together.
+   Advances *CURSOR past the last sector written.  Returns the
+   number of sectors written, 0 if none was dirty.
+   The I/O lock and the cache lock must be held.  The cache lock
+   is released while the requests are in flight. */
+static size_t
+flush_some (block_sector_t *cursor, size_t max)
+{
+  struct block_request reqs[CACHE_IO_MAX];
+  struct cache_entry *entries[CACHE_IO_MAX];
+  struct semaphore done;
+  size_t used = 0, req_cnt = 0, i;
+
+  ASSERT (lock_held_by_current_thread (&io_lock));
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  if (max > CACHE_IO_MAX)
+    max = CACHE_IO_MAX;
+  sema_init (&done, 0);
+  while (used < max)
+    {
+      struct cache_entry *e = next_dirty (*cursor);
+      struct block_request *r;
+
+      if (e == NULL && *cursor != 0)
+        e = next_dirty (*cursor = 0);
+      if (e == NULL)
+        break;
+
+      r = &reqs[req_cnt++];
+      r->block = fs_device;
+      r->sector = e->sector;
+      r->cnt = 0;
+      r->buffer = io_buffer + used * BLOCK_SECTOR_SIZE;
+      r->write = true;
+      r->done = flush_done;
+      r->aux = &done;
+      while (used < max)
+        {
+          struct cache_entry *next = cache_lookup (e->sector + r->cnt);
+          if (!writable (next))
+            break;
+          stage (next, io_buffer + used * BLOCK_SECTOR_SIZE);
+          entries[used++] = next;
+          r->cnt++;
+        }
+      *cursor = e->sector + r->cnt;
+      checksum_update (r->sector, r->buffer, r->cnt);
+      block_submit (r);
+    }
+
+  lock_release (&cache_lock);
+  for (i = 0; i < req_cnt; i++)
+    sema_down (&done);
+  lock_acquire (&cache_lock);
+  unstage (entries, used);
+  writeback_cnt += used;
+  return used;
+}
+
+/* Write-behind thread.  Periodically writes back a batch of
+   dirty sectors in ascending sector order, continuing where the
+   previous batch stopped and wrapping around at the end. */
+static void
+flush_daemon (void *aux UNUSED)
+{
+  int64_t interval = DIV_ROUND_UP ((int64_t) cache_flush_interval
+                                   * TIMER_FREQ, 1000);
+
+  /* Reserve a twentieth of each interval, so that write-back keeps
+     to schedule however busy the CPU is. */
+  thread_set_deadline (DIV_ROUND_UP (interval, 20), interval);
+  for (;;)
+    {
+      unsigned cnt;
+
+      timer_sleep (interval);
+      inode_flush_delayed ();
+      journal_commit ();
+
+      lock_acquire (&io_lock);
+      lock_acquire (&cache_lock);
+      for (cnt = 0; cnt < cache_flush_batch; )
+        {
+          size_t n = flush_some (&flush_cursor, cache_flush_batch - cnt);
+          if (n == 0)
+            break;
+          cnt += n;
+        }
+      lock_release (&cache_lock);
+      lock_release (&io_lock);
+      checksum_sync ();
+    }
+}
+
+/* Writes every dirty sector in the cache that is not logged back
+   to disk, in ascending sector order so that runs are written
+   together. */
+void
+cache_flush (void)
+{
+  block_sector_t cursor = 0;
+
+  lock_acquire (&io_lock);
+  lock_acquire (&cache_lock);
+  while (flush_some (&cursor, CACHE_IO_MAX) > 0)
+    continue;
+  lock_release (&cache_lock);
+  lock_release (&io_lock);
+}
+
+/* Makes pinned entry E part of the journal's running transaction,
+   if it is not already, and returns true if it was not.  The
+   journal's credits guarantee that there is room.  Dirty data that E
+   already holds is written home first: it may belong to a
+   committed transaction, whose journal copy is about to be
+   overwritten by the next commit, and once the new data is copied
+   in the old version would be lost.
+   The cache lock must be held.  It may be released meanwhile. */
+static bool
+log_entry (struct cache_entry *e)
+{
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+  ASSERT (e->pin_cnt > 0);
+
+  while (!e->logged && e->dirty)
+    clean (e);
+  if (e->logged)
+    return false;
+  if (logged_cnt >= JOURNAL_MAX)
+    PANIC ("journal transaction overflow at sector %"PRDSNu, e->sector);
+  e->logged = true;
+  logged_cnt++;
+  return true;
+}
+
+/* Like cache_write_meta(), but adds SECTOR to the journal's
+   running transaction, so that the sector does not reach its
+   home location until the transaction has been committed.
+   Returns true if SECTOR was not already part of the
+   transaction. */
+bool
+cache_write_logged (block_sector_t sector, const void *buffer,
+                    off_t ofs, off_t size)
+{
+  struct cache_entry *e;
+  bool added;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_pin (sector, size < BLOCK_SECTOR_SIZE, true);
+  lock_acquire (&cache_lock);
+  added = log_entry (e);
+  lock_release (&cache_lock);
+  lock_acquire (&e->lock);
+  memcpy (e->data + ofs, buffer, size);
+  lock_release (&e->lock);
+  cache_unpin (e, true);
+  return added;
+}
+
+/* Like cache_zero_meta(), but logs SECTOR as cache_write_logged()
+   does. */
+bool
+cache_zero_logged (block_sector_t sector)
+{
+  struct cache_entry *e;
+  bool added;
+
+  e = cache_pin (sector, false, true);
+  lock_acquire (&cache_lock);
+  added = log_entry (e);
+  lock_release (&cache_lock);
+  lock_acquire (&e->lock);
+  memset (e->data, 0, BLOCK_SECTOR_SIZE);
+  lock_release (&e->lock);
+  cache_unpin (e, true);
+  return added;
+}
+
+/* Returns true if entry E holds one of the CNT sectors starting
+   at SECTOR. */
+static bool
+in_range (const struct cache_entry *e, block_sector_t sector, size_t cnt)
+{
+  return e->valid && e->sector >= sector && e->sector - sector < cnt;
+}
+
+/* Reads the CNT sectors starting at SECTOR straight from disk
+   into BUFFER, without caching them, so that a large transfer
+   does not evict everything else.  Cached copies that are dirty
+   are written back first, so that the disk holds their latest
+   contents.  The caller must keep the sectors from being written
+   meanwhile.  BUFFER must be in kernel memory, since the transfer
+   is carried out by another thread. */
+void
+cache_read_direct (block_sector_t sector, size_t cnt, void *buffer)
+{
+  size_t i;
+
+  ASSERT (is_kernel_vaddr (buffer));
+
+  lock_acquire (&io_lock);
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    while (in_range (&cache[i], sector, cnt) && writable (&cache[i]))
+      writeback (&cache[i]);
+  direct_cnt += cnt;
+  lock_release (&cache_lock);
+  lock_release (&io_lock);
+
+  block_read_multiple (fs_device, sector, cnt, buffer);
+  checksum_verify (sector, buffer, cnt);
+}
+
+/* Reads each of the CNT pages in KPAGES straight from disk, as
+   cache_read_direct() does, from the page's worth of consecutive
+   sectors starting at the corresponding entry in SECTORS.  Every
+   read is submitted before waiting for any, so that the block
+   layer merges those that follow one another on disk into a
+   single transfer. */
+void
+cache_read_pages (const block_sector_t sectors[], void *kpages[], size_t cnt)
+{
+  size_t per_page = PGSIZE / BLOCK_SECTOR_SIZE;
+  struct block_request reqs[CACHE_PAGES_MAX];
+  struct semaphore done;
+  size_t i, j;
+
+  ASSERT (cnt <= CACHE_PAGES_MAX);
+
+  lock_acquire (&io_lock);
+  lock_acquire (&cache_lock);
+  for (i = 0; i < cnt; i++)
+    for (j = 0; j < CACHE_SIZE; j++)
+      while (in_range (&cache[j], sectors[i], per_page)
+             && writable (&cache[j]))
+        writeback (&cache[j]);
+  direct_cnt += cnt * per_page;
+  lock_release (&cache_lock);
+  lock_release (&io_lock);
+
+  sema_init (&done, 0);
+  for (i = 0; i < cnt; i++)
+    {
+      struct block_request *r = &reqs[i];
+      r->block = fs_device;
+      r->sector = sectors[i];
+      r->cnt = per_page;
+      r->buffer = kpages[i];
+      r->write = false;
+      r->done = flush_done;
+      r->aux = &done;
+      block_submit (r);
+    }
+  for (i = 0; i < cnt; i++)
+    sema_down (&done);
+  for (i = 0; i < cnt; i++)
+    checksum_verify (sectors[i], kpages[i], per_page);
+}
+
+/* Discards the cached copies of the CNT sectors starting at
+   SECTOR, waiting for any that are being read or used.
+   The I/O lock and the cache lock must be held, so that no
+   write-back is in flight. */
+static void
+discard_range (block_sector_t sector, size_t cnt)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&io_lock));
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      while (in_range (e, sector, cnt) && (e->loading || e->pin_cnt > 0))
+        cond_wait (e->loading ? &e->loaded : &entry_free, &cache_lock);
+      if (in_range (e, sector, cnt))
+        {
+          forget (e);
+          list_push_back (&free_list, &e->elem);
+        }
+    }
+}
+
+/* Writes the CNT sectors starting at SECTOR straight from BUFFER
+   to disk, without caching them.  Cached copies are discarded
+   first, so that an older dirty copy can never be written back
+   over the new data.  The I/O lock is held until the write is
+   done, which keeps read-ahead from loading an old copy
+   meanwhile.  The caller must keep the sectors from being read
+   or written otherwise.  BUFFER must be in kernel memory, as for
+   cache_read_direct(). */
+void
+cache_write_direct (block_sector_t sector, size_t cnt, const void *buffer)
+{
+  ASSERT (is_kernel_vaddr (buffer));
+
+  lock_acquire (&io_lock);
+  lock_acquire (&cache_lock);
+  discard_range (sector, cnt);
+  direct_cnt += cnt;
+  lock_release (&cache_lock);
+
+  checksum_update (sector, buffer, cnt);
+  block_write_multiple (fs_device, sector, cnt, buffer);
+  lock_release (&io_lock);
+}
+
+/* Drops the cached copies of the CNT sectors starting at SECTOR,
+   writing back any that are dirty first, so that their entries
+   are the first to be reused.  Entries in use, held or logged are
+   left alone. */
+void
+cache_drop (block_sector_t sector, size_t cnt)
+{
+  size_t i;
+
+  lock_acquire (&io_lock);
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      while (in_range (e, sector, cnt) && writable (e) && !e->writing)
+        writeback (e);
+      if (in_range (e, sector, cnt) && !e->dirty && !e->logged
+          && !e->loading && !e->writing && e->pin_cnt == 0)
+        {
+          forget (e);
+          list_push_back (&free_list, &e->elem);
+          dropped_cnt++;
+        }
+    }
+  lock_release (&cache_lock);
+  lock_release (&io_lock);
+}
+
+/* Returns the number of logged sectors. */
+size_t
+cache_logged_cnt (void)
+{
+  return logged_cnt;
+}
+
+/* Copies the sector number and contents of each logged entry into
+   SECTORS and IMAGES, which must have room for JOURNAL_MAX of
+   each, and returns the number of entries copied. */
+size_t
+cache_log_snapshot (block_sector_t *sectors, uint8_t *images)
+{
+  size_t cnt = 0;
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].logged)
+      {
+        sectors[cnt] = cache[i].sector;
+        lock_acquire (&cache[i].lock);
+        memcpy (images + cnt * BLOCK_SECTOR_SIZE, cache[i].data,
+                BLOCK_SECTOR_SIZE);
+        lock_release (&cache[i].lock);
+        cnt++;
+      }
+  ASSERT (cnt == logged_cnt);
+  lock_release (&cache_lock);
+  return cnt;
+}
+
+/* Unpins every logged entry once the journal has committed them,
+   leaving them dirty, to be written home later. */
+void
+cache_log_release (void)
+{
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    cache[i].logged = false;
+  logged_cnt = 0;
+  cond_broadcast (&entry_free, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Writes back those of the CNT sectors in SECTORS that are cached,
+   dirty, and not logged.  Holding the I/O lock also means that
+   no other write-back of them is still in flight on return. */
+void
+cache_checkpoint (const block_sector_t *sectors, size_t cnt)
+{
+  size_t i;
+
+  lock_acquire (&io_lock);
+  lock_acquire (&cache_lock);
+  for (i = 0; i < cnt; i++)
+    {
+      struct cache_entry *e = cache_lookup (sectors[i]);
+      if (writable (e))
+        writeback (e);
+    }
+  lock_release (&cache_lock);
+  lock_release (&io_lock);
+}
+
+/* Writes back each dirty sector that is marked in SECTORS and is
+   not logged, in sector order, together with the dirty sectors
+   around it in one multi-sector write.  Sectors that are not
+   marked stay in the cache.  Returns true if any marked metadata
+   sector was dirty or logged beforehand, that is, if some of the
+   metadata among SECTORS had not reached the disk yet. */
+bool
+cache_sync (const struct bitmap *sectors)
+{
+  size_t size = bitmap_size (sectors);
+  bool meta = false;
+  size_t i;
+
+  lock_acquire (&io_lock);
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      if (e->valid && e->meta && (e->dirty || e->logged)
+          && e->sector < size && bitmap_test (sectors, e->sector))
+        meta = true;
+    }
+  for (;;)
+    {
+      struct cache_entry *next = NULL;
+      unsigned long long before = writeback_cnt;
+
+      for (i = 0; i < CACHE_SIZE; i++)
+        {
+          struct cache_entry *e = &cache[i];
+          if (e->valid && writable (e) && e->sector < size
+              && bitmap_test (sectors, e->sector)
+              && (next == NULL || e->sector < next->sector))
+            next = e;
+        }
+      if (next == NULL)
+        break;
+      writeback (next);
+      synced_cnt += writeback_cnt - before;
+    }
+  lock_release (&cache_lock);
+  lock_release (&io_lock);
+  return meta;
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  printf ("Cache: %llu hits, %llu misses, %llu coalesced, "
+          "%llu write-backs, %llu read-ahead, %llu warmed, "
+          "%llu direct, %llu dropped, %llu synced, %llu clusters\n",
+          hit_cnt, miss_cnt, coalesced_cnt, writeback_cnt, readahead_cnt,
+          warmed_cnt, direct_cnt, dropped_cnt, synced_cnt,
+          cluster_cnt);
+  printf ("Cache lists: a1in %zu sectors, %llu hits; am %zu sectors, "
+          "%llu hits; a1out %llu hits; %llu cold misses\n",
+          a1in_cnt, a1in_hit_cnt, list_size (&am), am_hit_cnt,
+          a1out_hit_cnt, cold_miss_cnt);
+  printf ("Cache throttling: %llu writes delayed, %llu sectors written\n",
+          throttle_cnt, throttled_cnt);
+  printf ("Cache metadata: %zu sectors, %zu held, %llu hits, %llu misses\n",
+          meta_cnt, hold_cnt, meta_hit_cnt, meta_miss_cnt);
+}
@@ -0,0 +1,60 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+struct bitmap;
+
+/* Number of sectors held by the buffer cache. */
+#define CACHE_SIZE 64
+
+/* A run of CNT consecutive sectors starting at START, as saved in
+   the warm-up list. */
+struct cache_range
+  {
+    block_sector_t start;               /* First sector. */
+    uint32_t cnt;                       /* Number of sectors. */
+  };
+
+/* Most pages cache_read_pages() reads in one call. */
+#define CACHE_PAGES_MAX 8
+
+/* Write-behind interval in milliseconds (0 disables write-behind)
+   and maximum number of sectors written back per interval. */
+extern unsigned cache_flush_interval;
+extern unsigned cache_flush_batch;
+
+void cache_init (void);
+void cache_read (block_sector_t, void *buffer, off_t ofs, off_t size);
+void cache_write (block_sector_t, const void *buffer, off_t ofs, off_t size);
+void cache_zero (block_sector_t);
+void cache_read_meta (block_sector_t, void *buffer, off_t ofs, off_t size);
+void cache_write_meta (block_sector_t, const void *buffer,
+                       off_t ofs, off_t size);
+void cache_zero_meta (block_sector_t);
+bool cache_hold (block_sector_t);
+void cache_unhold (block_sector_t);
+void cache_read_direct (block_sector_t, size_t cnt, void *buffer);
+void cache_write_direct (block_sector_t, size_t cnt, const void *buffer);
+void cache_read_pages (const block_sector_t sectors[], void *kpages[],
+                       size_t cnt);
+void cache_readahead (block_sector_t, size_t cnt);
+void cache_prefetch (block_sector_t *sectors, size_t cnt);
+void cache_load (block_sector_t, size_t cnt);
+void cache_drop (block_sector_t, size_t cnt);
+void cache_flush (void);
+bool cache_sync (const struct bitmap *sectors);
+size_t cache_warm_list (struct cache_range *, size_t max);
+void cache_warm (const struct cache_range *, size_t cnt);
+bool cache_write_logged (block_sector_t, const void *buffer,
+                         off_t ofs, off_t size);
+bool cache_zero_logged (block_sector_t);
+size_t cache_logged_cnt (void);
+size_t cache_log_snapshot (block_sector_t *sectors, uint8_t *images);
+void cache_log_release (void);
+void cache_checkpoint (const block_sector_t *, size_t cnt);
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
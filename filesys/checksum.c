@@ -0,0 +1,274 @@
+#include "filesys/checksum.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Sector checksums.
+
+   A disk formatted with FS_CHECKSUM keeps a CRC32 of every sector
+   in a table that starts at CHECKSUM_SECTOR, one 32-bit entry per
+   sector.  The buffer cache updates a sector's entry whenever it
+   writes the sector and checks it whenever it reads the sector,
+   so that a sector the disk corrupted behind our back is
+   reported instead of silently returned.  The superblock, the
+   journal and the table itself are written straight to disk and
+   are not covered.
+
+   The whole table is kept in memory.  Changed table sectors are
+   written out lazily, by checksum_sync(), which the cache's
+   write-behind thread calls after each batch, and at unmount.
+   The table on disk is therefore only trusted after a clean
+   unmount; after a crash it is rebuilt from the disk's contents,
+   once the journal has been replayed. */
+
+/* Table entries stored in one sector. */
+#define CRCS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (uint32_t))
+
+/* Sectors read at a time while rebuilding the table. */
+#define REBUILD_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+bool checksum_enabled;
+
+/* Lookup tables for slicing-by-8 CRC32, built by checksum_init().
+   crc_table[0] is the usual byte-at-a-time table; crc_table[K]
+   advances a byte's contribution by K more bytes of zeros, so
+   that 8 bytes can be folded in with 8 independent lookups. */
+static uint32_t crc_table[8][256];
+
+static uint32_t *table;                 /* CRC of each sector, or null. */
+static size_t table_sectors;            /* Sectors in the table on disk. */
+static size_t table_pages;              /* Pages holding TABLE. */
+static struct bitmap *table_dirty;      /* Table sectors changed. */
+static struct lock checksum_lock;       /* Protects the above. */
+
+/* Statistics. */
+static unsigned long long verified_cnt; /* Sectors checked on read. */
+static unsigned long long mismatch_cnt; /* Sectors that failed. */
+static unsigned long long table_write_cnt; /* Table sectors written. */
+
+static uint32_t crc32 (const void *, size_t);
+static void allocate_table (void);
+static bool covered (block_sector_t);
+
+/* Initializes the checksum module.  Checksums remain off until
+   checksum_rebuild() or checksum_open() turns them on. */
+void
+checksum_init (void)
+{
+  unsigned i, k;
+
+  lock_init (&checksum_lock);
+  for (i = 0; i < 256; i++)
+    {
+      uint32_t crc = i;
+      for (k = 0; k < 8; k++)
+        crc = (crc >> 1) ^ (crc & 1 ? 0xedb88320 : 0);
+      crc_table[0][i] = crc;
+    }
+  for (i = 0; i < 256; i++)
+    for (k = 1; k < 8; k++)
+      crc_table[k][i] = ((crc_table[k - 1][i] >> 8)
+                         ^ crc_table[0][crc_table[k - 1][i] & 0xff]);
+  ASSERT (crc32 ("123456789", 9) == 0xcbf43926);
+}
+
+/* Returns the CRC32 of the SIZE bytes in BUFFER. */
+static uint32_t
+crc32 (const void *buffer, size_t size)
+{
+  const uint8_t *p = buffer;
+  uint32_t crc = 0xffffffff;
+
+  for (; size >= 8; p += 8, size -= 8)
+    {
+      uint32_t lo = crc ^ (p[0] | p[1] << 8 | p[2] << 16
+                           | (uint32_t) p[3] << 24);
+      uint32_t hi = p[4] | p[5] << 8 | p[6] << 16 | (uint32_t) p[7] << 24;
+      crc = (crc_table[7][lo & 0xff] ^ crc_table[6][(lo >> 8) & 0xff]
+             ^ crc_table[5][(lo >> 16) & 0xff] ^ crc_table[4][lo >> 24]
+             ^ crc_table[3][hi & 0xff] ^ crc_table[2][(hi >> 8) & 0xff]
+             ^ crc_table[1][(hi >> 16) & 0xff] ^ crc_table[0][hi >> 24]);
+    }
+  for (; size > 0; p++, size--)
+    crc = (crc >> 8) ^ crc_table[0][(crc ^ *p) & 0xff];
+  return ~crc;
+}
+
+/* Returns the number of sectors that the checksum table occupies
+   on the file system device. */
+size_t
+checksum_size (void)
+{
+  return DIV_ROUND_UP (block_size (fs_device), CRCS_PER_SECTOR);
+}
+
+/* Allocates the in-memory table and its dirty bitmap. */
+static void
+allocate_table (void)
+{
+  ASSERT (table == NULL);
+
+  table_sectors = checksum_size ();
+  table_pages = DIV_ROUND_UP (table_sectors * BLOCK_SECTOR_SIZE, PGSIZE);
+  table = palloc_get_multiple (PAL_ZERO, table_pages);
+  table_dirty = bitmap_create (table_sectors);
+  if (table == NULL || table_dirty == NULL)
+    PANIC ("checksum table allocation failed--device is too large");
+}
+
+/* Returns true if SECTOR's contents are checksummed. */
+static bool
+covered (block_sector_t sector)
+{
+  return (sector < SUPERBLOCK_SECTOR
+          || (sector >= CHECKSUM_SECTOR + table_sectors
+              && sector < block_size (fs_device)));
+}
+
+/* Computes the checksum of every sector on the disk from its
+   current contents and turns checksums on.  Used when formatting
+   and after a crash, before anything is cached.  Reads the whole
+   disk. */
+void
+checksum_rebuild (void)
+{
+  block_sector_t size = block_size (fs_device);
+  block_sector_t sector;
+  uint8_t *buffer;
+
+  allocate_table ();
+  buffer = palloc_get_page (PAL_ASSERT);
+  printf ("checksum: rebuilding table for %"PRDSNu" sectors\n", size);
+  for (sector = 0; sector < size; sector += REBUILD_SECTORS)
+    {
+      size_t cnt = size - sector < REBUILD_SECTORS
+                   ? size - sector : REBUILD_SECTORS;
+      size_t i;
+
+      block_read_multiple (fs_device, sector, cnt, buffer);
+      for (i = 0; i < cnt; i++)
+        table[sector + i] = crc32 (buffer + i * BLOCK_SECTOR_SIZE,
+                                   BLOCK_SECTOR_SIZE);
+    }
+  palloc_free_page (buffer);
+  bitmap_set_all (table_dirty, true);
+  checksum_sync ();
+}
+
+/* Reads the checksum table of a cleanly unmounted disk and turns
+   checksums on. */
+void
+checksum_open (void)
+{
+  allocate_table ();
+  block_read_multiple (fs_device, CHECKSUM_SECTOR, table_sectors, table);
+}
+
+/* Writes the changed sectors of the table to disk, each run of
+   consecutive sectors with one write. */
+void
+checksum_sync (void)
+{
+  size_t i = 0;
+
+  lock_acquire (&checksum_lock);
+  if (table != NULL)
+    while ((i = bitmap_scan (table_dirty, i, 1, true)) != BITMAP_ERROR)
+      {
+        size_t n = 1;
+
+        while (i + n < table_sectors && bitmap_test (table_dirty, i + n))
+          n++;
+        bitmap_set_multiple (table_dirty, i, n, false);
+        block_write_multiple (fs_device, CHECKSUM_SECTOR + i, n,
+                              table + i * CRCS_PER_SECTOR);
+        table_write_cnt += n;
+        i += n;
+      }
+  lock_release (&checksum_lock);
+}
+
+/* Writes the table to disk and turns checksums off. */
+void
+checksum_done (void)
+{
+  checksum_sync ();
+  if (table != NULL)
+    {
+      palloc_free_multiple (table, table_pages);
+      bitmap_destroy (table_dirty);
+      table = NULL;
+    }
+}
+
+/* Records the checksums of the CNT sectors starting at SECTOR,
+   whose new contents are in BUFFER, about to be written to disk.
+   Does nothing while checksums are off. */
+void
+checksum_update (block_sector_t sector, const void *buffer, size_t cnt)
+{
+  const uint8_t *p = buffer;
+  size_t i;
+
+  if (table == NULL)
+    return;
+  lock_acquire (&checksum_lock);
+  for (i = 0; i < cnt; i++)
+    if (covered (sector + i))
+      {
+        table[sector + i] = crc32 (p + i * BLOCK_SECTOR_SIZE,
+                                   BLOCK_SECTOR_SIZE);
+        bitmap_mark (table_dirty, (sector + i) / CRCS_PER_SECTOR);
+      }
+  lock_release (&checksum_lock);
+}
+
+/* Checks the CNT sectors starting at SECTOR, just read from disk
+   into BUFFER, against their checksums.  Reports each sector
+   that does not match on the console.  Returns true if all of
+   them matched, or if checksums are off. */
+bool
+checksum_verify (block_sector_t sector, const void *buffer, size_t cnt)
+{
+  const uint8_t *p = buffer;
+  bool ok = true;
+  size_t i;
+
+  if (table == NULL)
+    return true;
+  for (i = 0; i < cnt; i++)
+    if (covered (sector + i))
+      {
+        uint32_t crc = crc32 (p + i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE);
+        uint32_t expected;
+
+        lock_acquire (&checksum_lock);
+        expected = table[sector + i];
+        verified_cnt++;
+        if (crc != expected)
+          mismatch_cnt++;
+        lock_release (&checksum_lock);
+        if (crc != expected)
+          {
+            printf ("checksum: sector %"PRDSNu" is corrupt "
+                    "(expected %08"PRIx32", found %08"PRIx32")\n",
+                    sector + i, expected, crc);
+            ok = false;
+          }
+      }
+  return ok;
+}
+
+/* Prints checksum statistics. */
+void
+checksum_print_stats (void)
+{
+  printf ("Checksums: %llu sectors verified, %llu mismatches, "
+          "%llu table writes\n",
+          verified_cnt, mismatch_cnt, table_write_cnt);
+}
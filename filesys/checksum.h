@@ -0,0 +1,30 @@
+#ifndef FILESYS_CHECKSUM_H
+#define FILESYS_CHECKSUM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+#include "filesys/filesys.h"
+#include "filesys/journal.h"
+
+/* First sector of the checksum table, which follows the journal
+   on disks formatted with FS_CHECKSUM. */
+#define CHECKSUM_SECTOR (JOURNAL_SECTOR + JOURNAL_SIZE)
+
+/* Keep a checksum of every sector?  Set before formatting to
+   format with checksums, and by mounting from the superblock. */
+extern bool checksum_enabled;
+
+void checksum_init (void);
+size_t checksum_size (void);
+void checksum_rebuild (void);
+void checksum_open (void);
+void checksum_sync (void);
+void checksum_done (void);
+
+void checksum_update (block_sector_t, const void *buffer, size_t cnt);
+bool checksum_verify (block_sector_t, const void *buffer, size_t cnt);
+
+void checksum_print_stats (void);
+
+#endif /* filesys/checksum.h */
@@ -0,0 +1,248 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+
+/* Directory entry cache.
+
+   Maps a (directory inode sector, name) pair to the sector of the
+   named inode, so that repeated lookups of the same names do not
+   have to search the directory.  A negative entry, whose sector
+   is DCACHE_NEGATIVE, records that a name does not exist.
+
+   The directory layer keeps the cache coherent: dir_lookup()
+   fills it, dir_add() and dir_remove() update it.  At most
+   DCACHE_SIZE names are cached; beyond that the least recently
+   used one is dropped.  When memory runs short, the cache's
+   shrinker drops least recently used names too. */
+
+/* Longest name that is cached.  Longer names are rare, and room
+   for them would make every entry several times larger. */
+#define DCACHE_NAME_MAX 30
+
+/* A cached name. */
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* Element in dentries. */
+    struct list_elem lru_elem;          /* Element in lru_list. */
+    block_sector_t dir;                 /* Directory inode sector. */
+    char name[DCACHE_NAME_MAX + 1];     /* Name within DIR. */
+    block_sector_t sector;              /* Inode sector, or negative. */
+  };
+
+static struct hash dentries;            /* All cached names. */
+static struct list lru_list;            /* Most recently used first. */
+static struct lock dcache_lock;         /* Protects the above. */
+
+/* Statistics. */
+static unsigned long long hit_cnt;      /* Positive hits. */
+static unsigned long long negative_cnt; /* Negative hits. */
+static unsigned long long miss_cnt;     /* Names not cached. */
+
+static hash_hash_func dentry_hash;
+static hash_less_func dentry_less;
+static struct dentry *find (block_sector_t dir, const char *name);
+static size_t shrink_count (void);
+static size_t shrink_scan (size_t cnt);
+
+/* Drops cold names when memory runs short. */
+static struct shrinker shrinker =
+  {
+    .name = "dentry cache", .count = shrink_count, .scan = shrink_scan
+  };
+
+/* Initializes the directory entry cache. */
+void
+dcache_init (void)
+{
+  hash_init (&dentries, dentry_hash, dentry_less, NULL);
+  list_init (&lru_list);
+  lock_init (&dcache_lock);
+  palloc_register_shrinker (&shrinker);
+}
+
+/* Looks up NAME in directory DIR.  If the cache knows it, stores
+   its inode sector, or DCACHE_NEGATIVE if it is known not to
+   exist, into *SECTORP and returns true.  Otherwise returns
+   false. */
+bool
+dcache_lookup (block_sector_t dir, const char *name, block_sector_t *sectorp)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    {
+      list_remove (&d->lru_elem);
+      list_push_front (&lru_list, &d->lru_elem);
+      *sectorp = d->sector;
+      if (d->sector == DCACHE_NEGATIVE)
+        negative_cnt++;
+      else
+        hit_cnt++;
+    }
+  else
+    miss_cnt++;
+  lock_release (&dcache_lock);
+
+  return d != NULL;
+}
+
+/* Records that NAME in directory DIR refers to the inode in
+   SECTOR, or does not exist if SECTOR is DCACHE_NEGATIVE. */
+void
+dcache_insert (block_sector_t dir, const char *name, block_sector_t sector)
+{
+  struct dentry *d;
+
+  if (strlen (name) > DCACHE_NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    list_remove (&d->lru_elem);
+  else
+    {
+      if (hash_size (&dentries) >= DCACHE_SIZE)
+        {
+          /* Recycle the least recently used entry. */
+          d = list_entry (list_pop_back (&lru_list), struct dentry, lru_elem);
+          hash_delete (&dentries, &d->hash_elem);
+        }
+      else
+        d = malloc (sizeof *d);
+      if (d == NULL)
+        {
+          lock_release (&dcache_lock);
+          return;
+        }
+      d->dir = dir;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dentries, &d->hash_elem);
+    }
+  d->sector = sector;
+  list_push_front (&lru_list, &d->lru_elem);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets anything cached about NAME in directory DIR. */
+void
+dcache_invalidate (block_sector_t dir, const char *name)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    {
+      hash_delete (&dentries, &d->hash_elem);
+      list_remove (&d->lru_elem);
+      free (d);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Forgets every name cached for directory DIR, which is being
+   removed, so that a later directory reusing its sector starts
+   clean. */
+void
+dcache_invalidate_dir (block_sector_t dir)
+{
+  struct list_elem *e;
+
+  lock_acquire (&dcache_lock);
+  for (e = list_begin (&lru_list); e != list_end (&lru_list); )
+    {
+      struct dentry *d = list_entry (e, struct dentry, lru_elem);
+      e = list_next (e);
+      if (d->dir == dir)
+        {
+          hash_delete (&dentries, &d->hash_elem);
+          list_remove (&d->lru_elem);
+          free (d);
+        }
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Returns the number of cached names. */
+static size_t
+shrink_count (void)
+{
+  return hash_size (&dentries);
+}
+
+/* Drops up to CNT of the least recently used names, unless the
+   dcache lock is busy, and returns the number dropped. */
+static size_t
+shrink_scan (size_t cnt)
+{
+  size_t freed = 0;
+
+  if (lock_held_by_current_thread (&dcache_lock)
+      || !lock_try_acquire (&dcache_lock))
+    return 0;
+  for (; freed < cnt && !list_empty (&lru_list); freed++)
+    {
+      struct dentry *d = list_entry (list_pop_back (&lru_list),
+                                     struct dentry, lru_elem);
+      hash_delete (&dentries, &d->hash_elem);
+      free (d);
+    }
+  lock_release (&dcache_lock);
+  return freed;
+}
+
+/* Prints directory entry cache statistics. */
+void
+dcache_print_stats (void)
+{
+  printf ("Dentry cache: %llu hits, %llu negative hits, %llu misses\n",
+          hit_cnt, negative_cnt, miss_cnt);
+}
+
+/* Returns the cached entry for NAME in DIR, or a null pointer.
+   The dcache lock must be held. */
+static struct dentry *
+find (block_sector_t dir, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&dcache_lock));
+
+  if (strlen (name) > DCACHE_NAME_MAX)
+    return NULL;
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentries, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Returns a hash value for dentry E. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_bytes (&d->dir, sizeof d->dir);
+}
+
+/* Returns true if dentry A precedes dentry B. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
@@ -0,0 +1,22 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Inode sector recorded for a name known not to exist. */
+#define DCACHE_NEGATIVE ((block_sector_t) -1)
+
+/* Maximum number of cached names. */
+#define DCACHE_SIZE 128
+
+void dcache_init (void);
+bool dcache_lookup (block_sector_t dir, const char *name,
+                    block_sector_t *sectorp);
+void dcache_insert (block_sector_t dir, const char *name,
+                    block_sector_t sector);
+void dcache_invalidate (block_sector_t dir, const char *name);
+void dcache_invalidate_dir (block_sector_t dir);
+void dcache_print_stats (void);
+
+#endif /* filesys/dcache.h */
@@ -1,32 +1,227 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include <round.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/arena.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/vaddr.h"
+#ifdef USERPROG
+#include "userprog/image.h"
+#endif
+
+/* Directory formats.
+
+   A directory's data is a sequence of sectors, each packed with
+   variable-length records (struct dir_record) that never cross a
+   sector boundary.  A record's REC_LEN reaches to the start of
+   the next record, so the last record in a sector runs to its
+   end, and a record longer than its name needs has room after
+   the name for another record.  Only the first record in a
+   sector may be free, with a zero INODE_SECTOR: removing any
+   other record merges it into the one before.  A sector of
+   zeros, as in new directory space, is a single free record.
+   Each record also stores the hash of its name, so that a search
+   compares names only when their hashes match.
+
+   A linear directory is searched from its first sector.  A hashed
+   directory, used for directories created with at least
+   DIR_HASH_MIN sectors, treats each sector as a bucket: an entry
+   named NAME is stored in the first sector, starting at
+   hash_bytes (NAME) modulo the number of sectors, that had room
+   for it when it was added.  A sector that an addition passed
+   over for lack of room is marked DIR_OVERFLOW, so a lookup stops
+   at the first unmarked sector along its probe sequence.  Marks
+   stay after removals, until the directory is rebuilt.  Both
+   formats read the same in dir_readdir().
+
+   The directory's inode also records the number of live entries
+   and, for a linear directory, the first sector that may have
+   room: every sector before it is too full to hold even the
+   shortest record.  dir_add() starts looking for room there, and
+   lookup() stops once it has seen every live entry instead of
+   reading past the space left by removals.  dir_compact() packs
+   the entries of a linear directory into as few sectors as it
+   can.
+
+   Directories grow as entries are added.  A full linear directory
+   is extended by one sector, until it would reach DIR_HASH_MIN
+   sectors; then it is rebuilt as a hashed directory with twice the
+   sectors.  A hashed directory is rebuilt at twice its size once
+   its entries would fill three quarters of it at DIR_SLOT_SIZE
+   bytes each, or once an entry fits in none of its sectors.
+
+   dir_lookup(), dir_add(), dir_remove() and dir_compact() hold the
+   directory's lock (see inode_dir_lock()), so that a lookup never
+   sees a half-finished update and two additions cannot claim the
+   same space.  dir_readdir() does not, so it may miss entries that
+   change while it runs.
+
+   A directory's inode may also carry a Bloom filter of the hashes
+   of its entries' names, so that lookup() can tell that most
+   absent names are absent without reading the directory, as
+   creating a file or looking up a missing one must.  The filter
+   is built by reading the directory the first time a lookup
+   needs it, and each addition sets its name's bits.  A removal
+   leaves them set, which makes the filter less selective but
+   never wrong, so the filter is rebuilt on a later lookup once
+   removals make up more than a quarter of the names in it, or
+   once additions have filled it past BLOOM_BITS_PER_NAME bits per
+   name. */
+#define DIR_HASH_MIN 4
+
+/* Nominal size of a directory record, by which directories are
+   sized for a number of entries.  It holds an 8-character name. */
+#define DIR_SLOT_SIZE 20
+
+/* Inode flag marking a hashed directory. */
+#define DIR_HASHED 0x01
+
+/* Record flag, kept in the first record of a sector of a hashed
+   directory, marking a sector that an addition found full. */
+#define DIR_OVERFLOW 0x01
+
+/* Sizing of name filters, whose bits are a power of 2 between
+   BLOOM_MIN_BITS and BLOOM_MAX_BITS, with room when built for
+   twice the directory's names at BLOOM_BITS_PER_NAME bits each.
+   Each name sets BLOOM_HASHES bits, for about 1 false positive
+   in 40 when the filter is full. */
+#define BLOOM_MIN_BITS 256
+#define BLOOM_MAX_BITS 65536
+#define BLOOM_BITS_PER_NAME 8
+#define BLOOM_HASHES 3
+
+/* Stat-ahead.  A program listing a directory usually opens or
+   stats each entry it reads, which would read each entry's inode
+   sector in turn.  So once dir_readdir() is called a second time,
+   or dir_readdir_batch() at all, the inode sectors of the entries
+   in the next STAT_AHEAD_SECTORS sectors of the directory are
+   queued for read-ahead, sorted so that they load in a few
+   sweeps.  The next window is queued when the reader is within a
+   sector of the end of the last.  STAT_AHEAD_MAX bounds the
+   entries in a window, each taking at least 16 bytes. */
+#define STAT_AHEAD_SECTORS 2
+#define STAT_AHEAD_MAX (STAT_AHEAD_SECTORS * BLOCK_SECTOR_SIZE / 16 + 1)
+
+/* A directory's name filter, kept by its inode. */
+struct dir_bloom
+  {
+    size_t bits;                        /* Number of bits. */
+    size_t cnt;                         /* Names added. */
+    size_t removed;                     /* Names removed since built. */
+    uint32_t words[];                   /* BITS bits. */
+  };
+
+/* Statistics for name filters. */
+static unsigned long long bloom_build_cnt;  /* Filters built. */
+static unsigned long long bloom_skip_cnt;   /* Lookups not needing reads. */
+static unsigned long long bloom_false_cnt;  /* False positives. */
+
+/* Statistics for stat-ahead. */
+static unsigned long long ahead_window_cnt; /* Windows queued. */
+static unsigned long long ahead_inode_cnt;  /* Inode sectors queued. */
 
 /* A directory. */
 struct dir 
   {
     struct inode *inode;                /* Backing store. */
     off_t pos;                          /* Current position. */
+    off_t ahead_pos;                    /* End of stat-ahead window. */
   };
 
-/* A single directory entry. */
-struct dir_entry 
+/* A directory entry record, followed by its name. */
+struct dir_record
   {
-    block_sector_t inode_sector;        /* Sector number of header. */
-    char name[NAME_MAX + 1];            /* Null terminated file name. */
-    bool in_use;                        /* In use or free? */
+    block_sector_t inode_sector;        /* Sector of inode, 0 if free. */
+    uint32_t hash;                      /* hash_bytes() of name. */
+    uint16_t rec_len;                   /* Bytes to next record, or 0. */
+    uint8_t name_len;                   /* Length of name. */
+    uint8_t flags;                      /* DIR_OVERFLOW. */
+    char name[];                        /* Name, not null terminated. */
   };
 
+/* One sector of a directory. */
+union dir_sector
+  {
+    uint8_t bytes[BLOCK_SECTOR_SIZE];
+    uint32_t words[BLOCK_SECTOR_SIZE / sizeof (uint32_t)]; /* Alignment. */
+  };
+
+/* Consecutive sectors of a directory, read together by
+   next_record(). */
+struct dir_buf
+  {
+    union dir_sector *sectors;          /* Room for CAP sectors. */
+    size_t cap;                         /* Capacity in sectors. */
+    size_t first;                       /* Index of first sector held. */
+    size_t cnt;                         /* Number of sectors held. */
+  };
+
+/* Results of add_to_sector(). */
+enum add_result
+  {
+    ADD_OK,                             /* Entry added. */
+    ADD_FULL,                           /* No room in the sector. */
+    ADD_ERROR                           /* Disk write failed. */
+  };
+
+static bool rehash (struct dir *, size_t sectors);
+
 /* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+   given SECTOR, whose parent directory is in PARENT_SECTOR.  One
+   entry is taken by "..", which refers to the parent.
+   Returns true if successful, false on failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, size_t entry_cnt,
+            block_sector_t parent_sector)
+{
+  size_t sectors = DIV_ROUND_UP (entry_cnt * DIR_SLOT_SIZE,
+                                 BLOCK_SECTOR_SIZE);
+  struct dir *dir;
+  struct inode *inode;
+  bool success;
+
+  if (sectors == 0)
+    sectors = 1;
+  if (!inode_create (sector, sectors * BLOCK_SECTOR_SIZE, true))
+    return false;
+  inode = inode_open (sector);
+  if (inode == NULL)
+    return false;
+  if (sectors >= DIR_HASH_MIN)
+    inode_set_flags (inode, inode_get_flags (inode) | DIR_HASHED);
+  dir = dir_open (inode);
+  success = dir != NULL && dir_add (dir, "..", parent_sector);
+  dir_close (dir);
+  return success;
+}
+
+/* Cache of struct dir. */
+static struct slab_cache dir_cache;
+
+/* Initializes the directory module. */
+void
+dir_init (void)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  slab_cache_init (&dir_cache, "dir", sizeof (struct dir), NULL);
+}
+
+/* Prints name filter statistics. */
+void
+dir_print_stats (void)
+{
+  printf ("Directories: %llu name filters built, %llu lookups filtered, "
+          "%llu false positives\n",
+          bloom_build_cnt, bloom_skip_cnt, bloom_false_cnt);
+  printf ("Directories: %llu stat-ahead windows, %llu inode sectors "
+          "prefetched\n", ahead_window_cnt, ahead_inode_cnt);
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -34,17 +229,18 @@ dir_create (block_sector_t sector, size_t entry_cnt)
 struct dir *
 dir_open (struct inode *inode) 
 {
-  struct dir *dir = calloc (1, sizeof *dir);
-  if (inode != NULL && dir != NULL)
+  struct dir *dir = slab_alloc (&dir_cache);
+  if (inode != NULL && dir != NULL && inode_is_dir (inode))
     {
       dir->inode = inode;
       dir->pos = 0;
+      dir->ahead_pos = 0;
       return dir;
     }
   else
     {
       inode_close (inode);
-      free (dir);
+      slab_free (&dir_cache, dir);
       return NULL; 
     }
 }
@@ -65,6 +261,19 @@ dir_reopen (struct dir *dir)
   return dir_open (inode_reopen (dir->inode));
 }
 
+/* Opens and returns a new directory for the same inode as DIR,
+   positioned where DIR is, so that dir_readdir() carries on from
+   the same entry.  Returns a null pointer on failure. */
+struct dir *
+dir_dup (struct dir *dir)
+{
+  struct dir *copy = dir_reopen (dir);
+
+  if (copy != NULL)
+    copy->pos = dir->pos;
+  return copy;
+}
+
 /* Destroys DIR and frees associated resources. */
 void
 dir_close (struct dir *dir) 
@@ -72,7 +281,7 @@ dir_close (struct dir *dir)
   if (dir != NULL)
     {
       inode_close (dir->inode);
-      free (dir);
+      slab_free (&dir_cache, dir);
     }
 }
 
@@ -83,51 +292,562 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
+/* Returns the inode number of DIR. */
+block_sector_t
+dir_get_inumber (struct dir *dir)
+{
+  return inode_get_inumber (dir->inode);
+}
+
+/* Returns the number of sectors in DIR. */
+static size_t
+sector_cnt (const struct dir *dir)
+{
+  return inode_length (dir->inode) / BLOCK_SECTOR_SIZE;
+}
+
+/* Returns true if DIR is in hashed format.  The format is read
+   from the inode each time, since another opener may convert the
+   directory. */
+static bool
+is_hashed (const struct dir *dir)
+{
+  return (inode_get_flags (dir->inode) & DIR_HASHED) != 0;
+}
+
+/* Returns the number of bytes in a record for a name LEN bytes
+   long. */
+static size_t
+record_size (size_t len)
+{
+  return ROUND_UP (sizeof (struct dir_record) + len, 4);
+}
+
+/* Returns the byte offset of record R within sector S. */
+static size_t
+record_ofs (const union dir_sector *s, const struct dir_record *r)
+{
+  return (const uint8_t *) r - s->bytes;
+}
+
+/* Returns the record at byte OFS in sector S, or a null pointer
+   if OFS is at the end of the sector or the record there is
+   damaged.  A zero REC_LEN, as in a sector of zeros, is taken to
+   run to the end of the sector. */
+static struct dir_record *
+record_at (union dir_sector *s, size_t ofs)
+{
+  struct dir_record *r;
+
+  if (ofs % 4 != 0 || ofs + sizeof *r > BLOCK_SECTOR_SIZE)
+    return NULL;
+  r = (struct dir_record *) (s->bytes + ofs);
+  if (r->rec_len == 0)
+    r->rec_len = BLOCK_SECTOR_SIZE - ofs;
+  if (r->rec_len < sizeof *r || r->rec_len % 4 != 0
+      || ofs + r->rec_len > BLOCK_SECTOR_SIZE
+      || (r->inode_sector != 0
+          && (r->name_len == 0 || record_size (r->name_len) > r->rec_len)))
+    return NULL;
+  return r;
+}
+
+/* Returns the number of bytes in record R that its name does not
+   use, which is all of them if R is free. */
+static size_t
+spare (const struct dir_record *r)
+{
+  return r->rec_len - (r->inode_sector != 0 ? record_size (r->name_len) : 0);
+}
+
+/* Returns a record in sector S with at least SIZE spare bytes, or
+   a null pointer if there is none. */
+static struct dir_record *
+find_room (union dir_sector *s, size_t size)
+{
+  struct dir_record *r;
+  size_t ofs;
+
+  for (ofs = 0; (r = record_at (s, ofs)) != NULL; ofs += r->rec_len)
+    if (spare (r) >= size)
+      return r;
+  return NULL;
+}
+
+/* Stores an entry for NAME, LEN bytes long with hash HASH, naming
+   the inode in INODE_SECTOR, in the spare bytes of record R, as
+   returned by find_room().  Returns the new record, which is R
+   itself if R was free. */
+static struct dir_record *
+insert (struct dir_record *r, const char *name, size_t len, uint32_t hash,
+        block_sector_t inode_sector)
+{
+  struct dir_record *new = r;
+
+  if (r->inode_sector != 0)
+    {
+      size_t used = record_size (r->name_len);
+
+      new = (struct dir_record *) ((uint8_t *) r + used);
+      new->rec_len = r->rec_len - used;
+      new->flags = 0;
+      r->rec_len = used;
+    }
+  new->inode_sector = inode_sector;
+  new->hash = hash;
+  new->name_len = len;
+  memcpy (new->name, name, len);
+  return new;
+}
+
+/* Returns true if record R is live and holds NAME, LEN bytes long
+   with hash HASH. */
+static bool
+record_matches (const struct dir_record *r, const char *name, size_t len,
+                uint32_t hash)
+{
+  return (r->inode_sector != 0 && r->hash == hash && r->name_len == len
+          && !memcmp (r->name, name, len));
+}
+
+/* Returns true if record R is the entry for "..". */
+static bool
+is_parent (const struct dir_record *r)
+{
+  return r->name_len == 2 && !memcmp (r->name, "..", 2);
+}
+
+/* Copies the name in record R into NAME as a null-terminated
+   string. */
+static void
+copy_name (char name[NAME_MAX + 1], const struct dir_record *r)
+{
+  memcpy (name, r->name, r->name_len);
+  name[r->name_len] = '\0';
+}
+
+/* Reads sector IDX of directory INODE into S.  Returns false if
+   IDX is past the end of the directory. */
+static bool
+read_sector (struct inode *inode, size_t idx, union dir_sector *s)
+{
+  return (inode_read_at (inode, s->bytes, BLOCK_SECTOR_SIZE,
+                         (off_t) idx * BLOCK_SECTOR_SIZE)
+          == BLOCK_SECTOR_SIZE);
+}
+
+/* Writes bytes LO through HI - 1 of S into sector IDX of
+   directory INODE.  Returns true if successful. */
+static bool
+write_sector (struct inode *inode, size_t idx, const union dir_sector *s,
+              size_t lo, size_t hi)
+{
+  return (inode_write_at (inode, s->bytes + lo, hi - lo,
+                          (off_t) idx * BLOCK_SECTOR_SIZE + lo)
+          == (off_t) (hi - lo));
+}
+
+/* Initializes B to read into the CNT sectors at SECTORS. */
+static void
+init_buf (struct dir_buf *b, union dir_sector *sectors, size_t cnt)
+{
+  b->sectors = sectors;
+  b->cap = cnt;
+  b->first = 0;
+  b->cnt = 0;
+}
+
+/* Returns the next live record at or after byte *POS of directory
+   INODE and advances *POS past it, reading sectors into B as they
+   are needed.  Returns a null pointer at the end of the
+   directory.  The rest of a damaged sector is skipped. */
+static struct dir_record *
+next_record (struct inode *inode, off_t *pos, struct dir_buf *b)
+{
+  for (;;)
+    {
+      size_t idx = *pos / BLOCK_SECTOR_SIZE;
+      struct dir_record *r;
+
+      if (idx < b->first || idx >= b->first + b->cnt)
+        {
+          off_t bytes = inode_read_at (inode, b->sectors,
+                                       b->cap * BLOCK_SECTOR_SIZE,
+                                       (off_t) idx * BLOCK_SECTOR_SIZE);
+          b->first = idx;
+          b->cnt = bytes / BLOCK_SECTOR_SIZE;
+          if (b->cnt == 0)
+            return NULL;
+        }
+
+      r = record_at (&b->sectors[idx - b->first], *pos % BLOCK_SECTOR_SIZE);
+      if (r == NULL)
+        *pos = (off_t) (idx + 1) * BLOCK_SECTOR_SIZE;
+      else
+        {
+          *pos += r->rec_len;
+          if (r->inode_sector != 0)
+            return r;
+        }
+    }
+}
+
+/* Stores the inode sector named by record R into *SECTORP and
+   OFS, R's byte offset in its directory, into *OFSP, each if
+   non-null, for lookup().  Returns true. */
+static bool
+found (const struct dir_record *r, off_t ofs, block_sector_t *sectorp,
+       off_t *ofsp)
+{
+  if (sectorp != NULL)
+    *sectorp = r->inode_sector;
+  if (ofsp != NULL)
+    *ofsp = ofs;
+  return true;
+}
+
+/* Returns bit I of the BLOOM_HASHES bits that HASH sets in
+   BLOOM, by double hashing. */
+static size_t
+bloom_bit (const struct dir_bloom *bloom, uint32_t hash, int i)
+{
+  uint32_t step = ((hash >> 16) | (hash << 16)) * 0x9e3779b1 | 1;
+
+  return (hash + i * step) & (bloom->bits - 1);
+}
+
+/* Adds the name with hash HASH to BLOOM. */
+static void
+bloom_add (struct dir_bloom *bloom, uint32_t hash)
+{
+  int i;
+
+  for (i = 0; i < BLOOM_HASHES; i++)
+    {
+      size_t bit = bloom_bit (bloom, hash, i);
+      bloom->words[bit / 32] |= 1u << (bit % 32);
+    }
+  bloom->cnt++;
+}
+
+/* Returns false if BLOOM holds no name with hash HASH, true if
+   it may. */
+static bool
+bloom_test (const struct dir_bloom *bloom, uint32_t hash)
+{
+  int i;
+
+  for (i = 0; i < BLOOM_HASHES; i++)
+    {
+      size_t bit = bloom_bit (bloom, hash, i);
+      if (!(bloom->words[bit / 32] & (1u << (bit % 32))))
+        return false;
+    }
+  return true;
+}
+
+/* Returns the name filter of DIR, building it first if DIR has
+   none or has one due for rebuilding, or a null pointer if memory
+   runs out or DIR cannot be read.  The caller must hold DIR's
+   lock. */
+static struct dir_bloom *
+get_bloom (const struct dir *dir)
+{
+  struct dir_bloom *bloom = inode_get_dir_bloom (dir->inode);
+  size_t live_cnt, free_slot, bits;
+
+  if (bloom != NULL
+      && bloom->removed * 4 <= bloom->cnt
+      && (bloom->cnt * BLOOM_BITS_PER_NAME <= bloom->bits
+          || bloom->bits >= BLOOM_MAX_BITS))
+    return bloom;
+
+  inode_get_dir_info (dir->inode, &live_cnt, &free_slot);
+  for (bits = BLOOM_MIN_BITS;
+       bits < BLOOM_MAX_BITS && bits < live_cnt * 2 * BLOOM_BITS_PER_NAME;
+       bits *= 2)
+    continue;
+  bloom = calloc (1, sizeof *bloom + bits / 8);
+  if (bloom != NULL)
+    {
+      union dir_sector s;
+      struct dir_record *r;
+      struct dir_buf b;
+      off_t pos = 0;
+
+      /* A new directory, with no entries, is not read at all. */
+      bloom->bits = bits;
+      init_buf (&b, &s, 1);
+      while (bloom->cnt < live_cnt
+             && (r = next_record (dir->inode, &pos, &b)) != NULL)
+        bloom_add (bloom, r->hash);
+      if (bloom->cnt < live_cnt)
+        {
+          free (bloom);
+          bloom = NULL;
+        }
+      else
+        bloom_build_cnt++;
+    }
+  inode_set_dir_bloom (dir->inode, bloom);
+  return bloom;
+}
+
 /* Searches DIR for a file with the given NAME.
-   If successful, returns true, sets *EP to the directory entry
-   if EP is non-null, and sets *OFSP to the byte offset of the
-   directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   If successful, returns true, sets *SECTORP to the inode sector
+   that the entry names if SECTORP is non-null, and sets *OFSP to
+   the byte offset of the entry's record if OFSP is non-null.
+   Otherwise, returns false and ignores SECTORP and OFSP.
+   Consults DIR's name filter first.  The caller must hold DIR's
+   lock. */
 static bool
 lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp) 
+        block_sector_t *sectorp, off_t *ofsp) 
 {
-  struct dir_entry e;
-  size_t ofs;
-  
+  struct dir_bloom *bloom;
+  union dir_sector s;
+  struct dir_record *r;
+  size_t len, cnt;
+  uint32_t hash;
+
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
+  len = strlen (name);
+  cnt = sector_cnt (dir);
+  if (len > NAME_MAX || cnt == 0)
+    return false;
+  hash = hash_bytes (name, len);
+  bloom = get_bloom (dir);
+  if (bloom != NULL && !bloom_test (bloom, hash))
+    {
+      bloom_skip_cnt++;
+      return false;
+    }
+
+  if (is_hashed (dir))
+    {
+      size_t idx = hash % cnt;
+      size_t i, ofs;
+
+      for (i = 0; i < cnt && read_sector (dir->inode, idx, &s);
+           i++, idx = (idx + 1) % cnt)
+        {
+          for (ofs = 0; (r = record_at (&s, ofs)) != NULL; ofs += r->rec_len)
+            if (record_matches (r, name, len, hash))
+              return found (r, (off_t) idx * BLOCK_SECTOR_SIZE + ofs,
+                            sectorp, ofsp);
+          r = record_at (&s, 0);
+          if (r == NULL || !(r->flags & DIR_OVERFLOW))
+            break;
+        }
+    }
+  else
+    {
+      size_t live_cnt, free_slot, seen;
+      struct dir_buf b;
+      off_t pos = 0;
+
+      inode_get_dir_info (dir->inode, &live_cnt, &free_slot);
+      init_buf (&b, &s, 1);
+      for (seen = 0;
+           seen < live_cnt && (r = next_record (dir->inode, &pos, &b)) != NULL;
+           seen++)
+        if (record_matches (r, name, len, hash))
+          return found (r, pos - r->rec_len, sectorp, ofsp);
+    }
+  if (bloom != NULL)
+    bloom_false_cnt++;
   return false;
 }
 
+/* Adds an entry for NAME, LEN bytes long with hash HASH, naming
+   the inode in INODE_SECTOR, to sector IDX of directory INODE, if
+   it has room, using S as a buffer.  A sector at IDX past the end
+   of the directory starts out empty, and writing it extends the
+   directory.  If the sector has no room and MARK is true, marks
+   it DIR_OVERFLOW. */
+static enum add_result
+add_to_sector (struct inode *inode, size_t idx, union dir_sector *s,
+               const char *name, size_t len, uint32_t hash,
+               block_sector_t inode_sector, bool mark)
+{
+  bool extend = !read_sector (inode, idx, s);
+  struct dir_record *r, *new;
+  size_t lo, hi;
+
+  if (extend)
+    memset (s, 0, sizeof *s);
+  r = find_room (s, record_size (len));
+  if (r == NULL)
+    {
+      struct dir_record *first = record_at (s, 0);
+
+      if (mark && first != NULL && !(first->flags & DIR_OVERFLOW))
+        {
+          first->flags |= DIR_OVERFLOW;
+          if (!write_sector (inode, idx, s, 0, sizeof *first))
+            return ADD_ERROR;
+        }
+      return ADD_FULL;
+    }
+
+  new = insert (r, name, len, hash, inode_sector);
+  lo = extend ? 0 : record_ofs (s, r);
+  hi = extend ? BLOCK_SECTOR_SIZE : record_ofs (s, new) + record_size (len);
+  return write_sector (inode, idx, s, lo, hi) ? ADD_OK : ADD_ERROR;
+}
+
+/* Adds an entry for NAME, LEN bytes long with hash HASH, naming
+   the inode in INODE_SECTOR, to hashed directory DIR, in the first
+   sector along NAME's probe sequence with room.  Uses S as a
+   buffer. */
+static enum add_result
+add_hashed (struct dir *dir, union dir_sector *s, const char *name,
+            size_t len, uint32_t hash, block_sector_t inode_sector)
+{
+  size_t cnt = sector_cnt (dir);
+  size_t idx = hash % cnt;
+  enum add_result result = ADD_FULL;
+  size_t i;
+
+  for (i = 0; i < cnt && result == ADD_FULL; i++, idx = (idx + 1) % cnt)
+    result = add_to_sector (dir->inode, idx, s, name, len, hash,
+                            inode_sector, true);
+  return result;
+}
+
+/* Adds an entry for NAME, LEN bytes long with hash HASH, naming
+   the inode in INODE_SECTOR, to linear directory DIR, in the
+   first sector with room at or after *FREE_SLOT, or in a new
+   sector at the end if none has room and EXTEND is true.  On
+   success, updates *FREE_SLOT.  Uses S as a buffer. */
+static enum add_result
+add_linear (struct dir *dir, union dir_sector *s, const char *name,
+            size_t len, uint32_t hash, block_sector_t inode_sector,
+            size_t *free_slot, bool extend)
+{
+  size_t end = sector_cnt (dir) + (extend ? 1 : 0);
+  size_t first_room = SIZE_MAX;
+  enum add_result result = ADD_FULL;
+  size_t idx;
+
+  for (idx = *free_slot; idx < end; idx++)
+    {
+      result = add_to_sector (dir->inode, idx, s, name, len, hash,
+                              inode_sector, false);
+      if (result != ADD_FULL)
+        break;
+      if (first_room == SIZE_MAX && find_room (s, record_size (1)) != NULL)
+        first_room = idx;
+    }
+
+  if (result == ADD_OK)
+    {
+      if (first_room == SIZE_MAX)
+        first_room = find_room (s, record_size (1)) != NULL ? idx : idx + 1;
+      *free_slot = first_room;
+    }
+  return result;
+}
+
+/* Rebuilds DIR as a hashed directory with SECTORS sectors, which
+   must be more than it has now, extending it.  The new table is
+   built in memory and then written over the old one, all in the
+   running journal operation, so a directory cannot grow past what
+   one transaction can hold.  Directories open for dir_readdir()
+   may skip or repeat entries afterward.  Returns true if
+   successful, false if memory, disk space or room in the journal
+   runs out, in which case DIR is unchanged. */
+static bool
+rehash (struct dir *dir, size_t sectors)
+{
+  union dir_sector s, *table;
+  struct dir_record *r;
+  struct dir_buf b;
+  size_t live_cnt = 0, i;
+  off_t pos = 0;
+  bool success = true;
+
+  ASSERT (sectors > sector_cnt (dir));
+  table = calloc (sectors, sizeof *table);
+  if (table == NULL)
+    return false;
+
+  /* Place each live entry along its probe sequence. */
+  init_buf (&b, &s, 1);
+  while (success && (r = next_record (dir->inode, &pos, &b)) != NULL)
+    {
+      size_t size = record_size (r->name_len);
+      size_t idx = r->hash % sectors;
+      struct dir_record *room = NULL;
+
+      for (i = 0; i < sectors; i++, idx = (idx + 1) % sectors)
+        {
+          room = find_room (&table[idx], size);
+          if (room != NULL)
+            break;
+          record_at (&table[idx], 0)->flags |= DIR_OVERFLOW;
+        }
+      if (room != NULL)
+        {
+          insert (room, r->name, r->name_len, r->hash, r->inode_sector);
+          live_cnt++;
+        }
+      else
+        success = false;
+    }
+
+  /* Reserve the journal credits and allocate the sectors that the
+     table grows into before any old sector is overwritten, so that
+     the writes cannot run out of room partway. */
+  if (success)
+    success = journal_extend (sectors + JOURNAL_CREDITS);
+  if (success)
+    success = inode_preallocate (dir->inode,
+                                 (off_t) sectors * BLOCK_SECTOR_SIZE);
+  for (i = 0; success && i < sectors; i++)
+    success = write_sector (dir->inode, i, &table[i], 0, BLOCK_SECTOR_SIZE);
+  if (success)
+    {
+      inode_set_flags (dir->inode, inode_get_flags (dir->inode) | DIR_HASHED);
+      inode_set_dir_info (dir->inode, live_cnt, 0);
+    }
+  free (table);
+  return success;
+}
+
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   Consults and fills the directory entry cache.
+   A directory that has been removed contains nothing. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
-  struct dir_entry e;
+  block_sector_t dir_sector, sector;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  dir_sector = inode_get_inumber (dir->inode);
+  inode_dir_lock (dir->inode);
+  if (inode_is_removed (dir->inode))
+    sector = DCACHE_NEGATIVE;
+  else if (!dcache_lookup (dir_sector, name, &sector))
+    {
+      if (!lookup (dir, name, &sector, NULL))
+        sector = DCACHE_NEGATIVE;
+      dcache_insert (dir_sector, name, sector);
+    }
+
+  if (sector != DCACHE_NEGATIVE)
+    *inode = inode_open (sector);
   else
     *inode = NULL;
+  inode_dir_unlock (dir->inode);
 
   return *inode != NULL;
 }
@@ -141,96 +861,391 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
-  struct dir_entry e;
-  off_t ofs;
+  union dir_sector *s = NULL;
+  size_t len, live_cnt, free_slot;
+  enum add_result result;
+  uint32_t hash;
   bool success = false;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
   /* Check NAME for validity. */
-  if (*name == '\0' || strlen (name) > NAME_MAX)
+  len = strlen (name);
+  if (len == 0 || len > NAME_MAX || !strcmp (name, "."))
     return false;
+  hash = hash_bytes (name, len);
+
+  /* The journal handle comes first, since committing waits for
+     handles and a handle may be waiting for the directory lock. */
+  journal_begin (JOURNAL_CREDITS);
+  inode_dir_lock (dir->inode);
+
+  /* Check that DIR still exists. */
+  if (inode_is_removed (dir->inode))
+    goto done;
 
   /* Check that NAME is not in use. */
   if (lookup (dir, name, NULL, NULL))
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
-
-  /* Write slot. */
-  e.in_use = true;
-  strlcpy (e.name, name, sizeof e.name);
-  e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  s = malloc (sizeof *s);
+  if (s == NULL)
+    goto done;
+  inode_get_dir_info (dir->inode, &live_cnt, &free_slot);
+  if (is_hashed (dir))
+    {
+      /* Make room if DIR is too full to hash well. */
+      if ((live_cnt + 1) * DIR_SLOT_SIZE * 4
+          > (size_t) inode_length (dir->inode) * 3
+          && !rehash (dir, sector_cnt (dir) * 2))
+        goto done;
+      result = add_hashed (dir, s, name, len, hash, inode_sector);
+    }
+  else
+    {
+      /* A full directory grows by a sector at a time, until it is
+         worth hashing. */
+      size_t cnt = sector_cnt (dir);
+
+      result = add_linear (dir, s, name, len, hash, inode_sector,
+                           &free_slot, cnt + 1 < DIR_HASH_MIN);
+      if (result == ADD_FULL)
+        {
+          if (!rehash (dir, cnt * 2))
+            goto done;
+          result = add_hashed (dir, s, name, len, hash, inode_sector);
+        }
+    }
+  if (result == ADD_FULL)
+    {
+      /* No sector along NAME's probe sequence had room. */
+      if (!rehash (dir, sector_cnt (dir) * 2))
+        goto done;
+      result = add_hashed (dir, s, name, len, hash, inode_sector);
+    }
+
+  if (result == ADD_OK)
+    {
+      struct dir_bloom *bloom = inode_get_dir_bloom (dir->inode);
+
+      inode_set_dir_info (dir->inode, live_cnt + 1,
+                          is_hashed (dir) ? 0 : free_slot);
+      if (bloom != NULL)
+        bloom_add (bloom, hash);
+      dcache_insert (inode_get_inumber (dir->inode), name, inode_sector);
+      success = true;
+    }
 
  done:
+  inode_dir_unlock (dir->inode);
+  journal_end ();
+  free (s);
   return success;
 }
 
+/* Frees the record at byte OFS of directory INODE, merging it
+   into the record before it in the same sector, if any.  Returns
+   true if successful. */
+static bool
+erase (struct inode *inode, off_t ofs)
+{
+  size_t idx = ofs / BLOCK_SECTOR_SIZE;
+  size_t target = ofs % BLOCK_SECTOR_SIZE;
+  struct dir_record *r, *prev = NULL;
+  union dir_sector s;
+  size_t at;
+
+  if (!read_sector (inode, idx, &s))
+    return false;
+  for (at = 0; (r = record_at (&s, at)) != NULL && at < target;
+       at += r->rec_len)
+    prev = r;
+  if (r == NULL || at != target)
+    return false;
+
+  r->inode_sector = 0;
+  if (prev != NULL)
+    prev->rec_len += r->rec_len;
+  return write_sector (inode, idx, &s,
+                       prev != NULL ? record_ofs (&s, prev) : target,
+                       target + sizeof *r);
+}
+
 /* Removes any entry for NAME in DIR.
-   Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   Returns true if successful, false on failure, which occurs if
+   there is no file with the given NAME, or if NAME is a directory
+   that is not empty or is the root directory. */
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
-  struct dir_entry e;
+  block_sector_t sector;
   struct inode *inode = NULL;
+  struct dir_bloom *bloom;
   bool success = false;
+  bool child_locked = false;
+  size_t live_cnt, free_slot;
   off_t ofs;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  journal_begin (JOURNAL_CREDITS);
+  inode_dir_lock (dir->inode);
+
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  if (!lookup (dir, name, &sector, &ofs))
     goto done;
 
   /* Open inode. */
-  inode = inode_open (e.inode_sector);
+  inode = inode_open (sector);
   if (inode == NULL)
     goto done;
 
+  /* Only an empty directory, holding just "..", may be removed.
+     Its own lock keeps entries from being added to it meanwhile.
+     Directory locks are always taken parent first. */
+  if (inode_is_dir (inode))
+    {
+      size_t child_cnt, child_free;
+
+      if (inode == dir->inode)
+        goto done;
+      inode_dir_lock (inode);
+      child_locked = true;
+      inode_get_dir_info (inode, &child_cnt, &child_free);
+      if (child_cnt > 1 || sector == ROOT_DIR_SECTOR)
+        goto done;
+      dcache_invalidate_dir (sector);
+    }
+
   /* Erase directory entry. */
-  e.in_use = false;
-  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
+  if (!erase (dir->inode, ofs))
     goto done;
+  dcache_insert (inode_get_inumber (dir->inode), name, DCACHE_NEGATIVE);
+  bloom = inode_get_dir_bloom (dir->inode);
+  if (bloom != NULL)
+    bloom->removed++;
+  inode_get_dir_info (dir->inode, &live_cnt, &free_slot);
+  if (!is_hashed (dir) && ofs / BLOCK_SECTOR_SIZE < (off_t) free_slot)
+    free_slot = ofs / BLOCK_SECTOR_SIZE;
+  inode_set_dir_info (dir->inode, live_cnt - 1, free_slot);
 
   /* Remove inode. */
   inode_remove (inode);
+#ifdef USERPROG
+  image_forget (inode);
+#endif
   success = true;
 
  done:
+  if (child_locked)
+    inode_dir_unlock (inode);
   inode_close (inode);
+  inode_dir_unlock (dir->inode);
+  journal_end ();
   return success;
 }
 
+/* Queues read-ahead of the inode sectors of the entries in DIR's
+   next stat-ahead window, unless the reader is still more than a
+   sector short of the end of the last one. */
+static void
+stat_ahead (struct dir *dir)
+{
+  block_sector_t sectors[STAT_AHEAD_MAX];
+  union dir_sector *buf;
+  struct dir_record *r;
+  struct dir_buf b;
+  off_t pos, end;
+  size_t cnt = 0;
+
+  if (dir->pos + BLOCK_SECTOR_SIZE <= dir->ahead_pos)
+    return;
+  buf = arena_alloc (STAT_AHEAD_SECTORS * sizeof *buf);
+  if (buf == NULL)
+    return;
+
+  pos = dir->pos > dir->ahead_pos ? dir->pos : dir->ahead_pos;
+  end = (ROUND_DOWN (pos, BLOCK_SECTOR_SIZE)
+         + STAT_AHEAD_SECTORS * BLOCK_SECTOR_SIZE);
+  init_buf (&b, buf, STAT_AHEAD_SECTORS);
+  while (pos < end && cnt < STAT_AHEAD_MAX
+         && (r = next_record (dir->inode, &pos, &b)) != NULL)
+    if (!is_parent (r))
+      sectors[cnt++] = r->inode_sector;
+  dir->ahead_pos = pos > end ? pos : end;
+  arena_free (buf);
+
+  if (cnt > 0)
+    {
+      ahead_window_cnt++;
+      ahead_inode_cnt += cnt;
+      cache_prefetch (sectors, cnt);
+    }
+}
+
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
    contains no more entries. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
-  struct dir_entry e;
+  union dir_sector s;
+  struct dir_record *r;
+  struct dir_buf b;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  if (dir->pos > 0)
+    stat_ahead (dir);
+  init_buf (&b, &s, 1);
+  while ((r = next_record (dir->inode, &dir->pos, &b)) != NULL)
+    if (!is_parent (r))
+      {
+        copy_name (name, r);
+        return true;
+      }
+  return false;
+}
+
+/* Reads up to MAX of the next entries in DIR into RECORDS, as
+   dir_readdir() would, also noting each entry's inode number and
+   whether it is a directory.  The entries are read a sector at a
+   time.  Each entry's type is read from its inode sector, which
+   stat-ahead has usually brought into the cache, without opening
+   the inode.  Returns the number of records stored, which is 0
+   once the directory contains no more entries. */
+size_t
+dir_readdir_batch (struct dir *dir, struct readdir_record *records,
+                   size_t max)
+{
+  union dir_sector s;
+  struct dir_record *r;
+  struct dir_buf b;
+  size_t cnt = 0;
+
+  init_buf (&b, &s, 1);
+  stat_ahead (dir);
+  while (cnt < max && (r = next_record (dir->inode, &dir->pos, &b)) != NULL)
+    if (!is_parent (r))
+      {
+        struct readdir_record *rec = &records[cnt++];
+
+        stat_ahead (dir);
+        rec->inumber = r->inode_sector;
+        rec->is_dir = inode_sector_is_dir (r->inode_sector);
+        copy_name (rec->name, r);
+      }
+  return cnt;
+}
+
+/* Stores in INUMBERS the inode sectors of up to MAX of the next
+   entries in DIR, skipping "..", and returns the number stored,
+   which is 0 once the directory contains no more entries.  The
+   directory is read up to a page at a time, so that its sectors
+   are loaded with multi-sector reads.  Used by the file system
+   checker. */
+size_t
+dir_read_inumbers (struct dir *dir, block_sector_t *inumbers, size_t max)
+{
+  union dir_sector *sectors;
+  struct dir_record *r;
+  struct dir_buf b;
+  size_t cnt = 0;
+
+  sectors = malloc (PGSIZE);
+  if (sectors == NULL)
+    return 0;
+  init_buf (&b, sectors, PGSIZE / sizeof *sectors);
+  while (cnt < max && (r = next_record (dir->inode, &dir->pos, &b)) != NULL)
+    if (!is_parent (r))
+      inumbers[cnt++] = r->inode_sector;
+  free (sectors);
+  return cnt;
+}
+
+/* Writes OUT, whose records end at byte OFS with LAST, as sector
+   IDX of directory INODE for dir_compact(), first stretching LAST
+   to the end of the sector.  Sets *FIRST_ROOM to IDX if it is not
+   yet set and OUT has room for another record.  Returns true if
+   successful. */
+static bool
+put_packed (struct inode *inode, size_t idx, union dir_sector *out,
+            size_t ofs, struct dir_record *last, size_t *first_room)
+{
+  if (last != NULL)
+    last->rec_len += BLOCK_SECTOR_SIZE - ofs;
+  if (*first_room == SIZE_MAX && BLOCK_SECTOR_SIZE - ofs >= record_size (1))
+    *first_room = idx;
+  return write_sector (inode, idx, out, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Packs the live entries of linear directory DIR, in order, into
+   as few sectors as they fit in, so that later lookups and
+   additions do not have to read past the space left by removed
+   entries.  Each sector is rewritten only after it has been read,
+   since packing never moves a record to a later sector.
+   Directories open for dir_readdir() may skip or repeat entries
+   afterward.  Hashed directories are left alone, since their
+   entries must stay in their probe sequences.
+   Returns true if successful, false on a disk error or if memory
+   runs out. */
+bool
+dir_compact (struct dir *dir)
+{
+  union dir_sector in, *out;
+  struct dir_record *r, *last = NULL;
+  struct dir_buf b;
+  size_t idx = 0, ofs = 0, used_cnt = 0, live_cnt = 0, end;
+  size_t first_room = SIZE_MAX;
+  off_t pos = 0;
+  bool success = false;
+
+  ASSERT (dir != NULL);
+
+  if (is_hashed (dir))
+    return true;
+  out = calloc (1, sizeof *out);
+  if (out == NULL)
+    return false;
+
+  journal_begin (JOURNAL_CREDITS);
+  inode_dir_lock (dir->inode);
+  init_buf (&b, &in, 1);
+  while ((r = next_record (dir->inode, &pos, &b)) != NULL)
     {
-      dir->pos += sizeof e;
-      if (e.in_use)
+      size_t size = record_size (r->name_len);
+
+      if (ofs + size > BLOCK_SECTOR_SIZE)
         {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
-        } 
+          if (!put_packed (dir->inode, idx++, out, ofs, last, &first_room))
+            goto done;
+          memset (out, 0, sizeof *out);
+          ofs = 0;
+        }
+      last = (struct dir_record *) (out->bytes + ofs);
+      memcpy (last, r, size);
+      last->rec_len = size;
+      last->flags = 0;
+      ofs += size;
+      live_cnt++;
+      used_cnt = (pos - 1) / BLOCK_SECTOR_SIZE + 1;
     }
-  return false;
+  if (!put_packed (dir->inode, idx, out, ofs, last, &first_room))
+    goto done;
+
+  /* Empty the sectors that held entries and now hold none. */
+  memset (out, 0, sizeof *out);
+  for (end = idx + 1; end < used_cnt; end++)
+    if (!write_sector (dir->inode, end, out, 0, BLOCK_SECTOR_SIZE))
+      goto done;
+
+  inode_set_dir_info (dir->inode, live_cnt,
+                      first_room != SIZE_MAX ? first_room : idx + 1);
+  success = true;
+
+ done:
+  inode_dir_unlock (dir->inode);
+  journal_end ();
+  free (out);
+  return success;
 }
@@ -3,28 +3,36 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <syscall-nr.h>
 #include "devices/block.h"
 
-/* Maximum length of a file name component.
-   This is the traditional UNIX maximum length.
-   After directories are implemented, this maximum length may be
-   retained, but much longer full path names must be allowed. */
-#define NAME_MAX 14
+/* Maximum length of a file name component, the most that a
+   directory record's one-byte name length can describe.  Must
+   agree with READDIR_MAX_LEN in lib/user/syscall.h. */
+#define NAME_MAX 255
 
 struct inode;
 
 /* Opening and closing directories. */
-bool dir_create (block_sector_t sector, size_t entry_cnt);
+bool dir_create (block_sector_t sector, size_t entry_cnt,
+                 block_sector_t parent_sector);
+void dir_init (void);
+void dir_print_stats (void);
 struct dir *dir_open (struct inode *);
 struct dir *dir_open_root (void);
 struct dir *dir_reopen (struct dir *);
+struct dir *dir_dup (struct dir *);
 void dir_close (struct dir *);
 struct inode *dir_get_inode (struct dir *);
+block_sector_t dir_get_inumber (struct dir *);
 
 /* Reading and writing. */
 bool dir_lookup (const struct dir *, const char *name, struct inode **);
 bool dir_add (struct dir *, const char *name, block_sector_t);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+size_t dir_readdir_batch (struct dir *, struct readdir_record *, size_t max);
+size_t dir_read_inumbers (struct dir *, block_sector_t *, size_t max);
+bool dir_compact (struct dir *);
 
 #endif /* filesys/directory.h */
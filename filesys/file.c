@@ -1,7 +1,11 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include <string.h>
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/vaddr.h"
 
 /* An open file. */
 struct file 
@@ -11,13 +15,23 @@ struct file
     bool deny_write;            /* Has file_deny_write() been called? */
   };
 
+/* Cache of struct file. */
+static struct slab_cache file_cache;
+
+/* Initializes the file module. */
+void
+file_init (void)
+{
+  slab_cache_init (&file_cache, "file", sizeof (struct file), NULL);
+}
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
 struct file *
 file_open (struct inode *inode) 
 {
-  struct file *file = calloc (1, sizeof *file);
+  struct file *file = slab_alloc (&file_cache);
   if (inode != NULL && file != NULL)
     {
       file->inode = inode;
@@ -28,7 +42,7 @@ file_open (struct inode *inode)
   else
     {
       inode_close (inode);
-      free (file);
+      slab_free (&file_cache, file);
       return NULL; 
     }
 }
@@ -49,7 +63,7 @@ file_close (struct file *file)
     {
       file_allow_write (file);
       inode_close (file->inode);
-      free (file); 
+      slab_free (&file_cache, file); 
     }
 }
 
@@ -99,6 +113,120 @@ file_write (struct file *file, const void *buffer, off_t size)
   return bytes_written;
 }
 
+/* Reads from FILE into the CNT buffers in IOV, filling each in
+   turn, starting at the file's current position, and advances the
+   position by the number of bytes read.  Returns the number of
+   bytes read, which is less than the buffers hold if end of file
+   is reached.  The inode copies straight from its cached sectors
+   into each buffer. */
+off_t
+file_readv (struct file *file, const struct iovec *iov, int cnt)
+{
+  off_t bytes_read = inode_readv_at (file->inode, iov, cnt, file->pos);
+  file->pos += bytes_read;
+  return bytes_read;
+}
+
+/* Writes the CNT buffers in IOV to FILE, one after another,
+   starting at the file's current position, and advances the
+   position by the number of bytes written.  Returns the number of
+   bytes written, which may be short if the disk fills up.  Small
+   buffers are gathered into page-sized writes so that the inode
+   sees few, large requests. */
+off_t
+file_writev (struct file *file, const struct iovec *iov, int cnt)
+{
+  uint8_t *page;
+  off_t total = 0;
+  int i = 0;
+  unsigned ofs = 0;
+
+  if (cnt == 1 || (page = palloc_get_page (0)) == NULL)
+    {
+      for (i = 0; i < cnt; i++)
+        {
+          off_t n = file_write (file, iov[i].iov_base, iov[i].iov_len);
+          total += n;
+          if (n < (off_t) iov[i].iov_len)
+            break;
+        }
+      return total;
+    }
+
+  while (i < cnt)
+    {
+      off_t used = 0, n;
+
+      while (i < cnt && used < PGSIZE)
+        {
+          unsigned chunk = iov[i].iov_len - ofs;
+          if (chunk > (unsigned) (PGSIZE - used))
+            chunk = PGSIZE - used;
+          memcpy (page + used, (const uint8_t *) iov[i].iov_base + ofs, chunk);
+          used += chunk;
+          ofs += chunk;
+          if (ofs == iov[i].iov_len)
+            {
+              i++;
+              ofs = 0;
+            }
+        }
+      if (used == 0)
+        break;
+
+      n = file_write (file, page, used);
+      total += n;
+      if (n < used)
+        break;
+    }
+  palloc_free_page (page);
+  return total;
+}
+
+/* Copies up to SIZE bytes from IN, starting at its current
+   position, to OUT at its current position, and advances both
+   positions by the number of bytes copied.  Returns that number,
+   which is less than SIZE if IN reaches end of file or OUT cannot
+   grow.  The data moves from cache to cache through a kernel
+   buffer, never through user memory, a page at a time or a sector
+   at a time if no page is free. */
+off_t
+file_copy (struct file *out, struct file *in, off_t size)
+{
+  uint8_t sector[BLOCK_SECTOR_SIZE];
+  uint8_t *page = palloc_get_page (0);
+  uint8_t *buffer = page != NULL ? page : sector;
+  off_t chunk_max = page != NULL ? PGSIZE : BLOCK_SECTOR_SIZE;
+  off_t total = 0;
+
+  while (size > 0)
+    {
+      off_t chunk = size < chunk_max ? size : chunk_max;
+      off_t got, put;
+
+      /* Keep the reads on IN's sector boundaries. */
+      if (in->pos % BLOCK_SECTOR_SIZE != 0
+          && chunk > BLOCK_SECTOR_SIZE - in->pos % BLOCK_SECTOR_SIZE)
+        chunk -= in->pos % BLOCK_SECTOR_SIZE;
+
+      got = file_read (in, buffer, chunk);
+      if (got == 0)
+        break;
+      put = file_write (out, buffer, got);
+      total += put;
+      size -= put;
+      if (put < got)
+        {
+          in->pos -= got - put;
+          break;
+        }
+    }
+
+  if (page != NULL)
+    palloc_free_page (page);
+  return total;
+}
+
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
@@ -113,6 +241,86 @@ file_write_at (struct file *file, const void *buffer, off_t size,
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Reads SIZE bytes, at most a page, of FILE starting at FILE_OFS
+   into page KPAGE of a memory mapping or executable, straight
+   from disk rather than through the buffer cache.  Returns the
+   number of bytes read.
+   The file's current position is unaffected. */
+off_t
+file_read_page (struct file *file, void *kpage, off_t size, off_t file_ofs)
+{
+  return inode_read_page (file->inode, kpage, size, file_ofs);
+}
+
+/* Reads CNT whole pages of FILE, starting at FILE_OFS, into the
+   pages in KPAGES, like file_read_page() one after another, but
+   with pages adjacent on disk read together.  Returns the number
+   of bytes read.
+   The file's current position is unaffected. */
+off_t
+file_read_pages (struct file *file, void *kpages[], size_t cnt,
+                 off_t file_ofs)
+{
+  return inode_read_pages (file->inode, kpages, cnt, file_ofs);
+}
+
+/* Writes SIZE bytes, at most a page, from page KPAGE of a memory
+   mapping into FILE starting at FILE_OFS, straight to disk rather
+   than through the buffer cache.  Returns the number of bytes
+   written.
+   The file's current position is unaffected. */
+off_t
+file_write_page (struct file *file, const void *kpage, off_t size,
+                 off_t file_ofs)
+{
+  return inode_write_page (file->inode, kpage, size, file_ofs);
+}
+
+/* Sets the size of FILE to LENGTH bytes, discarding the data past
+   LENGTH or adding zeros up to it.  Returns true if successful.
+   The file's current position is unaffected. */
+bool
+file_truncate (struct file *file, off_t length)
+{
+  ASSERT (file != NULL);
+  return inode_truncate (file->inode, length);
+}
+
+/* Allocates disk space for the SIZE bytes of FILE starting at
+   FILE_OFS, growing FILE to cover them if necessary.  Holes in
+   that range are filled with zeros; existing data is kept.
+   Returns true if successful.
+   The file's current position is unaffected. */
+bool
+file_allocate (struct file *file, off_t file_ofs, off_t size)
+{
+  ASSERT (file != NULL);
+  return inode_allocate (file->inode, file_ofs, size);
+}
+
+/* Turns transparent compression of FILE's data on or off,
+   according to ENABLE.  Turning it on compresses the data now;
+   turning it off expands it again.  Returns true if successful.
+   The file's current position is unaffected. */
+bool
+file_compress (struct file *file, bool enable)
+{
+  ASSERT (file != NULL);
+  return inode_set_compress (file->inode, enable);
+}
+
+/* Applies access pattern ADVICE, one of the ADVICE_* values in
+   <syscall-nr.h>, to the SIZE bytes of FILE starting at FILE_OFS,
+   or to the rest of the file if SIZE is 0.  Returns false if
+   ADVICE is not valid.
+   The file's current position is unaffected. */
+bool
+file_advise (struct file *file, off_t file_ofs, off_t size, int advice)
+{
+  ASSERT (file != NULL);
+  return inode_advise (file->inode, file_ofs, size, advice);
+}
+
 /* Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
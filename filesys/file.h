@@ -1,10 +1,15 @@
 #ifndef FILESYS_FILE_H
 #define FILESYS_FILE_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <syscall-nr.h>
 #include "filesys/off_t.h"
 
 struct inode;
 
+void file_init (void);
+
 /* Opening and closing files. */
 struct file *file_open (struct inode *);
 struct file *file_reopen (struct file *);
@@ -16,6 +21,22 @@ off_t file_read (struct file *, void *, off_t);
 off_t file_read_at (struct file *, void *, off_t size, off_t start);
 off_t file_write (struct file *, const void *, off_t);
 off_t file_write_at (struct file *, const void *, off_t size, off_t start);
+off_t file_readv (struct file *, const struct iovec *, int cnt);
+off_t file_writev (struct file *, const struct iovec *, int cnt);
+off_t file_copy (struct file *out, struct file *in, off_t size);
+off_t file_read_page (struct file *, void *kpage, off_t size, off_t start);
+off_t file_read_pages (struct file *, void *kpages[], size_t cnt,
+                       off_t start);
+off_t file_write_page (struct file *, const void *kpage, off_t size,
+                       off_t start);
+
+/* Changing the size. */
+bool file_truncate (struct file *, off_t length);
+bool file_allocate (struct file *, off_t offset, off_t size);
+bool file_compress (struct file *, bool);
+
+/* Access pattern advice. */
+bool file_advise (struct file *, off_t offset, off_t size, int advice);
 
 /* Preventing writes. */
 void file_deny_write (struct file *);
@@ -2,15 +2,85 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/checksum.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
+#include "filesys/fsutil.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "filesys/directory.h"
+#include "filesys/refcount.h"
+#include "threads/arena.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
 
+/* Identifies a superblock. */
+#define SUPERBLOCK_MAGIC 0x53425346
+
+/* Layout version written by do_format().  Version 2 changed the
+   directory format to variable-length records. */
+#define SUPERBLOCK_VERSION 2
+
+/* Maximum number of sector runs in the warm-up list. */
+#define WARM_MAX 60
+
+/* Feature flags that this kernel understands. */
+#define FS_FEATURES (FS_EXTENTS | FS_INLINE | FS_JOURNAL | FS_CHECKSUM \
+                     | FS_REFCOUNT)
+
+/* On-disk superblock, in SUPERBLOCK_SECTOR.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   CLEAN is cleared when the file system is mounted and set again
+   by filesys_done(), so a crash leaves it clear.  Booting from a
+   cleanly unmounted disk skips recovery.  Disks formatted before
+   superblocks existed have no SUPERBLOCK_MAGIC here; their
+   directories are in the old fixed-size format, so they must be
+   reformatted.
+
+   WARM lists the runs of sectors that the buffer cache held at
+   the last clean unmount, which are read back in the background
+   at the next boot.
+
+   With FS_REFCOUNT, REFCOUNT_SECTOR is the inode of the table of
+   sector reference counts that lets files share data sectors.
+
+   CLUSTER is the number of sectors per cluster, or 0 on disks
+   formatted before clusters existed, which have 1. */
+struct superblock
+  {
+    unsigned magic;                     /* SUPERBLOCK_MAGIC. */
+    unsigned version;                   /* Layout version. */
+    unsigned features;                  /* FS_* flags. */
+    unsigned clean;                     /* Cleanly unmounted? */
+    block_sector_t sector_cnt;          /* Sectors in file system. */
+    uint32_t warm_cnt;                  /* Number of runs in WARM. */
+    struct cache_range warm[WARM_MAX];  /* Cache warm-up list. */
+    block_sector_t refcount_sector;     /* Reference count table. */
+    uint32_t cluster;                   /* Sectors per cluster. */
+  };
+
+unsigned filesys_cluster = 1;
+
+/* Largest number of sectors per cluster. */
+#define CLUSTER_MAX 8
+
+/* In-memory copy of the superblock, valid if has_superblock. */
+static struct superblock sb;
+static bool has_superblock;
+
+/* Is the root directory's inode held in the buffer cache? */
+static bool root_held;
+
 static void do_format (void);
+static bool mount (void);
+static bool resolve (const char *path, struct dir **dirp,
+                     char name[NAME_MAX + 1]);
 
 /* Initializes the file system module.
    If FORMAT is true, reformats the file system. */
@@ -21,13 +91,38 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  ASSERT (sizeof sb == BLOCK_SECTOR_SIZE);
+
+  journal_init ();
+  checksum_init ();
+  cache_init ();
+  dcache_init ();
   inode_init ();
+  file_init ();
+  dir_init ();
   free_map_init ();
+  refcount_init ();
 
   if (format) 
-    do_format ();
+    {
+      do_format ();
+      free_map_open ();
+    }
+  else
+    {
+      bool check = mount ();
+      free_map_open ();
+      if (has_superblock && (sb.features & FS_REFCOUNT))
+        refcount_open (sb.refcount_sector);
+      if (check)
+        fsutil_fsck (NULL);
+    }
+
+  /* Nearly every path lookup starts at the root directory. */
+  root_held = cache_hold (ROOT_DIR_SECTOR);
 
-  free_map_open ();
+  if (has_superblock)
+    cache_warm (sb.warm, sb.warm_cnt < WARM_MAX ? sb.warm_cnt : WARM_MAX);
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -35,69 +130,349 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  if (has_superblock)
+    sb.warm_cnt = cache_warm_list (sb.warm, WARM_MAX);
+  if (root_held)
+    cache_unhold (ROOT_DIR_SECTOR);
+  inode_flush_delayed ();
+  inode_flush_releases ();
+  refcount_close ();
   free_map_close ();
+  journal_done ();
+  cache_flush ();
+  checksum_done ();
+
+  if (has_superblock)
+    {
+      sb.clean = true;
+      block_write (fs_device, SUPERBLOCK_SECTOR, &sb);
+    }
+}
+
+/* Writes all unwritten data to disk without shutting down: every
+   inode's delayed data, the journal's running transaction and
+   every dirty sector in the buffer cache. */
+void
+filesys_sync (void)
+{
+  inode_flush_delayed ();
+  journal_commit ();
+  cache_flush ();
+  checksum_sync ();
+}
+
+/* Returns true if the file system has a superblock, false if it
+   was formatted before superblocks existed. */
+bool
+filesys_has_superblock (void)
+{
+  return has_superblock;
+}
+
+/* Reads the superblock and prepares the file system for use,
+   recovering it if it was not cleanly unmounted, and then marks
+   it as in use.  Returns true if the free map must be rebuilt by
+   the checker, because the disk was not cleanly unmounted and has
+   no journal to replay. */
+static bool
+mount (void)
+{
+  bool check = false;
+
+  block_read (fs_device, SUPERBLOCK_SECTOR, &sb);
+  if (sb.magic != SUPERBLOCK_MAGIC)
+    PANIC ("file system has no superblock and an old directory format; "
+           "reformat it");
+  if (sb.version != SUPERBLOCK_VERSION || (sb.features & ~FS_FEATURES))
+    PANIC ("file system has unsupported version %u or features %#x",
+           sb.version, sb.features);
+  if (sb.sector_cnt != block_size (fs_device))
+    PANIC ("file system has %"PRDSNu" sectors but its device has %"PRDSNu,
+           sb.sector_cnt, block_size (fs_device));
+  if (sb.cluster > CLUSTER_MAX || (sb.cluster & (sb.cluster - 1)))
+    PANIC ("file system has unsupported cluster size %u", sb.cluster);
+  has_superblock = true;
+  inode_extents = (sb.features & FS_EXTENTS) != 0;
+  filesys_cluster = sb.cluster != 0 ? sb.cluster : 1;
+  checksum_enabled = (sb.features & FS_CHECKSUM) != 0;
+
+  if (!sb.clean)
+    printf ("File system was not cleanly unmounted.\n");
+  if (!(sb.features & FS_JOURNAL))
+    check = !sb.clean;
+  else if (sb.clean)
+    journal_open ();
+  else
+    journal_recover ();
+
+  /* The table on disk is written lazily, so it is current only
+     after a clean unmount.  Recovery writes home sectors behind
+     the cache's back, so rebuild after it. */
+  if (checksum_enabled)
+    {
+      if (sb.clean)
+        checksum_open ();
+      else
+        checksum_rebuild ();
+    }
+
+  sb.clean = false;
+  block_write (fs_device, SUPERBLOCK_SECTOR, &sb);
+  return check;
 }
 
-/* Creates a file named NAME with the given INITIAL_SIZE.
+/* Creates a file at PATH with the given INITIAL_SIZE.
+   Returns true if successful, false otherwise.
+   Fails if a file at PATH already exists, if a directory along
+   PATH does not exist, or if internal memory allocation fails.
+   The inode goes in the same block group as its directory. */
+bool
+filesys_create (const char *path, off_t initial_size) 
+{
+  block_sector_t inode_sector = 0;
+  char name[NAME_MAX + 1];
+  struct dir *dir = NULL;
+  bool success;
+
+  journal_begin (JOURNAL_CREDITS);
+  success = (resolve (path, &dir, name)
+             && free_map_allocate_inode (dir_get_inumber (dir), &inode_sector)
+             && inode_create (inode_sector, initial_size, false)
+             && dir_add (dir, name, inode_sector));
+  if (!success && inode_sector != 0) 
+    free_map_release (inode_sector, 1);
+  dir_close (dir);
+  journal_end ();
+
+  return success;
+}
+
+/* Creates an empty directory at PATH.
    Returns true if successful, false otherwise.
-   Fails if a file named NAME already exists,
-   or if internal memory allocation fails. */
+   Fails for the same reasons as filesys_create().
+   Directories are spread across block groups, so that each one
+   leaves room near it for the files it will hold. */
 bool
-filesys_create (const char *name, off_t initial_size) 
+filesys_mkdir (const char *path)
 {
   block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
+  char name[NAME_MAX + 1];
+  struct dir *dir = NULL;
+  bool success;
+
+  journal_begin (JOURNAL_CREDITS);
+  success = (resolve (path, &dir, name)
+             && free_map_allocate_spread (&inode_sector)
+             && dir_create (inode_sector, 16, dir_get_inumber (dir))
+             && dir_add (dir, name, inode_sector));
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
   dir_close (dir);
+  journal_end ();
 
   return success;
 }
 
-/* Opens the file with the given NAME.
+/* Opens the file or directory at PATH.
    Returns the new file if successful or a null pointer
    otherwise.
-   Fails if no file named NAME exists,
+   Fails if nothing exists at PATH,
    or if an internal memory allocation fails. */
 struct file *
-filesys_open (const char *name)
+filesys_open (const char *path)
 {
-  struct dir *dir = dir_open_root ();
+  char name[NAME_MAX + 1];
+  struct dir *dir = NULL;
   struct inode *inode = NULL;
 
-  if (dir != NULL)
-    dir_lookup (dir, name, &inode);
+  if (resolve (path, &dir, name))
+    {
+      if (!strcmp (name, "."))
+        {
+          if (!inode_is_removed (dir_get_inode (dir)))
+            inode = inode_reopen (dir_get_inode (dir));
+        }
+      else
+        dir_lookup (dir, name, &inode);
+    }
   dir_close (dir);
 
   return file_open (inode);
 }
 
-/* Deletes the file named NAME.
+/* Deletes the file or empty directory at PATH.
    Returns true if successful, false on failure.
-   Fails if no file named NAME exists,
-   or if an internal memory allocation fails. */
+   Fails if nothing exists at PATH, if PATH names a directory
+   that is not empty, or if an internal memory allocation
+   fails. */
 bool
-filesys_remove (const char *name) 
+filesys_remove (const char *path) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  char name[NAME_MAX + 1];
+  struct dir *dir = NULL;
+  bool success;
+
+  journal_begin (JOURNAL_CREDITS);
+  success = (resolve (path, &dir, name)
+             && strcmp (name, ".") && strcmp (name, "..")
+             && dir_remove (dir, name));
   dir_close (dir); 
+  journal_end ();
 
   return success;
 }
-
+
+/* Creates a file at NEW_PATH that is a copy of the regular file
+   at PATH, sharing its data sectors until either file writes to
+   them.  Returns true if successful, false otherwise.
+   Fails if PATH does not name a regular file, if the file system
+   or the file's format does not allow sharing, or for the same
+   reasons as filesys_create(). */
+bool
+filesys_clone (const char *path, const char *new_path)
+{
+  block_sector_t inode_sector = 0;
+  char name[NAME_MAX + 1];
+  struct dir *dir = NULL;
+  struct file *file;
+  bool cloned = false;
+  bool success;
+
+  journal_begin (JOURNAL_CREDITS);
+  file = filesys_open (path);
+  success = (file != NULL && !inode_is_dir (file_get_inode (file))
+             && resolve (new_path, &dir, name)
+             && free_map_allocate_inode (dir_get_inumber (dir), &inode_sector)
+             && (cloned = inode_clone (file_get_inode (file), inode_sector))
+             && dir_add (dir, name, inode_sector));
+  if (!success && cloned)
+    {
+      /* Releases the clone's references along with its inode. */
+      struct inode *inode = inode_open (inode_sector);
+      if (inode == NULL)
+        PANIC ("can't reopen clone inode %"PRDSNu, inode_sector);
+      inode_remove (inode);
+      inode_close (inode);
+    }
+  else if (!success && inode_sector != 0)
+    free_map_release (inode_sector, 1);
+  dir_close (dir);
+  file_close (file);
+  journal_end ();
+
+  return success;
+}
+
+/* Changes the current thread's working directory to PATH.
+   Returns true if successful, false if PATH does not name a
+   directory. */
+bool
+filesys_chdir (const char *path)
+{
+  struct file *file = filesys_open (path);
+  struct dir *dir;
+
+  if (file == NULL)
+    return false;
+  dir = dir_open (inode_reopen (file_get_inode (file)));
+  file_close (file);
+  if (dir == NULL)
+    return false;
+
+  dir_close (thread_current ()->cwd);
+  thread_current ()->cwd = dir;
+  return true;
+}
+
+/* Splits PATH into the directory that contains its last
+   component, which is opened and stored in *DIRP, and the name
+   of that component, which is copied into NAME.  A relative PATH
+   starts from the current thread's working directory.  "." and
+   ".." are followed along the way; a PATH that names a directory
+   by itself, such as "/", yields that directory and the name ".".
+   Returns true if successful.  On failure, *DIRP is set to a
+   null pointer. */
+static bool
+resolve (const char *path, struct dir **dirp, char name[NAME_MAX + 1])
+{
+  struct thread *cur = thread_current ();
+  char *copy, *token, *next, *save_ptr;
+  struct dir *dir;
+
+  *dirp = NULL;
+  if (path == NULL || *path == '\0')
+    return false;
+  copy = arena_alloc (strlen (path) + 1);
+  if (copy == NULL)
+    return false;
+  strlcpy (copy, path, strlen (path) + 1);
+
+  if (path[0] == '/' || cur->cwd == NULL)
+    dir = dir_open_root ();
+  else
+    dir = dir_reopen (cur->cwd);
+
+  /* Descend through every component but the last. */
+  token = strtok_r (copy, "/", &save_ptr);
+  strlcpy (name, ".", NAME_MAX + 1);
+  while (dir != NULL && token != NULL)
+    {
+      next = strtok_r (NULL, "/", &save_ptr);
+      if (strlen (token) > NAME_MAX)
+        {
+          dir_close (dir);
+          dir = NULL;
+        }
+      else if (next == NULL)
+        strlcpy (name, token, NAME_MAX + 1);
+      else if (strcmp (token, "."))
+        {
+          struct inode *inode;
+          struct dir *child = NULL;
+
+          if (dir_lookup (dir, token, &inode))
+            child = dir_open (inode);
+          dir_close (dir);
+          dir = child;
+        }
+      token = next;
+    }
+  arena_free (copy);
+
+  *dirp = dir;
+  return dir != NULL;
+}
+
 /* Formats the file system. */
 static void
 do_format (void)
 {
+  block_sector_t refcount_sector;
+
+  if (filesys_cluster == 0 || filesys_cluster > CLUSTER_MAX
+      || (filesys_cluster & (filesys_cluster - 1)))
+    PANIC ("cluster size must be 1, 2, 4 or 8 sectors, not %u",
+           filesys_cluster);
+  if (checksum_enabled)
+    checksum_rebuild ();
   printf ("Formatting file system...");
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  if (!dir_create (ROOT_DIR_SECTOR, 16, ROOT_DIR_SECTOR))
     PANIC ("root directory creation failed");
+  refcount_sector = refcount_create ();
   free_map_close ();
+  journal_format ();
+
+  memset (&sb, 0, sizeof sb);
+  sb.magic = SUPERBLOCK_MAGIC;
+  sb.version = SUPERBLOCK_VERSION;
+  sb.features = (FS_INLINE | FS_JOURNAL | (inode_extents ? FS_EXTENTS : 0)
+                 | (checksum_enabled ? FS_CHECKSUM : 0) | FS_REFCOUNT);
+  sb.clean = false;
+  sb.sector_cnt = block_size (fs_device);
+  sb.refcount_sector = refcount_sector;
+  sb.cluster = filesys_cluster;
+  block_write (fs_device, SUPERBLOCK_SECTOR, &sb);
+  has_superblock = true;
   printf ("done.\n");
 }
@@ -7,14 +7,33 @@
 /* Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
+#define SUPERBLOCK_SECTOR 2     /* File system superblock sector. */
+#define JOURNAL_SECTOR 3        /* First sector of the journal. */
+
+/* Superblock feature flags. */
+#define FS_EXTENTS 0x01         /* New inodes are extent-based. */
+#define FS_INLINE 0x02          /* Small files are stored in the inode. */
+#define FS_JOURNAL 0x04         /* Metadata is journaled. */
+#define FS_CHECKSUM 0x08        /* Sectors are checksummed. */
+#define FS_REFCOUNT 0x10        /* Files may share data sectors. */
 
 /* Block device that contains the file system. */
 struct block *fs_device;
 
+/* Sectors per cluster, the unit in which file data is allocated
+   and read: 1, 2, 4 or 8.  Set by the kernel command-line option
+   "-cluster" for formatting, and from the superblock otherwise. */
+extern unsigned filesys_cluster;
+
 void filesys_init (bool format);
 void filesys_done (void);
-bool filesys_create (const char *name, off_t initial_size);
-struct file *filesys_open (const char *name);
-bool filesys_remove (const char *name);
+void filesys_sync (void);
+bool filesys_has_superblock (void);
+bool filesys_create (const char *path, off_t initial_size);
+bool filesys_mkdir (const char *path);
+struct file *filesys_open (const char *path);
+bool filesys_remove (const char *path);
+bool filesys_clone (const char *path, const char *new_path);
+bool filesys_chdir (const char *path);
 
 #endif /* filesys/filesys.h */
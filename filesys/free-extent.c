@@ -0,0 +1,341 @@
+#include "filesys/free-extent.h"
+#include <debug.h>
+#include <rbtree.h>
+#include <round.h>
+#include <stdio.h>
+#include "threads/malloc.h"
+
+/* Free extent index.
+
+   With the "-free-extents" option, the free map keeps, besides
+   its bitmap, an index of the maximal runs of free sectors in the
+   data part of each block group, that is, outside the inode
+   tables.  Each run is in two red-black trees: BY_START, ordered
+   by first sector, and BY_SIZE, ordered by length and then by
+   first sector.  The smallest run that holds N sectors is then
+   the lower bound of N in BY_SIZE, and the run that holds or
+   follows a goal sector is a lookup in BY_START, both in
+   O(log n) time however fragmented the disk is.
+
+   The bitmap stays the only copy on disk, written a sector at a
+   time as it changes, and the index is rebuilt from it whenever
+   the free map is read.  The free map lock serializes all calls
+   into this module. */
+
+bool free_extents_enabled;
+
+/* A run of free sectors. */
+struct extent
+  {
+    struct rb_elem start_elem;          /* Element in BY_START. */
+    struct rb_elem size_elem;           /* Element in BY_SIZE. */
+    block_sector_t start;               /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+  };
+
+static struct rb_tree by_start;         /* Runs by first sector. */
+static struct rb_tree by_size;          /* Runs by length, then start. */
+
+/* Statistics. */
+static size_t peak_cnt;                 /* Most runs at once. */
+static unsigned long long best_fit_cnt; /* Best-fit queries. */
+static unsigned long long near_cnt;     /* Near-goal queries. */
+static unsigned long long miss_cnt;     /* Queries with no fit. */
+static unsigned long long step_cnt;     /* Runs visited by near-goal. */
+
+/* Orders extents by first sector. */
+static bool
+start_less (const struct rb_elem *a_, const struct rb_elem *b_,
+            void *aux UNUSED)
+{
+  const struct extent *a = rb_entry (a_, struct extent, start_elem);
+  const struct extent *b = rb_entry (b_, struct extent, start_elem);
+
+  return a->start < b->start;
+}
+
+/* Orders extents by length, then by first sector. */
+static bool
+size_less (const struct rb_elem *a_, const struct rb_elem *b_,
+           void *aux UNUSED)
+{
+  const struct extent *a = rb_entry (a_, struct extent, size_elem);
+  const struct extent *b = rb_entry (b_, struct extent, size_elem);
+
+  return a->cnt != b->cnt ? a->cnt < b->cnt : a->start < b->start;
+}
+
+/* Initializes the index, empty. */
+void
+free_extent_init (void)
+{
+  rb_init (&by_start, start_less, NULL);
+  rb_init (&by_size, size_less, NULL);
+}
+
+/* Empties the index. */
+void
+free_extent_clear (void)
+{
+  struct rb_elem *e;
+
+  while ((e = rb_pop_first (&by_start)) != NULL)
+    free (rb_entry (e, struct extent, start_elem));
+  rb_init (&by_size, size_less, NULL);
+}
+
+/* Returns the extent that holds SECTOR, or a null pointer if
+   SECTOR is not in any. */
+static struct extent *
+find_holding (block_sector_t sector)
+{
+  struct extent key;
+  struct rb_elem *e;
+
+  key.start = sector;
+  e = rb_upper_bound (&by_start, &key.start_elem);
+  e = e != NULL ? rb_prev (e) : rb_last (&by_start);
+  if (e != NULL)
+    {
+      struct extent *x = rb_entry (e, struct extent, start_elem);
+      if (sector < x->start + x->cnt)
+        return x;
+    }
+  return NULL;
+}
+
+/* Changes the length of extent X to CNT, keeping BY_SIZE in
+   order, or frees X if CNT is 0. */
+static void
+resize (struct extent *x, size_t cnt)
+{
+  rb_remove (&by_size, &x->size_elem);
+  if (cnt == 0)
+    {
+      rb_remove (&by_start, &x->start_elem);
+      free (x);
+      return;
+    }
+  x->cnt = cnt;
+  rb_insert (&by_size, &x->size_elem);
+}
+
+/* Adds a new extent of CNT sectors starting at START.  Returns
+   false if memory allocation failed. */
+static bool
+insert (block_sector_t start, size_t cnt)
+{
+  struct extent *x = malloc (sizeof *x);
+
+  if (x == NULL)
+    return false;
+  x->start = start;
+  x->cnt = cnt;
+  rb_insert (&by_start, &x->start_elem);
+  rb_insert (&by_size, &x->size_elem);
+  if (rb_size (&by_start) > peak_cnt)
+    peak_cnt = rb_size (&by_start);
+  return true;
+}
+
+/* Records that the CNT sectors starting at SECTOR, which are in
+   no extent, are free, merging them with the extents on either
+   side.  Returns false if memory allocation failed, in which case
+   the index is unchanged. */
+bool
+free_extent_add (block_sector_t sector, size_t cnt)
+{
+  struct extent key;
+  struct rb_elem *e;
+  struct extent *left = NULL, *right = NULL;
+
+  if (cnt == 0)
+    return true;
+
+  key.start = sector;
+  e = rb_lower_bound (&by_start, &key.start_elem);
+  if (e != NULL)
+    {
+      right = rb_entry (e, struct extent, start_elem);
+      ASSERT (sector + cnt <= right->start);
+      if (sector + cnt != right->start)
+        right = NULL;
+    }
+  e = e != NULL ? rb_prev (e) : rb_last (&by_start);
+  if (e != NULL)
+    {
+      left = rb_entry (e, struct extent, start_elem);
+      ASSERT (left->start + left->cnt <= sector);
+      if (left->start + left->cnt != sector)
+        left = NULL;
+    }
+
+  if (left != NULL && right != NULL)
+    {
+      size_t right_cnt = right->cnt;
+      resize (right, 0);
+      resize (left, left->cnt + cnt + right_cnt);
+    }
+  else if (left != NULL)
+    resize (left, left->cnt + cnt);
+  else if (right != NULL)
+    {
+      /* Moving RIGHT's start down to SECTOR keeps BY_START in
+         order, since no extent lies between. */
+      right->start = sector;
+      resize (right, right->cnt + cnt);
+    }
+  else
+    return insert (sector, cnt);
+  return true;
+}
+
+/* Records that the CNT sectors starting at SECTOR, which must lie
+   within a single extent, are no longer free.  Returns false if
+   memory allocation failed, in which case the index is
+   unchanged. */
+bool
+free_extent_take (block_sector_t sector, size_t cnt)
+{
+  struct extent *x;
+  block_sector_t end;
+
+  if (cnt == 0)
+    return true;
+
+  x = find_holding (sector);
+  ASSERT (x != NULL && sector + cnt <= x->start + x->cnt);
+  end = x->start + x->cnt;
+
+  if (sector + cnt < end)
+    {
+      /* Keep the part after the taken sectors, in a new extent
+         unless none remains before them either. */
+      if (sector > x->start)
+        {
+          if (!insert (sector + cnt, end - (sector + cnt)))
+            return false;
+          resize (x, sector - x->start);
+        }
+      else
+        {
+          x->start = sector + cnt;
+          resize (x, end - x->start);
+        }
+    }
+  else
+    resize (x, sector - x->start);
+  return true;
+}
+
+/* Returns true if a run of CNT sectors that starts at or after
+   sector FROM, on a multiple of ALIGN, fits in extent X, and if
+   so stores the first sector of the earliest such run in
+   *FIRST. */
+static bool
+fits (const struct extent *x, block_sector_t from, size_t cnt, size_t align,
+      block_sector_t *first)
+{
+  block_sector_t s = x->start > from ? x->start : from;
+
+  s = ROUND_UP (s, align);
+  if (s < x->start || s + cnt > x->start + x->cnt)
+    return false;
+  *first = s;
+  return true;
+}
+
+/* Finds the shortest extent that holds a run of CNT sectors
+   starting on a multiple of ALIGN, the first on disk among those
+   of equal length, and stores the first sector of that run in
+   *SECTORP.  Returns false if there is none.  The sectors stay in
+   the index until free_extent_take(). */
+bool
+free_extent_best_fit (size_t cnt, size_t align, block_sector_t *sectorp)
+{
+  struct extent key;
+  struct rb_elem *e;
+
+  best_fit_cnt++;
+  key.cnt = cnt;
+  key.start = 0;
+
+  /* Any extent at least CNT + ALIGN - 1 long holds an aligned
+     run, so only the few shorter ones may be passed over. */
+  for (e = rb_lower_bound (&by_size, &key.size_elem); e != NULL;
+       e = rb_next (e))
+    if (fits (rb_entry (e, struct extent, size_elem), 0, cnt, align,
+              sectorp))
+      return true;
+  miss_cnt++;
+  return false;
+}
+
+/* Finds the first run of CNT free sectors, starting on a multiple
+   of ALIGN, at or after GOAL that lies between sectors START and
+   END, exclusive, and failing that the first one at or after
+   START, and stores its first sector in *SECTORP.  Returns false
+   if there is none.  The sectors stay in the index until
+   free_extent_take(). */
+bool
+free_extent_near (size_t cnt, size_t align, block_sector_t goal,
+                  block_sector_t start, block_sector_t end,
+                  block_sector_t *sectorp)
+{
+  struct extent key;
+  struct extent *x;
+  struct rb_elem *e;
+  int pass;
+
+  ASSERT (start <= goal);
+  near_cnt++;
+  for (pass = 0; pass < 2; pass++)
+    {
+      block_sector_t from = pass == 0 ? goal : start;
+
+      x = find_holding (from);
+      if (x != NULL)
+        e = &x->start_elem;
+      else
+        {
+          key.start = from;
+          e = rb_lower_bound (&by_start, &key.start_elem);
+        }
+      for (; e != NULL; e = rb_next (e))
+        {
+          block_sector_t first;
+
+          x = rb_entry (e, struct extent, start_elem);
+          first = x->start > from ? x->start : from;
+          if (first + cnt > end || (pass == 1 && first >= goal))
+            break;
+          step_cnt++;
+          if (fits (x, from, cnt, align, &first) && first + cnt <= end)
+            {
+              *sectorp = first;
+              return true;
+            }
+        }
+    }
+  miss_cnt++;
+  return false;
+}
+
+/* Returns the number of extents in the index. */
+size_t
+free_extent_count (void)
+{
+  return rb_size (&by_start);
+}
+
+/* Prints statistics about the free extent index. */
+void
+free_extent_print_stats (void)
+{
+  if (!free_extents_enabled)
+    return;
+  printf ("Free extents: %zu now (peak %zu), %llu best-fit and "
+          "%llu near-goal queries, %llu missed, %llu runs visited\n",
+          free_extent_count (), peak_cnt, best_fit_cnt, near_cnt,
+          miss_cnt, step_cnt);
+}
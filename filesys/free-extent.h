@@ -0,0 +1,24 @@
+#ifndef FILESYS_FREE_EXTENT_H
+#define FILESYS_FREE_EXTENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* If true, the free map indexes its free extents.  Set by the
+   kernel command-line option "-free-extents". */
+extern bool free_extents_enabled;
+
+void free_extent_init (void);
+void free_extent_clear (void);
+bool free_extent_add (block_sector_t, size_t cnt);
+bool free_extent_take (block_sector_t, size_t cnt);
+bool free_extent_best_fit (size_t cnt, size_t align, block_sector_t *);
+bool free_extent_near (size_t cnt, size_t align, block_sector_t goal,
+                       block_sector_t start, block_sector_t end,
+                       block_sector_t *);
+size_t free_extent_count (void);
+
+void free_extent_print_stats (void);
+
+#endif /* filesys/free-extent.h */
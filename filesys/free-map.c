@@ -1,52 +1,633 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include "filesys/cache.h"
+#include "filesys/checksum.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/free-extent.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
+static bool inode_held;              /* Its inode held in the cache? */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static size_t free_cnt;              /* Number of 0 bits in free_map. */
+static size_t reserved_cnt;          /* Free sectors promised away. */
+static size_t free_map_next;         /* Next-fit search start. */
+
+/* Protects the free map and everything below.  Not held while
+   the free map file is written, since writing a file may
+   allocate. */
+static struct lock free_map_lock;
+
+/* Sectors of the free map file that differ from the copy on
+   disk, one bit per sector of the file.  Allocation and release
+   only mark them here; free_map_sync() writes them out. */
+static struct bitmap *free_map_dirty;
+
+/* Number of free map bits stored in one sector of its file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* Block groups.
+
+   The disk is divided into groups of GROUP_SECTORS consecutive
+   sectors.  free_map_allocate_near() keeps an inode's data in the
+   same group as the inode, and free_map_allocate_spread() places
+   new directories in the emptiest group, so that related sectors
+   stay close together and unrelated directories spread out.
+
+   The first INODE_TABLE_SECTORS sectors of each group are its
+   inode table.  free_map_allocate_inode() takes inode sectors from
+   the table, as close to the parent directory's inode as it can,
+   and data allocations stay out of the tables, so that the inodes
+   of a directory's files sit side by side and one pass over them
+   seeks little.  The free map's bits for a table serve as its
+   inode bitmap.  Either kind of allocation falls back to the
+   other's sectors once its own are used up. */
+#define GROUP_SECTORS 4096
+#define INODE_TABLE_SECTORS 128
+static size_t group_cnt;             /* Number of groups. */
+static size_t *group_free;           /* Free sectors in each group. */
+static size_t *group_free_inodes;    /* Free inode table sectors in each. */
+
+/* True while the free extent index, in filesys/free-extent.c, is
+   up to date, so that data allocations query it instead of
+   scanning the bitmap.  Only with free_extents_enabled, and only
+   until the index runs out of memory. */
+static bool extents_indexed;
+
+static void claim (block_sector_t, size_t cnt);
+static void account (block_sector_t, size_t cnt, bool allocated);
+static void count_groups (void);
+static void mark_dirty (block_sector_t, size_t cnt);
+static bool allocate (size_t cnt, block_sector_t *);
+static bool allocate_near (size_t cnt, block_sector_t goal,
+                           block_sector_t *);
+static bool allocate_inode (block_sector_t goal, block_sector_t *);
+static size_t scan_data (size_t start, size_t cnt, size_t align);
+static size_t cluster_align (size_t cnt);
+static void index_extents (void);
+static void drop_extents (void);
 
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
-  free_map = bitmap_create (block_size (fs_device));
+  lock_init (&free_map_lock);
+  free_extent_init ();
+  free_map = bitmap_create_summary (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  free_map_dirty = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                                BLOCK_SECTOR_SIZE));
+  if (free_map_dirty == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+  group_free = malloc (group_cnt * sizeof *group_free);
+  group_free_inodes = malloc (group_cnt * sizeof *group_free_inodes);
+  if (group_free == NULL || group_free_inodes == NULL)
+    PANIC ("block group creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_mark (free_map, SUPERBLOCK_SECTOR);
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SIZE, true);
+  if (checksum_enabled)
+    bitmap_set_multiple (free_map, CHECKSUM_SECTOR, checksum_size (), true);
+  count_groups ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available.  The change reaches the free map file
+   at the next free_map_sync(). */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = allocate (cnt, sectorp);
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Does the work of free_map_allocate().
+   The free map lock must be held. */
+static bool
+allocate (size_t cnt, block_sector_t *sectorp)
+{
+  block_sector_t sector = BITMAP_ERROR;
+  size_t align;
+
+  if (cnt > free_cnt - reserved_cnt)
+    return false;
+
+  /* With the extent index, take the best-fit run outside the inode
+     tables.  Otherwise search next-fit from where the last
+     allocation ended, then wrap around to the start of the disk.
+     A run that is not cluster-aligned will do if no aligned one
+     is left.  Only if no run outside the inode tables is long
+     enough, take one anywhere. */
+  for (align = cluster_align (cnt); sector == BITMAP_ERROR; align = 1)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      if (extents_indexed)
+        {
+          if (!free_extent_best_fit (cnt, align, &sector))
+            sector = BITMAP_ERROR;
+        }
+      else
+        {
+          sector = scan_data (free_map_next, cnt, align);
+          if (sector == BITMAP_ERROR && free_map_next != 0)
+            sector = scan_data (0, cnt, align);
+        }
+      if (align == 1)
+        break;
     }
+  if (sector == BITMAP_ERROR)
+    sector = bitmap_scan (free_map, 0, cnt, false);
   if (sector != BITMAP_ERROR)
-    *sectorp = sector;
+    {
+      free_map_next = (sector + cnt) % bitmap_size (free_map);
+      claim (sector, cnt);
+      *sectorp = sector;
+    }
   return sector != BITMAP_ERROR;
 }
 
+/* Returns the sector alignment for a data allocation of CNT
+   sectors.  On a file system formatted with clusters, an
+   allocation of at least a cluster starts on a cluster boundary,
+   so that file data lies in whole clusters that the buffer cache
+   reads with one transfer each.  Smaller allocations, such as
+   inode and index sectors, fill in anywhere. */
+static size_t
+cluster_align (size_t cnt)
+{
+  return filesys_cluster > 1 && cnt >= filesys_cluster ? filesys_cluster : 1;
+}
+
+/* Returns the first sector of the first run of CNT free sectors
+   at or after START, on a multiple of ALIGN, that lies wholly
+   outside the inode tables, or BITMAP_ERROR if there is none.
+   The free map lock must be held. */
+static size_t
+scan_data (size_t start, size_t cnt, size_t align)
+{
+  size_t size = bitmap_size (free_map);
+
+  while (start < size)
+    {
+      size_t sector = bitmap_scan (free_map, start, cnt, false);
+      size_t group;
+
+      if (sector == BITMAP_ERROR)
+        return BITMAP_ERROR;
+
+      /* A run that starts in a table, or crosses into the next
+         group and so into that group's table, is no good.  Go on
+         past the table it touches. */
+      group = sector / GROUP_SECTORS;
+      if (sector % GROUP_SECTORS < INODE_TABLE_SECTORS)
+        start = group * GROUP_SECTORS + INODE_TABLE_SECTORS;
+      else if ((sector + cnt - 1) / GROUP_SECTORS != group)
+        start = (group + 1) * GROUP_SECTORS + INODE_TABLE_SECTORS;
+      else if (sector % align != 0)
+        start = ROUND_UP (sector, align);
+      else
+        return sector;
+    }
+  return BITMAP_ERROR;
+}
+
+/* Like free_map_allocate(), but prefers sectors in the block
+   group that holds GOAL, starting at GOAL itself.  Falls back to
+   the rest of the disk when that group has no room. */
+bool
+free_map_allocate_near (size_t cnt, block_sector_t goal,
+                        block_sector_t *sectorp)
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = allocate_near (cnt, goal, sectorp);
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Does the work of free_map_allocate_near().
+   The free map lock must be held. */
+static bool
+allocate_near (size_t cnt, block_sector_t goal, block_sector_t *sectorp)
+{
+  size_t size = bitmap_size (free_map);
+
+  if (goal < size && cnt > 0
+      && (group_free[goal / GROUP_SECTORS]
+          - group_free_inodes[goal / GROUP_SECTORS]) >= cnt
+      && cnt <= free_cnt - reserved_cnt)
+    {
+      size_t data_start = (goal / GROUP_SECTORS * GROUP_SECTORS
+                           + INODE_TABLE_SECTORS);
+      size_t group_end = data_start - INODE_TABLE_SECTORS + GROUP_SECTORS;
+      size_t align = cluster_align (cnt);
+      size_t sector;
+
+      if (group_end > size)
+        group_end = size;
+      if (goal < data_start)
+        goal = data_start;
+      if (extents_indexed)
+        {
+          block_sector_t found;
+          sector = (free_extent_near (cnt, align, goal, data_start,
+                                      group_end, &found)
+                    ? found : BITMAP_ERROR);
+        }
+      else
+        {
+          sector = scan_data (goal, cnt, align);
+          if (sector == BITMAP_ERROR || sector + cnt > group_end)
+            sector = scan_data (data_start, cnt, align);
+        }
+      if (sector != BITMAP_ERROR && sector + cnt <= group_end)
+        {
+          claim (sector, cnt);
+          *sectorp = sector;
+          return true;
+        }
+    }
+  return allocate (cnt, sectorp);
+}
+
+/* Allocates one sector for the inode of a new file in the
+   directory whose inode is in DIR_SECTOR, preferably in the same
+   block group's inode table, as close after DIR_SECTOR as
+   possible.  Falls back to the other groups' tables, then to any
+   free sector.
+   Returns true if successful, false if the disk is full. */
+bool
+free_map_allocate_inode (block_sector_t dir_sector, block_sector_t *sectorp)
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = allocate_inode (dir_sector, sectorp);
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Does the work of free_map_allocate_inode(), with GOAL as the
+   sector to start from.  The free map lock must be held. */
+static bool
+allocate_inode (block_sector_t goal, block_sector_t *sectorp)
+{
+  size_t size = bitmap_size (free_map);
+  size_t first = goal < size ? goal / GROUP_SECTORS : 0;
+  size_t i;
+
+  if (free_cnt - reserved_cnt < 1)
+    return false;
+  for (i = 0; i < group_cnt; i++)
+    {
+      size_t group = (first + i) % group_cnt;
+      size_t table = group * GROUP_SECTORS;
+      size_t table_end = table + INODE_TABLE_SECTORS;
+      size_t sector;
+
+      if (group_free_inodes[group] == 0)
+        continue;
+      if (table_end > size)
+        table_end = size;
+      sector = BITMAP_ERROR;
+      if (group == first && goal > table && goal < table_end)
+        sector = bitmap_scan (free_map, goal, 1, false);
+      if (sector == BITMAP_ERROR || sector >= table_end)
+        sector = bitmap_scan (free_map, table, 1, false);
+      ASSERT (sector < table_end);
+      claim (sector, 1);
+      *sectorp = sector;
+      return true;
+    }
+  return allocate_near (1, goal, sectorp);
+}
+
+/* Allocates one sector for a new directory in the block group
+   with the most free sectors, so that directories, and the files
+   allocated near them, spread out across the disk.  The sector
+   comes from that group's inode table if it has room.
+   Returns true if successful, false if the disk is full. */
+bool
+free_map_allocate_spread (block_sector_t *sectorp)
+{
+  size_t best = 0;
+  size_t i;
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  for (i = 1; i < group_cnt; i++)
+    if (group_free[i] > group_free[best])
+      best = i;
+  success = allocate_inode (best * GROUP_SECTORS, sectorp);
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Marks the CNT free sectors starting at SECTOR as in use. */
+static void
+claim (block_sector_t sector, size_t cnt)
+{
+  ASSERT (!bitmap_contains (free_map, sector, cnt, true));
+  bitmap_set_multiple (free_map, sector, cnt, true);
+  account (sector, cnt, true);
+}
+
+/* Updates the free sector counts and the dirty sectors of the
+   free map file for CNT sectors starting at SECTOR, which were
+   just ALLOCATED or released. */
+static void
+account (block_sector_t sector, size_t cnt, bool allocated)
+{
+  block_sector_t end = sector + cnt;
+
+  if (allocated)
+    free_cnt -= cnt;
+  else
+    free_cnt += cnt;
+
+  while (sector < end)
+    {
+      size_t group = sector / GROUP_SECTORS;
+      block_sector_t group_end = (group + 1) * GROUP_SECTORS;
+      block_sector_t table_end = group * GROUP_SECTORS + INODE_TABLE_SECTORS;
+      size_t n = (end < group_end ? end : group_end) - sector;
+      size_t in_table = 0;
+
+      if (sector < table_end)
+        in_table = (end < table_end ? end : table_end) - sector;
+      if (extents_indexed && in_table < n
+          && !(allocated
+               ? free_extent_take (sector + in_table, n - in_table)
+               : free_extent_add (sector + in_table, n - in_table)))
+        drop_extents ();
+      if (allocated)
+        {
+          group_free[group] -= n;
+          group_free_inodes[group] -= in_table;
+        }
+      else
+        {
+          group_free[group] += n;
+          group_free_inodes[group] += in_table;
+        }
+      sector += n;
+    }
+
+  mark_dirty (end - cnt, cnt);
+}
+
+/* Recomputes the free sector counts from the bitmap. */
+static void
+count_groups (void)
+{
+  size_t size = bitmap_size (free_map);
+  size_t i;
+
+  free_cnt = 0;
+  for (i = 0; i < group_cnt; i++)
+    {
+      size_t start = i * GROUP_SECTORS;
+      size_t n = size - start < GROUP_SECTORS ? size - start : GROUP_SECTORS;
+
+      group_free[i] = bitmap_count (free_map, start, n, false);
+      group_free_inodes[i] = bitmap_count (free_map, start,
+                                           (n < INODE_TABLE_SECTORS
+                                            ? n : INODE_TABLE_SECTORS),
+                                           false);
+      free_cnt += group_free[i];
+    }
+  index_extents ();
+}
+
+/* Rebuilds the free extent index from the bitmap, if it is
+   enabled. */
+static void
+index_extents (void)
+{
+  size_t size = bitmap_size (free_map);
+  size_t i;
+
+  if (!free_extents_enabled)
+    return;
+  free_extent_clear ();
+  extents_indexed = true;
+  for (i = 0; i < group_cnt; i++)
+    {
+      size_t sector = i * GROUP_SECTORS + INODE_TABLE_SECTORS;
+      size_t group_end = (i + 1) * GROUP_SECTORS;
+
+      if (group_end > size)
+        group_end = size;
+      while (sector < group_end)
+        {
+          size_t end;
+
+          sector = bitmap_scan (free_map, sector, 1, false);
+          if (sector == BITMAP_ERROR || sector >= group_end)
+            break;
+          end = bitmap_scan (free_map, sector, 1, true);
+          if (end == BITMAP_ERROR || end > group_end)
+            end = group_end;
+          if (!free_extent_add (sector, end - sector))
+            {
+              drop_extents ();
+              return;
+            }
+          sector = end;
+        }
+    }
+}
+
+/* Gives up on the free extent index after running out of memory
+   for it.  Allocation goes back to scanning the bitmap. */
+static void
+drop_extents (void)
+{
+  printf ("free map: out of memory for free extent index, "
+          "using the bitmap alone\n");
+  free_extent_clear ();
+  extents_indexed = false;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
-  ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  struct free_run run;
+
+  run.start = sector;
+  run.cnt = cnt;
+  free_map_release_many (&run, 1);
+}
+
+/* Makes the sectors in each of the CNT RUNS available for use,
+   taking the free map lock only once.  Like any release, the
+   change reaches the free map file at the next free_map_sync(),
+   which writes each changed sector of it once however many runs
+   it covers. */
+void
+free_map_release_many (const struct free_run *runs, size_t cnt)
+{
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  for (i = 0; i < cnt; i++)
+    {
+      block_sector_t sector = runs[i].start;
+
+      ASSERT (bitmap_all (free_map, sector, runs[i].cnt));
+      bitmap_set_multiple (free_map, sector, runs[i].cnt, false);
+      account (sector, runs[i].cnt, false);
+      if (sector < free_map_next)
+        free_map_next = sector;
+    }
+  lock_release (&free_map_lock);
+}
+
+/* Sets aside CNT free sectors, without choosing which, so that
+   other allocations cannot take them until free_map_unreserve()
+   gives them back.  Returns false if fewer than CNT sectors are
+   free and not already reserved. */
+bool
+free_map_reserve (size_t cnt)
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = cnt <= free_cnt - reserved_cnt;
+  if (success)
+    reserved_cnt += cnt;
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Gives back CNT sectors set aside by free_map_reserve(). */
+void
+free_map_unreserve (size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (cnt <= reserved_cnt);
+  reserved_cnt -= cnt;
+  lock_release (&free_map_lock);
+}
+
+/* Like free_map_allocate_near(), but takes the CNT sectors from
+   those set aside by free_map_reserve(), in one step, so that no
+   other allocation can take them in between.  Returns false,
+   leaving the reservation as it was, if no run of CNT
+   consecutive free sectors is left; a single sector can always
+   be had. */
+bool
+free_map_allocate_reserved (size_t cnt, block_sector_t goal,
+                            block_sector_t *sectorp)
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  ASSERT (cnt <= reserved_cnt);
+  reserved_cnt -= cnt;
+  success = allocate_near (cnt, goal, sectorp);
+  if (!success)
+    reserved_cnt += cnt;
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Records that the free map bits for CNT sectors starting at
+   SECTOR have changed. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  if (cnt > 0)
+    bitmap_set_multiple (free_map_dirty, sector / BITS_PER_SECTOR,
+                         (sector + cnt - 1) / BITS_PER_SECTOR
+                         - sector / BITS_PER_SECTOR + 1, true);
+}
+
+/* Writes the changed sectors of the free map to its file.
+   Unless NDEBUG is defined, also checks the free sector count
+   against the bitmap. */
+void
+free_map_sync (void)
+{
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  ASSERT (free_cnt == bitmap_count (free_map, 0, bitmap_size (free_map),
+                                    false));
+  lock_release (&free_map_lock);
+
+  if (free_map_file == NULL)
+    return;
+  for (i = 0; i < bitmap_size (free_map_dirty); i++)
+    {
+      bool dirty;
+
+      lock_acquire (&free_map_lock);
+      dirty = bitmap_test (free_map_dirty, i);
+      bitmap_reset (free_map_dirty, i);
+      lock_release (&free_map_lock);
+      if (dirty && !bitmap_write_part (free_map, free_map_file,
+                                       i * BLOCK_SECTOR_SIZE,
+                                       BLOCK_SECTOR_SIZE))
+        PANIC ("can't write free map");
+    }
+}
+
+/* Returns the number of sectors of the free map file that the
+   next free_map_sync() will write. */
+size_t
+free_map_dirty_cnt (void)
+{
+  size_t cnt;
+
+  lock_acquire (&free_map_lock);
+  cnt = bitmap_count (free_map_dirty, 0, bitmap_size (free_map_dirty), true);
+  lock_release (&free_map_lock);
+  return cnt;
+}
+
+/* Replaces the free map by USED, which has one bit per sector,
+   true for a sector in use, as rebuilt by the file system
+   checker.  Returns the number of sectors whose state changed.
+   The changes reach the free map file at the next
+   free_map_sync(). */
+size_t
+free_map_rebuild (const struct bitmap *used)
+{
+  size_t changed = 0;
+  size_t i;
+
+  ASSERT (bitmap_size (used) == bitmap_size (free_map));
+
+  lock_acquire (&free_map_lock);
+  for (i = 0; i < bitmap_size (free_map); i++)
+    if (bitmap_test (free_map, i) != bitmap_test (used, i))
+      {
+        bitmap_flip (free_map, i);
+        mark_dirty (i, 1);
+        changed++;
+      }
+  count_groups ();
+  free_map_next = 0;
+  lock_release (&free_map_lock);
+  return changed;
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,13 +639,20 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  count_groups ();
+  inode_held = cache_hold (FREE_MAP_SECTOR);
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  free_map_sync ();
+  if (inode_held)
+    cache_unhold (FREE_MAP_SECTOR);
+  inode_held = false;
   file_close (free_map_file);
+  free_map_file = NULL;
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -73,7 +661,7 @@ void
 free_map_create (void) 
 {
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
     PANIC ("free map creation failed");
 
   /* Write bitmap to file. */
@@ -82,11 +670,22 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (free_map_dirty, false);
 }
 
-/* MODIFIED Return number of bits that are 0 */
+/* MODIFIED Return number of bits that are 0, that is, the number
+   of free sectors, less those reserved by free_map_reserve().
+   Kept up to date by allocation and release, so this takes
+   constant time. */
 size_t
 free_map_unused (void)
 {
-  return bitmap_count (free_map, 0, block_size (fs_device), false);
+  return free_cnt - reserved_cnt;
+}
+
+/* Returns the total number of sectors tracked by the free map. */
+size_t
+free_map_size (void)
+{
+  return bitmap_size (free_map);
 }
@@ -5,15 +5,36 @@
 #include <stddef.h>
 #include "devices/block.h"
 
+struct bitmap;
+
+/* A run of CNT consecutive sectors starting at START. */
+struct free_run
+  {
+    block_sector_t start;               /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+  };
+
 void free_map_init (void);
 void free_map_read (void);
 void free_map_create (void);
 void free_map_open (void);
 void free_map_close (void);
+void free_map_sync (void);
+size_t free_map_dirty_cnt (void);
+size_t free_map_rebuild (const struct bitmap *used);
 
 bool free_map_allocate (size_t, block_sector_t *);
+bool free_map_allocate_near (size_t, block_sector_t goal, block_sector_t *);
+bool free_map_allocate_inode (block_sector_t dir_sector, block_sector_t *);
+bool free_map_allocate_spread (block_sector_t *);
 void free_map_release (block_sector_t, size_t);
+void free_map_release_many (const struct free_run *, size_t cnt);
+bool free_map_reserve (size_t cnt);
+void free_map_unreserve (size_t cnt);
+bool free_map_allocate_reserved (size_t, block_sector_t goal,
+                                 block_sector_t *);
 
 size_t free_map_unused (void);
+size_t free_map_size (void);
 
 #endif /* filesys/free-map.h */
@@ -1,16 +1,31 @@
 #include "filesys/fsutil.h"
+#include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ustar.h>
+#include "filesys/checksum.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/cache.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "filesys/refcount.h"
+#include "threads/arena.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
+/* Next sector of the scratch device to be written by
+   fsutil_append() or fsutil_export(). */
+static block_sector_t append_sector;
+
 /* List files in the root directory. */
 void
 fsutil_ls (char **argv UNUSED) 
@@ -66,39 +81,327 @@ fsutil_rm (char **argv)
     PANIC ("%s: delete failed\n", file_name);
 }
 
+/* Inode sectors named by one batch of directory entries. */
+#define FSCK_BATCH 128
+
+/* Checks the inode in SECTOR for fsutil_fsck(), marking the
+   sectors it occupies in USED and, if it is a directory, the
+   inodes that it names in PENDING.  INUMBERS is a buffer for
+   FSCK_BATCH inode sectors.  Returns the number of problems
+   found. */
+static size_t
+fsck_inode (block_sector_t sector, struct bitmap *used,
+            struct bitmap *pending, block_sector_t *inumbers)
+{
+  size_t bad_cnt = 0;
+  struct dir *dir;
+  bool is_dir;
+  size_t cnt, i;
+
+  bitmap_reset (pending, sector);
+  if (!inode_collect (sector, used, &is_dir))
+    {
+      printf ("fsck: inode %"PRDSNu" is damaged\n", sector);
+      bad_cnt++;
+    }
+  if (!is_dir)
+    return bad_cnt;
+
+  dir = dir_open (inode_open (sector));
+  if (dir == NULL)
+    PANIC ("fsck: can't open directory %"PRDSNu, sector);
+  while ((cnt = dir_read_inumbers (dir, inumbers, FSCK_BATCH)) > 0)
+    for (i = 0; i < cnt; i++)
+      {
+        block_sector_t child = inumbers[i];
+        if (child < bitmap_size (used) && !bitmap_test (used, child)
+            && !bitmap_test (pending, child))
+          bitmap_mark (pending, child);
+        else
+          {
+            printf ("fsck: directory %"PRDSNu" names bad inode "
+                    "%"PRDSNu"\n", sector, child);
+            bad_cnt++;
+          }
+      }
+  dir_close (dir);
+  return bad_cnt;
+}
+
+/* Checks the file system and rebuilds the free map from the
+   sectors that files and directories actually occupy, so that
+   sectors leaked or lost by an unclean shutdown are put right.
+
+   Only inodes reachable from the root directory are visited, so
+   the time taken depends on the space in use rather than the
+   size of the disk.  Inodes waiting to be visited are kept in a
+   bitmap and visited in ascending sector order, wrapping around
+   when a directory names an inode behind the current position.
+   Each run of consecutive waiting inodes is loaded with one
+   multi-sector read, and directories are read a page at a
+   time. */
+void
+fsutil_fsck (char **argv UNUSED)
+{
+  size_t size = free_map_size ();
+  struct bitmap *used, *pending;
+  block_sector_t *inumbers;
+  size_t cursor = 0, inode_cnt = 0, bad_cnt = 0, fixed_cnt;
+
+  printf ("Checking file system...\n");
+  inode_flush_delayed ();
+  inode_flush_releases ();
+  used = bitmap_create (size);
+  pending = bitmap_create (size);
+  inumbers = malloc (FSCK_BATCH * sizeof *inumbers);
+  if (used == NULL || pending == NULL || inumbers == NULL)
+    PANIC ("couldn't allocate fsck bitmaps");
+
+  if (filesys_has_superblock ())
+    bitmap_mark (used, SUPERBLOCK_SECTOR);
+  if (journal_enabled ())
+    bitmap_set_multiple (used, JOURNAL_SECTOR, JOURNAL_SIZE, true);
+  if (checksum_enabled)
+    bitmap_set_multiple (used, CHECKSUM_SECTOR, checksum_size (), true);
+  bitmap_mark (pending, FREE_MAP_SECTOR);
+  if (refcount_sector != 0)
+    bitmap_mark (pending, refcount_sector);
+  bitmap_mark (pending, ROOT_DIR_SECTOR);
+  for (;;)
+    {
+      size_t sector = bitmap_scan (pending, cursor, 1, true);
+      size_t run;
+
+      if (sector == BITMAP_ERROR && cursor != 0)
+        sector = bitmap_scan (pending, cursor = 0, 1, true);
+      if (sector == BITMAP_ERROR)
+        break;
+
+      for (run = 1; sector + run < size && run < CACHE_SIZE / 2
+                    && bitmap_test (pending, sector + run); run++)
+        continue;
+      cache_load (sector, run);
+      for (cursor = sector; cursor < sector + run; cursor++)
+        bad_cnt += fsck_inode (cursor, used, pending, inumbers);
+      inode_cnt += run;
+    }
+
+  fixed_cnt = free_map_rebuild (used);
+  free_map_sync ();
+  printf ("fsck: %zu inodes, %zu problems, %zu free map sectors fixed\n",
+          inode_cnt, bad_cnt, fixed_cnt);
+
+  free (inumbers);
+  bitmap_destroy (pending);
+  bitmap_destroy (used);
+}
+
+/* Defragments every regular file reachable from the root
+   directory whose data lies in more than one run of sectors.
+   Directories are walked in ascending sector order, as in
+   fsutil_fsck(), with PENDING holding the inodes still to be
+   visited and SEEN those already named. */
+void
+fsutil_defrag (char **argv UNUSED)
+{
+  size_t size = free_map_size ();
+  struct bitmap *pending, *seen;
+  block_sector_t *inumbers;
+  size_t file_cnt = 0, moved_cnt = 0, run_cnt = 0;
+  size_t sector;
+
+  printf ("Defragmenting file system...\n");
+  pending = bitmap_create (size);
+  seen = bitmap_create (size);
+  inumbers = malloc (FSCK_BATCH * sizeof *inumbers);
+  if (pending == NULL || seen == NULL || inumbers == NULL)
+    PANIC ("couldn't allocate defrag bitmaps");
+
+  bitmap_mark (pending, ROOT_DIR_SECTOR);
+  bitmap_mark (seen, ROOT_DIR_SECTOR);
+  while ((sector = bitmap_scan (pending, 0, 1, true)) != BITMAP_ERROR)
+    {
+      struct inode *inode;
+      size_t runs, cnt, i;
+      struct dir *dir;
+
+      bitmap_reset (pending, sector);
+      inode = inode_open (sector);
+      if (inode == NULL)
+        continue;
+      if (!inode_is_dir (inode))
+        {
+          file_cnt++;
+          if (inode_defrag (inode, 2, &runs))
+            {
+              moved_cnt++;
+              run_cnt += runs;
+            }
+          inode_close (inode);
+          continue;
+        }
+
+      dir = dir_open (inode);
+      if (dir == NULL)
+        continue;
+      while ((cnt = dir_read_inumbers (dir, inumbers, FSCK_BATCH)) > 0)
+        for (i = 0; i < cnt; i++)
+          if (inumbers[i] < size && !bitmap_test (seen, inumbers[i]))
+            {
+              bitmap_mark (seen, inumbers[i]);
+              bitmap_mark (pending, inumbers[i]);
+            }
+      dir_close (dir);
+    }
+
+  printf ("defrag: %zu files, %zu defragmented from %zu runs\n",
+          file_cnt, moved_cnt, run_cnt);
+
+  free (inumbers);
+  bitmap_destroy (seen);
+  bitmap_destroy (pending);
+}
+
+/* Sectors of the scratch device read by fsutil_extract() at a
+   time, and the number of such runs buffered. */
+#define EXTRACT_RUN 64
+#define EXTRACT_BUFS 2
+#define EXTRACT_PAGES (EXTRACT_RUN * BLOCK_SECTOR_SIZE / PGSIZE)
+
+/* Two-stage pipeline between the thread that reads the archive
+   from the scratch device and the one that writes its files into
+   the file system.  The reader fills the buffers in turn, each
+   with the next EXTRACT_RUN sectors of the device, so that reading
+   the next run overlaps writing the current one. */
+struct extract_pipe
+  {
+    struct block *src;                  /* Scratch device. */
+    uint8_t *bufs[EXTRACT_BUFS];        /* Staging buffers. */
+    size_t cnt[EXTRACT_BUFS];           /* Sectors read into each. */
+    struct semaphore full[EXTRACT_BUFS];  /* Up when a buffer is full. */
+    struct semaphore empty[EXTRACT_BUFS]; /* Up when it may be refilled. */
+    struct semaphore done;              /* Up when the reader exits. */
+    bool stop;                          /* Tells the reader to exit. */
+    block_sector_t next;                /* Next sector to read. */
+
+    /* Owned by the writer. */
+    size_t cur;                         /* Buffer being consumed. */
+    size_t pos;                         /* Next sector in it. */
+    bool held;                          /* Is CUR full and ours? */
+  };
+
+/* Reader thread of an extract_pipe. */
+static void
+extract_reader (void *p_)
+{
+  struct extract_pipe *p = p_;
+  block_sector_t size = block_size (p->src);
+  size_t i = 0;
+
+  for (;;)
+    {
+      size_t cnt;
+
+      sema_down (&p->empty[i]);
+      if (p->stop)
+        break;
+      cnt = size - p->next < EXTRACT_RUN ? size - p->next : EXTRACT_RUN;
+      block_read_multiple (p->src, p->next, cnt, p->bufs[i]);
+      p->next += cnt;
+      p->cnt[i] = cnt;
+      sema_up (&p->full[i]);
+      i = (i + 1) % EXTRACT_BUFS;
+    }
+  sema_up (&p->done);
+}
+
+/* Returns the next 1 to MAX consecutive sectors of the archive in
+   P, storing the number returned in *CNT.  They remain valid
+   until the next call. */
+static const uint8_t *
+extract_take (struct extract_pipe *p, size_t max, size_t *cnt)
+{
+  const uint8_t *data;
+  size_t n;
+
+  if (p->held && p->pos == p->cnt[p->cur])
+    {
+      sema_up (&p->empty[p->cur]);
+      p->cur = (p->cur + 1) % EXTRACT_BUFS;
+      p->held = false;
+    }
+  if (!p->held)
+    {
+      sema_down (&p->full[p->cur]);
+      if (p->cnt[p->cur] == 0)
+        PANIC ("ustar archive runs past the end of the scratch device");
+      p->held = true;
+      p->pos = 0;
+    }
+
+  n = p->cnt[p->cur] - p->pos;
+  if (n > max)
+    n = max;
+  data = p->bufs[p->cur] + p->pos * BLOCK_SECTOR_SIZE;
+  p->pos += n;
+  *cnt = n;
+  return data;
+}
+
 /* Extracts a ustar-format tar archive from the scratch block
-   device into the Pintos file system. */
+   device into the Pintos file system.
+
+   A helper thread reads the device in runs of EXTRACT_RUN sectors
+   while this thread writes the previous run's data.  Each file is
+   created at its full size up front and then written in chunks
+   as large as the buffered sectors allow, so that its data lands
+   in as few, as large, writes as possible. */
 void
 fsutil_extract (char **argv UNUSED) 
 {
   static block_sector_t sector = 0;
 
-  struct block *src;
-  void *header, *data;
+  struct extract_pipe p;
+  void *header;
+  size_t i;
 
   /* Allocate buffers. */
-  header = malloc (BLOCK_SECTOR_SIZE);
-  data = malloc (BLOCK_SECTOR_SIZE);
-  if (header == NULL || data == NULL)
+  header = arena_alloc (BLOCK_SECTOR_SIZE);
+  if (header == NULL)
     PANIC ("couldn't allocate buffers");
+  for (i = 0; i < EXTRACT_BUFS; i++)
+    {
+      p.bufs[i] = palloc_get_multiple (PAL_ASSERT, EXTRACT_PAGES);
+      sema_init (&p.full[i], 0);
+      sema_init (&p.empty[i], 1);
+    }
+  sema_init (&p.done, 0);
+  p.stop = false;
+  p.cur = 0;
+  p.held = false;
 
   /* Open source block device. */
-  src = block_get_role (BLOCK_SCRATCH);
-  if (src == NULL)
+  p.src = block_get_role (BLOCK_SCRATCH);
+  if (p.src == NULL)
     PANIC ("couldn't open scratch device");
+  p.next = sector;
 
   printf ("Extracting ustar archive from scratch device "
           "into file system...\n");
+  thread_create ("extract", PRI_DEFAULT, extract_reader, &p);
 
   for (;;)
     {
       const char *file_name;
       const char *error;
       enum ustar_type type;
+      size_t cnt;
       int size;
 
-      /* Read and parse ustar header. */
-      block_read (src, sector++, header);
+      /* Read and parse ustar header.  It is copied out of the
+         pipeline, because FILE_NAME points into it. */
+      memcpy (header, extract_take (&p, 1, &cnt), BLOCK_SECTOR_SIZE);
+      sector++;
       error = ustar_parse_header (header, &file_name, &type, &size);
       if (error != NULL)
         PANIC ("bad ustar header in sector %"PRDSNu" (%s)", sector - 1, error);
@@ -126,13 +429,18 @@ fsutil_extract (char **argv UNUSED)
           /* Do copy. */
           while (size > 0)
             {
-              int chunk_size = (size > BLOCK_SECTOR_SIZE
-                                ? BLOCK_SECTOR_SIZE
-                                : size);
-              block_read (src, sector++, data);
+              const uint8_t *data;
+              int chunk_size;
+
+              data = extract_take (&p, DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE),
+                                   &cnt);
+              chunk_size = (size > (int) (cnt * BLOCK_SECTOR_SIZE)
+                            ? (int) (cnt * BLOCK_SECTOR_SIZE)
+                            : size);
               if (file_write (dst, data, chunk_size) != chunk_size)
                 PANIC ("%s: write failed with %d bytes unwritten",
                        file_name, size);
+              sector += cnt;
               size -= chunk_size;
             }
 
@@ -141,17 +449,24 @@ fsutil_extract (char **argv UNUSED)
         }
     }
 
+  /* Stop the reader.  It may be waiting for any of the buffers. */
+  p.stop = true;
+  for (i = 0; i < EXTRACT_BUFS; i++)
+    sema_up (&p.empty[i]);
+  sema_down (&p.done);
+
   /* Erase the ustar header from the start of the block device,
      so that the extraction operation is idempotent.  We erase
      two blocks because two blocks of zeros are the ustar
      end-of-archive marker. */
   printf ("Erasing ustar archive...\n");
   memset (header, 0, BLOCK_SECTOR_SIZE);
-  block_write (src, 0, header);
-  block_write (src, 1, header);
+  block_write (p.src, 0, header);
+  block_write (p.src, 1, header);
 
-  free (data);
-  free (header);
+  for (i = 0; i < EXTRACT_BUFS; i++)
+    palloc_free_multiple (p.bufs[i], EXTRACT_PAGES);
+  arena_free (header);
 }
 
 /* Copies file FILE_NAME from the file system to the scratch
@@ -165,7 +480,7 @@ fsutil_extract (char **argv UNUSED)
 void
 fsutil_append (char **argv)
 {
-  static block_sector_t sector = 0;
+  block_sector_t sector = append_sector;
 
   const char *file_name = argv[1];
   void *buffer;
@@ -176,7 +491,7 @@ fsutil_append (char **argv)
   printf ("Appending '%s' to ustar archive on scratch device...\n", file_name);
 
   /* Allocate buffer. */
-  buffer = malloc (BLOCK_SECTOR_SIZE);
+  buffer = arena_alloc (BLOCK_SECTOR_SIZE);
   if (buffer == NULL)
     PANIC ("couldn't allocate buffer");
 
@@ -215,8 +530,91 @@ fsutil_append (char **argv)
   memset (buffer, 0, BLOCK_SECTOR_SIZE);
   block_write (dst, sector, buffer);
   block_write (dst, sector, buffer + 1);
+  append_sector = sector;
 
   /* Finish up. */
   file_close (src);
-  free (buffer);
+  arena_free (buffer);
+}
+
+/* Sectors written to the scratch device by fsutil_export() at a
+   time. */
+#define EXPORT_RUN 64
+#define EXPORT_PAGES (EXPORT_RUN * BLOCK_SECTOR_SIZE / PGSIZE)
+
+/* Copies each file named in the comma-separated list ARGV[1] from
+   the file system to the scratch device, in ustar format, like a
+   series of `append's.  File data is read and written EXPORT_RUN
+   sectors at a time, so that large results leave the VM at disk
+   speed instead of a sector per request.  Shares its position on
+   the scratch device with fsutil_append(). */
+void
+fsutil_export (char **argv)
+{
+  uint8_t *buffer;
+  struct block *dst;
+  char *file_name, *save_ptr;
+
+  /* Allocate buffer. */
+  buffer = palloc_get_multiple (PAL_ASSERT, EXPORT_PAGES);
+
+  /* Open target block device. */
+  dst = block_get_role (BLOCK_SCRATCH);
+  if (dst == NULL)
+    PANIC ("couldn't open scratch device");
+
+  for (file_name = strtok_r (argv[1], ",", &save_ptr); file_name != NULL;
+       file_name = strtok_r (NULL, ",", &save_ptr))
+    {
+      struct file *src;
+      off_t size;
+
+      printf ("Exporting '%s' to ustar archive on scratch device...\n",
+              file_name);
+
+      /* Open source file. */
+      src = filesys_open (file_name);
+      if (src == NULL)
+        PANIC ("%s: open failed", file_name);
+      size = file_length (src);
+
+      /* Write ustar header to first sector. */
+      if (!ustar_make_header (file_name, USTAR_REGULAR, size,
+                              (char *) buffer))
+        PANIC ("%s: name too long for ustar format", file_name);
+      if (append_sector >= block_size (dst))
+        PANIC ("%s: out of space on scratch device", file_name);
+      block_write (dst, append_sector++, buffer);
+
+      /* Do copy, a run of sectors at a time. */
+      while (size > 0)
+        {
+          off_t chunk_size = (size > EXPORT_RUN * BLOCK_SECTOR_SIZE
+                              ? EXPORT_RUN * BLOCK_SECTOR_SIZE : size);
+          size_t cnt = DIV_ROUND_UP (chunk_size, BLOCK_SECTOR_SIZE);
+
+          if (append_sector + cnt > block_size (dst))
+            PANIC ("%s: out of space on scratch device", file_name);
+          if (file_read (src, buffer, chunk_size) != chunk_size)
+            PANIC ("%s: read failed with %"PROTd" bytes unread",
+                   file_name, size);
+          memset (buffer + chunk_size, 0,
+                  cnt * BLOCK_SECTOR_SIZE - chunk_size);
+          block_write_multiple (dst, append_sector, cnt, buffer);
+          append_sector += cnt;
+          size -= chunk_size;
+        }
+      file_close (src);
+    }
+
+  /* Write ustar end-of-archive marker, which is two consecutive
+     sectors full of zeros, without advancing past it, in case
+     more files are appended. */
+  if (append_sector + 2 <= block_size (dst))
+    {
+      memset (buffer, 0, 2 * BLOCK_SECTOR_SIZE);
+      block_write_multiple (dst, append_sector, 2, buffer);
+    }
+
+  palloc_free_multiple (buffer, EXPORT_PAGES);
 }
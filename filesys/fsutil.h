@@ -4,7 +4,10 @@
 void fsutil_ls (char **argv);
 void fsutil_cat (char **argv);
 void fsutil_rm (char **argv);
+void fsutil_fsck (char **argv);
+void fsutil_defrag (char **argv);
 void fsutil_extract (char **argv);
 void fsutil_append (char **argv);
+void fsutil_export (char **argv);
 
 #endif /* filesys/fsutil.h */
@@ -1,38 +1,274 @@
 #include "filesys/inode.h"
+#include <bitmap.h>
+#include <hash.h>
 #include <list.h>
+#include <lz.h>
 #include <debug.h>
 #include <round.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <string.h>
+#include <syscall-nr.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
+#include "filesys/refcount.h"
+#include "threads/arena.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/tracepoint.h"
+#include "threads/vaddr.h"
+#include "threads/workqueue.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
-#define DIRECT_BLOCK 124
-#define MAX_BLOCK_NUMBER 16637 // 1 + 124 + 2 ** 7 + 2 ** 14
+#define DIRECT_BLOCK 122
+#define MAX_BLOCK_NUMBER 16635 // 1 + 122 + 2 ** 7 + 2 ** 14
+
+/* Identifies an extent-based inode. */
+#define EXTENT_MAGIC 0x494e4f45
+#define INLINE_EXTENTS 60               /* Extents in inode_disk. */
+#define BLOCK_EXTENTS 63                /* Extents per extent_block. */
+
+/* Identifies an inode whose data is stored in the inode itself. */
+#define INLINE_MAGIC 0x494e4f49
+#define INLINE_BYTES 492                /* Data bytes in inode_disk. */
+
+/* Identifies an inode whose data is compressed cluster by
+   cluster. */
+#define COMPRESSED_MAGIC 0x494e4f43
+#define CLUSTER_SIZE PGSIZE             /* Bytes per cluster. */
+#define CLUSTER_SECTORS (CLUSTER_SIZE / BLOCK_SECTOR_SIZE)
+
+/* If true, inode_create() makes extent-based inodes. */
+bool inode_extents;
 
 /* MODIFIED: return the total number of sectors needed to save SECTORS's data */
 size_t compute_total_sectors (size_t sectors);
 
+/* Sector number of a hole in a sparse file. */
+#define HOLE_SECTOR 0
+
+/* Sectors allocated at a time when a write extends a file. */
+#define GROW_CHUNK 8
+
+/* A read or write of file data that covers at least this many
+   whole, contiguous sectors goes straight between the disk and
+   the caller's buffer.  Caching a transfer as large as the whole
+   cache would only evict everything else. */
+#define DIRECT_MIN CACHE_SIZE
+
+/* A direct transfer to or from user memory is copied through at
+   most this many kernel pages at a time.  The block layer carries
+   out transfers in the device's dispatcher thread, under whatever
+   page directory happens to be active, so it must only ever be
+   given kernel addresses. */
+#define BOUNCE_PAGES 16
+
+/* inode_write_at(), inode_allocate() and inode_truncate() work on
+   at most this many data sectors per journal operation, so that
+   the indirect blocks and free map sectors that a long transfer
+   changes fit in one transaction. */
+#define TXN_SECTORS 1024
+
+/* Most extent_blocks that an inode may have, so that
+   extent_store() can always rewrite the whole chain within one
+   journal operation. */
+#define EXTENT_BLOCKS_MAX (JOURNAL_CREDITS_MAX - JOURNAL_CREDITS)
+
+/* A removed inode with at least this many sectors of data has
+   them released by a background job, so that closing it does not
+   wait while its whole index is walked. */
+#define DEFER_MIN 128
+
+/* Delayed allocation.
+
+   Data written to a hole in a regular file is not given sectors
+   right away.  It waits in the inode's delayed buffer, which
+   holds up to DELAY_MAX consecutive data sectors, while the free
+   map reserves room for them.  The buffer is written out, to a
+   single run of sectors if the free map allows, when a write
+   needs a sector it cannot hold, when the inode is closed or
+   truncated, and when the flusher thread calls
+   inode_flush_delayed(), so that a file grown by many small
+   appends, even interleaved with other files' appends, is laid
+   out in long runs.  At most DELAY_INODES inodes have delayed
+   data at a time; the rest allocate as they write. */
+#define DELAY_MAX 32
+#define DELAY_PAGES (DELAY_MAX * BLOCK_SECTOR_SIZE / PGSIZE)
+#define DELAY_INODES 8
+
+/* Index sectors a flush of a delayed buffer may need, reserved
+   along with its data. */
+#define DELAY_META 3
+
+/* Online defragmentation.
+
+   inode_defrag() moves a regular file whose data lies in several
+   runs of sectors into a single new run and switches its map over
+   in one journal transaction.  When the last opener of an
+   extent-based file with at least DEFRAG_RUNS extents closes it,
+   the inode is handed to a background job to be defragmented
+   instead of being freed at once.  The same job compresses a
+   file with COMPRESS set that was changed while it was open.  At
+   most DEFRAG_QUEUE inodes wait for that job. */
+#define DEFRAG_RUNS 8
+#define DEFRAG_QUEUE 8
+
+/* Runs gathered for each free_map_release_many() call. */
+#define RELEASE_BATCH 32
+
+/* Data sectors a block-mapped inode can address. */
+#define BLOCKMAP_SECTORS (DIRECT_BLOCK + 128 * 128)
+
+/* A run of LENGTH consecutive data sectors starting at START. */
+struct extent
+  {
+    block_sector_t start;               /* First sector of the run. */
+    uint32_t length;                    /* Number of sectors. */
+  };
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   The data sectors are mapped one of two ways, chosen when the
+   inode is created and told apart by the magic number.  An
+   INODE_MAGIC inode lists sectors individually in SECTORS and the
+   double indirect block IB.  An EXTENT_MAGIC inode lists runs of
+   sectors in EXTENTS, followed by a chain of extent_blocks
+   starting at OVERFLOW when more than INLINE_EXTENTS are needed.
+   A block map reaches only BLOCKMAP_SECTORS sectors, so an
+   INODE_MAGIC inode that grows past them is converted to
+   EXTENT_MAGIC in place, with its data left where it is.
+
+   Files may be sparse.  A data sector is allocated the first time
+   it is written, so a sector number of 0, which always holds the
+   free map inode, stands for a hole that reads as zeros: a 0 in
+   SECTORS, IB or an indirect block, or an extent starting at 0.
+
+   Files grow when written past LENGTH.  A write that extends a
+   file allocates up to GROW_CHUNK sectors at a time, so sectors
+   past the new end of file may be allocated too; the last close
+   trims them off again.  An extent inode's extents may likewise
+   reach past the end of file while it is open.
+
+   An INLINE_MAGIC inode, used for files of at most INLINE_BYTES,
+   has no data sectors: its bytes are kept in INLINE_DATA.  If it
+   grows past that, it is converted to the format that
+   TO_EXTENTS names and its bytes move to its first data sector.
+
+   A COMPRESSED_MAGIC inode holds its data in clusters of
+   CLUSTER_SIZE bytes, each compressed on its own with
+   lz_compress().  Its extents, stored as for EXTENT_MAGIC, list
+   one run per cluster in order: a run as long as the cluster
+   holds it as is, a shorter one holds it compressed, and a hole
+   holds a cluster of zeros.  Such an inode is read-only in this
+   form.  A regular file with COMPRESS set is compressed when it
+   goes cold, after its last close, and goes back to EXTENT_MAGIC
+   the first time it is changed.
+
+   DIR_ENTRY_CNT and DIR_FREE_SLOT belong to the directory layer,
+   through inode_get_dir_info() and inode_set_dir_info(). */
 struct inode_disk
   {
-    block_sector_t sectors[DIRECT_BLOCK];		/* MODIFIED Sectors pointing to direct or indirect data block. */
-    block_sector_t ib;
+    union
+      {
+        struct
+          {
+            block_sector_t sectors[DIRECT_BLOCK];		/* MODIFIED Sectors pointing to direct or indirect data block. */
+            block_sector_t ib;
+          };
+        struct
+          {
+            struct extent extents[INLINE_EXTENTS]; /* First extents. */
+            uint32_t extent_cnt;        /* Total number of extents. */
+            block_sector_t overflow;    /* First extent_block, or 0. */
+          };
+        uint8_t inline_data[INLINE_BYTES]; /* Data of small file. */
+      };
+    uint32_t dir_entry_cnt;             /* Directory: live entries. */
+    uint32_t dir_free_slot;             /* Directory: first free slot. */
     bool is_directory;			/* MODIFIED */
-    char padding[3];
+    uint8_t flags;                      /* Set by inode_set_flags(). */
+    bool to_extents;                    /* Inline: format to grow to. */
+    bool compress;                      /* Keep data compressed? */
+    off_t length;                       /* File size in bytes. */
+    unsigned magic;                     /* Magic number. */
+  };
+
+/* Direct sectors of a block-mapped inode kept in memory. */
+#define HEAD_DIRECT 12
+
+/* The part of an inode_disk that an open inode keeps in memory.
+
+   Its members from DIR_ENTRY_CNT on are laid out as at the end of
+   struct inode_disk, so that head_store() writes them back in one
+   piece.  Of the map, only a few hot entries are kept: the first
+   HEAD_DIRECT direct sectors and IB of an INODE_MAGIC inode, and
+   OVERFLOW of an extent-based one, whose extents are in the
+   inode's extent map besides.  The rest of a block map and the
+   bytes of an INLINE_MAGIC inode are read through the buffer
+   cache when needed.  Every change to the map is written to the
+   inode sector at once, so the cached sector always agrees with
+   the head, except that the head may run ahead of it until the
+   next head_store(). */
+struct inode_head
+  {
+    block_sector_t direct[HEAD_DIRECT]; /* First direct sectors. */
+    block_sector_t ib;                  /* Double indirect block. */
+    block_sector_t overflow;            /* First extent_block, or 0. */
+    uint32_t dir_entry_cnt;             /* Directory: live entries. */
+    uint32_t dir_free_slot;             /* Directory: first free slot. */
+    bool is_directory;                  /* Holds a directory? */
+    uint8_t flags;                      /* Set by inode_set_flags(). */
+    bool to_extents;                    /* Inline: format to grow to. */
+    bool compress;                      /* Keep data compressed? */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
   };
 
+/* Byte offset in struct inode_disk of the members that struct
+   inode_head shares with it, and their size. */
+#define HEAD_OFS offsetof (struct inode_disk, dir_entry_cnt)
+#define HEAD_SIZE (sizeof (struct inode_head) \
+                   - offsetof (struct inode_head, dir_entry_cnt))
+
 /*the struct of indirect_block which has 128 pointers pointing to second level ib */
 struct indirect_block
 {
   block_sector_t sectors[128];
 };
 
+/* Overflow extents of an EXTENT_MAGIC inode.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct extent_block
+  {
+    uint32_t extent_cnt;                /* Extents used in this block. */
+    block_sector_t next;                /* Next extent_block, or 0. */
+    struct extent extents[BLOCK_EXTENTS];
+  };
+
+/* An extent of an open inode, with the index of its first sector
+   within the file. */
+struct mapped_extent
+  {
+    block_sector_t index;               /* First file sector in run. */
+    block_sector_t start;               /* First disk sector in run. */
+    block_sector_t length;              /* Number of sectors. */
+  };
+
+/* Returns the number of extent_blocks that hold EXTENT_CNT
+   extents. */
+static inline size_t
+extent_blocks (size_t extent_cnt)
+{
+  return (extent_cnt > INLINE_EXTENTS
+          ? DIV_ROUND_UP (extent_cnt - INLINE_EXTENTS, BLOCK_EXTENTS) : 0);
+}
+
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
 static inline size_t
@@ -41,388 +277,3494 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* Number of second-level indirect blocks whose contents are kept
+   in memory per open inode. */
+#define IB_CACHE_SIZE 4
+
+/* Decoded indirect blocks of an open inode, so that byte_to_sector()
+   does not have to go through the buffer cache twice for every
+   sector past the direct blocks.  Allocated on the first indirect
+   lookup.  Must be invalidated whenever the inode's indirect
+   blocks change. */
+struct ib_cache
+  {
+    bool first_valid;                   /* first[] holds inode's ib? */
+    struct indirect_block first;        /* First level ib. */
+    unsigned clock;                     /* Last use stamp handed out. */
+    struct
+      {
+        bool valid;                     /* Holds a second level ib? */
+        block_sector_t index;           /* Entry number in first level. */
+        unsigned last_use;              /* For least-recently-used. */
+        struct indirect_block block;    /* Second level ib. */
+      }
+    second[IB_CACHE_SIZE];
+  };
+
+/* Read-ahead windows.  A run of reads that each start where the
+   last one ended is a sequential stream.  The window, the number
+   of sectors read ahead of the stream, starts at READAHEAD_MIN
+   and doubles with each further sequential read up to
+   READAHEAD_MAX; a read that continues no stream replaces the
+   least recently used one and reads nothing ahead.  Each inode
+   follows up to READAHEAD_STREAMS streams, so that several
+   processes reading one file each keep their own window.
+   inode_advise() can override the guess: ADVICE_SEQUENTIAL keeps
+   every window at READAHEAD_MAX and ADVICE_RANDOM turns
+   read-ahead off. */
+#define READAHEAD_MIN 2
+#define READAHEAD_MAX 32
+#define READAHEAD_STREAMS 4
+
+/* One sequential stream of reads of an inode. */
+struct readahead
+  {
+    off_t next;                         /* Where the next read starts. */
+    block_sector_t end;                 /* Read ahead up to this index. */
+    size_t window;                      /* Sectors to keep ahead. */
+    unsigned last_use;                  /* For least-recently-used. */
+  };
+
+/* In-memory inode.
+
+   Locking: ELEM and OPEN_CNT are protected by open_inodes_lock.
+   RWLOCK is held for reading by inode_read_at() and for writing
+   by anything that changes the inode, so that readers of one
+   file proceed in parallel with each other but not with a
+   writer.  Since readers fill in IB_CACHE and CLUSTER and update
+   RA, they have their own lock.
+   DIR_LOCK is not used by the inode layer at all; it serializes
+   the directory layer's updates of a directory's contents. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
-    struct inode_disk data;             /* Inode content. */
+    unsigned write_gen;                 /* Incremented by each write. */
+    struct rwlock rwlock;               /* Shared reads, exclusive writes. */
+    struct lock ib_lock;                /* Protects ib_cache, cluster, ra. */
+    struct lock dir_lock;               /* See inode_dir_lock(). */
+    struct dir_bloom *dir_bloom;        /* Directory's name filter, owned
+                                           by the directory layer. */
+    struct inode_head head;             /* Inode content kept in memory. */
+    struct ib_cache *ib_cache;          /* Decoded indirect blocks. */
+    struct mapped_extent *extents;      /* Extent map, if EXTENT_MAGIC. */
+    size_t extent_cnt;                  /* Number of extents. */
+    block_sector_t alloc_end;           /* Sectors may be allocated
+                                           below here past EOF. */
+    struct delayed *delayed;            /* Unallocated data, or null. */
+    size_t reserved;                    /* Free sectors set aside for
+                                           its next allocations. */
+    bool defrag_tried;                  /* Seen by the defragmenter? */
+    uint8_t *cluster;                   /* Decompressed cluster and
+                                           scratch page, or null. */
+    size_t cluster_idx;                 /* Cluster in CLUSTER. */
+    struct readahead ra[READAHEAD_STREAMS]; /* Sequential readers. */
+    unsigned ra_clock;                  /* Last use stamp handed out. */
+    int advice;                         /* ADVICE_NORMAL, _SEQUENTIAL
+                                           or _RANDOM. */
   };
 
-/* Returns the block device sector that contains byte offset POS
-   within INODE.
+/* Data sectors of an inode that have been written but not yet
+   allocated.  Protected by the inode's RWLOCK, except that ELEM
+   is protected by delayed_lock. */
+struct delayed
+  {
+    struct list_elem elem;              /* In delayed_inodes. */
+    struct inode *inode;                /* Owner. */
+    block_sector_t first;               /* Index of first data sector. */
+    size_t cnt;                         /* Number of data sectors. */
+    size_t reserved;                    /* Sectors reserved for them. */
+    bool held;                          /* Holds a reference to INODE? */
+    uint8_t *data;                      /* DELAY_MAX sectors. */
+  };
 
-   MODIFIED traverse
+/* Inodes with delayed data, and their lock.  Acquired after
+   open_inodes_lock. */
+static struct list delayed_inodes;
+static size_t delayed_cnt;
+static struct lock delayed_lock;
 
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
-static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
-{
-  ASSERT (inode != NULL);
-  block_sector_t index, first_ib_index, second_ib_index;
-  struct indirect_block *first_ib, *second_ib;
+/* Statistics for delayed allocation. */
+static unsigned long long delayed_sectors; /* Sectors flushed. */
+static unsigned long long delayed_runs;    /* Runs they were given. */
 
-  if (pos < inode->data.length)
-  {
-    index = pos / BLOCK_SECTOR_SIZE;
+static bool flush_delayed (struct inode *);
+static void free_delayed (struct inode *);
+static size_t contiguous_run (struct inode *, block_sector_t index,
+                              block_sector_t first, size_t max);
+
+struct release_batch;
+static bool is_metadata (const struct inode *);
+static size_t map_credits (const struct inode *, size_t cnt);
+static bool reserve_sectors (struct inode *, size_t cnt);
+static void unreserve_sectors (struct inode *, size_t keep);
+static bool allocate_sectors (struct inode *, size_t cnt,
+                              block_sector_t goal, block_sector_t *);
+static size_t allocate_run (struct inode *, size_t cnt, block_sector_t goal,
+                            block_sector_t *start);
+static size_t extent_find (struct inode *, block_sector_t index);
+static bool extent_load (struct inode *, const struct inode_disk *);
+static bool extent_store (struct inode *, size_t from);
+static block_sector_t extent_fill (struct inode *, block_sector_t index,
+                                   size_t cnt, size_t covered);
+static void extent_restore (struct inode *, size_t pos,
+                            const struct mapped_extent *, size_t old_cnt);
+static bool extent_cover (struct inode *, size_t sectors);
+static bool extent_punch (struct inode *, block_sector_t index, size_t cnt,
+                          struct release_batch *);
+static bool extent_trim (struct inode *);
+static void extent_release (const struct inode_disk *,
+                            struct release_batch *);
+static block_sector_t blockmap_fill (struct inode *, block_sector_t index,
+                                     size_t cnt, size_t covered);
+static void blockmap_trim (struct inode *);
+static bool blockmap_set (struct inode *, block_sector_t index,
+                          block_sector_t sector);
+static void blockmap_release (const struct inode_disk *,
+                              struct release_batch *);
+static off_t read_at (struct inode *, void *, off_t size, off_t offset,
+                      bool page);
+static off_t read_compressed (struct inode *, uint8_t *, off_t size,
+                              off_t offset);
+static bool compress_data (struct inode *);
+static bool expand (struct inode *);
+static off_t write_at (struct inode *, const void *, off_t size,
+                       off_t offset, bool page);
+static bool shrink (struct inode *, off_t length);
+static bool truncate_step (struct inode *, off_t length);
+static bool allocate_step (struct inode *, off_t offset, off_t size);
+static void readahead (struct inode *, off_t start, off_t end);
+static bool bounce_alloc (off_t size, uint8_t **bouncep, size_t *page_cntp);
+static size_t bounce_run (size_t run, size_t page_cnt);
+static void queue_readahead (struct inode *, block_sector_t from,
+                             block_sector_t to);
 
-    // direct block
-    if (index < DIRECT_BLOCK)
+/* Fills in head H from on-disk inode D. */
+static void
+head_load (struct inode_head *h, const struct inode_disk *d)
+{
+  memcpy (&h->dir_entry_cnt, &d->dir_entry_cnt, HEAD_SIZE);
+  memset (h->direct, 0, sizeof h->direct);
+  h->ib = HOLE_SECTOR;
+  h->overflow = 0;
+  if (d->magic == INODE_MAGIC)
     {
-      return inode->data.sectors[index];
+      memcpy (h->direct, d->sectors, sizeof h->direct);
+      h->ib = d->ib;
     }
-    else
-    {
-      // number of entry in first level ib
-      first_ib_index = (index - DIRECT_BLOCK) / 128;
-      second_ib_index = (index - DIRECT_BLOCK) % 128;
-
-      // read first level ib
-      block_read (fs_device, inode->data.ib, first_ib);
-
-      // read second level ib
-      block_read (fs_device, first_ib->sectors[first_ib_index], second_ib);
+  else if (d->magic == EXTENT_MAGIC || d->magic == COMPRESSED_MAGIC)
+    h->overflow = d->overflow;
+}
 
-      return second_ib->sectors[second_ib_index];
-    }
-  }
-  else
-    return -1;
+/* Reads INODE's whole on-disk inode into D through the buffer
+   cache, with the members it shares with INODE's head as the
+   head has them. */
+static void
+disk_read (const struct inode *inode, struct inode_disk *d)
+{
+  cache_read_meta (inode->sector, d, 0, BLOCK_SECTOR_SIZE);
+  memcpy (&d->dir_entry_cnt, &inode->head.dir_entry_cnt, HEAD_SIZE);
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Writes the members of INODE's head that it shares with its
+   on-disk inode back to the inode sector. */
+static void
+head_store (struct inode *inode)
+{
+  journal_write (inode->sector, &inode->head.dir_entry_cnt, HEAD_OFS,
+                 HEAD_SIZE);
+}
 
-/* Initializes the inode module. */
-void
-inode_init (void) 
+/* Zeros the map of INODE, on disk and in its head, as a change of
+   format requires. */
+static void
+map_clear (struct inode *inode)
 {
-  list_init (&open_inodes);
+  static const uint8_t zeros[BLOCK_SECTOR_SIZE];
+
+  journal_write (inode->sector, zeros, 0, HEAD_OFS);
+  memset (inode->head.direct, 0, sizeof inode->head.direct);
+  inode->head.ib = HOLE_SECTOR;
+  inode->head.overflow = 0;
 }
 
-/* Initializes an inode with LENGTH bytes of data and
-   writes the new inode to sector SECTOR on the file system
-   device.
-   Returns true if successful.
-   Returns false if memory or disk allocation fails. */
-bool
-inode_create (block_sector_t sector, off_t length)
+/* Puts back the map of INODE from D, a copy of its on-disk inode
+   read before map_clear(), after a change of format that could not
+   be completed. */
+static void
+map_restore (struct inode *inode, const struct inode_disk *d)
 {
-  struct inode_disk *disk_inode = NULL;
-  block_sector_t total_sectors;
-  bool success = false;
-  
-  ASSERT (length >= 0);
+  journal_write (inode->sector, d, 0, HEAD_OFS);
+  head_load (&inode->head, d);
+  head_store (inode);
+}
 
-  /* If this assertion fails, the inode structure is not exactly
-     one sector in size, and you should fix that. */
-  ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
+/* Forgets INODE's decoded indirect blocks. */
+static void
+ib_cache_invalidate (struct inode *inode)
+{
+  size_t i;
 
-  disk_inode = calloc (1, sizeof *disk_inode);
-  if (disk_inode != NULL)
+  lock_acquire (&inode->ib_lock);
+  if (inode->ib_cache != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
-      total_sectors = compute_total_sectors (sectors);
-      if (total_sectors > MAX_BLOCK_NUMBER)
-      {
-        // file too large, counting indirect blocks
-        return false;
-      }
+      inode->ib_cache->first_valid = false;
+      for (i = 0; i < IB_CACHE_SIZE; i++)
+        inode->ib_cache->second[i].valid = false;
+    }
+  lock_release (&inode->ib_lock);
+}
 
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
+/* Returns the sector entry SECOND_IB_INDEX of the second level ib
+   at entry FIRST_IB_INDEX of INODE's first level ib, using and
+   filling INODE's ib_cache.  Returns false if the ib_cache cannot
+   be allocated. */
+static bool
+ib_cache_lookup (struct inode *inode, block_sector_t first_ib_index,
+                 block_sector_t second_ib_index, block_sector_t *sector)
+{
+  struct ib_cache *c = inode->ib_cache;
+  size_t i, victim;
 
-      /* create direct / indirect data blocks */
-      if (free_map_unused () >= total_sectors + 1) 
-        {
-	  write_sectors_to_disk (total_sectors, disk_inode);
+  if (c == NULL)
+    {
+      c = inode->ib_cache = malloc (sizeof *c);
+      if (c == NULL)
+        return false;
+      c->first_valid = false;
+      c->clock = 0;
+      for (i = 0; i < IB_CACHE_SIZE; i++)
+        c->second[i].valid = false;
+    }
 
-          block_write (fs_device, sector, disk_inode);
-          
-          success = true; 
-        } 
-      free (disk_inode);
+  if (inode->head.ib == HOLE_SECTOR)
+    {
+      *sector = HOLE_SECTOR;
+      return true;
+    }
+  if (!c->first_valid)
+    {
+      cache_read_meta (inode->head.ib, &c->first, 0, BLOCK_SECTOR_SIZE);
+      c->first_valid = true;
+    }
+  if (c->first.sectors[first_ib_index] == HOLE_SECTOR)
+    {
+      *sector = HOLE_SECTOR;
+      return true;
     }
 
-  printf ("inode_create: length is %d\n", length);
+  // find the second level ib, or the least recently used slot
+  victim = 0;
+  for (i = 0; i < IB_CACHE_SIZE; i++)
+    {
+      if (c->second[i].valid && c->second[i].index == first_ib_index)
+        break;
+      if (!c->second[i].valid
+          || (c->second[victim].valid
+              && c->second[i].last_use < c->second[victim].last_use))
+        victim = i;
+    }
+  if (i == IB_CACHE_SIZE)
+    {
+      i = victim;
+      cache_read_meta (c->first.sectors[first_ib_index],
+                       &c->second[i].block, 0, BLOCK_SECTOR_SIZE);
+      c->second[i].index = first_ib_index;
+      c->second[i].valid = true;
+    }
 
-  return success;
+  c->second[i].last_use = ++c->clock;
+  *sector = c->second[i].block.sectors[second_ib_index];
+  return true;
 }
 
-/* Reads an inode from SECTOR
-   and returns a `struct inode' that contains it.
-   Returns a null pointer if memory allocation fails. */
-struct inode *
-inode_open (block_sector_t sector)
+/* Returns the block device sector that holds sector INDEX of
+   INODE's data, which must not be inline, or HOLE_SECTOR if that
+   sector has not been written.  INDEX may lie past the end of
+   file, but within the sectors that INODE's map covers. */
+static block_sector_t
+index_to_sector (struct inode *inode, block_sector_t index)
 {
-  struct list_elem *e;
-  struct inode *inode;
+  block_sector_t first_ib_index, second_ib_index;
+  block_sector_t second_ib, sector;
+  bool found;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  ASSERT (inode->head.magic != INLINE_MAGIC);
+
+  if (inode->head.magic == EXTENT_MAGIC)
+  {
+    /* Binary search for the extent holding the sector. */
+    size_t lo = 0, hi = inode->extent_cnt;
+
+    while (hi - lo > 1)
+      {
+        size_t mid = lo + (hi - lo) / 2;
+        if (inode->extents[mid].index <= index)
+          lo = mid;
+        else
+          hi = mid;
+      }
+    ASSERT (lo < inode->extent_cnt);
+    ASSERT (index < inode->extents[lo].index + inode->extents[lo].length);
+    if (inode->extents[lo].start == HOLE_SECTOR)
+      return HOLE_SECTOR;
+    return inode->extents[lo].start + (index - inode->extents[lo].index);
+  }
+
+  ASSERT (index < BLOCKMAP_SECTORS);
+
+  // direct block, in the head or else in the inode sector
+  if (index < HEAD_DIRECT)
+    return inode->head.direct[index];
+  if (index < DIRECT_BLOCK)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      cache_read_meta (inode->sector, &sector,
+                       offsetof (struct inode_disk, sectors)
+                       + index * sizeof sector, sizeof sector);
+      return sector;
     }
 
-  /* Allocate memory. */
-  inode = malloc (sizeof *inode);
-  if (inode == NULL)
-    return NULL;
+  // number of entry in first level ib
+  first_ib_index = (index - DIRECT_BLOCK) / 128;
+  second_ib_index = (index - DIRECT_BLOCK) % 128;
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
-  inode->sector = sector;
-  inode->open_cnt = 1;
-  inode->deny_write_cnt = 0;
-  inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  lock_acquire (&inode->ib_lock);
+  found = ib_cache_lookup (inode, first_ib_index, second_ib_index, &sector);
+  lock_release (&inode->ib_lock);
+  if (found)
+    return sector;
 
-  printf ("inode_open: length is %d\n", inode->data.length);
-  
-  return inode;
+  // look up the second level ib in the first level ib
+  if (inode->head.ib == HOLE_SECTOR)
+    return HOLE_SECTOR;
+  cache_read_meta (inode->head.ib, &second_ib,
+                   first_ib_index * sizeof second_ib, sizeof second_ib);
+  if (second_ib == HOLE_SECTOR)
+    return HOLE_SECTOR;
+
+  // look up the data sector in the second level ib
+  cache_read_meta (second_ib, &sector,
+                   second_ib_index * sizeof sector, sizeof sector);
+  return sector;
 }
 
-/* Reopens and returns INODE. */
-struct inode *
-inode_reopen (struct inode *inode)
+/* Returns the block device sector that contains byte offset POS
+   within INODE.
+
+   MODIFIED traverse
+
+   Returns HOLE_SECTOR if that byte lies in a hole not yet written.
+   Returns -1 if INODE does not contain data for a byte at offset
+   POS, or keeps its data inline. */
+static block_sector_t
+byte_to_sector (struct inode *inode, off_t pos) 
 {
-  if (inode != NULL)
-    inode->open_cnt++;
-  return inode;
+  ASSERT (inode != NULL);
+
+  if (inode->head.magic == INLINE_MAGIC || pos >= inode->head.length)
+    return -1;
+  return index_to_sector (inode, pos / BLOCK_SECTOR_SIZE);
 }
 
-/* Returns INODE's inode number. */
-block_sector_t
-inode_get_inumber (const struct inode *inode)
+/* Open inodes, indexed by sector, so that opening a single inode
+   twice returns the same `struct inode', and their lock. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+
+/* Cache of struct inode. */
+static struct slab_cache inode_cache;
+
+/* Statistics for inode_open(). */
+static unsigned long long lookup_cnt;   /* Calls to inode_open(). */
+static unsigned long long found_cnt;    /* Calls finding inode open. */
+
+/* Sector runs waiting to be released together. */
+struct release_batch
+  {
+    struct free_run runs[RELEASE_BATCH];
+    size_t cnt;
+  };
+
+/* A removed inode whose sectors have yet to be released. */
+struct deferred_release
+  {
+    struct list_elem elem;              /* In release_queue. */
+    block_sector_t sector;              /* Inode sector. */
+    struct inode_disk data;             /* Its last contents. */
+  };
+
+/* Removed inodes queued for release_run(), the number queued or
+   being released, and the lock that protects them. */
+static struct list release_queue;
+static size_t release_pending;
+static struct lock release_lock;
+static struct condition releases_done;  /* Signaled when pending is 0. */
+static struct work release_work;
+static unsigned long long deferred_cnt; /* Inodes released in background. */
+
+/* Inodes waiting for defrag_run(), each holding the reference its
+   last opener gave up.  Protected by release_lock, and counted in
+   defrag_pending until they are done. */
+static struct inode *defrag_queue[DEFRAG_QUEUE];
+static size_t defrag_queued;
+static size_t defrag_pending;
+static struct work defrag_work;
+static unsigned long long defrag_cnt;   /* Files defragmented. */
+static unsigned long long defrag_runs;  /* Runs they were in. */
+
+/* Statistics for clones. */
+static unsigned long long clone_cnt;    /* Files cloned. */
+static unsigned long long cow_copied;   /* Shared sectors copied. */
+static unsigned long long cow_dropped;  /* Shared sectors overwritten. */
+
+/* Statistics for compression. */
+static unsigned long long compressed_cnt; /* Clusters compressed. */
+static unsigned long long compressed_sectors; /* Sectors they took. */
+static unsigned long long decompressed_cnt; /* Clusters decompressed. */
+static unsigned long long expanded_cnt; /* Files decompressed. */
+
+/* Block-mapped files converted to extents to grow past the block
+   map's reach. */
+static unsigned long long converted_cnt;
+
+/* Statistics for inode_sync(). */
+static unsigned long long sync_cnt;     /* Inodes synced. */
+static unsigned long long sync_skipped; /* Of them, needing no commit. */
+
+static void release_inode (block_sector_t, const struct inode_disk *);
+static work_func release_run;
+static work_func defrag_run;
+
+/* Returns a hash value for the inode containing E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
 {
-  return inode->sector;
+  const struct inode *inode = hash_entry (e, struct inode, elem);
+  return hash_int (inode->sector);
 }
 
-/* Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
-void
-inode_close (struct inode *inode) 
+/* Returns true if inode A's sector precedes inode B's. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
 {
-  block_sector_t index, ib, i, k, r;
-  struct indirect_block *first_ib, *second_ib;
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
 
-  /* Ignore null pointer. */
-  if (inode == NULL)
-    return;
+/* Returns the number of open inodes holding decoded indirect
+   blocks or a decompressed cluster, which shrink_scan() can
+   free. */
+static size_t
+shrink_count (void)
+{
+  struct hash_iterator i;
+  size_t cnt = 0;
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  if (lock_held_by_current_thread (&open_inodes_lock)
+      || !lock_try_acquire (&open_inodes_lock))
+    return 0;
+  hash_first (&i, &open_inodes);
+  while (hash_next (&i))
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
-      if (inode->removed) 
-        {
-	    index = inode->data.length / BLOCK_SECTOR_SIZE;
-
-	    // direct block
-	    for (i = 0; i < DIRECT_BLOCK && i < index; i++)
-	    {
-	      free_map_release(inode->data.sectors[i], 1);
-	    }
-	    if ( i < index )
-	    {
-	      // number of entry in first level ib
-	      ib = inode->data.ib;
-	      block_read (fs_device, ib, first_ib);
-	      k = 0;
-              while( i < index )
-	      {
-	        block_read (fs_device, first_ib->sectors[k], second_ib);
-	        r = 0;
-		while( i < index && r < 128 )
-		{
-		  free_map_release(second_ib->sectors[r], 1);
-		  r++;
-		  i++;
-		}
-		free_map_release(first_ib->sectors[k], 1);
-		k++;
-	      }
-	    }
-	  // free inode
-          free_map_release (inode->sector, 1);
-        }
-
-      free (inode); 
+      struct inode *inode = hash_entry (hash_cur (&i), struct inode, elem);
+      if (inode->ib_cache != NULL || inode->cluster != NULL)
+        cnt++;
     }
+  lock_release (&open_inodes_lock);
+  return cnt;
 }
 
-/* Marks INODE to be deleted when it is closed by the last caller who
-   has it open. */
+/* Frees the decoded indirect blocks and decompressed clusters of
+   up to CNT open inodes, which are only copies of what is on disk
+   and are read again when needed.  Inodes whose locks are busy
+   are skipped.  Returns the number of inodes trimmed. */
+static size_t
+shrink_scan (size_t cnt)
+{
+  struct hash_iterator i;
+  size_t freed = 0;
+
+  if (lock_held_by_current_thread (&open_inodes_lock)
+      || !lock_try_acquire (&open_inodes_lock))
+    return 0;
+  hash_first (&i, &open_inodes);
+  while (freed < cnt && hash_next (&i))
+    {
+      struct inode *inode = hash_entry (hash_cur (&i), struct inode, elem);
+
+      if ((inode->ib_cache == NULL && inode->cluster == NULL)
+          || lock_held_by_current_thread (&inode->ib_lock)
+          || !lock_try_acquire (&inode->ib_lock))
+        continue;
+      free (inode->ib_cache);
+      inode->ib_cache = NULL;
+      if (inode->cluster != NULL)
+        palloc_free_multiple (inode->cluster, 2);
+      inode->cluster = NULL;
+      lock_release (&inode->ib_lock);
+      freed++;
+    }
+  lock_release (&open_inodes_lock);
+  return freed;
+}
+
+/* Frees cached copies of open inodes' index data when memory runs
+   short. */
+static struct shrinker shrinker =
+  {
+    .name = "inode index", .count = shrink_count, .scan = shrink_scan
+  };
+
+/* Initializes the inode module. */
 void
-inode_remove (struct inode *inode) 
+inode_init (void) 
 {
-  ASSERT (inode != NULL);
-  inode->removed = true;
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
+  lock_init (&open_inodes_lock);
+  lock_set_name (&open_inodes_lock, "open inodes");
+  /* The members that heads share with inode_disk must be laid
+     out alike. */
+  ASSERT (HEAD_OFS + HEAD_SIZE == BLOCK_SECTOR_SIZE);
+  ASSERT (offsetof (struct inode_head, magic)
+          - offsetof (struct inode_head, dir_entry_cnt)
+          == offsetof (struct inode_disk, magic) - HEAD_OFS);
+
+  slab_cache_init (&inode_cache, "inode", sizeof (struct inode), NULL);
+  list_init (&delayed_inodes);
+  lock_init (&delayed_lock);
+  list_init (&release_queue);
+  lock_init (&release_lock);
+  cond_init (&releases_done);
+  work_init (&release_work, release_run, NULL);
+  work_init (&defrag_work, defrag_run, NULL);
+  palloc_register_shrinker (&shrinker);
 }
 
-/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
-   Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
-off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
+/* Prints inode statistics. */
+void
+inode_print_stats (void)
 {
-  uint8_t *buffer = buffer_;
-  off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  printf ("Inodes: %llu opens, %llu already open, %llu deferred releases\n",
+          lookup_cnt, found_cnt, deferred_cnt);
+  printf ("Delayed allocation: %llu sectors in %llu runs\n",
+          delayed_sectors, delayed_runs);
+  printf ("Defragmentation: %llu files moved out of %llu runs\n",
+          defrag_cnt, defrag_runs);
+  printf ("Clones: %llu files, %llu shared sectors copied, "
+          "%llu overwritten\n", clone_cnt, cow_copied, cow_dropped);
+  printf ("Compression: %llu clusters into %llu sectors, "
+          "%llu clusters decompressed, %llu files expanded\n",
+          compressed_cnt, compressed_sectors, decompressed_cnt,
+          expanded_cnt);
+  printf ("Large files: %llu block-mapped files converted to extents\n",
+          converted_cnt);
+  printf ("Syncs: %llu files, %llu without a journal commit\n",
+          sync_cnt, sync_skipped);
+}
 
-  while (size > 0) 
-    {
-      /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
-      int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+/* Returns the delayed data for data sector INDEX of INODE, or a
+   null pointer if there is none.  The caller must hold INODE's
+   rwlock. */
+static uint8_t *
+delayed_sector (struct inode *inode, block_sector_t index)
+{
+  struct delayed *d = inode->delayed;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+  if (d == NULL || index < d->first || index >= d->first + d->cnt)
+    return NULL;
+  return d->data + (index - d->first) * BLOCK_SECTOR_SIZE;
+}
 
-      /* Number of bytes to actually copy out of this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
+/* Returns a buffer for hole INDEX of INODE in INODE's delayed
+   data, adding a zeroed sector for it if necessary, the buffer
+   is written out first if it cannot hold INDEX.  Returns a null
+   pointer if INDEX must be allocated right away instead.  The
+   caller must hold INODE's rwlock for writing and be in a
+   journal transaction. */
+static uint8_t *
+delay_sector (struct inode *inode, block_sector_t index)
+{
+  struct delayed *d = inode->delayed;
+  uint8_t *data = delayed_sector (inode, index);
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
+  if (data != NULL)
+    return data;
+  if (d != NULL && (index != d->first + d->cnt || d->cnt == DELAY_MAX))
+    {
+      if (!flush_delayed (inode))
+        return NULL;
+      d = NULL;
+    }
+
+  if (d == NULL)
+    {
+      lock_acquire (&delayed_lock);
+      if (delayed_cnt < DELAY_INODES)
+        d = malloc (sizeof *d);
+      if (d != NULL)
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
+          d->data = palloc_get_multiple (0, DELAY_PAGES);
+          if (d->data == NULL || !free_map_reserve (DELAY_META))
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
+              palloc_free_multiple (d->data, DELAY_PAGES);
+              free (d);
+              d = NULL;
             }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
         }
-      
-      /* Advance. */
-      size -= chunk_size;
-      offset += chunk_size;
-      bytes_read += chunk_size;
+      if (d != NULL)
+        {
+          d->inode = inode;
+          d->first = index;
+          d->cnt = 0;
+          d->reserved = DELAY_META;
+          d->held = false;
+          list_push_back (&delayed_inodes, &d->elem);
+          delayed_cnt++;
+          inode->delayed = d;
+        }
+      lock_release (&delayed_lock);
+      if (d == NULL)
+        return NULL;
     }
-  free (bounce);
 
-  return bytes_read;
+  if (!free_map_reserve (1))
+    return NULL;
+  d->reserved++;
+  data = d->data + d->cnt++ * BLOCK_SECTOR_SIZE;
+  memset (data, 0, BLOCK_SECTOR_SIZE);
+  return data;
+}
+
+/* Gives back INODE's delayed buffer and the sectors reserved for
+   it, discarding its data, and the reference to INODE that the
+   buffer holds, if any. */
+static void
+free_delayed (struct inode *inode)
+{
+  struct delayed *d = inode->delayed;
+
+  if (d->held)
+    {
+      /* Whoever got here has INODE open too. */
+      lock_acquire (&open_inodes_lock);
+      ASSERT (inode->open_cnt > 1);
+      inode->open_cnt--;
+      lock_release (&open_inodes_lock);
+    }
+  free_map_unreserve (d->reserved);
+  lock_acquire (&delayed_lock);
+  list_remove (&d->elem);
+  delayed_cnt--;
+  lock_release (&delayed_lock);
+  palloc_free_multiple (d->data, DELAY_PAGES);
+  free (d);
+  inode->delayed = NULL;
+}
+
+/* Allocates sectors for INODE's delayed data, in as few runs as
+   the free map allows, writes the data to them, and frees the
+   delayed buffer.  Returns false if the disk runs out of room
+   first, in which case the data not yet written stays in the
+   buffer, so that none is lost.  The caller must hold INODE's
+   rwlock for writing, or be its last opener, and be in a journal
+   transaction. */
+static bool
+flush_delayed (struct inode *inode)
+{
+  struct delayed *d = inode->delayed;
+  block_sector_t index = d->first;
+  size_t left = d->cnt;
+  size_t keep = inode->reserved;
+
+  /* Allocating below takes the sectors that were reserved. */
+  inode->reserved += d->reserved;
+  d->reserved = 0;
+  while (left > 0)
+    {
+      block_sector_t sector = (inode->head.magic == EXTENT_MAGIC
+                               ? extent_fill (inode, index, left, left)
+                               : blockmap_fill (inode, index, left, left));
+      size_t run;
+
+      if (sector == HOLE_SECTOR)
+        {
+          printf ("inode %"PRDSNu": no space for %zu delayed sectors\n",
+                  inode->sector, left);
+          break;
+        }
+      run = contiguous_run (inode, index, sector, left);
+      cache_write_direct (sector, run,
+                          d->data + (index - d->first) * BLOCK_SECTOR_SIZE);
+      delayed_sectors += run;
+      delayed_runs++;
+      index += run;
+      left -= run;
+    }
+
+  if (inode->reserved > keep)
+    {
+      d->reserved = inode->reserved - keep;
+      inode->reserved = keep;
+    }
+  if (left > 0)
+    {
+      /* Keep the rest for a later attempt. */
+      memmove (d->data, d->data + (index - d->first) * BLOCK_SECTOR_SIZE,
+               left * BLOCK_SECTOR_SIZE);
+      d->first = index;
+      d->cnt = left;
+      return false;
+    }
+  free_delayed (inode);
+  return true;
+}
+
+/* Writes out the delayed data of every inode that has any. */
+void
+inode_flush_delayed (void)
+{
+  for (;;)
+    {
+      struct inode *inode;
+      bool flushed;
+
+      lock_acquire (&open_inodes_lock);
+      lock_acquire (&delayed_lock);
+      if (list_empty (&delayed_inodes))
+        {
+          lock_release (&delayed_lock);
+          lock_release (&open_inodes_lock);
+          return;
+        }
+      inode = list_entry (list_front (&delayed_inodes),
+                          struct delayed, elem)->inode;
+      inode->open_cnt++;
+      lock_release (&delayed_lock);
+      lock_release (&open_inodes_lock);
+
+      journal_begin (map_credits (inode, DELAY_MAX));
+      rwlock_acquire_write (&inode->rwlock);
+      flushed = inode->delayed == NULL || flush_delayed (inode);
+      rwlock_release_write (&inode->rwlock);
+      journal_end ();
+      inode_close (inode);
+
+      /* The disk is full, so the rest would not go either. */
+      if (!flushed)
+        return;
+    }
+}
+
+/* Waits until the background jobs on inodes are done: every
+   inode queued for defragmentation has been defragmented, and the
+   sectors of every removed inode queued for release are back in
+   the free map. */
+void
+inode_flush_releases (void)
+{
+  lock_acquire (&release_lock);
+  while (defrag_pending > 0 || release_pending > 0)
+    cond_wait (&releases_done, &release_lock);
+  lock_release (&release_lock);
+}
+
+/* Adds the CNT sectors starting at SECTOR to BATCH, releasing
+   the batch first if it is full. */
+static void
+batch_append (struct release_batch *batch, block_sector_t sector,
+              size_t cnt)
+{
+  struct free_run *last = batch->cnt > 0 ? &batch->runs[batch->cnt - 1] : NULL;
+
+  if (last != NULL && last->start + last->cnt == sector)
+    last->cnt += cnt;
+  else
+    {
+      if (batch->cnt == RELEASE_BATCH)
+        {
+          free_map_release_many (batch->runs, batch->cnt);
+          batch->cnt = 0;
+        }
+      batch->runs[batch->cnt].start = sector;
+      batch->runs[batch->cnt].cnt = cnt;
+      batch->cnt++;
+    }
+}
+
+/* Lets go of the CNT sectors starting at SECTOR, adding to BATCH
+   those that no other file shares.  The rest only lose a
+   reference. */
+static void
+batch_add (struct release_batch *batch, block_sector_t sector, size_t cnt)
+{
+  size_t first = 0, i;
+
+  for (i = 0; i < cnt; i++)
+    if (refcount_drop (sector + i))
+      {
+        if (i > first)
+          batch_append (batch, sector + first, i - first);
+        first = i + 1;
+      }
+  if (cnt > first)
+    batch_append (batch, sector + first, cnt - first);
+}
+
+/* Releases the data, index sectors and inode SECTOR of removed
+   inode DATA. */
+static void
+release_inode (block_sector_t sector, const struct inode_disk *data)
+{
+  struct release_batch batch;
+
+  batch.cnt = 0;
+  if (data->magic == EXTENT_MAGIC || data->magic == COMPRESSED_MAGIC)
+    extent_release (data, &batch);
+  else if (data->magic == INODE_MAGIC)
+    blockmap_release (data, &batch);
+  batch_add (&batch, sector, 1);
+  free_map_release_many (batch.runs, batch.cnt);
+}
+
+/* Background job that releases the inodes in release_queue. */
+static void
+release_run (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct deferred_release *r;
+
+      lock_acquire (&release_lock);
+      if (list_empty (&release_queue))
+        {
+          lock_release (&release_lock);
+          return;
+        }
+      r = list_entry (list_pop_front (&release_queue),
+                      struct deferred_release, elem);
+      lock_release (&release_lock);
+
+      journal_begin (JOURNAL_CREDITS
+                     + DIV_ROUND_UP (bytes_to_sectors (r->data.length),
+                                     BLOCK_SECTOR_SIZE * 8));
+      release_inode (r->sector, &r->data);
+      journal_end ();
+      free (r);
+
+      lock_acquire (&release_lock);
+      deferred_cnt++;
+      if (--release_pending == 0)
+        cond_broadcast (&releases_done, &release_lock);
+      lock_release (&release_lock);
+    }
+}
+
+/* Background job that defragments or compresses the inodes in
+   defrag_queue and then drops the reference each was queued
+   with. */
+static void
+defrag_run (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct inode *inode;
+      size_t runs;
+
+      lock_acquire (&release_lock);
+      if (defrag_queued == 0)
+        {
+          lock_release (&release_lock);
+          return;
+        }
+      inode = defrag_queue[--defrag_queued];
+      lock_release (&release_lock);
+
+      if (inode->head.compress)
+        {
+          size_t sectors = bytes_to_sectors (inode->head.length);
+
+          journal_begin (map_credits (inode, sectors));
+          rwlock_acquire_write (&inode->rwlock);
+          inode->defrag_tried = true;
+          if (journal_extend (map_credits (inode, sectors)))
+            compress_data (inode);
+          rwlock_release_write (&inode->rwlock);
+          journal_end ();
+        }
+      else
+        inode_defrag (inode, DEFRAG_RUNS, &runs);
+      inode_close (inode);
+
+      lock_acquire (&release_lock);
+      if (--defrag_pending == 0 && release_pending == 0)
+        cond_broadcast (&releases_done, &release_lock);
+      lock_release (&release_lock);
+    }
+}
+
+/* Returns the number of runs of consecutive disk sectors that
+   hold INODE's first SECTORS data sectors, or 0 if any of them is
+   a hole or is shared with another file, which moving would
+   unshare. */
+static size_t
+count_runs (struct inode *inode, size_t sectors)
+{
+  block_sector_t index;
+  size_t runs = 0;
+
+  for (index = 0; index < sectors; )
+    {
+      block_sector_t sector = index_to_sector (inode, index);
+      size_t n, i;
+
+      if (sector == HOLE_SECTOR)
+        return 0;
+      n = contiguous_run (inode, index, sector, sectors - index);
+      for (i = 0; i < n; i++)
+        if (refcount_shared (sector + i))
+          return 0;
+      index += n;
+      runs++;
+    }
+  return runs;
+}
+
+/* Copies the SECTORS data sectors of INODE to the run of sectors
+   starting at START, a page at a time through BUFFER, and points
+   INODE's map at the copies.  Returns false if memory runs out
+   or the new map cannot be stored, before the map is switched
+   over. */
+static bool
+move_data (struct inode *inode, size_t sectors, block_sector_t start,
+           uint8_t *buffer)
+{
+  size_t per_page = PGSIZE / BLOCK_SECTOR_SIZE;
+  struct release_batch batch;
+  block_sector_t index;
+  size_t n;
+
+  /* Cached copies of the old sectors that are dirty are written
+     back before they are read, and those of the new sectors are
+     discarded as they are written. */
+  for (index = 0; index < sectors; index += n)
+    {
+      block_sector_t old = index_to_sector (inode, index);
+      n = contiguous_run (inode, index, old, (sectors - index < per_page
+                                              ? sectors - index : per_page));
+      cache_read_direct (old, n, buffer);
+      cache_write_direct (start + index, n, buffer);
+    }
+
+  batch.cnt = 0;
+  if (inode->head.magic == EXTENT_MAGIC)
+    {
+      struct mapped_extent *old = inode->extents;
+      size_t old_cnt = inode->extent_cnt, i;
+      struct mapped_extent *m = malloc (sizeof *m);
+
+      if (m == NULL)
+        return false;
+      m->index = 0;
+      m->start = start;
+      m->length = sectors;
+      inode->extents = m;
+      inode->extent_cnt = 1;
+      if (!extent_store (inode, 0))
+        {
+          inode->extents = old;
+          inode->extent_cnt = old_cnt;
+          free (m);
+          return false;
+        }
+      for (i = 0; i < old_cnt; i++)
+        if (old[i].start != HOLE_SECTOR)
+          batch_add (&batch, old[i].start, old[i].length);
+      free (old);
+    }
+  else
+    for (index = 0; index < sectors; index++)
+      {
+        block_sector_t old = index_to_sector (inode, index);
+        if (!blockmap_set (inode, index, start + index))
+          PANIC ("can't remap sector %"PRDSNu" of inode %"PRDSNu,
+                 index, inode->sector);
+        batch_add (&batch, old, 1);
+      }
+  free_map_release_many (batch.runs, batch.cnt);
+  return true;
+}
+
+/* If INODE is a regular file whose data lies in at least
+   MIN_RUNS separate runs of sectors, with no holes, moves it into
+   a single run of newly allocated sectors near the inode and
+   returns true.  Stores the number of runs the data was in into
+   *RUNS, or 0 if INODE is not a candidate.  Returns false if
+   INODE need not or cannot be moved, for instance because the
+   free map has no run long enough. */
+bool
+inode_defrag (struct inode *inode, size_t min_runs, size_t *runs)
+{
+  size_t sectors = 0;
+  block_sector_t start;
+  uint8_t *buffer = NULL;
+  bool moved = false;
+
+  *runs = 0;
+  journal_begin (map_credits (inode, bytes_to_sectors (inode->head.length)));
+  rwlock_acquire_write (&inode->rwlock);
+  inode->defrag_tried = true;
+  if (inode->delayed != NULL)
+    flush_delayed (inode);
+  if ((inode->head.magic == EXTENT_MAGIC || inode->head.magic == INODE_MAGIC)
+      && inode->delayed == NULL && !is_metadata (inode) && !inode->removed
+      && inode->deny_write_cnt == 0)
+    {
+      sectors = bytes_to_sectors (inode->head.length);
+      if (inode->head.magic != EXTENT_MAGIC || extent_trim (inode))
+        *runs = count_runs (inode, sectors);
+    }
+  if (*runs >= min_runs && *runs > 1
+      && journal_extend (map_credits (inode, sectors)))
+    buffer = palloc_get_page (0);
+  if (buffer != NULL
+      && allocate_sectors (inode, sectors, inode->sector, &start))
+    {
+      moved = move_data (inode, sectors, start, buffer);
+      if (moved)
+        {
+          inode->write_gen++;
+          defrag_cnt++;
+          defrag_runs += *runs;
+        }
+      else
+        free_map_release (start, sectors);
+    }
+  palloc_free_page (buffer);
+  rwlock_release_write (&inode->rwlock);
+  journal_end ();
+  return moved;
+}
+
+/* Creates in SECTOR a new regular file inode that is a copy of
+   INODE and shares its data sectors.  A sector stays shared until
+   one of the files writes to it or lets go of it.  Returns false
+   if INODE is not a regular file, if it is block-mapped, if the
+   file system keeps no reference counts, or if disk space runs
+   out or a sector is already shared too many times. */
+bool
+inode_clone (struct inode *inode, block_sector_t sector)
+{
+  struct inode_disk *d = malloc (sizeof *d);
+  bool success = false;
+  size_t i;
+
+  if (d == NULL)
+    return false;
+  journal_begin (map_credits (inode, 0));
+  rwlock_acquire_write (&inode->rwlock);
+  if (inode->delayed != NULL)
+    flush_delayed (inode);
+  if (inode->delayed != NULL || is_metadata (inode))
+    ;
+  else if (inode->head.magic == INLINE_MAGIC)
+    {
+      /* The data lives in the inode, so just copy it. */
+      disk_read (inode, d);
+      d->flags = 0;
+      journal_write (sector, d, 0, BLOCK_SECTOR_SIZE);
+      success = true;
+    }
+  else if ((inode->head.magic == EXTENT_MAGIC
+            || inode->head.magic == COMPRESSED_MAGIC)
+           && refcount_sector != 0)
+    {
+      struct mapped_extent *extents = NULL;
+      bool ready = (journal_extend (map_credits (inode, 0))
+                    && (inode->head.magic != EXTENT_MAGIC
+                        || extent_trim (inode)));
+
+      if (ready)
+        extents = malloc (inode->extent_cnt * sizeof *extents);
+      i = 0;
+      if (ready && (extents != NULL || inode->extent_cnt == 0))
+        {
+          for (; i < inode->extent_cnt; i++)
+            {
+              struct mapped_extent *m = &inode->extents[i];
+              if (m->start != HOLE_SECTOR
+                  && !refcount_share (m->start, m->length))
+                break;
+            }
+          success = i == inode->extent_cnt;
+        }
+      if (success)
+        {
+          struct inode *clone;
+
+          memset (d, 0, sizeof *d);
+          d->length = inode->head.length;
+          d->compress = inode->head.compress;
+          d->magic = inode->head.magic;
+          journal_write (sector, d, 0, BLOCK_SECTOR_SIZE);
+          clone = inode_open (sector);
+          if (clone == NULL)
+            PANIC ("can't open clone inode %"PRDSNu, sector);
+          memcpy (extents, inode->extents,
+                  inode->extent_cnt * sizeof *extents);
+          clone->extents = extents;
+          clone->extent_cnt = inode->extent_cnt;
+          if (!extent_store (clone, 0))
+            {
+              /* No room for its extent_blocks.  The caller lets go
+                 of the empty clone inode. */
+              clone->extent_cnt = 0;
+              success = false;
+            }
+          inode_close (clone);
+        }
+      else
+        free (extents);
+
+      /* Give back the references taken above, if the clone did
+         not come about. */
+      if (!success)
+        while (i-- > 0)
+          {
+            struct mapped_extent *m = &inode->extents[i];
+            block_sector_t s;
+            if (m->start != HOLE_SECTOR)
+              for (s = m->start; s < m->start + m->length; s++)
+                refcount_drop (s);
+          }
+    }
+  if (success)
+    clone_cnt++;
+  rwlock_release_write (&inode->rwlock);
+  journal_end ();
+  free (d);
+  return success;
+}
+
+/* Returns the number of bytes in cluster INDEX of a file LENGTH
+   bytes long. */
+static size_t
+cluster_bytes (off_t length, size_t index)
+{
+  off_t left = length - (off_t) index * CLUSTER_SIZE;
+  return left < CLUSTER_SIZE ? left : CLUSTER_SIZE;
+}
+
+/* Reads the BYTES bytes of the cluster that RUN holds into OUT,
+   using the page SCRATCH for compressed data.  Returns false if
+   the cluster does not decompress to BYTES bytes. */
+static bool
+load_run (const struct mapped_extent *run, size_t bytes, uint8_t *out,
+          uint8_t *scratch)
+{
+  size_t raw = DIV_ROUND_UP (bytes, BLOCK_SECTOR_SIZE);
+  size_t i;
+
+  if (run->start == HOLE_SECTOR)
+    {
+      memset (out, 0, bytes);
+      return true;
+    }
+  if (run->length > raw)
+    return false;
+
+  /* One read for the whole run, then copies out of the cache. */
+  cache_load (run->start, run->length);
+  if (run->length == raw)
+    {
+      for (i = 0; i < raw; i++)
+        cache_read (run->start + i, out + i * BLOCK_SECTOR_SIZE, 0,
+                    (i + 1 < raw ? BLOCK_SECTOR_SIZE
+                     : bytes - i * BLOCK_SECTOR_SIZE));
+      return true;
+    }
+  for (i = 0; i < run->length; i++)
+    cache_read (run->start + i, scratch + i * BLOCK_SECTOR_SIZE, 0,
+                BLOCK_SECTOR_SIZE);
+  decompressed_cnt++;
+  return lz_decompress (scratch, run->length * BLOCK_SECTOR_SIZE,
+                        out, bytes) == bytes;
+}
+
+/* Makes INODE->cluster hold cluster INDEX of compressed INODE,
+   whose ib_lock the caller must hold.  Returns false if memory
+   runs out or the cluster is damaged. */
+static bool
+load_cluster (struct inode *inode, size_t index)
+{
+  ASSERT (lock_held_by_current_thread (&inode->ib_lock));
+
+  if (inode->cluster == NULL)
+    {
+      inode->cluster = palloc_get_multiple (0, 2);
+      if (inode->cluster == NULL)
+        return false;
+    }
+  else if (inode->cluster_idx == index)
+    return true;
+
+  inode->cluster_idx = SIZE_MAX;
+  if (!load_run (&inode->extents[index],
+                 cluster_bytes (inode->head.length, index),
+                 inode->cluster, inode->cluster + CLUSTER_SIZE))
+    return false;
+  inode->cluster_idx = index;
+  return true;
+}
+
+/* Discards INODE's decompressed cluster. */
+static void
+drop_cluster (struct inode *inode)
+{
+  lock_acquire (&inode->ib_lock);
+  if (inode->cluster != NULL)
+    palloc_free_multiple (inode->cluster, 2);
+  inode->cluster = NULL;
+  lock_release (&inode->ib_lock);
+}
+
+/* Does the work of read_at() for compressed INODE.  Returns short
+   if a damaged cluster is met. */
+static off_t
+read_compressed (struct inode *inode, uint8_t *buffer, off_t size,
+                 off_t offset)
+{
+  off_t length = inode_length (inode);
+  off_t bytes_read = 0;
+
+  if (offset >= length)
+    return 0;
+  if (size > length - offset)
+    size = length - offset;
+
+  lock_acquire (&inode->ib_lock);
+  while (size > 0)
+    {
+      size_t index = offset / CLUSTER_SIZE;
+      int cluster_ofs = offset % CLUSTER_SIZE;
+      int cluster_left = CLUSTER_SIZE - cluster_ofs;
+      int chunk_size = size < cluster_left ? size : cluster_left;
+
+      if (!load_cluster (inode, index))
+        break;
+      memcpy (buffer + bytes_read, inode->cluster + cluster_ofs, chunk_size);
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_read += chunk_size;
+    }
+  lock_release (&inode->ib_lock);
+  return bytes_read;
+}
+
+/* Returns true if the SIZE bytes at P are all zero. */
+static bool
+is_zeros (const uint8_t *p, size_t size)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    if (p[i] != 0)
+      return false;
+  return true;
+}
+
+/* Compresses the data of extent-based or block-mapped INODE,
+   whose rwlock the caller must hold for writing, into newly
+   allocated sectors, one cluster at a time, and switches INODE to
+   COMPRESSED_MAGIC.  Returns false, changing nothing, if INODE
+   cannot be compressed, if the disk or memory runs out, or if
+   compressing would not save any sectors. */
+static bool
+compress_data (struct inode *inode)
+{
+  struct inode_head *d = &inode->head;
+  size_t cluster_cnt = DIV_ROUND_UP (d->length, CLUSTER_SIZE);
+  size_t old_sectors = 0, new_sectors = 0, i;
+  struct inode_disk *disk;
+  struct mapped_extent *map;
+  struct release_batch batch;
+  block_sector_t goal = inode->sector;
+  uint8_t *data, *out;
+  void *work;
+  bool success = true;
+
+  if ((d->magic != EXTENT_MAGIC && d->magic != INODE_MAGIC)
+      || is_metadata (inode) || inode->removed || cluster_cnt == 0)
+    return false;
+  if (inode->delayed != NULL && !flush_delayed (inode))
+    return false;
+  for (i = 0; i < bytes_to_sectors (d->length); i++)
+    if (index_to_sector (inode, i) != HOLE_SECTOR)
+      old_sectors++;
+
+  map = malloc (cluster_cnt * sizeof *map);
+  data = palloc_get_multiple (0, 2);
+  work = malloc (LZ_WORK_SIZE);
+  disk = malloc (sizeof *disk);
+  if (map == NULL || data == NULL || work == NULL || disk == NULL)
+    {
+      free (map);
+      palloc_free_multiple (data, 2);
+      free (work);
+      free (disk);
+      return false;
+    }
+  out = data + CLUSTER_SIZE;
+
+  for (i = 0; i < cluster_cnt && success; i++)
+    {
+      size_t bytes = cluster_bytes (d->length, i);
+      size_t raw = DIV_ROUND_UP (bytes, BLOCK_SECTOR_SIZE);
+      size_t size, cnt;
+      uint8_t *src = out;
+
+      map[i].index = i;
+      map[i].start = HOLE_SECTOR;
+      map[i].length = 0;
+      if (read_at (inode, data, bytes, (off_t) i * CLUSTER_SIZE, false)
+          != (off_t) bytes)
+        success = false;
+      else if (!is_zeros (data, bytes))
+        {
+          /* Keep the cluster as is unless that saves a sector. */
+          size = lz_compress (data, bytes, out,
+                              (raw - 1) * BLOCK_SECTOR_SIZE, work);
+          if (size == 0)
+            {
+              src = data;
+              size = bytes;
+            }
+          cnt = DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
+          memset (src + size, 0, cnt * BLOCK_SECTOR_SIZE - size);
+          if (!allocate_sectors (inode, cnt, goal, &map[i].start))
+            success = false;
+          else
+            {
+              cache_write_direct (map[i].start, cnt, src);
+              map[i].length = cnt;
+              goal = map[i].start + cnt;
+              new_sectors += cnt;
+            }
+        }
+    }
+  if (success && new_sectors >= old_sectors)
+    success = false;
+
+  if (success)
+    {
+      /* Switch to the new map, keeping an extent inode's chain of
+         extent_blocks for it. */
+      struct mapped_extent *old = inode->extents;
+      size_t old_cnt = inode->extent_cnt;
+      unsigned old_magic = d->magic;
+
+      if (old_magic == INODE_MAGIC)
+        {
+          disk_read (inode, disk);
+          map_clear (inode);
+        }
+      d->magic = COMPRESSED_MAGIC;
+      inode->extents = map;
+      inode->extent_cnt = cluster_cnt;
+      success = extent_store (inode, 0);
+      if (!success)
+        {
+          /* No room for the extent_blocks: put the old map back. */
+          inode->extents = old;
+          inode->extent_cnt = old_cnt;
+          d->magic = old_magic;
+          if (old_magic == INODE_MAGIC)
+            map_restore (inode, disk);
+        }
+      else
+        {
+          /* Let go of the old data and index sectors. */
+          batch.cnt = 0;
+          if (old_magic == EXTENT_MAGIC)
+            {
+              for (i = 0; i < old_cnt; i++)
+                if (old[i].start != HOLE_SECTOR)
+                  batch_add (&batch, old[i].start, old[i].length);
+              free (old);
+            }
+          else
+            {
+              blockmap_release (disk, &batch);
+              ib_cache_invalidate (inode);
+            }
+          free_map_release_many (batch.runs, batch.cnt);
+          compressed_cnt += cluster_cnt;
+          compressed_sectors += new_sectors;
+        }
+      i = cluster_cnt;
+    }
+  if (!success)
+    {
+      while (i-- > 0)
+        if (map[i].start != HOLE_SECTOR)
+          free_map_release (map[i].start, map[i].length);
+      free (map);
+    }
+  palloc_free_multiple (data, 2);
+  free (work);
+  free (disk);
+  return success;
+}
+
+/* Turns compressed INODE, whose rwlock the caller must hold for
+   writing, back into an extent-based inode with its data
+   decompressed, so that it can be changed.  Does nothing to other
+   inodes.  Returns false, changing nothing, if the disk or memory
+   runs out or a cluster is damaged. */
+static bool
+expand (struct inode *inode)
+{
+  struct inode_head *d = &inode->head;
+  struct mapped_extent *old = inode->extents;
+  size_t old_cnt = inode->extent_cnt, i;
+  size_t spare = extent_blocks (old_cnt);
+  struct release_batch batch;
+  uint8_t *page;
+  bool success = true;
+
+  if (d->magic != COMPRESSED_MAGIC)
+    return true;
+  if (free_map_unused () < bytes_to_sectors (d->length) + 1)
+    return false;
+
+  /* The old map's extent_blocks go back to the free map below.
+     Set aside as many sectors, so that the map can be put back
+     whatever the writes take. */
+  if (!free_map_reserve (spare))
+    return false;
+  page = palloc_get_multiple (0, 2);
+  if (page == NULL)
+    {
+      free_map_unreserve (spare);
+      return false;
+    }
+  drop_cluster (inode);
+
+  d->magic = EXTENT_MAGIC;
+  inode->extents = NULL;
+  inode->extent_cnt = 0;
+  success = extent_cover (inode, bytes_to_sectors (d->length));
+  for (i = 0; i < old_cnt && success; i++)
+    {
+      size_t bytes = cluster_bytes (d->length, i);
+
+      if (old[i].start == HOLE_SECTOR)
+        continue;
+      success = (load_run (&old[i], bytes, page, page + CLUSTER_SIZE)
+                 && write_at (inode, page, bytes, (off_t) i * CLUSTER_SIZE,
+                              false)
+                    == (off_t) bytes);
+    }
+  palloc_free_multiple (page, 2);
+
+  batch.cnt = 0;
+  if (success)
+    {
+      for (i = 0; i < old_cnt; i++)
+        if (old[i].start != HOLE_SECTOR)
+          batch_add (&batch, old[i].start, old[i].length);
+      free (old);
+      free_map_unreserve (spare);
+      inode->defrag_tried = false;
+      expanded_cnt++;
+    }
+  else
+    {
+      /* Let go of what was written and put the old map back,
+         storing it in the sectors set aside. */
+      off_t length = d->length;
+      size_t keep = inode->reserved;
+      bool restored;
+
+      if (inode->delayed != NULL)
+        free_delayed (inode);
+      d->length = 0;
+      extent_trim (inode);
+      d->length = length;
+      free (inode->extents);
+      inode->extents = old;
+      inode->extent_cnt = old_cnt;
+      d->magic = COMPRESSED_MAGIC;
+      inode->reserved += spare;
+      restored = extent_store (inode, 0);
+      ASSERT (restored);
+      unreserve_sectors (inode, keep);
+    }
+  free_map_release_many (batch.runs, batch.cnt);
+  return success;
+}
+
+/* Sets whether regular file INODE is kept compressed.  Turning
+   compression on compresses the file at once, unless doing so
+   saves no space; turning it off decompresses it.  Returns false
+   if INODE is not a regular file, or if decompressing it runs out
+   of disk space. */
+bool
+inode_set_compress (struct inode *inode, bool compress)
+{
+  bool success = true;
+
+  journal_begin (map_credits (inode, bytes_to_sectors (inode->head.length)));
+  rwlock_acquire_write (&inode->rwlock);
+  if (is_metadata (inode))
+    success = false;
+  else if (compress)
+    compress_data (inode);
+  else
+    success = expand (inode);
+  if (success && inode->head.compress != compress)
+    {
+      inode->head.compress = compress;
+      head_store (inode);
+    }
+  rwlock_release_write (&inode->rwlock);
+  journal_end ();
+  return success;
+}
+
+/* Applies access pattern ADVICE, one of the ADVICE_* values, to
+   the LEN bytes of INODE starting at OFS, or to everything from
+   OFS to the end of file if LEN is 0.  ADVICE_NORMAL,
+   ADVICE_SEQUENTIAL and ADVICE_RANDOM set how far the whole file
+   is read ahead.  ADVICE_WILLNEED starts loading the range into
+   the buffer cache, up to as much of it as the cache can keep,
+   and ADVICE_DONTNEED writes back and drops the range's cached
+   sectors.  Returns false if ADVICE is not valid. */
+bool
+inode_advise (struct inode *inode, off_t ofs, off_t len, int advice)
+{
+  block_sector_t from, to, index;
+
+  switch (advice)
+    {
+    case ADVICE_NORMAL:
+    case ADVICE_SEQUENTIAL:
+    case ADVICE_RANDOM:
+      lock_acquire (&inode->ib_lock);
+      inode->advice = advice;
+      lock_release (&inode->ib_lock);
+      return true;
+
+    case ADVICE_WILLNEED:
+    case ADVICE_DONTNEED:
+      break;
+
+    default:
+      return false;
+    }
+
+  rwlock_acquire_read (&inode->rwlock);
+  if (inode->head.magic == INLINE_MAGIC
+      || inode->head.magic == COMPRESSED_MAGIC
+      || ofs >= inode_length (inode))
+    {
+      rwlock_release_read (&inode->rwlock);
+      return true;
+    }
+  if (len == 0 || len > inode_length (inode) - ofs)
+    len = inode_length (inode) - ofs;
+  from = ofs / BLOCK_SECTOR_SIZE;
+  to = DIV_ROUND_UP (ofs + len, BLOCK_SECTOR_SIZE);
+
+  if (advice == ADVICE_WILLNEED)
+    {
+      /* Sectors past what the cache can hold at once would only
+         evict the first ones again. */
+      if (to - from > CACHE_SIZE / 2)
+        to = from + CACHE_SIZE / 2;
+      queue_readahead (inode, from, to);
+    }
+  else
+    for (index = from; index < to; )
+      {
+        block_sector_t sector = index_to_sector (inode, index);
+        size_t n = 1;
+
+        if (sector != HOLE_SECTOR)
+          {
+            n = contiguous_run (inode, index, sector, to - index);
+            cache_drop (sector, n);
+          }
+        index += n;
+      }
+  rwlock_release_read (&inode->rwlock);
+  return true;
+}
+
+/* Makes INODE's contents durable: allocates and writes its
+   delayed data, then writes back, in sector order, the dirty
+   cached sectors that INODE occupies, and then commits the
+   journal, so that its inode and index sectors are safe in the
+   log.  Dirty sectors of other files stay in the cache.  If
+   DATA_ONLY is true, the commit is skipped when none of INODE's
+   own metadata is waiting for one.  Without a journal the
+   metadata sectors are written back along with the data instead;
+   the free map is then rebuilt at mount after a crash anyway.
+   Returns false if memory runs out, or if the disk has no room
+   for the delayed data. */
+bool
+inode_sync (struct inode *inode, bool data_only)
+{
+  struct bitmap *sectors = bitmap_create (block_size (fs_device));
+  bool is_dir, meta, flushed;
+
+  if (sectors == NULL)
+    return false;
+
+  journal_begin (map_credits (inode, DELAY_MAX));
+  rwlock_acquire_write (&inode->rwlock);
+  flushed = inode->delayed == NULL || flush_delayed (inode);
+  inode_collect (inode->sector, sectors, &is_dir);
+  rwlock_release_write (&inode->rwlock);
+  journal_end ();
+
+  meta = cache_sync (sectors);
+  bitmap_destroy (sectors);
+  sync_cnt++;
+  if (journal_enabled () && (meta || !data_only))
+    journal_commit ();
+  else
+    sync_skipped++;
+  return flushed;
+}
+
+/* Initializes an inode with LENGTH bytes of data and
+   writes the new inode to sector SECTOR on the file system
+   device.  IS_DIR records whether the inode holds a directory.
+   No data sectors are allocated: the file starts out as a hole
+   that later writes fill in.
+   Returns true if successful.
+   Returns false if memory allocation fails. */
+bool
+inode_create (block_sector_t sector, off_t length, bool is_dir)
+{
+  struct inode_disk *disk_inode = NULL;
+  size_t sectors = bytes_to_sectors (length);
+  
+  ASSERT (length >= 0);
+
+  /* If this assertion fails, the inode structure is not exactly
+     one sector in size, and you should fix that. */
+  ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
+
+  disk_inode = calloc (1, sizeof *disk_inode);
+  if (disk_inode == NULL)
+    return false;
+
+  disk_inode->length = length;
+  disk_inode->is_directory = is_dir;
+  if (length <= INLINE_BYTES)
+    {
+      /* Small enough to live in the inode sector, zeroed by
+         calloc(). */
+      disk_inode->magic = INLINE_MAGIC;
+      disk_inode->to_extents = inode_extents;
+    }
+  else if (inode_extents
+           || compute_total_sectors (sectors) > MAX_BLOCK_NUMBER)
+    {
+      /* A single extent covering the whole file, all hole.  A
+         file too large for the block map gets extents even when
+         block maps are the default. */
+      disk_inode->magic = EXTENT_MAGIC;
+      disk_inode->extents[0].start = HOLE_SECTOR;
+      disk_inode->extents[0].length = sectors;
+      disk_inode->extent_cnt = 1;
+    }
+  else
+    disk_inode->magic = INODE_MAGIC;
+
+  journal_write (sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
+  free (disk_inode);
+  return true;
+}
+
+/* Reads an inode from SECTOR
+   and returns a `struct inode' that contains it.
+   Returns a null pointer if memory allocation fails. */
+struct inode *
+inode_open (block_sector_t sector)
+{
+  struct inode key;
+  struct hash_elem *e;
+  struct inode *inode;
+  struct inode_disk *disk;
+
+  /* Check whether this inode is already open. */
+  lock_acquire (&open_inodes_lock);
+  lookup_cnt++;
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
+    {
+      found_cnt++;
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      return inode; 
+    }
+
+  /* Allocate memory, and a buffer to read the inode sector into. */
+  inode = slab_alloc (&inode_cache);
+  disk = malloc (sizeof *disk);
+  if (inode == NULL || disk == NULL)
+    {
+      if (inode != NULL)
+        slab_free (&inode_cache, inode);
+      free (disk);
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
+
+  /* Initialize.  The inode is read with open_inodes_lock still
+     held, so that no one else can find it half made. */
+  inode->sector = sector;
+  hash_insert (&open_inodes, &inode->elem);
+  inode->open_cnt = 1;
+  inode->deny_write_cnt = 0;
+  inode->write_gen = 0;
+  inode->removed = false;
+  rwlock_init (&inode->rwlock);
+  lock_init (&inode->ib_lock);
+  lock_init (&inode->dir_lock);
+  inode->dir_bloom = NULL;
+  inode->ib_cache = NULL;
+  inode->extents = NULL;
+  inode->extent_cnt = 0;
+  inode->alloc_end = 0;
+  inode->delayed = NULL;
+  inode->reserved = 0;
+  inode->defrag_tried = false;
+  inode->cluster = NULL;
+  memset (inode->ra, 0, sizeof inode->ra);
+  inode->ra_clock = 0;
+  inode->advice = ADVICE_NORMAL;
+  cache_read_meta (inode->sector, disk, 0, BLOCK_SECTOR_SIZE);
+  head_load (&inode->head, disk);
+  if ((disk->magic == EXTENT_MAGIC || disk->magic == COMPRESSED_MAGIC)
+      && !extent_load (inode, disk))
+    {
+      hash_delete (&open_inodes, &inode->elem);
+      slab_free (&inode_cache, inode);
+      inode = NULL;
+    }
+  lock_release (&open_inodes_lock);
+  free (disk);
+
+  return inode;
+}
+
+/* Reopens and returns INODE. */
+struct inode *
+inode_reopen (struct inode *inode)
+{
+  if (inode != NULL)
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
+  return inode;
+}
+
+/* Returns INODE's inode number. */
+block_sector_t
+inode_get_inumber (const struct inode *inode)
+{
+  return inode->sector;
+}
+
+/* Closes INODE and writes it to disk.
+   If this was the last reference to INODE, frees its memory and
+   any sectors allocated past its end of file.
+   If INODE was also a removed inode, frees its blocks.  This is
+   done with open_inodes_lock held, so that reopening the same
+   sector waits until INODE is gone.  The blocks of a large inode
+   are instead freed by a background job, which owns the inode
+   sector until it is done, so the sector cannot be reused
+   before then. */
+void
+inode_close (struct inode *inode) 
+{
+  /* Ignore null pointer. */
+  if (inode == NULL)
+    return;
+
+  /* Release resources if this was the last opener: flush delayed
+     data, trim what was allocated past the end of file, or release
+     a removed file shorter than DEFER_MIN sectors. */
+  journal_begin (map_credits (inode, DEFER_MIN));
+  lock_acquire (&open_inodes_lock);
+  if (inode->open_cnt == 1 && !inode->removed && !inode->defrag_tried
+      && !is_metadata (inode)
+      && (inode->head.compress
+          ? (inode->head.magic == EXTENT_MAGIC
+             || inode->head.magic == INODE_MAGIC)
+          : (inode->head.magic == EXTENT_MAGIC
+             && inode->extent_cnt >= DEFRAG_RUNS)))
+    {
+      /* Hand our reference to the defragmenter, if it has room. */
+      lock_acquire (&release_lock);
+      if (defrag_queued < DEFRAG_QUEUE)
+        {
+          inode->defrag_tried = true;
+          defrag_queue[defrag_queued++] = inode;
+          defrag_pending++;
+          work_queue (&defrag_work, WORK_LOW);
+        }
+      lock_release (&release_lock);
+      if (inode->defrag_tried)
+        {
+          lock_release (&open_inodes_lock);
+          journal_end ();
+          return;
+        }
+    }
+  if (inode->open_cnt == 1 && inode->delayed != NULL && !inode->removed
+      && !flush_delayed (inode))
+    {
+      /* The disk is full.  Hand our reference to the delayed data,
+         whose writer was told it was written, until
+         inode_flush_delayed() gets it out. */
+      inode->delayed->held = true;
+      lock_release (&open_inodes_lock);
+      journal_end ();
+      return;
+    }
+  if (--inode->open_cnt == 0)
+    {
+      /* Remove from inode list and release lock. */
+      hash_delete (&open_inodes, &inode->elem);
+ 
+      /* Discard delayed data that is no longer wanted. */
+      if (inode->delayed != NULL)
+        free_delayed (inode);
+
+      /* Give back sectors allocated ahead of the end of file. */
+      if (!inode->removed && inode->head.magic == EXTENT_MAGIC)
+        extent_trim (inode);
+      else if (!inode->removed && inode->head.magic == INODE_MAGIC)
+        blockmap_trim (inode);
+
+      /* Deallocate blocks if removed. */
+      if (inode->removed)
+        {
+          struct deferred_release *r = NULL;
+
+          if (inode->head.magic != INLINE_MAGIC
+              && bytes_to_sectors (inode->head.length) >= DEFER_MIN)
+            r = malloc (sizeof *r);
+          if (r != NULL)
+            {
+              r->sector = inode->sector;
+              disk_read (inode, &r->data);
+              lock_acquire (&release_lock);
+              list_push_back (&release_queue, &r->elem);
+              release_pending++;
+              lock_release (&release_lock);
+              work_queue (&release_work, WORK_NORMAL);
+            }
+          else
+            {
+              struct inode_disk d;
+
+              disk_read (inode, &d);
+              release_inode (inode->sector, &d);
+            }
+        }
+
+      free (inode->ib_cache);
+      free (inode->extents);
+      free (inode->dir_bloom);
+      if (inode->cluster != NULL)
+        palloc_free_multiple (inode->cluster, 2);
+      slab_free (&inode_cache, inode); 
+    }
+  lock_release (&open_inodes_lock);
+  journal_end ();
+}
+
+/* Marks INODE to be deleted when it is closed by the last caller who
+   has it open. */
+void
+inode_remove (struct inode *inode) 
+{
+  ASSERT (inode != NULL);
+  rwlock_acquire_write (&inode->rwlock);
+  inode->removed = true;
+  ib_cache_invalidate (inode);
+  rwlock_release_write (&inode->rwlock);
+}
+
+/* Returns true if INODE's contents are metadata: directory
+   entries, the free map or the reference count table. */
+static bool
+is_metadata (const struct inode *inode)
+{
+  return (inode->head.is_directory || inode->sector == FREE_MAP_SECTOR
+          || (refcount_sector != 0 && inode->sector == refcount_sector));
+}
+
+/* Returns the journal credits for an operation on INODE that
+   allocates, releases or moves up to CNT of its data sectors:
+   JOURNAL_CREDITS, plus the free map sectors that record CNT
+   sectors, plus the indirect blocks that map them or else the
+   whole chain of extent_blocks, which extent_store() may rewrite.
+   Without INODE's lock held, the result is only an estimate. */
+static size_t
+map_credits (const struct inode *inode, size_t cnt)
+{
+  size_t credits = JOURNAL_CREDITS + DIV_ROUND_UP (cnt, BLOCK_SECTOR_SIZE * 8);
+
+  if (inode->head.magic == INODE_MAGIC)
+    credits += DIV_ROUND_UP (cnt, 128) + 1;
+  else if (inode->head.magic != INLINE_MAGIC)
+    credits += extent_blocks (inode->extent_cnt + 2);
+  return credits;
+}
+
+/* Returns the number of sectors, at most MAX, that starting at
+   data sector INDEX of INODE, held at disk sector FIRST, follow
+   one another on disk without holes. */
+static size_t
+contiguous_run (struct inode *inode, block_sector_t index,
+                block_sector_t first, size_t max)
+{
+  size_t cnt = 1;
+
+  while (cnt < max && index_to_sector (inode, index + cnt) == first + cnt)
+    cnt++;
+  return cnt;
+}
+
+/* Loads the sectors that hold the SIZE bytes of INODE starting
+   at OFFSET into the buffer cache, reading each run of
+   consecutive disk sectors with one multi-sector read. */
+static void
+load_range (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = inode_length (inode);
+  block_sector_t index, last, start = HOLE_SECTOR;
+  size_t cnt = 0;
+
+  if (inode->head.magic == COMPRESSED_MAGIC)
+    return;
+  if (size < end - offset)
+    end = offset + size;
+  last = (end - 1) / BLOCK_SECTOR_SIZE;
+  for (index = offset / BLOCK_SECTOR_SIZE; index <= last; index++)
+    {
+      block_sector_t sector = index_to_sector (inode, index);
+      if (cnt > 0 && sector == start + cnt)
+        cnt++;
+      else
+        {
+          if (cnt > 0)
+            cache_load (start, cnt);
+          start = sector;
+          cnt = sector != HOLE_SECTOR;
+        }
+    }
+  if (cnt > 0)
+    cache_load (start, cnt);
+}
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
+   Returns the number of bytes actually read, which may be less
+   than SIZE if an error occurs or end of file is reached.
+   Readers of an inode do not wait for each other. */
+off_t
+inode_read_at (struct inode *inode, void *buffer, off_t size, off_t offset) 
+{
+  off_t bytes_read;
+
+  TRACEPOINT (TP_INODE_READ, inode->sector, offset, size);
+  rwlock_acquire_read (&inode->rwlock);
+  bytes_read = read_at (inode, buffer, size, offset, false);
+  rwlock_release_read (&inode->rwlock);
+  return bytes_read;
+}
+
+/* Reads SIZE bytes, at most a page, from INODE into page buffer
+   KPAGE, starting at position OFFSET, for a memory mapping or an
+   executable page.  Like inode_read_at(), except that the data
+   goes straight from the disk to KPAGE, bypassing the buffer
+   cache and read-ahead, so that the mapped page is the only copy
+   of the data in memory.  Dirty cached copies of the sectors are
+   written back first, so the page sees the latest writes. */
+off_t
+inode_read_page (struct inode *inode, void *kpage, off_t size, off_t offset)
+{
+  off_t bytes_read;
+
+  ASSERT (size <= PGSIZE);
+
+  rwlock_acquire_read (&inode->rwlock);
+  bytes_read = read_at (inode, kpage, size, offset, true);
+  rwlock_release_read (&inode->rwlock);
+  return bytes_read;
+}
+
+/* Reads CNT whole pages from INODE into the pages in KPAGES, the
+   first starting at position OFFSET and each following on from
+   the last, as inode_read_page() would one at a time.  The pages
+   whose sectors lie in one run on disk are read together with
+   cache_read_pages(), so that pages next to each other on disk
+   take a single transfer; the rest are read as inode_read_page()
+   does.  Returns the number of bytes read, which is less than
+   CNT pages only at end of file. */
+off_t
+inode_read_pages (struct inode *inode, void *kpages[], size_t cnt,
+                  off_t offset)
+{
+  size_t per_page = PGSIZE / BLOCK_SECTOR_SIZE;
+  block_sector_t sectors[CACHE_PAGES_MAX];
+  void *direct[CACHE_PAGES_MAX];
+  size_t direct_cnt = 0, i;
+  off_t bytes_read = 0;
+
+  ASSERT (cnt <= CACHE_PAGES_MAX);
+
+  rwlock_acquire_read (&inode->rwlock);
+  for (i = 0; i < cnt; i++)
+    {
+      off_t ofs = offset + (off_t) i * PGSIZE;
+      block_sector_t index = ofs / BLOCK_SECTOR_SIZE;
+      block_sector_t sector = HOLE_SECTOR;
+      off_t n;
+
+      if (inode->head.magic != INLINE_MAGIC
+          && inode->head.magic != COMPRESSED_MAGIC
+          && !is_metadata (inode) && ofs % BLOCK_SECTOR_SIZE == 0
+          && ofs + PGSIZE <= inode_length (inode))
+        sector = index_to_sector (inode, index);
+      if (sector != HOLE_SECTOR
+          && contiguous_run (inode, index, sector, per_page) == per_page)
+        {
+          sectors[direct_cnt] = sector;
+          direct[direct_cnt++] = kpages[i];
+          bytes_read += PGSIZE;
+          continue;
+        }
+      n = read_at (inode, kpages[i], PGSIZE, ofs, true);
+      bytes_read += n;
+      if (n < PGSIZE)
+        break;
+    }
+  if (direct_cnt > 0)
+    cache_read_pages (sectors, direct, direct_cnt);
+  rwlock_release_read (&inode->rwlock);
+  return bytes_read;
+}
+
+/* Reads from INODE into the CNT buffers in IOV, filling each in
+   turn, starting at position OFFSET.  Returns the number of bytes
+   read, which is less than the buffers hold if end of file is
+   reached.  Each buffer is filled straight from the buffer cache,
+   with no intermediate copy, but the sectors behind a run of
+   small buffers are still loaded a page's worth at a time. */
+off_t
+inode_readv_at (struct inode *inode, const struct iovec *iov, int cnt,
+                off_t offset)
+{
+  off_t total = 0, loaded = offset;
+  int i;
+
+  rwlock_acquire_read (&inode->rwlock);
+  for (i = 0; i < cnt; i++)
+    {
+      off_t n;
+
+      if (inode->head.magic != INLINE_MAGIC && offset + total >= loaded
+          && offset + total < inode_length (inode))
+        {
+          load_range (inode, offset + total, PGSIZE);
+          loaded = offset + total + PGSIZE;
+        }
+      n = read_at (inode, iov[i].iov_base, iov[i].iov_len, offset + total,
+                   false);
+      total += n;
+      if (n < (off_t) iov[i].iov_len)
+        break;
+    }
+  rwlock_release_read (&inode->rwlock);
+  return total;
+}
+
+/* Does the work of inode_read_at(), or of inode_read_page() if
+   PAGE is true. */
+static off_t
+read_at (struct inode *inode, void *buffer_, off_t size, off_t offset,
+         bool page) 
+{
+  uint8_t *buffer = buffer_;
+  off_t bytes_read = 0;
+  size_t direct_min = page ? 1 : DIRECT_MIN;
+  bool direct = (!is_metadata (inode)
+                 && size >= (off_t) direct_min * BLOCK_SECTOR_SIZE);
+  uint8_t *bounce = NULL;
+  size_t bounce_pages = 0;
+
+  if (inode->head.magic == INLINE_MAGIC)
+    {
+      if (offset >= inode_length (inode))
+        return 0;
+      if (size > inode_length (inode) - offset)
+        size = inode_length (inode) - offset;
+      cache_read_meta (inode->sector, buffer,
+                       offsetof (struct inode_disk, inline_data) + offset,
+                       size);
+      return size;
+    }
+  if (inode->head.magic == COMPRESSED_MAGIC)
+    return read_compressed (inode, buffer, size, offset);
+  if (direct && is_user_vaddr (buffer))
+    direct = bounce_alloc (size, &bounce, &bounce_pages);
+
+  if (!direct && offset < inode_length (inode)
+      && offset / BLOCK_SECTOR_SIZE
+         != (offset + size - 1) / BLOCK_SECTOR_SIZE)
+    load_range (inode, offset, size);
+
+  while (size > 0) 
+    {
+      /* Disk sector to read, starting byte offset within sector. */
+      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+
+      /* Bytes left in inode, bytes left in sector, lesser of the two. */
+      off_t inode_left = inode_length (inode) - offset;
+      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+      int min_left = inode_left < sector_left ? inode_left : sector_left;
+
+      /* Number of bytes to actually copy out of this sector. */
+      int chunk_size = size < min_left ? size : min_left;
+      if (chunk_size <= 0)
+        break;
+
+      /* Sectors to read straight from disk, if any.  If the file
+         is too fragmented here for that, stop trying. */
+      size_t run = 0;
+      if (direct && sector_ofs == 0 && sector_idx != HOLE_SECTOR)
+        {
+          off_t left = size < inode_left ? size : inode_left;
+          if (left >= BLOCK_SECTOR_SIZE)
+            run = contiguous_run (inode, offset / BLOCK_SECTOR_SIZE,
+                                  sector_idx, left / BLOCK_SECTOR_SIZE);
+          if (run < direct_min)
+            {
+              run = 0;
+              direct = false;
+            }
+        }
+
+      /* Copy a long aligned run straight from disk, or else out of
+         the buffer cache, or zeros for a hole.  Directory contents
+         and the free map are metadata. */
+      if (run > 0 && bounce != NULL)
+        {
+          run = bounce_run (run, bounce_pages);
+          chunk_size = run * BLOCK_SECTOR_SIZE;
+          cache_read_direct (sector_idx, run, bounce);
+          memcpy (buffer + bytes_read, bounce, chunk_size);
+        }
+      else if (run > 0)
+        {
+          cache_read_direct (sector_idx, run, buffer + bytes_read);
+          chunk_size = run * BLOCK_SECTOR_SIZE;
+        }
+      else if (sector_idx == HOLE_SECTOR)
+        {
+          const uint8_t *delayed
+            = delayed_sector (inode, offset / BLOCK_SECTOR_SIZE);
+          if (delayed != NULL)
+            memcpy (buffer + bytes_read, delayed + sector_ofs, chunk_size);
+          else
+            memset (buffer + bytes_read, 0, chunk_size);
+        }
+      else if (is_metadata (inode))
+        cache_read_meta (sector_idx, buffer + bytes_read, sector_ofs,
+                         chunk_size);
+      else
+        cache_read (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
+      
+      /* Advance. */
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_read += chunk_size;
+    }
+  palloc_free_multiple (bounce, bounce_pages);
+
+  if (bytes_read > 0 && !page)
+    readahead (inode, offset - bytes_read, offset);
+  return bytes_read;
+}
+
+/* Allocates kernel pages for a direct transfer of SIZE bytes to or
+   from user memory, at most BOUNCE_PAGES of them, storing them
+   into *BOUNCEP and their number into *PAGE_CNTP.  Returns false
+   if no pages are free, in which case the transfer should go
+   through the buffer cache instead. */
+static bool
+bounce_alloc (off_t size, uint8_t **bouncep, size_t *page_cntp)
+{
+  size_t page_cnt = DIV_ROUND_UP (size, PGSIZE);
+
+  if (page_cnt > BOUNCE_PAGES)
+    page_cnt = BOUNCE_PAGES;
+  *bouncep = palloc_get_multiple (0, page_cnt);
+  *page_cntp = *bouncep != NULL ? page_cnt : 0;
+  return *bouncep != NULL;
+}
+
+/* Returns RUN, cut down to the sectors that fit in PAGE_CNT
+   bounce pages. */
+static size_t
+bounce_run (size_t run, size_t page_cnt)
+{
+  size_t max = page_cnt * (PGSIZE / BLOCK_SECTOR_SIZE);
+
+  return run < max ? run : max;
+}
+
+/* Notes that a read of INODE covered the bytes from START up to
+   END and, if it continues a sequential stream, asks the cache to
+   load the sectors that the stream's grown window reaches and
+   earlier reads have not already asked for.  Each run of
+   consecutive disk sectors is queued as one request. */
+static void
+readahead (struct inode *inode, off_t start, off_t end)
+{
+  block_sector_t from, to, max;
+  struct readahead *ra = NULL;
+  size_t i;
+
+  lock_acquire (&inode->ib_lock);
+  if (inode->advice == ADVICE_RANDOM)
+    {
+      lock_release (&inode->ib_lock);
+      return;
+    }
+  for (i = 0; i < READAHEAD_STREAMS; i++)
+    if (inode->ra[i].next == start && inode->ra[i].last_use != 0)
+      {
+        ra = &inode->ra[i];
+        ra->window = (ra->window == 0 ? READAHEAD_MIN
+                      : ra->window * 2 < READAHEAD_MAX ? ra->window * 2
+                      : READAHEAD_MAX);
+        break;
+      }
+  if (ra == NULL)
+    {
+      /* A new stream, unless it is the first read of the file. */
+      ra = &inode->ra[0];
+      for (i = 1; i < READAHEAD_STREAMS; i++)
+        if (inode->ra[i].last_use < ra->last_use)
+          ra = &inode->ra[i];
+      ra->window = start == 0 ? READAHEAD_MIN : 0;
+      ra->end = 0;
+    }
+  if (inode->advice == ADVICE_SEQUENTIAL)
+    ra->window = READAHEAD_MAX;
+  ra->next = end;
+  ra->last_use = ++inode->ra_clock;
+
+  from = end / BLOCK_SECTOR_SIZE;
+  if (from < ra->end)
+    from = ra->end;
+  to = end / BLOCK_SECTOR_SIZE + ra->window;
+  max = bytes_to_sectors (inode_length (inode));
+  if (to > max)
+    to = max;
+  if (to > from)
+    ra->end = to;
+  lock_release (&inode->ib_lock);
+  queue_readahead (inode, from, to);
+}
+
+/* Asks the cache to load data sectors FROM up to TO of INODE in
+   the background, queuing each run of consecutive disk sectors as
+   one request and skipping holes. */
+static void
+queue_readahead (struct inode *inode, block_sector_t from, block_sector_t to)
+{
+  block_sector_t index, run_start = HOLE_SECTOR;
+  size_t run_cnt = 0;
+
+  for (index = from; index < to; index++)
+    {
+      block_sector_t sector = index_to_sector (inode, index);
+      if (run_cnt > 0 && sector == run_start + run_cnt)
+        run_cnt++;
+      else
+        {
+          if (run_cnt > 0)
+            cache_readahead (run_start, run_cnt);
+          run_start = sector;
+          run_cnt = sector != HOLE_SECTOR;
+        }
+    }
+  if (run_cnt > 0)
+    cache_readahead (run_start, run_cnt);
+}
+
+/* Converts inline INODE to the format it records for growth,
+   moving its bytes to its first data sector.  Returns true if
+   successful, false if memory or disk space runs out, in which
+   case INODE stays inline with its bytes intact. */
+static bool
+inline_expand (struct inode *inode)
+{
+  struct inode_head *d = &inode->head;
+  off_t length = d->length;
+  uint8_t *copy = arena_alloc (INLINE_BYTES);
+  bool extents = d->to_extents;
+
+  if (copy == NULL)
+    return false;
+  cache_read_meta (inode->sector, copy,
+                   offsetof (struct inode_disk, inline_data), length);
+  map_clear (inode);
+  d->magic = extents ? EXTENT_MAGIC : INODE_MAGIC;
+  head_store (inode);
+  if (extents && !extent_cover (inode, GROW_CHUNK))
+    {
+      /* Put the inode back the way it was. */
+      d->magic = INLINE_MAGIC;
+      journal_write (inode->sector, copy,
+                     offsetof (struct inode_disk, inline_data), length);
+      head_store (inode);
+      arena_free (copy);
+      return false;
+    }
+  if (length > 0 && write_at (inode, copy, length, 0, false) != length)
+    {
+      /* Give back whatever the write took and keep the bytes in
+         the inode. */
+      if (inode->delayed != NULL)
+        free_delayed (inode);
+      shrink (inode, 0);
+      map_clear (inode);
+      d->magic = INLINE_MAGIC;
+      d->length = length;
+      journal_write (inode->sector, copy,
+                     offsetof (struct inode_disk, inline_data), length);
+      head_store (inode);
+      arena_free (copy);
+      return false;
+    }
+  arena_free (copy);
+  return true;
+}
+
+/* Converts block-mapped INODE, which is about to grow past what
+   its block map can reach, to an extent-based inode covering the
+   same sectors, so that it can keep growing.  The data stays
+   where it is; only the indirect blocks are released.  Returns
+   true if successful, false if memory or disk space runs out. */
+static bool
+blockmap_expand (struct inode *inode)
+{
+  struct inode_head *d = &inode->head;
+  struct mapped_extent *map = NULL, *last = NULL;
+  struct indirect_block *first;
+  struct inode_disk *disk;
+  struct release_batch batch;
+  size_t map_cnt = 0, map_max = 0, k;
+  block_sector_t index;
+
+  ASSERT (d->magic == INODE_MAGIC);
+
+  /* Coalesce the block map into runs. */
+  for (index = 0; index < BLOCKMAP_SECTORS; index++)
+    {
+      block_sector_t sector = index_to_sector (inode, index);
+
+      if (last != NULL
+          && (sector == HOLE_SECTOR
+              ? last->start == HOLE_SECTOR
+              : (last->start != HOLE_SECTOR
+                 && last->start + last->length == sector)))
+        {
+          last->length++;
+          continue;
+        }
+      if (map_cnt == map_max)
+        {
+          struct mapped_extent *bigger;
+
+          map_max = map_max * 2 + 16;
+          bigger = realloc (map, map_max * sizeof *map);
+          if (bigger == NULL)
+            {
+              free (map);
+              return false;
+            }
+          map = bigger;
+        }
+      last = &map[map_cnt++];
+      last->index = index;
+      last->start = sector;
+      last->length = 1;
+    }
+
+  first = malloc (sizeof *first);
+  disk = malloc (sizeof *disk);
+  if (first == NULL || disk == NULL)
+    {
+      free (first);
+      free (disk);
+      free (map);
+      return false;
+    }
+
+  /* The direct sectors share the union with the extents, so the
+     map above must be complete before they are overwritten. */
+  disk_read (inode, disk);
+  map_clear (inode);
+  d->magic = EXTENT_MAGIC;
+  inode->extents = map;
+  inode->extent_cnt = map_cnt;
+  if (!extent_store (inode, 0))
+    {
+      /* No room for the extent_blocks: put the block map back. */
+      inode->extents = NULL;
+      inode->extent_cnt = 0;
+      map_restore (inode, disk);
+      free (first);
+      free (disk);
+      free (map);
+      return false;
+    }
+
+  /* Let go of the indirect blocks, which the extents replace. */
+  batch.cnt = 0;
+  if (disk->ib != HOLE_SECTOR)
+    {
+      cache_read_meta (disk->ib, first, 0, BLOCK_SECTOR_SIZE);
+      for (k = 0; k < 128; k++)
+        if (first->sectors[k] != HOLE_SECTOR)
+          batch_add (&batch, first->sectors[k], 1);
+      batch_add (&batch, disk->ib, 1);
+    }
+  free (first);
+  free (disk);
+  ib_cache_invalidate (inode);
+  inode->alloc_end = 0;
+  free_map_release_many (batch.runs, batch.cnt);
+  converted_cnt++;
+  return true;
+}
+
+/* Prepares INODE for a write that ends at byte END, past its end
+   of file: converts an inline inode that will not fit, and makes
+   sure that the map covers the new sectors, with room for a
+   GROW_CHUNK of allocation beyond them.  Returns false if INODE
+   cannot grow that large. */
+static bool
+grow (struct inode *inode, off_t end)
+{
+  size_t sectors = bytes_to_sectors (end);
+  size_t cover = ROUND_UP (sectors, GROW_CHUNK);
+
+  if (inode->head.magic == INLINE_MAGIC)
+    {
+      if (end <= INLINE_BYTES)
+        return true;
+      if (!inline_expand (inode))
+        return false;
+    }
+
+  if (inode->head.magic == INODE_MAGIC
+      && compute_total_sectors (sectors) > MAX_BLOCK_NUMBER
+      && !blockmap_expand (inode))
+    return false;
+
+  if (inode->head.magic == EXTENT_MAGIC)
+    return extent_cover (inode, cover);
+  return true;
+}
+
+/* Gives extent-based INODE private copies of the shared sectors
+   that a write of SIZE bytes at OFFSET is about to change, all of
+   which its extents must cover.  A sector that the write covers
+   entirely becomes a hole, for the write to fill; one that it
+   covers partly is copied into a new sector first.  Returns
+   false, changing nothing, if the disk has too little room for
+   the copies or memory runs out. */
+static bool
+unshare (struct inode *inode, off_t offset, off_t size)
+{
+  block_sector_t first = offset / BLOCK_SECTOR_SIZE;
+  block_sector_t last = (offset + size - 1) / BLOCK_SECTOR_SIZE;
+  bool first_part = offset % BLOCK_SECTOR_SIZE != 0;
+  bool last_part = (offset + size) % BLOCK_SECTOR_SIZE != 0;
+  struct release_batch batch;
+  struct mapped_extent *saved;
+  struct free_run *punched;
+  block_sector_t copies[2];
+  size_t shared = 0, runs = 0, punch_cnt = 0, copy_cnt = 0, i;
+  size_t old_cnt = inode->extent_cnt, keep = inode->reserved, spare;
+  size_t dropped = 0;
+  block_sector_t index;
+  uint8_t *bounce = NULL;
+  bool success = true;
+
+  if (inode->head.magic != EXTENT_MAGIC || refcount_sector == 0
+      || is_metadata (inode))
+    return true;
+
+  /* Count the shared sectors and the runs they form. */
+  for (index = first; index <= last; index++)
+    {
+      block_sector_t sector = index_to_sector (inode, index);
+      if (sector != HOLE_SECTOR && refcount_shared (sector))
+        {
+          shared++;
+          if (index == first
+              || !refcount_shared (index_to_sector (inode, index - 1)))
+            runs++;
+        }
+    }
+  if (shared == 0)
+    return true;
+
+  /* A write that stops partway must not leave holes where shared
+     data was.  So before changing anything, get the memory, a
+     copy of the map to put back, and reserve room for the copies
+     and for the extent_blocks that splitting adds, as well as
+     SPARE sectors for the extent_blocks of the map put back.
+     The references to the sectors punched out are only dropped
+     once all is done. */
+  spare = extent_blocks (old_cnt);
+  saved = malloc (old_cnt * sizeof *saved);
+  punched = malloc (shared * sizeof *punched);
+  if (first_part || last_part)
+    bounce = arena_alloc (BLOCK_SECTOR_SIZE);
+  if (saved == NULL || punched == NULL
+      || ((first_part || last_part) && bounce == NULL)
+      || !free_map_reserve (spare))
+    {
+      free (saved);
+      free (punched);
+      arena_free (bounce);
+      return false;
+    }
+  if (!reserve_sectors (inode, shared + 2 * runs))
+    {
+      free_map_unreserve (spare);
+      free (saved);
+      free (punched);
+      arena_free (bounce);
+      return false;
+    }
+  memcpy (saved, inode->extents, old_cnt * sizeof *saved);
+
+  for (index = first; index <= last && success; )
+    {
+      block_sector_t sector = index_to_sector (inode, index);
+      struct mapped_extent *m;
+      size_t cnt;
+
+      if (sector == HOLE_SECTOR || !refcount_shared (sector))
+        {
+          index++;
+          continue;
+        }
+
+      if ((index == first && first_part) || (index == last && last_part))
+        {
+          /* Keep the part that the write leaves alone. */
+          block_sector_t copy = HOLE_SECTOR;
+
+          cache_read (sector, bounce, 0, BLOCK_SECTOR_SIZE);
+          success = extent_punch (inode, index, 1, NULL);
+          if (success)
+            {
+              punched[punch_cnt].start = sector;
+              punched[punch_cnt++].cnt = 1;
+              copy = extent_fill (inode, index, 1, 1);
+              success = copy != HOLE_SECTOR;
+            }
+          if (success)
+            {
+              copies[copy_cnt++] = copy;
+              cache_write (copy, bounce, 0, BLOCK_SECTOR_SIZE);
+            }
+          index++;
+          continue;
+        }
+
+      /* Overwritten entirely: the write fills these in. */
+      m = &inode->extents[extent_find (inode, index)];
+      for (cnt = 1; index + cnt < m->index + m->length
+                    && index + cnt <= last
+                    && !(index + cnt == last && last_part)
+                    && refcount_shared (sector + cnt); cnt++)
+        continue;
+      success = extent_punch (inode, index, cnt, NULL);
+      if (success)
+        {
+          punched[punch_cnt].start = sector;
+          punched[punch_cnt++].cnt = cnt;
+          dropped += cnt;
+        }
+      index += cnt;
+    }
+
+  if (success)
+    {
+      batch.cnt = 0;
+      for (i = 0; i < punch_cnt; i++)
+        batch_add (&batch, punched[i].start, punched[i].cnt);
+      free_map_release_many (batch.runs, batch.cnt);
+      free_map_unreserve (spare);
+      cow_copied += copy_cnt;
+      cow_dropped += dropped;
+    }
+  else
+    {
+      /* Put the map back, with its extent_blocks in the sectors
+         set aside for them, and let go of the copies. */
+      bool restored;
+
+      free (inode->extents);
+      inode->extents = saved;
+      inode->extent_cnt = old_cnt;
+      saved = NULL;
+      inode->reserved += spare;
+      restored = extent_store (inode, 0);
+      ASSERT (restored);
+      for (i = 0; i < copy_cnt; i++)
+        free_map_release (copies[i], 1);
+    }
+  unreserve_sectors (inode, keep);
+  free (saved);
+  free (punched);
+  arena_free (bounce);
+  return success;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or an error occurs.
+   A write past end of file extends the inode; the new end of
+   file takes effect once the data is in place.  The write is
+   carried out TXN_SECTORS sectors at a time, each piece
+   journaled as one operation that excludes readers and other
+   writers of INODE. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
+
+  TRACEPOINT (TP_INODE_WRITE, inode->sector, offset, size);
+  while (size > 0)
+    {
+      off_t chunk = size < TXN_SECTORS * BLOCK_SECTOR_SIZE
+                    ? size : TXN_SECTORS * BLOCK_SECTOR_SIZE;
+      off_t written;
+
+      journal_begin (map_credits (inode, bytes_to_sectors (chunk) + 1));
+      rwlock_acquire_write (&inode->rwlock);
+      written = write_at (inode, buffer + bytes_written, chunk, offset,
+                          false);
+      rwlock_release_write (&inode->rwlock);
+      journal_end ();
+
+      bytes_written += written;
+      if (written < chunk)
+        break;
+      size -= chunk;
+      offset += chunk;
+    }
+  return bytes_written;
+}
+
+/* Writes SIZE bytes, at most a page, from page buffer KPAGE into
+   INODE, starting at OFFSET, for a memory mapping.  Like
+   inode_write_at(), except that whole sectors go straight from
+   KPAGE to the disk and their cached copies are discarded, so
+   that the data is not kept in memory twice and later reads see
+   it. */
+off_t
+inode_write_page (struct inode *inode, const void *kpage, off_t size,
+                  off_t offset)
+{
+  off_t bytes_written;
+
+  ASSERT (size <= PGSIZE);
+
+  journal_begin (map_credits (inode, PGSIZE / BLOCK_SECTOR_SIZE + 1));
+  rwlock_acquire_write (&inode->rwlock);
+  bytes_written = write_at (inode, kpage, size, offset, true);
+  rwlock_release_write (&inode->rwlock);
+  journal_end ();
+  return bytes_written;
+}
+
+/* Does the work of inode_write_at(), or of inode_write_page() if
+   PAGE is true. */
+static off_t
+write_at (struct inode *inode, const void *buffer_, off_t size,
+          off_t offset, bool page) 
+{
+  const uint8_t *buffer = buffer_;
+  off_t bytes_written = 0;
+  off_t old_length = inode_length (inode);
+  off_t end = offset + size;
+  size_t direct_min = page ? 1 : DIRECT_MIN;
+  bool direct = (!is_metadata (inode)
+                 && size >= (off_t) direct_min * BLOCK_SECTOR_SIZE);
   uint8_t *bounce = NULL;
+  size_t bounce_pages = 0;
 
-  if (inode->deny_write_cnt)
+  if (inode->deny_write_cnt || size <= 0)
+    return 0;
+  if (!expand (inode))
     return 0;
+  inode->write_gen++;
+  if (end > old_length && !grow (inode, end))
+    return 0;
+  if (!unshare (inode, offset, size))
+    return 0;
+
+  /* A direct write would allocate over delayed sectors.  If they
+     cannot be written out, add to them instead. */
+  if (direct && inode->delayed != NULL && !flush_delayed (inode))
+    direct = false;
+
+  if (inode->head.magic == INLINE_MAGIC)
+    {
+      journal_write (inode->sector, buffer,
+                     offsetof (struct inode_disk, inline_data) + offset,
+                     size);
+      if (end > old_length)
+        {
+          inode->head.length = end;
+          head_store (inode);
+        }
+      return size;
+    }
+  if (direct && is_user_vaddr (buffer))
+    direct = bounce_alloc (size, &bounce, &bounce_pages);
 
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t index = offset / BLOCK_SECTOR_SIZE;
+      block_sector_t sector_idx = index_to_sector (inode, index);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      /* Bytes left in write, bytes left in sector, lesser of the
+         two. */
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+      int chunk_size = size < sector_left ? size : sector_left;
+      uint8_t *delayed = NULL;
+
+      /* Hold file data for a hole in memory for now. */
+      if (sector_idx == HOLE_SECTOR && !direct && !is_metadata (inode))
+        delayed = delay_sector (inode, index);
+
+      /* Allocate the sector if this is its first write, along with
+         the sectors that the rest of the write will need.  Past
+         the end of file, allocate at least a GROW_CHUNK at once.
+         Sectors that the write covers entirely need no zeroing. */
+      if (sector_idx == HOLE_SECTOR && delayed == NULL)
+        {
+          size_t cnt = bytes_to_sectors (sector_ofs + size);
+          size_t covered = sector_ofs == 0 ? size / BLOCK_SECTOR_SIZE : 0;
+          if (offset >= old_length && cnt < GROW_CHUNK)
+            cnt = GROW_CHUNK;
+          sector_idx = (inode->head.magic == EXTENT_MAGIC
+                        ? extent_fill (inode, index, cnt, covered)
+                        : blockmap_fill (inode, index, cnt, covered));
+          if (sector_idx == HOLE_SECTOR)
+            break;
+        }
+
+      /* Sectors to write straight to disk, if any.  If the file
+         is too fragmented here for that, stop trying. */
+      size_t run = 0;
+      if (direct && sector_ofs == 0 && size >= BLOCK_SECTOR_SIZE)
+        {
+          run = contiguous_run (inode, index, sector_idx,
+                                size / BLOCK_SECTOR_SIZE);
+          if (run < direct_min)
+            {
+              run = 0;
+              direct = false;
+            }
+        }
+
+      /* Write a long aligned run straight to disk, or else copy
+         into the buffer cache, which writes the sector back to
+         disk later.  Directory contents and the free map are
+         metadata, so they are journaled; file data is not. */
+      if (delayed != NULL)
+        memcpy (delayed + sector_ofs, buffer + bytes_written, chunk_size);
+      else if (run > 0 && bounce != NULL)
+        {
+          run = bounce_run (run, bounce_pages);
+          chunk_size = run * BLOCK_SECTOR_SIZE;
+          memcpy (bounce, buffer + bytes_written, chunk_size);
+          cache_write_direct (sector_idx, run, bounce);
+        }
+      else if (run > 0)
+        {
+          cache_write_direct (sector_idx, run, buffer + bytes_written);
+          chunk_size = run * BLOCK_SECTOR_SIZE;
+        }
+      else if (is_metadata (inode))
+        journal_write (sector_idx, buffer + bytes_written, sector_ofs,
+                       chunk_size);
+      else
+        cache_write (sector_idx, buffer + bytes_written, sector_ofs,
+                     chunk_size);
+
+      /* Advance. */
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_written += chunk_size;
+    }
+  palloc_free_multiple (bounce, bounce_pages);
+
+  /* Extend the file over what was written. */
+  if (offset > inode_length (inode))
+    {
+      inode->head.length = offset;
+      head_store (inode);
+    }
+
+  return bytes_written;
+}
+
+/* Writes zeros to the CNT sectors starting at SECTOR, a page at a
+   time straight to disk if a page is available, so that zeroing a
+   large run does not flush the buffer cache. */
+static void
+zero_sectors (block_sector_t sector, size_t cnt)
+{
+  size_t per_page = PGSIZE / BLOCK_SECTOR_SIZE;
+  void *zeros = palloc_get_page (PAL_ZERO);
+
+  while (cnt > 0)
+    {
+      size_t n = cnt < per_page ? cnt : per_page;
+
+      if (zeros != NULL)
+        cache_write_direct (sector, n, zeros);
+      else
+        for (n = 0; n < cnt && n < per_page; n++)
+          cache_zero (sector + n);
+      sector += n;
+      cnt -= n;
+    }
+  palloc_free_page (zeros);
+}
+
+/* Shortens INODE to LENGTH bytes, releasing the sectors past the
+   new end of file.  The rest of the last sector is zeroed, so
+   that growing the file again reads zeros there.  Returns false,
+   changing nothing, if the last sector is shared and cannot be
+   copied or if the shorter map cannot be stored. */
+static bool
+shrink (struct inode *inode, off_t length)
+{
+  static const uint8_t zeros[BLOCK_SECTOR_SIZE];
+  struct inode_head *d = &inode->head;
+  off_t tail = length % BLOCK_SECTOR_SIZE;
+
+  if (d->magic == INLINE_MAGIC)
+    {
+      journal_write (inode->sector, zeros,
+                     offsetof (struct inode_disk, inline_data) + length,
+                     d->length - length);
+      d->length = length;
+      return true;
+    }
+
+  if (tail > 0 && !unshare (inode, length, BLOCK_SECTOR_SIZE - tail))
+    return false;
+  if (d->magic == EXTENT_MAGIC)
+    {
+      off_t old_length = d->length;
+
+      d->length = length;
+      if (!extent_trim (inode))
+        {
+          d->length = old_length;
+          return false;
+        }
+    }
+  else
+    {
+      if (inode->alloc_end < bytes_to_sectors (d->length))
+        inode->alloc_end = bytes_to_sectors (d->length);
+      d->length = length;
+      blockmap_trim (inode);
+    }
+  if (tail > 0)
+    {
+      block_sector_t sector = index_to_sector (inode,
+                                               length / BLOCK_SECTOR_SIZE);
+      if (sector != HOLE_SECTOR)
+        cache_write (sector, zeros, tail, BLOCK_SECTOR_SIZE - tail);
+    }
+  return true;
+}
+
+/* Sets the length of INODE to LENGTH bytes.  Shrinking releases
+   the sectors past the new end of file; growing adds a hole,
+   which reads as zeros.  Returns false if writes to INODE are
+   denied, if it is a directory, or if it cannot grow that
+   large.  A long shrink is carried out TXN_SECTORS sectors at a
+   time, each step journaled as one operation; if a step fails,
+   INODE keeps the length that the previous one left. */
+bool
+inode_truncate (struct inode *inode, off_t length)
+{
+  const off_t step = TXN_SECTORS * BLOCK_SECTOR_SIZE;
+
+  ASSERT (length >= 0);
+
+  while (inode_length (inode) - length > step)
+    if (!truncate_step (inode, inode_length (inode) - step))
+      return false;
+  return truncate_step (inode, length);
+}
+
+/* Does one step of inode_truncate(), as one journal operation. */
+static bool
+truncate_step (struct inode *inode, off_t length)
+{
+  off_t old_length;
+  bool success = true;
+
+  journal_begin (map_credits (inode, TXN_SECTORS + 1));
+  rwlock_acquire_write (&inode->rwlock);
+  old_length = inode_length (inode);
+  if (inode->delayed != NULL)
+    flush_delayed (inode);
+  if (inode->deny_write_cnt > 0 || inode->head.is_directory
+      || inode->delayed != NULL
+      || (length != old_length && !expand (inode)))
+    success = false;
+  else if (length > old_length)
+    success = grow (inode, length);
+  else if (length < old_length)
+    success = shrink (inode, length);
+  if (success && length != old_length)
+    {
+      inode->write_gen++;
+      inode->head.length = length;
+      head_store (inode);
+    }
+  rwlock_release_write (&inode->rwlock);
+  journal_end ();
+  return success;
+}
+
+/* Allocates zeroed sectors for the holes in INODE's data sectors
+   FIRST up to LAST, each hole in as few runs as the free map
+   allows.  Returns false if the disk fills up. */
+static bool
+fill_range (struct inode *inode, block_sector_t first, block_sector_t last)
+{
+  block_sector_t index = first;
+
+  while (index < last)
+    {
+      block_sector_t sector = index_to_sector (inode, index);
+      size_t cnt, run;
+
+      if (sector != HOLE_SECTOR)
+        {
+          index++;
+          continue;
+        }
+      for (cnt = 1; index + cnt < last; cnt++)
+        if (index_to_sector (inode, index + cnt) != HOLE_SECTOR)
+          break;
+
+      /* The fill functions would zero the new sectors through the
+         cache; zero_sectors() is cheaper for a long run. */
+      sector = (inode->head.magic == EXTENT_MAGIC
+                ? extent_fill (inode, index, cnt, cnt)
+                : blockmap_fill (inode, index, cnt, cnt));
+      if (sector == HOLE_SECTOR)
+        return false;
+      run = contiguous_run (inode, index, sector, cnt);
+      zero_sectors (sector, run);
+      index += run;
+    }
+  return true;
+}
+
+/* Allocates zeroed sectors for every hole in the SIZE bytes of
+   INODE starting at OFFSET, extending INODE to OFFSET + SIZE
+   bytes if it is shorter, so that later writes there need no
+   allocation and the data lies in as few runs as possible.
+   Returns false if writes to INODE are denied, if it is a
+   directory, or if the disk fills up; in the last case the
+   sectors allocated so far are kept.  A long range is allocated
+   TXN_SECTORS sectors at a time, each piece journaled as one
+   operation. */
+bool
+inode_allocate (struct inode *inode, off_t offset, off_t size)
+{
+  const off_t step = TXN_SECTORS * BLOCK_SECTOR_SIZE;
+
+  ASSERT (offset >= 0 && size >= 0);
+
+  for (; size > step; offset += step, size -= step)
+    if (!allocate_step (inode, offset, step))
+      return false;
+  return allocate_step (inode, offset, size);
+}
+
+/* Does one step of inode_allocate(), as one journal operation. */
+static bool
+allocate_step (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+  bool success;
+
+  journal_begin (map_credits (inode, bytes_to_sectors (size) + 1));
+  rwlock_acquire_write (&inode->rwlock);
+  if (inode->delayed != NULL)
+    flush_delayed (inode);
+  success = (inode->deny_write_cnt == 0 && !inode->head.is_directory
+             && inode->delayed == NULL && expand (inode));
+  if (success && end > inode_length (inode))
+    success = grow (inode, end);
+  if (success && inode->head.magic != INLINE_MAGIC && size > 0)
+    success = fill_range (inode, offset / BLOCK_SECTOR_SIZE,
+                          bytes_to_sectors (end));
+  if (success && end > inode_length (inode))
+    {
+      inode->write_gen++;
+      inode->head.length = end;
+      head_store (inode);
+    }
+  rwlock_release_write (&inode->rwlock);
+  journal_end ();
+  return success;
+}
+
+/* Allocates zeroed sectors for INODE's data past its end of file
+   up to byte END, without changing its length, so that writes
+   that extend INODE up to END need no allocation.  The directory
+   layer uses this to make sure that a directory can grow before
+   it starts rewriting it.  Sectors that stay past the end of file
+   are released when INODE is last closed.  Returns false, giving
+   back what it allocated, if the disk fills up. */
+bool
+inode_preallocate (struct inode *inode, off_t end)
+{
+  bool success;
+
+  journal_begin (map_credits (inode, bytes_to_sectors (end)));
+  rwlock_acquire_write (&inode->rwlock);
+  success = expand (inode) && grow (inode, end);
+  if (success && inode->head.magic != INLINE_MAGIC)
+    success = fill_range (inode, bytes_to_sectors (inode_length (inode)),
+                          bytes_to_sectors (end));
+  if (!success && inode->head.magic == EXTENT_MAGIC)
+    extent_trim (inode);
+  else if (!success && inode->head.magic == INODE_MAGIC)
+    blockmap_trim (inode);
+  rwlock_release_write (&inode->rwlock);
+  journal_end ();
+  return success;
+}
+
+/* Disables writes to INODE.
+   May be called at most once per inode opener. */
+void
+inode_deny_write (struct inode *inode) 
+{
+  rwlock_acquire_write (&inode->rwlock);
+  inode->deny_write_cnt++;
+  ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rwlock);
+}
+
+/* Re-enables writes to INODE.
+   Must be called once by each inode opener who has called
+   inode_deny_write() on the inode, before closing the inode. */
+void
+inode_allow_write (struct inode *inode) 
+{
+  rwlock_acquire_write (&inode->rwlock);
+  ASSERT (inode->deny_write_cnt > 0);
+  ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rwlock);
+}
+
+/* Returns true if INODE holds a directory. */
+bool
+inode_is_dir (const struct inode *inode)
+{
+  return inode->head.is_directory;
+}
+
+/* Returns true if the inode in SECTOR holds a directory.  Reads
+   only that flag, through the buffer cache, without opening the
+   inode, which is safe because an inode never changes between
+   file and directory once created. */
+bool
+inode_sector_is_dir (block_sector_t sector)
+{
+  bool is_dir;
+
+  cache_read_meta (sector, &is_dir, offsetof (struct inode_disk, is_directory),
+                   sizeof is_dir);
+  return is_dir;
+}
+
+/* Returns a number that changes whenever INODE is written, for
+   those who remember something about INODE's contents while it
+   is open. */
+unsigned
+inode_write_gen (const struct inode *inode)
+{
+  return inode->write_gen;
+}
+
+/* Returns true if INODE has been removed with inode_remove(). */
+bool
+inode_is_removed (const struct inode *inode)
+{
+  return inode->removed;
+}
+
+/* Returns the flags stored in INODE by inode_set_flags(). */
+unsigned
+inode_get_flags (const struct inode *inode)
+{
+  return inode->head.flags;
+}
+
+/* Stores FLAGS, which must fit in 8 bits, in INODE and writes
+   INODE back to disk.  The inode layer does not interpret them;
+   they let higher layers record the format of the contents. */
+void
+inode_set_flags (struct inode *inode, unsigned flags)
+{
+  ASSERT (flags <= UINT8_MAX);
+  journal_begin (1);
+  rwlock_acquire_write (&inode->rwlock);
+  inode->head.flags = flags;
+  head_store (inode);
+  rwlock_release_write (&inode->rwlock);
+  journal_end ();
+}
+
+/* Stores the live entry count and first free slot recorded for
+   directory INODE into *ENTRY_CNT and *FREE_SLOT. */
+void
+inode_get_dir_info (const struct inode *inode, size_t *entry_cnt,
+                    size_t *free_slot)
+{
+  *entry_cnt = inode->head.dir_entry_cnt;
+  *free_slot = inode->head.dir_free_slot;
+}
+
+/* Records ENTRY_CNT and FREE_SLOT for directory INODE and writes
+   INODE back to disk. */
+void
+inode_set_dir_info (struct inode *inode, size_t entry_cnt, size_t free_slot)
+{
+  journal_begin (1);
+  rwlock_acquire_write (&inode->rwlock);
+  inode->head.dir_entry_cnt = entry_cnt;
+  inode->head.dir_free_slot = free_slot;
+  head_store (inode);
+  rwlock_release_write (&inode->rwlock);
+  journal_end ();
+}
+
+/* Acquires INODE's directory lock, with which the directory layer
+   serializes changes to a directory's entries.  The inode layer
+   itself never takes it, so it may be held across any inode
+   call. */
+void
+inode_dir_lock (struct inode *inode)
+{
+  lock_acquire (&inode->dir_lock);
+}
+
+/* Releases INODE's directory lock. */
+void
+inode_dir_unlock (struct inode *inode)
+{
+  lock_release (&inode->dir_lock);
+}
+
+/* Returns the name filter that the directory layer attached to
+   directory INODE, or a null pointer.  The caller must hold
+   INODE's directory lock. */
+struct dir_bloom *
+inode_get_dir_bloom (struct inode *inode)
+{
+  ASSERT (lock_held_by_current_thread (&inode->dir_lock));
+  return inode->dir_bloom;
+}
+
+/* Attaches BLOOM, a block from malloc(), as directory INODE's name
+   filter, freeing any it had.  INODE frees BLOOM when it is
+   closed for the last time.  The caller must hold INODE's
+   directory lock. */
+void
+inode_set_dir_bloom (struct inode *inode, struct dir_bloom *bloom)
+{
+  ASSERT (lock_held_by_current_thread (&inode->dir_lock));
+  if (inode->dir_bloom != bloom)
+    free (inode->dir_bloom);
+  inode->dir_bloom = bloom;
+}
+
+/* Returns the length, in bytes, of INODE's data. */
+off_t
+inode_length (const struct inode *inode)
+{
+  return inode->head.length;
+}
+
+/* Stores in *BLOCKS the number of sectors allocated to INODE's
+   data and to the index sectors that map it, with its delayed
+   data counted as if already allocated.  Only a block-mapped
+   inode's map is read; an extent map is already in memory.
+   Returns false if memory to read the map cannot be had.
+   The caller must hold INODE's rwlock. */
+static bool
+count_blocks (struct inode *inode, size_t *blocks)
+{
+  const struct inode_head *d = &inode->head;
+  size_t cnt = inode->delayed != NULL ? inode->delayed->cnt : 0;
+  struct indirect_block *first, *second;
+  size_t i, k;
+
+  if (d->magic == INLINE_MAGIC)
+    {
+      *blocks = cnt;
+      return true;
+    }
+  if (d->magic != INODE_MAGIC)
+    {
+      for (i = 0; i < inode->extent_cnt; i++)
+        if (inode->extents[i].start != HOLE_SECTOR)
+          cnt += inode->extents[i].length;
+      *blocks = cnt + extent_blocks (inode->extent_cnt);
+      return true;
+    }
 
-      /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
+  first = arena_alloc (sizeof *first);
+  second = arena_alloc (sizeof *second);
+  if (first == NULL || second == NULL)
+    {
+      arena_free (second);
+      arena_free (first);
+      return false;
+    }
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
+  /* The direct sectors fit in FIRST. */
+  cache_read_meta (inode->sector, first, offsetof (struct inode_disk, sectors),
+                   DIRECT_BLOCK * sizeof *first->sectors);
+  for (i = 0; i < DIRECT_BLOCK; i++)
+    if (first->sectors[i] != HOLE_SECTOR)
+      cnt++;
+  if (d->ib == HOLE_SECTOR)
+    {
+      arena_free (second);
+      arena_free (first);
+      *blocks = cnt;
+      return true;
+    }
+  cache_read_meta (d->ib, first, 0, BLOCK_SECTOR_SIZE);
+  cnt++;
+  for (k = 0; k < 128; k++)
+    {
+      if (first->sectors[k] == HOLE_SECTOR)
+        continue;
+      cache_read_meta (first->sectors[k], second, 0, BLOCK_SECTOR_SIZE);
+      cnt++;
+      for (i = 0; i < 128; i++)
+        if (second->sectors[i] != HOLE_SECTOR)
+          cnt++;
+    }
+  arena_free (second);
+  arena_free (first);
+  *blocks = cnt;
+  return true;
+}
 
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+/* Stores INODE's size, type, inode number and allocated sector
+   count in *ST, without reading any data sector.  Returns false,
+   leaving *ST unchanged, if memory to count the sectors cannot be
+   had. */
+bool
+inode_stat (struct inode *inode, struct stat *st)
+{
+  size_t blocks;
+  bool ok;
 
-      /* Advance. */
-      size -= chunk_size;
-      offset += chunk_size;
-      bytes_written += chunk_size;
+  rwlock_acquire_read (&inode->rwlock);
+  ok = count_blocks (inode, &blocks);
+  if (ok)
+    {
+      st->size = inode_length (inode);
+      st->is_dir = inode_is_dir (inode);
+      st->inumber = inode_get_inumber (inode);
+      st->blocks = blocks;
     }
-  free (bounce);
+  rwlock_release_read (&inode->rwlock);
+  return ok;
+}
 
-  return bytes_written;
+/* Marks the CNT sectors starting at SECTOR in USED.  Returns
+   false if any of them is past the end of USED or was already
+   marked without being shared, that is, if the sectors are
+   claimed twice. */
+static bool
+collect_run (struct bitmap *used, block_sector_t sector, size_t cnt)
+{
+  size_t size = bitmap_size (used);
+  bool ok = true;
+  size_t i;
+
+  if (sector >= size || cnt > size - sector)
+    return false;
+  if (bitmap_contains (used, sector, cnt, true))
+    for (i = 0; i < cnt && ok; i++)
+      ok = !bitmap_test (used, sector + i) || refcount_shared (sector + i);
+  bitmap_set_multiple (used, sector, cnt, true);
+  return ok;
 }
 
-/* Disables writes to INODE.
-   May be called at most once per inode opener. */
-void
-inode_deny_write (struct inode *inode) 
+/* Marks in USED the sectors of the block-mapped inode D: its
+   data sectors and its indirect blocks.  Returns false if any
+   was invalid or already marked. */
+static bool
+blockmap_collect (const struct inode_disk *d, struct bitmap *used)
 {
-  inode->deny_write_cnt++;
-  ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  struct indirect_block *first, *second;
+  bool ok = true;
+  size_t i, k;
+
+  for (i = 0; i < DIRECT_BLOCK; i++)
+    if (d->sectors[i] != HOLE_SECTOR)
+      ok = collect_run (used, d->sectors[i], 1) && ok;
+  if (d->ib == HOLE_SECTOR)
+    return ok;
+  if (!collect_run (used, d->ib, 1))
+    return false;
+
+  first = malloc (sizeof *first);
+  second = malloc (sizeof *second);
+  if (first == NULL || second == NULL)
+    PANIC ("out of memory checking inode");
+  cache_read_meta (d->ib, first, 0, BLOCK_SECTOR_SIZE);
+  for (k = 0; k < 128; k++)
+    {
+      if (first->sectors[k] == HOLE_SECTOR)
+        continue;
+      if (!collect_run (used, first->sectors[k], 1))
+        {
+          ok = false;
+          continue;
+        }
+      cache_read_meta (first->sectors[k], second, 0, BLOCK_SECTOR_SIZE);
+      for (i = 0; i < 128; i++)
+        if (second->sectors[i] != HOLE_SECTOR)
+          ok = collect_run (used, second->sectors[i], 1) && ok;
+    }
+  free (first);
+  free (second);
+  return ok;
 }
 
-/* Re-enables writes to INODE.
-   Must be called once by each inode opener who has called
-   inode_deny_write() on the inode, before closing the inode. */
-void
-inode_allow_write (struct inode *inode) 
+/* Marks in USED the sectors of the extent-based inode D: its
+   data sectors and its extent_blocks.  Returns false if any was
+   invalid or already marked. */
+static bool
+extent_collect (const struct inode_disk *d, struct bitmap *used)
 {
-  ASSERT (inode->deny_write_cnt > 0);
-  ASSERT (inode->deny_write_cnt <= inode->open_cnt);
-  inode->deny_write_cnt--;
+  struct extent_block blk;
+  block_sector_t sector;
+  bool ok = true;
+  size_t i;
+
+  for (i = 0; i < d->extent_cnt && i < INLINE_EXTENTS; i++)
+    if (d->extents[i].start != HOLE_SECTOR)
+      ok = collect_run (used, d->extents[i].start,
+                        d->extents[i].length) && ok;
+
+  for (sector = d->overflow; sector != 0; sector = blk.next)
+    {
+      if (!collect_run (used, sector, 1))
+        return false;
+      cache_read_meta (sector, &blk, 0, BLOCK_SECTOR_SIZE);
+      if (blk.extent_cnt > BLOCK_EXTENTS)
+        return false;
+      for (i = 0; i < blk.extent_cnt; i++)
+        if (blk.extents[i].start != HOLE_SECTOR)
+          ok = collect_run (used, blk.extents[i].start,
+                            blk.extents[i].length) && ok;
+    }
+  return ok;
 }
 
-/* Returns the length, in bytes, of INODE's data. */
-off_t
-inode_length (const struct inode *inode)
+/* Marks in USED every sector that the inode in SECTOR occupies:
+   the inode itself, its data sectors, and the sectors that map
+   them, including sectors allocated past the end of file.  Sets
+   *IS_DIR to whether the inode is a directory.  Used by the file
+   system checker.
+   Returns false if SECTOR does not hold a valid inode, or if the
+   inode names a sector that is past the end of the disk or that
+   something else already claimed. */
+bool
+inode_collect (block_sector_t sector, struct bitmap *used, bool *is_dir)
 {
-  return inode->data.length;
+  struct inode_disk *d;
+  bool ok;
+
+  *is_dir = false;
+  if (!collect_run (used, sector, 1))
+    return false;
+
+  d = malloc (sizeof *d);
+  if (d == NULL)
+    PANIC ("out of memory checking inode");
+  cache_read_meta (sector, d, 0, BLOCK_SECTOR_SIZE);
+  if (d->magic == INLINE_MAGIC)
+    ok = d->length >= 0 && d->length <= INLINE_BYTES;
+  else if (d->magic == EXTENT_MAGIC || d->magic == COMPRESSED_MAGIC)
+    ok = d->length >= 0 && extent_collect (d, used);
+  else if (d->magic == INODE_MAGIC)
+    ok = d->length >= 0 && blockmap_collect (d, used);
+  else
+    ok = false;
+  *is_dir = ok && d->is_directory;
+  free (d);
+  return ok;
 }
 
 /* For SECTORS number of direct sectors, return 
@@ -438,64 +3780,728 @@ compute_total_sectors (size_t sectors)
   }
   else
   {
-    int second_level = ( sectors - DIRECT_BLOCK ) / 128;
+    int second_level = DIV_ROUND_UP ( sectors - DIRECT_BLOCK, 128 );
     int indirect_sectors = sectors - DIRECT_BLOCK;
     // Direct data + Indirect data + indirect IB (1st level: 1, 2nd level: second_level)
     return indirect_sectors + second_level + 1 + DIRECT_BLOCK;
   }
 }
 
-/* Create secotrs in disk with 2 level indirected block. */
-void
-write_sectors_to_disk( block_sector_t total_sectors, struct inode_disk *disk_inode )
+/* Sets aside CNT more free sectors for INODE's coming
+   allocations.  Returns false if fewer than CNT sectors are free
+   and not already reserved. */
+static bool
+reserve_sectors (struct inode *inode, size_t cnt)
 {
-  block_sector_t position;
-  int i, k;
+  if (!free_map_reserve (cnt))
+    return false;
+  inode->reserved += cnt;
+  return true;
+}
 
-  // data in direct data blocks
-  for( i = 0; i < total_sectors && i < DIRECT_BLOCK; i++ )
-  {
-    free_map_allocate(1, &position );
-    disk_inode->sectors[i] = position;
-  }
+/* Gives back the sectors reserved for INODE beyond KEEP, the
+   number it had before an operation reserved more. */
+static void
+unreserve_sectors (struct inode *inode, size_t keep)
+{
+  if (inode->reserved > keep)
+    {
+      free_map_unreserve (inode->reserved - keep);
+      inode->reserved = keep;
+    }
+}
 
-  // data in IB
-  if( i < total_sectors )
-  {
-    // get the first level IB's sector position and save it into inode->ib
-    struct indirect_block *first_level = calloc(1, sizeof (struct indirect_block));
-    free_map_allocate(1, &position );
-    disk_inode->ib = position;
-    i++;
-
-    // create the first_level IB
-    int ib_index = 0;
-    while ( i < total_sectors )
-    {
-      ASSERT (ib_index < 128);
-
-      struct indirect_block *second_level = calloc(1, sizeof (struct indirect_block));
-      free_map_allocate(1, &position );
-      first_level->sectors[ib_index] = position;
-      i++;
-   
-      // create the second_level IB
-      for( k = 0; (k < 128) && (i + k < total_sectors); k++ )
-      {
-        free_map_allocate(1, &position );
-        second_level->sectors[k] = position;
-      } 
+/* Allocates CNT consecutive sectors for INODE, preferably in the
+   block group of GOAL, as free_map_allocate_near() does, but from
+   the sectors reserved for INODE if it has that many.  Stores the
+   first sector in *SECTORP and returns true if successful. */
+static bool
+allocate_sectors (struct inode *inode, size_t cnt, block_sector_t goal,
+                  block_sector_t *sectorp)
+{
+  if (cnt > inode->reserved)
+    return free_map_allocate_near (cnt, goal, sectorp);
+  if (!free_map_allocate_reserved (cnt, goal, sectorp))
+    return false;
+  inode->reserved -= cnt;
+  return true;
+}
+
+/* Allocates a run of up to CNT consecutive sectors for INODE,
+   preferably in the block group of GOAL, halving the request
+   until the free map can satisfy it.  Stores the first sector in
+   *START and returns the number of sectors allocated, or 0 if
+   none are free. */
+static size_t
+allocate_run (struct inode *inode, size_t cnt, block_sector_t goal,
+              block_sector_t *start)
+{
+  while (cnt > 0 && !allocate_sectors (inode, cnt, goal, start))
+    cnt /= 2;
+  return cnt;
+}
+
+/* Points sector INDEX of block-mapped INODE at SECTOR, which may
+   be HOLE_SECTOR, allocating the indirect blocks needed to reach
+   it.  Returns false if an indirect block cannot be allocated. */
+static bool
+blockmap_set (struct inode *inode, block_sector_t index,
+              block_sector_t sector)
+{
+  struct inode_head *d = &inode->head;
+  block_sector_t first_ib_index, second_ib_index, second_ib;
+  size_t i;
 
-      i = i + k;
+  ASSERT (index < BLOCKMAP_SECTORS);
 
-      //write the second_level IB to disk
-      block_write (fs_device, first_level->sectors[ib_index], second_level);
-      free( second_level );
-      ib_index++;
+  // direct block
+  if (index < DIRECT_BLOCK)
+    {
+      if (index < HEAD_DIRECT)
+        d->direct[index] = sector;
+      journal_write (inode->sector, &sector,
+                     offsetof (struct inode_disk, sectors)
+                     + index * sizeof sector, sizeof sector);
+      return true;
     }
 
-    //write the first_level IB to disk
-    block_write (fs_device, disk_inode->ib, first_level);
-    free( first_level );
-  }
+  // first level ib
+  first_ib_index = (index - DIRECT_BLOCK) / 128;
+  second_ib_index = (index - DIRECT_BLOCK) % 128;
+  if (d->ib == HOLE_SECTOR)
+    {
+      if (!allocate_sectors (inode, 1, inode->sector, &d->ib))
+        {
+          d->ib = HOLE_SECTOR;
+          return false;
+        }
+      journal_zero (d->ib);
+      journal_write (inode->sector, &d->ib, offsetof (struct inode_disk, ib),
+                     sizeof d->ib);
+      ib_cache_invalidate (inode);
+    }
+
+  // second level ib
+  cache_read_meta (d->ib, &second_ib,
+                   first_ib_index * sizeof second_ib, sizeof second_ib);
+  if (second_ib == HOLE_SECTOR)
+    {
+      if (!allocate_sectors (inode, 1, inode->sector, &second_ib))
+        return false;
+      journal_zero (second_ib);
+      journal_write (d->ib, &second_ib,
+                     first_ib_index * sizeof second_ib, sizeof second_ib);
+      ib_cache_invalidate (inode);
+    }
+  journal_write (second_ib, &sector,
+                 second_ib_index * sizeof sector, sizeof sector);
+
+  /* Patch the cached copy of the second level ib, if any. */
+  lock_acquire (&inode->ib_lock);
+  if (inode->ib_cache != NULL)
+    for (i = 0; i < IB_CACHE_SIZE; i++)
+      if (inode->ib_cache->second[i].valid
+          && inode->ib_cache->second[i].index == first_ib_index)
+        inode->ib_cache->second[i].block.sectors[second_ib_index] = sector;
+  lock_release (&inode->ib_lock);
+  return true;
+}
+
+/* Allocates zeroed sectors for up to CNT sectors of block-mapped
+   INODE starting at index INDEX, which must be a hole, in one run
+   if the free map allows.  The first COVERED of them are about to
+   be overwritten entirely, so they are not zeroed.  Stops early
+   at the first sector that is already allocated.  Returns the
+   sector for INDEX, or HOLE_SECTOR if the disk is full. */
+static block_sector_t
+blockmap_fill (struct inode *inode, block_sector_t index, size_t cnt,
+               size_t covered)
+{
+  block_sector_t goal = inode->sector, start;
+  size_t run, k;
+
+  if (cnt > BLOCKMAP_SECTORS - index)
+    cnt = BLOCKMAP_SECTORS - index;
+  if (index > 0 && index_to_sector (inode, index - 1) != HOLE_SECTOR)
+    goal = index_to_sector (inode, index - 1) + 1;
+  run = allocate_run (inode, cnt, goal, &start);
+
+  for (k = 0; k < run; k++)
+    {
+      if (k > 0 && index_to_sector (inode, index + k) != HOLE_SECTOR)
+        break;
+      if (k >= covered)
+        cache_zero (start + k);
+      if (!blockmap_set (inode, index + k, start + k))
+        break;
+    }
+  if (k < run)
+    free_map_release (start + k, run - k);
+  if (k == 0)
+    return HOLE_SECTOR;
+
+  if (index + k > inode->alloc_end)
+    inode->alloc_end = index + k;
+  return start;
+}
+
+/* Releases the data sectors of block-mapped INODE past its end of
+   file. */
+static void
+blockmap_trim (struct inode *inode)
+{
+  struct release_batch batch;
+  block_sector_t index;
+
+  batch.cnt = 0;
+  for (index = bytes_to_sectors (inode->head.length);
+       index < inode->alloc_end; index++)
+    {
+      block_sector_t sector = index_to_sector (inode, index);
+      if (sector != HOLE_SECTOR)
+        {
+          blockmap_set (inode, index, HOLE_SECTOR);
+          batch_add (&batch, sector, 1);
+        }
+    }
+  free_map_release_many (batch.runs, batch.cnt);
+  inode->alloc_end = 0;
+}
+
+/* Adds the data and indirect sectors of the block-mapped
+   DISK_INODE to BATCH, skipping holes.  The whole map is walked,
+   since sectors allocated past the end of file may remain if the
+   file was never closed. */
+static void
+blockmap_release (const struct inode_disk *disk_inode,
+                  struct release_batch *batch)
+{
+  struct indirect_block *first, *second;
+  size_t i, k;
+
+  // direct block
+  for (i = 0; i < DIRECT_BLOCK; i++)
+    if (disk_inode->sectors[i] != HOLE_SECTOR)
+      batch_add (batch, disk_inode->sectors[i], 1);
+
+  if (disk_inode->ib == HOLE_SECTOR)
+    return;
+
+  first = malloc (sizeof *first);
+  second = malloc (sizeof *second);
+  if (first != NULL && second != NULL)
+    {
+      // walk the first level ib, then each second level ib
+      cache_read_meta (disk_inode->ib, first, 0, BLOCK_SECTOR_SIZE);
+      for (k = 0; k < 128; k++)
+        {
+          if (first->sectors[k] == HOLE_SECTOR)
+            continue;
+          cache_read_meta (first->sectors[k], second, 0,
+                           BLOCK_SECTOR_SIZE);
+          for (i = 0; i < 128; i++)
+            if (second->sectors[i] != HOLE_SECTOR)
+              batch_add (batch, second->sectors[i], 1);
+          batch_add (batch, first->sectors[k], 1);
+        }
+      batch_add (batch, disk_inode->ib, 1);
+    }
+  free (first);
+  free (second);
+}
+
+/* Releases the chain of extent_blocks starting at SECTOR, but
+   not the data they map. */
+static void
+chain_release (block_sector_t sector)
+{
+  while (sector != 0)
+    {
+      block_sector_t next;
+
+      cache_read_meta (sector, &next, offsetof (struct extent_block, next),
+                       sizeof next);
+      free_map_release (sector, 1);
+      sector = next;
+    }
+}
+
+/* Writes the extents of INODE from number FROM onward back to
+   disk, in the inode and its chain of extent_blocks, adding and
+   releasing extent_blocks as the number of extents requires.
+   Returns false, changing nothing on disk, if the extent_blocks
+   to add cannot be reserved or would make the chain longer than
+   EXTENT_BLOCKS_MAX, so the caller can put its extents back as
+   they were.  Cannot fail if the chain already has room for the
+   extents or INODE has enough sectors reserved. */
+static bool
+extent_store (struct inode *inode, size_t from)
+{
+  struct inode_head *d = &inode->head;
+  uint32_t cnt = inode->extent_cnt, stored;
+  struct extent_block blk;
+  block_sector_t sector, next;
+  size_t keep = inode->reserved, have, need = extent_blocks (cnt);
+  size_t base, i;
+  bool success = true;
+
+  /* Reserve the extent_blocks to add before writing anything. */
+  cache_read_meta (inode->sector, &stored,
+                   offsetof (struct inode_disk, extent_cnt), sizeof stored);
+  have = d->overflow != 0 ? extent_blocks (stored) : 0;
+  if (need > have && need > EXTENT_BLOCKS_MAX)
+    return false;
+  if (need > have + keep && !reserve_sectors (inode, need - have - keep))
+    return false;
+
+  /* The extents kept in the inode, gathered in BLK first. */
+  for (i = from; i < cnt && i < INLINE_EXTENTS; i++)
+    {
+      blk.extents[i - from].start = inode->extents[i].start;
+      blk.extents[i - from].length = inode->extents[i].length;
+    }
+  if (i > from)
+    journal_write (inode->sector, blk.extents,
+                   offsetof (struct inode_disk, extents)
+                   + from * sizeof *blk.extents,
+                   (i - from) * sizeof *blk.extents);
+
+  if (cnt <= INLINE_EXTENTS && d->overflow != 0)
+    {
+      chain_release (d->overflow);
+      d->overflow = 0;
+    }
+  else if (cnt > INLINE_EXTENTS && d->overflow == 0)
+    {
+      if (!allocate_sectors (inode, 1, inode->sector, &d->overflow))
+        {
+          d->overflow = 0;
+          return false;
+        }
+      journal_zero (d->overflow);
+    }
+
+  sector = cnt > INLINE_EXTENTS ? d->overflow : 0;
+  for (base = INLINE_EXTENTS; base < cnt; base += BLOCK_EXTENTS)
+    {
+      size_t end = cnt < base + BLOCK_EXTENTS ? cnt : base + BLOCK_EXTENTS;
+      bool dirty = false;
+
+      cache_read_meta (sector, &blk, 0, BLOCK_SECTOR_SIZE);
+      if (end > from)
+        {
+          for (i = from > base ? from : base; i < end; i++)
+            {
+              blk.extents[i - base].start = inode->extents[i].start;
+              blk.extents[i - base].length = inode->extents[i].length;
+            }
+          blk.extent_cnt = end - base;
+          dirty = true;
+        }
+      if (end < cnt && blk.next == 0)
+        {
+          if (!allocate_sectors (inode, 1, inode->sector, &next))
+            success = false;
+          else
+            {
+              journal_zero (next);
+              blk.next = next;
+              dirty = true;
+            }
+        }
+      else if (end == cnt && blk.next != 0)
+        {
+          /* Release extent_blocks no longer needed. */
+          chain_release (blk.next);
+          blk.next = 0;
+          dirty = true;
+        }
+      if (dirty)
+        journal_write (sector, &blk, 0, BLOCK_SECTOR_SIZE);
+      if (!success)
+        break;
+      sector = blk.next;
+    }
+
+  journal_write (inode->sector, &cnt, offsetof (struct inode_disk, extent_cnt),
+                 sizeof cnt);
+  journal_write (inode->sector, &d->overflow,
+                 offsetof (struct inode_disk, overflow), sizeof d->overflow);
+  head_store (inode);
+  unreserve_sectors (inode, keep);
+  return success;
+}
+
+/* Returns the position in INODE's extents of the extent that
+   holds data sector INDEX. */
+static size_t
+extent_find (struct inode *inode, block_sector_t index)
+{
+  size_t lo = 0, hi = inode->extent_cnt;
+
+  while (hi - lo > 1)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (inode->extents[mid].index <= index)
+        lo = mid;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+/* Allocates zeroed sectors for up to CNT sectors of
+   extent-based INODE starting at index INDEX, which must be a
+   hole, in one run if the free map allows, splitting the hole
+   extent around them.  The first COVERED of them are about to be
+   overwritten entirely, so they are not zeroed.  When the run directly follows the extent
+   before the hole on disk, that extent is lengthened instead, so
+   that a file filled in order keeps a single extent.  Returns the
+   sector for INDEX, or HOLE_SECTOR if the disk is full or memory
+   runs out. */
+static block_sector_t
+extent_fill (struct inode *inode, block_sector_t index, size_t cnt,
+             size_t covered)
+{
+  struct mapped_extent *m, *prev, old_m, old_prev;
+  block_sector_t sector, goal = inode->sector;
+  size_t pos = extent_find (inode, index), lo, run;
+  size_t old_pos = pos, old_cnt = inode->extent_cnt;
+  size_t keep = inode->reserved, meta = 0;
+
+  m = &inode->extents[pos];
+  ASSERT (m->start == HOLE_SECTOR);
+  ASSERT (index >= m->index && index < m->index + m->length);
+  if (cnt > m->index + m->length - index)
+    cnt = m->index + m->length - index;
+
+  /* Splitting may need one more extent_block.  Unless INODE has
+     sectors reserved already, set one aside for it, so that the
+     run cannot take the last free sector. */
+  if (extent_blocks (inode->extent_cnt + 2) > extent_blocks (inode->extent_cnt)
+      && keep == 0)
+    {
+      if (!free_map_reserve (1))
+        return HOLE_SECTOR;
+      meta = 1;
+    }
+
+  prev = pos > 0 ? &inode->extents[pos - 1] : NULL;
+  if (prev != NULL)
+    goal = prev->start + prev->length;
+  run = allocate_run (inode, cnt, goal, &sector);
+  if (run == 0)
+    {
+      free_map_unreserve (meta);
+      return HOLE_SECTOR;
+    }
+  for (lo = covered; lo < run; lo++)
+    cache_zero (sector + lo);
+  old_m = *m;
+  if (prev != NULL)
+    old_prev = *prev;
+
+  if (index == m->index && prev != NULL
+      && prev->start + prev->length == sector)
+    {
+      /* Grow the previous extent into the hole. */
+      prev->length += run;
+      m->index += run;
+      m->length -= run;
+      if (m->length == 0)
+        {
+          memmove (m, m + 1,
+                   (inode->extent_cnt - pos - 1) * sizeof *m);
+          inode->extent_cnt--;
+        }
+      pos--;
+    }
+  else
+    {
+      /* Split the hole into up to three extents. */
+      block_sector_t before = index - m->index;
+      block_sector_t after = m->length - before - run;
+      size_t added = (before > 0) + (after > 0);
+      struct mapped_extent *extents;
+
+      extents = realloc (inode->extents,
+                         (inode->extent_cnt + added) * sizeof *extents);
+      if (extents == NULL)
+        {
+          free_map_release (sector, run);
+          free_map_unreserve (meta);
+          return HOLE_SECTOR;
+        }
+      inode->extents = extents;
+      m = &extents[pos];
+      memmove (m + 1 + added, m + 1,
+               (inode->extent_cnt - pos - 1) * sizeof *m);
+      inode->extent_cnt += added;
+      if (before > 0)
+        {
+          m->length = before;
+          m++;
+        }
+      m->index = index;
+      m->start = sector;
+      m->length = run;
+      if (after > 0)
+        {
+          m[1].index = index + run;
+          m[1].start = HOLE_SECTOR;
+          m[1].length = after;
+        }
+    }
+
+  inode->reserved += meta;
+  if (!extent_store (inode, pos))
+    {
+      /* Put the hole back. */
+      extent_restore (inode, old_pos, &old_m, old_cnt);
+      if (old_pos > 0)
+        inode->extents[old_pos - 1] = old_prev;
+      free_map_release (sector, run);
+      sector = HOLE_SECTOR;
+    }
+  unreserve_sectors (inode, keep);
+  return sector;
+}
+
+/* Puts back OLD as extent POS of INODE, and OLD_CNT as its number
+   of extents, after a change to them that could not be stored,
+   moving the extents that followed OLD back into place.  The
+   change must have left INODE->extents room for OLD_CNT
+   extents. */
+static void
+extent_restore (struct inode *inode, size_t pos,
+                const struct mapped_extent *old, size_t old_cnt)
+{
+  struct mapped_extent *m = &inode->extents[pos];
+
+  memmove (m + 1, inode->extents + (pos + 1 + inode->extent_cnt - old_cnt),
+           (old_cnt - pos - 1) * sizeof *m);
+  *m = *old;
+  inode->extent_cnt = old_cnt;
+}
+
+/* Turns the CNT data sectors of extent-based INODE starting at
+   INDEX, which must lie in one extent that is not a hole, into a
+   hole, splitting the extent around them, and lets go of their
+   sectors through BATCH, unless BATCH is null, in which case the
+   caller must let go of them itself.  Returns false, changing
+   nothing, if memory or an extent_block cannot be allocated. */
+static bool
+extent_punch (struct inode *inode, block_sector_t index, size_t cnt,
+              struct release_batch *batch)
+{
+  size_t pos = extent_find (inode, index);
+  struct mapped_extent *m = &inode->extents[pos], *extents;
+  block_sector_t before = index - m->index;
+  block_sector_t after = m->length - before - cnt;
+  block_sector_t start = m->start + before;
+  size_t added = (before > 0) + (after > 0);
+
+  struct mapped_extent old = *m;
+  size_t old_cnt = inode->extent_cnt;
+
+  ASSERT (m->start != HOLE_SECTOR);
+  ASSERT (index >= m->index && before + cnt <= m->length);
+
+  extents = realloc (inode->extents,
+                     (inode->extent_cnt + added) * sizeof *extents);
+  if (extents == NULL)
+    return false;
+  inode->extents = extents;
+  m = &extents[pos];
+  memmove (m + 1 + added, m + 1, (inode->extent_cnt - pos - 1) * sizeof *m);
+  inode->extent_cnt += added;
+  if (before > 0)
+    {
+      m->length = before;
+      m++;
+    }
+  m->index = index;
+  m->start = HOLE_SECTOR;
+  m->length = cnt;
+  if (after > 0)
+    {
+      m[1].index = index + cnt;
+      m[1].start = start + cnt;
+      m[1].length = after;
+    }
+
+  if (!extent_store (inode, pos))
+    {
+      extent_restore (inode, pos, &old, old_cnt);
+      return false;
+    }
+  if (batch != NULL)
+    batch_add (batch, start, cnt);
+  return true;
+}
+
+/* Makes the extents of INODE cover at least SECTORS sectors,
+   adding a hole at the end if necessary.  Returns false if memory
+   or an extent_block cannot be allocated. */
+static bool
+extent_cover (struct inode *inode, size_t sectors)
+{
+  struct mapped_extent *last = NULL;
+  size_t covered = 0;
+
+  if (inode->extent_cnt > 0)
+    {
+      last = &inode->extents[inode->extent_cnt - 1];
+      covered = last->index + last->length;
+    }
+  if (covered >= sectors)
+    return true;
+
+  if (last != NULL && last->start == HOLE_SECTOR)
+    {
+      last->length += sectors - covered;
+      if (!extent_store (inode, inode->extent_cnt - 1))
+        {
+          last->length -= sectors - covered;
+          return false;
+        }
+    }
+  else
+    {
+      struct mapped_extent *extents;
+
+      extents = realloc (inode->extents,
+                         (inode->extent_cnt + 1) * sizeof *extents);
+      if (extents == NULL)
+        return false;
+      inode->extents = extents;
+      last = &extents[inode->extent_cnt++];
+      last->index = covered;
+      last->start = HOLE_SECTOR;
+      last->length = sectors - covered;
+      if (!extent_store (inode, inode->extent_cnt - 1))
+        {
+          inode->extent_cnt--;
+          return false;
+        }
+    }
+  return true;
+}
+
+/* Releases the sectors of extent-based INODE past its end of
+   file and shortens its extents to match.  Returns false,
+   changing nothing, if the shorter extents cannot be stored. */
+static bool
+extent_trim (struct inode *inode)
+{
+  block_sector_t end = bytes_to_sectors (inode->head.length), keep;
+  size_t pos = inode->extent_cnt, old_cnt = inode->extent_cnt, i;
+  struct release_batch batch;
+  struct mapped_extent old;
+
+  /* Find the first extent that reaches past END.  Only it can
+     keep part of its sectors. */
+  while (pos > 0 && (inode->extents[pos - 1].index
+                     + inode->extents[pos - 1].length) > end)
+    pos--;
+  if (pos == old_cnt)
+    return true;
+  old = inode->extents[pos];
+  keep = old.index < end ? end - old.index : 0;
+  inode->extents[pos].length = keep;
+  inode->extent_cnt = pos + (keep > 0);
+  if (!extent_store (inode, inode->extent_cnt > 0
+                            ? inode->extent_cnt - 1 : 0))
+    {
+      inode->extents[pos] = old;
+      inode->extent_cnt = old_cnt;
+      return false;
+    }
+
+  batch.cnt = 0;
+  if (old.start != HOLE_SECTOR)
+    batch_add (&batch, old.start + keep, old.length - keep);
+  for (i = pos + 1; i < old_cnt; i++)
+    if (inode->extents[i].start != HOLE_SECTOR)
+      batch_add (&batch, inode->extents[i].start, inode->extents[i].length);
+  free_map_release_many (batch.runs, batch.cnt);
+  return true;
+}
+
+
+/* Reads the extents of INODE, whose on-disk inode D must be
+   extent-based, into INODE->extents.  Returns false if memory
+   allocation fails. */
+static bool
+extent_load (struct inode *inode, const struct inode_disk *d)
+{
+  struct extent_block *blk = NULL;
+  block_sector_t sector = d->overflow;
+  block_sector_t index = 0;
+  size_t i;
+
+  inode->extent_cnt = d->extent_cnt;
+  if (d->extent_cnt == 0)
+    return true;
+  inode->extents = malloc (d->extent_cnt * sizeof *inode->extents);
+  if (inode->extents == NULL)
+    return false;
+
+  for (i = 0; i < d->extent_cnt; i++)
+    {
+      const struct extent *e;
+
+      if (i < INLINE_EXTENTS)
+        e = &d->extents[i];
+      else
+        {
+          size_t ofs = (i - INLINE_EXTENTS) % BLOCK_EXTENTS;
+          if (ofs == 0)
+            {
+              if (blk == NULL)
+                blk = malloc (sizeof *blk);
+              if (blk == NULL)
+                {
+                  free (inode->extents);
+                  inode->extents = NULL;
+                  return false;
+                }
+              if (i > INLINE_EXTENTS)
+                sector = blk->next;
+              cache_read_meta (sector, blk, 0, BLOCK_SECTOR_SIZE);
+            }
+          e = &blk->extents[ofs];
+        }
+      inode->extents[i].index = d->magic == COMPRESSED_MAGIC ? i : index;
+      inode->extents[i].start = e->start;
+      inode->extents[i].length = e->length;
+      index += e->length;
+    }
+  free (blk);
+  return true;
+}
+
+/* Adds the data sectors and extent_blocks of the extent-based
+   DISK_INODE to BATCH. */
+static void
+extent_release (const struct inode_disk *disk_inode,
+                struct release_batch *batch)
+{
+  struct extent_block blk;
+  block_sector_t sector;
+  size_t i;
+
+  for (i = 0; i < disk_inode->extent_cnt && i < INLINE_EXTENTS; i++)
+    if (disk_inode->extents[i].start != HOLE_SECTOR)
+      batch_add (batch, disk_inode->extents[i].start,
+                 disk_inode->extents[i].length);
+
+  for (sector = disk_inode->overflow; sector != 0; sector = blk.next)
+    {
+      cache_read_meta (sector, &blk, 0, BLOCK_SECTOR_SIZE);
+      for (i = 0; i < blk.extent_cnt; i++)
+        if (blk.extents[i].start != HOLE_SECTOR)
+          batch_add (batch, blk.extents[i].start, blk.extents[i].length);
+      batch_add (batch, sector, 1);
+    }
 }
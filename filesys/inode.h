@@ -2,22 +2,60 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <syscall-nr.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
 
 struct bitmap;
+struct dir_bloom;
+struct inode;
+
+extern bool inode_extents;
 
 void inode_init (void);
-bool inode_create (block_sector_t, off_t);
+void inode_print_stats (void);
+void inode_flush_releases (void);
+void inode_flush_delayed (void);
+bool inode_defrag (struct inode *, size_t min_runs, size_t *runs);
+bool inode_clone (struct inode *, block_sector_t);
+bool inode_set_compress (struct inode *, bool);
+bool inode_advise (struct inode *, off_t ofs, off_t len, int advice);
+bool inode_sync (struct inode *, bool data_only);
+bool inode_create (block_sector_t, off_t, bool is_dir);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
+off_t inode_readv_at (struct inode *, const struct iovec *, int cnt,
+                      off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+off_t inode_read_page (struct inode *, void *kpage, off_t size, off_t offset);
+off_t inode_read_pages (struct inode *, void *kpages[], size_t cnt,
+                        off_t offset);
+off_t inode_write_page (struct inode *, const void *kpage, off_t size,
+                        off_t offset);
+bool inode_truncate (struct inode *, off_t length);
+bool inode_allocate (struct inode *, off_t offset, off_t size);
+bool inode_preallocate (struct inode *, off_t end);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
+bool inode_is_dir (const struct inode *);
+bool inode_sector_is_dir (block_sector_t);
+bool inode_is_removed (const struct inode *);
+unsigned inode_write_gen (const struct inode *);
+unsigned inode_get_flags (const struct inode *);
+void inode_set_flags (struct inode *, unsigned flags);
+void inode_get_dir_info (const struct inode *, size_t *entry_cnt,
+                         size_t *free_slot);
+void inode_set_dir_info (struct inode *, size_t entry_cnt, size_t free_slot);
+void inode_dir_lock (struct inode *);
+void inode_dir_unlock (struct inode *);
+struct dir_bloom *inode_get_dir_bloom (struct inode *);
+void inode_set_dir_bloom (struct inode *, struct dir_bloom *);
 off_t inode_length (const struct inode *);
+bool inode_stat (struct inode *, struct stat *);
+bool inode_collect (block_sector_t, struct bitmap *used, bool *is_dir);
 
 #endif /* filesys/inode.h */
@@ -0,0 +1,498 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <hash.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/refcount.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Metadata journal.
+
+   Inode sectors, index and extent blocks, directory contents and
+   the free map are written through journal_write() instead of
+   cache_write().  Such a write goes into the buffer cache as
+   usual, but the cache entry is "logged": it is pinned in the
+   cache, out of reach of eviction and write-behind, until the
+   running transaction that it belongs to has been committed.
+   File data is not journaled.
+
+   The journal itself is a single slot of JOURNAL_SIZE sectors
+   starting at JOURNAL_SECTOR: a header that names the sectors of
+   one transaction, followed by their images.  Committing writes
+   the whole slot in one multi-sector write and then unpins the
+   entries, which are written home later by the cache like any
+   other dirty sector.  A crash before the slot is on disk loses
+   the transaction as a whole; a crash afterward is repaired at
+   the next boot by journal_recover(), which copies the images
+   home again.  The header's checksum covers the images, so that
+   a slot that was only partly written is not replayed.
+
+   Group commit: operations do not commit individually.  Each one
+   brackets its updates with journal_begin() and journal_end(),
+   and the flusher thread commits whatever has accumulated once
+   per write-behind interval, so that many operations share one
+   journal write.  A commit waits for the operations in progress
+   to end and holds off new ones until it is done, so that a
+   transaction never holds half an operation.
+
+   Credits: a transaction cannot be committed in the middle of an
+   operation, so an operation must know before it starts that the
+   transaction has room for it.  journal_begin() takes the number
+   of sectors the operation may add, and reserves them, first
+   committing the transaction or waiting for the operations in it
+   to end if the sectors logged, the free map and reference count
+   sectors waiting to be staged, and the credits of the
+   operations in progress leave too little room.  Each sector
+   that an operation logs for the first time uses one of its
+   credits.  An operation that finds out only midway how much it
+   has to log, such as a directory that has to be rehashed, asks
+   for more with journal_extend() and gives up cleanly if there is
+   no room.  One that runs out anyway draws on JOURNAL_SLACK; a
+   transaction that overflows even that panics, rather than
+   letting a metadata write bypass the journal.
+
+   Checkpointing is lazy.  Before a commit overwrites the slot,
+   the sectors of the previous transaction that are still dirty
+   are written home.  A sector that is logged again while it is
+   still dirty from a committed transaction is written home first
+   by the cache, because the journal copy of that version is
+   about to be lost.
+
+   Disks formatted without a journal have no FS_JOURNAL feature
+   in their superblock.  They are used unjournaled, with writes
+   going straight to the cache as before. */
+
+/* Identifies a journal header. */
+#define JOURNAL_MAGIC 0x4c4e524a
+
+/* On-disk journal header.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_header
+  {
+    unsigned magic;                     /* JOURNAL_MAGIC. */
+    unsigned seq;                       /* Transaction sequence number. */
+    unsigned cnt;                       /* Number of sectors logged. */
+    unsigned checksum;                  /* Of header and images. */
+    block_sector_t sectors[JOURNAL_MAX]; /* Home of each image. */
+    uint32_t unused[92];                /* Not used. */
+  };
+
+/* Is the journal in use? */
+static bool enabled;
+
+/* Handles.  A thread's nested journal_begin() calls count as one
+   handle, tracked in struct thread's journal_depth, with the
+   credits it has left in journal_credits. */
+static struct lock journal_lock;        /* Protects the members below. */
+static int handle_cnt;                  /* Outermost handles open. */
+static size_t reserved_cnt;             /* Credits left in all handles. */
+static bool committing;                 /* Commit in progress? */
+static struct condition may_begin;      /* Signaled when commit ends. */
+static struct condition handles_done;   /* Signaled when handle_cnt is 0. */
+
+/* Serializes commits. */
+static struct lock commit_lock;
+
+/* Staging area for the slot: header, then JOURNAL_MAX images. */
+static uint8_t *log_buf;
+
+/* Last committed transaction, whose sectors are checkpointed
+   before the slot is overwritten. */
+static unsigned seq;
+static block_sector_t prev_sectors[JOURNAL_MAX];
+static size_t prev_cnt;
+
+/* Statistics. */
+static unsigned long long commit_cnt;   /* Transactions committed. */
+static unsigned long long logged_cnt;   /* Sectors written to the journal. */
+static unsigned long long replay_cnt;   /* Sectors recovered at boot. */
+static unsigned long long commit_wait_cnt; /* Begins that had to commit. */
+static unsigned long long overrun_cnt;  /* Sectors logged without credit. */
+
+static size_t room (size_t limit);
+static void charge (void);
+static void use_credit (void);
+static void put_credits (void);
+static unsigned checksum (struct journal_header *);
+static void write_empty (void);
+
+/* Initializes the journal module.  Journaling remains disabled
+   until journal_format() or journal_recover() enables it. */
+void
+journal_init (void)
+{
+  size_t page_cnt = DIV_ROUND_UP (JOURNAL_SIZE * BLOCK_SECTOR_SIZE, PGSIZE);
+
+  ASSERT (sizeof (struct journal_header) == BLOCK_SECTOR_SIZE);
+
+  lock_init (&journal_lock);
+  lock_init (&commit_lock);
+  cond_init (&may_begin);
+  cond_init (&handles_done);
+  log_buf = palloc_get_multiple (PAL_ASSERT, page_cnt);
+}
+
+/* Writes an empty journal to a newly formatted disk and enables
+   journaling. */
+void
+journal_format (void)
+{
+  seq = 0;
+  write_empty ();
+  enabled = true;
+}
+
+/* Replays the transaction in the journal, if it was committed
+   completely, and enables journaling.  Leaves journaling disabled
+   on a disk without a journal.  Must run before anything else
+   reads the file system. */
+void
+journal_recover (void)
+{
+  struct journal_header *h = (struct journal_header *) log_buf;
+  unsigned sum;
+  size_t i;
+
+  block_read (fs_device, JOURNAL_SECTOR, h);
+  if (h->magic != JOURNAL_MAGIC || h->cnt > JOURNAL_MAX)
+    return;
+  seq = h->seq;
+  if (h->cnt > 0)
+    {
+      block_read_multiple (fs_device, JOURNAL_SECTOR + 1, h->cnt,
+                           log_buf + BLOCK_SECTOR_SIZE);
+      sum = h->checksum;
+      if (checksum (h) == sum)
+        {
+          for (i = 0; i < h->cnt; i++)
+            block_write (fs_device, h->sectors[i],
+                         log_buf + (i + 1) * BLOCK_SECTOR_SIZE);
+          replay_cnt += h->cnt;
+          printf ("journal: replayed transaction %u, %u sectors\n",
+                  h->seq, h->cnt);
+        }
+      write_empty ();
+    }
+  enabled = true;
+}
+
+/* Enables journaling on a disk that was cleanly unmounted, whose
+   journal is known to be empty, without reading it. */
+void
+journal_open (void)
+{
+  enabled = true;
+}
+
+/* Commits the running transaction, writes every dirty sector
+   home, empties the journal, and disables journaling. */
+void
+journal_done (void)
+{
+  if (!enabled)
+    return;
+  journal_commit ();
+  cache_flush ();
+  write_empty ();
+  prev_cnt = 0;
+  enabled = false;
+}
+
+/* Returns true if the file system is journaled. */
+bool
+journal_enabled (void)
+{
+  return enabled;
+}
+
+/* Starts an operation whose journaled writes must be committed
+   together, reserving CREDITS sectors of the running transaction
+   for it.  Commits the transaction first if it lacks the room, and
+   waits while a commit is in progress.  CREDITS above
+   JOURNAL_CREDITS_MAX count as JOURNAL_CREDITS_MAX.  Nested calls
+   by one thread join the outermost operation, whose credits must
+   cover theirs; CREDITS is ignored for them. */
+void
+journal_begin (size_t credits)
+{
+  struct thread *cur = thread_current ();
+
+  if (cur->journal_depth > 0)
+    {
+      cur->journal_depth++;
+      return;
+    }
+  if (credits > JOURNAL_CREDITS_MAX)
+    credits = JOURNAL_CREDITS_MAX;
+
+  lock_acquire (&journal_lock);
+  for (;;)
+    {
+      while (committing)
+        cond_wait (&may_begin, &journal_lock);
+      if (!enabled || room (JOURNAL_CREDITS_MAX) >= credits)
+        break;
+      commit_wait_cnt++;
+      lock_release (&journal_lock);
+      journal_commit ();
+      lock_acquire (&journal_lock);
+    }
+  handle_cnt++;
+  if (enabled)
+    {
+      reserved_cnt += credits;
+      cur->journal_credits = credits;
+    }
+  lock_release (&journal_lock);
+  cur->journal_depth = 1;
+}
+
+/* Makes sure that the running operation has at least CREDITS
+   credits left, taking what it lacks from the room left in the
+   running transaction.  Returns false, changing nothing, if the
+   transaction does not have that much room, in which case the
+   operation must leave the file system as it is.  Unlike
+   journal_begin(), never waits, since the transaction cannot be
+   committed while the operation is in it. */
+bool
+journal_extend (size_t credits)
+{
+  struct thread *cur = thread_current ();
+  bool success = true;
+
+  ASSERT (cur->journal_depth > 0);
+  if (!enabled || cur->journal_credits >= credits)
+    return true;
+
+  lock_acquire (&journal_lock);
+  if (room (JOURNAL_CREDITS_MAX) >= credits - cur->journal_credits)
+    {
+      reserved_cnt += credits - cur->journal_credits;
+      cur->journal_credits = credits;
+    }
+  else
+    success = false;
+  lock_release (&journal_lock);
+  return success;
+}
+
+/* Ends the operation started by the matching journal_begin(),
+   giving back the credits that it did not use. */
+void
+journal_end (void)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (cur->journal_depth > 0);
+  if (--cur->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  put_credits ();
+  if (--handle_cnt == 0 && committing)
+    cond_signal (&handles_done, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Writes SIZE bytes from BUFFER into metadata SECTOR at byte
+   offset OFS, as part of the running transaction. */
+void
+journal_write (block_sector_t sector, const void *buffer,
+               off_t ofs, off_t size)
+{
+  if (!enabled)
+    {
+      cache_write_meta (sector, buffer, ofs, size);
+      return;
+    }
+  journal_begin (1);
+  charge ();
+  if (cache_write_logged (sector, buffer, ofs, size))
+    use_credit ();
+  journal_end ();
+}
+
+/* Fills metadata SECTOR with zeros, as part of the running
+   transaction. */
+void
+journal_zero (block_sector_t sector)
+{
+  if (!enabled)
+    {
+      cache_zero_meta (sector);
+      return;
+    }
+  journal_begin (1);
+  charge ();
+  if (cache_zero_logged (sector))
+    use_credit ();
+  journal_end ();
+}
+
+/* Returns how many of the first LIMIT sectors of the running
+   transaction are neither logged, nor waiting in the free map or
+   the reference count table to be staged by the commit, nor
+   reserved by an operation in progress.  The caller must hold
+   journal_lock. */
+static size_t
+room (size_t limit)
+{
+  size_t used = (cache_logged_cnt () + free_map_dirty_cnt ()
+                 + refcount_dirty_cnt () + reserved_cnt);
+
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+  return used < limit ? limit - used : 0;
+}
+
+/* Makes sure that the running operation has a credit for the
+   sector it is about to log.  An operation that has used up its
+   credits gets one from JOURNAL_SLACK, as does the commit, whose
+   sectors were already counted.  Panics if the transaction is
+   full, since the write cannot be left out of it. */
+static void
+charge (void)
+{
+  struct thread *cur = thread_current ();
+
+  if (cur->journal_credits > 0)
+    return;
+  lock_acquire (&journal_lock);
+  if (room (JOURNAL_MAX) == 0)
+    PANIC ("journal transaction overflow");
+  reserved_cnt++;
+  cur->journal_credits++;
+  if (!lock_held_by_current_thread (&commit_lock))
+    overrun_cnt++;
+  lock_release (&journal_lock);
+}
+
+/* Uses one of the running operation's credits for a sector that
+   it has just logged. */
+static void
+use_credit (void)
+{
+  struct thread *cur = thread_current ();
+
+  lock_acquire (&journal_lock);
+  ASSERT (cur->journal_credits > 0);
+  cur->journal_credits--;
+  reserved_cnt--;
+  lock_release (&journal_lock);
+}
+
+/* Gives back the credits that the running thread has left.  The
+   caller must hold journal_lock. */
+static void
+put_credits (void)
+{
+  struct thread *cur = thread_current ();
+
+  reserved_cnt -= cur->journal_credits;
+  cur->journal_credits = 0;
+}
+
+/* Commits the running transaction: waits for the operations in
+   progress to end, stages the reference count table and the free
+   map, and writes the logged sectors to the journal.  With
+   journaling disabled, only writes their changed sectors into the
+   cache. */
+void
+journal_commit (void)
+{
+  struct journal_header *h = (struct journal_header *) log_buf;
+  struct thread *cur = thread_current ();
+  size_t cnt;
+
+  if (!enabled)
+    {
+      refcount_sync ();
+      free_map_sync ();
+      return;
+    }
+  ASSERT (cur->journal_depth == 0);
+
+  lock_acquire (&commit_lock);
+  lock_acquire (&journal_lock);
+  committing = true;
+  while (handle_cnt > 0)
+    cond_wait (&handles_done, &journal_lock);
+  lock_release (&journal_lock);
+
+  /* Nothing else is changing the file system now.  The
+     reference count table and then the free map, which writing
+     the table may change, are written as part of this thread's
+     own operation, which does not wait for the commit.  The
+     operations that changed them have already counted their
+     sectors against the transaction, so the operation has no
+     credits of its own. */
+  cur->journal_depth++;
+  refcount_sync ();
+  free_map_sync ();
+  cur->journal_depth--;
+  lock_acquire (&journal_lock);
+  put_credits ();
+  lock_release (&journal_lock);
+
+  cnt = cache_log_snapshot (h->sectors, log_buf + BLOCK_SECTOR_SIZE);
+  if (cnt > 0)
+    {
+      cache_checkpoint (prev_sectors, prev_cnt);
+
+      h->magic = JOURNAL_MAGIC;
+      h->seq = ++seq;
+      h->cnt = cnt;
+      memset (h->unused, 0, sizeof h->unused);
+      h->checksum = checksum (h);
+      block_write_multiple (fs_device, JOURNAL_SECTOR, cnt + 1, log_buf);
+      cache_log_release ();
+
+      memcpy (prev_sectors, h->sectors, cnt * sizeof *prev_sectors);
+      prev_cnt = cnt;
+      commit_cnt++;
+      logged_cnt += cnt;
+    }
+
+  lock_acquire (&journal_lock);
+  committing = false;
+  cond_broadcast (&may_begin, &journal_lock);
+  lock_release (&journal_lock);
+  lock_release (&commit_lock);
+}
+
+/* Returns the checksum of header H and the H->cnt images that
+   follow it in log_buf, leaving H->checksum zeroed. */
+static unsigned
+checksum (struct journal_header *h)
+{
+  h->checksum = 0;
+  return hash_bytes (log_buf, (h->cnt + 1) * BLOCK_SECTOR_SIZE);
+}
+
+/* Writes a journal header that holds no transaction. */
+static void
+write_empty (void)
+{
+  struct journal_header *h = (struct journal_header *) log_buf;
+
+  memset (h, 0, sizeof *h);
+  h->magic = JOURNAL_MAGIC;
+  h->seq = seq;
+  h->checksum = checksum (h);
+  block_write (fs_device, JOURNAL_SECTOR, h);
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void)
+{
+  printf ("Journal: %llu commits, %llu sectors logged, %llu replayed, "
+          "%llu early commits, %llu sectors over credit\n",
+          commit_cnt, logged_cnt, replay_cnt, commit_wait_cnt, overrun_cnt);
+}
@@ -0,0 +1,45 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+/* Most metadata sectors in one transaction. */
+#define JOURNAL_MAX 32
+
+/* Sectors occupied by the journal on disk: a header followed by
+   one image per logged sector. */
+#define JOURNAL_SIZE (JOURNAL_MAX + 1)
+
+/* Credits.  An operation reserves room in the running
+   transaction at journal_begin() for every metadata sector that
+   it may log and every free map sector that it may change.
+   JOURNAL_SLACK sectors of each transaction are never handed
+   out, for the commit's own writes and for operations that
+   overrun their estimate, so no operation may ask for more than
+   JOURNAL_CREDITS_MAX.  JOURNAL_CREDITS covers an operation on
+   one inode and one directory entry whose block maps do not
+   grow by more than a few sectors. */
+#define JOURNAL_SLACK 4
+#define JOURNAL_CREDITS_MAX (JOURNAL_MAX - JOURNAL_SLACK)
+#define JOURNAL_CREDITS 10
+
+void journal_init (void);
+void journal_format (void);
+void journal_recover (void);
+void journal_open (void);
+void journal_done (void);
+bool journal_enabled (void);
+
+void journal_begin (size_t credits);
+bool journal_extend (size_t credits);
+void journal_end (void);
+void journal_write (block_sector_t, const void *buffer, off_t ofs, off_t size);
+void journal_zero (block_sector_t);
+void journal_commit (void);
+
+void journal_print_stats (void);
+
+#endif /* filesys/journal.h */
@@ -0,0 +1,250 @@
+#include "filesys/refcount.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Sector reference counts.
+
+   Cloning a file makes the clone's extents name the same data
+   sectors as the original's.  Such a sector must not be freed
+   until the last file that names it lets go of it, and must be
+   copied before any of them writes to it.  The table kept here
+   counts, for every sector on the disk, the number of files that
+   name it besides the first: 0 for an ordinary sector, which is
+   the case for all but shared data sectors.
+
+   The table is a file, one byte per sector, whose inode sector
+   the superblock records.  The whole table is kept in memory.
+   Changed table sectors are written to the file by
+   refcount_sync(), which the journal calls while committing, so
+   the table on disk always agrees with the inodes that the same
+   transaction changed. */
+
+block_sector_t refcount_sector;
+
+static uint8_t *table;                  /* Extra references per sector. */
+static size_t table_pages;              /* Pages holding TABLE. */
+static struct bitmap *table_dirty;      /* Table sectors changed. */
+static struct inode *table_inode;       /* The table file. */
+static uint8_t *sync_buf;               /* One table sector, for sync. */
+static struct lock refcount_lock;       /* Protects the above. */
+
+/* Number of sectors with a nonzero count.  Read without the lock
+   as a shortcut: a sector being released cannot be shared at the
+   same time, because sharing it needs an open inode for it. */
+static size_t shared_cnt;
+
+/* Statistics. */
+static unsigned long long share_cnt;    /* Sectors shared. */
+static unsigned long long drop_cnt;     /* Shared sectors let go. */
+static unsigned long long table_write_cnt; /* Table sectors written. */
+
+static void allocate_table (void);
+
+/* Initializes the reference count module.  Sharing remains
+   unavailable until refcount_create() or refcount_open(). */
+void
+refcount_init (void)
+{
+  lock_init (&refcount_lock);
+}
+
+/* Allocates the in-memory table and its dirty bitmap. */
+static void
+allocate_table (void)
+{
+  size_t size = block_size (fs_device);
+
+  ASSERT (table == NULL);
+
+  table_pages = DIV_ROUND_UP (size, PGSIZE);
+  table = palloc_get_multiple (PAL_ZERO, table_pages);
+  table_dirty = bitmap_create (DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE));
+  sync_buf = malloc (BLOCK_SECTOR_SIZE);
+  if (table == NULL || table_dirty == NULL || sync_buf == NULL)
+    PANIC ("reference count table allocation failed--device is too large");
+}
+
+/* Creates an empty reference count table while formatting, opens
+   it, and returns its inode sector for the superblock. */
+block_sector_t
+refcount_create (void)
+{
+  block_sector_t sector;
+
+  if (!free_map_allocate (1, &sector)
+      || !inode_create (sector, block_size (fs_device), false))
+    PANIC ("reference count table creation failed");
+  refcount_open (sector);
+  return sector;
+}
+
+/* Opens the reference count table whose inode is in SECTOR and
+   reads it into memory. */
+void
+refcount_open (block_sector_t sector)
+{
+  size_t size = block_size (fs_device);
+
+  allocate_table ();
+  table_inode = inode_open (sector);
+  if (table_inode == NULL
+      || inode_read_at (table_inode, table, size, 0) != (off_t) size)
+    PANIC ("can't read reference count table");
+  refcount_sector = sector;
+
+  shared_cnt = 0;
+  for (sector = 0; sector < size; sector++)
+    if (table[sector] > 0)
+      shared_cnt++;
+}
+
+/* Writes the changed sectors of the reference count table to its
+   file, as part of the running transaction. */
+void
+refcount_sync (void)
+{
+  size_t size = block_size (fs_device);
+  size_t i;
+
+  if (table_inode == NULL)
+    return;
+  for (i = 0; i < bitmap_size (table_dirty); i++)
+    {
+      size_t ofs = i * BLOCK_SECTOR_SIZE;
+      size_t len = size - ofs < BLOCK_SECTOR_SIZE ? size - ofs
+                                                  : BLOCK_SECTOR_SIZE;
+      bool dirty;
+
+      lock_acquire (&refcount_lock);
+      dirty = bitmap_test (table_dirty, i);
+      bitmap_reset (table_dirty, i);
+      if (dirty)
+        memcpy (sync_buf, table + ofs, len);
+      lock_release (&refcount_lock);
+      if (dirty)
+        {
+          if (inode_write_at (table_inode, sync_buf, len, ofs) != (off_t) len)
+            PANIC ("can't write reference count table");
+          table_write_cnt++;
+        }
+    }
+}
+
+/* Returns the number of table sectors that the next
+   refcount_sync() will write. */
+size_t
+refcount_dirty_cnt (void)
+{
+  size_t cnt;
+
+  if (table_inode == NULL)
+    return 0;
+  lock_acquire (&refcount_lock);
+  cnt = bitmap_count (table_dirty, 0, bitmap_size (table_dirty), true);
+  lock_release (&refcount_lock);
+  return cnt;
+}
+
+/* Writes out and closes the reference count table. */
+void
+refcount_close (void)
+{
+  if (table_inode == NULL)
+    return;
+  refcount_sync ();
+  inode_close (table_inode);
+  table_inode = NULL;
+  refcount_sector = 0;
+  palloc_free_multiple (table, table_pages);
+  table = NULL;
+  bitmap_destroy (table_dirty);
+  free (sync_buf);
+}
+
+/* Records one more file naming each of the CNT sectors starting
+   at SECTOR.  Returns false, changing nothing, if the file system
+   has no reference count table or if one of the sectors is
+   already shared by as many files as the table can count. */
+bool
+refcount_share (block_sector_t sector, size_t cnt)
+{
+  size_t i;
+
+  if (table == NULL)
+    return false;
+  ASSERT (sector + cnt <= block_size (fs_device));
+
+  lock_acquire (&refcount_lock);
+  for (i = 0; i < cnt; i++)
+    if (table[sector + i] == UINT8_MAX)
+      {
+        lock_release (&refcount_lock);
+        return false;
+      }
+  for (i = 0; i < cnt; i++)
+    if (table[sector + i]++ == 0)
+      shared_cnt++;
+  bitmap_set_multiple (table_dirty, sector / BLOCK_SECTOR_SIZE,
+                       (sector + cnt - 1) / BLOCK_SECTOR_SIZE
+                       - sector / BLOCK_SECTOR_SIZE + 1, true);
+  share_cnt += cnt;
+  lock_release (&refcount_lock);
+  return true;
+}
+
+/* Returns true if more than one file names SECTOR. */
+bool
+refcount_shared (block_sector_t sector)
+{
+  bool shared;
+
+  if (shared_cnt == 0)
+    return false;
+  lock_acquire (&refcount_lock);
+  shared = table[sector] > 0;
+  lock_release (&refcount_lock);
+  return shared;
+}
+
+/* Called when a file stops naming SECTOR.  If another file still
+   names it, records one file fewer and returns true.  Otherwise,
+   returns false, and the caller should free SECTOR. */
+bool
+refcount_drop (block_sector_t sector)
+{
+  bool shared;
+
+  if (shared_cnt == 0)
+    return false;
+  lock_acquire (&refcount_lock);
+  shared = table[sector] > 0;
+  if (shared)
+    {
+      if (--table[sector] == 0)
+        shared_cnt--;
+      bitmap_mark (table_dirty, sector / BLOCK_SECTOR_SIZE);
+      drop_cnt++;
+    }
+  lock_release (&refcount_lock);
+  return shared;
+}
+
+/* Prints reference count statistics. */
+void
+refcount_print_stats (void)
+{
+  printf ("Shared sectors: %zu now, %llu shared, %llu let go, "
+          "%llu table sectors written\n",
+          shared_cnt, share_cnt, drop_cnt, table_write_cnt);
+}
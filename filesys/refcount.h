@@ -0,0 +1,25 @@
+#ifndef FILESYS_REFCOUNT_H
+#define FILESYS_REFCOUNT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Inode sector of the reference count table, or 0 if the file
+   system has none and files cannot share sectors. */
+extern block_sector_t refcount_sector;
+
+void refcount_init (void);
+block_sector_t refcount_create (void);
+void refcount_open (block_sector_t);
+void refcount_sync (void);
+size_t refcount_dirty_cnt (void);
+void refcount_close (void);
+
+bool refcount_share (block_sector_t, size_t cnt);
+bool refcount_shared (block_sector_t);
+bool refcount_drop (block_sector_t);
+
+void refcount_print_stats (void);
+
+#endif /* filesys/refcount.h */
@@ -3,6 +3,8 @@
 #include <limits.h>
 #include <round.h>
 #include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
 #ifdef FILESYS
 #include "filesys/file.h"
@@ -28,8 +30,27 @@ struct bitmap
   {
     size_t bit_cnt;     /* Number of bits. */
     elem_type *bits;    /* Elements that represent bits. */
+    elem_type *any_zero; /* Summary: group has a 0 bit, or null. */
+    elem_type *any_one;  /* Summary: group has a 1 bit, or null. */
   };
 
+/* A hierarchical bitmap, one created by bitmap_create_summary()
+   or bitmap_create_summary_in_buf(), also keeps two summary
+   bitmaps with one bit per group of SUMMARY_ELEMS elements: in
+   ANY_ZERO, whether any bit in the group is 0, and in ANY_ONE,
+   whether any is 1.  Searches skip whole groups that cannot
+   match, so finding the first free bit in a nearly full map, or
+   checking that a long run is free, touches a summary word per
+   SUMMARY_ELEMS * ELEM_BITS * ELEM_BITS bits instead of every
+   element.
+
+   Keeping the summaries exact costs a group scan whenever an
+   element becomes all 0s or all 1s.  Each summary update runs
+   with interrupts off and recomputes from the bits as they are
+   then, so updates stay as safe as the single-bit operations on
+   a uniprocessor machine. */
+#define SUMMARY_ELEMS 32
+
 /* Returns the index of the element that contains the bit
    numbered BIT_IDX. */
 static inline size_t
@@ -38,6 +59,13 @@ elem_idx (size_t bit_idx)
   return bit_idx / ELEM_BITS;
 }
 
+/* Returns the number of summary groups for BIT_CNT bits. */
+static inline size_t
+group_cnt (size_t bit_cnt)
+{
+  return DIV_ROUND_UP (DIV_ROUND_UP (bit_cnt, ELEM_BITS), SUMMARY_ELEMS);
+}
+
 /* Returns an elem_type where only the bit corresponding to
    BIT_IDX is turned on. */
 static inline elem_type
@@ -68,6 +96,164 @@ last_mask (const struct bitmap *b)
   int last_bits = b->bit_cnt % ELEM_BITS;
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Returns the number of 1-bits in X.
+   Assumes that elem_type is 32 bits wide, as on the 80x86.  This
+   avoids __builtin_popcount, which needs libgcc without POPCNT. */
+static inline size_t
+elem_popcount (elem_type x)
+{
+  x = x - ((x >> 1) & 0x55555555);
+  x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+  x = (x + (x >> 4)) & 0x0f0f0f0f;
+  return (x * 0x01010101) >> 24;
+}
+
+/* Returns the bits of element IDX of B that are set to VALUE,
+   restricted to the bits numbered START through END - 1, as an
+   element in which a 1-bit marks a match. */
+static inline elem_type
+elem_matches (const struct bitmap *b, size_t idx, size_t start, size_t end,
+              bool value)
+{
+  elem_type x = value ? b->bits[idx] : ~b->bits[idx];
+  size_t first = idx * ELEM_BITS;
+
+  if (start > first)
+    x &= (elem_type) -1 << (start - first);
+  if (end < first + ELEM_BITS)
+    x &= ((elem_type) 1 << (end - first)) - 1;
+  return x;
+}
+
+/* Returns the first group at or after GROUP whose bit is set in
+   SUMMARY, one of B's summary bitmaps, or the number of groups if
+   there is none. */
+static size_t
+next_group (const struct bitmap *b, const elem_type *summary, size_t group)
+{
+  size_t groups = group_cnt (b->bit_cnt);
+  size_t idx;
+
+  for (idx = elem_idx (group); idx * ELEM_BITS < groups; idx++)
+    {
+      elem_type x = summary[idx];
+      if (idx == elem_idx (group))
+        x &= (elem_type) -1 << (group % ELEM_BITS);
+      if (x != 0)
+        return idx * ELEM_BITS + __builtin_ctzl (x);
+    }
+  return groups;
+}
+
+/* Returns the index of the first bit in B between START and END,
+   exclusive, that is set to VALUE, or END if there is none.
+   Works a whole element at a time, and in a hierarchical bitmap
+   skips groups that have no bit set to VALUE. */
+static size_t
+find_next (const struct bitmap *b, size_t start, size_t end, bool value)
+{
+  const elem_type *summary = value ? b->any_one : b->any_zero;
+  size_t idx;
+
+  for (idx = elem_idx (start); start < end && idx * ELEM_BITS < end; idx++)
+    {
+      elem_type x;
+
+      if (summary != NULL
+          && (idx == elem_idx (start) || idx % SUMMARY_ELEMS == 0))
+        {
+          size_t group = next_group (b, summary, idx / SUMMARY_ELEMS);
+          if (group * SUMMARY_ELEMS > idx)
+            {
+              idx = group * SUMMARY_ELEMS;
+              if (idx * ELEM_BITS >= end)
+                break;
+            }
+        }
+      x = elem_matches (b, idx, start, end, value);
+      if (x != 0)
+        return idx * ELEM_BITS + __builtin_ctzl (x);
+    }
+  return end;
+}
+
+/* Recomputes the summary bits of B's group GROUP from its
+   elements.  B must be hierarchical. */
+static void
+summarize_group (struct bitmap *b, size_t group)
+{
+  size_t first = group * SUMMARY_ELEMS;
+  size_t last = elem_cnt (b->bit_cnt) - 1;
+  size_t end = first + SUMMARY_ELEMS;
+  elem_type ones = 0, zeros = 0;
+  size_t idx;
+
+  if (end > last + 1)
+    end = last + 1;
+  for (idx = first; idx < end; idx++)
+    {
+      elem_type mask = idx == last ? last_mask (b) : (elem_type) -1;
+      ones |= b->bits[idx] & mask;
+      zeros |= ~b->bits[idx] & mask;
+    }
+
+  if (zeros != 0)
+    b->any_zero[elem_idx (group)] |= bit_mask (group);
+  else
+    b->any_zero[elem_idx (group)] &= ~bit_mask (group);
+  if (ones != 0)
+    b->any_one[elem_idx (group)] |= bit_mask (group);
+  else
+    b->any_one[elem_idx (group)] &= ~bit_mask (group);
+}
+
+/* Updates the summaries of hierarchical bitmap B after a change
+   to the element holding bit BIT_IDX.  Only an element that is
+   now all 0s or all 1s can clear a summary bit, so only then is
+   the whole group rescanned. */
+static void
+summarize_bit (struct bitmap *b, size_t bit_idx)
+{
+  size_t idx = elem_idx (bit_idx);
+  size_t group = idx / SUMMARY_ELEMS;
+  elem_type mask = (idx == elem_cnt (b->bit_cnt) - 1
+                    ? last_mask (b) : (elem_type) -1);
+  enum intr_level old_level = intr_disable ();
+  elem_type x = b->bits[idx] & mask;
+
+  if (x == 0 || x == mask)
+    summarize_group (b, group);
+  else
+    {
+      b->any_zero[elem_idx (group)] |= bit_mask (group);
+      b->any_one[elem_idx (group)] |= bit_mask (group);
+    }
+  intr_set_level (old_level);
+}
+
+/* Recomputes the summaries of hierarchical bitmap B's groups
+   FIRST through LAST, inclusive. */
+static void
+summarize_groups (struct bitmap *b, size_t first, size_t last)
+{
+  size_t group;
+
+  for (group = first; group <= last; group++)
+    {
+      enum intr_level old_level = intr_disable ();
+      summarize_group (b, group);
+      intr_set_level (old_level);
+    }
+}
+
+/* Recomputes all of hierarchical bitmap B's summaries. */
+static void
+summarize_all (struct bitmap *b)
+{
+  if (b->bit_cnt > 0)
+    summarize_groups (b, 0, group_cnt (b->bit_cnt) - 1);
+}
 
 /* Creation and destruction. */
 
@@ -83,6 +269,7 @@ bitmap_create (size_t bit_cnt)
     {
       b->bit_cnt = bit_cnt;
       b->bits = malloc (byte_cnt (bit_cnt));
+      b->any_zero = b->any_one = NULL;
       if (b->bits != NULL || bit_cnt == 0)
         {
           bitmap_set_all (b, false);
@@ -105,6 +292,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 
   b->bit_cnt = bit_cnt;
   b->bits = (elem_type *) (b + 1);
+  b->any_zero = b->any_one = NULL;
   bitmap_set_all (b, false);
   return b;
 }
@@ -117,6 +305,61 @@ bitmap_buf_size (size_t bit_cnt)
   return sizeof (struct bitmap) + byte_cnt (bit_cnt);
 }
 
+/* Creates and returns a hierarchical bitmap of BIT_CNT bits, all
+   set to false, or a null pointer if memory allocation failed.
+   See the comment on SUMMARY_ELEMS for when to use one. */
+struct bitmap *
+bitmap_create_summary (size_t bit_cnt)
+{
+  struct bitmap *b = bitmap_create (bit_cnt);
+  if (b != NULL && bit_cnt > 0)
+    {
+      size_t summary_size = byte_cnt (group_cnt (bit_cnt));
+      b->any_zero = malloc (summary_size);
+      b->any_one = malloc (summary_size);
+      if (b->any_zero == NULL || b->any_one == NULL)
+        {
+          bitmap_destroy (b);
+          return NULL;
+        }
+      memset (b->any_zero, 0, summary_size);
+      memset (b->any_one, 0, summary_size);
+      summarize_all (b);
+    }
+  return b;
+}
+
+/* Creates and returns a hierarchical bitmap with BIT_CNT bits in
+   the BLOCK_SIZE bytes of storage preallocated at BLOCK.
+   BLOCK_SIZE must be at least bitmap_summary_buf_size(BIT_CNT). */
+struct bitmap *
+bitmap_create_summary_in_buf (size_t bit_cnt, void *block,
+                              size_t block_size UNUSED)
+{
+  struct bitmap *b = block;
+  size_t summary_size = byte_cnt (group_cnt (bit_cnt));
+
+  ASSERT (block_size >= bitmap_summary_buf_size (bit_cnt));
+
+  b->bit_cnt = bit_cnt;
+  b->bits = (elem_type *) (b + 1);
+  b->any_zero = b->bits + elem_cnt (bit_cnt);
+  b->any_one = b->any_zero + elem_cnt (group_cnt (bit_cnt));
+  memset (b->any_zero, 0, summary_size);
+  memset (b->any_one, 0, summary_size);
+  bitmap_set_all (b, false);
+  return b;
+}
+
+/* Returns the number of bytes required to accomodate a
+   hierarchical bitmap with BIT_CNT bits (for use with
+   bitmap_create_summary_in_buf()). */
+size_t
+bitmap_summary_buf_size (size_t bit_cnt)
+{
+  return bitmap_buf_size (bit_cnt) + 2 * byte_cnt (group_cnt (bit_cnt));
+}
+
 /* Destroys bitmap B, freeing its storage.
    Not for use on bitmaps created by
    bitmap_create_preallocated(). */
@@ -126,6 +369,8 @@ bitmap_destroy (struct bitmap *b)
   if (b != NULL) 
     {
       free (b->bits);
+      free (b->any_zero);
+      free (b->any_one);
       free (b);
     }
 }
@@ -153,9 +398,10 @@ bitmap_set (struct bitmap *b, size_t idx, bool value)
     bitmap_reset (b, idx);
 }
 
-/* Atomically sets the bit numbered BIT_IDX in B to true. */
-void
-bitmap_mark (struct bitmap *b, size_t bit_idx) 
+/* Atomically sets the bit numbered BIT_IDX in B to true, without
+   updating summaries. */
+static inline void
+mark_bit (struct bitmap *b, size_t bit_idx)
 {
   size_t idx = elem_idx (bit_idx);
   elem_type mask = bit_mask (bit_idx);
@@ -166,9 +412,10 @@ bitmap_mark (struct bitmap *b, size_t bit_idx)
   asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
 }
 
-/* Atomically sets the bit numbered BIT_IDX in B to false. */
-void
-bitmap_reset (struct bitmap *b, size_t bit_idx) 
+/* Atomically sets the bit numbered BIT_IDX in B to false, without
+   updating summaries. */
+static inline void
+reset_bit (struct bitmap *b, size_t bit_idx)
 {
   size_t idx = elem_idx (bit_idx);
   elem_type mask = bit_mask (bit_idx);
@@ -179,6 +426,24 @@ bitmap_reset (struct bitmap *b, size_t bit_idx)
   asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
 }
 
+/* Atomically sets the bit numbered BIT_IDX in B to true. */
+void
+bitmap_mark (struct bitmap *b, size_t bit_idx) 
+{
+  mark_bit (b, bit_idx);
+  if (b->any_zero != NULL)
+    summarize_bit (b, bit_idx);
+}
+
+/* Atomically sets the bit numbered BIT_IDX in B to false. */
+void
+bitmap_reset (struct bitmap *b, size_t bit_idx) 
+{
+  reset_bit (b, bit_idx);
+  if (b->any_zero != NULL)
+    summarize_bit (b, bit_idx);
+}
+
 /* Atomically toggles the bit numbered IDX in B;
    that is, if it is true, makes it false,
    and if it is false, makes it true. */
@@ -192,6 +457,8 @@ bitmap_flip (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the XOR instruction in [IA32-v2b]. */
   asm ("xorl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  if (b->any_zero != NULL)
+    summarize_bit (b, bit_idx);
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -224,8 +491,23 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
+  if (b->any_zero == NULL)
+    {
+      for (i = 0; i < cnt; i++)
+        bitmap_set (b, start + i, value);
+      return;
+    }
+
+  /* In a hierarchical bitmap, set the bits without touching the
+     summaries, then summarize each group they span once. */
   for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+    if (value)
+      mark_bit (b, start + i);
+    else
+      reset_bit (b, start + i);
+  if (cnt > 0)
+    summarize_groups (b, elem_idx (start) / SUMMARY_ELEMS,
+                      elem_idx (start + cnt - 1) / SUMMARY_ELEMS);
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -233,16 +515,16 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i, value_cnt;
+  size_t idx, end, value_cnt;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
+  end = start + cnt;
   value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
+  for (idx = elem_idx (start); cnt > 0 && idx * ELEM_BITS < end; idx++)
+    value_cnt += elem_popcount (elem_matches (b, idx, start, end, value));
   return value_cnt;
 }
 
@@ -251,16 +533,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_next (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -302,10 +579,26 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   if (cnt <= b->bit_cnt) 
     {
       size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t i = start;
+
+      if (cnt == 0)
+        return start;
+
+      /* Jump to the next bit set to VALUE, then check whether the
+         run starting there is long enough.  If not, resume the
+         search after the bit that cut the run short. */
+      while (i <= last)
+        {
+          size_t end;
+
+          i = find_next (b, i, b->bit_cnt, value);
+          if (i > last)
+            break;
+          end = find_next (b, i, i + cnt, !value);
+          if (end == i + cnt)
+            return i;
+          i = end;
+        }
     }
   return BITMAP_ERROR;
 }
@@ -348,6 +641,8 @@ bitmap_read (struct bitmap *b, struct file *file)
 
       success = file_read_at (file, b->bits, size, 0) == size;
       b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+      if (b->any_zero != NULL)
+        summarize_all (b);
     }
   return success;
 }
@@ -360,6 +655,23 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the SIZE bytes starting at byte offset OFS of B's file
+   image to the same place in FILE, clipped to the end of B.
+   Return true if successful, false otherwise. */
+bool
+bitmap_write_part (const struct bitmap *b, struct file *file,
+                   size_t ofs, size_t size)
+{
+  size_t total = byte_cnt (b->bit_cnt);
+
+  if (ofs >= total)
+    return true;
+  if (size > total - ofs)
+    size = total - ofs;
+  return (file_write_at (file, (uint8_t *) b->bits + ofs, size, ofs)
+          == (off_t) size);
+}
 #endif /* FILESYS */
 
 /* Debugging. */
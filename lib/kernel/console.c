@@ -5,10 +5,14 @@
 #include "threads/init.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include <console.h>
 
 static void vprintf_helper (char, void *);
 static void putchar_have_lock (uint8_t c);
+static void log_putc (uint8_t c);
+static void drain_log (void);
+static thread_func console_daemon NO_RETURN;
 
 /* The console lock.
    Both the vga and serial layers do their own locking, so it's
@@ -59,6 +63,30 @@ static int console_lock_depth;
 /* Number of characters written to console. */
 static int64_t write_cnt;
 
+/* Log buffer.
+
+   Once console_start() has been called, output is not written
+   to the vga display and serial port as it is produced, which
+   would make every printf() wait for the serial port.  Instead,
+   it is appended to this ring buffer, which the low-priority
+   "console" thread drains whenever nothing else wants to run.
+   A writer that finds the buffer full drains it itself; one that
+   cannot block (in an interrupt handler or with interrupts off)
+   drops the character instead.
+
+   LOG_HEAD and LOG_TAIL count the characters ever appended to
+   and removed from the buffer, so that their difference is the
+   number buffered.  Both are updated with interrupts off.  Only
+   the holder of DRAIN_LOCK removes characters, which keeps the
+   output in order. */
+#define LOG_SIZE 8192           /* Size of log buffer, a power of 2. */
+static char log_buf[LOG_SIZE];
+static size_t log_head, log_tail;
+static bool use_log;            /* Buffer output? */
+static struct semaphore log_sema; /* Upped when output arrives. */
+static struct lock drain_lock;  /* Held while draining the buffer. */
+static int64_t drop_cnt;        /* Characters dropped. */
+
 /* Enable console locking. */
 void
 console_init (void) 
@@ -67,6 +95,42 @@ console_init (void)
   use_console_lock = true;
 }
 
+/* Starts buffering console output in the log buffer.  Must be
+   called after the thread system has started. */
+void
+console_start (void) 
+{
+  sema_init (&log_sema, 0);
+  lock_init (&drain_lock);
+  thread_create ("console", PRI_MIN, console_daemon, NULL);
+  use_log = true;
+}
+
+/* Writes out everything in the log buffer, and waits for the
+   serial port to transmit it.  A caller that cannot block, in an
+   interrupt handler or with interrupts off, drains the buffer only
+   if no thread holds drain_lock: with interrupts off, none can
+   take it meanwhile, and if one holds it already, it has taken a
+   chunk that must come out before the rest, so the rest is left
+   to it.  After a panic the buffer is drained regardless. */
+void
+console_flush (void) 
+{
+  if (!use_log)
+    ;
+  else if (!use_console_lock)
+    drain_log ();
+  else if (!intr_context () && intr_get_level () == INTR_ON)
+    {
+      lock_acquire (&drain_lock);
+      drain_log ();
+      lock_release (&drain_lock);
+    }
+  else if (drain_lock.holder == NULL)
+    drain_log ();
+  serial_flush ();
+}
+
 /* Notifies the console that a kernel panic is underway,
    which warns it to avoid trying to take the console lock from
    now on. */
@@ -80,14 +144,45 @@ console_panic (void)
 void
 console_print_stats (void) 
 {
-  printf ("Console: %lld characters output\n", write_cnt);
+  printf ("Console: %lld characters output, %lld dropped\n",
+          write_cnt, drop_cnt);
+}
+
+/* Runs FUNC with the running thread's console output stored in
+   the SIZE bytes at BUF instead of being printed, and returns the
+   number of bytes stored.  Output past SIZE bytes is discarded.
+   Output from interrupt handlers and other threads is printed as
+   usual, and the console lock is not taken, so FUNC may block. */
+size_t
+console_capture (void (*func) (void), char *buf, size_t size)
+{
+  struct thread *t = thread_current ();
+  struct console_capture c, *outer = t->capture;
+
+  ASSERT (!intr_context ());
+  c.buf = buf;
+  c.size = size;
+  c.len = 0;
+  t->capture = &c;
+  func ();
+  t->capture = outer;
+  return c.len;
+}
+
+/* Returns the running thread's console capture, or a null pointer
+   if its output goes to the console. */
+static struct console_capture *
+current_capture (void) 
+{
+  return (!intr_context () && use_console_lock
+          ? thread_current ()->capture : NULL);
 }
 
 /* Acquires the console lock. */
 static void
 acquire_console (void) 
 {
-  if (!intr_context () && use_console_lock) 
+  if (!intr_context () && use_console_lock && current_capture () == NULL) 
     {
       if (lock_held_by_current_thread (&console_lock)) 
         console_lock_depth++; 
@@ -100,7 +195,7 @@ acquire_console (void)
 static void
 release_console (void) 
 {
-  if (!intr_context () && use_console_lock) 
+  if (!intr_context () && use_console_lock && current_capture () == NULL) 
     {
       if (console_lock_depth > 0)
         console_lock_depth--;
@@ -116,6 +211,7 @@ console_locked_by_current_thread (void)
 {
   return (intr_context ()
           || !use_console_lock
+          || current_capture () != NULL
           || lock_held_by_current_thread (&console_lock));
 }
 
@@ -184,8 +280,103 @@ vprintf_helper (char c, void *char_cnt_)
 static void
 putchar_have_lock (uint8_t c) 
 {
+  struct console_capture *capture = current_capture ();
+
   ASSERT (console_locked_by_current_thread ());
+  if (capture != NULL)
+    {
+      if (capture->len < capture->size)
+        capture->buf[capture->len++] = c;
+      return;
+    }
   write_cnt++;
-  serial_putc (c);
-  vga_putc (c);
+  if (use_log && use_console_lock)
+    log_putc (c);
+  else
+    {
+      /* After a panic, anything still buffered must come first. */
+      drain_log ();
+      serial_putc (c);
+      vga_putc (c);
+    }
+}
+
+/* Appends C to the log buffer, waking the console thread if the
+   buffer was empty. */
+static void
+log_putc (uint8_t c) 
+{
+  enum intr_level old_level = intr_disable ();
+
+  while (log_head - log_tail >= LOG_SIZE)
+    {
+      if (intr_context () || old_level == INTR_OFF)
+        {
+          drop_cnt++;
+          intr_set_level (old_level);
+          return;
+        }
+      intr_set_level (old_level);
+      lock_acquire (&drain_lock);
+      drain_log ();
+      lock_release (&drain_lock);
+      old_level = intr_disable ();
+    }
+
+  log_buf[log_head++ % LOG_SIZE] = c;
+  if (log_head - log_tail == 1)
+    sema_up (&log_sema);
+  intr_set_level (old_level);
+}
+
+/* Writes the contents of the log buffer to the vga display and
+   serial port.  Unless the kernel has panicked, the caller must
+   hold drain_lock, or keep interrupts off while no thread holds
+   it. */
+static void
+drain_log (void) 
+{
+  for (;;)
+    {
+      uint8_t chunk[64];
+      enum intr_level old_level;
+      size_t cnt, i;
+
+      /* Take a chunk of the buffer with interrupts off, then write
+         it with interrupts on so that the serial port can use
+         its interrupt-driven queue. */
+      old_level = intr_disable ();
+      cnt = log_head - log_tail;
+      if (cnt > sizeof chunk)
+        cnt = sizeof chunk;
+      for (i = 0; i < cnt; i++)
+        chunk[i] = log_buf[(log_tail + i) % LOG_SIZE];
+      log_tail += cnt;
+      intr_set_level (old_level);
+
+      if (cnt == 0)
+        break;
+      for (i = 0; i < cnt; i++)
+        {
+          serial_putc (chunk[i]);
+          vga_putc (chunk[i]);
+        }
+    }
+}
+
+/* Console thread.  Drains the log buffer each time it becomes
+   non-empty. */
+static void
+console_daemon (void *aux UNUSED) 
+{
+  /* Drain promptly even under load, but with a tick of every ten
+     at most, so that heavy logging cannot crowd out other work. */
+  thread_set_deadline (1, 10);
+  for (;;)
+    {
+      sema_down (&log_sema);
+      lock_acquire (&drain_lock);
+      drain_log ();
+      lock_release (&drain_lock);
+    }
 }
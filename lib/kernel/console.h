@@ -3,8 +3,20 @@
 #include "../stddef.h"
 
 void console_init (void);
+void console_start (void);
+void console_flush (void);
 void console_panic (void);
 void console_print_stats (void);
 void putbuf (const char *, size_t);
 
+/* Console output diverted to a buffer by console_capture(). */
+struct console_capture
+  {
+    char *buf;                  /* Output goes here... */
+    size_t size;                /* ...up to this many bytes. */
+    size_t len;                 /* Bytes produced so far. */
+  };
+
+size_t console_capture (void (*func) (void), char *buf, size_t size);
+
 #endif /* lib/kernel/console.h */
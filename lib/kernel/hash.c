@@ -17,7 +17,9 @@ static struct hash_elem *find_elem (struct hash *, struct list *,
                                     struct hash_elem *);
 static void insert_elem (struct hash *, struct list *, struct hash_elem *);
 static void remove_elem (struct hash *, struct hash_elem *);
+static struct list *next_bucket (struct hash *, struct list *);
 static void rehash (struct hash *);
+static void migrate (struct hash *, size_t cnt);
 
 /* Initializes hash table H to compute hash values using HASH and
    compare hash elements using LESS, given auxiliary data AUX. */
@@ -28,6 +30,10 @@ hash_init (struct hash *h,
   h->elem_cnt = 0;
   h->bucket_cnt = 4;
   h->buckets = malloc (sizeof *h->buckets * h->bucket_cnt);
+  h->old_buckets = NULL;
+  h->old_bucket_cnt = 0;
+  h->migrate_idx = 0;
+  h->incremental = false;
   h->hash = hash;
   h->less = less;
   h->aux = aux;
@@ -53,12 +59,10 @@ hash_init (struct hash *h,
 void
 hash_clear (struct hash *h, hash_action_func *destructor) 
 {
-  size_t i;
+  struct list *bucket;
 
-  for (i = 0; i < h->bucket_cnt; i++) 
+  for (bucket = h->buckets; bucket != NULL; bucket = next_bucket (h, bucket))
     {
-      struct list *bucket = &h->buckets[i];
-
       if (destructor != NULL) 
         while (!list_empty (bucket)) 
           {
@@ -70,6 +74,10 @@ hash_clear (struct hash *h, hash_action_func *destructor)
       list_init (bucket); 
     }    
 
+  free (h->old_buckets);
+  h->old_buckets = NULL;
+  h->old_bucket_cnt = 0;
+  h->migrate_idx = 0;
   h->elem_cnt = 0;
 }
 
@@ -88,9 +96,27 @@ hash_destroy (struct hash *h, hash_action_func *destructor)
 {
   if (destructor != NULL)
     hash_clear (h, destructor);
+  free (h->old_buckets);
   free (h->buckets);
 }
 
+/* Sets whether hash table H changes its number of buckets all at
+   once (the default) or incrementally.
+
+   Resizing all at once moves every element inside a single
+   hash_insert(), hash_replace(), or hash_delete() call, so that
+   call takes time proportional to the size of the table.  In
+   incremental mode, the old bucket array is instead kept
+   alongside the new one, and each of those calls moves only a few
+   old buckets, so that none takes more than a bounded amount of
+   time.  Lookups are no slower in either mode, since every
+   element's bucket is known either way. */
+void
+hash_set_incremental (struct hash *h, bool incremental)
+{
+  h->incremental = incremental;
+}
+
 /* Inserts NEW into hash table H and returns a null pointer, if
    no equal element is already in the table.
    If an equal element is already in the table, returns it
@@ -162,13 +188,12 @@ hash_delete (struct hash *h, struct hash_elem *e)
 void
 hash_apply (struct hash *h, hash_action_func *action) 
 {
-  size_t i;
+  struct list *bucket;
   
   ASSERT (action != NULL);
 
-  for (i = 0; i < h->bucket_cnt; i++) 
+  for (bucket = h->buckets; bucket != NULL; bucket = next_bucket (h, bucket))
     {
-      struct list *bucket = &h->buckets[i];
       struct list_elem *elem, *next;
 
       for (elem = list_begin (bucket); elem != list_end (bucket); elem = next) 
@@ -223,7 +248,8 @@ hash_next (struct hash_iterator *i)
   i->elem = list_elem_to_hash_elem (list_next (&i->elem->list_elem));
   while (i->elem == list_elem_to_hash_elem (list_end (i->bucket)))
     {
-      if (++i->bucket >= i->hash->buckets + i->hash->bucket_cnt)
+      i->bucket = next_bucket (i->hash, i->bucket);
+      if (i->bucket == NULL)
         {
           i->elem = NULL;
           break;
@@ -301,12 +327,37 @@ hash_int (int i)
   return hash_bytes (&i, sizeof i);
 }
 
-/* Returns the bucket in H that E belongs in. */
+/* Returns the bucket in H that E belongs in.  While H is being
+   resized, that is in the old bucket array if E's old bucket has
+   not yet been migrated, otherwise in the new one. */
 static struct list *
 find_bucket (struct hash *h, struct hash_elem *e) 
 {
-  size_t bucket_idx = h->hash (e, h->aux) & (h->bucket_cnt - 1);
-  return &h->buckets[bucket_idx];
+  unsigned hash = h->hash (e, h->aux);
+
+  if (h->old_buckets != NULL)
+    {
+      size_t old_idx = hash & (h->old_bucket_cnt - 1);
+      if (old_idx >= h->migrate_idx)
+        return &h->old_buckets[old_idx];
+    }
+  return &h->buckets[hash & (h->bucket_cnt - 1)];
+}
+
+/* Returns the bucket that follows BUCKET in H, visiting all of
+   the current buckets and then any old buckets not yet migrated,
+   or a null pointer after the last one. */
+static struct list *
+next_bucket (struct hash *h, struct list *bucket) 
+{
+  bucket++;
+  if (bucket == h->buckets + h->bucket_cnt)
+    return h->old_buckets != NULL ? h->old_buckets + h->migrate_idx : NULL;
+  else if (h->old_buckets != NULL
+           && bucket == h->old_buckets + h->old_bucket_cnt)
+    return NULL;
+  else
+    return bucket;
 }
 
 /* Searches BUCKET in H for a hash element equal to E.  Returns
@@ -344,21 +395,34 @@ is_power_of_2 (size_t x)
 #define BEST_ELEMS_PER_BUCKET 2 /* Ideal elems/bucket. */
 #define MAX_ELEMS_PER_BUCKET  4 /* Elems/bucket > 4: increase # of buckets. */
 
+/* Number of old buckets migrated per operation in incremental
+   mode.  Since the bucket count doubles or halves only after the
+   element count does, this finishes long before another resize
+   is due. */
+#define MIGRATE_BUCKETS 4
+
 /* Changes the number of buckets in hash table H to match the
    ideal.  This function can fail because of an out-of-memory
    condition, but that'll just make hash accesses less efficient;
-   we can still continue. */
+   we can still continue.
+
+   In incremental mode, only starts the change, or continues one
+   already in progress; see hash_set_incremental(). */
 static void
 rehash (struct hash *h) 
 {
   size_t old_bucket_cnt, new_bucket_cnt;
-  struct list *new_buckets, *old_buckets;
+  struct list *new_buckets;
   size_t i;
 
   ASSERT (h != NULL);
 
-  /* Save old bucket info for later use. */
-  old_buckets = h->buckets;
+  /* Finish any resize in progress before considering another. */
+  if (h->old_buckets != NULL)
+    {
+      migrate (h, h->incremental ? MIGRATE_BUCKETS : h->old_bucket_cnt);
+      return;
+    }
   old_bucket_cnt = h->bucket_cnt;
 
   /* Calculate the number of buckets to use now.
@@ -387,29 +451,42 @@ rehash (struct hash *h)
   for (i = 0; i < new_bucket_cnt; i++) 
     list_init (&new_buckets[i]);
 
-  /* Install new bucket info. */
+  /* Install new bucket info, keeping the old buckets until their
+     elements have been moved. */
+  h->old_buckets = h->buckets;
+  h->old_bucket_cnt = old_bucket_cnt;
+  h->migrate_idx = 0;
   h->buckets = new_buckets;
   h->bucket_cnt = new_bucket_cnt;
 
-  /* Move each old element into the appropriate new bucket. */
-  for (i = 0; i < old_bucket_cnt; i++) 
+  migrate (h, h->incremental ? MIGRATE_BUCKETS : old_bucket_cnt);
+}
+
+/* Moves the elements of up to CNT of H's old buckets into the
+   appropriate new buckets, freeing the old buckets once all have
+   been moved. */
+static void
+migrate (struct hash *h, size_t cnt) 
+{
+  for (; cnt > 0 && h->migrate_idx < h->old_bucket_cnt; cnt--) 
     {
-      struct list *old_bucket;
-      struct list_elem *elem, *next;
+      struct list *old_bucket = &h->old_buckets[h->migrate_idx++];
 
-      old_bucket = &old_buckets[i];
-      for (elem = list_begin (old_bucket);
-           elem != list_end (old_bucket); elem = next) 
+      while (!list_empty (old_bucket)) 
         {
-          struct list *new_bucket
-            = find_bucket (h, list_elem_to_hash_elem (elem));
-          next = list_next (elem);
-          list_remove (elem);
-          list_push_front (new_bucket, elem);
+          struct list_elem *elem = list_pop_front (old_bucket);
+          unsigned hash = h->hash (list_elem_to_hash_elem (elem), h->aux);
+          list_push_front (&h->buckets[hash & (h->bucket_cnt - 1)], elem);
         }
     }
 
-  free (old_buckets);
+  if (h->migrate_idx >= h->old_bucket_cnt)
+    {
+      free (h->old_buckets);
+      h->old_buckets = NULL;
+      h->old_bucket_cnt = 0;
+      h->migrate_idx = 0;
+    }
 }
 
 /* Inserts E into BUCKET (in hash table H). */
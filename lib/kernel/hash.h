@@ -61,6 +61,10 @@ struct hash
     size_t elem_cnt;            /* Number of elements in table. */
     size_t bucket_cnt;          /* Number of buckets, a power of 2. */
     struct list *buckets;       /* Array of `bucket_cnt' lists. */
+    struct list *old_buckets;   /* Buckets being migrated, or null. */
+    size_t old_bucket_cnt;      /* Number of buckets in `old_buckets'. */
+    size_t migrate_idx;         /* Next bucket of `old_buckets' to move. */
+    bool incremental;           /* Resize a few buckets at a time? */
     hash_hash_func *hash;       /* Hash function. */
     hash_less_func *less;       /* Comparison function. */
     void *aux;                  /* Auxiliary data for `hash' and `less'. */
@@ -78,6 +82,7 @@ struct hash_iterator
 bool hash_init (struct hash *, hash_hash_func *, hash_less_func *, void *aux);
 void hash_clear (struct hash *, hash_action_func *);
 void hash_destroy (struct hash *, hash_action_func *);
+void hash_set_incremental (struct hash *, bool);
 
 /* Search, insertion, deletion. */
 struct hash_elem *hash_insert (struct hash *, struct hash_elem *);
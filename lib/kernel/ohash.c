@@ -0,0 +1,518 @@
+/* Open-addressing hash table.
+
+   See ohash.h for basic information.
+
+   The table proper is the array H->SLOTS of H->SLOT_CNT slots.
+   An element whose hash value is X has "home" slot X % SLOT_CNT
+   and is stored at or after it, wrapping around at the end of
+   the array; its distance from home is its probe distance.
+   Robin Hood insertion keeps the elements that share a run of
+   occupied slots ordered by home slot, which has two useful
+   consequences: a search may stop at the first slot whose
+   element lies closer to its home than the key would, and an
+   element may be deleted by shifting the rest of its run back
+   one slot, with no tombstones.
+
+   While the table is being grown, the previous array is kept in
+   H->OLD_SLOTS.  Nothing is ever inserted into it; instead, each
+   insertion or deletion moves the next few of its slots into
+   H->SLOTS, until it is empty and can be freed.  Slots that have
+   been moved, or whose elements have been deleted, are marked
+   with TOMBSTONE rather than emptied, since emptying them would
+   cut short searches for the elements that follow them. */
+
+#include "ohash.h"
+#include "../debug.h"
+#include "threads/malloc.h"
+
+/* Initial number of slots.  Must be a power of 2. */
+#define INIT_SLOT_CNT 16
+
+/* Number of old slots moved per insertion or deletion while the
+   table is being grown. */
+#define MIGRATE_SLOTS 8
+
+/* Marks a slot in H->OLD_SLOTS that no longer holds an element. */
+#define TOMBSTONE ((struct ohash_elem *) 1)
+
+static struct ohash_slot *alloc_slots (size_t cnt);
+static struct ohash_slot *find_slot (struct ohash *, struct ohash_slot *,
+                                     size_t cnt, struct ohash_elem *,
+                                     unsigned hash);
+static struct ohash_slot *find_any (struct ohash *, struct ohash_elem *,
+                                    unsigned hash, bool *in_old);
+static void place (struct ohash_slot *, size_t cnt, unsigned hash,
+                   struct ohash_elem *);
+static void remove_at (struct ohash_slot *, size_t cnt, size_t idx);
+static void insert_elem (struct ohash *, unsigned hash, struct ohash_elem *);
+static void migrate (struct ohash *, size_t cnt);
+static void grow (struct ohash *);
+
+/* Initializes hash table H to compute hash values using HASH and
+   compare hash elements using LESS, given auxiliary data AUX. */
+bool
+ohash_init (struct ohash *h,
+            ohash_hash_func *hash, ohash_less_func *less, void *aux)
+{
+  h->elem_cnt = 0;
+  h->slot_cnt = INIT_SLOT_CNT;
+  h->used_cnt = 0;
+  h->slots = alloc_slots (h->slot_cnt);
+  h->old_slots = NULL;
+  h->old_slot_cnt = 0;
+  h->migrate_idx = 0;
+  h->hash = hash;
+  h->less = less;
+  h->aux = aux;
+
+  return h->slots != NULL;
+}
+
+/* Removes all the elements from H.
+
+   If DESTRUCTOR is non-null, then it is called for each element
+   in the hash.  DESTRUCTOR may, if appropriate, deallocate the
+   memory used by the hash element.  However, modifying hash
+   table H while ohash_clear() is running, using any of the
+   functions ohash_clear(), ohash_destroy(), ohash_insert(),
+   ohash_replace(), or ohash_delete(), yields undefined behavior,
+   whether done in DESTRUCTOR or elsewhere. */
+void
+ohash_clear (struct ohash *h, ohash_action_func *destructor)
+{
+  size_t i;
+
+  if (h->old_slots != NULL)
+    {
+      for (i = h->migrate_idx; i < h->old_slot_cnt; i++)
+        {
+          struct ohash_elem *e = h->old_slots[i].elem;
+          if (e != NULL && e != TOMBSTONE && destructor != NULL)
+            destructor (e, h->aux);
+        }
+      free (h->old_slots);
+      h->old_slots = NULL;
+      h->old_slot_cnt = 0;
+      h->migrate_idx = 0;
+    }
+
+  for (i = 0; i < h->slot_cnt; i++)
+    {
+      struct ohash_elem *e = h->slots[i].elem;
+      if (e != NULL)
+        {
+          h->slots[i].elem = NULL;
+          if (destructor != NULL)
+            destructor (e, h->aux);
+        }
+    }
+
+  h->elem_cnt = 0;
+  h->used_cnt = 0;
+}
+
+/* Destroys hash table H.
+
+   If DESTRUCTOR is non-null, then it is first called for each
+   element in the hash.  DESTRUCTOR may, if appropriate,
+   deallocate the memory used by the hash element.  However,
+   modifying hash table H while ohash_clear() is running, using
+   any of the functions ohash_clear(), ohash_destroy(),
+   ohash_insert(), ohash_replace(), or ohash_delete(), yields
+   undefined behavior, whether done in DESTRUCTOR or
+   elsewhere. */
+void
+ohash_destroy (struct ohash *h, ohash_action_func *destructor)
+{
+  ohash_clear (h, destructor);
+  free (h->slots);
+}
+
+/* Inserts NEW into hash table H and returns a null pointer, if
+   no equal element is already in the table.
+   If an equal element is already in the table, returns it
+   without inserting NEW. */
+struct ohash_elem *
+ohash_insert (struct ohash *h, struct ohash_elem *new)
+{
+  unsigned hash = h->hash (new, h->aux);
+  struct ohash_slot *old;
+  bool in_old;
+
+  old = find_any (h, new, hash, &in_old);
+  if (old != NULL)
+    return old->elem;
+
+  insert_elem (h, hash, new);
+  return NULL;
+}
+
+/* Inserts NEW into hash table H, replacing any equal element
+   already in the table, which is returned. */
+struct ohash_elem *
+ohash_replace (struct ohash *h, struct ohash_elem *new)
+{
+  unsigned hash = h->hash (new, h->aux);
+  struct ohash_slot *old;
+  bool in_old;
+
+  old = find_any (h, new, hash, &in_old);
+  if (old != NULL)
+    {
+      struct ohash_elem *e = old->elem;
+      old->elem = new;
+      new->hash = hash;
+      return e;
+    }
+
+  insert_elem (h, hash, new);
+  return NULL;
+}
+
+/* Finds and returns an element equal to E in hash table H, or a
+   null pointer if no equal element exists in the table. */
+struct ohash_elem *
+ohash_find (struct ohash *h, struct ohash_elem *e)
+{
+  struct ohash_slot *s;
+  bool in_old;
+
+  s = find_any (h, e, h->hash (e, h->aux), &in_old);
+  return s != NULL ? s->elem : NULL;
+}
+
+/* Finds, removes, and returns an element equal to E in hash
+   table H.  Returns a null pointer if no equal element existed
+   in the table.
+
+   If the elements of the hash table are dynamically allocated,
+   or own resources that are, then it is the caller's
+   responsibility to deallocate them. */
+struct ohash_elem *
+ohash_delete (struct ohash *h, struct ohash_elem *e)
+{
+  struct ohash_slot *s;
+  struct ohash_elem *found;
+  bool in_old;
+
+  s = find_any (h, e, h->hash (e, h->aux), &in_old);
+  if (s == NULL)
+    return NULL;
+
+  found = s->elem;
+  if (in_old)
+    s->elem = TOMBSTONE;
+  else
+    {
+      remove_at (h->slots, h->slot_cnt, s - h->slots);
+      h->used_cnt--;
+    }
+  h->elem_cnt--;
+
+  migrate (h, MIGRATE_SLOTS);
+  return found;
+}
+
+/* Calls ACTION for each element in hash table H in arbitrary
+   order.
+   Modifying hash table H while ohash_apply() is running, using
+   any of the functions ohash_clear(), ohash_destroy(),
+   ohash_insert(), ohash_replace(), or ohash_delete(), yields
+   undefined behavior, whether done from ACTION or elsewhere. */
+void
+ohash_apply (struct ohash *h, ohash_action_func *action)
+{
+  struct ohash_iterator i;
+
+  ASSERT (action != NULL);
+
+  ohash_first (&i, h);
+  while (ohash_next (&i))
+    action (ohash_cur (&i), h->aux);
+}
+
+/* Initializes I for iterating hash table H.
+
+   Iteration idiom:
+
+      struct ohash_iterator i;
+
+      ohash_first (&i, h);
+      while (ohash_next (&i))
+        {
+          struct foo *f = ohash_entry (ohash_cur (&i), struct foo, elem);
+          ...do something with f...
+        }
+
+   Modifying hash table H during iteration, using any of the
+   functions ohash_clear(), ohash_destroy(), ohash_insert(),
+   ohash_replace(), or ohash_delete(), invalidates all
+   iterators. */
+void
+ohash_first (struct ohash_iterator *i, struct ohash *h)
+{
+  ASSERT (i != NULL);
+  ASSERT (h != NULL);
+
+  i->hash = h;
+  i->slot = NULL;
+  i->in_old = h->old_slots != NULL;
+  i->elem = NULL;
+}
+
+/* Advances I to the next element in the hash table and returns
+   it.  Returns a null pointer if no elements are left.  Elements
+   are returned in arbitrary order.
+
+   Modifying a hash table H during iteration, using any of the
+   functions ohash_clear(), ohash_destroy(), ohash_insert(),
+   ohash_replace(), or ohash_delete(), invalidates all
+   iterators. */
+struct ohash_elem *
+ohash_next (struct ohash_iterator *i)
+{
+  struct ohash *h = i->hash;
+
+  for (;;)
+    {
+      struct ohash_slot *slots = i->in_old ? h->old_slots : h->slots;
+      size_t cnt = i->in_old ? h->old_slot_cnt : h->slot_cnt;
+      struct ohash_slot *s;
+
+      for (s = i->slot != NULL ? i->slot + 1 : slots; s < slots + cnt; s++)
+        if (s->elem != NULL && s->elem != TOMBSTONE)
+          {
+            i->slot = s;
+            i->elem = s->elem;
+            return i->elem;
+          }
+
+      if (!i->in_old)
+        {
+          i->slot = slots + cnt - 1;
+          i->elem = NULL;
+          return NULL;
+        }
+      i->in_old = false;
+      i->slot = NULL;
+    }
+}
+
+/* Returns the current element in the hash table iteration, or a
+   null pointer at the end of the table.  Undefined behavior
+   after calling ohash_first() but before ohash_next(). */
+struct ohash_elem *
+ohash_cur (struct ohash_iterator *i)
+{
+  return i->elem;
+}
+
+/* Returns the number of elements in H. */
+size_t
+ohash_size (struct ohash *h)
+{
+  return h->elem_cnt;
+}
+
+/* Returns true if H contains no elements, false otherwise. */
+bool
+ohash_empty (struct ohash *h)
+{
+  return h->elem_cnt == 0;
+}
+
+/* Returns a new array of CNT empty slots, or a null pointer if
+   memory is not available. */
+static struct ohash_slot *
+alloc_slots (size_t cnt)
+{
+  return calloc (cnt, sizeof (struct ohash_slot));
+}
+
+/* Returns the probe distance of an element with hash value HASH
+   stored at index IDX of an array of CNT slots. */
+static inline size_t
+probe_distance (unsigned hash, size_t idx, size_t cnt)
+{
+  return (idx - hash) & (cnt - 1);
+}
+
+/* Searches the CNT SLOTS for an element equal to E, whose hash
+   value is HASH.  Returns its slot if found, otherwise a null
+   pointer. */
+static struct ohash_slot *
+find_slot (struct ohash *h, struct ohash_slot *slots, size_t cnt,
+           struct ohash_elem *e, unsigned hash)
+{
+  size_t idx = hash & (cnt - 1);
+  size_t dist;
+
+  for (dist = 0; ; dist++)
+    {
+      struct ohash_slot *s = &slots[idx];
+
+      if (s->elem == NULL || probe_distance (s->hash, idx, cnt) < dist)
+        return NULL;
+      if (s->hash == hash && s->elem != TOMBSTONE
+          && !h->less (s->elem, e, h->aux) && !h->less (e, s->elem, h->aux))
+        return s;
+      idx = (idx + 1) & (cnt - 1);
+    }
+}
+
+/* Searches H for an element equal to E, whose hash value is
+   HASH, first in the current slots, then in any slots still
+   being moved.  Returns its slot if found, setting *IN_OLD to
+   true if it is in H->OLD_SLOTS, otherwise returns a null
+   pointer. */
+static struct ohash_slot *
+find_any (struct ohash *h, struct ohash_elem *e, unsigned hash,
+          bool *in_old)
+{
+  struct ohash_slot *s;
+
+  *in_old = false;
+  s = find_slot (h, h->slots, h->slot_cnt, e, hash);
+  if (s == NULL && h->old_slots != NULL)
+    {
+      s = find_slot (h, h->old_slots, h->old_slot_cnt, e, hash);
+      *in_old = s != NULL;
+    }
+  return s;
+}
+
+/* Stores element E, whose hash value is HASH, in the CNT SLOTS,
+   which must contain at least one empty slot and no
+   tombstones. */
+static void
+place (struct ohash_slot *slots, size_t cnt, unsigned hash,
+       struct ohash_elem *e)
+{
+  size_t idx = hash & (cnt - 1);
+  size_t dist = 0;
+
+  for (;;)
+    {
+      struct ohash_slot *s = &slots[idx];
+      size_t s_dist;
+
+      if (s->elem == NULL)
+        {
+          s->hash = hash;
+          s->elem = e;
+          return;
+        }
+
+      /* Take the slot from an element closer to its home, and
+         carry that element on instead. */
+      s_dist = probe_distance (s->hash, idx, cnt);
+      if (s_dist < dist)
+        {
+          struct ohash_slot tmp = *s;
+          s->hash = hash;
+          s->elem = e;
+          hash = tmp.hash;
+          e = tmp.elem;
+          dist = s_dist;
+        }
+
+      idx = (idx + 1) & (cnt - 1);
+      dist++;
+    }
+}
+
+/* Empties slot IDX of the CNT SLOTS, shifting back the elements
+   that follow it in its run. */
+static void
+remove_at (struct ohash_slot *slots, size_t cnt, size_t idx)
+{
+  for (;;)
+    {
+      size_t next = (idx + 1) & (cnt - 1);
+
+      if (slots[next].elem == NULL
+          || probe_distance (slots[next].hash, next, cnt) == 0)
+        {
+          slots[idx].elem = NULL;
+          return;
+        }
+      slots[idx] = slots[next];
+      idx = next;
+    }
+}
+
+/* Inserts E, whose hash value is HASH and which is not already in
+   H, into H's current slots, growing H first if necessary. */
+static void
+insert_elem (struct ohash *h, unsigned hash, struct ohash_elem *e)
+{
+  migrate (h, MIGRATE_SLOTS);
+  if ((h->used_cnt + 1) * 4 > h->slot_cnt * 3)
+    grow (h);
+
+  e->hash = hash;
+  place (h->slots, h->slot_cnt, hash, e);
+  h->used_cnt++;
+  h->elem_cnt++;
+}
+
+/* Moves up to CNT of H's old slots into its current slots,
+   freeing the old slots once all have been moved. */
+static void
+migrate (struct ohash *h, size_t cnt)
+{
+  if (h->old_slots == NULL)
+    return;
+
+  for (; cnt > 0 && h->migrate_idx < h->old_slot_cnt; cnt--)
+    {
+      struct ohash_slot *s = &h->old_slots[h->migrate_idx++];
+      if (s->elem != NULL && s->elem != TOMBSTONE)
+        {
+          place (h->slots, h->slot_cnt, s->hash, s->elem);
+          h->used_cnt++;
+          s->elem = TOMBSTONE;
+        }
+    }
+
+  if (h->migrate_idx >= h->old_slot_cnt)
+    {
+      free (h->old_slots);
+      h->old_slots = NULL;
+      h->old_slot_cnt = 0;
+      h->migrate_idx = 0;
+    }
+}
+
+/* Starts doubling the number of slots in H, which is about to
+   run out of room.  Any earlier growth still in progress is
+   completed first.
+
+   If memory runs out, carries on in the existing slots for as
+   long as they have room, then panics. */
+static void
+grow (struct ohash *h)
+{
+  struct ohash_slot *new_slots;
+  size_t new_cnt;
+
+  migrate (h, SIZE_MAX);
+  if ((h->used_cnt + 1) * 4 <= h->slot_cnt * 3)
+    return;
+
+  new_cnt = h->slot_cnt * 2;
+  new_slots = alloc_slots (new_cnt);
+  if (new_slots == NULL)
+    {
+      if (h->used_cnt + 1 < h->slot_cnt)
+        return;
+      PANIC ("ohash: out of memory growing to %zu slots", new_cnt);
+    }
+
+  h->old_slots = h->slots;
+  h->old_slot_cnt = h->slot_cnt;
+  h->migrate_idx = 0;
+  h->slots = new_slots;
+  h->slot_cnt = new_cnt;
+  h->used_cnt = 0;
+}
@@ -0,0 +1,120 @@
+#ifndef __LIB_KERNEL_OHASH_H
+#define __LIB_KERNEL_OHASH_H
+
+/* Open-addressing hash table.
+
+   An alternative to the chained hash table in hash.h with the
+   same interface, for tables that are searched far more often
+   than they are modified.  Instead of an array of lists, the
+   table is a single array of slots, each holding an element
+   pointer and that element's hash value.  A search walks
+   consecutive slots and compares stored hash values before
+   touching any element, so most probes stay in one or two cache
+   lines.
+
+   Elements are placed by Robin Hood linear probing: an element
+   being inserted takes the slot of any element that is closer to
+   its home slot than the inserted one is to its own.  This keeps
+   probe sequences short and lets a search stop as soon as it
+   meets an element closer to home than the key would be.
+   Deletion shifts the following elements back, so the table
+   never holds tombstones in normal operation.
+
+   When the table fills past 3/4, it is doubled incrementally:
+   the old slot array is kept alongside the new one and a few of
+   its slots are moved over on each insertion or deletion, so no
+   single operation has to rehash every element.  Searches look in
+   both arrays until the move is complete.
+
+   As with hash.h, each structure that can be in a table embeds a
+   struct ohash_elem, and ohash_entry() converts back from it.
+   The sample hash functions in hash.h may be used to compute
+   hash values. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Hash element. */
+struct ohash_elem
+  {
+    unsigned hash;              /* Hash value, cached by the table. */
+  };
+
+/* Converts pointer to hash element OHASH_ELEM into a pointer to
+   the structure that OHASH_ELEM is embedded inside.  Supply the
+   name of the outer structure STRUCT and the member name MEMBER
+   of the hash element. */
+#define ohash_entry(OHASH_ELEM, STRUCT, MEMBER)                 \
+        ((STRUCT *) ((uint8_t *) (OHASH_ELEM)                   \
+                     - offsetof (STRUCT, MEMBER)))
+
+/* Computes and returns the hash value for hash element E, given
+   auxiliary data AUX. */
+typedef unsigned ohash_hash_func (const struct ohash_elem *e, void *aux);
+
+/* Compares the value of two hash elements A and B, given
+   auxiliary data AUX.  Returns true if A is less than B, or
+   false if A is greater than or equal to B. */
+typedef bool ohash_less_func (const struct ohash_elem *a,
+                              const struct ohash_elem *b,
+                              void *aux);
+
+/* Performs some operation on hash element E, given auxiliary
+   data AUX. */
+typedef void ohash_action_func (struct ohash_elem *e, void *aux);
+
+/* A slot in the table: empty if ELEM is null. */
+struct ohash_slot
+  {
+    unsigned hash;              /* Hash value of ELEM. */
+    struct ohash_elem *elem;    /* Element, or null. */
+  };
+
+/* Hash table. */
+struct ohash
+  {
+    size_t elem_cnt;            /* Number of elements in table. */
+    size_t slot_cnt;            /* Number of slots, a power of 2. */
+    size_t used_cnt;            /* Elements in `slots'. */
+    struct ohash_slot *slots;   /* Array of `slot_cnt' slots. */
+    struct ohash_slot *old_slots; /* Array being moved, or null. */
+    size_t old_slot_cnt;        /* Number of slots in `old_slots'. */
+    size_t migrate_idx;         /* Next slot of `old_slots' to move. */
+    ohash_hash_func *hash;      /* Hash function. */
+    ohash_less_func *less;      /* Comparison function. */
+    void *aux;                  /* Auxiliary data for `hash' and `less'. */
+  };
+
+/* A hash table iterator. */
+struct ohash_iterator
+  {
+    struct ohash *hash;         /* The hash table. */
+    struct ohash_slot *slot;    /* Current slot. */
+    bool in_old;                /* Whether SLOT is in `old_slots'. */
+    struct ohash_elem *elem;    /* Current hash element. */
+  };
+
+/* Basic life cycle. */
+bool ohash_init (struct ohash *, ohash_hash_func *, ohash_less_func *,
+                 void *aux);
+void ohash_clear (struct ohash *, ohash_action_func *);
+void ohash_destroy (struct ohash *, ohash_action_func *);
+
+/* Search, insertion, deletion. */
+struct ohash_elem *ohash_insert (struct ohash *, struct ohash_elem *);
+struct ohash_elem *ohash_replace (struct ohash *, struct ohash_elem *);
+struct ohash_elem *ohash_find (struct ohash *, struct ohash_elem *);
+struct ohash_elem *ohash_delete (struct ohash *, struct ohash_elem *);
+
+/* Iteration. */
+void ohash_apply (struct ohash *, ohash_action_func *);
+void ohash_first (struct ohash_iterator *, struct ohash *);
+struct ohash_elem *ohash_next (struct ohash_iterator *);
+struct ohash_elem *ohash_cur (struct ohash_iterator *);
+
+/* Information. */
+size_t ohash_size (struct ohash *);
+bool ohash_empty (struct ohash *);
+
+#endif /* lib/kernel/ohash.h */
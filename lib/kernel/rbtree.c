@@ -0,0 +1,442 @@
+/* Red-black tree.
+
+   See rbtree.h for basic information.
+
+   The tree maintains the usual invariants: every element is red
+   or black, the root is black, a red element has no red
+   children, and every path from an element down to a null child
+   passes through the same number of black elements.  Together
+   these keep the height within 2 log2 (n + 1).
+
+   The algorithms are those of Cormen, Leiserson, Rivest and
+   Stein, "Introduction to Algorithms", chapter 13, adapted to use
+   null pointers instead of a sentinel leaf.  Since a null child
+   has no parent field, rb_remove() passes the parent of the
+   removed position to remove_fixup() explicitly. */
+
+#include "rbtree.h"
+#include "../debug.h"
+
+static void rotate_left (struct rb_tree *, struct rb_elem *);
+static void rotate_right (struct rb_tree *, struct rb_elem *);
+static void insert_fixup (struct rb_tree *, struct rb_elem *);
+static void remove_fixup (struct rb_tree *, struct rb_elem *,
+                          struct rb_elem *parent);
+
+/* Initializes T as an empty tree whose elements are ordered by
+   LESS, given auxiliary data AUX. */
+void
+rb_init (struct rb_tree *t, rb_less_func *less, void *aux)
+{
+  ASSERT (t != NULL);
+  ASSERT (less != NULL);
+
+  t->root = NULL;
+  t->elem_cnt = 0;
+  t->less = less;
+  t->aux = aux;
+}
+
+/* Inserts E into T, after any elements equal to it. */
+void
+rb_insert (struct rb_tree *t, struct rb_elem *e)
+{
+  struct rb_elem *parent = NULL;
+  struct rb_elem **link = &t->root;
+
+  ASSERT (e != NULL);
+
+  while (*link != NULL)
+    {
+      parent = *link;
+      link = t->less (e, parent, t->aux) ? &parent->left : &parent->right;
+    }
+
+  e->parent = parent;
+  e->left = e->right = NULL;
+  e->red = true;
+  *link = e;
+  t->elem_cnt++;
+
+  insert_fixup (t, e);
+}
+
+/* Replaces OLD by NEW as the child of OLD's parent in T, or as
+   T's root if OLD has no parent.  Does not change NEW's parent
+   pointer. */
+static void
+replace_child (struct rb_tree *t, struct rb_elem *old, struct rb_elem *new)
+{
+  struct rb_elem *parent = old->parent;
+
+  if (parent == NULL)
+    t->root = new;
+  else if (parent->left == old)
+    parent->left = new;
+  else
+    parent->right = new;
+}
+
+/* Returns the smallest element in the subtree rooted at E. */
+static struct rb_elem *
+subtree_first (struct rb_elem *e)
+{
+  while (e->left != NULL)
+    e = e->left;
+  return e;
+}
+
+/* Returns the largest element in the subtree rooted at E. */
+static struct rb_elem *
+subtree_last (struct rb_elem *e)
+{
+  while (e->right != NULL)
+    e = e->right;
+  return e;
+}
+
+/* Removes element E, which must be in T, from T. */
+void
+rb_remove (struct rb_tree *t, struct rb_elem *e)
+{
+  struct rb_elem *child, *parent;
+  bool removed_red;
+
+  ASSERT (t->elem_cnt > 0);
+
+  if (e->left == NULL || e->right == NULL)
+    {
+      /* E has at most one child, which takes its place. */
+      child = e->left != NULL ? e->left : e->right;
+      parent = e->parent;
+      removed_red = e->red;
+      if (child != NULL)
+        child->parent = parent;
+      replace_child (t, e, child);
+    }
+  else
+    {
+      /* E's successor, which has no left child, takes its place,
+         and the successor's right child takes the successor's. */
+      struct rb_elem *next = subtree_first (e->right);
+
+      removed_red = next->red;
+      child = next->right;
+      if (next->parent == e)
+        parent = next;
+      else
+        {
+          parent = next->parent;
+          parent->left = child;
+          if (child != NULL)
+            child->parent = parent;
+          next->right = e->right;
+          e->right->parent = next;
+        }
+      next->left = e->left;
+      e->left->parent = next;
+      next->parent = e->parent;
+      next->red = e->red;
+      replace_child (t, e, next);
+    }
+  t->elem_cnt--;
+
+  if (!removed_red)
+    remove_fixup (t, child, parent);
+}
+
+/* Removes and returns the smallest element in T, which must not
+   be empty. */
+struct rb_elem *
+rb_pop_first (struct rb_tree *t)
+{
+  struct rb_elem *e;
+
+  ASSERT (!rb_empty (t));
+
+  e = subtree_first (t->root);
+  rb_remove (t, e);
+  return e;
+}
+
+/* Returns the first element in T that is equal to KEY, or a
+   null pointer if there is none. */
+struct rb_elem *
+rb_find (const struct rb_tree *t, const struct rb_elem *key)
+{
+  struct rb_elem *e = rb_lower_bound (t, key);
+
+  return e != NULL && !t->less (key, e, t->aux) ? e : NULL;
+}
+
+/* Returns the first element in T that is not less than KEY, or a
+   null pointer if every element is less than KEY. */
+struct rb_elem *
+rb_lower_bound (const struct rb_tree *t, const struct rb_elem *key)
+{
+  struct rb_elem *e = t->root;
+  struct rb_elem *bound = NULL;
+
+  while (e != NULL)
+    if (t->less (e, key, t->aux))
+      e = e->right;
+    else
+      {
+        bound = e;
+        e = e->left;
+      }
+  return bound;
+}
+
+/* Returns the first element in T that is greater than KEY, or a
+   null pointer if no element is greater than KEY. */
+struct rb_elem *
+rb_upper_bound (const struct rb_tree *t, const struct rb_elem *key)
+{
+  struct rb_elem *e = t->root;
+  struct rb_elem *bound = NULL;
+
+  while (e != NULL)
+    if (t->less (key, e, t->aux))
+      {
+        bound = e;
+        e = e->left;
+      }
+    else
+      e = e->right;
+  return bound;
+}
+
+/* Returns the smallest element in T, or a null pointer if T is
+   empty. */
+struct rb_elem *
+rb_first (const struct rb_tree *t)
+{
+  return t->root != NULL ? subtree_first (t->root) : NULL;
+}
+
+/* Returns the largest element in T, or a null pointer if T is
+   empty. */
+struct rb_elem *
+rb_last (const struct rb_tree *t)
+{
+  return t->root != NULL ? subtree_last (t->root) : NULL;
+}
+
+/* Returns the element that follows E in its tree, or a null
+   pointer if E is the largest. */
+struct rb_elem *
+rb_next (const struct rb_elem *e)
+{
+  struct rb_elem *parent;
+
+  ASSERT (e != NULL);
+
+  if (e->right != NULL)
+    return subtree_first (e->right);
+  while ((parent = e->parent) != NULL && e == parent->right)
+    e = parent;
+  return parent;
+}
+
+/* Returns the element that precedes E in its tree, or a null
+   pointer if E is the smallest. */
+struct rb_elem *
+rb_prev (const struct rb_elem *e)
+{
+  struct rb_elem *parent;
+
+  ASSERT (e != NULL);
+
+  if (e->left != NULL)
+    return subtree_last (e->left);
+  while ((parent = e->parent) != NULL && e == parent->left)
+    e = parent;
+  return parent;
+}
+
+/* Returns the number of elements in T. */
+size_t
+rb_size (const struct rb_tree *t)
+{
+  return t->elem_cnt;
+}
+
+/* Returns true if T is empty, false otherwise. */
+bool
+rb_empty (const struct rb_tree *t)
+{
+  return t->root == NULL;
+}
+
+/* Returns true if E is a red element, false if it is black or
+   null. */
+static inline bool
+is_red (const struct rb_elem *e)
+{
+  return e != NULL && e->red;
+}
+
+/* Rotates the subtree rooted at X in T to the left, so that X's
+   right child takes its place. */
+static void
+rotate_left (struct rb_tree *t, struct rb_elem *x)
+{
+  struct rb_elem *y = x->right;
+
+  x->right = y->left;
+  if (y->left != NULL)
+    y->left->parent = x;
+  y->parent = x->parent;
+  replace_child (t, x, y);
+  y->left = x;
+  x->parent = y;
+}
+
+/* Rotates the subtree rooted at X in T to the right, so that X's
+   left child takes its place. */
+static void
+rotate_right (struct rb_tree *t, struct rb_elem *x)
+{
+  struct rb_elem *y = x->left;
+
+  x->left = y->right;
+  if (y->right != NULL)
+    y->right->parent = x;
+  y->parent = x->parent;
+  replace_child (t, x, y);
+  y->right = x;
+  x->parent = y;
+}
+
+/* Restores the red-black invariants in T after red element E has
+   been inserted as a leaf. */
+static void
+insert_fixup (struct rb_tree *t, struct rb_elem *e)
+{
+  struct rb_elem *parent;
+
+  while (is_red (parent = e->parent))
+    {
+      /* PARENT is red, so it is not the root and has a parent. */
+      struct rb_elem *grandparent = parent->parent;
+      struct rb_elem *uncle;
+
+      if (parent == grandparent->left)
+        {
+          uncle = grandparent->right;
+          if (is_red (uncle))
+            {
+              parent->red = uncle->red = false;
+              grandparent->red = true;
+              e = grandparent;
+              continue;
+            }
+          if (e == parent->right)
+            {
+              rotate_left (t, parent);
+              e = parent;
+              parent = e->parent;
+            }
+          rotate_right (t, grandparent);
+        }
+      else
+        {
+          uncle = grandparent->left;
+          if (is_red (uncle))
+            {
+              parent->red = uncle->red = false;
+              grandparent->red = true;
+              e = grandparent;
+              continue;
+            }
+          if (e == parent->left)
+            {
+              rotate_right (t, parent);
+              e = parent;
+              parent = e->parent;
+            }
+          rotate_left (t, grandparent);
+        }
+      parent->red = false;
+      grandparent->red = true;
+      break;
+    }
+  t->root->red = false;
+}
+
+/* Restores the red-black invariants in T after a black element
+   has been removed from between PARENT and E, which may be null
+   and which now has one black element too few on its paths. */
+static void
+remove_fixup (struct rb_tree *t, struct rb_elem *e, struct rb_elem *parent)
+{
+  while (e != t->root && !is_red (e))
+    {
+      /* E's sibling has at least one black element on its paths,
+         so it is not null. */
+      struct rb_elem *sibling;
+
+      if (e == parent->left)
+        {
+          sibling = parent->right;
+          if (sibling->red)
+            {
+              sibling->red = false;
+              parent->red = true;
+              rotate_left (t, parent);
+              sibling = parent->right;
+            }
+          if (!is_red (sibling->left) && !is_red (sibling->right))
+            {
+              sibling->red = true;
+              e = parent;
+              parent = e->parent;
+              continue;
+            }
+          if (!is_red (sibling->right))
+            {
+              sibling->left->red = false;
+              sibling->red = true;
+              rotate_right (t, sibling);
+              sibling = parent->right;
+            }
+          sibling->red = parent->red;
+          parent->red = false;
+          sibling->right->red = false;
+          rotate_left (t, parent);
+        }
+      else
+        {
+          sibling = parent->left;
+          if (sibling->red)
+            {
+              sibling->red = false;
+              parent->red = true;
+              rotate_right (t, parent);
+              sibling = parent->left;
+            }
+          if (!is_red (sibling->left) && !is_red (sibling->right))
+            {
+              sibling->red = true;
+              e = parent;
+              parent = e->parent;
+              continue;
+            }
+          if (!is_red (sibling->left))
+            {
+              sibling->right->red = false;
+              sibling->red = true;
+              rotate_left (t, sibling);
+              sibling = parent->left;
+            }
+          sibling->red = parent->red;
+          parent->red = false;
+          sibling->left->red = false;
+          rotate_right (t, parent);
+        }
+      e = t->root;
+    }
+  if (e != NULL)
+    e->red = false;
+}
@@ -0,0 +1,114 @@
+#ifndef __LIB_KERNEL_RBTREE_H
+#define __LIB_KERNEL_RBTREE_H
+
+/* Red-black tree.
+
+   A balanced binary search tree that keeps its elements sorted
+   by a caller-supplied comparison function.  Insertion, deletion
+   and search take O(log n) time, and the elements can be visited
+   in order, so it replaces list_insert_ordered() wherever a
+   sorted set may grow large.
+
+   Like lists and hash tables, the tree does not use dynamic
+   allocation.  Each structure that can be in a tree embeds a
+   struct rb_elem member, and rb_entry() converts a struct rb_elem
+   back to the structure that contains it.  For example:
+
+      struct foo
+        {
+          struct rb_elem elem;
+          int key;
+          ...other members...
+        };
+
+      static bool
+      foo_less (const struct rb_elem *a, const struct rb_elem *b,
+                void *aux UNUSED)
+      {
+        return (rb_entry (a, struct foo, elem)->key
+                < rb_entry (b, struct foo, elem)->key);
+      }
+
+      struct rb_tree foo_tree;
+
+      rb_init (&foo_tree, foo_less, NULL);
+
+   Iteration from smallest to largest:
+
+      struct rb_elem *e;
+
+      for (e = rb_first (&foo_tree); e != NULL; e = rb_next (e))
+        {
+          struct foo *f = rb_entry (e, struct foo, elem);
+          ...do something with f...
+        }
+
+   Elements that compare equal may be in the same tree; they are
+   kept in the order they were inserted.  To search, fill in the
+   key fields of a scratch structure and pass its element to
+   rb_find(), rb_lower_bound(), or rb_upper_bound(). */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Tree element. */
+struct rb_elem
+  {
+    struct rb_elem *parent;     /* Parent, or null for the root. */
+    struct rb_elem *left;       /* Smaller elements, or null. */
+    struct rb_elem *right;      /* Larger elements, or null. */
+    bool red;                   /* Red or black? */
+  };
+
+/* Converts pointer to tree element RB_ELEM into a pointer to the
+   structure that RB_ELEM is embedded inside.  Supply the name of
+   the outer structure STRUCT and the member name MEMBER of the
+   tree element.  See the big comment at the top of the file for
+   an example. */
+#define rb_entry(RB_ELEM, STRUCT, MEMBER)                       \
+        ((STRUCT *) ((uint8_t *) &(RB_ELEM)->parent             \
+                     - offsetof (STRUCT, MEMBER.parent)))
+
+/* Compares the value of two tree elements A and B, given
+   auxiliary data AUX.  Returns true if A is less than B, or
+   false if A is greater than or equal to B. */
+typedef bool rb_less_func (const struct rb_elem *a,
+                           const struct rb_elem *b,
+                           void *aux);
+
+/* Red-black tree. */
+struct rb_tree
+  {
+    struct rb_elem *root;       /* Root, or null if empty. */
+    size_t elem_cnt;            /* Number of elements in tree. */
+    rb_less_func *less;         /* Comparison function. */
+    void *aux;                  /* Auxiliary data for `less'. */
+  };
+
+/* Initialization. */
+void rb_init (struct rb_tree *, rb_less_func *, void *aux);
+
+/* Insertion and removal. */
+void rb_insert (struct rb_tree *, struct rb_elem *);
+void rb_remove (struct rb_tree *, struct rb_elem *);
+struct rb_elem *rb_pop_first (struct rb_tree *);
+
+/* Search. */
+struct rb_elem *rb_find (const struct rb_tree *, const struct rb_elem *);
+struct rb_elem *rb_lower_bound (const struct rb_tree *,
+                                const struct rb_elem *);
+struct rb_elem *rb_upper_bound (const struct rb_tree *,
+                                const struct rb_elem *);
+
+/* Traversal. */
+struct rb_elem *rb_first (const struct rb_tree *);
+struct rb_elem *rb_last (const struct rb_tree *);
+struct rb_elem *rb_next (const struct rb_elem *);
+struct rb_elem *rb_prev (const struct rb_elem *);
+
+/* Information. */
+size_t rb_size (const struct rb_tree *);
+bool rb_empty (const struct rb_tree *);
+
+#endif /* lib/kernel/rbtree.h */
@@ -0,0 +1,202 @@
+#include <lz.h>
+#include <debug.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* Compressed format.
+
+   A block is a series of sequences, each some literal bytes
+   followed by a match: a copy of bytes that appeared earlier in
+   the output.  A sequence starts with a token byte whose high
+   nybble is the number of literals and whose low nybble is the
+   match length less MIN_MATCH.  A nybble of 15 means that more
+   length follows after the token, in bytes that are added to it,
+   up to and including the first byte that is not 255.  Then come
+   the literals, the match's distance back from the current
+   position as 2 bytes little-endian, and the rest of the match
+   length.  The last sequence has literals only and ends the
+   block.
+
+   The compressor is greedy.  It finds matches through a hash
+   table of the positions of the 4-byte strings seen so far,
+   keeping only the latest position for each hash value. */
+
+/* Shortest match worth encoding. */
+#define MIN_MATCH 4
+
+/* Hash table size, as a power of 2.  Must agree with
+   LZ_WORK_SIZE. */
+#define HASH_BITS 10
+
+/* Returns the 4 bytes at P as a 32-bit number. */
+static inline uint32_t
+read32 (const uint8_t *p)
+{
+  uint32_t x;
+  memcpy (&x, p, sizeof x);
+  return x;
+}
+
+/* Returns the hash table slot for the 4 bytes at P. */
+static inline unsigned
+hash4 (const uint8_t *p)
+{
+  return (read32 (p) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Appends LENGTH, less the 15 that its nybble holds, to the
+   output at *DST, which must not reach END.  Returns false if
+   there is no room. */
+static bool
+put_length (uint8_t **dst, uint8_t *end, size_t length)
+{
+  for (length -= 15; ; length -= 255)
+    {
+      if (*dst >= end)
+        return false;
+      *(*dst)++ = length < 255 ? length : 255;
+      if (length < 255)
+        return true;
+    }
+}
+
+/* Appends a sequence with the LIT_CNT literals at LIT and, if
+   MATCH_LEN is nonzero, a match of MATCH_LEN bytes at distance
+   OFFSET, to the output at *DST, which must not reach END.
+   Returns false if there is no room. */
+static bool
+put_sequence (uint8_t **dst, uint8_t *end, const uint8_t *lit,
+              size_t lit_cnt, size_t offset, size_t match_len)
+{
+  size_t ml = match_len > 0 ? match_len - MIN_MATCH : 0;
+  uint8_t *token = *dst;
+
+  if (*dst >= end)
+    return false;
+  *token = (lit_cnt < 15 ? lit_cnt : 15) << 4 | (ml < 15 ? ml : 15);
+  (*dst)++;
+  if (lit_cnt >= 15 && !put_length (dst, end, lit_cnt))
+    return false;
+  if ((size_t) (end - *dst) < lit_cnt)
+    return false;
+  memcpy (*dst, lit, lit_cnt);
+  *dst += lit_cnt;
+  if (match_len == 0)
+    return true;
+
+  if (end - *dst < 2)
+    return false;
+  *(*dst)++ = offset & 0xff;
+  *(*dst)++ = offset >> 8;
+  return ml < 15 || put_length (dst, end, ml);
+}
+
+/* Compresses the SRC_SIZE bytes at SRC, at most LZ_MAX_INPUT,
+   into DST, which has room for DST_SIZE bytes.  WORK must point
+   to LZ_WORK_SIZE bytes of scratch memory.  Returns the size of
+   the compressed data, or 0 if it would not fit in DST_SIZE
+   bytes. */
+size_t
+lz_compress (const void *src_, size_t src_size,
+             void *dst_, size_t dst_size, void *work)
+{
+  const uint8_t *src = src_;
+  uint8_t *dst = dst_, *end = dst + dst_size;
+  uint16_t *table = work;
+  size_t pos = 0, anchor = 0;
+
+  ASSERT (src_size <= LZ_MAX_INPUT);
+
+  /* Slots hold a position plus 1, so that 0 means empty. */
+  memset (table, 0, LZ_WORK_SIZE);
+  while (src_size >= MIN_MATCH && pos <= src_size - MIN_MATCH)
+    {
+      unsigned h = hash4 (src + pos);
+      size_t ref = table[h];
+
+      table[h] = pos + 1;
+      if (ref > 0 && read32 (src + ref - 1) == read32 (src + pos))
+        {
+          size_t len = MIN_MATCH;
+
+          ref--;
+          while (pos + len < src_size && src[ref + len] == src[pos + len])
+            len++;
+          if (!put_sequence (&dst, end, src + anchor, pos - anchor,
+                             pos - ref, len))
+            return 0;
+          pos += len;
+          anchor = pos;
+        }
+      else
+        pos++;
+    }
+  if (!put_sequence (&dst, end, src + anchor, src_size - anchor, 0, 0))
+    return 0;
+  return dst - (uint8_t *) dst_;
+}
+
+/* Reads a length continued past its nybble from *SRC, which must
+   not reach END, adding it to *LENGTH.  Returns false if the
+   input ends first. */
+static bool
+get_length (const uint8_t **src, const uint8_t *end, size_t *length)
+{
+  uint8_t b;
+
+  do
+    {
+      if (*src >= end)
+        return false;
+      b = *(*src)++;
+      *length += b;
+    }
+  while (b == 255);
+  return true;
+}
+
+/* Decompresses the SRC_SIZE bytes at SRC, as produced by
+   lz_compress(), into DST, which has room for DST_SIZE bytes.
+   Stops once DST is full, so that SRC may be followed by padding.
+   Returns the size of the decompressed data, or SIZE_MAX if the
+   input is malformed or would overflow DST. */
+size_t
+lz_decompress (const void *src_, size_t src_size,
+               void *dst_, size_t dst_size)
+{
+  const uint8_t *src = src_, *src_end = src + src_size;
+  uint8_t *dst = dst_, *dst_end = dst + dst_size;
+
+  while (src < src_end && dst < dst_end)
+    {
+      uint8_t token = *src++;
+      size_t lit_cnt = token >> 4, match_len = token & 15, offset;
+      const uint8_t *ref;
+
+      if (lit_cnt == 15 && !get_length (&src, src_end, &lit_cnt))
+        return SIZE_MAX;
+      if ((size_t) (src_end - src) < lit_cnt
+          || (size_t) (dst_end - dst) < lit_cnt)
+        return SIZE_MAX;
+      memcpy (dst, src, lit_cnt);
+      src += lit_cnt;
+      dst += lit_cnt;
+      if (src == src_end || dst == dst_end)
+        break;
+
+      /* The match may overlap its own output, so copy bytewise. */
+      if (src_end - src < 2)
+        return SIZE_MAX;
+      offset = src[0] | src[1] << 8;
+      src += 2;
+      if (match_len == 15 && !get_length (&src, src_end, &match_len))
+        return SIZE_MAX;
+      match_len += MIN_MATCH;
+      if (offset == 0 || offset > (size_t) (dst - (uint8_t *) dst_)
+          || (size_t) (dst_end - dst) < match_len)
+        return SIZE_MAX;
+      for (ref = dst - offset; match_len > 0; match_len--)
+        *dst++ = *ref++;
+    }
+  return dst - (uint8_t *) dst_;
+}
@@ -0,0 +1,23 @@
+#ifndef __LIB_LZ_H
+#define __LIB_LZ_H
+
+/* Fast LZ77 compression of small blocks, in the style of LZ4.
+   Meant for data that is read far more often than it is written:
+   decompression needs no memory beyond the output and runs at
+   close to memcpy() speed. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Largest block that can be compressed at once, in bytes. */
+#define LZ_MAX_INPUT 65535
+
+/* Bytes of scratch memory that lz_compress() needs. */
+#define LZ_WORK_SIZE (sizeof (uint16_t) << 10)
+
+size_t lz_compress (const void *src, size_t src_size,
+                    void *dst, size_t dst_size, void *work);
+size_t lz_decompress (const void *src, size_t src_size,
+                      void *dst, size_t dst_size);
+
+#endif /* lib/lz.h */
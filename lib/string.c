@@ -1,8 +1,28 @@
 #include <string.h>
 #include <debug.h>
+#include <stdint.h>
+
+/* A machine word, which may alias any other type. */
+typedef uint32_t __attribute__ ((may_alias)) word_t;
+
+/* Nonzero if any byte of word W is zero.
+
+   The string functions below scan strings a word at a time once
+   their pointer is word aligned.  An aligned word never spans two
+   pages, so reading the bytes past a string's null terminator in
+   the same word cannot fault even if the string ends just before
+   an unmapped page. */
+#define HAS_ZERO(W) (((W) - 0x01010101u) & ~(W) & 0x80808080u)
+
+/* Returns true if P is word aligned. */
+#define WORD_ALIGNED(P) ((uintptr_t) (P) % sizeof (word_t) == 0)
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
-   Returns DST. */
+   Returns DST.
+
+   Blocks of more than a few words are copied a word at a time
+   with "rep movsl", after copying single bytes until DST is word
+   aligned. */
 void *
 memcpy (void *dst_, const void *src_, size_t size) 
 {
@@ -12,8 +32,21 @@ memcpy (void *dst_, const void *src_, size_t size)
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
-  while (size-- > 0)
-    *dst++ = *src++;
+  if (size >= 4 * sizeof (word_t))
+    {
+      size_t head = -(uintptr_t) dst % sizeof (word_t);
+      size_t words;
+
+      size -= head;
+      asm volatile ("rep movsb"
+                    : "+D" (dst), "+S" (src), "+c" (head) : : "memory");
+      words = size / sizeof (word_t);
+      size %= sizeof (word_t);
+      asm volatile ("rep movsl"
+                    : "+D" (dst), "+S" (src), "+c" (words) : : "memory");
+    }
+  asm volatile ("rep movsb"
+                : "+D" (dst), "+S" (src), "+c" (size) : : "memory");
 
   return dst_;
 }
@@ -29,26 +62,37 @@ memmove (void *dst_, const void *src_, size_t size)
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
-  if (dst < src) 
+  if (dst <= src || dst >= src + size) 
     {
-      while (size-- > 0)
-        *dst++ = *src++;
+      /* A forward copy reads each byte before it can be
+         overwritten. */
+      return memcpy (dst_, src_, size);
     }
-  else 
+  else if (size > 0)
     {
-      dst += size;
-      src += size;
-      while (size-- > 0)
-        *--dst = *--src;
+      /* Copy backward, with the direction flag set: first the bytes
+         past the last whole word, then the words. */
+      size_t tail = size % sizeof (word_t);
+      size_t words = size / sizeof (word_t);
+
+      dst += size - 1;
+      src += size - 1;
+      asm volatile ("std; rep movsb"
+                    : "+D" (dst), "+S" (src), "+c" (tail) : : "memory");
+      dst -= sizeof (word_t) - 1;
+      src -= sizeof (word_t) - 1;
+      asm volatile ("rep movsl; cld"
+                    : "+D" (dst), "+S" (src), "+c" (words) : : "memory");
     }
 
-  return dst;
+  return dst_;
 }
 
 /* Find the first differing byte in the two blocks of SIZE bytes
    at A and B.  Returns a positive value if the byte in A is
    greater, a negative value if the byte in B is greater, or zero
-   if blocks A and B are equal. */
+   if blocks A and B are equal.  Equal prefixes are skipped a word
+   at a time. */
 int
 memcmp (const void *a_, const void *b_, size_t size) 
 {
@@ -58,6 +102,10 @@ memcmp (const void *a_, const void *b_, size_t size)
   ASSERT (a != NULL || size == 0);
   ASSERT (b != NULL || size == 0);
 
+  for (; size >= sizeof (word_t); a += sizeof (word_t), b += sizeof (word_t),
+         size -= sizeof (word_t))
+    if (*(const word_t *) a != *(const word_t *) b)
+      break;
   for (; size-- > 0; a++, b++)
     if (*a != *b)
       return *a > *b ? +1 : -1;
@@ -78,6 +126,21 @@ strcmp (const char *a_, const char *b_)
   ASSERT (a != NULL);
   ASSERT (b != NULL);
 
+  /* If A and B are equally aligned, compare whole words once they
+     are aligned, until a word differs or holds a null byte. */
+  if ((uintptr_t) a % sizeof (word_t) == (uintptr_t) b % sizeof (word_t))
+    {
+      for (; !WORD_ALIGNED (a); a++, b++)
+        if (*a == '\0' || *a != *b)
+          return *a < *b ? -1 : *a > *b;
+      while (*(const word_t *) a == *(const word_t *) b
+             && !HAS_ZERO (*(const word_t *) a))
+        {
+          a += sizeof (word_t);
+          b += sizeof (word_t);
+        }
+    }
+
   while (*a != '\0' && *a == *b) 
     {
       a++;
@@ -113,6 +176,7 @@ char *
 strchr (const char *string, int c_) 
 {
   char c = c_;
+  uint32_t pattern = (unsigned char) c * 0x01010101u;
 
   ASSERT (string != NULL);
 
@@ -121,8 +185,16 @@ strchr (const char *string, int c_)
       return (char *) string;
     else if (*string == '\0')
       return NULL;
+    else if (!WORD_ALIGNED (++string))
+      continue;
     else
-      string++;
+      {
+        /* Skip words holding neither C nor a null byte. */
+        word_t w;
+        while (w = *(const word_t *) string,
+               !HAS_ZERO (w) && !HAS_ZERO (w ^ pattern))
+          string += sizeof (word_t);
+      }
 }
 
 /* Returns the length of the initial substring of STRING that
@@ -274,16 +346,31 @@ strtok_r (char *s, const char *delimiters, char **save_ptr)
   return token;
 }
 
-/* Sets the SIZE bytes in DST to VALUE. */
+/* Sets the SIZE bytes in DST to VALUE.  Like memcpy(), stores a
+   word at a time with "rep stosl" once DST is word aligned. */
 void *
 memset (void *dst_, int value, size_t size) 
 {
   unsigned char *dst = dst_;
+  uint32_t word = (unsigned char) value * 0x01010101u;
 
   ASSERT (dst != NULL || size == 0);
   
-  while (size-- > 0)
-    *dst++ = value;
+  if (size >= 4 * sizeof (word_t))
+    {
+      size_t head = -(uintptr_t) dst % sizeof (word_t);
+      size_t words;
+
+      size -= head;
+      asm volatile ("rep stosb"
+                    : "+D" (dst), "+c" (head) : "a" (word) : "memory");
+      words = size / sizeof (word_t);
+      size %= sizeof (word_t);
+      asm volatile ("rep stosl"
+                    : "+D" (dst), "+c" (words) : "a" (word) : "memory");
+    }
+  asm volatile ("rep stosb"
+                : "+D" (dst), "+c" (size) : "a" (word) : "memory");
 
   return dst_;
 }
@@ -296,7 +383,12 @@ strlen (const char *string)
 
   ASSERT (string != NULL);
 
-  for (p = string; *p != '\0'; p++)
+  for (p = string; !WORD_ALIGNED (p); p++)
+    if (*p == '\0')
+      return p - string;
+  while (!HAS_ZERO (*(const word_t *) p))
+    p += sizeof (word_t);
+  for (; *p != '\0'; p++)
     continue;
   return p - string;
 }
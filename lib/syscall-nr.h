@@ -28,7 +28,197 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+    SYS_READDIR_BATCH,          /* Reads many directory entries. */
+    SYS_BLOCKSTATS,             /* Reports block device statistics. */
+    SYS_PREAD,                  /* Read from a file at an offset. */
+    SYS_PWRITE,                 /* Write to a file at an offset. */
+    SYS_READV,                  /* Read from a file into many buffers. */
+    SYS_WRITEV,                 /* Write to a file from many buffers. */
+    SYS_COPY_FILE_RANGE,        /* Copy data between two files. */
+    SYS_SCHED_TRACE,            /* Dump the scheduler trace. */
+    SYS_TICKS,                  /* Timer ticks since boot. */
+    SYS_FORK,                   /* Duplicate the current process. */
+    SYS_PIPE,                   /* Create a pipe. */
+    SYS_SHM_ATTACH,             /* Attach a shared memory segment. */
+    SYS_SHM_DETACH,             /* Detach a shared memory segment. */
+    SYS_FUTEX_WAIT,             /* Sleep while a word holds a value. */
+    SYS_FUTEX_WAKE,             /* Wake threads sleeping on a word. */
+    SYS_AIO_READ,               /* Start reading from a file. */
+    SYS_AIO_WRITE,              /* Start writing to a file. */
+    SYS_AIO_POLL,               /* Check whether a transfer is done. */
+    SYS_AIO_WAIT,               /* Wait for a transfer to finish. */
+    SYS_FTRUNCATE,              /* Change the size of a file. */
+    SYS_FALLOCATE,              /* Allocate space in a file. */
+    SYS_CLONE_FILE,             /* Copy a file, sharing its data. */
+    SYS_COMPRESS,               /* Turn compression of a file on or off. */
+    SYS_FADVISE,                /* Describe how a file will be read. */
+    SYS_MADVISE,                /* Describe how mapped memory will be used. */
+    SYS_FSYNC,                  /* Write a file's data and metadata to disk. */
+    SYS_FDATASYNC,              /* Write a file's data to disk. */
+    SYS_SYNC,                   /* Write all unwritten data to disk. */
+    SYS_STAT,                   /* Describe a file by name. */
+    SYS_FSTAT,                  /* Describe an open file. */
+    SYS_GETRUSAGE,              /* Report resource usage. */
+    SYS_IOPRIO,                 /* Set disk scheduling weight and cap. */
+    SYS_WAIT_ANY,               /* Wait for whichever child exits first. */
+    SYS_RING_ENTER,             /* Run the calls queued on a ring. */
+    SYS_SPAWN,                  /* Start a process without waiting. */
+    SYS_POLL                    /* Wait for file descriptors to be ready. */
+  };
+
+/* Access pattern advice for SYS_FADVISE and SYS_MADVISE. */
+#define ADVICE_NORMAL 0         /* No particular pattern. */
+#define ADVICE_SEQUENTIAL 1     /* Read in order: read far ahead. */
+#define ADVICE_RANDOM 2         /* Read at random: never read ahead. */
+#define ADVICE_WILLNEED 3       /* Needed soon: start loading it. */
+#define ADVICE_DONTNEED 4       /* Not needed again: drop it. */
+
+/* One buffer for SYS_READV and SYS_WRITEV, which accept up to
+   IOV_MAX of them per call. */
+#define IOV_MAX 64
+struct iovec
+  {
+    void *iov_base;             /* Start of buffer. */
+    unsigned iov_len;           /* Number of bytes in buffer. */
+  };
+
+/* One file descriptor for SYS_POLL, which accepts up to POLL_MAX
+   of them per call.  EVENTS says which of POLLIN and POLLOUT to
+   report; POLLERR, POLLHUP and POLLNVAL are always reported. */
+#define POLL_MAX 64
+struct pollfd
+  {
+    int fd;                     /* File descriptor. */
+    short events;               /* Events of interest. */
+    short revents;              /* Events that occurred. */
+  };
+#define POLLIN 0x01             /* Reading would not block. */
+#define POLLOUT 0x04            /* Writing would not block. */
+#define POLLERR 0x08            /* Pipe write end with no readers. */
+#define POLLHUP 0x10            /* Pipe read end with no writers. */
+#define POLLNVAL 0x20           /* Not an open file descriptor. */
+
+/* A file as described by SYS_STAT and SYS_FSTAT. */
+struct stat
+  {
+    unsigned size;              /* Length in bytes. */
+    int is_dir;                 /* Nonzero if it is a directory. */
+    int inumber;                /* Inode number. */
+    unsigned blocks;            /* Sectors allocated to its data and
+                                   to the index sectors that map it. */
+  };
+
+/* One directory entry as stored by SYS_READDIR_BATCH. */
+struct readdir_record
+  {
+    int inumber;                /* Inode number of the entry. */
+    int is_dir;                 /* Nonzero if it is a directory. */
+    char name[255 + 1];         /* Null terminated name. */
+  };
+
+/* Block device statistics as reported by SYS_BLOCKSTATS.
+   For a device stacked on another, such as a partition, all but
+   the sector counts describe the device at the bottom of the
+   stack, where requests are queued. */
+#define BLOCKSTATS_LATENCY_CNT 16
+#define BLOCKSTATS_HEAT_CNT 16
+struct block_stats
+  {
+    unsigned long long read_cnt;        /* Sectors read. */
+    unsigned long long write_cnt;       /* Sectors written. */
+    unsigned long long request_cnt;     /* Requests completed. */
+    unsigned long long merge_cnt;       /* Requests merged into others. */
+    unsigned long long seek_cnt;        /* Dispatches that did not start
+                                           where the previous one ended. */
+    unsigned long long throttle_cnt;    /* Dispatches that passed over a
+                                           process at its bandwidth
+                                           cap. */
+    unsigned depth;                     /* Requests queued or in flight. */
+    unsigned max_depth;                 /* Most requests ever pending. */
+
+    /* Completed requests by latency from submission to
+       completion.  Entry I counts those that took fewer than
+       2**(I + 10) CPU cycles but at least as many as entry I - 1
+       allows; the last entry also counts anything slower. */
+    unsigned latency[BLOCKSTATS_LATENCY_CNT];
+
+    /* Sectors moved in each of BLOCKSTATS_HEAT_CNT equal ranges of
+       the device, from its first sector to its last. */
+    unsigned long long heat[BLOCKSTATS_HEAT_CNT];
+  };
+
+/* Disk scheduling weights for SYS_IOPRIO.  Processes with
+   requests pending for the same disk share its bandwidth in
+   proportion to their weights. */
+#define IOPRIO_WEIGHT_MIN 1     /* Smallest share. */
+#define IOPRIO_WEIGHT_DEFAULT 100 /* Share of a new process. */
+#define IOPRIO_WEIGHT_MAX 1000  /* Largest share. */
+
+/* Whose usage SYS_GETRUSAGE reports. */
+#define RUSAGE_SELF 0           /* The calling process. */
+#define RUSAGE_CHILDREN 1       /* Its children that it has waited for,
+                                   and theirs, recursively. */
+
+/* Resource usage as reported by SYS_GETRUSAGE.  Sectors count
+   toward the process that asked for the transfer, when it asked.
+   A page fault is minor if it is served from memory and major if
+   it has to read the disk. */
+#define RUSAGE_LATENCY_CNT 16
+struct rusage
+  {
+    unsigned long long user_ticks;      /* Timer ticks in user mode. */
+    unsigned long long kernel_ticks;    /* Timer ticks in the kernel. */
+    unsigned long long read_sectors;    /* Sectors read. */
+    unsigned long long write_sectors;   /* Sectors written. */
+    unsigned long long syscall_cnt;     /* System calls made. */
+
+    unsigned minor_faults;      /* Page faults served from memory. */
+    unsigned major_faults;      /* Page faults that read the disk. */
+    unsigned zero_faults;       /* Pages zero-filled (minor). */
+    unsigned cow_faults;        /* Pages copied on write (minor). */
+    unsigned file_faults;       /* Pages read from files (major). */
+    unsigned swap_faults;       /* Pages read back from swap (major). */
+
+    /* Page faults by latency, including any wait for the disk.
+       Entry I counts those that took fewer than 2**(I + 10) CPU
+       cycles but at least as many as entry I - 1 allows; the last
+       entry also counts anything slower. */
+    unsigned minor_latency[RUSAGE_LATENCY_CNT];
+    unsigned major_latency[RUSAGE_LATENCY_CNT];
+  };
+
+/* A submission ring and a completion ring, in the memory of the
+   process that uses them, for issuing many system calls with one
+   SYS_RING_ENTER.  The process fills in sq[sq_tail % RING_ENTRIES]
+   and advances sq_tail for each call it queues.  SYS_RING_ENTER
+   makes the queued calls in order, advancing sq_head past each,
+   and stores each one's result at cq[cq_tail % RING_ENTRIES],
+   advancing cq_tail, so the process reaps completions from cq_head
+   up to cq_tail without entering the kernel.  It stops early when
+   the completion ring is full.  All four counters run freely and
+   wrap around. */
+#define RING_ENTRIES 64
+struct ring_sqe
+  {
+    int nr;                     /* SYS_* number. */
+    int args[4];                /* Its arguments. */
+    unsigned user_data;         /* Copied to the completion. */
+  };
+struct ring_cqe
+  {
+    unsigned user_data;         /* From the submission. */
+    int result;                 /* What the call returned, or -1 if it
+                                   may not be made from a ring. */
+  };
+struct ring
+  {
+    unsigned sq_head;           /* Advanced by the kernel. */
+    unsigned sq_tail;           /* Advanced by the process. */
+    unsigned cq_head;           /* Advanced by the process. */
+    unsigned cq_tail;           /* Advanced by the kernel. */
+    struct ring_sqe sq[RING_ENTRIES];
+    struct ring_cqe cq[RING_ENTRIES];
   };
 
 #endif /* lib/syscall-nr.h */
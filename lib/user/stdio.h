@@ -4,4 +4,45 @@
 int hprintf (int, const char *, ...) PRINTF_FORMAT (2, 3);
 int vhprintf (int, const char *, va_list) PRINTF_FORMAT (2, 0);
 
+/* Buffered streams.
+
+   A stream collects small reads and writes on a file descriptor
+   into a buffer, so that they reach the kernel as a few large
+   read() and write() system calls.  See stream.c for details. */
+typedef struct stream FILE;
+
+#define EOF (-1)                /* End of file or error. */
+#define BUFSIZ 512              /* Default buffer size. */
+#define FOPEN_MAX 8             /* Streams that may be open at once. */
+
+/* Buffering modes for setvbuf(). */
+#define _IOFBF 0                /* Fully buffered. */
+#define _IOLBF 1                /* Line buffered. */
+#define _IONBF 2                /* Unbuffered. */
+
+extern FILE *stdin;             /* Unbuffered, since keyboard reads block. */
+extern FILE *stdout;            /* Line buffered. */
+
+FILE *fopen (const char *name, const char *mode);
+FILE *fdopen (int fd, const char *mode);
+int fclose (FILE *);
+int fflush (FILE *);
+int setvbuf (FILE *, char *buf, int mode, size_t size);
+
+size_t fread (void *, size_t size, size_t cnt, FILE *);
+size_t fwrite (const void *, size_t size, size_t cnt, FILE *);
+int fgetc (FILE *);
+char *fgets (char *, int size, FILE *);
+int fputc (int, FILE *);
+int fputs (const char *, FILE *);
+int fprintf (FILE *, const char *, ...) PRINTF_FORMAT (2, 3);
+int vfprintf (FILE *, const char *, va_list) PRINTF_FORMAT (2, 0);
+
+int feof (FILE *);
+int ferror (FILE *);
+int fileno (FILE *);
+
+/* Internal function, called by exit(). */
+void __fflush_all (void);
+
 #endif /* lib/user/stdio.h */
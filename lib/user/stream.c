@@ -0,0 +1,503 @@
+/* Buffered streams.
+
+   A stream wraps a file descriptor with a buffer.  Reads fill
+   the buffer a whole BUFSIZ at a time and are then satisfied from
+   it; writes collect in it until it fills, the stream is flushed,
+   or, for a line-buffered stream, a new-line is written.  Reads
+   and writes at least as large as the buffer bypass it and go
+   straight to the kernel.
+
+   User programs have no heap, so the streams and their default
+   buffers are allocated statically, FOPEN_MAX of each.  setvbuf()
+   can substitute a buffer of any size provided by the caller.
+
+   A stream holds either buffered input or buffered output at any
+   given time, never both.  Switching from reading to writing
+   seeks the file descriptor back over the unread input, and
+   switching from writing to reading flushes the output.
+
+   Buffered output is flushed by exit(), and so also when main()
+   returns. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+
+/* Stream flags. */
+#define S_READ  0x01            /* Open for reading. */
+#define S_WRITE 0x02            /* Open for writing. */
+#define S_EOF   0x04            /* End of file reached. */
+#define S_ERROR 0x08            /* Read or write failed. */
+
+/* A stream.  A slot in STREAMS is free if its FLAGS are 0. */
+struct stream
+  {
+    int fd;                     /* File descriptor. */
+    int flags;                  /* S_* flags. */
+    int mode;                   /* _IOFBF, _IOLBF, or _IONBF. */
+    char *buf;                  /* Buffer. */
+    size_t size;                /* Buffer size in bytes. */
+    size_t ofs;                 /* Offset of unread input in BUF. */
+    size_t rcnt;                /* Bytes of unread input in BUF. */
+    size_t wcnt;                /* Bytes of unflushed output in BUF. */
+  };
+
+static char default_bufs[FOPEN_MAX][BUFSIZ];
+
+static struct stream streams[FOPEN_MAX] =
+  {
+    { STDIN_FILENO, S_READ, _IONBF, NULL, 0, 0, 0, 0 },
+    { STDOUT_FILENO, S_WRITE, _IOLBF, default_bufs[1], BUFSIZ, 0, 0, 0 },
+  };
+
+FILE *stdin = &streams[0];
+FILE *stdout = &streams[1];
+
+/* Returns the S_READ and S_WRITE flags for fopen() mode string
+   MODE, or 0 if MODE is invalid. */
+static int
+parse_mode (const char *mode)
+{
+  int flags;
+
+  switch (*mode)
+    {
+    case 'r':
+      flags = S_READ;
+      break;
+    case 'w':
+    case 'a':
+      flags = S_WRITE;
+      break;
+    default:
+      return 0;
+    }
+  if (strchr (mode, '+') != NULL)
+    flags = S_READ | S_WRITE;
+  return flags;
+}
+
+/* Returns a free stream slot, or a null pointer if all are in
+   use. */
+static struct stream *
+alloc_stream (void)
+{
+  struct stream *s;
+
+  for (s = streams; s < streams + FOPEN_MAX; s++)
+    if (s->flags == 0)
+      return s;
+  return NULL;
+}
+
+/* Opens a fully buffered stream on file descriptor FD, which
+   must be open, with the access given by MODE as for fopen().
+   Returns the stream, or a null pointer on failure. */
+FILE *
+fdopen (int fd, const char *mode)
+{
+  int flags = parse_mode (mode);
+  struct stream *s = alloc_stream ();
+
+  if (flags == 0 || s == NULL)
+    return NULL;
+
+  s->fd = fd;
+  s->flags = flags;
+  s->mode = _IOFBF;
+  s->buf = default_bufs[s - streams];
+  s->size = BUFSIZ;
+  s->ofs = s->rcnt = s->wcnt = 0;
+  return s;
+}
+
+/* Opens file NAME as a fully buffered stream and returns it, or
+   a null pointer on failure.  MODE is "r" to read an existing
+   file, "w" to write a new, empty file, replacing any existing
+   one, or "a" to append to a file, creating it if necessary,
+   optionally followed by "+" to permit both reading and
+   writing. */
+FILE *
+fopen (const char *name, const char *mode)
+{
+  FILE *s;
+  int fd;
+
+  if (parse_mode (mode) == 0 || alloc_stream () == NULL)
+    return NULL;
+
+  if (*mode == 'w')
+    {
+      /* There is no way to truncate a file, so replace it. */
+      remove (name);
+      if (!create (name, 0))
+        return NULL;
+    }
+  else if (*mode == 'a')
+    create (name, 0);
+
+  fd = open (name);
+  if (fd < 0)
+    return NULL;
+  if (*mode == 'a')
+    seek (fd, filesize (fd));
+
+  s = fdopen (fd, mode);
+  if (s == NULL)
+    close (fd);
+  return s;
+}
+
+/* Writes S's buffered output to its file.  Returns 0 if
+   successful, otherwise EOF. */
+static int
+flush_output (struct stream *s)
+{
+  if (s->wcnt > 0)
+    {
+      int n = write (s->fd, s->buf, s->wcnt);
+      if (n < 0 || (size_t) n != s->wcnt)
+        {
+          s->flags |= S_ERROR;
+          s->wcnt = 0;
+          return EOF;
+        }
+      s->wcnt = 0;
+    }
+  return 0;
+}
+
+/* Discards S's buffered input, moving its file position back so
+   that the input will be read again. */
+static void
+drop_input (struct stream *s)
+{
+  if (s->rcnt > 0)
+    {
+      seek (s->fd, tell (s->fd) - s->rcnt);
+      s->rcnt = 0;
+    }
+}
+
+/* Writes any buffered output in S to its file, and discards any
+   buffered input.  If S is a null pointer, does so for every
+   open stream.  Returns 0 if successful, otherwise EOF. */
+int
+fflush (FILE *s)
+{
+  int retval = 0;
+
+  if (s == NULL)
+    {
+      for (s = streams; s < streams + FOPEN_MAX; s++)
+        if (s->flags != 0 && fflush (s) == EOF)
+          retval = EOF;
+      return retval;
+    }
+
+  retval = flush_output (s);
+  drop_input (s);
+  return retval;
+}
+
+/* Flushes every open stream.  Called by exit(). */
+void
+__fflush_all (void)
+{
+  fflush (NULL);
+}
+
+/* Flushes and closes stream S.  The console file descriptors are
+   left open.  Returns 0 if successful, otherwise EOF. */
+int
+fclose (FILE *s)
+{
+  int retval = fflush (s);
+
+  if (s->fd != STDIN_FILENO && s->fd != STDOUT_FILENO)
+    close (s->fd);
+  s->flags = 0;
+  return retval;
+}
+
+/* Sets stream S to buffering MODE, one of _IOFBF, _IOLBF, or
+   _IONBF.  For a buffered mode, uses the SIZE bytes at BUF as
+   the buffer, or if BUF is null, a buffer of SIZE bytes (or
+   BUFSIZ if SIZE is 0) which must not exceed BUFSIZ.  Returns 0
+   if successful, otherwise EOF. */
+int
+setvbuf (FILE *s, char *buf, int mode, size_t size)
+{
+  if (fflush (s) == EOF)
+    return EOF;
+
+  if (mode == _IONBF)
+    {
+      buf = NULL;
+      size = 0;
+    }
+  else if (mode != _IOFBF && mode != _IOLBF)
+    return EOF;
+  else if (buf == NULL)
+    {
+      if (size > BUFSIZ)
+        return EOF;
+      buf = default_bufs[s - streams];
+      if (size == 0)
+        size = BUFSIZ;
+    }
+  else if (size == 0)
+    return EOF;
+
+  s->mode = mode;
+  s->buf = buf;
+  s->size = size;
+  s->ofs = 0;
+  return 0;
+}
+
+/* Reads up to CNT objects of SIZE bytes each from stream S into
+   BUFFER.  Returns the number of whole objects read, which is
+   less than CNT only at end of file or on error. */
+size_t
+fread (void *buffer, size_t size, size_t cnt, FILE *s)
+{
+  char *dst = buffer;
+  size_t total = size * cnt;
+  size_t done = 0;
+
+  if (!(s->flags & S_READ))
+    {
+      s->flags |= S_ERROR;
+      return 0;
+    }
+  if (total == 0 || flush_output (s) == EOF)
+    return 0;
+
+  while (done < total)
+    {
+      size_t left = total - done;
+      int n;
+
+      if (s->rcnt > 0)
+        {
+          /* Satisfy from buffered input. */
+          n = left < s->rcnt ? left : s->rcnt;
+          memcpy (dst + done, s->buf + s->ofs, n);
+          s->ofs += n;
+          s->rcnt -= n;
+          done += n;
+          continue;
+        }
+
+      if (left >= s->size)
+        {
+          /* Large enough to read directly. */
+          n = read (s->fd, dst + done, left);
+          if (n > 0)
+            done += n;
+        }
+      else
+        {
+          /* Refill the buffer. */
+          n = read (s->fd, s->buf, s->size);
+          if (n > 0)
+            {
+              s->ofs = 0;
+              s->rcnt = n;
+            }
+        }
+      if (n <= 0)
+        {
+          s->flags |= n == 0 ? S_EOF : S_ERROR;
+          break;
+        }
+    }
+  return done / size;
+}
+
+/* Writes CNT objects of SIZE bytes each from BUFFER to stream S.
+   Returns the number of whole objects written, which is less
+   than CNT only on error. */
+size_t
+fwrite (const void *buffer, size_t size, size_t cnt, FILE *s)
+{
+  const char *src = buffer;
+  size_t total = size * cnt;
+  size_t done = 0;
+
+  if (!(s->flags & S_WRITE))
+    {
+      s->flags |= S_ERROR;
+      return 0;
+    }
+  if (total == 0)
+    return 0;
+  drop_input (s);
+
+  while (done < total)
+    {
+      size_t left = total - done;
+      size_t n;
+
+      if (s->wcnt == 0 && left >= s->size)
+        {
+          /* Large enough to write directly. */
+          int written = write (s->fd, src + done, left);
+          if (written > 0)
+            done += written;
+          if (written < 0 || (size_t) written != left)
+            s->flags |= S_ERROR;
+          break;
+        }
+
+      n = s->size - s->wcnt;
+      if (n > left)
+        n = left;
+      memcpy (s->buf + s->wcnt, src + done, n);
+      s->wcnt += n;
+      done += n;
+      if (s->wcnt == s->size && flush_output (s) == EOF)
+        break;
+    }
+
+  if (s->mode == _IOLBF && s->wcnt > 0 && memchr (src, '\n', done) != NULL)
+    flush_output (s);
+  return done / size;
+}
+
+/* Reads and returns one character from stream S, or EOF at end
+   of file or on error. */
+int
+fgetc (FILE *s)
+{
+  unsigned char c;
+
+  if (s->rcnt > 0)
+    {
+      s->rcnt--;
+      return (unsigned char) s->buf[s->ofs++];
+    }
+  return fread (&c, 1, 1, s) == 1 ? c : EOF;
+}
+
+/* Reads a line from stream S into the SIZE bytes at STRING,
+   stopping after a new-line, at end of file, or when SIZE - 1
+   characters have been read, and null-terminates it.  Returns
+   STRING, or a null pointer if nothing could be read. */
+char *
+fgets (char *string, int size, FILE *s)
+{
+  char *p = string;
+
+  if (size <= 0)
+    return NULL;
+
+  while (p < string + size - 1)
+    {
+      int c = fgetc (s);
+      if (c == EOF)
+        {
+          if (p == string)
+            return NULL;
+          break;
+        }
+      *p++ = c;
+      if (c == '\n')
+        break;
+    }
+  *p = '\0';
+  return string;
+}
+
+/* Writes character C to stream S.  Returns C, or EOF on
+   error. */
+int
+fputc (int c, FILE *s)
+{
+  char ch = c;
+
+  /* Fast path for buffering a character that cannot cause a
+     flush. */
+  if ((s->flags & S_WRITE) && s->rcnt == 0 && s->wcnt + 1 < s->size
+      && (ch != '\n' || s->mode == _IOFBF))
+    {
+      s->buf[s->wcnt++] = ch;
+      return (unsigned char) ch;
+    }
+  return fwrite (&ch, 1, 1, s) == 1 ? (unsigned char) ch : EOF;
+}
+
+/* Writes string STRING to stream S, without a new-line.  Returns
+   0 if successful, otherwise EOF. */
+int
+fputs (const char *string, FILE *s)
+{
+  size_t length = strlen (string);
+
+  return fwrite (string, 1, length, s) == length ? 0 : EOF;
+}
+
+/* Auxiliary data for vfprintf_helper(). */
+struct vfprintf_aux
+  {
+    FILE *stream;       /* Output stream. */
+    int char_cnt;       /* Total characters written so far. */
+  };
+
+/* Helper function for vfprintf(). */
+static void
+vfprintf_helper (char c, void *aux_)
+{
+  struct vfprintf_aux *aux = aux_;
+
+  fputc (c, aux->stream);
+  aux->char_cnt++;
+}
+
+/* Like vprintf(), but writes output to stream S. */
+int
+vfprintf (FILE *s, const char *format, va_list args)
+{
+  struct vfprintf_aux aux;
+
+  aux.stream = s;
+  aux.char_cnt = 0;
+  __vprintf (format, args, vfprintf_helper, &aux);
+  return aux.char_cnt;
+}
+
+/* Like printf(), but writes output to stream S. */
+int
+fprintf (FILE *s, const char *format, ...)
+{
+  va_list args;
+  int retval;
+
+  va_start (args, format);
+  retval = vfprintf (s, format, args);
+  va_end (args);
+
+  return retval;
+}
+
+/* Returns nonzero if stream S has reached end of file. */
+int
+feof (FILE *s)
+{
+  return (s->flags & S_EOF) != 0;
+}
+
+/* Returns nonzero if a read or write on stream S has failed. */
+int
+ferror (FILE *s)
+{
+  return (s->flags & S_ERROR) != 0;
+}
+
+/* Returns the file descriptor underlying stream S. */
+int
+fileno (FILE *s)
+{
+  return s->fd;
+}
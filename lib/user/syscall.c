@@ -1,7 +1,35 @@
 #include <syscall.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "../syscall-nr.h"
-#include <console.h>
-#include "../kernel/console.h"
+
+/* Every system call pushes its arguments and number and then
+   calls through syscall_entry, which traps into the kernel with
+   the stack pointer at the number, as the kernel expects, and
+   returns with the result in EAX.  It clobbers ECX and EDX.
+
+   __syscall_int uses int $0x30, which works everywhere.
+   __syscall_sysenter uses SYSENTER, which is several times
+   cheaper on CPUs that have it: it skips the IDT lookup and the
+   privilege checks and stack switch of an interrupt gate, and
+   the kernel returns with SYSEXIT instead of IRET.  SYSENTER
+   saves neither the stack pointer nor the return address, so we
+   pass them in ECX and EDX, after popping the return address so
+   that the stack looks the same on both paths.
+   syscall_init_entry() picks one when the program starts. */
+void __syscall_int (void);
+void __syscall_sysenter (void);
+asm (".text\n"
+     "__syscall_int:\n"
+     "\tpopl %edx\n"
+     "\tint $0x30\n"
+     "\tjmp *%edx\n"
+     "__syscall_sysenter:\n"
+     "\tpopl %edx\n"
+     "\tmovl %esp, %ecx\n"
+     "\tsysenter\n");
+
+static void (*syscall_entry) (void) = __syscall_int;
 
 /* Invokes syscall NUMBER, passing no arguments, and returns the
    return value as an `int'. */
@@ -9,25 +37,28 @@
         ({                                                      \
           int retval;                                           \
           asm volatile                                          \
-            ("pushl %[number]; int $0x30; addl $4, %%esp"       \
+            ("pushl %[number]; call *%[entry]; addl $4, %%esp"  \
                : "=a" (retval)                                  \
-               : [number] "i" (NUMBER)                          \
-               : "memory");                                     \
+               : [number] "i" (NUMBER),                         \
+                 [entry] "m" (syscall_entry)                    \
+               : "ecx", "edx", "cc", "memory");                 \
           retval;                                               \
         })
 
 /* Invokes syscall NUMBER, passing argument ARG0, and returns the
    return value as an `int'. */
-#define syscall1(NUMBER, ARG0)                                           \
-        ({                                                               \
-          int retval;                                                    \
-          asm volatile                                                   \
-            ("pushl %[arg0]; pushl %[number]; int $0x30; addl $8, %%esp" \
-               : "=a" (retval)                                           \
-               : [number] "i" (NUMBER),                                  \
-                 [arg0] "g" (ARG0)                                       \
-               : "memory");                                              \
-          retval;                                                        \
+#define syscall1(NUMBER, ARG0)                                  \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[arg0]; pushl %[number]; "                 \
+             "call *%[entry]; addl $8, %%esp"                   \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [entry] "m" (syscall_entry),                   \
+                 [arg0] "g" (ARG0)                              \
+               : "ecx", "edx", "cc", "memory");                 \
+          retval;                                               \
         })
 
 /* Invokes syscall NUMBER, passing arguments ARG0 and ARG1, and
@@ -37,12 +68,13 @@
           int retval;                                           \
           asm volatile                                          \
             ("pushl %[arg1]; pushl %[arg0]; "                   \
-             "pushl %[number]; int $0x30; addl $12, %%esp"      \
+             "pushl %[number]; call *%[entry]; addl $12, %%esp" \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER),                         \
+                 [entry] "m" (syscall_entry),                   \
                  [arg0] "g" (ARG0),                             \
                  [arg1] "g" (ARG1)                              \
-               : "memory");                                     \
+               : "ecx", "edx", "cc", "memory");                 \
           retval;                                               \
         })
 
@@ -53,16 +85,56 @@
           int retval;                                           \
           asm volatile                                          \
             ("pushl %[arg2]; pushl %[arg1]; pushl %[arg0]; "    \
-             "pushl %[number]; int $0x30; addl $16, %%esp"      \
+             "pushl %[number]; call *%[entry]; addl $16, %%esp" \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER),                         \
+                 [entry] "m" (syscall_entry),                   \
                  [arg0] "g" (ARG0),                             \
                  [arg1] "g" (ARG1),                             \
                  [arg2] "g" (ARG2)                              \
-               : "memory");                                     \
+               : "ecx", "edx", "cc", "memory");                 \
+          retval;                                               \
+        })
+
+/* Invokes syscall NUMBER, passing arguments ARG0, ARG1, ARG2,
+   and ARG3, and returns the return value as an `int'. */
+#define syscall4(NUMBER, ARG0, ARG1, ARG2, ARG3)                \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[arg3]; pushl %[arg2]; pushl %[arg1]; "    \
+             "pushl %[arg0]; pushl %[number]; call *%[entry]; " \
+             "addl $20, %%esp"                                  \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [entry] "m" (syscall_entry),                   \
+                 [arg0] "g" (ARG0),                             \
+                 [arg1] "g" (ARG1),                             \
+                 [arg2] "g" (ARG2),                             \
+                 [arg3] "g" (ARG3)                              \
+               : "ecx", "edx", "cc", "memory");                 \
           retval;                                               \
         })
 
+/* CPUID leaf 1 EDX flag for SYSENTER and SYSEXIT. */
+#define CPUID_SEP 0x00000800
+
+/* Switches system calls to SYSENTER if the CPU supports it.
+   The kernel enables SYSENTER under the same test, in
+   userprog/syscall.c, which also explains the Pentium Pro
+   exception.  Called by _start() before anything else. */
+void
+syscall_init_entry (void) 
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+
+  asm ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  if ((edx & CPUID_SEP) != 0
+      && !(((eax >> 8) & 0xf) == 6 && ((eax >> 4) & 0xf) < 3
+           && (eax & 0xf) < 3))
+    syscall_entry = __syscall_sysenter;
+}
+
 void
 halt (void) 
 {
@@ -70,9 +142,15 @@ halt (void)
   NOT_REACHED ();
 }
 
+/* Flushes buffered streams.  Defined in stream.c, which is only
+   linked into programs that use streams. */
+void __fflush_all (void) __attribute__ ((weak));
+
 void
 exit (int status)
 {
+  if (__fflush_all != NULL)
+    __fflush_all ();
   syscall1 (SYS_EXIT, status);
   NOT_REACHED ();
 }
@@ -83,12 +161,36 @@ exec (const char *file)
   return (pid_t) syscall1 (SYS_EXEC, file);
 }
 
+pid_t
+spawn (const char *file)
+{
+  return (pid_t) syscall1 (SYS_SPAWN, file);
+}
+
+pid_t
+fork (void)
+{
+  return (pid_t) syscall0 (SYS_FORK);
+}
+
 int
 wait (pid_t pid)
 {
   return syscall1 (SYS_WAIT, pid);
 }
 
+pid_t
+wait_any (int *status)
+{
+  return syscall2 (SYS_WAIT_ANY, status, 1);
+}
+
+pid_t
+try_wait_any (int *status)
+{
+  return syscall2 (SYS_WAIT_ANY, status, 0);
+}
+
 bool
 create (const char *file, unsigned initial_size)
 {
@@ -146,6 +248,162 @@ close (int fd)
   syscall1 (SYS_CLOSE, fd);
 }
 
+int
+pread (int fd, void *buffer, unsigned size, unsigned position)
+{
+  return syscall4 (SYS_PREAD, fd, buffer, size, position);
+}
+
+int
+pwrite (int fd, const void *buffer, unsigned size, unsigned position)
+{
+  return syscall4 (SYS_PWRITE, fd, buffer, size, position);
+}
+
+int
+readv (int fd, const struct iovec *iov, int iovcnt)
+{
+  return syscall3 (SYS_READV, fd, iov, iovcnt);
+}
+
+int
+writev (int fd, const struct iovec *iov, int iovcnt)
+{
+  return syscall3 (SYS_WRITEV, fd, iov, iovcnt);
+}
+
+int
+copy_file_range (int in_fd, int out_fd, unsigned length)
+{
+  return syscall3 (SYS_COPY_FILE_RANGE, in_fd, out_fd, length);
+}
+
+int
+pipe (int fds[2])
+{
+  return syscall1 (SYS_PIPE, fds);
+}
+
+int
+futex_wait (int *addr, int val)
+{
+  return syscall2 (SYS_FUTEX_WAIT, addr, val);
+}
+
+int
+futex_wake (int *addr, int cnt)
+{
+  return syscall2 (SYS_FUTEX_WAKE, addr, cnt);
+}
+
+int
+aio_read (int fd, void *buffer, unsigned length, unsigned offset)
+{
+  return syscall4 (SYS_AIO_READ, fd, buffer, length, offset);
+}
+
+int
+aio_write (int fd, const void *buffer, unsigned length, unsigned offset)
+{
+  return syscall4 (SYS_AIO_WRITE, fd, buffer, length, offset);
+}
+
+int
+aio_poll (int ticket)
+{
+  return syscall1 (SYS_AIO_POLL, ticket);
+}
+
+int
+aio_wait (int ticket)
+{
+  return syscall1 (SYS_AIO_WAIT, ticket);
+}
+
+bool
+ftruncate (int fd, unsigned length)
+{
+  return syscall2 (SYS_FTRUNCATE, fd, length);
+}
+
+bool
+fallocate (int fd, unsigned offset, unsigned length)
+{
+  return syscall3 (SYS_FALLOCATE, fd, offset, length);
+}
+
+bool
+clone_file (const char *file, const char *new_file)
+{
+  return syscall2 (SYS_CLONE_FILE, file, new_file);
+}
+
+bool
+compress (int fd, bool enable)
+{
+  return syscall2 (SYS_COMPRESS, fd, enable);
+}
+
+bool
+fadvise (int fd, unsigned offset, unsigned length, int advice)
+{
+  return syscall4 (SYS_FADVISE, fd, offset, length, advice);
+}
+
+bool
+fsync (int fd)
+{
+  return syscall1 (SYS_FSYNC, fd);
+}
+
+bool
+fdatasync (int fd)
+{
+  return syscall1 (SYS_FDATASYNC, fd);
+}
+
+void
+sync (void)
+{
+  syscall0 (SYS_SYNC);
+}
+
+bool
+stat (const char *file, struct stat *st)
+{
+  return syscall2 (SYS_STAT, file, st);
+}
+
+bool
+fstat (int fd, struct stat *st)
+{
+  return syscall2 (SYS_FSTAT, fd, st);
+}
+
+bool
+getrusage (int who, struct rusage *usage)
+{
+  return syscall2 (SYS_GETRUSAGE, who, usage);
+}
+
+bool
+ioprio (unsigned weight, unsigned kbps)
+{
+  return syscall2 (SYS_IOPRIO, weight, kbps);
+}
+
+int
+ring_enter (struct ring *ring)
+{
+  return syscall1 (SYS_RING_ENTER, ring);
+}
+
+int
+poll (struct pollfd *fds, unsigned cnt, int timeout)
+{
+  return syscall3 (SYS_POLL, fds, cnt, timeout);
+}
+
 mapid_t
 mmap (int fd, void *addr)
 {
@@ -158,6 +416,24 @@ munmap (mapid_t mapid)
   syscall1 (SYS_MUNMAP, mapid);
 }
 
+bool
+madvise (void *addr, unsigned length, int advice)
+{
+  return syscall3 (SYS_MADVISE, addr, length, advice);
+}
+
+bool
+shm_attach (int key, void *addr, unsigned size)
+{
+  return syscall3 (SYS_SHM_ATTACH, key, addr, size);
+}
+
+bool
+shm_detach (void *addr)
+{
+  return syscall1 (SYS_SHM_DETACH, addr);
+}
+
 bool
 chdir (const char *dir)
 {
@@ -187,3 +463,27 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+int
+readdir_batch (int fd, struct readdir_record *records, unsigned max)
+{
+  return syscall3 (SYS_READDIR_BATCH, fd, records, max);
+}
+
+bool
+blockstats (const char *device, struct block_stats *stats)
+{
+  return syscall2 (SYS_BLOCKSTATS, device, stats);
+}
+
+void
+sched_trace (void)
+{
+  syscall0 (SYS_SCHED_TRACE);
+}
+
+int
+ticks (void)
+{
+  return syscall0 (SYS_TICKS);
+}
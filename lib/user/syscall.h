@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <syscall-nr.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -13,17 +14,24 @@ typedef int mapid_t;
 #define MAP_FAILED ((mapid_t) -1)
 
 /* Maximum characters in a filename written by readdir(). */
-#define READDIR_MAX_LEN 14
+#define READDIR_MAX_LEN 255
 
 /* Typical return values from main() and arguments to exit(). */
 #define EXIT_SUCCESS 0          /* Successful execution. */
 #define EXIT_FAILURE 1          /* Unsuccessful execution. */
 
+/* Startup, called by _start(). */
+void syscall_init_entry (void);
+
 /* Projects 2 and later. */
 void halt (void) NO_RETURN;
 void exit (int status) NO_RETURN;
 pid_t exec (const char *file);
+pid_t spawn (const char *file);
+pid_t fork (void);
 int wait (pid_t);
+pid_t wait_any (int *status);
+pid_t try_wait_any (int *status);
 bool create (const char *file, unsigned initial_size);
 bool remove (const char *file);
 int open (const char *file);
@@ -33,10 +41,39 @@ int write (int fd, const void *buffer, unsigned length);
 void seek (int fd, unsigned position);
 unsigned tell (int fd);
 void close (int fd);
+int pread (int fd, void *buffer, unsigned length, unsigned position);
+int pwrite (int fd, const void *buffer, unsigned length, unsigned position);
+int readv (int fd, const struct iovec *, int iovcnt);
+int writev (int fd, const struct iovec *, int iovcnt);
+int copy_file_range (int in_fd, int out_fd, unsigned length);
+int pipe (int fds[2]);
+int futex_wait (int *addr, int val);
+int futex_wake (int *addr, int cnt);
+int aio_read (int fd, void *buffer, unsigned length, unsigned offset);
+int aio_write (int fd, const void *buffer, unsigned length, unsigned offset);
+int aio_poll (int ticket);
+int aio_wait (int ticket);
+bool ftruncate (int fd, unsigned length);
+bool fallocate (int fd, unsigned offset, unsigned length);
+bool clone_file (const char *file, const char *new_file);
+bool compress (int fd, bool enable);
+bool fadvise (int fd, unsigned offset, unsigned length, int advice);
+bool fsync (int fd);
+bool fdatasync (int fd);
+void sync (void);
+bool stat (const char *file, struct stat *);
+bool fstat (int fd, struct stat *);
+bool getrusage (int who, struct rusage *);
+bool ioprio (unsigned weight, unsigned kbps);
+int ring_enter (struct ring *);
+int poll (struct pollfd *, unsigned cnt, int timeout);
 
 /* Project 3 and optionally project 4. */
 mapid_t mmap (int fd, void *addr);
 void munmap (mapid_t);
+bool madvise (void *addr, unsigned length, int advice);
+bool shm_attach (int key, void *addr, unsigned size);
+bool shm_detach (void *addr);
 
 /* Project 4 only. */
 bool chdir (const char *dir);
@@ -44,5 +81,9 @@ bool mkdir (const char *dir);
 bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
+int readdir_batch (int fd, struct readdir_record *, unsigned max);
+bool blockstats (const char *device, struct block_stats *);
+void sched_trace (void);
+int ticks (void);
 
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,146 @@
+#include "tests/bench.h"
+#include <random.h>
+#include <stdlib.h>
+#include "tests/lib.h"
+
+/* Returns the CPU's cycle counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Starts measuring phase NAME of a benchmark in B. */
+void
+bench_start (struct bench *b, const char *name)
+{
+  b->name = name;
+  b->bytes = 0;
+  b->op_cnt = 0;
+  if (!blockstats (NULL, &b->disk))
+    fail ("blockstats failed");
+  if (!getrusage (RUSAGE_SELF, &b->usage))
+    fail ("getrusage failed");
+  b->start_ticks = ticks ();
+  b->start_tsc = rdtsc ();
+}
+
+/* Marks the start of one operation in B. */
+void
+bench_op_begin (struct bench *b)
+{
+  b->op_tsc = rdtsc ();
+}
+
+/* Marks the end of the operation started by the last
+   bench_op_begin() on B, which moved BYTES bytes. */
+void
+bench_op_end (struct bench *b, size_t bytes)
+{
+  uint64_t cycles = rdtsc () - b->op_tsc;
+
+  if (b->op_cnt < BENCH_SAMPLE_CNT)
+    b->samples[b->op_cnt] = cycles;
+  else
+    {
+      /* Reservoir sampling: keep each operation with equal
+         probability. */
+      size_t slot = random_ulong () % (b->op_cnt + 1);
+      if (slot < BENCH_SAMPLE_CNT)
+        b->samples[slot] = cycles;
+    }
+  b->op_cnt++;
+  b->bytes += bytes;
+}
+
+/* qsort() comparison function for latencies. */
+static int
+compare_cycles (const void *a_, const void *b_)
+{
+  const uint64_t *a = a_;
+  const uint64_t *b = b_;
+
+  return *a < *b ? -1 : *a > *b;
+}
+
+/* Returns percentile PCT of the CNT sorted latencies in SAMPLES,
+   converted to microseconds at CYCLES_PER_MS cycles per
+   millisecond. */
+static unsigned long long
+percentile (const uint64_t *samples, size_t cnt, unsigned pct,
+            uint64_t cycles_per_ms)
+{
+  size_t i = cnt * pct / 100;
+
+  if (i >= cnt)
+    i = cnt - 1;
+  return samples[i] * 1000 / cycles_per_ms;
+}
+
+/* Ends phase B and reports its throughput, latency percentiles,
+   disk traffic and page faults. */
+void
+bench_report (struct bench *b)
+{
+  uint64_t cycles = rdtsc () - b->start_tsc;
+  int elapsed = ticks () - b->start_ticks;
+  unsigned long long kb_per_sec, ops_per_sec;
+  unsigned long long p50 = 0, p90 = 0, p99 = 0, max = 0;
+  struct block_stats disk;
+  struct rusage usage;
+  size_t sample_cnt;
+
+  if (!blockstats (NULL, &disk))
+    fail ("blockstats failed");
+  if (!getrusage (RUSAGE_SELF, &usage))
+    fail ("getrusage failed");
+
+  /* Phases shorter than a tick are counted as one tick. */
+  if (elapsed < 1)
+    elapsed = 1;
+  kb_per_sec = b->bytes * BENCH_TICK_FREQ / elapsed / 1024;
+  ops_per_sec = (unsigned long long) b->op_cnt * BENCH_TICK_FREQ / elapsed;
+  msg ("%s: %zu ops, %llu bytes in %d ticks", b->name, b->op_cnt, b->bytes,
+       elapsed);
+  msg ("%s: %llu.%02llu MB/s, %llu ops/s", b->name, kb_per_sec / 1024,
+       kb_per_sec % 1024 * 100 / 1024, ops_per_sec);
+
+  sample_cnt = b->op_cnt < BENCH_SAMPLE_CNT ? b->op_cnt : BENCH_SAMPLE_CNT;
+  if (sample_cnt > 0)
+    {
+      uint64_t cycles_per_ms = cycles * BENCH_TICK_FREQ / elapsed / 1000;
+
+      if (cycles_per_ms == 0)
+        cycles_per_ms = 1;
+      qsort (b->samples, sample_cnt, sizeof *b->samples, compare_cycles);
+      p50 = percentile (b->samples, sample_cnt, 50, cycles_per_ms);
+      p90 = percentile (b->samples, sample_cnt, 90, cycles_per_ms);
+      p99 = percentile (b->samples, sample_cnt, 99, cycles_per_ms);
+      max = percentile (b->samples, sample_cnt, 100, cycles_per_ms);
+      msg ("%s: latency p50 %llu us, p90 %llu us, p99 %llu us, max %llu us",
+           b->name, p50, p90, p99, max);
+    }
+
+  msg ("%s: disk %llu sectors read, %llu written, %llu requests, %llu seeks",
+       b->name, disk.read_cnt - b->disk.read_cnt,
+       disk.write_cnt - b->disk.write_cnt,
+       disk.request_cnt - b->disk.request_cnt,
+       disk.seek_cnt - b->disk.seek_cnt);
+  msg ("%s: faults %u minor, %u major, %u from swap",
+       b->name, usage.minor_faults - b->usage.minor_faults,
+       usage.major_faults - b->usage.major_faults,
+       usage.swap_faults - b->usage.swap_faults);
+
+  msg ("%s: result ops=%zu bytes=%llu ticks=%d kbps=%llu ops_per_sec=%llu "
+       "p50_us=%llu p90_us=%llu p99_us=%llu max_us=%llu "
+       "read_sectors=%llu write_sectors=%llu minor_faults=%u "
+       "major_faults=%u swap_faults=%u",
+       b->name, b->op_cnt, b->bytes, elapsed, kb_per_sec, ops_per_sec,
+       p50, p90, p99, max, disk.read_cnt - b->disk.read_cnt,
+       disk.write_cnt - b->disk.write_cnt,
+       usage.minor_faults - b->usage.minor_faults,
+       usage.major_faults - b->usage.major_faults,
+       usage.swap_faults - b->usage.swap_faults);
+}
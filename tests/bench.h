@@ -0,0 +1,44 @@
+#ifndef TESTS_BENCH_H
+#define TESTS_BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <syscall.h>
+
+/* Timer interrupts per second.  Must match TIMER_FREQ in
+   devices/timer.h. */
+#define BENCH_TICK_FREQ 100
+
+/* Operations whose latency is kept for computing percentiles.
+   Beyond that, a uniform random sample is kept. */
+#define BENCH_SAMPLE_CNT 1024
+
+/* One measured phase of a benchmark.
+
+   Throughput is computed from timer ticks, which is coarse but
+   needs no calibration.  Latencies are measured in CPU cycles
+   with rdtsc and converted to microseconds using the cycles that
+   elapsed over the whole phase.
+
+   bench_report() prints its numbers for people to read, then all
+   of them again on one "result" line as KEY=VALUE pairs, for
+   scripts to compare runs. */
+struct bench
+  {
+    const char *name;                   /* Phase name, for reports. */
+    int start_ticks;                    /* ticks() at start. */
+    uint64_t start_tsc;                 /* Cycle counter at start. */
+    uint64_t op_tsc;                    /* Cycle counter at op start. */
+    struct block_stats disk;            /* Disk statistics at start. */
+    struct rusage usage;                /* Resource usage at start. */
+    unsigned long long bytes;           /* Bytes moved. */
+    size_t op_cnt;                      /* Operations completed. */
+    uint64_t samples[BENCH_SAMPLE_CNT]; /* Latencies in cycles. */
+  };
+
+void bench_start (struct bench *, const char *name);
+void bench_op_begin (struct bench *);
+void bench_op_end (struct bench *, size_t bytes);
+void bench_report (struct bench *);
+
+#endif /* tests/bench.h */
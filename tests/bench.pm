@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+# Passes if benchmark $test ran to completion.  Its numbers vary
+# from run to run, so they are not checked.
+sub check_bench {
+    our ($test);
+    my (@output) = read_text_file ("$test.output");
+    common_checks ("run", @output);
+
+    my ($name) = $test =~ m%([^/]+)$%;
+    fail "$name didn't begin\n" if !grep ($_ eq "($name) begin", @output);
+    fail "$name didn't end\n" if !grep ($_ eq "($name) end", @output);
+    fail "$name reported no results\n"
+      if !grep (/^\(\Q$name\E\) [^:]+: .* ops/, @output);
+    pass;
+}
+
+1;
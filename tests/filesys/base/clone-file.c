@@ -0,0 +1,68 @@
+/* Clones a file with clone_file(), then overwrites part of the
+   clone and truncates the original, checking after each step
+   that each file has its own contents and that changing one
+   leaves the other alone.  Finally removes the original and
+   checks that the clone keeps the data they shared. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 5000
+#define PATCH_OFS 700
+#define PATCH_SIZE 1400
+#define SHORT_SIZE 2100
+
+static char buf[FILE_SIZE];
+static char patched[FILE_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "original";
+  const char *clone_name = "clone";
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, FILE_SIZE) == FILE_SIZE,
+         "write %d bytes to \"%s\"", FILE_SIZE, file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  CHECK (clone_file (file_name, clone_name), "clone \"%s\" to \"%s\"",
+         file_name, clone_name);
+  check_file (clone_name, buf, FILE_SIZE);
+
+  memcpy (patched, buf, FILE_SIZE);
+  memset (patched + PATCH_OFS, 'x', PATCH_SIZE);
+  CHECK ((fd = open (clone_name)) > 1, "open \"%s\"", clone_name);
+  seek (fd, PATCH_OFS);
+  CHECK (write (fd, patched + PATCH_OFS, PATCH_SIZE) == PATCH_SIZE,
+         "write %d bytes to \"%s\"", PATCH_SIZE, clone_name);
+  msg ("close \"%s\"", clone_name);
+  close (fd);
+  check_file (clone_name, patched, FILE_SIZE);
+  check_file (file_name, buf, FILE_SIZE);
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (ftruncate (fd, SHORT_SIZE), "ftruncate \"%s\" to %d bytes",
+         file_name, SHORT_SIZE);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, SHORT_SIZE);
+  check_file (clone_name, patched, FILE_SIZE);
+
+  CHECK (remove (file_name), "remove \"%s\"", file_name);
+  check_file (clone_name, patched, FILE_SIZE);
+
+  CHECK (!clone_file (file_name, "other"), "clone removed \"%s\"",
+         file_name);
+  CHECK (!clone_file (clone_name, clone_name), "clone \"%s\" onto itself",
+         clone_name);
+}
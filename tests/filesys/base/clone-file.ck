@@ -0,0 +1,41 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(clone-file) begin
+(clone-file) create "original"
+(clone-file) open "original"
+(clone-file) write 5000 bytes to "original"
+(clone-file) close "original"
+(clone-file) clone "original" to "clone"
+(clone-file) open "clone" for verification
+(clone-file) verified contents of "clone"
+(clone-file) close "clone"
+(clone-file) open "clone"
+(clone-file) write 1400 bytes to "clone"
+(clone-file) close "clone"
+(clone-file) open "clone" for verification
+(clone-file) verified contents of "clone"
+(clone-file) close "clone"
+(clone-file) open "original" for verification
+(clone-file) verified contents of "original"
+(clone-file) close "original"
+(clone-file) open "original"
+(clone-file) ftruncate "original" to 2100 bytes
+(clone-file) close "original"
+(clone-file) open "original" for verification
+(clone-file) verified contents of "original"
+(clone-file) close "original"
+(clone-file) open "clone" for verification
+(clone-file) verified contents of "clone"
+(clone-file) close "clone"
+(clone-file) remove "original"
+(clone-file) open "clone" for verification
+(clone-file) verified contents of "clone"
+(clone-file) close "clone"
+(clone-file) clone removed "original"
+(clone-file) clone "clone" onto itself
+(clone-file) end
+EOF
+pass;
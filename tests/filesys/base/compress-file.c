@@ -0,0 +1,62 @@
+/* Writes a compressible file and turns on compress(), then
+   overwrites part of it and turns compression back off, checking
+   after each step that the file reads back as written.  Also
+   checks that compress() fails on a bad file descriptor. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 20000
+#define PATCH_OFS 9000
+#define PATCH_SIZE 3000
+
+static char buf[FILE_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "packed";
+  size_t ofs;
+  int fd;
+
+  /* Text with plenty of repetition, so that it compresses. */
+  for (ofs = 0; ofs < FILE_SIZE; )
+    {
+      char line[64];
+      size_t len = snprintf (line, sizeof line, "line %zu of packed\n",
+                             ofs / 20);
+      if (len > FILE_SIZE - ofs)
+        len = FILE_SIZE - ofs;
+      memcpy (buf + ofs, line, len);
+      ofs += len;
+    }
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, FILE_SIZE) == FILE_SIZE,
+         "write %d bytes to \"%s\"", FILE_SIZE, file_name);
+  CHECK (compress (fd, true), "compress \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, FILE_SIZE);
+
+  memset (buf + PATCH_OFS, 'x', PATCH_SIZE);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  seek (fd, PATCH_OFS);
+  CHECK (write (fd, buf + PATCH_OFS, PATCH_SIZE) == PATCH_SIZE,
+         "write %d bytes to \"%s\"", PATCH_SIZE, file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, FILE_SIZE);
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (compress (fd, false), "uncompress \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, FILE_SIZE);
+
+  CHECK (!compress (fd, true), "compress closed fd");
+}
@@ -0,0 +1,30 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(compress-file) begin
+(compress-file) create "packed"
+(compress-file) open "packed"
+(compress-file) write 20000 bytes to "packed"
+(compress-file) compress "packed"
+(compress-file) close "packed"
+(compress-file) open "packed" for verification
+(compress-file) verified contents of "packed"
+(compress-file) close "packed"
+(compress-file) open "packed"
+(compress-file) write 3000 bytes to "packed"
+(compress-file) close "packed"
+(compress-file) open "packed" for verification
+(compress-file) verified contents of "packed"
+(compress-file) close "packed"
+(compress-file) open "packed"
+(compress-file) uncompress "packed"
+(compress-file) close "packed"
+(compress-file) open "packed" for verification
+(compress-file) verified contents of "packed"
+(compress-file) close "packed"
+(compress-file) compress closed fd
+(compress-file) end
+EOF
+pass;
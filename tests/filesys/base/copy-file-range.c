@@ -0,0 +1,47 @@
+/* Copies a file with copy_file_range(), starting from an offset
+   that is not sector-aligned, then checks the copy's contents and
+   that asking for more than is left copies only what is left. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define TEST_SIZE 9000
+#define START 100
+
+static char buf[TEST_SIZE];
+static char back[TEST_SIZE];
+
+void
+test_main (void) 
+{
+  int in_fd, out_fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create ("in", 0), "create \"in\"");
+  CHECK ((in_fd = open ("in")) > 1, "open \"in\"");
+  CHECK (write (in_fd, buf, TEST_SIZE) == TEST_SIZE,
+         "write %d bytes to \"in\"", TEST_SIZE);
+  CHECK (create ("out", 0), "create \"out\"");
+  CHECK ((out_fd = open ("out")) > 1, "open \"out\"");
+
+  seek (in_fd, START);
+  CHECK (copy_file_range (in_fd, out_fd, TEST_SIZE) == TEST_SIZE - START,
+         "copy_file_range copies %d bytes", TEST_SIZE - START);
+  CHECK (tell (in_fd) == TEST_SIZE && tell (out_fd) == TEST_SIZE - START,
+         "positions advanced");
+  CHECK (copy_file_range (in_fd, out_fd, 1) == 0,
+         "copy_file_range at end of file");
+
+  seek (out_fd, 0);
+  CHECK (read (out_fd, back, TEST_SIZE) == TEST_SIZE - START,
+         "read back \"out\"");
+  compare_bytes (back, buf + START, TEST_SIZE - START, 0, "out");
+
+  msg ("close files");
+  close (in_fd);
+  close (out_fd);
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(copy-file-range) begin
+(copy-file-range) create "in"
+(copy-file-range) open "in"
+(copy-file-range) write 9000 bytes to "in"
+(copy-file-range) create "out"
+(copy-file-range) open "out"
+(copy-file-range) copy_file_range copies 8900 bytes
+(copy-file-range) positions advanced
+(copy-file-range) copy_file_range at end of file
+(copy-file-range) read back "out"
+(copy-file-range) close files
+(copy-file-range) end
+EOF
+pass;
@@ -0,0 +1,45 @@
+/* Gives each kind of fadvise() advice for a file, reading it back
+   after each to check that advice never changes what is read.
+   Also checks that bad advice and a bad file descriptor are
+   refused. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 24000
+
+static char buf[FILE_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "advised";
+  int fd;
+
+  random_bytes (buf, sizeof buf);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, FILE_SIZE) == FILE_SIZE,
+         "write %d bytes to \"%s\"", FILE_SIZE, file_name);
+
+  CHECK (fadvise (fd, 0, 0, ADVICE_SEQUENTIAL), "advise sequential");
+  seek (fd, 0);
+  check_file_handle (fd, file_name, buf, FILE_SIZE);
+  CHECK (fadvise (fd, 0, 0, ADVICE_RANDOM), "advise random");
+  seek (fd, 0);
+  check_file_handle (fd, file_name, buf, FILE_SIZE);
+  CHECK (fadvise (fd, 4096, 8192, ADVICE_WILLNEED), "advise willneed");
+  seek (fd, 0);
+  check_file_handle (fd, file_name, buf, FILE_SIZE);
+  CHECK (fadvise (fd, 0, 0, ADVICE_DONTNEED), "advise dontneed");
+  seek (fd, 0);
+  check_file_handle (fd, file_name, buf, FILE_SIZE);
+  CHECK (fadvise (fd, 0, 0, ADVICE_NORMAL), "advise normal");
+
+  CHECK (!fadvise (fd, 0, 0, 99), "advise nonsense");
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  CHECK (!fadvise (fd, 0, 0, ADVICE_WILLNEED), "advise closed fd");
+}
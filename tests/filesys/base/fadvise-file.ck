@@ -0,0 +1,24 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fadvise-file) begin
+(fadvise-file) create "advised"
+(fadvise-file) open "advised"
+(fadvise-file) write 24000 bytes to "advised"
+(fadvise-file) advise sequential
+(fadvise-file) verified contents of "advised"
+(fadvise-file) advise random
+(fadvise-file) verified contents of "advised"
+(fadvise-file) advise willneed
+(fadvise-file) verified contents of "advised"
+(fadvise-file) advise dontneed
+(fadvise-file) verified contents of "advised"
+(fadvise-file) advise normal
+(fadvise-file) advise nonsense
+(fadvise-file) close "advised"
+(fadvise-file) advise closed fd
+(fadvise-file) end
+EOF
+pass;
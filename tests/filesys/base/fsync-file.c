@@ -0,0 +1,46 @@
+/* Writes a file in two parts, making each durable with fsync()
+   or fdatasync(), then calls sync() and reads the file back.
+   Also checks that a directory can be synced and that a bad file
+   descriptor is refused. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 9000
+
+static char buf[FILE_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "synced";
+  int fd, dir_fd;
+
+  random_bytes (buf, sizeof buf);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, 5000) == 5000,
+         "write 5000 bytes to \"%s\"", file_name);
+  CHECK (fsync (fd), "fsync \"%s\"", file_name);
+  CHECK (write (fd, buf + 5000, FILE_SIZE - 5000) == FILE_SIZE - 5000,
+         "write %d more bytes to \"%s\"", FILE_SIZE - 5000, file_name);
+  CHECK (fdatasync (fd), "fdatasync \"%s\"", file_name);
+  seek (fd, 0);
+  CHECK (write (fd, buf, 100) == 100,
+         "overwrite 100 bytes of \"%s\"", file_name);
+  CHECK (fdatasync (fd), "fdatasync \"%s\"", file_name);
+  msg ("sync");
+  sync ();
+  seek (fd, 0);
+  check_file_handle (fd, file_name, buf, FILE_SIZE);
+
+  CHECK ((dir_fd = open ("/")) > 1, "open \"/\"");
+  CHECK (fsync (dir_fd), "fsync \"/\"");
+  msg ("close \"/\"");
+  close (dir_fd);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  CHECK (!fsync (fd), "fsync closed fd");
+}
@@ -0,0 +1,24 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fsync-file) begin
+(fsync-file) create "synced"
+(fsync-file) open "synced"
+(fsync-file) write 5000 bytes to "synced"
+(fsync-file) fsync "synced"
+(fsync-file) write 4000 more bytes to "synced"
+(fsync-file) fdatasync "synced"
+(fsync-file) overwrite 100 bytes of "synced"
+(fsync-file) fdatasync "synced"
+(fsync-file) sync
+(fsync-file) verified contents of "synced"
+(fsync-file) open "/"
+(fsync-file) fsync "/"
+(fsync-file) close "/"
+(fsync-file) close "synced"
+(fsync-file) fsync closed fd
+(fsync-file) end
+EOF
+pass;
@@ -0,0 +1,70 @@
+/* Grows a sparse file well past the 8 MB that a block map can
+   reach, and creates another that starts out that large, checking
+   that the data written before and after the growth reads back
+   and that the holes read as zeros. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define MB (1024 * 1024)
+#define BLOCK_SIZE 512
+
+static char buf[BLOCK_SIZE];
+static char zeros[BLOCK_SIZE];
+
+/* Writes a block of CH at OFS in FD. */
+static void
+write_block (int fd, const char *file_name, unsigned ofs, char ch)
+{
+  memset (buf, ch, BLOCK_SIZE);
+  seek (fd, ofs);
+  CHECK (write (fd, buf, BLOCK_SIZE) == BLOCK_SIZE,
+         "write %d bytes at offset %u in \"%s\"", BLOCK_SIZE, ofs,
+         file_name);
+}
+
+/* Checks that the block at OFS in FD holds CH, or zeros if CH is
+   0. */
+static void
+check_block (int fd, const char *file_name, unsigned ofs, char ch)
+{
+  seek (fd, ofs);
+  CHECK (read (fd, buf, BLOCK_SIZE) == BLOCK_SIZE,
+         "read %d bytes at offset %u in \"%s\"", BLOCK_SIZE, ofs,
+         file_name);
+  memset (zeros, ch, BLOCK_SIZE);
+  if (memcmp (buf, zeros, BLOCK_SIZE))
+    fail ("wrong data at offset %u in \"%s\"", ofs, file_name);
+}
+
+void
+test_main (void) 
+{
+  int fd;
+
+  CHECK (create ("grown", 0), "create \"grown\"");
+  CHECK ((fd = open ("grown")) > 1, "open \"grown\"");
+  write_block (fd, "grown", 0, 'a');
+  write_block (fd, "grown", 1 * MB, 'b');
+  write_block (fd, "grown", 9 * MB, 'c');
+  write_block (fd, "grown", 12 * MB, 'd');
+  CHECK (filesize (fd) == 12 * MB + BLOCK_SIZE, "filesize \"grown\"");
+  check_block (fd, "grown", 0, 'a');
+  check_block (fd, "grown", 1 * MB, 'b');
+  check_block (fd, "grown", 5 * MB, 0);
+  check_block (fd, "grown", 9 * MB, 'c');
+  check_block (fd, "grown", 12 * MB, 'd');
+  msg ("close \"grown\"");
+  close (fd);
+
+  CHECK (create ("made", 10 * MB), "create \"made\" with 10 MB");
+  CHECK ((fd = open ("made")) > 1, "open \"made\"");
+  CHECK (filesize (fd) == 10 * MB, "filesize \"made\"");
+  write_block (fd, "made", 10 * MB - BLOCK_SIZE, 'e');
+  check_block (fd, "made", 8 * MB, 0);
+  check_block (fd, "made", 10 * MB - BLOCK_SIZE, 'e');
+  msg ("close \"made\"");
+  close (fd);
+}
@@ -0,0 +1,29 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(huge-file) begin
+(huge-file) create "grown"
+(huge-file) open "grown"
+(huge-file) write 512 bytes at offset 0 in "grown"
+(huge-file) write 512 bytes at offset 1048576 in "grown"
+(huge-file) write 512 bytes at offset 9437184 in "grown"
+(huge-file) write 512 bytes at offset 12582912 in "grown"
+(huge-file) filesize "grown"
+(huge-file) read 512 bytes at offset 0 in "grown"
+(huge-file) read 512 bytes at offset 1048576 in "grown"
+(huge-file) read 512 bytes at offset 5242880 in "grown"
+(huge-file) read 512 bytes at offset 9437184 in "grown"
+(huge-file) read 512 bytes at offset 12582912 in "grown"
+(huge-file) close "grown"
+(huge-file) create "made" with 10 MB
+(huge-file) open "made"
+(huge-file) filesize "made"
+(huge-file) write 512 bytes at offset 10485248 in "made"
+(huge-file) read 512 bytes at offset 8388608 in "made"
+(huge-file) read 512 bytes at offset 10485248 in "made"
+(huge-file) close "made"
+(huge-file) end
+EOF
+pass;
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(pread-pwrite) begin
+(pread-pwrite) create "quux"
+(pread-pwrite) open "quux"
+(pread-pwrite) pwrite "quux" in random order
+(pread-pwrite) pread "quux" in random order
+(pread-pwrite) file position unchanged
+(pread-pwrite) pread at end of file
+(pread-pwrite) close "quux"
+(pread-pwrite) end
+EOF
+pass;
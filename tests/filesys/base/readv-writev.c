@@ -0,0 +1,60 @@
+/* Writes a file with writev() from buffers of assorted sizes,
+   some larger than a page, then reads it back with readv() into
+   buffers split at different points and checks the data. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define TEST_SIZE 10000
+
+static char buf[TEST_SIZE];
+static char back[TEST_SIZE];
+
+/* Fills IOV with CNT buffers of the given SIZES, carved one
+   after another out of BASE. */
+static void
+carve (struct iovec *iov, char *base, const unsigned *sizes, int cnt)
+{
+  int i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      iov[i].iov_base = base;
+      iov[i].iov_len = sizes[i];
+      base += sizes[i];
+    }
+}
+
+void
+test_main (void) 
+{
+  static const unsigned wsizes[] = {1, 17, 4096, 0, 300, 5586};
+  static const unsigned rsizes[] = {5000, 3, 1, 996, 4000};
+  struct iovec iov[6];
+  const char *file_name = "vector";
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+
+  carve (iov, buf, wsizes, 6);
+  CHECK (writev (fd, iov, 6) == TEST_SIZE, "writev %d bytes", TEST_SIZE);
+  CHECK (tell (fd) == TEST_SIZE, "position advanced");
+
+  seek (fd, 0);
+  carve (iov, back, rsizes, 5);
+  CHECK (readv (fd, iov, 5) == TEST_SIZE, "readv %d bytes", TEST_SIZE);
+  compare_bytes (back, buf, TEST_SIZE, 0, file_name);
+
+  seek (fd, TEST_SIZE - 10);
+  CHECK (readv (fd, iov, 5) == 10, "short readv at end of file");
+
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
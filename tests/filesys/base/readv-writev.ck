@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(readv-writev) begin
+(readv-writev) create "vector"
+(readv-writev) open "vector"
+(readv-writev) writev 10000 bytes
+(readv-writev) position advanced
+(readv-writev) readv 10000 bytes
+(readv-writev) short readv at end of file
+(readv-writev) close "vector"
+(readv-writev) end
+EOF
+pass;
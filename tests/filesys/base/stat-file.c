@@ -0,0 +1,42 @@
+/* Checks what stat() and fstat() report for a new file, for the
+   same file after writing to it, and for the root directory, and
+   that a missing file and a bad file descriptor are refused. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[5000];
+
+void
+test_main (void) 
+{
+  const char *file_name = "described";
+  struct stat st;
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK (stat (file_name, &st), "stat \"%s\"", file_name);
+  if (st.size != 0 || st.is_dir || st.blocks != 0)
+    fail ("new file: size %u, is_dir %d, %u blocks",
+          st.size, st.is_dir, st.blocks);
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf,
+         "write %zu bytes to \"%s\"", sizeof buf, file_name);
+  CHECK (fstat (fd, &st), "fstat \"%s\"", file_name);
+  if (st.size != sizeof buf || st.is_dir || st.inumber != inumber (fd))
+    fail ("written file: size %u, is_dir %d, inumber %d",
+          st.size, st.is_dir, st.inumber);
+  if (st.blocks < (sizeof buf + 511) / 512)
+    fail ("%u blocks for %zu bytes", st.blocks, sizeof buf);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  CHECK (stat ("/", &st), "stat \"/\"");
+  if (!st.is_dir)
+    fail ("\"/\" is not a directory");
+
+  CHECK (!stat ("missing", &st), "stat \"missing\"");
+  CHECK (!fstat (fd, &st), "fstat closed fd");
+}
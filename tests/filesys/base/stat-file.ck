@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(stat-file) begin
+(stat-file) create "described"
+(stat-file) stat "described"
+(stat-file) open "described"
+(stat-file) write 5000 bytes to "described"
+(stat-file) fstat "described"
+(stat-file) close "described"
+(stat-file) stat "/"
+(stat-file) stat "missing"
+(stat-file) fstat closed fd
+(stat-file) end
+EOF
+pass;
@@ -0,0 +1,79 @@
+/* Writes a file through a buffered stream, with many short
+   formatted lines and a block larger than the stream buffer that
+   bypasses it, then reads it back through another stream with
+   fgets(), fread() and fgetc(), checking the data, the file
+   size, and end of file. */
+
+#include <random.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define LINE_CNT 200
+#define BLOCK_SIZE (3 * BUFSIZ + 17)
+
+static char block[BLOCK_SIZE];
+static char copy[BLOCK_SIZE];
+
+/* Stores line number I, including its new-line, into LINE. */
+static void
+make_line (char line[64], int i)
+{
+  snprintf (line, 64, "line %d of %d: %08x\n", i, LINE_CNT, i * 2654435761u);
+}
+
+void
+test_main (void) 
+{
+  const char *file_name = "stream";
+  char line[64], got[64];
+  size_t size = 0;
+  FILE *s;
+  int fd;
+  int i;
+
+  random_init (57);
+  random_bytes (block, sizeof block);
+
+  CHECK ((s = fopen (file_name, "w")) != NULL, "fopen \"%s\" for writing",
+         file_name);
+  msg ("write %d lines and a %d-byte block", LINE_CNT, BLOCK_SIZE);
+  for (i = 0; i < LINE_CNT; i++)
+    {
+      make_line (line, i);
+      if (fprintf (s, "%s", line) != (int) strlen (line))
+        fail ("fprintf of line %d failed", i);
+      size += strlen (line);
+    }
+  if (fwrite (block, 1, sizeof block, s) != sizeof block)
+    fail ("fwrite of block failed");
+  size += sizeof block;
+  CHECK (fputc ('.', s) == '.', "fputc");
+  size++;
+  CHECK (!ferror (s), "no stream error");
+  CHECK (fclose (s) == 0, "fclose \"%s\"", file_name);
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (filesize (fd) == (int) size, "file size is %zu", size);
+  close (fd);
+
+  CHECK ((s = fopen (file_name, "r")) != NULL, "fopen \"%s\" for reading",
+         file_name);
+  msg ("read back %d lines and the block", LINE_CNT);
+  for (i = 0; i < LINE_CNT; i++)
+    {
+      make_line (line, i);
+      if (fgets (got, sizeof got, s) == NULL)
+        fail ("fgets of line %d failed", i);
+      if (strcmp (got, line))
+        fail ("line %d reads \"%s\", expected \"%s\"", i, got, line);
+    }
+  if (fread (copy, 1, sizeof copy, s) != sizeof copy)
+    fail ("fread of block failed");
+  compare_bytes (copy, block, sizeof block, 0, file_name);
+  CHECK (fgetc (s) == '.', "fgetc");
+  CHECK (fgetc (s) == EOF && feof (s), "end of file");
+  CHECK (fclose (s) == 0, "fclose \"%s\"", file_name);
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(stream-file) begin
+(stream-file) fopen "stream" for writing
+(stream-file) write 200 lines and a 1553-byte block
+(stream-file) fputc
+(stream-file) no stream error
+(stream-file) fclose "stream"
+(stream-file) open "stream"
+(stream-file) file size is 6644
+(stream-file) fopen "stream" for reading
+(stream-file) read back 200 lines and the block
+(stream-file) fgetc
+(stream-file) end of file
+(stream-file) fclose "stream"
+(stream-file) end
+EOF
+pass;
@@ -0,0 +1,58 @@
+/* Shrinks and grows a file with ftruncate(), then preallocates
+   space past its end with fallocate(), checking after each step
+   that the file has the right size, that the data before the old
+   end of file survives, and that everything past it reads as
+   zeros. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define WRITE_SIZE 1000
+#define SHORT_SIZE 300
+#define LONG_SIZE 5000
+#define ALLOC_SIZE 20000
+
+static char buf[ALLOC_SIZE];
+static char expected[ALLOC_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "trunc";
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, WRITE_SIZE);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, WRITE_SIZE) == WRITE_SIZE,
+         "write %d bytes to \"%s\"", WRITE_SIZE, file_name);
+
+  CHECK (ftruncate (fd, SHORT_SIZE), "ftruncate \"%s\" to %d bytes",
+         file_name, SHORT_SIZE);
+  CHECK (filesize (fd) == SHORT_SIZE, "filesize is %d", SHORT_SIZE);
+  memcpy (expected, buf, SHORT_SIZE);
+  seek (fd, 0);
+  check_file_handle (fd, file_name, expected, SHORT_SIZE);
+
+  CHECK (ftruncate (fd, LONG_SIZE), "ftruncate \"%s\" to %d bytes",
+         file_name, LONG_SIZE);
+  CHECK (filesize (fd) == LONG_SIZE, "filesize is %d", LONG_SIZE);
+  seek (fd, 0);
+  check_file_handle (fd, file_name, expected, LONG_SIZE);
+
+  CHECK (fallocate (fd, 0, ALLOC_SIZE), "fallocate %d bytes in \"%s\"",
+         ALLOC_SIZE, file_name);
+  CHECK (filesize (fd) == ALLOC_SIZE, "filesize is %d", ALLOC_SIZE);
+  seek (fd, 0);
+  check_file_handle (fd, file_name, expected, ALLOC_SIZE);
+
+  CHECK (!ftruncate (fd + 10, 0), "ftruncate bad fd");
+  CHECK (!fallocate (fd, 0, 0), "fallocate 0 bytes");
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
@@ -0,0 +1,24 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(trunc-alloc) begin
+(trunc-alloc) create "trunc"
+(trunc-alloc) open "trunc"
+(trunc-alloc) write 1000 bytes to "trunc"
+(trunc-alloc) ftruncate "trunc" to 300 bytes
+(trunc-alloc) filesize is 300
+(trunc-alloc) verified contents of "trunc"
+(trunc-alloc) ftruncate "trunc" to 5000 bytes
+(trunc-alloc) filesize is 5000
+(trunc-alloc) verified contents of "trunc"
+(trunc-alloc) fallocate 20000 bytes in "trunc"
+(trunc-alloc) filesize is 20000
+(trunc-alloc) verified contents of "trunc"
+(trunc-alloc) ftruncate bad fd
+(trunc-alloc) fallocate 0 bytes
+(trunc-alloc) close "trunc"
+(trunc-alloc) end
+EOF
+pass;
@@ -0,0 +1,50 @@
+/* Measures a storm of small file creations in one directory,
+   followed by their deletion. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/bench.h"
+
+#define FILE_CNT 200
+#define FILE_SIZE 100
+
+static char buf[FILE_SIZE];
+static struct bench b;
+
+void
+test_main (void)
+{
+  char name[32];
+  int i;
+
+  CHECK (mkdir ("storm"), "mkdir \"storm\"");
+
+  bench_start (&b, "create");
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      int fd;
+
+      snprintf (name, sizeof name, "storm/f%d", i);
+      bench_op_begin (&b);
+      if (!create (name, 0) || (fd = open (name)) < 2)
+        fail ("create \"%s\" failed", name);
+      if (write (fd, buf, sizeof buf) != sizeof buf)
+        fail ("write \"%s\" failed", name);
+      close (fd);
+      bench_op_end (&b, sizeof buf);
+    }
+  bench_report (&b);
+
+  bench_start (&b, "remove");
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "storm/f%d", i);
+      bench_op_begin (&b);
+      if (!remove (name))
+        fail ("remove \"%s\" failed", name);
+      bench_op_end (&b, 0);
+    }
+  bench_report (&b);
+}
@@ -0,0 +1,54 @@
+/* Measures opening a file at the bottom of a deep chain of
+   directories, each of which also holds other entries. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/bench.h"
+
+#define DEPTH 16
+#define SIBLING_CNT 8
+#define OP_CNT 500
+
+static struct bench b;
+
+void
+test_main (void)
+{
+  char path[DEPTH * 4 + 16];
+  char sibling[sizeof path + 8];
+  int depth, i;
+
+  msg ("creating %d levels of directories", DEPTH);
+  path[0] = '\0';
+  for (depth = 0; depth < DEPTH; depth++)
+    {
+      snprintf (path + strlen (path), sizeof path - strlen (path),
+                "/d%d", depth);
+      if (!mkdir (path))
+        fail ("mkdir \"%s\" failed", path);
+      for (i = 0; i < SIBLING_CNT; i++)
+        {
+          snprintf (sibling, sizeof sibling, "%s/s%d", path, i);
+          if (!create (sibling, 0))
+            fail ("create \"%s\" failed", sibling);
+        }
+    }
+  strlcat (path, "/leaf", sizeof path);
+  CHECK (create (path, 0), "create leaf");
+
+  bench_start (&b, "lookup");
+  for (i = 0; i < OP_CNT; i++)
+    {
+      int fd;
+
+      bench_op_begin (&b);
+      if ((fd = open (path)) < 2)
+        fail ("open \"%s\" failed", path);
+      close (fd);
+      bench_op_end (&b, 0);
+    }
+  bench_report (&b);
+}
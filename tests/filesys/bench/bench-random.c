@@ -0,0 +1,61 @@
+/* Measures reads and writes of single sectors at random offsets
+   in a file much larger than the buffer cache. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/bench.h"
+
+#define FILE_SIZE (256 * 1024)
+#define BLOCK_SIZE 512
+#define OP_CNT 1024
+
+static char buf[BLOCK_SIZE];
+static struct bench b;
+
+/* Returns a random block-aligned offset within the file. */
+static unsigned
+random_offset (void)
+{
+  return random_ulong () % (FILE_SIZE / BLOCK_SIZE) * BLOCK_SIZE;
+}
+
+void
+test_main (void)
+{
+  const char *file_name = "random";
+  int fd;
+  int i;
+
+  /* Write the file first, so that reads find real sectors
+     instead of holes. */
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  for (i = 0; i < FILE_SIZE / BLOCK_SIZE; i++)
+    if (write (fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+      fail ("write \"%s\" failed", file_name);
+
+  bench_start (&b, "read");
+  for (i = 0; i < OP_CNT; i++)
+    {
+      unsigned ofs = random_offset ();
+      bench_op_begin (&b);
+      if (pread (fd, buf, BLOCK_SIZE, ofs) != BLOCK_SIZE)
+        fail ("read %d bytes at offset %u failed", BLOCK_SIZE, ofs);
+      bench_op_end (&b, BLOCK_SIZE);
+    }
+  bench_report (&b);
+
+  bench_start (&b, "write");
+  for (i = 0; i < OP_CNT; i++)
+    {
+      unsigned ofs = random_offset ();
+      bench_op_begin (&b);
+      if (pwrite (fd, buf, BLOCK_SIZE, ofs) != BLOCK_SIZE)
+        fail ("write %d bytes at offset %u failed", BLOCK_SIZE, ofs);
+      bench_op_end (&b, BLOCK_SIZE);
+    }
+  bench_report (&b);
+  close (fd);
+}
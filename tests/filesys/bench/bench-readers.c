@@ -0,0 +1,37 @@
+/* Measures several processes reading the same file at once.
+   Each child reports its own throughput; the parent reports the
+   aggregate. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/filesys/bench/bench-readers.h"
+#include "tests/bench.h"
+
+#define CHILD_CNT 4
+#define BLOCK_SIZE 4096
+
+static char buf[BLOCK_SIZE];
+static struct bench b;
+
+void
+test_main (void)
+{
+  pid_t children[CHILD_CNT];
+  size_t ofs;
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  for (ofs = 0; ofs < FILE_SIZE; ofs += BLOCK_SIZE)
+    if (write (fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+      fail ("write \"%s\" failed", file_name);
+  close (fd);
+
+  bench_start (&b, "aggregate");
+  bench_op_begin (&b);
+  exec_children ("child-bench-read", children, CHILD_CNT);
+  wait_children (children, CHILD_CNT);
+  bench_op_end (&b, (size_t) FILE_SIZE * CHILD_CNT);
+  bench_report (&b);
+}
@@ -0,0 +1,46 @@
+/* Measures sequential writes and reads of a file much larger
+   than the buffer cache, one 4 kB block at a time. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/bench.h"
+
+#define FILE_SIZE (512 * 1024)
+#define BLOCK_SIZE 4096
+
+static char buf[BLOCK_SIZE];
+static struct bench b;
+
+void
+test_main (void)
+{
+  const char *file_name = "seq";
+  size_t ofs;
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  bench_start (&b, "write");
+  for (ofs = 0; ofs < FILE_SIZE; ofs += BLOCK_SIZE)
+    {
+      bench_op_begin (&b);
+      if (write (fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+        fail ("write %zu bytes at offset %zu failed", sizeof buf, ofs);
+      bench_op_end (&b, BLOCK_SIZE);
+    }
+  bench_report (&b);
+  close (fd);
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  bench_start (&b, "read");
+  for (ofs = 0; ofs < FILE_SIZE; ofs += BLOCK_SIZE)
+    {
+      bench_op_begin (&b);
+      if (read (fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+        fail ("read %zu bytes at offset %zu failed", sizeof buf, ofs);
+      bench_op_end (&b, BLOCK_SIZE);
+    }
+  bench_report (&b);
+  close (fd);
+}
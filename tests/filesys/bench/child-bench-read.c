@@ -0,0 +1,46 @@
+/* Child process for bench-readers.
+   Reads the whole shared file, one 4 kB block at a time, and
+   reports how long that took. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/filesys/bench/bench-readers.h"
+#include "tests/bench.h"
+
+#define BLOCK_SIZE 4096
+
+const char *test_name = "child-bench-read";
+
+static char buf[BLOCK_SIZE];
+static struct bench b;
+
+int
+main (int argc, const char *argv[])
+{
+  char name[32];
+  int child_idx;
+  size_t ofs;
+  int fd;
+
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+  snprintf (name, sizeof name, "reader %d", child_idx);
+
+  quiet = true;
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  quiet = false;
+  bench_start (&b, name);
+  for (ofs = 0; ofs < FILE_SIZE; ofs += BLOCK_SIZE)
+    {
+      bench_op_begin (&b);
+      if (read (fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+        fail ("read \"%s\" failed", file_name);
+      bench_op_end (&b, BLOCK_SIZE);
+    }
+  bench_report (&b);
+  close (fd);
+
+  return child_idx;
+}
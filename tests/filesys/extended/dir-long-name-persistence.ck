@@ -0,0 +1,7 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({'a' => {'a' x 15 => [''], 'b' x 60 => [''],
+			'c' x 90 => ['']}});
+pass;
@@ -0,0 +1,64 @@
+/* Creates files whose names are longer than the old 14-character
+   limit, checks that readdir() returns each name whole, and that
+   a name of exactly READDIR_MAX_LEN characters works while a
+   longer one is refused. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static const int lengths[] = {15, 60, 90};
+#define NAME_CNT (sizeof lengths / sizeof *lengths)
+
+/* Sets NAME to LEN copies of the letter C. */
+static void
+make_name (char *name, int len, char c)
+{
+  memset (name, c, len);
+  name[len] = '\0';
+}
+
+void
+test_main (void) 
+{
+  static char name[READDIR_MAX_LEN + 2];
+  static char entry[READDIR_MAX_LEN + 1];
+  bool seen[NAME_CNT];
+  size_t i;
+  int fd;
+
+  CHECK (mkdir ("a"), "mkdir \"a\"");
+  CHECK (chdir ("a"), "chdir \"a\"");
+  for (i = 0; i < NAME_CNT; i++)
+    {
+      make_name (name, lengths[i], 'a' + i);
+      CHECK (create (name, 0), "create %d-character name", lengths[i]);
+    }
+
+  CHECK ((fd = open (".")) > 1, "open \".\"");
+  memset (seen, 0, sizeof seen);
+  while (readdir (fd, entry))
+    {
+      i = entry[0] - 'a';
+      make_name (name, i < NAME_CNT ? lengths[i] : 0, entry[0]);
+      if (i >= NAME_CNT || strcmp (entry, name) || seen[i])
+        fail ("unexpected entry of %zu characters", strlen (entry));
+      seen[i] = true;
+    }
+  close (fd);
+  for (i = 0; i < NAME_CNT; i++)
+    if (!seen[i])
+      fail ("%d-character name missing", lengths[i]);
+  msg ("readdir returned every name");
+
+  make_name (name, READDIR_MAX_LEN, 'z');
+  CHECK (create (name, 0), "create %d-character name", READDIR_MAX_LEN);
+  CHECK ((fd = open (name)) > 1, "open %d-character name", READDIR_MAX_LEN);
+  close (fd);
+  CHECK (remove (name), "remove %d-character name", READDIR_MAX_LEN);
+
+  make_name (name, READDIR_MAX_LEN + 1, 'z');
+  CHECK (!create (name, 0), "create %d-character name (must fail)",
+         READDIR_MAX_LEN + 1);
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-long-name) begin
+(dir-long-name) mkdir "a"
+(dir-long-name) chdir "a"
+(dir-long-name) create 15-character name
+(dir-long-name) create 60-character name
+(dir-long-name) create 90-character name
+(dir-long-name) open "."
+(dir-long-name) readdir returned every name
+(dir-long-name) create 255-character name
+(dir-long-name) open 255-character name
+(dir-long-name) remove 255-character name
+(dir-long-name) create 256-character name (must fail)
+(dir-long-name) end
+EOF
+pass;
@@ -0,0 +1,67 @@
+/* Fills a directory with files and a subdirectory, then lists
+   it with readdir_batch() a few records at a time and checks
+   that every entry comes back exactly once with the right
+   type. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 10
+
+void
+test_main (void) 
+{
+  struct readdir_record records[3];
+  bool seen[FILE_CNT + 1];
+  int fd, cnt, total;
+  int i;
+
+  CHECK (mkdir ("a"), "mkdir \"a\"");
+  CHECK (mkdir ("a/sub"), "mkdir \"a/sub\"");
+  msg ("creating files");
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "a/f%d", i);
+      if (!create (name, 0))
+        fail ("create \"%s\" failed", name);
+    }
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+
+  msg ("reading entries");
+  memset (seen, 0, sizeof seen);
+  total = 0;
+  while ((cnt = readdir_batch (fd, records, 3)) > 0)
+    for (i = 0; i < cnt; i++)
+      {
+        struct readdir_record *r = &records[i];
+        int idx;
+
+        if (!strcmp (r->name, "sub"))
+          {
+            idx = FILE_CNT;
+            if (!r->is_dir)
+              fail ("\"sub\" not reported as a directory");
+          }
+        else if (r->name[0] == 'f'
+                 && (idx = atoi (r->name + 1)) >= 0 && idx < FILE_CNT)
+          {
+            if (r->is_dir)
+              fail ("\"%s\" reported as a directory", r->name);
+          }
+        else
+          fail ("unexpected entry \"%s\"", r->name);
+        if (seen[idx])
+          fail ("entry \"%s\" seen twice", r->name);
+        seen[idx] = true;
+        total++;
+      }
+  CHECK (cnt == 0, "readdir_batch at end returns 0");
+  CHECK (total == FILE_CNT + 1, "read %d entries", FILE_CNT + 1);
+  CHECK (readdir_batch (fd, records, 3) == 0, "readdir_batch again returns 0");
+  close (fd);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-readdir-batch) begin
+(dir-readdir-batch) mkdir "a"
+(dir-readdir-batch) mkdir "a/sub"
+(dir-readdir-batch) creating files
+(dir-readdir-batch) open "a"
+(dir-readdir-batch) reading entries
+(dir-readdir-batch) readdir_batch at end returns 0
+(dir-readdir-batch) read 11 entries
+(dir-readdir-batch) readdir_batch again returns 0
+(dir-readdir-batch) end
+EOF
+pass;
@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my (%fs) = ("big" => [random_bytes (20000)]);
+$fs{"f$_"} = [chr (ord ('a') + $_ % 26) x 1024] foreach grep ($_ % 2, 0...31);
+check_archive (\%fs);
+pass;
@@ -0,0 +1,72 @@
+/* Fills the disk with small files, removes every other one to
+   leave it fragmented, then grows a large file across the holes
+   and checks that everything still reads back correctly.  Run
+   with the free extent index, which has to split and merge free
+   runs as this goes on. */
+
+#include <random.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SMALL_CNT 32
+#define SMALL_SIZE 1024
+#define BIG_SIZE 20000
+static char small[SMALL_SIZE];
+static char big[BIG_SIZE];
+
+void
+test_main (void)
+{
+  char name[16];
+  int fd;
+  int i;
+
+  msg ("create %d small files", SMALL_CNT);
+  for (i = 0; i < SMALL_CNT; i++)
+    {
+      snprintf (name, sizeof name, "f%d", i);
+      memset (small, 'a' + i % 26, SMALL_SIZE);
+      if (!create (name, 0))
+        fail ("create \"%s\"", name);
+      if ((fd = open (name)) < 2)
+        fail ("open \"%s\"", name);
+      if (write (fd, small, SMALL_SIZE) != SMALL_SIZE)
+        fail ("write \"%s\"", name);
+      close (fd);
+    }
+
+  msg ("remove every other file");
+  for (i = 0; i < SMALL_CNT; i += 2)
+    {
+      snprintf (name, sizeof name, "f%d", i);
+      if (!remove (name))
+        fail ("remove \"%s\"", name);
+    }
+
+  random_init (0);
+  random_bytes (big, sizeof big);
+  CHECK (create ("big", 0), "create \"big\"");
+  CHECK ((fd = open ("big")) > 1, "open \"big\"");
+  CHECK (write (fd, big, BIG_SIZE) == BIG_SIZE, "write \"big\"");
+  msg ("close \"big\"");
+  close (fd);
+  check_file ("big", big, BIG_SIZE);
+
+  msg ("check remaining small files");
+  for (i = 1; i < SMALL_CNT; i += 2)
+    {
+      char buf[SMALL_SIZE];
+
+      snprintf (name, sizeof name, "f%d", i);
+      memset (small, 'a' + i % 26, SMALL_SIZE);
+      if ((fd = open (name)) < 2)
+        fail ("open \"%s\"", name);
+      if (read (fd, buf, SMALL_SIZE) != SMALL_SIZE
+          || memcmp (buf, small, SMALL_SIZE))
+        fail ("contents of \"%s\" differ", name);
+      close (fd);
+    }
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-fragmented) begin
+(grow-fragmented) create 32 small files
+(grow-fragmented) remove every other file
+(grow-fragmented) create "big"
+(grow-fragmented) open "big"
+(grow-fragmented) write "big"
+(grow-fragmented) close "big"
+(grow-fragmented) open "big" for verification
+(grow-fragmented) verified contents of "big"
+(grow-fragmented) close "big"
+(grow-fragmented) check remaining small files
+(grow-fragmented) end
+EOF
+pass;
@@ -0,0 +1,7 @@
+/* Grows a file from 0 bytes to 52,117 bytes, 1,234 bytes at a
+   time, on a file system formatted with 4-sector clusters, so
+   that its data is allocated in aligned clusters and read back a
+   cluster at a time. */
+
+#define TEST_SIZE 52117
+#include "tests/filesys/extended/grow-seq.inc"
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-seq-cluster) begin
+(grow-seq-cluster) create "testme"
+(grow-seq-cluster) open "testme"
+(grow-seq-cluster) writing "testme"
+(grow-seq-cluster) close "testme"
+(grow-seq-cluster) open "testme" for verification
+(grow-seq-cluster) verified contents of "testme"
+(grow-seq-cluster) close "testme"
+(grow-seq-cluster) end
+EOF
+pass;
@@ -0,0 +1,39 @@
+/* Measures thread_create() and thread exit: each operation
+   creates a thread that runs, signals and exits. */
+
+#include "tests/threads/tests.h"
+#include "tests/threads/bench/bench.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define CREATE_CNT 500
+
+static struct semaphore done;
+static struct bench b;
+
+static thread_func child;
+
+void
+test_bench_create (void)
+{
+  int i;
+
+  sema_init (&done, 0);
+  bench_start (&b, "create-exit");
+  for (i = 0; i < CREATE_CNT; i++)
+    {
+      bench_op_begin (&b);
+      if (thread_create ("child", PRI_DEFAULT, child, NULL) == TID_ERROR)
+        fail ("thread_create failed");
+      sema_down (&done);
+      bench_op_end (&b);
+    }
+  bench_report (&b);
+}
+
+/* Signals the main thread, then exits. */
+static void
+child (void *aux UNUSED)
+{
+  sema_up (&done);
+}
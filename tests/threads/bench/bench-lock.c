@@ -0,0 +1,67 @@
+/* Measures lock_acquire() and lock_release(): first by one thread
+   with the lock always free, then with several threads taking
+   turns, each yielding while it holds the lock so that the others
+   block on it.  The contended cost is that of acquiring alone,
+   including the wait. */
+
+#include "tests/threads/tests.h"
+#include "tests/threads/bench/bench.h"
+#include "devices/timer.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define UNCONTENDED_CNT 10000
+#define THREAD_CNT 4
+#define ITER_CNT 250
+
+static struct lock lock;
+static struct semaphore done;
+static struct bench b;
+
+static thread_func contender;
+
+void
+test_bench_lock (void)
+{
+  int i;
+
+  lock_init (&lock);
+  sema_init (&done, 0);
+
+  bench_start (&b, "uncontended");
+  for (i = 0; i < UNCONTENDED_CNT; i++)
+    {
+      bench_op_begin (&b);
+      lock_acquire (&lock);
+      lock_release (&lock);
+      bench_op_end (&b);
+    }
+  bench_report (&b);
+
+  bench_start (&b, "contended");
+  for (i = 0; i < THREAD_CNT; i++)
+    thread_create ("contender", PRI_DEFAULT, contender, NULL);
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_down (&done);
+  bench_report (&b);
+}
+
+/* Takes the lock ITER_CNT times, yielding while holding it, and
+   counts how long each acquisition took. */
+static void
+contender (void *aux UNUSED)
+{
+  int i;
+
+  for (i = 0; i < ITER_CNT; i++)
+    {
+      uint64_t start = timer_tsc ();
+
+      lock_acquire (&lock);
+      bench_add (&b, timer_tsc () - start);
+      thread_yield ();
+      lock_release (&lock);
+      thread_yield ();
+    }
+  sema_up (&done);
+}
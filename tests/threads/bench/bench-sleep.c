@@ -0,0 +1,37 @@
+/* Measures the accuracy of timer_sleep(): how long sleeps of a few
+   different lengths actually take.  Each phase starts just after a
+   tick and also reports its target. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "tests/threads/bench/bench.h"
+#include "devices/timer.h"
+
+#define SLEEP_CNT 10
+
+static struct bench b;
+
+void
+test_bench_sleep (void)
+{
+  static const int64_t lengths[] = {1, 2, 5, 10};
+  static char names[sizeof lengths / sizeof *lengths][16];
+  size_t i;
+  int j;
+
+  for (i = 0; i < sizeof lengths / sizeof *lengths; i++)
+    {
+      snprintf (names[i], sizeof names[i], "sleep-%lld", lengths[i]);
+      bench_start (&b, names[i]);
+      timer_sleep (1);
+      for (j = 0; j < SLEEP_CNT; j++)
+        {
+          bench_op_begin (&b);
+          timer_sleep (lengths[i]);
+          bench_op_end (&b);
+        }
+      msg ("%s: target %lld ns", names[i],
+           lengths[i] * (1000000000 / TIMER_FREQ));
+      bench_report (&b);
+    }
+}
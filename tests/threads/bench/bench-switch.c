@@ -0,0 +1,48 @@
+/* Measures the cost of a context switch: two threads take turns
+   through a pair of semaphores, so that each round trip switches
+   twice. */
+
+#include "tests/threads/tests.h"
+#include "tests/threads/bench/bench.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define ROUND_CNT 2000
+
+static struct semaphore ping, pong;
+static struct bench b;
+
+static thread_func ponger;
+
+void
+test_bench_switch (void)
+{
+  int i;
+
+  sema_init (&ping, 0);
+  sema_init (&pong, 0);
+  thread_create ("pong", PRI_DEFAULT, ponger, NULL);
+
+  bench_start (&b, "round-trip");
+  for (i = 0; i < ROUND_CNT; i++)
+    {
+      bench_op_begin (&b);
+      sema_up (&ping);
+      sema_down (&pong);
+      bench_op_end (&b);
+    }
+  bench_report (&b);
+}
+
+/* Answers each of the main thread's pings. */
+static void
+ponger (void *aux UNUSED)
+{
+  int i;
+
+  for (i = 0; i < ROUND_CNT; i++)
+    {
+      sema_down (&ping);
+      sema_up (&pong);
+    }
+}
@@ -0,0 +1,61 @@
+/* Measures wakeup latency: the cycles from sema_up() in one thread
+   to the woken thread running.  A waiter of higher priority than
+   the waker should run at once; one of equal priority runs when
+   the waker yields. */
+
+#include "tests/threads/tests.h"
+#include "tests/threads/bench/bench.h"
+#include "devices/timer.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define WAKE_CNT 1000
+
+static struct semaphore wake, done;
+static uint64_t up_tsc;
+static struct bench b;
+
+static thread_func waiter;
+
+/* Wakes a waiter of priority PRIORITY WAKE_CNT times and reports
+   the latencies as phase NAME. */
+static void
+run_phase (const char *name, int priority)
+{
+  int i;
+
+  sema_init (&wake, 0);
+  sema_init (&done, 0);
+  thread_create ("waiter", priority, waiter, NULL);
+
+  bench_start (&b, name);
+  for (i = 0; i < WAKE_CNT; i++)
+    {
+      up_tsc = timer_tsc ();
+      sema_up (&wake);
+      thread_yield ();
+    }
+  sema_down (&done);
+  bench_report (&b);
+}
+
+void
+test_bench_wakeup (void)
+{
+  run_phase ("higher-priority", PRI_DEFAULT + 1);
+  run_phase ("equal-priority", PRI_DEFAULT);
+}
+
+/* Counts the time since UP_TSC each time it is woken. */
+static void
+waiter (void *aux UNUSED)
+{
+  int i;
+
+  for (i = 0; i < WAKE_CNT; i++)
+    {
+      sema_down (&wake);
+      bench_add (&b, timer_tsc () - up_tsc);
+    }
+  sema_up (&done);
+}
@@ -0,0 +1,98 @@
+#include "tests/threads/bench/bench.h"
+#include <random.h>
+#include <stdlib.h>
+#include "tests/threads/tests.h"
+#include "devices/timer.h"
+
+/* Starts measuring phase NAME of a benchmark in B. */
+void
+bench_start (struct bench *b, const char *name)
+{
+  b->name = name;
+  b->total = 0;
+  b->op_cnt = 0;
+}
+
+/* Marks the start of one operation in B. */
+void
+bench_op_begin (struct bench *b)
+{
+  b->op_tsc = timer_tsc ();
+}
+
+/* Marks the end of the operation started by the last
+   bench_op_begin() on B. */
+void
+bench_op_end (struct bench *b)
+{
+  bench_add (b, timer_tsc () - b->op_tsc);
+}
+
+/* Counts an operation that took CYCLES cycles in B. */
+void
+bench_add (struct bench *b, uint64_t cycles)
+{
+  if (b->op_cnt < BENCH_SAMPLE_CNT)
+    b->samples[b->op_cnt] = cycles;
+  else
+    {
+      /* Reservoir sampling: keep each operation with equal
+         probability. */
+      size_t slot = random_ulong () % (b->op_cnt + 1);
+      if (slot < BENCH_SAMPLE_CNT)
+        b->samples[slot] = cycles;
+    }
+  b->op_cnt++;
+  b->total += cycles;
+}
+
+/* qsort() comparison function for costs. */
+static int
+compare_cycles (const void *a_, const void *b_)
+{
+  const uint64_t *a = a_;
+  const uint64_t *b = b_;
+
+  return *a < *b ? -1 : *a > *b;
+}
+
+/* Returns percentile PCT of the CNT sorted costs in SAMPLES. */
+static unsigned long long
+percentile (const uint64_t *samples, size_t cnt, unsigned pct)
+{
+  size_t i = cnt * pct / 100;
+
+  if (i >= cnt)
+    i = cnt - 1;
+  return samples[i];
+}
+
+/* Ends phase B and reports the mean and percentiles of its
+   operations' costs. */
+void
+bench_report (struct bench *b)
+{
+  unsigned long long mean, p50 = 0, p90 = 0, p99 = 0, max = 0;
+  size_t sample_cnt;
+
+  mean = b->op_cnt > 0 ? b->total / b->op_cnt : 0;
+  msg ("%s: %zu ops, %llu cycles/op, %llu ns/op", b->name, b->op_cnt,
+       mean, (unsigned long long) timer_tsc_to_ns (mean));
+
+  sample_cnt = b->op_cnt < BENCH_SAMPLE_CNT ? b->op_cnt : BENCH_SAMPLE_CNT;
+  if (sample_cnt > 0)
+    {
+      qsort (b->samples, sample_cnt, sizeof *b->samples, compare_cycles);
+      p50 = percentile (b->samples, sample_cnt, 50);
+      p90 = percentile (b->samples, sample_cnt, 90);
+      p99 = percentile (b->samples, sample_cnt, 99);
+      max = percentile (b->samples, sample_cnt, 100);
+      msg ("%s: cycles p50 %llu, p90 %llu, p99 %llu, max %llu",
+           b->name, p50, p90, p99, max);
+    }
+
+  msg ("%s: result ops=%zu cycles_per_op=%llu ns_per_op=%llu "
+       "p50_cycles=%llu p90_cycles=%llu p99_cycles=%llu max_cycles=%llu",
+       b->name, b->op_cnt, mean,
+       (unsigned long long) timer_tsc_to_ns (mean), p50, p90, p99, max);
+}
@@ -0,0 +1,37 @@
+#ifndef TESTS_THREADS_BENCH_BENCH_H
+#define TESTS_THREADS_BENCH_BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Operations whose cost is kept for computing percentiles.
+   Beyond that, a uniform random sample is kept. */
+#define BENCH_SAMPLE_CNT 1024
+
+/* One measured phase of a kernel microbenchmark.
+
+   Every cost is measured in CPU cycles with the time-stamp
+   counter.  An operation is either timed from bench_op_begin() to
+   bench_op_end() in one thread, or timed by the caller, when it
+   starts in one thread and ends in another, and passed to
+   bench_add().
+
+   Like tests/bench.c in user programs, bench_report() prints its
+   numbers for people to read, then all of them again on one
+   "result" line as KEY=VALUE pairs. */
+struct bench
+  {
+    const char *name;                   /* Phase name, for reports. */
+    uint64_t op_tsc;                    /* Cycle counter at op start. */
+    uint64_t total;                     /* Cycles of all operations. */
+    size_t op_cnt;                      /* Operations completed. */
+    uint64_t samples[BENCH_SAMPLE_CNT]; /* Costs in cycles. */
+  };
+
+void bench_start (struct bench *, const char *name);
+void bench_op_begin (struct bench *);
+void bench_op_end (struct bench *);
+void bench_add (struct bench *, uint64_t cycles);
+void bench_report (struct bench *);
+
+#endif /* tests/threads/bench/bench.h */
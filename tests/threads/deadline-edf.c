@@ -0,0 +1,66 @@
+/* Checks admission control for deadline threads, and that of two
+   deadline threads made ready together, the one whose period ends
+   first runs first, ahead of the ordinary thread that woke them. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+struct deadline_info
+  {
+    const char *name;           /* Name to print. */
+    int64_t runtime, period;    /* Reservation. */
+    struct semaphore *start;    /* Downed before printing. */
+    struct semaphore *done;     /* Upped after printing. */
+  };
+
+static thread_func deadline_thread;
+
+void
+test_deadline_edf (void) 
+{
+  struct semaphore start, done;
+  struct deadline_info info[2] =
+    {
+      {"long", 5, 50, &start, &done},
+      {"short", 5, 20, &start, &done},
+    };
+  enum intr_level old_level;
+  int i;
+
+  msg ("reserve 30%%: %s", thread_set_deadline (3, 10) ? "ok" : "refused");
+  msg ("reserve 90%%: %s", thread_set_deadline (9, 10) ? "ok" : "refused");
+  msg ("release: %s", thread_set_deadline (0, 0) ? "ok" : "refused");
+
+  sema_init (&start, 0);
+  sema_init (&done, 0);
+  for (i = 0; i < 2; i++)
+    thread_create (info[i].name, PRI_DEFAULT, deadline_thread, &info[i]);
+  timer_sleep (10);
+
+  old_level = intr_disable ();
+  sema_up (&start);
+  sema_up (&start);
+  intr_set_level (old_level);
+  thread_yield ();
+
+  msg ("main running again");
+  sema_down (&done);
+  sema_down (&done);
+}
+
+static void
+deadline_thread (void *info_) 
+{
+  struct deadline_info *info = info_;
+
+  if (!thread_set_deadline (info->runtime, info->period))
+    fail ("%s: reservation refused", info->name);
+  sema_down (info->start);
+  msg ("%s ran", info->name);
+  sema_up (info->done);
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(deadline-edf) begin
+(deadline-edf) reserve 30%: ok
+(deadline-edf) reserve 90%: refused
+(deadline-edf) release: ok
+(deadline-edf) short ran
+(deadline-edf) long ran
+(deadline-edf) main running again
+(deadline-edf) end
+EOF
+pass;
@@ -0,0 +1,74 @@
+/* Checks that the stride scheduler divides the CPU in proportion
+   to tickets.
+
+   Three threads holding 100, 200, and 300 tickets spin together
+   for 12 seconds, or 1,200 ticks, which they should split 200,
+   400, and 600. */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define THREAD_CNT 3
+
+struct thread_info 
+  {
+    int64_t start_time;
+    int tick_count;
+    int tickets;
+  };
+
+static void load_thread (void *aux);
+
+void
+test_stride_share (void) 
+{
+  struct thread_info info[THREAD_CNT];
+  int64_t start_time;
+  int i;
+
+  ASSERT (thread_stride);
+
+  start_time = timer_ticks ();
+  msg ("Starting %d threads...", THREAD_CNT);
+  for (i = 0; i < THREAD_CNT; i++) 
+    {
+      struct thread_info *ti = &info[i];
+      char name[16];
+
+      ti->start_time = start_time;
+      ti->tick_count = 0;
+      ti->tickets = 100 * (i + 1);
+
+      snprintf (name, sizeof name, "load %d", i);
+      thread_create (name, PRI_DEFAULT, load_thread, ti);
+    }
+
+  msg ("Sleeping 15 seconds to let threads run, please wait...");
+  timer_sleep (15 * TIMER_FREQ);
+  
+  for (i = 0; i < THREAD_CNT; i++)
+    msg ("Thread %d received %d ticks.", i, info[i].tick_count);
+}
+
+static void
+load_thread (void *ti_) 
+{
+  struct thread_info *ti = ti_;
+  int64_t sleep_time = 1 * TIMER_FREQ;
+  int64_t spin_time = sleep_time + 12 * TIMER_FREQ;
+  int64_t last_time = 0;
+
+  thread_set_tickets (ti->tickets);
+  timer_sleep (sleep_time - timer_elapsed (ti->start_time));
+  while (timer_elapsed (ti->start_time) < spin_time) 
+    {
+      int64_t cur_time = timer_ticks ();
+      if (cur_time != last_time)
+        ti->tick_count++;
+      last_time = cur_time;
+    }
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::threads::mlfqs;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+my (@actual);
+foreach (@output) {
+    my ($id, $count) = /Thread (\d+) received (\d+) ticks\./ or next;
+    $actual[$id] = $count;
+}
+
+mlfqs_compare ("thread", "%d", \@actual, [200, 400, 600], 40, [0, 2, 1],
+	       "Some tick counts were missing or differed from those "
+	       . "expected by more than 40.");
+pass;
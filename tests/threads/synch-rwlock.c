@@ -0,0 +1,15 @@
+/* Runs rwlock_self_test(), which has several readers share a
+   reader-writer lock with writers, one of which upgrades from
+   reading.  The self-test panics if readers ever overlap a
+   writer or a write goes missing. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/synch.h"
+
+void
+test_synch_rwlock (void)
+{
+  rwlock_self_test ();
+  pass ();
+}
@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(synch-rwlock) begin
+Testing reader-writer locks...done.
+(synch-rwlock) PASS
+(synch-rwlock) end
+EOF
+pass;
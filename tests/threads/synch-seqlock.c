@@ -0,0 +1,15 @@
+/* Runs seqlock_self_test(), which reads a pair of values that a
+   writer thread keeps equal under a sequence lock.  The
+   self-test panics if a read that was not retried saw them
+   differ. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/synch.h"
+
+void
+test_synch_seqlock (void)
+{
+  seqlock_self_test ();
+  pass ();
+}
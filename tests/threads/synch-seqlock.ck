@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# The number of reads depends on how often the writer got in the
+# way, so it is not compared.
+s/^(Testing sequence locks\.\.\.done) \(\d+ reads\)\.$/$1./ foreach @output;
+compare_output ("run", \@output, [<<'EOF']);
+(synch-seqlock) begin
+Testing sequence locks...done.
+(synch-seqlock) PASS
+(synch-seqlock) end
+EOF
+pass;
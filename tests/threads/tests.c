@@ -38,6 +38,15 @@ static const struct test tests[] =
     {"mlfqs-nice-2", test_mlfqs_nice_2},
     {"mlfqs-nice-10", test_mlfqs_nice_10},
     {"mlfqs-block", test_mlfqs_block},
+    {"stride-share", test_stride_share},
+    {"deadline-edf", test_deadline_edf},
+    {"synch-rwlock", test_synch_rwlock},
+    {"synch-seqlock", test_synch_seqlock},
+    {"bench-switch", test_bench_switch},
+    {"bench-lock", test_bench_lock},
+    {"bench-wakeup", test_bench_wakeup},
+    {"bench-sleep", test_bench_sleep},
+    {"bench-create", test_bench_create},
   };
 
 static const char *test_name;
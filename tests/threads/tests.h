@@ -32,6 +32,15 @@ extern test_func test_mlfqs_fair_20;
 extern test_func test_mlfqs_nice_2;
 extern test_func test_mlfqs_nice_10;
 extern test_func test_mlfqs_block;
+extern test_func test_stride_share;
+extern test_func test_deadline_edf;
+extern test_func test_synch_rwlock;
+extern test_func test_synch_seqlock;
+extern test_func test_bench_switch;
+extern test_func test_bench_lock;
+extern test_func test_bench_wakeup;
+extern test_func test_bench_sleep;
+extern test_func test_bench_create;
 
 void msg (const char *, ...);
 void fail (const char *, ...);
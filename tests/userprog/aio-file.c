@@ -0,0 +1,46 @@
+/* Writes a file with aio_write() and reads it back with several
+   overlapping aio_read() requests, computing while they run.
+   Verifies the data and that finished tickets are forgotten. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (16 * 1024)
+#define PARTS 4
+
+static char data[SIZE];
+static char copy[SIZE];
+
+void
+test_main (void)
+{
+  int tickets[PARTS];
+  int fd, ticket, i;
+  size_t j;
+
+  for (j = 0; j < SIZE; j++)
+    data[j] = j * 13 + j / 509;
+  CHECK (create ("aio.dat", 0), "create \"aio.dat\"");
+  CHECK ((fd = open ("aio.dat")) > 1, "open \"aio.dat\"");
+
+  CHECK ((ticket = aio_write (fd, data, SIZE, 0)) >= 0, "submit write");
+  while (aio_poll (ticket) == 0)
+    continue;
+  CHECK (aio_wait (ticket) == SIZE, "wait for write");
+  CHECK (aio_wait (ticket) == -1, "ticket is gone");
+
+  for (i = 0; i < PARTS; i++)
+    tickets[i] = aio_read (fd, copy + i * (SIZE / PARTS), SIZE / PARTS,
+                           i * (SIZE / PARTS));
+  msg ("submit %d reads", PARTS);
+  for (i = PARTS - 1; i >= 0; i--)
+    if (tickets[i] < 0 || aio_wait (tickets[i]) != SIZE / PARTS)
+      fail ("read %d failed", i);
+  msg ("wait for reads");
+  if (memcmp (data, copy, SIZE))
+    fail ("data read back differs from data written");
+  msg ("verified contents");
+  close (fd);
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(aio-file) begin
+(aio-file) create "aio.dat"
+(aio-file) open "aio.dat"
+(aio-file) submit write
+(aio-file) wait for write
+(aio-file) ticket is gone
+(aio-file) submit 4 reads
+(aio-file) wait for reads
+(aio-file) verified contents
+(aio-file) end
+aio-file: exit(0)
+EOF
+pass;
@@ -0,0 +1,29 @@
+/* Measures exec() and wait() of a program that exits at once. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/bench.h"
+
+#define RUN_CNT 16
+
+static struct bench b;
+
+void
+test_main (void)
+{
+  int i;
+
+  bench_start (&b, "exec-wait");
+  for (i = 0; i < RUN_CNT; i++)
+    {
+      pid_t child;
+
+      bench_op_begin (&b);
+      child = exec ("child-bench-null");
+      if (child == PID_ERROR || wait (child) != 0)
+        fail ("exec of child-bench-null %d failed", i);
+      bench_op_end (&b, 0);
+    }
+  bench_report (&b);
+}
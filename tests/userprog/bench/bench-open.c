@@ -0,0 +1,59 @@
+/* Measures opening and closing a file, and looking up a
+   descriptor with tell(), while the process holds a growing
+   number of other descriptors open. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/bench.h"
+
+#define OPEN_CNT 200
+#define TELL_CNT 2000
+
+static struct bench b;
+
+void
+test_main (void)
+{
+  static const int held_cnts[] = {0, 32, 256};
+  static char names[3][2][24];
+  const char *file_name = "storm";
+  int held = 0;
+  size_t i;
+  int j, fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  for (i = 0; i < sizeof held_cnts / sizeof *held_cnts; i++)
+    {
+      for (; held < held_cnts[i]; held++)
+        if (open (file_name) < 2)
+          fail ("open \"%s\" with %d held failed", file_name, held);
+
+      snprintf (names[i][0], sizeof names[i][0], "open-close-%d", held);
+      bench_start (&b, names[i][0]);
+      for (j = 0; j < OPEN_CNT; j++)
+        {
+          bench_op_begin (&b);
+          fd = open (file_name);
+          if (fd < 2)
+            fail ("open \"%s\" failed", file_name);
+          close (fd);
+          bench_op_end (&b, 0);
+        }
+      bench_report (&b);
+
+      CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+      snprintf (names[i][1], sizeof names[i][1], "tell-%d", held);
+      bench_start (&b, names[i][1]);
+      for (j = 0; j < TELL_CNT; j++)
+        {
+          bench_op_begin (&b);
+          if (tell (fd) != 0)
+            fail ("tell on fd %d failed", fd);
+          bench_op_end (&b, 0);
+        }
+      bench_report (&b);
+      close (fd);
+    }
+}
@@ -0,0 +1,56 @@
+/* Measures read() and write() of a file 1 byte at a time and 64 kB
+   at a time, to separate the per-call cost from the per-byte cost
+   of copying between user and kernel. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/bench.h"
+
+#define SMALL_CNT 2048
+#define BIG_SIZE (64 * 1024)
+#define BIG_CNT 8
+
+static char buf[BIG_SIZE];
+static struct bench b;
+
+/* Writes CNT blocks of SIZE bytes to new file NAME, then reads
+   them back, timing each call, as phases WRITE_NAME and
+   READ_NAME. */
+static void
+run (const char *name, size_t size, int cnt,
+     const char *write_name, const char *read_name)
+{
+  int fd, i;
+
+  CHECK (create (name, 0), "create \"%s\"", name);
+  CHECK ((fd = open (name)) > 1, "open \"%s\"", name);
+  bench_start (&b, write_name);
+  for (i = 0; i < cnt; i++)
+    {
+      bench_op_begin (&b);
+      if (write (fd, buf, size) != (int) size)
+        fail ("write %zu bytes to \"%s\" failed", size, name);
+      bench_op_end (&b, size);
+    }
+  bench_report (&b);
+
+  seek (fd, 0);
+  bench_start (&b, read_name);
+  for (i = 0; i < cnt; i++)
+    {
+      bench_op_begin (&b);
+      if (read (fd, buf, size) != (int) size)
+        fail ("read %zu bytes from \"%s\" failed", size, name);
+      bench_op_end (&b, size);
+    }
+  bench_report (&b);
+  close (fd);
+}
+
+void
+test_main (void)
+{
+  run ("small", 1, SMALL_CNT, "write-1", "read-1");
+  run ("big", BIG_SIZE, BIG_CNT, "write-64k", "read-64k");
+}
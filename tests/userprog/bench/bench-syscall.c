@@ -0,0 +1,51 @@
+/* Measures the fixed cost of a system call: one that does nothing
+   but read the tick count, and write() to a descriptor that is not
+   open, which validates its buffer before failing, with buffers
+   of 1 byte and of 64 kB. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/bench.h"
+
+#define CALL_CNT 5000
+#define BIG_SIZE (64 * 1024)
+#define BAD_FD 1000
+
+static char buf[BIG_SIZE];
+static struct bench b;
+
+/* Times CALL_CNT writes of SIZE bytes to BAD_FD as phase NAME. */
+static void
+bad_writes (const char *name, size_t size)
+{
+  int i;
+
+  bench_start (&b, name);
+  for (i = 0; i < CALL_CNT; i++)
+    {
+      bench_op_begin (&b);
+      if (write (BAD_FD, buf, size) != 0)
+        fail ("write to unopened fd succeeded");
+      bench_op_end (&b, 0);
+    }
+  bench_report (&b);
+}
+
+void
+test_main (void)
+{
+  int i;
+
+  bench_start (&b, "null");
+  for (i = 0; i < CALL_CNT; i++)
+    {
+      bench_op_begin (&b);
+      ticks ();
+      bench_op_end (&b, 0);
+    }
+  bench_report (&b);
+
+  bad_writes ("validate-1", 1);
+  bad_writes ("validate-64k", BIG_SIZE);
+}
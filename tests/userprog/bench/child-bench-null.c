@@ -0,0 +1,8 @@
+/* Child process for bench-exec.  Exits at once, so that the
+   parent measures just the cost of starting a process. */
+
+int
+main (void)
+{
+  return 0;
+}
@@ -0,0 +1,35 @@
+/* Checks that ioprio() rejects weights out of range, and that a
+   process with a low weight and a bandwidth cap still gets its
+   file written and read back intact. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[4096];
+
+void
+test_main (void) 
+{
+  int fd;
+
+  if (ioprio (0, 0))
+    fail ("ioprio accepted weight 0");
+  if (ioprio (IOPRIO_WEIGHT_MAX + 1, 0))
+    fail ("ioprio accepted weight %d", IOPRIO_WEIGHT_MAX + 1);
+  CHECK (ioprio (IOPRIO_WEIGHT_MIN, 64), "ioprio (%d, 64)",
+         IOPRIO_WEIGHT_MIN);
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+  CHECK (create ("capped", sizeof buf), "create \"capped\"");
+  CHECK ((fd = open ("capped")) > 1, "open \"capped\"");
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf, "write \"capped\"");
+  CHECK (fsync (fd), "fsync \"capped\"");
+  close (fd);
+  check_file ("capped", buf, sizeof buf);
+
+  CHECK (ioprio (IOPRIO_WEIGHT_DEFAULT, 0), "ioprio (%d, 0)",
+         IOPRIO_WEIGHT_DEFAULT);
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(ioprio) begin
+(ioprio) ioprio (1, 64)
+(ioprio) create "capped"
+(ioprio) open "capped"
+(ioprio) write "capped"
+(ioprio) fsync "capped"
+(ioprio) open "capped" for verification
+(ioprio) verified contents of "capped"
+(ioprio) close "capped"
+(ioprio) ioprio (100, 0)
+(ioprio) end
+ioprio: exit(0)
+EOF
+pass;
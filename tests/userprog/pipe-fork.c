@@ -0,0 +1,62 @@
+/* Creates a pipe and forks.  The child writes several times the
+   pipe's capacity into it, so that it must wait for the parent to
+   read, and the parent checks every byte up to end of file. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (20 * 1024)
+
+/* Byte I of the data sent through the pipe. */
+static char
+pattern (size_t i)
+{
+  return i * 7 + i / 251;
+}
+
+void
+test_main (void)
+{
+  static char buf[1000];
+  int fds[2];
+  size_t total;
+  pid_t pid;
+  int n;
+
+  CHECK (pipe (fds) == 0, "pipe");
+  pid = fork ();
+  if (pid == 0)
+    {
+      size_t i;
+
+      close (fds[0]);
+      for (total = 0; total < SIZE; total += sizeof buf)
+        {
+          for (i = 0; i < sizeof buf; i++)
+            buf[i] = pattern (total + i);
+          if (write (fds[1], buf, sizeof buf) != (int) sizeof buf)
+            exit (1);
+        }
+      exit (0);
+    }
+  if (pid == PID_ERROR)
+    fail ("fork failed");
+
+  close (fds[1]);
+  total = 0;
+  while ((n = read (fds[0], buf, sizeof buf)) > 0)
+    {
+      int i;
+
+      for (i = 0; i < n; i++)
+        if (buf[i] != pattern (total + i))
+          fail ("byte %zu is %#x instead of %#x",
+                total + i, buf[i], pattern (total + i));
+      total += n;
+    }
+  CHECK (n == 0, "read to end of file");
+  msg ("read %zu bytes", total);
+  CHECK (wait (pid) == 0, "wait for child");
+  CHECK (write (fds[0], buf, 1) == -1, "write to read end fails");
+}
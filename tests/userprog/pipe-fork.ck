@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(pipe-fork) begin
+(pipe-fork) pipe
+(pipe-fork) read to end of file
+(pipe-fork) read 20480 bytes
+(pipe-fork) wait for child
+(pipe-fork) write to read end fails
+(pipe-fork) end
+EOF
+pass;
@@ -0,0 +1,56 @@
+/* Polls a pipe: an empty pipe is not readable, and polling it
+   with a timeout must return 0 once the time is up.  A forked
+   child's write must wake a parent polling without a timeout, and
+   once every write end is closed the read end reports POLLHUP.
+   A file descriptor that is not open reports POLLNVAL. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  struct pollfd p;
+  int fds[2];
+  int start;
+  char c;
+  pid_t pid;
+
+  CHECK (pipe (fds) == 0, "pipe");
+
+  p.fd = fds[0];
+  p.events = POLLIN;
+  CHECK (poll (&p, 1, 0) == 0, "empty pipe not readable");
+  start = ticks ();
+  CHECK (poll (&p, 1, 50) == 0, "poll with timeout returns 0");
+  CHECK (ticks () - start >= 4, "poll waited for the timeout");
+
+  p.fd = fds[1];
+  p.events = POLLOUT;
+  CHECK (poll (&p, 1, 0) == 1 && p.revents == POLLOUT,
+         "empty pipe writable");
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      close (fds[0]);
+      exit (write (fds[1], "x", 1) == 1 ? 0 : 1);
+    }
+  if (pid == PID_ERROR)
+    fail ("fork failed");
+  close (fds[1]);
+
+  p.fd = fds[0];
+  p.events = POLLIN;
+  CHECK (poll (&p, 1, -1) == 1 && (p.revents & POLLIN),
+         "child's write makes pipe readable");
+  CHECK (wait (pid) == 0, "wait for child");
+  CHECK (poll (&p, 1, 0) == 1 && p.revents == (POLLIN | POLLHUP),
+         "POLLHUP once writers are gone");
+  CHECK (read (fds[0], &c, 1) == 1 && c == 'x', "read child's byte");
+
+  p.fd = 57;
+  CHECK (poll (&p, 1, 0) == 1 && p.revents == POLLNVAL,
+         "POLLNVAL for closed fd");
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(poll-pipe) begin
+(poll-pipe) pipe
+(poll-pipe) empty pipe not readable
+(poll-pipe) poll with timeout returns 0
+(poll-pipe) poll waited for the timeout
+(poll-pipe) empty pipe writable
+(poll-pipe) child's write makes pipe readable
+(poll-pipe) wait for child
+(poll-pipe) POLLHUP once writers are gone
+(poll-pipe) read child's byte
+(poll-pipe) POLLNVAL for closed fd
+(poll-pipe) end
+EOF
+pass;
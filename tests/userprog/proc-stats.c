@@ -0,0 +1,56 @@
+/* Lists /proc, then samples /proc/syscall twice.  The read count
+   it shows must grow between samples, since the first sample's
+   read is counted by the second, and /proc must refuse writes and
+   unknown names. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Returns the read count in the /proc/syscall sample in BUF. */
+static int
+read_cnt (const char *buf)
+{
+  const char *p = strstr (buf, "Syscall read: ");
+
+  if (p == NULL)
+    fail ("no read count in sample");
+  return atoi (p + strlen ("Syscall read: "));
+}
+
+void
+test_main (void)
+{
+  static char buf[4096];
+  char name[READDIR_MAX_LEN + 1];
+  bool found = false;
+  int dir, fd, n, first;
+
+  CHECK ((dir = open ("/proc")) > 1, "open \"/proc\"");
+  CHECK (isdir (dir), "isdir \"/proc\"");
+  while (readdir (dir, name))
+    if (!strcmp (name, "syscall"))
+      found = true;
+  CHECK (found, "readdir finds \"syscall\"");
+  close (dir);
+
+  CHECK ((fd = open ("/proc/syscall")) > 1, "open \"/proc/syscall\"");
+  CHECK (!isdir (fd), "isdir \"/proc/syscall\" is false");
+  n = read (fd, buf, sizeof buf - 1);
+  CHECK (n > 0, "read first sample");
+  buf[n] = '\0';
+  first = read_cnt (buf);
+  CHECK (read (fd, buf, sizeof buf) == 0, "read past end of sample");
+
+  seek (fd, 0);
+  n = read (fd, buf, sizeof buf - 1);
+  CHECK (n > 0, "read second sample");
+  buf[n] = '\0';
+  CHECK (read_cnt (buf) > first, "read count grew");
+
+  CHECK (write (fd, buf, 1) == -1, "write fails");
+  close (fd);
+  CHECK (open ("/proc/nonexistent") == -1, "open \"/proc/nonexistent\" fails");
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(proc-stats) begin
+(proc-stats) open "/proc"
+(proc-stats) isdir "/proc"
+(proc-stats) readdir finds "syscall"
+(proc-stats) open "/proc/syscall"
+(proc-stats) isdir "/proc/syscall" is false
+(proc-stats) read first sample
+(proc-stats) read past end of sample
+(proc-stats) read second sample
+(proc-stats) read count grew
+(proc-stats) write fails
+(proc-stats) open "/proc/nonexistent" fails
+(proc-stats) end
+proc-stats: exit(0)
+EOF
+pass;
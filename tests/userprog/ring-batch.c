@@ -0,0 +1,82 @@
+/* Queues file system calls on a submission ring and makes each
+   batch with a single ring_enter, reaping the completions straight
+   from the completion ring.  A call that may not be made from a
+   ring, like exit, must complete with -1 and leave the process
+   running. */
+
+#include <string.h>
+#include <syscall.h>
+#include <syscall-nr.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHUNK 16
+#define CHUNK_CNT 8
+
+static struct ring ring;
+
+/* Queues system call NR with arguments A, B, C and D, tagged
+   USER_DATA. */
+static void
+queue (int nr, int a, int b, int c, int d, unsigned user_data)
+{
+  struct ring_sqe *sqe = &ring.sq[ring.sq_tail % RING_ENTRIES];
+
+  sqe->nr = nr;
+  sqe->args[0] = a;
+  sqe->args[1] = b;
+  sqe->args[2] = c;
+  sqe->args[3] = d;
+  sqe->user_data = user_data;
+  ring.sq_tail++;
+}
+
+/* Reaps the next completion, which must be tagged USER_DATA, and
+   returns its result. */
+static int
+reap (unsigned user_data)
+{
+  struct ring_cqe *cqe;
+
+  if (ring.cq_head == ring.cq_tail)
+    fail ("no completion for %u", user_data);
+  cqe = &ring.cq[ring.cq_head++ % RING_ENTRIES];
+  if (cqe->user_data != user_data)
+    fail ("completion for %u, expected %u", cqe->user_data, user_data);
+  return cqe->result;
+}
+
+void
+test_main (void)
+{
+  static const char data[] = "0123456789abcdef";
+  static char buf[CHUNK * CHUNK_CNT];
+  int fd, i;
+
+  queue (SYS_CREATE, (int) "ring.txt", 0, 0, 0, 1);
+  queue (SYS_OPEN, (int) "ring.txt", 0, 0, 0, 2);
+  queue (SYS_EXIT, 57, 0, 0, 0, 3);
+  CHECK (ring_enter (&ring) == 3, "ring_enter makes 3 calls");
+  CHECK (reap (1) == 1, "create \"ring.txt\"");
+  CHECK ((fd = reap (2)) > 1, "open \"ring.txt\"");
+  CHECK (reap (3) == -1, "exit refused");
+
+  for (i = 0; i < CHUNK_CNT; i++)
+    queue (SYS_WRITE, fd, (int) data, CHUNK, 0, 10 + i);
+  queue (SYS_FILESIZE, fd, 0, 0, 0, 20);
+  queue (SYS_PREAD, fd, (int) buf, sizeof buf, 0, 21);
+  queue (SYS_CLOSE, fd, 0, 0, 0, 22);
+  CHECK (ring_enter (&ring) == CHUNK_CNT + 3,
+         "ring_enter makes %d calls", CHUNK_CNT + 3);
+  CHECK (ring.sq_head == ring.sq_tail, "submission ring drained");
+  for (i = 0; i < CHUNK_CNT; i++)
+    if (reap (10 + i) != CHUNK)
+      fail ("write %d was short", i);
+  CHECK (reap (20) == CHUNK * CHUNK_CNT, "filesize");
+  CHECK (reap (21) == CHUNK * CHUNK_CNT, "pread");
+  CHECK (reap (22) == 0, "close");
+  for (i = 0; i < CHUNK_CNT; i++)
+    if (memcmp (buf + i * CHUNK, data, CHUNK))
+      fail ("chunk %d differs", i);
+  CHECK (ring.cq_head == ring.cq_tail, "completion ring drained");
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(ring-batch) begin
+(ring-batch) ring_enter makes 3 calls
+(ring-batch) create "ring.txt"
+(ring-batch) open "ring.txt"
+(ring-batch) exit refused
+(ring-batch) ring_enter makes 11 calls
+(ring-batch) submission ring drained
+(ring-batch) filesize
+(ring-batch) pread
+(ring-batch) close
+(ring-batch) completion ring drained
+(ring-batch) end
+ring-batch: exit(0)
+EOF
+pass;
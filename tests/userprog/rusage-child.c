@@ -0,0 +1,32 @@
+/* Checks that getrusage() counts the calling process's system
+   calls, and that a child's usage is added to its parent's
+   children's usage once the parent has waited for it. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  struct rusage self, before, after;
+
+  CHECK (getrusage (RUSAGE_SELF, &self), "getrusage self");
+  CHECK (getrusage (RUSAGE_CHILDREN, &before), "getrusage children");
+  if (before.syscall_cnt != 0)
+    fail ("%llu system calls by children not yet run",
+          before.syscall_cnt);
+
+  msg ("wait(exec()) = %d", wait (exec ("child-simple")));
+  CHECK (getrusage (RUSAGE_CHILDREN, &after), "getrusage children");
+  if (after.syscall_cnt < 2)
+    fail ("%llu system calls by child, expected at least 2",
+          after.syscall_cnt);
+
+  before = self;
+  CHECK (getrusage (RUSAGE_SELF, &self), "getrusage self");
+  if (self.syscall_cnt - before.syscall_cnt < 5)
+    fail ("%llu system calls since the first getrusage, "
+          "expected at least 5", self.syscall_cnt - before.syscall_cnt);
+  CHECK (!getrusage (-1, &self), "getrusage for unknown process");
+}
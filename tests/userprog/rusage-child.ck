@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rusage-child) begin
+(rusage-child) getrusage self
+(rusage-child) getrusage children
+(child-simple) run
+child-simple: exit(81)
+(rusage-child) wait(exec()) = 81
+(rusage-child) getrusage children
+(rusage-child) getrusage self
+(rusage-child) getrusage for unknown process
+(rusage-child) end
+rusage-child: exit(0)
+EOF
+pass;
@@ -0,0 +1,27 @@
+/* Spawns several children at once, plus one whose program does
+   not exist.  spawn must return a pid for each without waiting for
+   it to load; waiting then yields each child's exit code, and -1
+   for the one that could not load. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHILD_CNT 4
+
+void
+test_main (void) 
+{
+  pid_t children[CHILD_CNT];
+  pid_t missing;
+  int i;
+
+  for (i = 0; i < CHILD_CNT; i++)
+    CHECK ((children[i] = spawn ("child-simple")) != -1,
+           "spawn(\"child-simple\")");
+  CHECK ((missing = spawn ("no-such-file")) != -1,
+         "spawn(\"no-such-file\")");
+  for (i = 0; i < CHILD_CNT; i++)
+    msg ("wait(child) = %d", wait (children[i]));
+  msg ("wait(missing) = %d", wait (missing));
+}
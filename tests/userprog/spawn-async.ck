@@ -0,0 +1,44 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+
+# The children load and run concurrently, so their output may
+# come in any order, interleaved with the parent's.  Check that
+# each child said what it should, then compare the rest.
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+my (%counts);
+my (@rest);
+foreach (@output) {
+    if (/^\(child-simple\) run$/ || /^child-simple: exit\(81\)$/
+	|| /^load: no-such-file: open failed$/
+	|| /^no-such-file: exit\(-1\)$/) {
+	$counts{$_}++;
+    } else {
+	push (@rest, $_);
+    }
+}
+fail "expected 4 children to run\n"
+  if ($counts{"(child-simple) run"} || 0) != 4
+  || ($counts{"child-simple: exit(81)"} || 0) != 4;
+fail "missing program did not exit with -1\n"
+  if ($counts{"no-such-file: exit(-1)"} || 0) != 1;
+compare_output ("run", \@rest, [<<'EOF']);
+(spawn-async) begin
+(spawn-async) spawn("child-simple")
+(spawn-async) spawn("child-simple")
+(spawn-async) spawn("child-simple")
+(spawn-async) spawn("child-simple")
+(spawn-async) spawn("no-such-file")
+(spawn-async) wait(child) = 81
+(spawn-async) wait(child) = 81
+(spawn-async) wait(child) = 81
+(spawn-async) wait(child) = 81
+(spawn-async) wait(missing) = -1
+(spawn-async) end
+spawn-async: exit(0)
+EOF
+pass;
@@ -0,0 +1,21 @@
+/* Reaps a child with wait_any, which must return the child's pid
+   and exit code.  Once no children remain, wait_any and
+   try_wait_any must both return -1 immediately, and a plain wait
+   on the reaped child must fail as well. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  pid_t child = exec ("child-simple");
+  int status = 0;
+
+  CHECK (wait_any (&status) == child, "wait_any() = child");
+  msg ("exit status = %d", status);
+  msg ("wait(child) = %d", wait (child));
+  msg ("wait_any() = %d", wait_any (&status));
+  msg ("try_wait_any() = %d", try_wait_any (NULL));
+}
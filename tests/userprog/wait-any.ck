@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(wait-any) begin
+(child-simple) run
+child-simple: exit(81)
+(wait-any) wait_any() = child
+(wait-any) exit status = 81
+(wait-any) wait(child) = -1
+(wait-any) wait_any() = -1
+(wait-any) try_wait_any() = -1
+(wait-any) end
+wait-any: exit(0)
+EOF
+pass;
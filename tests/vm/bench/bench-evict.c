@@ -0,0 +1,46 @@
+/* Measures paging throughput with far more pages in use than
+   frames: the kernel is run with a small user pool, and every
+   access to a page of a large array evicts another page to swap
+   and reads this one back. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/bench.h"
+
+#define PAGE_CNT 512
+#define PAGE_SIZE 4096
+#define PASS_CNT 3
+
+static char pages[PAGE_CNT * PAGE_SIZE];
+static struct bench b;
+
+void
+test_main (void)
+{
+  int pass, i;
+
+  bench_start (&b, "fill");
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      bench_op_begin (&b);
+      memset (pages + i * PAGE_SIZE, i, PAGE_SIZE);
+      bench_op_end (&b, PAGE_SIZE);
+    }
+  bench_report (&b);
+
+  bench_start (&b, "sweep");
+  for (pass = 0; pass < PASS_CNT; pass++)
+    for (i = 0; i < PAGE_CNT; i++)
+      {
+        char *page = pages + i * PAGE_SIZE;
+
+        bench_op_begin (&b);
+        if (page[0] != (char) (i + pass) || page[PAGE_SIZE - 1] != page[0])
+          fail ("page %d has wrong contents in pass %d", i, pass);
+        page[0] = page[PAGE_SIZE - 1] = i + pass + 1;
+        bench_op_end (&b, PAGE_SIZE);
+      }
+  bench_report (&b);
+}
@@ -0,0 +1,45 @@
+/* Measures process startup: the time to exec a small program and
+   wait for it to exit, and to fork and wait for the child. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/bench.h"
+
+#define RUN_CNT 16
+
+static struct bench b;
+
+void
+test_main (void)
+{
+  int i;
+
+  bench_start (&b, "exec");
+  for (i = 0; i < RUN_CNT; i++)
+    {
+      pid_t child;
+
+      bench_op_begin (&b);
+      child = exec ("child-bench-exec");
+      if (child == PID_ERROR || wait (child) != 0)
+        fail ("exec of child-bench-exec %d failed", i);
+      bench_op_end (&b, 0);
+    }
+  bench_report (&b);
+
+  bench_start (&b, "fork");
+  for (i = 0; i < RUN_CNT; i++)
+    {
+      pid_t child;
+
+      bench_op_begin (&b);
+      child = fork ();
+      if (child == 0)
+        exit (0);
+      if (child == PID_ERROR || wait (child) != 0)
+        fail ("fork %d failed", i);
+      bench_op_end (&b, 0);
+    }
+  bench_report (&b);
+}
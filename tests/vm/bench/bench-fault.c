@@ -0,0 +1,86 @@
+/* Measures the latency of each kind of page fault: first writes
+   to zero-filled pages, first reads of them, writes to pages that
+   have only been read, and first reads of a mapped file. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/bench.h"
+
+#define PAGE_CNT 128
+#define PAGE_SIZE 4096
+
+/* One page spare in each, since the first may share a page with
+   data read from the executable. */
+static char written[(PAGE_CNT + 1) * PAGE_SIZE];
+static char read_first[(PAGE_CNT + 1) * PAGE_SIZE];
+static char buf[PAGE_SIZE];
+static struct bench b;
+
+/* Returns the first page boundary in ARRAY. */
+static char *
+first_page (char *array)
+{
+  return (char *) (((uintptr_t) array + PAGE_SIZE - 1)
+                   & ~(uintptr_t) (PAGE_SIZE - 1));
+}
+
+void
+test_main (void)
+{
+  const char *file_name = "fault.dat";
+  char *actual = (char *) 0x10000000;
+  volatile char *page;
+  mapid_t map;
+  int fd, i;
+
+  page = first_page (written);
+  bench_start (&b, "zero-write");
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      bench_op_begin (&b);
+      page[i * PAGE_SIZE] = 1;
+      bench_op_end (&b, PAGE_SIZE);
+    }
+  bench_report (&b);
+
+  page = first_page (read_first);
+  bench_start (&b, "zero-read");
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      bench_op_begin (&b);
+      if (page[i * PAGE_SIZE] != 0)
+        fail ("zero-filled page %d is not zero", i);
+      bench_op_end (&b, PAGE_SIZE);
+    }
+  bench_report (&b);
+
+  bench_start (&b, "write-after-read");
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      bench_op_begin (&b);
+      page[i * PAGE_SIZE] = 1;
+      bench_op_end (&b, PAGE_SIZE);
+    }
+  bench_report (&b);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  for (i = 0; i < PAGE_CNT; i++)
+    if (write (fd, buf, PAGE_SIZE) != PAGE_SIZE)
+      fail ("write \"%s\" failed", file_name);
+  CHECK ((map = mmap (fd, actual)) != MAP_FAILED, "mmap \"%s\"", file_name);
+  page = actual;
+  bench_start (&b, "file-read");
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      bench_op_begin (&b);
+      if (page[i * PAGE_SIZE] != 0)
+        fail ("mapped page %d is not zero", i);
+      bench_op_end (&b, PAGE_SIZE);
+    }
+  bench_report (&b);
+  munmap (map);
+  close (fd);
+}
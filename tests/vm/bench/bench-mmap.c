@@ -0,0 +1,63 @@
+/* Compares reading a file with read() against mapping it and
+   copying out of the mapping, 4 kB at a time. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/bench.h"
+
+#define FILE_SIZE (512 * 1024)
+#define BLOCK_SIZE 4096
+
+static char buf[BLOCK_SIZE];
+static struct bench b;
+
+void
+test_main (void)
+{
+  const char *file_name = "mmap.dat";
+  char *actual = (char *) 0x10000000;
+  mapid_t map;
+  size_t ofs;
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  for (ofs = 0; ofs < FILE_SIZE; ofs += BLOCK_SIZE)
+    {
+      memset (buf, ofs / BLOCK_SIZE, BLOCK_SIZE);
+      if (write (fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+        fail ("write \"%s\" failed", file_name);
+    }
+  close (fd);
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  bench_start (&b, "read");
+  for (ofs = 0; ofs < FILE_SIZE; ofs += BLOCK_SIZE)
+    {
+      bench_op_begin (&b);
+      if (read (fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+        fail ("read %d bytes at offset %zu failed", BLOCK_SIZE, ofs);
+      bench_op_end (&b, BLOCK_SIZE);
+      if (buf[0] != (char) (ofs / BLOCK_SIZE))
+        fail ("read bad data at offset %zu", ofs);
+    }
+  bench_report (&b);
+  close (fd);
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK ((map = mmap (fd, actual)) != MAP_FAILED, "mmap \"%s\"", file_name);
+  bench_start (&b, "mmap");
+  for (ofs = 0; ofs < FILE_SIZE; ofs += BLOCK_SIZE)
+    {
+      bench_op_begin (&b);
+      memcpy (buf, actual + ofs, BLOCK_SIZE);
+      bench_op_end (&b, BLOCK_SIZE);
+      if (buf[0] != (char) (ofs / BLOCK_SIZE))
+        fail ("mapping has bad data at offset %zu", ofs);
+    }
+  bench_report (&b);
+  munmap (map);
+  close (fd);
+}
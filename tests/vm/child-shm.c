@@ -0,0 +1,24 @@
+/* Child process of shm-exec.
+   Attaches the segment that shm-exec filled, at a different
+   address, checks its contents and overwrites them. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/shm.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((char *) 0x20000000)
+
+void
+test_main (void)
+{
+  size_t i;
+
+  CHECK (shm_attach (SHM_KEY, ACTUAL, 0), "attach segment");
+  for (i = 0; i < SHM_SIZE; i++)
+    if (ACTUAL[i] != 0x5a)
+      fail ("byte %zu is %#x instead of 0x5a", i, ACTUAL[i]);
+  msg ("child: parent's writes visible");
+  memset (ACTUAL, 0xa5, SHM_SIZE);
+}
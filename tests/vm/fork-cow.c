@@ -0,0 +1,49 @@
+/* Forks a process with 512 kB of initialized data and has the
+   child overwrite all of it.  Verifies that the child sees its
+   own writes and that the parent's copy is left unchanged. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (512 * 1024)
+
+static char buf[SIZE];
+
+/* Fails unless every byte of BUF is VALUE. */
+static void
+verify (char value)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != value)
+      fail ("byte %zu is %#x instead of %#x", i, buf[i], value);
+}
+
+void
+test_main (void)
+{
+  pid_t pid;
+
+  msg ("initialize");
+  memset (buf, 0x5a, sizeof buf);
+
+  msg ("fork");
+  pid = fork ();
+  if (pid == 0)
+    {
+      msg ("child: overwrite");
+      memset (buf, 0xa5, sizeof buf);
+      msg ("child: read pass");
+      verify (0xa5);
+      exit (42);
+    }
+  if (pid == PID_ERROR)
+    fail ("fork failed");
+
+  msg ("wait for child: %d", wait (pid));
+  msg ("parent: read pass");
+  verify (0x5a);
+}
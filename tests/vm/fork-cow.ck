@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fork-cow) begin
+(fork-cow) initialize
+(fork-cow) fork
+(fork-cow) child: overwrite
+(fork-cow) child: read pass
+(fork-cow) wait for child: 42
+(fork-cow) parent: read pass
+(fork-cow) end
+EOF
+pass;
@@ -0,0 +1,45 @@
+/* Forks a child that shares a segment with its parent, and has
+   the two hand a flag back and forth through futexes in it. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((int *) 0x10000000)
+
+/* Sleeps until *WORD is nonzero. */
+static void
+wait_for (int *word)
+{
+  while (*word == 0)
+    futex_wait (word, 0);
+}
+
+void
+test_main (void)
+{
+  int *flag = &ACTUAL[0];
+  int *reply = &ACTUAL[1];
+  pid_t pid;
+
+  CHECK (shm_attach (439, ACTUAL, 4096), "attach segment");
+  CHECK (futex_wait (flag, 1) == -1, "wait with wrong value fails");
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      wait_for (flag);
+      msg ("child: flag set");
+      *reply = 1;
+      futex_wake (reply, 1);
+      exit (0);
+    }
+  if (pid == PID_ERROR)
+    fail ("fork failed");
+
+  *flag = 1;
+  futex_wake (flag, 1);
+  wait_for (reply);
+  msg ("parent: reply set");
+  msg ("wait for child: %d", wait (pid));
+}
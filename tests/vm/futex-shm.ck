@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(futex-shm) begin
+(futex-shm) attach segment
+(futex-shm) wait with wrong value fails
+(futex-shm) child: flag set
+(futex-shm) parent: reply set
+(futex-shm) wait for child: 0
+(futex-shm) end
+EOF
+pass;
@@ -0,0 +1,31 @@
+/* Maps a file and gives madvise() advice for the mapping,
+   checking that the mapped data is unchanged afterward and that
+   advice for unmapped memory is refused. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  char *actual = (char *) 0x10000000;
+  int handle;
+  mapid_t map;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (handle, actual)) != MAP_FAILED, "mmap \"sample.txt\"");
+  CHECK (madvise (actual, 4096, ADVICE_WILLNEED), "advise willneed");
+  if (memcmp (actual, sample, strlen (sample)))
+    fail ("read of mmap'd file reported bad data");
+  CHECK (madvise (actual, 4096, ADVICE_DONTNEED), "advise dontneed");
+  if (memcmp (actual, sample, strlen (sample)))
+    fail ("read of mmap'd file reported bad data");
+  CHECK (!madvise (actual + 0x100000, 4096, ADVICE_WILLNEED),
+         "advise unmapped memory");
+  munmap (map);
+  CHECK (!madvise (actual, 4096, ADVICE_WILLNEED), "advise after munmap");
+  close (handle);
+}
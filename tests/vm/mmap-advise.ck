@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-advise) begin
+(mmap-advise) open "sample.txt"
+(mmap-advise) mmap "sample.txt"
+(mmap-advise) advise willneed
+(mmap-advise) advise dontneed
+(mmap-advise) advise unmapped memory
+(mmap-advise) advise after munmap
+(mmap-advise) end
+EOF
+pass;
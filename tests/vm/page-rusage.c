@@ -0,0 +1,71 @@
+/* Checks that getrusage() counts the page faults that the process
+   takes: zero-filled pages as minor faults, and pages read from a
+   mapped file as major faults, each with its latency. */
+
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_CNT 16
+
+/* One page spare, since the first may share a page with data
+   read from the executable. */
+static char zeros[(PAGE_CNT + 1) * 4096];
+
+/* Returns the sum of the CNT entries in HIST. */
+static unsigned
+sum (const unsigned hist[], int cnt)
+{
+  unsigned total = 0;
+  int i;
+
+  for (i = 0; i < cnt; i++)
+    total += hist[i];
+  return total;
+}
+
+void
+test_main (void)
+{
+  char *actual = (char *) 0x10000000;
+  char *page = (char *) ROUND_UP ((uintptr_t) zeros, 4096);
+  struct rusage before, after;
+  int handle;
+  mapid_t map;
+  int i;
+
+  CHECK (getrusage (RUSAGE_SELF, &before), "getrusage");
+  for (i = 0; i < PAGE_CNT; i++)
+    if (page[i * 4096] != 0)
+      fail ("zero-filled page is not zero");
+  CHECK (getrusage (RUSAGE_SELF, &after), "getrusage");
+  if (after.zero_faults - before.zero_faults < PAGE_CNT)
+    fail ("%u zero-fill faults for %d pages",
+          after.zero_faults - before.zero_faults, PAGE_CNT);
+  if (after.minor_faults - before.minor_faults < PAGE_CNT)
+    fail ("%u minor faults for %d pages",
+          after.minor_faults - before.minor_faults, PAGE_CNT);
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (handle, actual)) != MAP_FAILED, "mmap \"sample.txt\"");
+  before = after;
+  if (memcmp (actual, sample, strlen (sample)))
+    fail ("read of mmap'd file reported bad data");
+  CHECK (getrusage (RUSAGE_SELF, &after), "getrusage");
+  if (after.file_faults == before.file_faults)
+    fail ("no file-backed fault counted");
+  if (after.major_faults == before.major_faults)
+    fail ("no major fault counted");
+  munmap (map);
+  close (handle);
+
+  if (sum (after.minor_latency, RUSAGE_LATENCY_CNT) != after.minor_faults)
+    fail ("minor fault latencies do not add up");
+  if (sum (after.major_latency, RUSAGE_LATENCY_CNT) != after.major_faults)
+    fail ("major fault latencies do not add up");
+  CHECK (!getrusage (-1, &after), "getrusage for unknown process");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-rusage) begin
+(page-rusage) getrusage
+(page-rusage) getrusage
+(page-rusage) open "sample.txt"
+(page-rusage) mmap "sample.txt"
+(page-rusage) getrusage
+(page-rusage) getrusage for unknown process
+(page-rusage) end
+EOF
+pass;
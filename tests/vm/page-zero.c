@@ -0,0 +1,55 @@
+/* Reads every page of a large zero-filled array, which maps them
+   all to the kernel's shared zero page, then writes to every
+   other page and checks that the pages in between still read as
+   zeros, so that no write reached the shared page.  A child
+   forked afterward must see the same. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_CNT 64
+
+static char zeros[PAGE_CNT * 4096];
+
+/* Fails unless page I of ZEROS holds only bytes equal to C. */
+static void
+check_page (int i, char c)
+{
+  size_t j;
+
+  for (j = 0; j < 4096; j++)
+    if (zeros[i * 4096 + j] != c)
+      fail ("byte %zu of page %d is %d, not %d",
+            j, i, zeros[i * 4096 + j], c);
+}
+
+void
+test_main (void)
+{
+  pid_t child;
+  int i;
+
+  msg ("read pass");
+  for (i = 0; i < PAGE_CNT; i++)
+    check_page (i, 0);
+
+  msg ("write pass");
+  for (i = 0; i < PAGE_CNT; i += 2)
+    memset (zeros + i * 4096, 0x5a, 4096);
+
+  msg ("read pass");
+  for (i = 0; i < PAGE_CNT; i++)
+    check_page (i, i % 2 == 0 ? 0x5a : 0);
+
+  child = fork ();
+  if (child == 0)
+    {
+      for (i = 0; i < PAGE_CNT; i++)
+        check_page (i, i % 2 == 0 ? 0x5a : 0);
+      exit (0);
+    }
+  CHECK (child > 0, "fork");
+  CHECK (wait (child) == 0, "wait for child");
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-zero) begin
+(page-zero) read pass
+(page-zero) write pass
+(page-zero) read pass
+(page-zero) fork
+(page-zero) wait for child
+(page-zero) end
+EOF
+pass;
@@ -0,0 +1,31 @@
+/* Attaches a shared memory segment, fills it, and runs
+   child-shm, which attaches the same segment at another address
+   and overwrites it.  Verifies that each process sees what the
+   other wrote. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/shm.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((char *) 0x10000000)
+
+void
+test_main (void)
+{
+  pid_t child;
+  size_t i;
+
+  CHECK (shm_attach (SHM_KEY, ACTUAL, SHM_SIZE), "attach segment");
+  memset (ACTUAL, 0x5a, SHM_SIZE);
+
+  CHECK ((child = exec ("child-shm")) != -1, "exec \"child-shm\"");
+  CHECK (wait (child) == 0, "wait for child (should return 0)");
+
+  for (i = 0; i < SHM_SIZE; i++)
+    if (ACTUAL[i] != (char) 0xa5)
+      fail ("byte %zu is %#x instead of 0xa5", i, ACTUAL[i]);
+  msg ("parent: child's writes visible");
+  CHECK (shm_detach (ACTUAL), "detach segment");
+}
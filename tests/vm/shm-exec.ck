@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(shm-exec) begin
+(shm-exec) attach segment
+(shm-exec) exec "child-shm"
+(child-shm) begin
+(child-shm) attach segment
+(child-shm) child: parent's writes visible
+(child-shm) end
+(shm-exec) wait for child (should return 0)
+(shm-exec) parent: child's writes visible
+(shm-exec) detach segment
+(shm-exec) end
+EOF
+pass;
@@ -0,0 +1,8 @@
+#ifndef TESTS_VM_SHM_H
+#define TESTS_VM_SHM_H 1
+
+/* Segment shared by shm-exec and child-shm. */
+#define SHM_KEY 439
+#define SHM_SIZE (64 * 1024)
+
+#endif /* tests/vm/shm.h */
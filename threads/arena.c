@@ -0,0 +1,145 @@
+#include "threads/arena.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Per-thread scratch arenas.
+
+   Each thread may have an arena of ARENA_PAGES pages, obtained
+   the first time it calls arena_alloc(), that hands out memory by
+   bumping a pointer.  It suits the short-lived buffers that a
+   system call or file system operation allocates and frees before
+   returning: nothing is shared with other threads, so there is no
+   lock to take and no free list to search.
+
+   arena_free() gives memory back at once if it is the last block
+   allocated, and the whole arena is reclaimed when its last live
+   block is freed, so code that frees what it allocates never runs
+   its thread's arena dry, whether or not it runs inside a system
+   call.  The system call handler also resets the arena on the way
+   back to user mode, reclaiming anything a call left behind.  A
+   request that does not fit falls back to malloc(), and
+   arena_free() passes such blocks on to free(). */
+
+#define ARENA_PAGES 2
+#define ARENA_SIZE (ARENA_PAGES * PGSIZE)
+
+/* Blocks are aligned like malloc()'s. */
+#define ARENA_ALIGN 8
+
+/* Header of each arena block, giving where the arena's top was
+   before and after the block was carved out. */
+struct arena_block
+  {
+    size_t prev_used;           /* Arena bytes used before it. */
+    size_t used;                /* Arena bytes used with it. */
+  };
+
+/* Statistics. */
+static unsigned long long bump_cnt;     /* Blocks from arenas. */
+static unsigned long long fallback_cnt; /* Requests passed to malloc(). */
+static size_t peak_used;                /* Most bytes of one arena used. */
+
+/* Returns true if P lies in thread T's arena. */
+static bool
+in_arena (const struct thread *t, const void *p)
+{
+  return (t->arena != NULL && (const uint8_t *) p >= t->arena
+          && (const uint8_t *) p < t->arena + ARENA_SIZE);
+}
+
+/* Obtains and returns a new block of at least SIZE bytes from the
+   running thread's arena, or from malloc() if the arena is full.
+   Returns a null pointer if neither has the memory.  Free it with
+   arena_free(), not free(). */
+void *
+arena_alloc (size_t size)
+{
+  struct thread *t = thread_current ();
+  struct arena_block *b;
+  size_t need;
+
+  ASSERT (!intr_context ());
+  if (t->arena == NULL)
+    t->arena = palloc_get_multiple (0, ARENA_PAGES);
+  need = sizeof *b + ROUND_UP (size, ARENA_ALIGN);
+  if (t->arena == NULL || size > ARENA_SIZE
+      || need > ARENA_SIZE - t->arena_used)
+    {
+      fallback_cnt++;
+      return malloc (size);
+    }
+
+  b = (struct arena_block *) (t->arena + t->arena_used);
+  b->prev_used = t->arena_used;
+  t->arena_used += need;
+  b->used = t->arena_used;
+  t->arena_live++;
+  if (t->arena_used > peak_used)
+    peak_used = t->arena_used;
+  bump_cnt++;
+  return b + 1;
+}
+
+/* Frees block P, which arena_alloc() returned in this thread.  P
+   may be a null pointer, in which case nothing happens. */
+void
+arena_free (void *p)
+{
+  struct thread *t = thread_current ();
+  struct arena_block *b;
+
+  if (p == NULL)
+    return;
+  if (!in_arena (t, p))
+    {
+      free (p);
+      return;
+    }
+
+  /* Rewind to where the arena stood before P if P is on top,
+     or all the way if P was the last live block. */
+  b = (struct arena_block *) p - 1;
+  ASSERT (t->arena_live > 0);
+  if (--t->arena_live == 0)
+    t->arena_used = 0;
+  else if (b->used == t->arena_used)
+    t->arena_used = b->prev_used;
+}
+
+/* Reclaims all of the running thread's arena, including blocks
+   not yet freed, which must not be used afterward.  The system
+   call handler calls this as each call returns. */
+void
+arena_reset (void)
+{
+  struct thread *t = thread_current ();
+
+  t->arena_used = 0;
+  t->arena_live = 0;
+}
+
+/* Frees the running thread's arena, as it exits. */
+void
+arena_destroy (void)
+{
+  struct thread *t = thread_current ();
+
+  palloc_free_multiple (t->arena, ARENA_PAGES);
+  t->arena = NULL;
+  arena_reset ();
+}
+
+/* Prints arena statistics. */
+void
+arena_print_stats (void)
+{
+  printf ("Arena: %llu blocks bumped, %llu fell back to malloc, "
+          "%zu bytes peak\n", bump_cnt, fallback_cnt, peak_used);
+}
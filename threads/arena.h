@@ -0,0 +1,12 @@
+#ifndef THREADS_ARENA_H
+#define THREADS_ARENA_H
+
+#include <stddef.h>
+
+void *arena_alloc (size_t) __attribute__ ((malloc));
+void arena_free (void *);
+void arena_reset (void);
+void arena_destroy (void);
+void arena_print_stats (void);
+
+#endif /* threads/arena.h */
@@ -20,12 +20,18 @@
 #include "threads/loader.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/profile.h"
 #include "threads/pte.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/tracepoint.h"
+#include "threads/workqueue.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
+#include "userprog/futex.h"
 #include "userprog/gdt.h"
+#include "userprog/image.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
 #else
@@ -33,9 +39,23 @@
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
+#include "devices/bcache.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
+#include "devices/stripe.h"
+#include "filesys/cache.h"
+#include "filesys/checksum.h"
+#include "filesys/free-extent.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/inode.h"
+#endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/share.h"
+#include "vm/shm.h"
+#include "vm/swap.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -49,6 +69,18 @@ static bool format_filesys;
    overriding the defaults. */
 static const char *filesys_bdev_name;
 static const char *scratch_bdev_name;
+
+/* -stripe: Comma-separated names of block devices to stripe the
+   file system over. */
+static char *stripe_bdev_names;
+
+/* -bcache: Name of a fast block device to cache the file system
+   device's sectors on. */
+static const char *bcache_bdev_name;
+
+/* -ramdisk: Size of the RAM disk "ram0" to create, in kB, or 0
+   for none. */
+static size_t ramdisk_kb;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
@@ -57,6 +89,27 @@ static const char *swap_bdev_name;
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+/* Phases of boot, timed for the boot profile. */
+enum boot_phase
+  {
+    PHASE_EARLY,                /* Command line, threads, console. */
+    PHASE_MEMORY,               /* Page and block allocators, paging. */
+    PHASE_INTERRUPTS,           /* Segmentation and interrupt handlers. */
+    PHASE_THREADS,              /* Scheduler, workers, timer calibration. */
+    PHASE_FILESYS,              /* Disks and file system. */
+    PHASE_VM,                   /* Frame table, swap, sharing. */
+    PHASE_ACTIONS,              /* Actions from the command line. */
+    PHASE_CNT
+  };
+
+static const char *phase_names[PHASE_CNT] =
+  {"early", "memory", "interrupts", "threads", "filesys", "vm", "actions"};
+
+/* Time-stamp counter at the start of each phase.  Each phase ends
+   where the next begins; the last ends at boot_tsc[PHASE_CNT], or
+   at the time of printing if the actions have not finished. */
+static uint64_t boot_tsc[PHASE_CNT + 1];
+
 static void bss_init (void);
 static void paging_init (void);
 
@@ -68,6 +121,8 @@ static void usage (void);
 #ifdef FILESYS
 static void locate_block_devices (void);
 static void locate_block_device (enum block_type, const char *name);
+static void create_stripe (void);
+static void create_bcache (void);
 #endif
 
 int main (void) NO_RETURN;
@@ -80,6 +135,7 @@ main (void)
 
   /* Clear BSS. */  
   bss_init ();
+  boot_tsc[PHASE_EARLY] = timer_tsc ();
 
   /* Break command line into arguments and parse options. */
   argv = read_command_line ();
@@ -95,11 +151,15 @@ main (void)
           init_ram_pages * PGSIZE / 1024);
 
   /* Initialize memory system. */
+  boot_tsc[PHASE_MEMORY] = timer_tsc ();
   palloc_init (user_page_limit);
   malloc_init ();
   paging_init ();
+  profile_init ();
+  tracepoint_init ();
 
   /* Segmentation. */
+  boot_tsc[PHASE_INTERRUPTS] = timer_tsc ();
 #ifdef USERPROG
   tss_init ();
   gdt_init ();
@@ -113,24 +173,41 @@ main (void)
 #ifdef USERPROG
   exception_init ();
   syscall_init ();
+  image_init ();
+  futex_init ();
 #endif
 
   /* Start thread scheduler and enable interrupts. */
+  boot_tsc[PHASE_THREADS] = timer_tsc ();
   thread_start ();
+  intr_defer_start ();
+  workqueue_init ();
   serial_init_queue ();
+  console_start ();
   timer_calibrate ();
 
+  boot_tsc[PHASE_FILESYS] = timer_tsc ();
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
   locate_block_devices ();
   filesys_init (format_filesys);
 #endif
+  boot_tsc[PHASE_VM] = timer_tsc ();
+#ifdef VM
+  frame_init ();
+  swap_init ();
+  share_init ();
+  page_init ();
+  shm_init ();
+#endif
 
   printf ("Boot complete.\n");
   
   /* Run actions specified on kernel command line. */
+  boot_tsc[PHASE_ACTIONS] = timer_tsc ();
   run_actions (argv);
+  boot_tsc[PHASE_CNT] = timer_tsc ();
 
 
   /* Finish up. */
@@ -138,6 +215,26 @@ main (void)
   thread_exit ();
 }
 
+/* Prints how long each phase of boot took, in microseconds. */
+void
+init_print_stats (void)
+{
+  uint64_t end = boot_tsc[PHASE_CNT];
+  int i;
+
+  if (end == 0)
+    end = timer_tsc ();
+
+  printf ("Boot profile:");
+  for (i = 0; i < PHASE_CNT; i++)
+    {
+      uint64_t next = i + 1 < PHASE_CNT ? boot_tsc[i + 1] : end;
+      printf (" %s %llu us%s", phase_names[i],
+              timer_tsc_to_ns (next - boot_tsc[i]) / 1000,
+              i + 1 < PHASE_CNT ? "," : "\n");
+    }
+}
+
 /* Clear the "BSS", a segment that should be initialized to
    zeros.  It isn't actually stored on disk or zeroed by the
    kernel loader, so we have to zero it ourselves.
@@ -151,16 +248,62 @@ bss_init (void)
   memset (&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+/* CPUID leaf 1 feature flags in EDX.  See [IA32-v2a] "CPUID". */
+#define CPUID_PSE 0x00000008    /* Page Size Extension: 4 MB pages. */
+#define CPUID_PGE 0x00002000    /* Page Global Enable: global pages. */
+
+/* CR4 bits.  See [IA32-v3a] 2.5 "Control Registers". */
+#define CR4_PSE 0x00000010      /* Page Size Extension enable. */
+#define CR4_PGE 0x00000080      /* Page Global Enable. */
+
+/* Returns the feature flags that CPUID reports in EDX. */
+static uint32_t
+cpu_features (void)
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+
+  asm ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  return edx;
+}
+
+/* Sets the bits in FLAGS in CR4. */
+static void
+cr4_set (uint32_t flags)
+{
+  uint32_t cr4;
+
+  asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+  cr4 |= flags;
+  asm volatile ("movl %0, %%cr4" : : "r" (cr4) : "memory");
+}
+
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   If the CPU supports 4 MB pages, each whole 4 MB of RAM is
+   mapped by a single page directory entry, which needs no page
+   table and only one TLB entry.  The 4 MB holding the kernel's
+   code, which must stay read-only, and any partial 4 MB at the
+   end of RAM are still mapped with 4 kB pages.
+
+   If the CPU supports global pages, the kernel mapping, which
+   never changes once made and is the same in every page
+   directory, is marked global, so that its TLB entries survive
+   the CR3 loads of process switches. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
   size_t page;
   extern char _start, _end_kernel_text;
+  uint32_t features = cpu_features ();
+  bool pse = (features & CPUID_PSE) != 0;
+  uint32_t global = features & CPUID_PGE ? PTE_G : 0;
+
+  if (pse)
+    cr4_set (CR4_PSE);
 
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   pt = NULL;
@@ -172,13 +315,22 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      if (pse && pte_idx == 0
+          && init_ram_pages - page >= PTSPAN / PGSIZE
+          && (vaddr + PTSPAN <= &_start || vaddr >= &_end_kernel_text))
+        {
+          pd[pde_idx] = pde_create_large (vaddr, true) | global;
+          page += PTSPAN / PGSIZE - 1;
+          continue;
+        }
+
       if (pd[pde_idx] == 0)
         {
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
           pd[pde_idx] = pde_create (pt);
         }
 
-      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
+      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text) | global;
     }
 
   /* Store the physical address of the page directory into CR3
@@ -187,6 +339,11 @@ paging_init (void)
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base Address
      of the Page Directory". */
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
+
+  /* Only now, with the loader's mappings flushed, may global
+     entries stay in the TLB. */
+  if (global)
+    cr4_set (CR4_PGE);
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -244,19 +401,58 @@ parse_options (char **argv)
 #ifdef FILESYS
       else if (!strcmp (name, "-f"))
         format_filesys = true;
+      else if (!strcmp (name, "-extents"))
+        inode_extents = true;
+      else if (!strcmp (name, "-checksum"))
+        checksum_enabled = true;
+      else if (!strcmp (name, "-free-extents"))
+        free_extents_enabled = true;
+      else if (!strcmp (name, "-cluster"))
+        filesys_cluster = atoi (value);
       else if (!strcmp (name, "-filesys"))
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-stripe"))
+        stripe_bdev_names = value;
+      else if (!strcmp (name, "-bcache"))
+        bcache_bdev_name = value;
+      else if (!strcmp (name, "-ramdisk"))
+        ramdisk_kb = atoi (value);
+      else if (!strcmp (name, "-flush-interval"))
+        cache_flush_interval = atoi (value);
+      else if (!strcmp (name, "-flush-batch"))
+        cache_flush_batch = atoi (value);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
+      else if (!strcmp (name, "-stack-max"))
+        page_stack_max = atoi (value) * 1024;
+      else if (!strcmp (name, "-zswap"))
+        swap_zpool_size = atoi (value) * 1024;
 #endif
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-stride"))
+        thread_stride = true;
+      else if (!strcmp (name, "-tickless"))
+        timer_tickless = true;
+      else if (!strcmp (name, "-malloc-debug"))
+        malloc_debug = true;
+      else if (!strcmp (name, "-palloc-buddy"))
+        palloc_buddy = true;
+      else if (!strcmp (name, "-lock-profile"))
+        lock_profile = true;
+      else if (!strcmp (name, "-profile"))
+        profile_enabled = true;
+      else if (!strcmp (name, "-trace"))
+        {
+          if (value == NULL || !tracepoint_enable (value))
+            PANIC ("bad -trace sites `%s'", value != NULL ? value : "");
+        }
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
@@ -264,6 +460,8 @@ parse_options (char **argv)
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
     }
+  if (thread_mlfqs && thread_stride)
+    PANIC ("-mlfqs and -stride cannot be combined");
 
   /* Initialize the random number generator based on the system
      time.  This has no effect if an "-rs" option was specified.
@@ -293,6 +491,53 @@ run_task (char **argv)
   printf ("Execution of '%s' complete.\n", task);
 }
 
+#ifdef USERPROG
+/* Most tasks that one "runall" action may start. */
+#define RUNALL_MAX 32
+
+/* Runs all of the tasks in the semicolon-separated list
+   ARGV[1] at once and waits for every one of them, so that their
+   I/O and CPU time overlap.  Reports each task's exit status and
+   the time from the common start until it exited. */
+static void
+run_all (char **argv)
+{
+  char *tasks[RUNALL_MAX];
+  tid_t tids[RUNALL_MAX];
+  char *task, *save_ptr;
+  size_t cnt = 0;
+  int64_t start;
+  size_t i;
+
+  for (task = strtok_r (argv[1], ";", &save_ptr); task != NULL;
+       task = strtok_r (NULL, ";", &save_ptr))
+    {
+      if (cnt >= RUNALL_MAX)
+        PANIC ("runall: more than %d tasks", RUNALL_MAX);
+      tasks[cnt++] = task;
+    }
+
+  printf ("Executing %zu tasks at once:\n", cnt);
+  start = timer_ticks ();
+  for (i = 0; i < cnt; i++)
+    {
+      tids[i] = process_execute (tasks[i]);
+      if (tids[i] == TID_ERROR)
+        printf ("Task '%s' failed to start.\n", tasks[i]);
+    }
+  for (i = 0; i < cnt; i++)
+    if (tids[i] != TID_ERROR)
+      {
+        int64_t exit_ticks = start;
+        int status = process_wait_timed (tids[i], &exit_ticks);
+        printf ("Task '%s' exited with status %d after %"PRId64" ticks.\n",
+                tasks[i], status, exit_ticks - start);
+      }
+  printf ("Execution of %zu tasks complete after %"PRId64" ticks.\n",
+          cnt, timer_elapsed (start));
+}
+#endif
+
 /* Executes all of the actions specified in ARGV[]
    up to the null pointer sentinel. */
 static void
@@ -310,12 +555,18 @@ run_actions (char **argv)
   static const struct action actions[] = 
     {
       {"run", 2, run_task},
+#ifdef USERPROG
+      {"runall", 2, run_all},
+#endif
 #ifdef FILESYS
       {"ls", 1, fsutil_ls},
       {"cat", 2, fsutil_cat},
       {"rm", 2, fsutil_rm},
+      {"fsck", 1, fsutil_fsck},
+      {"defrag", 1, fsutil_defrag},
       {"extract", 1, fsutil_extract},
       {"append", 2, fsutil_append},
+      {"export", 2, fsutil_export},
 #endif
       {NULL, 0, NULL},
     };
@@ -355,6 +606,7 @@ usage (void)
           "\nAvailable actions:\n"
 #ifdef USERPROG
           "  run 'PROG [ARG...]' Run PROG and wait for it to complete.\n"
+          "  runall 'PROG [ARG...];...' Run the PROGs at once and wait.\n"
 #else
           "  run TEST           Run TEST.\n"
 #endif
@@ -362,9 +614,12 @@ usage (void)
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
           "  rm FILE            Delete FILE.\n"
+          "  fsck               Check file system and rebuild free map.\n"
+          "  defrag             Defragment fragmented files.\n"
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  extract            Untar from scratch device into file system.\n"
           "  append FILE        Append FILE to tar file on scratch device.\n"
+          "  export FILE,...    Append the FILEs to it in bulk.\n"
 #endif
           "\nOptions:\n"
           "  -h                 Print this help message and power off.\n"
@@ -372,14 +627,35 @@ usage (void)
           "  -r                 Reboot after actions.\n"
 #ifdef FILESYS
           "  -f                 Format file system device during startup.\n"
+          "  -extents           With -f, use extent-based inodes.\n"
+          "  -checksum          With -f, keep a CRC32 of every sector.\n"
+          "  -free-extents      Allocate sectors from an index of free runs.\n"
+          "  -cluster=N         With -f, allocate data in N-sector clusters.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -stripe=BDEV,BDEV... Stripe file system over the BDEVs.\n"
+          "  -bcache=BDEV       Cache the file system's hot sectors on BDEV.\n"
+          "  -ramdisk=KB        Create RAM disk ram0 of KB kB, e.g. for\n"
+          "                     -filesys=ram0 -f or -scratch=ram0.\n"
+          "  -flush-interval=MS Write back dirty cache sectors every MS ms.\n"
+          "  -flush-batch=N     Write back at most N sectors per interval.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
+          "  -stack-max=KB      Let user stacks grow to KB kB (default 8192).\n"
+          "  -zswap=KB          Keep up to KB kB of compressed swap in memory\n"
+          "                     (default 256, 0 to disable).\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -stride            Use stride (proportional-share) scheduler.\n"
+          "  -tickless          Stop the periodic timer tick while idle.\n"
+          "  -malloc-debug      Report live malloc() blocks by call site.\n"
+          "  -palloc-buddy      Allocate pages with a buddy allocator.\n"
+          "  -lock-profile      Report lock contention at shutdown.\n"
+          "  -profile           Sample the CPU on timer ticks, dump at shutdown.\n"
+          "  -trace=SITE,...    Record events at the named trace sites, or\n"
+          "                     at all of them, and dump them at shutdown.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
 #endif
@@ -392,6 +668,12 @@ usage (void)
 static void
 locate_block_devices (void)
 {
+  if (ramdisk_kb > 0)
+    ramdisk_create ("ram0", ramdisk_kb * 1024 / BLOCK_SECTOR_SIZE);
+  if (stripe_bdev_names != NULL)
+    create_stripe ();
+  if (bcache_bdev_name != NULL)
+    create_bcache ();
   locate_block_device (BLOCK_FILESYS, filesys_bdev_name);
   locate_block_device (BLOCK_SCRATCH, scratch_bdev_name);
 #ifdef VM
@@ -399,6 +681,58 @@ locate_block_devices (void)
 #endif
 }
 
+/* Creates the striped device "stripe" over the devices named in
+   the -stripe option, and makes it the file system device unless
+   -filesys names another. */
+static void
+create_stripe (void)
+{
+  struct block *members[STRIPE_MAX];
+  size_t cnt = 0;
+  char *name, *save_ptr;
+
+  for (name = strtok_r (stripe_bdev_names, ",", &save_ptr); name != NULL;
+       name = strtok_r (NULL, ",", &save_ptr))
+    {
+      if (cnt >= STRIPE_MAX)
+        PANIC ("Too many devices in -stripe (at most %d)", STRIPE_MAX);
+      members[cnt] = block_get_by_name (name);
+      if (members[cnt] == NULL)
+        PANIC ("No such block device \"%s\"", name);
+      cnt++;
+    }
+  stripe_create ("stripe", members, cnt);
+  if (filesys_bdev_name == NULL)
+    filesys_bdev_name = "stripe";
+}
+
+/* Creates the caching device "bcache" in front of the file system
+   device, with the device named in the -bcache option as its
+   cache, and makes it the file system device. */
+static void
+create_bcache (void)
+{
+  struct block *backing, *cache;
+
+  cache = block_get_by_name (bcache_bdev_name);
+  if (cache == NULL)
+    PANIC ("No such block device \"%s\"", bcache_bdev_name);
+  if (filesys_bdev_name != NULL)
+    backing = block_get_by_name (filesys_bdev_name);
+  else
+    for (backing = block_first (); backing != NULL;
+         backing = block_next (backing))
+      if (block_type (backing) == BLOCK_FILESYS && backing != cache)
+        break;
+  if (backing == NULL)
+    PANIC ("No file system device to cache on \"%s\"", bcache_bdev_name);
+  if (backing == cache)
+    PANIC ("-bcache device \"%s\" is the file system device",
+           bcache_bdev_name);
+  bcache_create ("bcache", backing, cache);
+  filesys_bdev_name = "bcache";
+}
+
 /* Figures out what block device to use for the given ROLE: the
    block device with the given NAME, if NAME is non-null,
    otherwise the first block device in probe order of type
@@ -6,6 +6,7 @@
 #include "threads/flags.h"
 #include "threads/intr-stubs.h"
 #include "threads/io.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "devices/timer.h"
@@ -37,6 +38,27 @@ static const char *intr_names[INTR_CNT];
    unexpected interrupt is one that has no registered handler. */
 static unsigned int unexpected_cnt[INTR_CNT];
 
+/* Time spent in each vector's handler, in CPU cycles.  For
+   external interrupts this is time with interrupts off; other
+   handlers, such as system calls and page faults, may also have
+   slept or been interrupted. */
+struct intr_stat
+  {
+    unsigned long long cnt;     /* Interrupts handled. */
+    uint64_t total;             /* Cycles in the handler. */
+    uint64_t max;               /* Longest single run. */
+  };
+static struct intr_stat intr_stats[INTR_CNT];
+
+/* The longest region that a thread ran with interrupts off, from
+   intr_disable() to intr_enable().  OFF_TSC is the cycle counter
+   when interrupts were last turned off, or 0 if they have been
+   turned on since, and OFF_EIP where. */
+static uint64_t off_tsc;
+static void *off_eip;
+static uint64_t off_max;
+static void *off_max_eip;
+
 /* External interrupts are those generated by devices outside the
    CPU, such as the timer.  External interrupts run with
    interrupts turned off, so they never nest, nor are they ever
@@ -47,6 +69,21 @@ static unsigned int unexpected_cnt[INTR_CNT];
 static bool in_external_intr;   /* Are we processing an external interrupt? */
 static bool yield_on_return;    /* Should we yield on interrupt return? */
 
+/* Deferred work.  An external interrupt handler runs with
+   interrupts off, so anything slow that it does delays every
+   other interrupt, the timer's included.  It can instead queue
+   that part as a struct intr_work with intr_defer(), to be run
+   in order by the "intr-defer" kernel thread.  That thread runs
+   at PRI_MAX, so the work runs as soon as the interrupt returns,
+   but with interrupts on.  Work queued before the thread starts
+   waits for it. */
+static struct list work_list;   /* Queued struct intr_work. */
+static struct semaphore work_sema;      /* Up'd once per queued work. */
+static thread_func work_thread;
+
+/* Interrupt level helper. */
+static enum intr_level disable (void *caller);
+
 /* Programmable Interrupt Controller helpers. */
 static void pic_init (void);
 static void pic_end_of_interrupt (int irq);
@@ -80,7 +117,16 @@ intr_get_level (void)
 enum intr_level
 intr_set_level (enum intr_level level) 
 {
-  return level == INTR_ON ? intr_enable () : intr_disable ();
+  return (level == INTR_ON
+          ? intr_enable ()
+          : disable (__builtin_return_address (0)));
+}
+
+/* Disables interrupts and returns the previous interrupt status. */
+enum intr_level
+intr_disable (void) 
+{
+  return disable (__builtin_return_address (0));
 }
 
 /* Enables interrupts and returns the previous interrupt status. */
@@ -90,6 +136,17 @@ intr_enable (void)
   enum intr_level old_level = intr_get_level ();
   ASSERT (!intr_context ());
 
+  if (old_level == INTR_OFF && off_tsc != 0)
+    {
+      uint64_t cycles = timer_tsc () - off_tsc;
+      if (cycles > off_max)
+        {
+          off_max = cycles;
+          off_max_eip = off_eip;
+        }
+      off_tsc = 0;
+    }
+
   /* Enable interrupts by setting the interrupt flag.
 
      See [IA32-v2b] "STI" and [IA32-v3a] 5.8.1 "Masking Maskable
@@ -99,9 +156,10 @@ intr_enable (void)
   return old_level;
 }
 
-/* Disables interrupts and returns the previous interrupt status. */
-enum intr_level
-intr_disable (void) 
+/* Disables interrupts on behalf of CALLER and returns the
+   previous interrupt status. */
+static enum intr_level
+disable (void *caller)
 {
   enum intr_level old_level = intr_get_level ();
 
@@ -110,6 +168,11 @@ intr_disable (void)
      Hardware Interrupts". */
   asm volatile ("cli" : : : "memory");
 
+  if (old_level == INTR_ON)
+    {
+      off_tsc = timer_tsc ();
+      off_eip = caller;
+    }
   return old_level;
 }
 
@@ -122,6 +185,8 @@ intr_init (void)
 
   /* Initialize interrupt controller. */
   pic_init ();
+  list_init (&work_list);
+  sema_init (&work_sema, 0);
 
   /* Initialize IDT. */
   for (i = 0; i < INTR_CNT; i++)
@@ -206,6 +271,58 @@ intr_register_int (uint8_t vec_no, int dpl, enum intr_level level,
   register_handler (vec_no, dpl, level, handler, name);
 }
 
+/* Initializes W to run FUNC (AUX) each time it is queued with
+   intr_defer(). */
+void
+intr_work_init (struct intr_work *w, intr_work_func *func, void *aux)
+{
+  w->func = func;
+  w->aux = aux;
+  w->queued = false;
+}
+
+/* Queues W to run in the deferred work thread, unless it is
+   already queued and has not started running yet.  May be called
+   from an interrupt handler. */
+void
+intr_defer (struct intr_work *w)
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (!w->queued)
+    {
+      w->queued = true;
+      list_push_back (&work_list, &w->elem);
+      sema_up (&work_sema);
+    }
+  intr_set_level (old_level);
+}
+
+/* Starts the deferred work thread. */
+void
+intr_defer_start (void)
+{
+  thread_create ("intr-defer", PRI_MAX, work_thread, NULL);
+}
+
+/* Runs deferred work as it is queued. */
+static void
+work_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct intr_work *w;
+      enum intr_level old_level;
+
+      sema_down (&work_sema);
+      old_level = intr_disable ();
+      w = list_entry (list_pop_front (&work_list), struct intr_work, elem);
+      w->queued = false;
+      intr_set_level (old_level);
+      w->func (w->aux);
+    }
+}
+
 /* Returns true during processing of an external interrupt
    and false at all other times. */
 bool
@@ -344,8 +461,11 @@ make_idtr_operand (uint16_t limit, void *base)
 void
 intr_handler (struct intr_frame *frame) 
 {
-  bool external;
+  struct intr_stat *stat = &intr_stats[frame->vec_no];
   intr_handler_func *handler;
+  enum intr_level old_level;
+  uint64_t start, cycles;
+  bool external;
 
   /* External interrupts are special.
      We only handle one at a time (so interrupts must be off)
@@ -361,7 +481,14 @@ intr_handler (struct intr_frame *frame)
       yield_on_return = false;
     }
 
+  /* If the interrupted code ran with interrupts on, the last
+     region with them off has ended, even if it was left by an
+     "iret" or "sti; hlt" rather than by intr_enable(). */
+  if (frame->eflags & FLAG_IF)
+    off_tsc = 0;
+
   /* Invoke the interrupt's handler. */
+  start = timer_tsc ();
   handler = intr_handlers[frame->vec_no];
   if (handler != NULL)
     handler (frame);
@@ -374,6 +501,17 @@ intr_handler (struct intr_frame *frame)
   else
     unexpected_interrupt (frame);
 
+  /* Handlers for internal interrupts can be interrupted, even by
+     another run of the same vector, so the update is made with
+     interrupts off. */
+  cycles = timer_tsc () - start;
+  old_level = intr_disable ();
+  stat->cnt++;
+  stat->total += cycles;
+  if (cycles > stat->max)
+    stat->max = cycles;
+  intr_set_level (old_level);
+
   /* Complete the processing of an external interrupt. */
   if (external) 
     {
@@ -436,3 +574,23 @@ intr_name (uint8_t vec)
 {
   return intr_names[vec];
 }
+
+/* Prints the time spent in each interrupt vector's handler and
+   the longest region run with interrupts off. */
+void
+intr_print_stats (void)
+{
+  int vec;
+
+  for (vec = 0; vec < INTR_CNT; vec++)
+    {
+      const struct intr_stat *stat = &intr_stats[vec];
+      if (stat->cnt > 0)
+        printf ("Interrupt %#04x (%s): %llu handled, %llu us total, "
+                "%llu us max\n", vec, intr_names[vec], stat->cnt,
+                timer_tsc_to_ns (stat->total) / 1000,
+                timer_tsc_to_ns (stat->max) / 1000);
+    }
+  printf ("Interrupts: longest off for %llu us, from %p\n",
+          timer_tsc_to_ns (off_max) / 1000, off_max_eip);
+}
@@ -1,6 +1,7 @@
 #ifndef THREADS_INTERRUPT_H
 #define THREADS_INTERRUPT_H
 
+#include <list.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -64,7 +65,23 @@ void intr_register_int (uint8_t vec, int dpl, enum intr_level,
 bool intr_context (void);
 void intr_yield_on_return (void);
 
+/* Work that an external interrupt handler defers until it can run
+   with interrupts on. */
+typedef void intr_work_func (void *aux);
+struct intr_work
+  {
+    struct list_elem elem;      /* Element in the deferred work list. */
+    intr_work_func *func;       /* Function to run. */
+    void *aux;                  /* Argument for FUNC. */
+    bool queued;                /* In the list? */
+  };
+
+void intr_work_init (struct intr_work *, intr_work_func *, void *aux);
+void intr_defer (struct intr_work *);
+void intr_defer_start (void);
+
 void intr_dump_frame (const struct intr_frame *);
 const char *intr_name (uint8_t vec);
+void intr_print_stats (void);
 
 #endif /* threads/interrupt.h */
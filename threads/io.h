@@ -112,4 +112,22 @@ outsl (uint16_t port, const void *addr, size_t cnt)
   asm volatile ("rep outsl" : "+S" (addr), "+c" (cnt) : "d" (port));
 }
 
+/* Reads and returns model-specific register MSR. */
+static inline uint64_t
+rdmsr (uint32_t msr)
+{
+  /* See [IA32-v2b] "RDMSR". */
+  uint64_t data;
+  asm volatile ("rdmsr" : "=A" (data) : "c" (msr));
+  return data;
+}
+
+/* Writes DATA to model-specific register MSR. */
+static inline void
+wrmsr (uint32_t msr, uint64_t data)
+{
+  /* See [IA32-v2b] "WRMSR". */
+  asm volatile ("wrmsr" : : "c" (msr), "A" (data));
+}
+
 #endif /* threads/io.h */
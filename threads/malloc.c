@@ -11,61 +11,121 @@
 
 /* A simple implementation of malloc().
 
-   The size of each request, in bytes, is rounded up to a power
-   of 2 and assigned to the "descriptor" that manages blocks of
-   that size.  The descriptor keeps a list of free blocks.  If
-   the free list is nonempty, one of its blocks is used to
-   satisfy the request.
-
-   Otherwise, a new page of memory, called an "arena", is
-   obtained from the page allocator (if none is available,
-   malloc() returns a null pointer).  The new arena is divided
-   into blocks, all of which are added to the descriptor's free
-   list.  Then we return one of the new blocks.
-
-   When we free a block, we add it to its descriptor's free list.
-   But if the arena that the block was in now has no in-use
-   blocks, we remove all of the arena's blocks from the free list
-   and give the arena back to the page allocator.
-
-   We can't handle blocks bigger than 2 kB using this scheme,
-   because they're too big to fit in a single page with a
-   descriptor.  We handle those by allocating contiguous pages
-   with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   The size of each request, in bytes, is rounded up to the next
+   size class and assigned to the "descriptor" that manages blocks
+   of that size.  The classes are the powers of 2 from 16 bytes
+   and the points halfway between them, so no more than about a
+   third of a block is ever wasted.
+
+   Blocks come from pages of memory, called "arenas", obtained
+   from the page allocator.  Each arena begins with a header that
+   holds a bitmap of its free blocks.  A descriptor keeps a list
+   of its arenas that have free blocks; a request is satisfied
+   from the first free block of the first of them, so allocations
+   are packed toward the start of few arenas.  If the list is
+   empty, a new arena is obtained (if none is available, malloc()
+   returns a null pointer).
+
+   When we free a block, we mark it free in its arena's bitmap.
+   If the arena now has no in-use blocks, we give it back to the
+   page allocator.
+
+   We can't handle blocks bigger than about 1.5 kB using this
+   scheme, because no more would fit in a single page with a
+   header.  We handle those by allocating contiguous pages with
+   the page allocator and sticking the allocation size at the
+   beginning of the allocated block's arena header.
+
+   realloc() resizes a block in place when it can: a block that
+   stays in the same size class is left where it is, and a big
+   block gives back the pages it no longer needs or, to grow,
+   takes the free pages that follow it.  Only otherwise does it
+   allocate a new block and copy.
+
+   With the -malloc-debug kernel option, each block is prefixed
+   with a tag naming the call site that allocated it, and the
+   blocks still live from each call site are reported at
+   shutdown, to help find leaks.  The return addresses printed can
+   be turned into function names with the backtrace utility. */
 
 /* Descriptor. */
 struct desc
   {
     size_t block_size;          /* Size of each element in bytes. */
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
-    struct list free_list;      /* List of free blocks. */
+    struct list arenas;         /* Arenas with free blocks. */
     struct lock lock;           /* Lock. */
+    size_t arena_cnt;           /* Arenas allocated. */
+    size_t live_cnt;            /* Blocks in use. */
+    size_t peak_cnt;            /* Most blocks ever in use at once. */
+    unsigned long long alloc_cnt; /* Blocks ever allocated. */
   };
 
 /* Magic number for detecting arena corruption. */
 #define ARENA_MAGIC 0x9a548eed
 
+/* Number of words in an arena's bitmap, enough for an arena of
+   the smallest blocks. */
+#define ARENA_MAP_WORDS DIV_ROUND_UP (PGSIZE / 16, 32)
+
 /* Arena. */
 struct arena 
   {
     unsigned magic;             /* Always set to ARENA_MAGIC. */
     struct desc *desc;          /* Owning descriptor, null for big block. */
     size_t free_cnt;            /* Free blocks; pages in big block. */
+    struct list_elem elem;      /* Element in descriptor's arenas. */
+    uint32_t free_map[ARENA_MAP_WORDS]; /* Bit set if block is free. */
   };
 
-/* Free block. */
-struct block 
-  {
-    struct list_elem free_elem; /* Free list element. */
-  };
+/* Offset of the first block in an arena, chosen so that blocks of
+   every size class are 8-byte aligned. */
+#define ARENA_HDR ROUND_UP (sizeof (struct arena), 16)
 
 /* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
+static struct desc descs[16];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
-static struct arena *block_to_arena (struct block *);
-static struct block *arena_to_block (struct arena *, size_t idx);
+/* Statistics for big blocks, protected by stats_lock. */
+static struct lock stats_lock;
+static size_t big_page_cnt;     /* Pages in big blocks in use. */
+static size_t big_peak_cnt;     /* Most such pages ever in use. */
+static unsigned long long big_alloc_cnt; /* Big blocks ever allocated. */
+static unsigned long long realloc_cnt;   /* Blocks resized. */
+static unsigned long long inplace_cnt;   /* ...of which in place. */
+
+/* If true, tag blocks with their call sites. */
+bool malloc_debug;
+
+/* A call site, for -malloc-debug. */
+struct site
+  {
+    void *caller;               /* Return address of malloc() call. */
+    size_t live_cnt;            /* Blocks in use. */
+    size_t live_bytes;          /* Bytes requested for them. */
+  };
+
+/* Call sites, hashed by return address and protected by
+   stats_lock.  Call sites beyond the first SITE_CNT share the
+   last entry. */
+#define SITE_CNT 128
+static struct site sites[SITE_CNT + 1];
+
+/* Prefix of a block allocated with -malloc-debug.  Its size keeps
+   the blocks that follow it 8-byte aligned. */
+struct tag
+  {
+    unsigned site;              /* Index into sites[]. */
+    unsigned size;              /* Bytes requested. */
+  };
+
+static void *alloc_block (size_t size);
+static void free_block (void *);
+static bool resize_block (void *, size_t size);
+static void count_big_pages (long delta);
+static void *malloc_at (size_t size, void *caller);
+static struct arena *block_to_arena (void *);
+static void *arena_to_block (struct arena *, size_t idx);
 
 /* Initializes the malloc() descriptors. */
 void
@@ -75,23 +135,125 @@ malloc_init (void)
 
   for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2)
     {
-      struct desc *d = &descs[desc_cnt++];
-      ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
-      d->block_size = block_size;
-      d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
-      list_init (&d->free_list);
-      lock_init (&d->lock);
+      size_t size[2] = {block_size, block_size + block_size / 2};
+      int i;
+
+      for (i = 0; i < 2; i++)
+        {
+          struct desc *d = &descs[desc_cnt++];
+          ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
+          d->block_size = size[i];
+          d->blocks_per_arena = (PGSIZE - ARENA_HDR) / size[i];
+          ASSERT (d->blocks_per_arena <= ARENA_MAP_WORDS * 32);
+          list_init (&d->arenas);
+          lock_init (&d->lock);
+          lock_set_name (&d->lock, "malloc descriptor");
+          d->arena_cnt = d->live_cnt = d->peak_cnt = 0;
+          d->alloc_cnt = 0;
+        }
     }
+  lock_init (&stats_lock);
+  lock_set_name (&stats_lock, "malloc stats");
+}
+
+/* Prints allocation statistics for each size class that has been
+   used, then, with -malloc-debug, every call site with blocks
+   still in use. */
+void
+malloc_print_stats (void)
+{
+  struct desc *d;
+  size_t i;
+
+  for (d = descs; d < descs + desc_cnt; d++)
+    if (d->alloc_cnt > 0)
+      printf ("Malloc: %zu-byte blocks: %zu in use (peak %zu), "
+              "%llu allocations, %zu arenas\n",
+              d->block_size, d->live_cnt, d->peak_cnt, d->alloc_cnt,
+              d->arena_cnt);
+  printf ("Malloc: big blocks: %zu pages in use (peak %zu), "
+          "%llu allocations\n", big_page_cnt, big_peak_cnt, big_alloc_cnt);
+  printf ("Malloc: %llu reallocations, %llu in place\n",
+          realloc_cnt, inplace_cnt);
+
+  if (malloc_debug)
+    for (i = 0; i <= SITE_CNT; i++)
+      if (sites[i].live_cnt > 0)
+        {
+          printf ("Malloc: %zu blocks (%zu bytes) in use from ",
+                  sites[i].live_cnt, sites[i].live_bytes);
+          if (i < SITE_CNT)
+            printf ("%p\n", sites[i].caller);
+          else
+            printf ("other call sites\n");
+        }
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size) 
+{
+  return malloc_at (size, __builtin_return_address (0));
+}
+
+/* Allocates a block of SIZE bytes on behalf of the call site that
+   returns to CALLER, tagging it with its call site if
+   -malloc-debug is in effect. */
+static void *
+malloc_at (size_t size, void *caller)
+{
+  struct tag *tag;
+  unsigned idx, start;
+
+  if (!malloc_debug || size == 0)
+    return alloc_block (size);
+
+  tag = alloc_block (size + sizeof *tag);
+  if (tag == NULL)
+    return NULL;
+
+  /* Find CALLER's entry, or make one, by linear probing. */
+  lock_acquire (&stats_lock);
+  start = idx = ((uintptr_t) caller >> 2) % SITE_CNT;
+  while (sites[idx].caller != caller && sites[idx].caller != NULL)
+    {
+      idx = (idx + 1) % SITE_CNT;
+      if (idx == start)
+        {
+          idx = SITE_CNT;
+          break;
+        }
+    }
+  if (idx < SITE_CNT)
+    sites[idx].caller = caller;
+  sites[idx].live_cnt++;
+  sites[idx].live_bytes += size;
+  lock_release (&stats_lock);
+
+  tag->site = idx;
+  tag->size = size;
+  return tag + 1;
+}
+
+/* Adds DELTA, which may be negative, to the pages in big blocks in
+   use.  The caller must hold stats_lock. */
+static void
+count_big_pages (long delta)
+{
+  big_page_cnt += delta;
+  if (big_page_cnt > big_peak_cnt)
+    big_peak_cnt = big_page_cnt;
+}
+
+/* Obtains and returns a new block of at least SIZE bytes, without
+   a debugging tag. */
+static void *
+alloc_block (size_t size) 
 {
   struct desc *d;
-  struct block *b;
   struct arena *a;
+  size_t word, bit;
 
   /* A null pointer satisfies a request for 0 bytes. */
   if (size == 0)
@@ -106,51 +268,65 @@ malloc (size_t size)
     {
       /* SIZE is too big for any descriptor.
          Allocate enough pages to hold SIZE plus an arena. */
-      size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
+      size_t page_cnt = DIV_ROUND_UP (size + ARENA_HDR, PGSIZE);
       a = palloc_get_multiple (0, page_cnt);
       if (a == NULL)
         return NULL;
 
+      lock_acquire (&stats_lock);
+      big_alloc_cnt++;
+      count_big_pages (page_cnt);
+      lock_release (&stats_lock);
+
       /* Initialize the arena to indicate a big block of PAGE_CNT
          pages, and return it. */
       a->magic = ARENA_MAGIC;
       a->desc = NULL;
       a->free_cnt = page_cnt;
-      return a + 1;
+      return (uint8_t *) a + ARENA_HDR;
     }
 
   lock_acquire (&d->lock);
 
-  /* If the free list is empty, create a new arena. */
-  if (list_empty (&d->free_list))
+  /* If no arena has a free block, create a new arena. */
+  if (list_empty (&d->arenas))
     {
       size_t i;
 
-      /* Allocate a page. */
+      /* Allocate a page.  D's lock is dropped meanwhile, because
+         an allocation that runs short of pages evicts user pages
+         and runs the shrinkers, which free and allocate blocks
+         themselves. */
+      lock_release (&d->lock);
       a = palloc_get_page (0);
       if (a == NULL) 
-        {
-          lock_release (&d->lock);
-          return NULL; 
-        }
+        return NULL; 
 
-      /* Initialize arena and add its blocks to the free list. */
+      /* Initialize arena with all of its blocks free. */
       a->magic = ARENA_MAGIC;
       a->desc = d;
       a->free_cnt = d->blocks_per_arena;
-      for (i = 0; i < d->blocks_per_arena; i++) 
-        {
-          struct block *b = arena_to_block (a, i);
-          list_push_back (&d->free_list, &b->free_elem);
-        }
+      memset (a->free_map, 0, sizeof a->free_map);
+      for (i = 0; i < d->blocks_per_arena; i++)
+        a->free_map[i / 32] |= 1u << (i % 32);
+      lock_acquire (&d->lock);
+      list_push_front (&d->arenas, &a->elem);
+      d->arena_cnt++;
     }
 
-  /* Get a block from free list and return it. */
-  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-  a = block_to_arena (b);
-  a->free_cnt--;
+  /* Take the first free block of the first arena. */
+  a = list_entry (list_front (&d->arenas), struct arena, elem);
+  for (word = 0; a->free_map[word] == 0; word++)
+    ASSERT (word + 1 < ARENA_MAP_WORDS);
+  bit = __builtin_ctz (a->free_map[word]);
+  a->free_map[word] &= ~(1u << bit);
+  if (--a->free_cnt == 0)
+    list_remove (&a->elem);
+  d->alloc_cnt++;
+  if (++d->live_cnt > d->peak_cnt)
+    d->peak_cnt = d->live_cnt;
   lock_release (&d->lock);
-  return b;
+  return arena_to_block (a, word * 32 + bit);
 }
 
 /* Allocates and return A times B bytes initialized to zeroes.
@@ -167,7 +343,7 @@ calloc (size_t a, size_t b)
     return NULL;
 
   /* Allocate and zero memory. */
-  p = malloc (size);
+  p = malloc_at (size, __builtin_return_address (0));
   if (p != NULL)
     memset (p, 0, size);
 
@@ -178,13 +354,78 @@ calloc (size_t a, size_t b)
 static size_t
 block_size (void *block) 
 {
-  struct block *b = block;
-  struct arena *a = block_to_arena (b);
-  struct desc *d = a->desc;
+  struct arena *a;
+  struct desc *d;
 
+  if (malloc_debug)
+    return ((struct tag *) block - 1)->size;
+  a = block_to_arena (block);
+  d = a->desc;
   return d != NULL ? d->block_size : PGSIZE * a->free_cnt - pg_ofs (block);
 }
 
+/* Tries to resize block P, allocated with alloc_block(), to SIZE
+   bytes without moving it, and returns true if successful. */
+static bool
+resize_block (void *p, size_t size)
+{
+  struct arena *a = block_to_arena (p);
+  struct desc *d = a->desc;
+  size_t old_cnt, new_cnt;
+
+  /* A normal block stays put as long as SIZE is in its class. */
+  if (d != NULL)
+    return size <= d->block_size && (d == descs || size > d[-1].block_size);
+
+  /* A big block must stay big, or else it would waste pages. */
+  if (size <= descs[desc_cnt - 1].block_size)
+    return false;
+  old_cnt = a->free_cnt;
+  new_cnt = DIV_ROUND_UP (size + ARENA_HDR, PGSIZE);
+  if (new_cnt < old_cnt)
+    palloc_free_multiple ((uint8_t *) a + PGSIZE * new_cnt,
+                          old_cnt - new_cnt);
+  else if (!palloc_extend (a, old_cnt, new_cnt))
+    return false;
+  a->free_cnt = new_cnt;
+
+  lock_acquire (&stats_lock);
+  count_big_pages ((long) new_cnt - (long) old_cnt);
+  lock_release (&stats_lock);
+  return true;
+}
+
+/* Tries to resize BLOCK, allocated with malloc(), to SIZE bytes
+   without moving it, and returns true if successful. */
+static bool
+resize (void *block, size_t size)
+{
+  struct tag *tag = NULL;
+  bool ok;
+
+  if (malloc_debug)
+    {
+      tag = (struct tag *) block - 1;
+      ok = resize_block (tag, size + sizeof *tag);
+    }
+  else
+    ok = resize_block (block, size);
+
+  lock_acquire (&stats_lock);
+  realloc_cnt++;
+  if (ok)
+    {
+      inplace_cnt++;
+      if (tag != NULL)
+        {
+          sites[tag->site].live_bytes += size - tag->size;
+          tag->size = size;
+        }
+    }
+  lock_release (&stats_lock);
+  return ok;
+}
+
 /* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
    moving it in the process.
    If successful, returns the new block; on failure, returns a
@@ -199,9 +440,11 @@ realloc (void *old_block, size_t new_size)
       free (old_block);
       return NULL;
     }
+  else if (old_block != NULL && resize (old_block, new_size))
+    return old_block;
   else 
     {
-      void *new_block = malloc (new_size);
+      void *new_block = malloc_at (new_size, __builtin_return_address (0));
       if (old_block != NULL && new_block != NULL)
         {
           size_t old_size = block_size (old_block);
@@ -217,55 +460,76 @@ realloc (void *old_block, size_t new_size)
    malloc(), calloc(), or realloc(). */
 void
 free (void *p) 
+{
+  if (p != NULL && malloc_debug)
+    {
+      struct tag *tag = (struct tag *) p - 1;
+
+      lock_acquire (&stats_lock);
+      ASSERT (tag->site <= SITE_CNT);
+      sites[tag->site].live_cnt--;
+      sites[tag->site].live_bytes -= tag->size;
+      lock_release (&stats_lock);
+      p = tag;
+    }
+  free_block (p);
+}
+
+/* Frees block P, which must have been allocated with
+   alloc_block(). */
+static void
+free_block (void *p) 
 {
   if (p != NULL)
     {
-      struct block *b = p;
-      struct arena *a = block_to_arena (b);
+      struct arena *a = block_to_arena (p);
       struct desc *d = a->desc;
       
       if (d != NULL) 
         {
           /* It's a normal block.  We handle it here. */
+          size_t idx = (pg_ofs (p) - ARENA_HDR) / d->block_size;
 
 #ifndef NDEBUG
           /* Clear the block to help detect use-after-free bugs. */
-          memset (b, 0xcc, d->block_size);
+          memset (p, 0xcc, d->block_size);
 #endif
   
           lock_acquire (&d->lock);
 
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
+          /* Mark block free. */
+          ASSERT ((a->free_map[idx / 32] & (1u << (idx % 32))) == 0);
+          a->free_map[idx / 32] |= 1u << (idx % 32);
+          if (a->free_cnt++ == 0)
+            list_push_back (&d->arenas, &a->elem);
 
           /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena) 
+          if (a->free_cnt >= d->blocks_per_arena) 
             {
-              size_t i;
-
               ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++) 
-                {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
-                }
+              list_remove (&a->elem);
+              d->arena_cnt--;
               palloc_free_page (a);
             }
+          d->live_cnt--;
 
           lock_release (&d->lock);
         }
       else
         {
           /* It's a big block.  Free its pages. */
+          lock_acquire (&stats_lock);
+          count_big_pages (-(long) a->free_cnt);
+          lock_release (&stats_lock);
           palloc_free_multiple (a, a->free_cnt);
           return;
         }
     }
 }
-
+
 /* Returns the arena that block B is inside. */
 static struct arena *
-block_to_arena (struct block *b)
+block_to_arena (void *b)
 {
   struct arena *a = pg_round_down (b);
 
@@ -275,20 +539,18 @@ block_to_arena (struct block *b)
 
   /* Check that the block is properly aligned for the arena. */
   ASSERT (a->desc == NULL
-          || (pg_ofs (b) - sizeof *a) % a->desc->block_size == 0);
-  ASSERT (a->desc != NULL || pg_ofs (b) == sizeof *a);
+          || (pg_ofs (b) - ARENA_HDR) % a->desc->block_size == 0);
+  ASSERT (a->desc != NULL || pg_ofs (b) == ARENA_HDR);
 
   return a;
 }
 
 /* Returns the (IDX - 1)'th block within arena A. */
-static struct block *
+static void *
 arena_to_block (struct arena *a, size_t idx) 
 {
   ASSERT (a != NULL);
   ASSERT (a->magic == ARENA_MAGIC);
   ASSERT (idx < a->desc->blocks_per_arena);
-  return (struct block *) ((uint8_t *) a
-                           + sizeof *a
-                           + idx * a->desc->block_size);
+  return (uint8_t *) a + ARENA_HDR + idx * a->desc->block_size;
 }
@@ -2,9 +2,14 @@
 #define THREADS_MALLOC_H
 
 #include <debug.h>
+#include <stdbool.h>
 #include <stddef.h>
 
+/* If true, track live blocks by allocating call site. */
+extern bool malloc_debug;
+
 void malloc_init (void);
+void malloc_print_stats (void);
 void *malloc (size_t) __attribute__ ((malloc));
 void *calloc (size_t, size_t) __attribute__ ((malloc));
 void *realloc (void *, size_t);
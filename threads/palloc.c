@@ -2,13 +2,16 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
+#include "threads/tracepoint.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -23,22 +26,121 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+   Neither half sits idle while the other runs out, though: a
+   pool with too few free pages borrows from the other one, as
+   long as more than the lender's reserve of POOL_RESERVE of its
+   pages stays free for the lender's own class.  Pages that user
+   processes have borrowed from the kernel pool are given back
+   through the reclaim hook set with palloc_set_reclaim(), which
+   the VM system uses to evict them, whenever the kernel pool's
+   free pages fall to its reserve.  The user pages of both pools
+   together stay within the -ul limit.
+
+   Kernel caches that can give memory back register a shrinker
+   with palloc_register_shrinker().  When an allocation finds no
+   pages in either pool, it runs passes of increasing pressure over
+   every shrinker, asking each to free a growing share of its
+   coldest objects, and tries again after each pass that freed
+   anything.  The frame table also runs a light pass whenever it
+   has to evict user pages, so that caches shrink along with user
+   memory under steady pressure.
+
+   The idle thread zeroes free user pages in the background, via
+   palloc_prezero(), so that a single-page PAL_ZERO allocation
+   usually finds a page that needs no memset.
+
+   Each pool finds free pages with a next-fit scan of its used_map
+   by default.  With the "-palloc-buddy" kernel command line
+   option, pools use a binary buddy allocator instead, so that
+   multi-page allocations neither scan the whole bitmap nor
+   fragment the pool.  Free pages are kept in aligned blocks of
+   2**ORDER pages on per-order free lists.  An allocation takes a
+   block of the smallest order that is big enough, splitting a
+   bigger one if necessary, and gives back the part past the pages
+   it needs.  A freed block merges with its buddy, the block of
+   the same order that it was split from, as long as the buddy is
+   free too.  used_map is kept up to date either way, for
+   assertions, statistics and palloc_prezero(). */
+
+/* Number of pre-zeroed pages the idle thread keeps ready. */
+#define PREZERO_TARGET 32
+
+/* Fraction of each pool that the other pool may not borrow. */
+#define POOL_RESERVE(PAGE_CNT) ((PAGE_CNT) / 8)
+
+/* Buddy allocator block orders: blocks of 1 to 2**(BUDDY_ORDERS
+   - 1) pages.  Bigger allocations fall back to scanning
+   used_map.  BUDDY_NONE marks a page that does not start a free
+   block. */
+#define BUDDY_ORDERS 11
+#define BUDDY_NONE 0xff
+
+/* Use the buddy allocator?  Set by the kernel command line
+   option "-palloc-buddy" before palloc_init(). */
+bool palloc_buddy;
 
 /* A memory pool. */
 struct pool
   {
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
+    struct bitmap *zero_map;            /* Free pages known to be zero. */
+    size_t zero_cnt;                    /* Number of bits set in zero_map. */
     uint8_t *base;                      /* Base of pool. */
+    size_t next;                        /* Next-fit search start. */
+    size_t reserve;                     /* Free pages not to lend. */
+    struct bitmap *lent_map;            /* Pages lent to the other class. */
+
+    /* Buddy allocator, if BUDDY is true.  Besides the lock, the
+       free lists need interrupts off, because pages are freed
+       without the lock. */
+    bool buddy;                         /* Use the buddy allocator? */
+    struct list free_lists[BUDDY_ORDERS]; /* Free blocks, by order. */
+    struct list_elem *links;            /* Per page: free list element
+                                           of the block it starts. */
+    uint8_t *orders;                    /* Per page: order of the free
+                                           block it starts, or
+                                           BUDDY_NONE. */
+
+    /* Statistics, updated with interrupts off because pages are
+       freed without the lock. */
+    const char *name;                   /* Name, for statistics. */
+    size_t used_cnt;                    /* Pages allocated. */
+    size_t peak_cnt;                    /* Most pages ever allocated. */
+    unsigned long long fail_cnt;        /* Allocations that failed. */
+    size_t lent_cnt;                    /* Bits set in lent_map. */
+    unsigned long long borrow_cnt;      /* Allocations lent out. */
+    unsigned long long reclaimed_cnt;   /* Lent pages given back. */
+    unsigned long long split_cnt;       /* Buddy blocks split. */
+    unsigned long long merge_cnt;       /* Buddy blocks merged. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
+/* Most pages user processes may hold, from either pool. */
+static size_t user_limit;
+
+/* Reclaim hook, or a null pointer. */
+static palloc_reclaim_func *reclaim_func;
+
+/* Registered shrinkers.  Only changed during initialization. */
+static struct list shrinkers = LIST_INITIALIZER (shrinkers);
+static unsigned long long shrink_cnt;   /* Passes that freed something. */
+
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static size_t take_zeroed (struct pool *);
+static void forget_zeroed (struct pool *, size_t page_idx, size_t page_cnt);
+static void count_pages (struct pool *, long delta);
+static size_t free_cnt (const struct pool *);
+static void print_pool_stats (struct pool *);
+static void free_in_pool (struct pool *, void *pages, size_t page_cnt);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static void buddy_free (struct pool *, size_t page_idx, size_t page_cnt);
+static void buddy_take (struct pool *, size_t page_idx);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -54,6 +156,7 @@ palloc_init (size_t user_page_limit)
   if (user_pages > user_page_limit)
     user_pages = user_page_limit;
   kernel_pages = free_pages - user_pages;
+  user_limit = user_page_limit;
 
   /* Give half of memory to kernel, half to user. */
   init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
@@ -61,34 +164,155 @@ palloc_init (size_t user_page_limit)
              user_pages, "user pool");
 }
 
+/* Takes PAGE_CNT contiguous free pages from POOL, provided that
+   more than KEEP pages of it stay free, and returns them, or a
+   null pointer if there are not enough.  LENT is true if the
+   pages are for the class that POOL does not belong to.  Sets
+   *ZEROED to true if the pages are known to be zero already. */
+static void *
+take_pages (struct pool *pool, enum palloc_flags flags, size_t page_cnt,
+            size_t keep, bool lent, bool *zeroed)
+{
+  size_t page_idx;
+
+  lock_acquire (&pool->lock);
+  if (free_cnt (pool) < page_cnt + keep)
+    page_idx = BITMAP_ERROR;
+  else if ((flags & PAL_ZERO) && page_cnt == 1 && pool->zero_cnt > 0)
+    {
+      /* Take a page the idle thread has already zeroed. */
+      page_idx = take_zeroed (pool);
+      *zeroed = true;
+    }
+  else if (pool->buddy)
+    {
+      enum intr_level old_level = intr_disable ();
+
+      page_idx = buddy_alloc (pool, page_cnt);
+      if (page_idx == BITMAP_ERROR)
+        {
+          /* Too big for any block: take the pages one at a time. */
+          size_t i;
+
+          page_idx = bitmap_scan (pool->used_map, 0, page_cnt, false);
+          for (i = 0; page_idx != BITMAP_ERROR && i < page_cnt; i++)
+            buddy_take (pool, page_idx + i);
+        }
+      if (page_idx != BITMAP_ERROR)
+        {
+          bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+          forget_zeroed (pool, page_idx, page_cnt);
+        }
+      intr_set_level (old_level);
+    }
+  else
+    {
+      /* Search next-fit from where the last allocation ended, then
+         wrap around to the start of the pool. */
+      page_idx = bitmap_scan_and_flip (pool->used_map, pool->next,
+                                       page_cnt, false);
+      if (page_idx == BITMAP_ERROR && pool->next != 0)
+        page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+      if (page_idx != BITMAP_ERROR)
+        {
+          pool->next = (page_idx + page_cnt) % bitmap_size (pool->used_map);
+          forget_zeroed (pool, page_idx, page_cnt);
+        }
+    }
+  if (page_idx != BITMAP_ERROR && lent)
+    {
+      enum intr_level old_level = intr_disable ();
+      bitmap_set_multiple (pool->lent_map, page_idx, page_cnt, true);
+      pool->lent_cnt += page_cnt;
+      pool->borrow_cnt++;
+      intr_set_level (old_level);
+    }
+  lock_release (&pool->lock);
+
+  if (page_idx == BITMAP_ERROR)
+    return NULL;
+  count_pages (pool, page_cnt);
+  return pool->base + PGSIZE * page_idx;
+}
+
+/* Returns the number of pages that user processes hold, whichever
+   pool they came from. */
+static size_t
+user_pages_used (void)
+{
+  return user_pool.used_cnt - user_pool.lent_cnt + kernel_pool.lent_cnt;
+}
+
+/* Asks the reclaim hook, if there is one, to give back the user
+   pages borrowed from the kernel pool until more than the kernel
+   pool's reserve plus WANT pages are free there. */
+static void
+reclaim (size_t want)
+{
+  size_t target = kernel_pool.reserve + want;
+  size_t avail = free_cnt (&kernel_pool);
+
+  if (reclaim_func != NULL && kernel_pool.lent_cnt > 0 && avail <= target)
+    kernel_pool.reclaimed_cnt += reclaim_func (target - avail + 1);
+}
+
+/* Obtains PAGE_CNT contiguous free pages for the class that FLAGS
+   asks for, from its own pool or else borrowed from the other,
+   and returns them, or a null pointer if there are not enough.
+   Sets *ZEROED to true if the pages are known to be zero. */
+static void *
+get_pages (enum palloc_flags flags, size_t page_cnt, bool *zeroed)
+{
+  bool user = (flags & PAL_USER) != 0;
+  struct pool *own = user ? &user_pool : &kernel_pool;
+  struct pool *other = user ? &kernel_pool : &user_pool;
+  void *pages;
+
+  pages = take_pages (own, flags, page_cnt, 0, false, zeroed);
+  if (pages == NULL && !user)
+    {
+      /* Kernel memory comes before pages lent to user processes. */
+      reclaim (page_cnt);
+      pages = take_pages (own, flags, page_cnt, 0, false, zeroed);
+    }
+  if (pages == NULL && (!user || user_pages_used () + page_cnt <= user_limit))
+    pages = take_pages (other, flags, page_cnt, other->reserve, true,
+                        zeroed);
+  if (pages != NULL && !user)
+    reclaim (0);
+  return pages;
+}
+
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
    If PAL_USER is set, the pages are obtained from the user pool,
-   otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
-   then the pages are filled with zeros.  If too few pages are
-   available, returns a null pointer, unless PAL_ASSERT is set in
-   FLAGS, in which case the kernel panics. */
+   otherwise from the kernel pool.  If that pool has too few free
+   pages, they are borrowed from the other pool, as long as more
+   than the other pool's reserve stays free, and if that fails
+   too, the shrinkers are asked to give memory back.  If PAL_ZERO
+   is set in FLAGS, then the pages are filled with zeros.  If too
+   few pages are available, returns a null pointer, unless
+   PAL_ASSERT is set in FLAGS, in which case the kernel panics. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
-  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
   void *pages;
-  size_t page_idx;
+  bool zeroed = false;
+  unsigned priority;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
-
-  if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
-  else
-    pages = NULL;
+  pages = get_pages (flags, page_cnt, &zeroed);
+  for (priority = SHRINK_PRIORITY + 1; pages == NULL && priority-- > 0; )
+    if (palloc_shrink (priority) > 0)
+      pages = get_pages (flags, page_cnt, &zeroed);
+  if (pages == NULL)
+    count_pages (flags & PAL_USER ? &user_pool : &kernel_pool, 0);
+  TRACEPOINT (TP_PALLOC_GET, pages, page_cnt, flags);
 
   if (pages != NULL) 
     {
-      if (flags & PAL_ZERO)
+      if ((flags & PAL_ZERO) && !zeroed)
         memset (pages, 0, PGSIZE * page_cnt);
     }
   else 
@@ -113,16 +337,152 @@ palloc_get_page (enum palloc_flags flags)
   return palloc_get_multiple (flags, 1);
 }
 
-/* Frees the PAGE_CNT pages starting at PAGES. */
+/* Zeroes one free user page in the background, if fewer than
+   PREZERO_TARGET are zeroed already.  Returns true if it did some
+   work, false if there is nothing to do for now.  Never blocks, so
+   that the idle thread may call it. */
+bool
+palloc_prezero (void)
+{
+  /* Page reserved for zeroing but not yet returned to the pool,
+     because the pool lock was busy. */
+  static size_t pending = BITMAP_ERROR;
+  struct pool *pool = &user_pool;
+
+  if (pending == BITMAP_ERROR)
+    {
+      size_t idx = 0;
+
+      if (pool->zero_cnt >= PREZERO_TARGET || !lock_try_acquire (&pool->lock))
+        return false;
+
+      /* Reserve a free page that is not zeroed yet.  At most
+         PREZERO_TARGET free pages are skipped. */
+      while ((idx = bitmap_scan (pool->used_map, idx, 1, false))
+             != BITMAP_ERROR && bitmap_test (pool->zero_map, idx))
+        idx++;
+      if (idx != BITMAP_ERROR)
+        {
+          enum intr_level old_level = intr_disable ();
+          bitmap_mark (pool->used_map, idx);
+          if (pool->buddy)
+            buddy_take (pool, idx);
+          intr_set_level (old_level);
+        }
+      lock_release (&pool->lock);
+      if (idx == BITMAP_ERROR)
+        return false;
+
+      pending = idx;
+      memset (pool->base + PGSIZE * idx, 0, PGSIZE);
+    }
+
+  /* Return the page to the pool as free and zeroed. */
+  if (!lock_try_acquire (&pool->lock))
+    return true;
+  if (pool->buddy)
+    {
+      enum intr_level old_level = intr_disable ();
+      bitmap_reset (pool->used_map, pending);
+      buddy_free (pool, pending, 1);
+      intr_set_level (old_level);
+    }
+  else
+    bitmap_reset (pool->used_map, pending);
+  bitmap_mark (pool->zero_map, pending);
+  pool->zero_cnt++;
+  pending = BITMAP_ERROR;
+  lock_release (&pool->lock);
+  return true;
+}
+
+/* Sets the reclaim hook to FUNC.  When the kernel pool runs low
+   and user pages have borrowed some of it, the kernel calls FUNC
+   with a number of pages that it would like user processes to
+   give back, and FUNC returns the number that it freed.  FUNC
+   may not block waiting on locks that the caller of
+   palloc_get_page() might hold.  It may use malloc() and free(),
+   though, because malloc() and slab_alloc() do not hold their
+   locks while they allocate pages. */
 void
-palloc_free_multiple (void *pages, size_t page_cnt) 
+palloc_set_reclaim (palloc_reclaim_func *func)
+{
+  reclaim_func = func;
+}
+
+/* Adds shrinker S, whose COUNT and SCAN must be set, to the
+   shrinkers asked to free memory when pages run short.  SCAN may
+   be called from any allocation of memory, so it must not wait
+   for locks that an allocating thread might hold: it should skip
+   whatever it cannot lock with lock_try_acquire().  It may free
+   memory with free() and slab_free(), whose locks are never held
+   across a page allocation.  Must be called during
+   initialization. */
+void
+palloc_register_shrinker (struct shrinker *s)
+{
+  ASSERT (s->count != NULL && s->scan != NULL);
+  s->freed_cnt = 0;
+  list_push_back (&shrinkers, &s->elem);
+}
+
+/* Asks every shrinker to free 1/2**PRIORITY of the objects it
+   could free, rounded up, and returns the number freed in all. */
+size_t
+palloc_shrink (unsigned priority)
+{
+  struct list_elem *e;
+  size_t freed = 0;
+
+  for (e = list_begin (&shrinkers); e != list_end (&shrinkers);
+       e = list_next (e))
+    {
+      struct shrinker *s = list_entry (e, struct shrinker, elem);
+      size_t cnt = s->count ();
+
+      if (cnt > 0)
+        {
+          size_t n = s->scan (DIV_ROUND_UP (cnt, (size_t) 1 << priority));
+          s->freed_cnt += n;
+          freed += n;
+        }
+    }
+  if (freed > 0)
+    shrink_cnt++;
+  return freed;
+}
+
+/* Returns true if PAGE was borrowed from the other pool: a user
+   page from the kernel pool or a kernel page from the user pool. */
+bool
+palloc_is_borrowed (const void *page)
 {
   struct pool *pool;
-  size_t page_idx;
+
+  if (page_from_pool (&kernel_pool, (void *) page))
+    pool = &kernel_pool;
+  else if (page_from_pool (&user_pool, (void *) page))
+    pool = &user_pool;
+  else
+    return false;
+  return bitmap_test (pool->lent_map, pg_no (page) - pg_no (pool->base));
+}
+
+/* Tries to grow the PAGE_CNT pages allocated at PAGES to NEW_CNT
+   pages in place, by taking the pages that follow them.  Returns
+   true if successful, false if any of those pages is in use or
+   lies outside the pool.  The new pages are not zeroed. */
+bool
+palloc_extend (void *pages, size_t page_cnt, size_t new_cnt)
+{
+  struct pool *pool;
+  size_t page_idx, extra;
+  bool lent, ok = false;
 
   ASSERT (pg_ofs (pages) == 0);
-  if (pages == NULL || page_cnt == 0)
-    return;
+  ASSERT (page_cnt > 0 && new_cnt >= page_cnt);
+  if (new_cnt == page_cnt)
+    return true;
 
   if (page_from_pool (&kernel_pool, pages))
     pool = &kernel_pool;
@@ -132,13 +492,108 @@ palloc_free_multiple (void *pages, size_t page_cnt)
     NOT_REACHED ();
 
   page_idx = pg_no (pages) - pg_no (pool->base);
+  extra = new_cnt - page_cnt;
+  ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
+
+  /* Pages lent to the other class stay lent, and the loan may not
+     eat into the pool's reserve. */
+  lock_acquire (&pool->lock);
+  lent = bitmap_test (pool->lent_map, page_idx);
+  if (page_idx + new_cnt <= bitmap_size (pool->used_map)
+      && free_cnt (pool) >= extra + (lent ? pool->reserve : 0)
+      && bitmap_none (pool->used_map, page_idx + page_cnt, extra))
+    {
+      enum intr_level old_level = intr_disable ();
+      size_t i;
+
+      if (pool->buddy)
+        for (i = page_idx + page_cnt; i < page_idx + new_cnt; i++)
+          buddy_take (pool, i);
+      bitmap_set_multiple (pool->used_map, page_idx + page_cnt, extra, true);
+      forget_zeroed (pool, page_idx + page_cnt, extra);
+      if (lent)
+        {
+          bitmap_set_multiple (pool->lent_map, page_idx + page_cnt, extra,
+                               true);
+          pool->lent_cnt += extra;
+        }
+      intr_set_level (old_level);
+      ok = true;
+    }
+  lock_release (&pool->lock);
+
+  if (ok)
+    count_pages (pool, extra);
+  return ok;
+}
+
+/* Frees the PAGE_CNT pages starting at PAGES.  They need not
+   have been allocated together, and they may run from the end of
+   the kernel pool into the user pool. */
+void
+palloc_free_multiple (void *pages, size_t page_cnt) 
+{
+  ASSERT (pg_ofs (pages) == 0);
+  if (pages == NULL || page_cnt == 0)
+    return;
+  TRACEPOINT (TP_PALLOC_FREE, pages, page_cnt, 0);
+
+  while (page_cnt > 0)
+    {
+      struct pool *pool;
+      size_t cnt;
+
+      if (page_from_pool (&kernel_pool, pages))
+        pool = &kernel_pool;
+      else if (page_from_pool (&user_pool, pages))
+        pool = &user_pool;
+      else
+        NOT_REACHED ();
+
+      cnt = pg_no (pool->base) + bitmap_size (pool->used_map) - pg_no (pages);
+      if (cnt > page_cnt)
+        cnt = page_cnt;
+      free_in_pool (pool, pages, cnt);
+      pages = (uint8_t *) pages + cnt * PGSIZE;
+      page_cnt -= cnt;
+    }
+}
+
+/* Frees the PAGE_CNT pages starting at PAGES, all of which are in
+   POOL. */
+static void
+free_in_pool (struct pool *pool, void *pages, size_t page_cnt) 
+{
+  size_t page_idx = pg_no (pages) - pg_no (pool->base);
+  enum intr_level old_level;
 
 #ifndef NDEBUG
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
+  old_level = intr_disable ();
+  if (pool->lent_cnt > 0)
+    {
+      size_t lent = bitmap_count (pool->lent_map, page_idx, page_cnt, true);
+      if (lent > 0)
+        {
+          bitmap_set_multiple (pool->lent_map, page_idx, page_cnt, false);
+          pool->lent_cnt -= lent;
+        }
+    }
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  if (pool->buddy)
+    buddy_free (pool, page_idx, page_cnt);
+  intr_set_level (old_level);
+  count_pages (pool, -(long) page_cnt);
+
+  /* Pull the next-fit cursor back so that the freed pages are
+     found first.  The cursor is only a hint, so this needs no
+     lock, which matters because the scheduler frees pages with
+     interrupts off. */
+  if (page_idx < pool->next)
+    pool->next = page_idx;
 }
 
 /* Frees the page at PAGE. */
@@ -148,25 +603,268 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void)
+{
+  struct list_elem *e;
+
+  print_pool_stats (&kernel_pool);
+  print_pool_stats (&user_pool);
+  printf ("Palloc: %llu shrink passes freed objects\n", shrink_cnt);
+  for (e = list_begin (&shrinkers); e != list_end (&shrinkers);
+       e = list_next (e))
+    {
+      struct shrinker *s = list_entry (e, struct shrinker, elem);
+      printf ("Shrinker: %s: %zu objects, %llu freed\n",
+              s->name, s->count (), s->freed_cnt);
+    }
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
+  /* We'll put the pool's used_map at its base, followed by
+     zero_map, lent_map and, for the buddy allocator, its per-page
+     arrays.
+     Calculate the space needed for them
      and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  size_t used_size = ROUND_UP (bitmap_summary_buf_size (page_cnt),
+                               sizeof (long));
+  size_t bm_size = ROUND_UP (bitmap_buf_size (page_cnt), sizeof (long));
+  size_t buddy_size = (palloc_buddy
+                       ? page_cnt * (sizeof *p->links + sizeof *p->orders)
+                       : 0);
+  size_t bm_pages = DIV_ROUND_UP (used_size + 2 * bm_size + buddy_size,
+                                  PGSIZE);
+  size_t i;
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
 
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
-  /* Initialize the pool. */
+  /* Initialize the pool, with zero_map and lent_map right after
+     used_map. */
   lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
+  lock_set_name (&p->lock, "palloc pool");
+  p->used_map = bitmap_create_summary_in_buf (page_cnt, base, used_size);
+  p->zero_map = bitmap_create_in_buf (page_cnt, (uint8_t *) base + used_size,
+                                      bm_size);
+  p->lent_map = bitmap_create_in_buf (page_cnt,
+                                      (uint8_t *) base + used_size + bm_size,
+                                      bm_size);
+  p->zero_cnt = 0;
   p->base = base + bm_pages * PGSIZE;
+  p->next = 0;
+  p->reserve = POOL_RESERVE (page_cnt);
+  p->name = name;
+  p->used_cnt = p->peak_cnt = 0;
+  p->fail_cnt = 0;
+  p->lent_cnt = 0;
+  p->borrow_cnt = p->reclaimed_cnt = 0;
+  p->split_cnt = p->merge_cnt = 0;
+
+  /* Put every page on the buddy free lists, in the biggest blocks
+     that fit. */
+  p->buddy = palloc_buddy;
+  if (p->buddy)
+    {
+      for (i = 0; i < BUDDY_ORDERS; i++)
+        list_init (&p->free_lists[i]);
+      p->links = (struct list_elem *) ((uint8_t *) base + used_size
+                                         + 2 * bm_size);
+      p->orders = (uint8_t *) (p->links + page_cnt);
+      memset (p->orders, BUDDY_NONE, page_cnt);
+      buddy_free (p, 0, page_cnt);
+      p->merge_cnt = 0;
+    }
+}
+
+/* Adds DELTA to the number of pages allocated from POOL, or counts
+   a failed allocation if DELTA is 0. */
+static void
+count_pages (struct pool *pool, long delta)
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (delta == 0)
+    pool->fail_cnt++;
+  pool->used_cnt += delta;
+  if (pool->used_cnt > pool->peak_cnt)
+    pool->peak_cnt = pool->used_cnt;
+  intr_set_level (old_level);
+}
+
+/* Returns the number of free pages in POOL. */
+static size_t
+free_cnt (const struct pool *pool)
+{
+  return bitmap_size (pool->used_map) - pool->used_cnt;
+}
+
+/* Prints statistics for POOL. */
+static void
+print_pool_stats (struct pool *pool)
+{
+  printf ("Palloc: %s: %zu of %zu pages in use (peak %zu), %zu free "
+          "pages zeroed, %llu failed allocations\n",
+          pool->name, pool->used_cnt, bitmap_size (pool->used_map),
+          pool->peak_cnt, pool->zero_cnt, pool->fail_cnt);
+  printf ("Palloc: %s: %zu pages lent to the other pool, %llu loans, "
+          "%llu pages reclaimed\n", pool->name, pool->lent_cnt,
+          pool->borrow_cnt, pool->reclaimed_cnt);
+  if (pool->buddy)
+    {
+      size_t i;
+
+      printf ("Palloc: %s: buddy allocator, %llu splits, %llu merges, "
+              "free blocks by order:", pool->name, pool->split_cnt,
+              pool->merge_cnt);
+      for (i = 0; i < BUDDY_ORDERS; i++)
+        printf (" %zu", list_size (&pool->free_lists[i]));
+      printf ("\n");
+    }
+}
+
+/* Allocates a free, already zeroed page from POOL, which must have
+   one, and returns its index.  The caller must hold POOL's lock. */
+static size_t
+take_zeroed (struct pool *pool)
+{
+  size_t page_idx = bitmap_scan_and_flip (pool->zero_map, 0, 1, true);
+
+  ASSERT (page_idx != BITMAP_ERROR);
+  ASSERT (!bitmap_test (pool->used_map, page_idx));
+  if (pool->buddy)
+    {
+      enum intr_level old_level = intr_disable ();
+      bitmap_mark (pool->used_map, page_idx);
+      buddy_take (pool, page_idx);
+      intr_set_level (old_level);
+    }
+  else
+    bitmap_mark (pool->used_map, page_idx);
+  pool->zero_cnt--;
+  return page_idx;
+}
+
+/* Clears the zeroed marks of the PAGE_CNT pages starting at
+   PAGE_IDX, which have just been allocated from POOL.  The caller
+   must hold POOL's lock. */
+static void
+forget_zeroed (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  size_t cnt;
+
+  if (pool->zero_cnt == 0)
+    return;
+  cnt = bitmap_count (pool->zero_map, page_idx, page_cnt, true);
+  if (cnt > 0)
+    {
+      bitmap_set_multiple (pool->zero_map, page_idx, page_cnt, false);
+      pool->zero_cnt -= cnt;
+    }
+}
+
+/* Puts the free block of 2**ORDER pages at PAGE_IDX on POOL's
+   free lists, first merging it with its buddy for as long as the
+   buddy is free.  Interrupts must be off. */
+static void
+buddy_release (struct pool *pool, size_t page_idx, unsigned order)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (order + 1 < BUDDY_ORDERS)
+    {
+      size_t buddy = page_idx ^ ((size_t) 1 << order);
+
+      if (buddy >= bitmap_size (pool->used_map)
+          || pool->orders[buddy] != order)
+        break;
+      list_remove (&pool->links[buddy]);
+      pool->orders[buddy] = BUDDY_NONE;
+      page_idx &= ~((size_t) 1 << order);
+      order++;
+      pool->merge_cnt++;
+    }
+  pool->orders[page_idx] = order;
+  list_push_front (&pool->free_lists[order], &pool->links[page_idx]);
+}
+
+/* Gives the PAGE_CNT pages starting at PAGE_IDX back to POOL's
+   free lists, as the biggest aligned blocks that they divide
+   into.  Interrupts must be off. */
+static void
+buddy_free (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  while (page_cnt > 0)
+    {
+      unsigned order = 0;
+
+      while (order + 1 < BUDDY_ORDERS
+             && page_idx % ((size_t) 2 << order) == 0
+             && ((size_t) 2 << order) <= page_cnt)
+        order++;
+      buddy_release (pool, page_idx, order);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
+
+/* Takes PAGE_CNT consecutive pages off POOL's free lists and
+   returns the index of the first, or BITMAP_ERROR if no free block
+   is big enough.  Interrupts must be off. */
+static size_t
+buddy_alloc (struct pool *pool, size_t page_cnt)
+{
+  unsigned want = 0, order;
+  size_t page_idx;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (want < BUDDY_ORDERS && ((size_t) 1 << want) < page_cnt)
+    want++;
+  for (order = want; order < BUDDY_ORDERS; order++)
+    if (!list_empty (&pool->free_lists[order]))
+      break;
+  if (order >= BUDDY_ORDERS)
+    return BITMAP_ERROR;
+
+  page_idx = list_front (&pool->free_lists[order]) - pool->links;
+  list_remove (&pool->links[page_idx]);
+  pool->orders[page_idx] = BUDDY_NONE;
+  pool->split_cnt += order - want;
+  buddy_free (pool, page_idx + page_cnt, ((size_t) 1 << order) - page_cnt);
+  return page_idx;
+}
+
+/* Takes free page PAGE_IDX off POOL's free lists, giving back the
+   rest of the block that held it.  Interrupts must be off. */
+static void
+buddy_take (struct pool *pool, size_t page_idx)
+{
+  size_t first, cnt;
+  unsigned order;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (order = 0; ; order++)
+    {
+      ASSERT (order < BUDDY_ORDERS);
+      first = page_idx & ~(((size_t) 1 << order) - 1);
+      if (pool->orders[first] == order)
+        break;
+    }
+  cnt = (size_t) 1 << order;
+  list_remove (&pool->links[first]);
+  pool->orders[first] = BUDDY_NONE;
+  if (order > 0)
+    pool->split_cnt++;
+  buddy_free (pool, first, page_idx - first);
+  buddy_free (pool, page_idx + 1, first + cnt - page_idx - 1);
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -1,6 +1,8 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <list.h>
+#include <stdbool.h>
 #include <stddef.h>
 
 /* How to allocate pages. */
@@ -11,10 +13,40 @@ enum palloc_flags
     PAL_USER = 004              /* User page. */
   };
 
+extern bool palloc_buddy;
+
+/* Frees up to the given number of borrowed user pages and returns
+   how many it freed.  See palloc_set_reclaim(). */
+typedef size_t palloc_reclaim_func (size_t page_cnt);
+
+/* A kernel cache that gives memory back when pages run short.
+   See palloc_register_shrinker(). */
+struct shrinker
+  {
+    const char *name;                   /* Name, for statistics. */
+    size_t (*count) (void);             /* Objects that could be freed. */
+    size_t (*scan) (size_t cnt);        /* Frees up to CNT coldest objects,
+                                           returns number freed. */
+    unsigned long long freed_cnt;       /* Objects freed so far. */
+    struct list_elem elem;              /* Element in shrinkers. */
+  };
+
+/* Shrinking pressure: a pass at priority P asks each shrinker to
+   free 1/2**P of its objects.  Passes run from SHRINK_PRIORITY
+   down to 0, which asks for everything. */
+#define SHRINK_PRIORITY 4
+
 void palloc_init (size_t user_page_limit);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+bool palloc_extend (void *, size_t page_cnt, size_t new_cnt);
+void palloc_set_reclaim (palloc_reclaim_func *);
+bool palloc_is_borrowed (const void *);
+void palloc_register_shrinker (struct shrinker *);
+size_t palloc_shrink (unsigned priority);
+bool palloc_prezero (void);
+void palloc_print_stats (void);
 
 #endif /* threads/palloc.h */
@@ -0,0 +1,58 @@
+#include "threads/poll.h"
+#include <debug.h>
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+
+/* Wait queues for poll().
+
+   A thread that wants to know when any of several objects changes
+   state adds a poll_waiter for each to the object's poll_queue,
+   all pointing to one semaphore of its own, then checks the
+   objects and downs the semaphore if none is ready.  Whenever an
+   object changes state, it calls poll_wake(), which ups the
+   semaphore of every waiter on its queue.  Because the waiters
+   are added before the objects are checked, a change that comes
+   between the check and the down is not missed. */
+
+/* Initializes Q as empty. */
+void
+poll_queue_init (struct poll_queue *q)
+{
+  list_init (&q->waiters);
+}
+
+/* Adds W to Q, so that poll_wake(Q) ups SEMA until W is removed. */
+void
+poll_queue_add (struct poll_queue *q, struct poll_waiter *w,
+                struct semaphore *sema)
+{
+  enum intr_level old_level = intr_disable ();
+
+  w->sema = sema;
+  list_push_back (&q->waiters, &w->elem);
+  intr_set_level (old_level);
+}
+
+/* Removes W from the queue that it was added to. */
+void
+poll_queue_remove (struct poll_waiter *w)
+{
+  enum intr_level old_level = intr_disable ();
+
+  list_remove (&w->elem);
+  intr_set_level (old_level);
+}
+
+/* Wakes every waiter on Q.  May be called from an interrupt
+   handler. */
+void
+poll_wake (struct poll_queue *q)
+{
+  enum intr_level old_level = intr_disable ();
+  struct list_elem *e;
+
+  for (e = list_begin (&q->waiters); e != list_end (&q->waiters);
+       e = list_next (e))
+    sema_try_up (list_entry (e, struct poll_waiter, elem)->sema);
+  intr_set_level (old_level);
+}
@@ -0,0 +1,29 @@
+#ifndef THREADS_POLL_H
+#define THREADS_POLL_H
+
+#include <list.h>
+
+struct semaphore;
+
+/* Threads waiting for an object, such as a pipe or the console
+   input buffer, to change state.  Protected by disabling
+   interrupts, so that interrupt handlers may wake it. */
+struct poll_queue
+  {
+    struct list waiters;        /* List of struct poll_waiter. */
+  };
+
+/* One thread's registration on a poll_queue. */
+struct poll_waiter
+  {
+    struct semaphore *sema;     /* Upped by poll_wake(). */
+    struct list_elem elem;      /* Element in poll_queue `waiters'. */
+  };
+
+void poll_queue_init (struct poll_queue *);
+void poll_queue_add (struct poll_queue *, struct poll_waiter *,
+                     struct semaphore *);
+void poll_queue_remove (struct poll_waiter *);
+void poll_wake (struct poll_queue *);
+
+#endif /* threads/poll.h */
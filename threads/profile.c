@@ -0,0 +1,113 @@
+#include "threads/profile.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/loader.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* A sampling CPU profiler.
+
+   With the -profile kernel option, every timer interrupt records
+   the instruction that it interrupted, the caller of the
+   function that was running, if it was running in the kernel,
+   and the running thread, into a ring of the most recent
+   PROFILE_CNT samples.  profile_dump() prints the ring at
+   shutdown, one sample per line, each starting with "profile:".
+   "backtrace --profile" reads such a log and prints a flat
+   profile by function and a profile by call site.
+
+   Samples are only taken on timer ticks, so with -tickless the
+   idle thread is undersampled, and code that runs with
+   interrupts off is charged to whatever runs after it turns them
+   back on. */
+
+/* Number of samples kept, a power of 2 given the size of struct
+   sample. */
+#define PROFILE_PAGES 16
+#define PROFILE_CNT (PROFILE_PAGES * PGSIZE / sizeof (struct sample))
+
+bool profile_enabled;
+
+/* One sample. */
+struct sample
+  {
+    uint32_t eip;               /* Instruction interrupted. */
+    uint32_t caller;            /* Its function's return address, or 0. */
+    int tid;                    /* Thread running. */
+    bool user;                  /* Interrupted a user program? */
+  };
+
+static struct sample *samples;  /* Ring, indexed by sample_cnt. */
+static unsigned sample_cnt;     /* Samples ever taken. */
+
+/* Allocates the sample ring, if profiling is enabled. */
+void
+profile_init (void)
+{
+  if (!profile_enabled)
+    return;
+  samples = palloc_get_multiple (PAL_ZERO, PROFILE_PAGES);
+  if (samples == NULL)
+    {
+      printf ("profile: no memory for samples; profiling disabled\n");
+      profile_enabled = false;
+    }
+}
+
+/* Records a sample of where interrupt frame F interrupted.
+   Called from the timer interrupt handler. */
+void
+profile_sample (const struct intr_frame *f)
+{
+  struct thread *t = thread_current ();
+  struct sample *s;
+
+  ASSERT (intr_context ());
+
+  if (samples == NULL)
+    return;
+  s = &samples[sample_cnt++ % PROFILE_CNT];
+  s->eip = (uint32_t) f->eip;
+  s->tid = t->tid;
+  s->user = f->cs != SEL_KCSEG;
+  s->caller = 0;
+
+  /* In the kernel, the interrupted function's frame pointer leads
+     to its return address.  Follow it only if it points into the
+     running thread's stack page, so that a function interrupted
+     before it set up its frame cannot make us fault.  User
+     memory is never read here. */
+  if (!s->user)
+    {
+      uint32_t *ebp = (uint32_t *) f->ebp;
+
+      if (pg_round_down (ebp) == pg_round_down (t)
+          && (uint8_t *) (ebp + 2) <= (uint8_t *) pg_round_down (t) + PGSIZE)
+        s->caller = ebp[1];
+    }
+}
+
+/* Prints the samples in the ring, oldest first, one per line as
+   "profile: TID MODE EIP CALLER", where MODE is "k" for kernel or
+   "u" for user.  The ring is not copied first, so samples taken
+   while printing may overwrite the oldest ones. */
+void
+profile_dump (void)
+{
+  unsigned i, first, end = sample_cnt;
+
+  if (samples == NULL)
+    return;
+  first = end > PROFILE_CNT ? end - PROFILE_CNT : 0;
+  printf ("profile: %u samples, %u kept\n", end, end - first);
+  for (i = first; i != end; i++)
+    {
+      struct sample *s = &samples[i % PROFILE_CNT];
+      printf ("profile: %d %c %#010"PRIx32" %#010"PRIx32"\n",
+              s->tid, s->user ? 'u' : 'k', s->eip, s->caller);
+    }
+}
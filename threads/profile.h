@@ -0,0 +1,16 @@
+#ifndef THREADS_PROFILE_H
+#define THREADS_PROFILE_H
+
+#include <stdbool.h>
+
+struct intr_frame;
+
+/* Sample where the CPU is on every timer tick?  Set by the
+   kernel command line option "-profile". */
+extern bool profile_enabled;
+
+void profile_init (void);
+void profile_sample (const struct intr_frame *);
+void profile_dump (void);
+
+#endif /* threads/profile.h */
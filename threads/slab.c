@@ -0,0 +1,272 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* An object cache.
+
+   Each cache hands out objects of one exact size, carved out of
+   pages obtained from the page allocator.  Unlike malloc(), which
+   rounds a request up to a power of 2, a cache wastes at most the
+   space left over at the end of each page, and finding a free
+   object never involves more than the cache's own lock.
+
+   A page of a cache, called a "slab", begins with a struct slab.
+   It is followed by an array of free-list links, one per object,
+   and then the objects themselves.  Keeping the links outside the
+   objects means that a free object keeps whatever state it was
+   freed in: if the cache has a constructor, it is called once per
+   object when its slab is created, and users return objects to
+   the cache in their constructed state.
+
+   Slabs with free objects are kept on the cache's partial list.
+   A full slab is on no list; it is found again from any of its
+   objects by rounding the object's address down to a page.  One
+   completely free slab is kept to absorb alternating allocations
+   and frees; others are given back to the page allocator.  When
+   pages run short, the page allocator's shrinker gives back the
+   kept ones too. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* End of a slab's free list. */
+#define SLAB_NONE UINT16_MAX
+
+/* A slab. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct slab_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in cache's partial list. */
+    size_t free_cnt;            /* Number of free objects. */
+    uint16_t free;              /* Index of first free object. */
+    uint16_t next[];            /* Index of next free object, by index. */
+  };
+
+/* All caches, for slab_print_stats(). */
+static struct list caches = LIST_INITIALIZER (caches);
+
+static struct slab *new_slab (struct slab_cache *);
+static size_t shrink_count (void);
+static size_t shrink_scan (size_t cnt);
+
+/* Gives completely free slabs back to the page allocator. */
+static struct shrinker shrinker =
+  {
+    .name = "slab", .count = shrink_count, .scan = shrink_scan
+  };
+
+/* Initializes CACHE, named NAME, to hand out objects of SIZE
+   bytes.  If CTOR is nonnull, it is called on each object once,
+   before the object is first allocated. */
+void
+slab_cache_init (struct slab_cache *cache, const char *name, size_t size,
+                 void (*ctor) (void *))
+{
+  enum intr_level old_level;
+  size_t n;
+
+  ASSERT (size > 0);
+
+  size = ROUND_UP (size, sizeof (void *));
+  n = (PGSIZE - sizeof (struct slab)) / (size + sizeof (uint16_t));
+  while (ROUND_UP (sizeof (struct slab) + n * sizeof (uint16_t), 8)
+         + n * size > PGSIZE)
+    n--;
+  ASSERT (n > 0 && n < SLAB_NONE);
+
+  cache->name = name;
+  cache->obj_size = size;
+  cache->objs_per_slab = n;
+  cache->obj_ofs = ROUND_UP (sizeof (struct slab) + n * sizeof (uint16_t), 8);
+  cache->ctor = ctor;
+  lock_init (&cache->lock);
+  list_init (&cache->partial);
+  cache->empty_cnt = 0;
+  cache->slab_cnt = 0;
+  cache->live_cnt = 0;
+  cache->peak_cnt = 0;
+  cache->alloc_cnt = 0;
+
+  old_level = intr_disable ();
+  if (list_empty (&caches))
+    palloc_register_shrinker (&shrinker);
+  list_push_back (&caches, &cache->elem);
+  intr_set_level (old_level);
+}
+
+/* Obtains and returns an object from CACHE.  Returns a null
+   pointer if memory is not available. */
+void *
+slab_alloc (struct slab_cache *cache)
+{
+  struct slab *s;
+  void *obj;
+
+  lock_acquire (&cache->lock);
+  if (list_empty (&cache->partial))
+    {
+      s = new_slab (cache);
+      if (s == NULL)
+        {
+          lock_release (&cache->lock);
+          return NULL;
+        }
+    }
+  else
+    s = list_entry (list_front (&cache->partial), struct slab, elem);
+
+  if (s->free_cnt == cache->objs_per_slab)
+    cache->empty_cnt--;
+  obj = (uint8_t *) s + cache->obj_ofs + s->free * cache->obj_size;
+  s->free = s->next[s->free];
+  if (--s->free_cnt == 0)
+    list_remove (&s->elem);
+
+  cache->alloc_cnt++;
+  if (++cache->live_cnt > cache->peak_cnt)
+    cache->peak_cnt = cache->live_cnt;
+  lock_release (&cache->lock);
+  return obj;
+}
+
+/* Returns OBJ, which must have been obtained from CACHE, to
+   CACHE.  If OBJ is a null pointer, does nothing. */
+void
+slab_free (struct slab_cache *cache, void *obj)
+{
+  struct slab *s;
+  size_t idx;
+
+  if (obj == NULL)
+    return;
+
+  s = pg_round_down (obj);
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == cache);
+  idx = ((uint8_t *) obj - (uint8_t *) s - cache->obj_ofs) / cache->obj_size;
+  ASSERT ((uint8_t *) s + cache->obj_ofs + idx * cache->obj_size
+          == (uint8_t *) obj);
+
+  lock_acquire (&cache->lock);
+  s->next[idx] = s->free;
+  s->free = idx;
+  if (s->free_cnt++ == 0)
+    list_push_front (&cache->partial, &s->elem);
+  cache->live_cnt--;
+
+  if (s->free_cnt == cache->objs_per_slab && ++cache->empty_cnt > 1)
+    {
+      list_remove (&s->elem);
+      cache->empty_cnt--;
+      cache->slab_cnt--;
+      s->magic = 0;
+      palloc_free_page (s);
+    }
+  lock_release (&cache->lock);
+}
+
+/* Returns the number of completely free slabs in all caches. */
+static size_t
+shrink_count (void)
+{
+  struct list_elem *e;
+  size_t cnt = 0;
+
+  for (e = list_begin (&caches); e != list_end (&caches); e = list_next (e))
+    cnt += list_entry (e, struct slab_cache, elem)->empty_cnt;
+  return cnt;
+}
+
+/* Gives up to CNT completely free slabs back to the page
+   allocator, skipping caches whose locks are busy, and returns
+   the number given back. */
+static size_t
+shrink_scan (size_t cnt)
+{
+  struct list_elem *e;
+  size_t freed = 0;
+
+  for (e = list_begin (&caches); e != list_end (&caches) && freed < cnt;
+       e = list_next (e))
+    {
+      struct slab_cache *c = list_entry (e, struct slab_cache, elem);
+      struct list_elem *p;
+
+      if (c->empty_cnt == 0 || lock_held_by_current_thread (&c->lock)
+          || !lock_try_acquire (&c->lock))
+        continue;
+      for (p = list_begin (&c->partial);
+           p != list_end (&c->partial) && c->empty_cnt > 0 && freed < cnt; )
+        {
+          struct slab *s = list_entry (p, struct slab, elem);
+
+          p = list_next (p);
+          if (s->free_cnt == c->objs_per_slab)
+            {
+              list_remove (&s->elem);
+              c->empty_cnt--;
+              c->slab_cnt--;
+              s->magic = 0;
+              palloc_free_page (s);
+              freed++;
+            }
+        }
+      lock_release (&c->lock);
+    }
+  return freed;
+}
+
+/* Prints statistics for every cache. */
+void
+slab_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&caches); e != list_end (&caches); e = list_next (e))
+    {
+      struct slab_cache *c = list_entry (e, struct slab_cache, elem);
+      printf ("Slab: %s: %zu-byte objects, %zu in use (peak %zu), "
+              "%llu allocations, %zu slabs\n",
+              c->name, c->obj_size, c->live_cnt, c->peak_cnt,
+              c->alloc_cnt, c->slab_cnt);
+    }
+}
+
+/* Creates a slab for CACHE, constructs its objects and adds it to
+   CACHE's partial list.  Returns the new slab, or a null pointer
+   if memory is not available.  CACHE's lock must be held.  It is
+   dropped while the page is allocated, because an allocation that
+   runs short of pages evicts user pages and runs the shrinkers,
+   which may free objects to CACHE. */
+static struct slab *
+new_slab (struct slab_cache *cache)
+{
+  struct slab *s;
+  size_t i;
+
+  lock_release (&cache->lock);
+  s = palloc_get_page (0);
+  lock_acquire (&cache->lock);
+  if (s == NULL)
+    return NULL;
+  s->magic = SLAB_MAGIC;
+  s->cache = cache;
+  s->free_cnt = cache->objs_per_slab;
+  s->free = 0;
+  for (i = 0; i < cache->objs_per_slab; i++)
+    {
+      s->next[i] = i + 1 < cache->objs_per_slab ? i + 1 : SLAB_NONE;
+      if (cache->ctor != NULL)
+        cache->ctor ((uint8_t *) s + cache->obj_ofs + i * cache->obj_size);
+    }
+  list_push_back (&cache->partial, &s->elem);
+  cache->empty_cnt++;
+  cache->slab_cnt++;
+  return s;
+}
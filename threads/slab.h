@@ -0,0 +1,34 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <list.h>
+#include <stddef.h>
+#include "threads/synch.h"
+
+/* A cache of objects of a single type, allocated from pages
+   ("slabs") that hold as many objects of exactly that size as
+   fit.  See slab.c for details. */
+struct slab_cache
+  {
+    const char *name;           /* Name, for statistics. */
+    size_t obj_size;            /* Size of each object in bytes. */
+    size_t objs_per_slab;       /* Number of objects in a slab. */
+    size_t obj_ofs;             /* Offset of first object in a slab. */
+    void (*ctor) (void *);      /* Constructor, or null. */
+    struct lock lock;           /* Protects all of the below. */
+    struct list partial;        /* Slabs with free objects. */
+    size_t empty_cnt;           /* Slabs with no objects in use. */
+    size_t slab_cnt;            /* Slabs allocated. */
+    size_t live_cnt;            /* Objects in use. */
+    size_t peak_cnt;            /* Most objects ever in use at once. */
+    unsigned long long alloc_cnt; /* Objects ever allocated. */
+    struct list_elem elem;      /* Element in list of all caches. */
+  };
+
+void slab_cache_init (struct slab_cache *, const char *name, size_t size,
+                      void (*ctor) (void *));
+void *slab_alloc (struct slab_cache *);
+void slab_free (struct slab_cache *, void *);
+void slab_print_stats (void);
+
+#endif /* threads/slab.h */
@@ -27,11 +27,58 @@
 */
 
 #include "threads/synch.h"
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
+/* Maximum length of a chain of lock holders that a priority is
+   donated along.  Bounds the work done by lock_acquire() when
+   threads wait on each other in a long chain. */
+#define DONATION_DEPTH 8
+
+/* Profile locks?  With the -lock-profile kernel option, every
+   lock records how often it is acquired, how often it has to
+   wait, and how long it waits and is held, so that the locks
+   worth splitting show up at shutdown.  Statistics are kept per
+   class of locks: all of the locks initialized by one call to
+   lock_init() in the source share a class, like the descriptor
+   locks in malloc.c, and lock_set_name() names a class.  Unnamed
+   classes are reported by the return address of their lock_init()
+   call, which the backtrace utility turns into a function name. */
+bool lock_profile;
+
+/* A class of locks, for -lock-profile.  Times are in CPU
+   cycles. */
+struct lock_class
+  {
+    void *site;                 /* Return address of lock_init(). */
+    const char *name;           /* Name, or a null pointer. */
+    unsigned long long acquire_cnt; /* Acquisitions. */
+    unsigned long long contend_cnt; /* ...that had to wait. */
+    uint64_t wait_total;        /* Time spent waiting. */
+    uint64_t wait_max;          /* Longest wait. */
+    uint64_t hold_total;        /* Time held. */
+    uint64_t hold_max;          /* Longest hold. */
+  };
+
+/* Lock classes, hashed by lock_init() call site and modified
+   only with interrupts off.  Call sites beyond the first
+   LOCK_CLASS_CNT share the last entry. */
+#define LOCK_CLASS_CNT 128
+static struct lock_class lock_classes[LOCK_CLASS_CNT + 1];
+
+static bool thread_priority_more (const struct list_elem *,
+                                  const struct list_elem *, void *);
+static bool waiter_priority_more (const struct list_elem *,
+                                  const struct list_elem *, void *);
+static struct lock_class *find_lock_class (void *site);
+static void profile_acquire (struct lock *, uint64_t start, bool contended);
+static void profile_release (struct lock *);
+
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
    manipulating it:
@@ -40,7 +87,13 @@
      decrement it.
 
    - up or "V": increment the value (and wake up one waiting
-     thread, if any). */
+     thread, if any).
+
+   SEMA's waiters are kept in priority order, highest first and
+   first come, first served within a priority, so that sema_up()
+   wakes the front one without a search.  When a waiting thread's
+   priority changes, through donation for example, the scheduler
+   calls synch_requeue() to move it to its new place. */
 void
 sema_init (struct semaphore *sema, unsigned value) 
 {
@@ -68,7 +121,17 @@ sema_down (struct semaphore *sema)
   old_level = intr_disable ();
   while (sema->value == 0) 
     {
-      list_push_back (&sema->waiters, &thread_current ()->elem);
+      struct thread *cur = thread_current ();
+
+      /* A thread in cond_wait() is requeued in the condition's
+         waiters instead, since it is the only waiter here. */
+      if (cur->wait_list == NULL)
+        {
+          cur->wait_list = &sema->waiters;
+          cur->wait_elem = &cur->elem;
+        }
+      list_insert_ordered (&sema->waiters, &cur->elem,
+                           thread_priority_more, NULL);
       thread_block ();
     }
   sema->value--;
@@ -102,7 +165,9 @@ sema_try_down (struct semaphore *sema)
 }
 
 /* Up or "V" operation on a semaphore.  Increments SEMA's value
-   and wakes up one thread of those waiting for SEMA, if any.
+   and wakes up the highest-priority thread of those waiting for
+   SEMA, if any, preempting the caller if that thread's priority
+   is higher.
 
    This function may be called from an interrupt handler. */
 void
@@ -114,10 +179,16 @@ sema_up (struct semaphore *sema)
 
   old_level = intr_disable ();
   if (!list_empty (&sema->waiters)) 
-    thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
+    {
+      struct thread *t = list_entry (list_pop_front (&sema->waiters),
+                                     struct thread, elem);
+      if (t->wait_list == &sema->waiters)
+        t->wait_list = NULL;
+      thread_unblock (t);
+    }
   sema->value++;
   intr_set_level (old_level);
+  thread_preempt ();
 }
 
 void
@@ -194,12 +265,30 @@ lock_init (struct lock *lock)
 
   lock->holder = NULL;
   sema_init (&lock->semaphore, 1);
+  lock->class = (lock_profile
+                 ? find_lock_class (__builtin_return_address (0)) : NULL);
+  lock->acquire_tsc = 0;
+}
+
+/* Names LOCK's class NAME in -lock-profile statistics.  NAME
+   must stay valid until shutdown. */
+void
+lock_set_name (struct lock *lock, const char *name)
+{
+  ASSERT (lock != NULL);
+
+  if (lock->class != NULL)
+    lock->class->name = name;
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
    necessary.  The lock must not already be held by the current
    thread.
 
+   While waiting, the current thread donates its priority to the
+   lock's holder, and onward along the chain of holders that are
+   themselves waiting for a lock, up to DONATION_DEPTH threads.
+
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but interrupts will be turned back on if
@@ -207,12 +296,39 @@ lock_init (struct lock *lock)
 void
 lock_acquire (struct lock *lock)
 {
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  uint64_t start;
+  bool contended;
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
+  start = lock->class != NULL ? timer_tsc () : 0;
+  old_level = intr_disable ();
+  contended = lock->holder != NULL;
+  if (lock->holder != NULL && !thread_mlfqs)
+    {
+      struct lock *l = lock;
+      int depth;
+
+      cur->waiting_lock = lock;
+      for (depth = 0; depth < DONATION_DEPTH && l != NULL
+             && l->holder != NULL; depth++)
+        {
+          thread_donate_priority (l->holder, cur->priority);
+          l = l->holder->waiting_lock;
+        }
+    }
   sema_down (&lock->semaphore);
-  lock->holder = thread_current ();
+  cur->waiting_lock = NULL;
+  lock->holder = cur;
+  list_push_back (&cur->locks, &lock->elem);
+  thread_update_priority (cur);
+  if (lock->class != NULL)
+    profile_acquire (lock, start, contended);
+  intr_set_level (old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -224,18 +340,27 @@ lock_acquire (struct lock *lock)
 bool
 lock_try_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
   bool success;
 
   ASSERT (lock != NULL);
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    {
+      lock->holder = thread_current ();
+      list_push_back (&lock->holder->locks, &lock->elem);
+      if (lock->class != NULL)
+        profile_acquire (lock, timer_tsc (), false);
+    }
+  intr_set_level (old_level);
   return success;
 }
 
 /* Releases LOCK, which must be owned by the current thread.
+   Gives up any priority donated by threads waiting for LOCK.
 
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to release a lock within an interrupt
@@ -243,11 +368,20 @@ lock_try_acquire (struct lock *lock)
 void
 lock_release (struct lock *lock) 
 {
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
+  if (lock->class != NULL)
+    profile_release (lock);
+  list_remove (&lock->elem);
   lock->holder = NULL;
+  thread_update_priority (thread_current ());
   sema_up (&lock->semaphore);
+  intr_set_level (old_level);
+  thread_preempt ();
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -261,11 +395,130 @@ lock_held_by_current_thread (const struct lock *lock)
   return lock->holder == thread_current ();
 }
 
+/* Returns the -lock-profile class for locks initialized by the
+   lock_init() call that returns to SITE, creating it if
+   needed. */
+static struct lock_class *
+find_lock_class (void *site)
+{
+  enum intr_level old_level = intr_disable ();
+  unsigned idx, start;
+
+  /* Find SITE's entry, or make one, by linear probing. */
+  start = idx = ((uintptr_t) site >> 2) % LOCK_CLASS_CNT;
+  while (lock_classes[idx].site != site && lock_classes[idx].site != NULL)
+    {
+      idx = (idx + 1) % LOCK_CLASS_CNT;
+      if (idx == start)
+        {
+          idx = LOCK_CLASS_CNT;
+          break;
+        }
+    }
+  if (idx < LOCK_CLASS_CNT)
+    lock_classes[idx].site = site;
+  intr_set_level (old_level);
+  return &lock_classes[idx];
+}
+
+/* Records that LOCK was acquired, after waiting since START if
+   CONTENDED.  Interrupts must be off. */
+static void
+profile_acquire (struct lock *lock, uint64_t start, bool contended)
+{
+  struct lock_class *c = lock->class;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  lock->acquire_tsc = timer_tsc ();
+  c->acquire_cnt++;
+  if (contended)
+    {
+      uint64_t wait = lock->acquire_tsc - start;
+
+      c->contend_cnt++;
+      c->wait_total += wait;
+      if (wait > c->wait_max)
+        c->wait_max = wait;
+    }
+}
+
+/* Records that LOCK is being released.  Interrupts must be
+   off. */
+static void
+profile_release (struct lock *lock)
+{
+  struct lock_class *c = lock->class;
+  uint64_t hold = timer_tsc () - lock->acquire_tsc;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  c->hold_total += hold;
+  if (hold > c->hold_max)
+    c->hold_max = hold;
+}
+
+/* Orders lock classes by time spent waiting, most first. */
+static int
+compare_lock_classes (const void *a_, const void *b_)
+{
+  const struct lock_class *a = a_;
+  const struct lock_class *b = b_;
+
+  if (a->wait_total != b->wait_total)
+    return a->wait_total < b->wait_total ? 1 : -1;
+  return 0;
+}
+
+/* With -lock-profile, prints the statistics of every class of
+   locks that has been acquired, those that waited longest first.
+   Times are in microseconds.  The classes are copied with
+   interrupts off and printed afterward, so that printing does not
+   disturb them. */
+void
+lock_print_stats (void)
+{
+  static struct lock_class classes[LOCK_CLASS_CNT + 1];
+  enum intr_level old_level;
+  size_t i, cnt = 0;
+
+  if (!lock_profile)
+    return;
+
+  old_level = intr_disable ();
+  for (i = 0; i <= LOCK_CLASS_CNT; i++)
+    if (lock_classes[i].acquire_cnt > 0)
+      classes[cnt++] = lock_classes[i];
+  intr_set_level (old_level);
+
+  qsort (classes, cnt, sizeof *classes, compare_lock_classes);
+  for (i = 0; i < cnt; i++)
+    {
+      struct lock_class *c = &classes[i];
+
+      printf ("Lock: ");
+      if (c->name != NULL)
+        printf ("%s", c->name);
+      else if (c->site != NULL)
+        printf ("%p", c->site);
+      else
+        printf ("other locks");
+      printf (": %llu acquisitions, %llu contended, "
+              "wait %llu us (max %llu), hold %llu us (max %llu)\n",
+              c->acquire_cnt, c->contend_cnt,
+              timer_tsc_to_ns (c->wait_total) / 1000,
+              timer_tsc_to_ns (c->wait_max) / 1000,
+              timer_tsc_to_ns (c->hold_total) / 1000,
+              timer_tsc_to_ns (c->hold_max) / 1000);
+    }
+}
+
 /* One semaphore in a list. */
 struct semaphore_elem 
   {
     struct list_elem elem;              /* List element. */
     struct semaphore semaphore;         /* This semaphore. */
+    struct thread *thread;              /* Thread waiting on it. */
   };
 
 /* Initializes condition variable COND.  A condition variable
@@ -302,7 +555,9 @@ cond_init (struct condition *cond)
 void
 cond_wait (struct condition *cond, struct lock *lock) 
 {
+  struct thread *cur = thread_current ();
   struct semaphore_elem waiter;
+  enum intr_level old_level;
 
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
@@ -310,14 +565,26 @@ cond_wait (struct condition *cond, struct lock *lock)
   ASSERT (lock_held_by_current_thread (lock));
   
   sema_init (&waiter.semaphore, 0);
-  list_push_back (&cond->waiters, &waiter.elem);
+  waiter.thread = cur;
+
+  /* The waiters are reordered with interrupts off, by threads
+     that need not hold LOCK, so change them only with interrupts
+     off too. */
+  old_level = intr_disable ();
+  list_insert_ordered (&cond->waiters, &waiter.elem,
+                       waiter_priority_more, NULL);
+  cur->wait_list = &cond->waiters;
+  cur->wait_elem = &waiter.elem;
+  intr_set_level (old_level);
+
   lock_release (lock);
   sema_down (&waiter.semaphore);
   lock_acquire (lock);
 }
 
 /* If any threads are waiting on COND (protected by LOCK), then
-   this function signals one of them to wake up from its wait.
+   this function signals the highest-priority one of them to wake
+   up from its wait.
    LOCK must be held before calling this function.
 
    An interrupt handler cannot acquire a lock, so it does not
@@ -326,14 +593,22 @@ cond_wait (struct condition *cond, struct lock *lock)
 void
 cond_signal (struct condition *cond, struct lock *lock UNUSED) 
 {
+  enum intr_level old_level;
+
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   if (!list_empty (&cond->waiters)) 
-    sema_up (&list_entry (list_pop_front (&cond->waiters),
-                          struct semaphore_elem, elem)->semaphore);
+    {
+      struct semaphore_elem *w = list_entry (list_pop_front (&cond->waiters),
+                                             struct semaphore_elem, elem);
+      w->thread->wait_list = NULL;
+      sema_up (&w->semaphore);
+    }
+  intr_set_level (old_level);
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -351,3 +626,441 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes RW as a reader-writer lock.  Any number of readers
+   may hold RW at once, or a single writer, but not both.  Unlike
+   a lock, RW may not be acquired recursively in either mode, and
+   its holders receive no priority donation.
+
+   Writers are preferred: once a writer is waiting, new readers
+   wait behind it, so that a steady stream of readers cannot
+   starve writers.  A reader may upgrade to a writer without
+   letting go, and a writer may downgrade to a reader. */
+void
+rwlock_init (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_init (&rw->lock);
+  cond_init (&rw->readers);
+  cond_init (&rw->writers);
+  cond_init (&rw->upgrader);
+  rw->reader_cnt = 0;
+  rw->writers_waiting = 0;
+  rw->upgrading = false;
+  rw->writer = NULL;
+}
+
+/* Acquires RW for reading, sleeping while a writer holds it or
+   is waiting for it.  This function may sleep, so it must not be
+   called within an interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (rw->writer != thread_current ());
+
+  lock_acquire (&rw->lock);
+  while (rw->writer != NULL || rw->writers_waiting > 0)
+    cond_wait (&rw->readers, &rw->lock);
+  rw->reader_cnt++;
+  lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread holds for reading. */
+void
+rwlock_release_read (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_acquire (&rw->lock);
+  ASSERT (rw->reader_cnt > 0);
+  if (--rw->reader_cnt == 0)
+    {
+      if (rw->upgrading)
+        cond_signal (&rw->upgrader, &rw->lock);
+      else
+        cond_signal (&rw->writers, &rw->lock);
+    }
+  lock_release (&rw->lock);
+}
+
+/* Acquires RW for writing, sleeping until no reader or other
+   writer holds it.  This function may sleep, so it must not be
+   called within an interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!rwlock_held_by_current_thread (rw));
+
+  lock_acquire (&rw->lock);
+  rw->writers_waiting++;
+  while (rw->writer != NULL || rw->reader_cnt > 0 || rw->upgrading)
+    cond_wait (&rw->writers, &rw->lock);
+  rw->writers_waiting--;
+  rw->writer = thread_current ();
+  lock_release (&rw->lock);
+}
+
+/* Lets in the next writer waiting for RW or, if there is none,
+   all of the waiting readers.
+   RW's internal lock must be held. */
+static void
+rwlock_wake (struct rwlock *rw)
+{
+  if (rw->writers_waiting > 0)
+    cond_signal (&rw->writers, &rw->lock);
+  else
+    cond_broadcast (&rw->readers, &rw->lock);
+}
+
+/* Releases RW, which the current thread holds for writing. */
+void
+rwlock_release_write (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+  ASSERT (rwlock_held_by_current_thread (rw));
+
+  lock_acquire (&rw->lock);
+  rw->writer = NULL;
+  rwlock_wake (rw);
+  lock_release (&rw->lock);
+}
+
+/* Converts the current thread's hold on RW from reading to
+   writing, waiting for the other readers to leave.  No other
+   writer gets in between.  Only one reader can be upgrading at a
+   time, since two would wait for each other forever, so this
+   returns false, still holding RW for reading, if another reader
+   is already upgrading; the caller must then release RW and
+   acquire it for writing instead.  Returns true if successful. */
+bool
+rwlock_upgrade (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+
+  lock_acquire (&rw->lock);
+  ASSERT (rw->reader_cnt > 0 && rw->writer == NULL);
+  if (rw->upgrading)
+    {
+      lock_release (&rw->lock);
+      return false;
+    }
+  rw->upgrading = true;
+  rw->reader_cnt--;
+  while (rw->reader_cnt > 0)
+    cond_wait (&rw->upgrader, &rw->lock);
+  rw->upgrading = false;
+  rw->writer = thread_current ();
+  lock_release (&rw->lock);
+  return true;
+}
+
+/* Converts the current thread's hold on RW from writing to
+   reading.  Waiting readers get in too, unless a writer is
+   waiting. */
+void
+rwlock_downgrade (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+  ASSERT (rwlock_held_by_current_thread (rw));
+
+  lock_acquire (&rw->lock);
+  rw->writer = NULL;
+  rw->reader_cnt++;
+  if (rw->writers_waiting == 0)
+    cond_broadcast (&rw->readers, &rw->lock);
+  lock_release (&rw->lock);
+}
+
+/* Returns true if the current thread holds RW for writing, false
+   otherwise.  (There is no way to tell whether a particular
+   thread holds RW for reading.) */
+bool
+rwlock_held_by_current_thread (const struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  return rw->writer == thread_current ();
+}
+
+/* State shared by rwlock_self_test() and its helper threads. */
+struct rwlock_test
+  {
+    struct rwlock rw;                   /* Lock under test. */
+    struct semaphore done;              /* One up per finished helper. */
+    int readers_in;                     /* Readers inside now. */
+    int writers_in;                     /* Writers inside now. */
+    int max_readers;                    /* Most readers inside at once. */
+    int value;                          /* Changed by writers. */
+  };
+
+static void rwlock_test_reader (void *);
+static void rwlock_test_writer (void *);
+
+/* Self-test for reader-writer locks.  Several readers, which
+   yield while holding the lock, run alongside writers, one of
+   which upgrades from reading.  Checks that readers share the
+   lock, that writers exclude everyone, and that every write
+   happened. */
+void
+rwlock_self_test (void)
+{
+  struct rwlock_test t;
+  int i;
+
+  printf ("Testing reader-writer locks...");
+  rwlock_init (&t.rw);
+  sema_init (&t.done, 0);
+  t.readers_in = t.writers_in = t.max_readers = t.value = 0;
+  for (i = 0; i < 4; i++)
+    thread_create ("rw-reader", PRI_DEFAULT, rwlock_test_reader, &t);
+  for (i = 0; i < 2; i++)
+    thread_create ("rw-writer", PRI_DEFAULT, rwlock_test_writer, &t);
+  for (i = 0; i < 6; i++)
+    sema_down (&t.done);
+
+  /* Upgrade and downgrade with no one else around. */
+  rwlock_acquire_read (&t.rw);
+  if (!rwlock_upgrade (&t.rw))
+    PANIC ("rwlock upgrade failed");
+  t.value++;
+  rwlock_downgrade (&t.rw);
+  rwlock_release_read (&t.rw);
+
+  ASSERT (t.value == 2 * 10 + 1);
+  ASSERT (t.max_readers > 1);
+  printf ("done.\n");
+}
+
+/* Reader thread used by rwlock_self_test(). */
+static void
+rwlock_test_reader (void *t_)
+{
+  struct rwlock_test *t = t_;
+  int i;
+
+  for (i = 0; i < 10; i++)
+    {
+      rwlock_acquire_read (&t->rw);
+      t->readers_in++;
+      if (t->readers_in > t->max_readers)
+        t->max_readers = t->readers_in;
+      ASSERT (t->writers_in == 0);
+      thread_yield ();
+      ASSERT (t->writers_in == 0);
+      t->readers_in--;
+      rwlock_release_read (&t->rw);
+      thread_yield ();
+    }
+  sema_up (&t->done);
+}
+
+/* Writer thread used by rwlock_self_test().  Every other write
+   is made by upgrading a read hold. */
+static void
+rwlock_test_writer (void *t_)
+{
+  struct rwlock_test *t = t_;
+  int i;
+
+  for (i = 0; i < 10; i++)
+    {
+      if (i % 2 == 0)
+        rwlock_acquire_write (&t->rw);
+      else
+        {
+          rwlock_acquire_read (&t->rw);
+          if (!rwlock_upgrade (&t->rw))
+            {
+              rwlock_release_read (&t->rw);
+              rwlock_acquire_write (&t->rw);
+            }
+        }
+      t->writers_in++;
+      ASSERT (t->writers_in == 1 && t->readers_in == 0);
+      thread_yield ();
+      t->value++;
+      t->writers_in--;
+      rwlock_release_write (&t->rw);
+      thread_yield ();
+    }
+  sema_up (&t->done);
+}
+
+/* Initializes sequence lock SL. */
+void
+seqlock_init (struct seqlock *sl)
+{
+  ASSERT (sl != NULL);
+
+  sl->seq = 0;
+}
+
+/* Starts a read of the data protected by SL and returns the
+   sequence number to pass to seqlock_read_retry().  Waits for a
+   write in progress on another thread to finish, which can only
+   happen if the writer does not disable interrupts. */
+unsigned
+seqlock_read_begin (const struct seqlock *sl)
+{
+  unsigned seq;
+
+  ASSERT (sl != NULL);
+
+  for (;;)
+    {
+      seq = *(volatile const unsigned *) &sl->seq;
+      barrier ();
+      if (seq % 2 == 0)
+        return seq;
+      if (!intr_context ())
+        thread_yield ();
+    }
+}
+
+/* Returns true if the data protected by SL was written since the
+   seqlock_read_begin() call that returned SEQ, in which case what
+   was read may be inconsistent and the read must be retried. */
+bool
+seqlock_read_retry (const struct seqlock *sl, unsigned seq)
+{
+  ASSERT (sl != NULL);
+
+  barrier ();
+  return *(volatile const unsigned *) &sl->seq != seq;
+}
+
+/* Starts a write of the data protected by SL. */
+void
+seqlock_write_begin (struct seqlock *sl)
+{
+  ASSERT (sl != NULL);
+  ASSERT (sl->seq % 2 == 0);
+
+  sl->seq++;
+  barrier ();
+}
+
+/* Ends a write of the data protected by SL. */
+void
+seqlock_write_end (struct seqlock *sl)
+{
+  ASSERT (sl != NULL);
+  ASSERT (sl->seq % 2 == 1);
+
+  barrier ();
+  sl->seq++;
+}
+
+/* State shared by seqlock_self_test() and its helper thread. */
+struct seqlock_test
+  {
+    struct seqlock sl;                  /* Lock under test. */
+    struct semaphore done;              /* Up when writer finishes. */
+    int64_t a, b;                       /* Always equal when consistent. */
+  };
+
+static void seqlock_test_writer (void *);
+
+/* Self-test for sequence locks.  A writer that yields in the
+   middle of its writes updates a pair of values that should
+   always be equal, while this thread reads them.  Checks that no
+   read that was not retried saw them differ. */
+void
+seqlock_self_test (void)
+{
+  struct seqlock_test t;
+  int64_t a, b;
+  int retry_cnt = 0;
+  int i;
+
+  printf ("Testing sequence locks...");
+  seqlock_init (&t.sl);
+  sema_init (&t.done, 0);
+  t.a = t.b = 0;
+  thread_create ("seq-writer", PRI_DEFAULT, seqlock_test_writer, &t);
+  for (i = 0; i < 100; i++)
+    {
+      unsigned seq;
+
+      do
+        {
+          seq = seqlock_read_begin (&t.sl);
+          a = t.a;
+          thread_yield ();
+          b = t.b;
+          retry_cnt++;
+        }
+      while (seqlock_read_retry (&t.sl, seq));
+      ASSERT (a == b);
+    }
+  sema_down (&t.done);
+  ASSERT (t.a == 100 && t.b == 100);
+  printf ("done (%d reads).\n", retry_cnt);
+}
+
+/* Writer thread used by seqlock_self_test(). */
+static void
+seqlock_test_writer (void *t_)
+{
+  struct seqlock_test *t = t_;
+  int i;
+
+  for (i = 0; i < 100; i++)
+    {
+      seqlock_write_begin (&t->sl);
+      t->a++;
+      thread_yield ();
+      t->b++;
+      seqlock_write_end (&t->sl);
+      thread_yield ();
+    }
+  sema_up (&t->done);
+}
+
+/* Moves T, whose priority has just changed, to its new place in
+   the wait queue it is in, if any.  Interrupts must be off. */
+void
+synch_requeue (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t->wait_list == NULL)
+    return;
+  list_remove (t->wait_elem);
+  list_insert_ordered (t->wait_list, t->wait_elem,
+                       (t->wait_elem == &t->elem
+                        ? thread_priority_more : waiter_priority_more),
+                       NULL);
+}
+
+/* Orders threads in a semaphore's wait list by priority, highest
+   first. */
+static bool
+thread_priority_more (const struct list_elem *a_,
+                      const struct list_elem *b_, void *aux UNUSED)
+{
+  const struct thread *a = list_entry (a_, struct thread, elem);
+  const struct thread *b = list_entry (b_, struct thread, elem);
+
+  return a->priority > b->priority;
+}
+
+/* Orders a condition variable's waiters by the priority of the
+   thread waiting on each, highest first. */
+static bool
+waiter_priority_more (const struct list_elem *a_,
+                      const struct list_elem *b_, void *aux UNUSED)
+{
+  const struct semaphore_elem *a
+    = list_entry (a_, struct semaphore_elem, elem);
+  const struct semaphore_elem *b
+    = list_entry (b_, struct semaphore_elem, elem);
+
+  return a->thread->priority > b->thread->priority;
+}
@@ -3,6 +3,10 @@
 
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+struct thread;
+struct lock_class;
 
 /* A counting semaphore. */
 struct semaphore 
@@ -21,11 +25,19 @@ void sema_self_test (void);
 /* Lock. */
 struct lock 
   {
-    struct thread *holder;      /* Thread holding lock (for debugging). */
+    struct thread *holder;      /* Thread holding lock. */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
+    struct list_elem elem;      /* Element in holder's list of locks. */
+    struct lock_class *class;   /* Profile, with -lock-profile. */
+    uint64_t acquire_tsc;       /* CPU cycle count when acquired. */
   };
 
+/* Profile locks?  Set by the kernel command line option
+   "-lock-profile" before thread_init(). */
+extern bool lock_profile;
+
 void lock_init (struct lock *);
+void lock_set_name (struct lock *, const char *name);
 void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
@@ -37,11 +49,64 @@ struct condition
     struct list waiters;        /* List of waiting threads. */
   };
 
+void lock_print_stats (void);
+
 void cond_init (struct condition *);
 void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Reader-writer lock. */
+struct rwlock
+  {
+    struct lock lock;           /* Protects the members below. */
+    struct condition readers;   /* Signaled when readers may enter. */
+    struct condition writers;   /* Signaled when a writer may enter. */
+    struct condition upgrader;  /* Signaled when upgrade may finish. */
+    unsigned reader_cnt;        /* Number of readers holding lock. */
+    unsigned writers_waiting;   /* Writers waiting to acquire. */
+    bool upgrading;             /* A reader waiting to upgrade? */
+    struct thread *writer;      /* Writer holding lock, or null. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_upgrade (struct rwlock *);
+void rwlock_downgrade (struct rwlock *);
+bool rwlock_held_by_current_thread (const struct rwlock *);
+void rwlock_self_test (void);
+
+void synch_requeue (struct thread *);
+
+/* Sequence lock, for small data that is read far more often
+   than it is written.  Readers never wait for each other or for
+   writers: they read optimistically and retry if a write
+   overlapped.  Writers must exclude one another by other means,
+   such as by disabling interrupts.
+
+      unsigned seq;
+      do
+        {
+          seq = seqlock_read_begin (&sl);
+          ...copy the protected data...
+        }
+      while (seqlock_read_retry (&sl, seq));
+*/
+struct seqlock
+  {
+    unsigned seq;               /* Odd while a write is in progress. */
+  };
+
+void seqlock_init (struct seqlock *);
+unsigned seqlock_read_begin (const struct seqlock *);
+bool seqlock_read_retry (const struct seqlock *, unsigned seq);
+void seqlock_write_begin (struct seqlock *);
+void seqlock_write_end (struct seqlock *);
+void seqlock_self_test (void);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
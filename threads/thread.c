@@ -2,17 +2,31 @@
 #include <debug.h>
 #include <stddef.h>
 #include <random.h>
+#include <round.h>
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
+#include "threads/fixed-point.h"
+#include "threads/arena.h"
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
+#include "threads/loader.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/slab.h"
 #include "threads/switch.h"
 #include "threads/synch.h"
+#include "threads/tracepoint.h"
 #include "threads/vaddr.h"
 #ifdef USERPROG
+#include "filesys/file.h"
+#include "userprog/pipe.h"
 #include "userprog/process.h"
+#include "userprog/procfs.h"
+#endif
+#ifdef FILESYS
+#include "filesys/directory.h"
 #endif
 
 /* Random value for struct thread's `magic' member.
@@ -20,16 +34,55 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running, with one FIFO queue per
+   priority.  Bit P of ready_mask is set if ready_queues[P] is
+   nonempty, so the highest ready priority is found in constant
+   time. */
+static struct list ready_queues[PRI_MAX + 1];
+static uint64_t ready_mask;
+static int ready_cnt;           /* Number of threads ready. */
+
+/* Under the stride scheduler, the ready threads are kept instead
+   in a binary min-heap on pass, in stride_heap[0] through
+   stride_heap[ready_cnt - 1]. */
+static struct thread **stride_heap;
+static uint64_t stride_pass;    /* Greatest pass of any thread chosen
+                                   to run. */
+
+/* Deadline threads that are ready and have budget left, in order
+   of deadline, which run ahead of all of the above. */
+static struct list dl_queue;
+static int dl_cnt;              /* Number of threads in dl_queue. */
+
+/* Idle thread. */
+static struct thread *idle_thread;
+
+/* Statistics. */
+static long long idle_ticks;    /* # of timer ticks spent idle. */
+static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
+static long long user_ticks;    /* # of timer ticks in user programs. */
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
 static struct list all_list;
 
-/* Idle thread. */
-static struct thread *idle_thread;
+/* Every struct child_status not yet freed, hashed by tid, for
+   get_thread() and thread_get_child().  Tids are allocated
+   sequentially, so taking the tid modulo the bucket count spreads
+   them evenly.  Access with interrupts off, which also protects
+   each record's ref_cnt. */
+#define TID_BUCKET_CNT 64       /* Must be a power of 2. */
+static struct list tid_buckets[TID_BUCKET_CNT];
+
+/* Status record of the initial thread, which is set up before
+   malloc() is available. */
+static struct child_status initial_status;
+
+#ifdef USERPROG
+/* Cache of struct file_node. */
+static struct slab_cache file_node_cache;
+#endif
 
 /* Initial thread, the thread running init.c:main(). */
 static struct thread *initial_thread;
@@ -45,20 +98,96 @@ struct kernel_thread_frame
     void *aux;                  /* Auxiliary data for function. */
   };
 
-/* Statistics. */
-static long long idle_ticks;    /* # of timer ticks spent idle. */
-static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
-static long long user_ticks;    /* # of timer ticks in user programs. */
-
 /* Scheduling. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
 static unsigned thread_ticks;   /* # of timer ticks since last yield. */
 
+/* Scheduler trace: the most recent TRACE_CNT scheduling events,
+   in a ring indexed by trace_cnt modulo TRACE_CNT. */
+#define TRACE_CNT 256           /* Must be a power of 2. */
+#define TRACE_THREAD_CNT 32     /* Most threads dumped. */
+enum trace_type
+  {
+    TRACE_SWITCH,               /* TID switched to OTHER. */
+    TRACE_BLOCK,                /* TID blocked. */
+    TRACE_UNBLOCK,              /* OTHER unblocked TID. */
+    TRACE_WAKEUP                /* An interrupt handler, interrupting
+                                   OTHER, unblocked TID. */
+  };
+struct trace_event
+  {
+    uint64_t tsc;               /* CPU cycle count. */
+    tid_t tid;                  /* Thread the event happened to. */
+    tid_t other;                /* Thread responsible, see above. */
+    enum trace_type type;       /* Event type. */
+  };
+static struct trace_event trace_ring[TRACE_CNT];
+static unsigned trace_cnt;      /* # of events ever recorded. */
+static struct lock dump_lock;   /* Serializes thread_dump_trace(). */
+
+/* Times any thread was made ready to run, by latency until it ran.
+   Entry I counts latencies of fewer than 2**(I + 10) CPU cycles
+   but at least as many as entry I - 1 allows; the last entry also
+   counts anything slower. */
+static unsigned sched_latency[SCHED_LATENCY_CNT];
+
+/* Pages of recently exited threads, kept for reuse by
+   thread_create() so that it need neither scan the page allocator
+   nor zero a whole page.  init_thread() clears the struct thread
+   at the bottom of the page, and nothing depends on the rest of
+   the stack being zeroed.  Access with interrupts off, since
+   thread_schedule_tail() fills it. */
+#define THREAD_PAGE_CNT 8
+static struct thread *page_cache[THREAD_PAGE_CNT];
+static size_t page_cache_cnt;
+static unsigned page_hit_cnt;   /* Pages taken from page_cache. */
+static unsigned page_miss_cnt;  /* Pages taken from palloc. */
+
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* Stride scheduling.
+
+   Each thread holds tickets, and each timer tick it runs advances
+   its pass by STRIDE1 divided by its tickets.  The ready thread
+   with the lowest pass runs next, so over time each thread gets
+   CPU time in proportion to its tickets.  A thread that wakes up
+   has its pass raised to that of the last thread chosen, so that
+   time spent blocked is not saved up to be spent later in a
+   burst.  New threads inherit their creator's tickets, except
+   that a user process funds the processes it starts by handing
+   them half of its own, which they give back when they exit:
+   the processes descended from one with N tickets share N
+   tickets however many of them there are. */
+bool thread_stride;
+#define STRIDE1 (1 << 20)
+
+/* Deadline scheduling.
+
+   A kernel thread whose response time matters may reserve
+   RUNTIME ticks of every PERIOD with thread_set_deadline().  Such
+   threads form a class above every other: while any of them is
+   ready with budget left, the one whose period ends first runs,
+   earliest deadline first, preempting any thread outside the
+   class.  Each tick it runs spends a tick of its budget.  A
+   thread that has spent it falls back to its ordinary priority
+   until its next period begins, which happens the next time it
+   is made ready or ticks after its deadline has passed.
+   Admission control keeps the total reserved within
+   DEADLINE_UTIL_MAX, so that ordinary threads always get the
+   rest. */
+#define DEADLINE_UTIL_MAX 500   /* Thousandths of the CPU. */
+static int deadline_util;       /* Thousandths reserved. */
+static unsigned deadline_overrun_cnt; /* Budgets spent before their
+                                         thread blocked. */
+
+/* System load average, the exponentially weighted moving average
+   of the number of threads ready to run, for the multi-level
+   feedback queue scheduler. */
+static fixed_t load_avg;
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
@@ -67,13 +196,39 @@ static struct thread *next_thread_to_run (void);
 static void init_thread (struct thread *, const char *name, int priority);
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
+static struct thread *alloc_thread_page (void);
+static void free_thread_page (struct thread *);
+static size_t page_cache_count (void);
+static size_t page_cache_scan (size_t);
+
+/* Gives cached thread pages back when memory runs short. */
+static struct shrinker page_cache_shrinker =
+  {
+    .name = "thread pages",
+    .count = page_cache_count,
+    .scan = page_cache_scan
+  };
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static void ready_push (struct thread *);
+static int ready_priority (void);
+static bool preempt_wanted (void);
+static bool in_deadline_class (const struct thread *);
+static int deadline_share (const struct thread *);
+static void return_tickets (struct thread *, struct child_status *);
+static void queue_exited (struct child_status *);
+static void change_priority (struct thread *, int priority);
+static int mlfqs_priority (const struct thread *);
+static void mlfqs_update (struct thread *, void *aux);
+static void trace (enum trace_type, struct thread *, struct thread *other);
+static void account_latency (struct thread *);
+static void init_status (struct child_status *, struct thread *);
+static struct child_status *lookup_status (tid_t);
+#ifdef USERPROG
 /* MODIFIED */
-void delete_fd_list ();
-void  kill_children();
-void  notify_children();
+void delete_fd_list (void);
+#endif
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
    general and it is possible in this case only because loader.S
@@ -92,15 +247,33 @@ thread_init (void)
 {
   ASSERT (intr_get_level () == INTR_OFF);
 
+  int pri, i;
+
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  lock_init (&dump_lock);
+#ifdef USERPROG
+  slab_cache_init (&file_node_cache, "file_node", sizeof (struct file_node),
+                   NULL);
+#endif
+  for (pri = PRI_MIN; pri <= PRI_MAX; pri++)
+    list_init (&ready_queues[pri]);
+  ready_mask = 0;
+  ready_cnt = 0;
+  list_init (&dl_queue);
+  dl_cnt = 0;
+  load_avg = 0;
   list_init (&all_list);
+  for (i = 0; i < TID_BUCKET_CNT; i++)
+    list_init (&tid_buckets[i]);
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
   init_thread (initial_thread, "main", PRI_DEFAULT);
   initial_thread->status = THREAD_RUNNING;
   initial_thread->tid = allocate_tid ();
+  init_status (&initial_status, initial_thread);
+  initial_status.parent_tid = TID_ERROR;
+  initial_status.ref_cnt = 1;
 }
 
 /* Starts preemptive thread scheduling by enabling interrupts.
@@ -110,8 +283,16 @@ thread_start (void)
 {
   /* Create the idle thread. */
   struct semaphore idle_started;
+
+  /* No more threads can exist than there are pages to hold them. */
+  if (thread_stride)
+    stride_heap = palloc_get_multiple (
+      PAL_ASSERT, DIV_ROUND_UP (init_ram_pages * sizeof (struct thread *),
+                                PGSIZE));
+
   sema_init (&idle_started, 0);
   thread_create ("idle", PRI_MIN, idle, &idle_started);
+  palloc_register_shrinker (&page_cache_shrinker);
 
   /* Start preemptive thread scheduling. */
   intr_enable ();
@@ -123,10 +304,15 @@ thread_start (void)
 /* Called by the timer interrupt handler at each timer tick.
    Thus, this function runs in an external interrupt context. */
 void
-thread_tick (void) 
+thread_tick (bool user) 
 {
   struct thread *t = thread_current ();
 
+  if (user)
+    t->rusage.user_ticks++;
+  else if (t != idle_thread)
+    t->rusage.kernel_ticks++;
+
   /* Update statistics. */
   if (t == idle_thread)
     idle_ticks++;
@@ -137,17 +323,164 @@ thread_tick (void)
   else
     kernel_ticks++;
 
+  if (thread_mlfqs)
+    {
+      if (t != idle_thread)
+        t->recent_cpu = fp_add_int (t->recent_cpu, 1);
+
+      /* Once per second, recompute the load average, and every
+         thread's recent_cpu and priority from it.  In between,
+         only the running thread's recent_cpu changes, so only its
+         priority needs recomputing. */
+      if (timer_ticks () % TIMER_FREQ == 0)
+        {
+          int ready = ready_cnt + dl_cnt + (t != idle_thread);
+
+          load_avg = fp_mul (fp_div (fp_from_int (59), fp_from_int (60)),
+                             load_avg)
+                     + fp_from_int (ready) / 60;
+          thread_foreach (mlfqs_update, NULL);
+        }
+      else if (timer_ticks () % TIME_SLICE == 0 && t != idle_thread)
+        change_priority (t, mlfqs_priority (t));
+      if (preempt_wanted ())
+        intr_yield_on_return ();
+    }
+
+  if (thread_stride && t != idle_thread)
+    t->pass += STRIDE1 / t->tickets;
+
+  /* Charge a deadline thread's budget.  One that has spent it
+     drops out of the class.  One that is still in it runs until
+     it blocks or a thread with an earlier deadline is ready,
+     without time slicing. */
+  if (t->dl_runtime > 0)
+    {
+      if (t->dl_budget > 0 && --t->dl_budget == 0)
+        {
+          deadline_overrun_cnt++;
+          intr_yield_on_return ();
+        }
+      else if (t->dl_budget == 0 && timer_ticks () >= t->dl_deadline)
+        {
+          t->dl_deadline = timer_ticks () + t->dl_period;
+          t->dl_budget = t->dl_runtime;
+        }
+      if (in_deadline_class (t))
+        return;
+    }
+
   /* Enforce preemption. */
   if (++thread_ticks >= TIME_SLICE)
     intr_yield_on_return ();
 }
 
+/* Accounts for TICKS timer ticks that passed without a timer
+   interrupt while the idle thread was halted. */
+void
+thread_tick_idle (int ticks)
+{
+  idle_ticks += ticks;
+}
+
+/* Adds the resource usage in SRC into DST. */
+void
+thread_add_rusage (struct rusage *dst, const struct rusage *src)
+{
+  int i;
+
+  dst->user_ticks += src->user_ticks;
+  dst->kernel_ticks += src->kernel_ticks;
+  dst->read_sectors += src->read_sectors;
+  dst->write_sectors += src->write_sectors;
+  dst->syscall_cnt += src->syscall_cnt;
+  dst->minor_faults += src->minor_faults;
+  dst->major_faults += src->major_faults;
+  dst->zero_faults += src->zero_faults;
+  dst->cow_faults += src->cow_faults;
+  dst->file_faults += src->file_faults;
+  dst->swap_faults += src->swap_faults;
+  for (i = 0; i < RUSAGE_LATENCY_CNT; i++)
+    {
+      dst->minor_latency[i] += src->minor_latency[i];
+      dst->major_latency[i] += src->major_latency[i];
+    }
+}
+
 /* Prints thread statistics. */
 void
 thread_print_stats (void) 
 {
+  int i;
+
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+  printf ("Thread: %u pages reused, %u allocated, %zu cached\n",
+          page_hit_cnt, page_miss_cnt, page_cache_cnt);
+  printf ("Thread: %d.%d%% of CPU reserved by deadline threads, "
+          "%u budgets spent\n",
+          deadline_util / 10, deadline_util % 10, deadline_overrun_cnt);
+  printf ("Thread: scheduling latency (log2 cycles):");
+  for (i = 0; i < SCHED_LATENCY_CNT; i++)
+    if (sched_latency[i] > 0)
+      printf (" %d:%u", i + 10, sched_latency[i]);
+  printf ("\n");
+}
+
+/* Prints the scheduler trace, oldest event first, followed by the
+   scheduling latency histograms of up to TRACE_THREAD_CNT threads.
+   Each line starts with "trace:" so that the dump is easily
+   extracted from a log.  Both are copied with interrupts off and
+   printed afterward, so that printing does not disturb them. */
+void
+thread_dump_trace (void)
+{
+  static const char *type_names[] = {"switch", "block", "unblock", "wakeup"};
+  static struct trace_event events[TRACE_CNT];
+  static struct
+    {
+      tid_t tid;
+      char name[16];
+      unsigned latency[SCHED_LATENCY_CNT];
+    }
+  threads[TRACE_THREAD_CNT];
+  enum intr_level old_level;
+  unsigned event_cnt, thread_cnt, i, j;
+  struct list_elem *e;
+
+  lock_acquire (&dump_lock);
+
+  old_level = intr_disable ();
+  event_cnt = trace_cnt < TRACE_CNT ? trace_cnt : TRACE_CNT;
+  for (i = 0; i < event_cnt; i++)
+    events[i] = trace_ring[(trace_cnt - event_cnt + i) % TRACE_CNT];
+  thread_cnt = 0;
+  for (e = list_begin (&all_list);
+       e != list_end (&all_list) && thread_cnt < TRACE_THREAD_CNT;
+       e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, allelem);
+
+      threads[thread_cnt].tid = t->tid;
+      strlcpy (threads[thread_cnt].name, t->name, sizeof t->name);
+      memcpy (threads[thread_cnt].latency, t->latency, sizeof t->latency);
+      thread_cnt++;
+    }
+  intr_set_level (old_level);
+
+  for (i = 0; i < event_cnt; i++)
+    printf ("trace: %llu %s %d %d\n", timer_tsc_to_ns (events[i].tsc),
+            type_names[events[i].type], events[i].tid, events[i].other);
+  for (i = 0; i < thread_cnt; i++)
+    {
+      printf ("trace: latency %d %s", threads[i].tid, threads[i].name);
+      for (j = 0; j < SCHED_LATENCY_CNT; j++)
+        if (threads[i].latency[j] > 0)
+          printf (" %u:%u", j + 10, threads[i].latency[j]);
+      printf ("\n");
+    }
+
+  lock_release (&dump_lock);
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -162,9 +495,11 @@ thread_print_stats (void)
    scheduled.  Use a semaphore or some other form of
    synchronization if you need to ensure ordering.
 
-   The code provided sets the new thread's `priority' member to
-   PRIORITY, but no actual priority scheduling is implemented.
-   Priority scheduling is the goal of Problem 1-3. */
+   If the new thread's PRIORITY is higher than the running
+   thread's, the new thread runs before thread_create() returns.
+   Under the multi-level feedback queue scheduler, PRIORITY is
+   ignored: the new thread inherits its creator's nice and
+   recent_cpu values and its priority is computed from them. */
 tid_t
 thread_create (const char *name, int priority,
                thread_func *function, void *aux) 
@@ -173,25 +508,57 @@ thread_create (const char *name, int priority,
   struct kernel_thread_frame *kf;
   struct switch_entry_frame *ef;
   struct switch_threads_frame *sf;
+  struct child_status *rec;
   tid_t tid;
   enum intr_level old_level;
 
   ASSERT (function != NULL);
 
   /* Allocate thread. */
-  t = palloc_get_page (PAL_ZERO);
+  t = alloc_thread_page ();
   if (t == NULL)
     return TID_ERROR;
+  rec = malloc (sizeof *rec);
+  if (rec == NULL)
+    {
+      free_thread_page (t);
+      return TID_ERROR;
+    }
 
   /* Initialize thread. */
   init_thread (t, name, priority);
   tid = t->tid = allocate_tid ();
+  t->nice = thread_current ()->nice;
+  t->recent_cpu = thread_current ()->recent_cpu;
+  t->io_weight = thread_current ()->io_weight;
+  t->io_rate = thread_current ()->io_rate;
+  t->tickets = thread_current ()->tickets;
+#ifdef USERPROG
+  if (thread_current ()->pagedir != NULL && t->tickets > TICKETS_MIN)
+    {
+      t->tickets /= 2;
+      t->borrowed_tickets = t->tickets;
+      thread_current ()->tickets -= t->tickets;
+    }
+#endif
+  t->pass = stride_pass;
+  if (thread_mlfqs && function != idle)
+    t->priority = t->base_priority = mlfqs_priority (t);
+
+#ifdef FILESYS
+  /* A new thread starts in its creator's working directory. */
+  if (thread_current ()->cwd != NULL)
+    t->cwd = dir_reopen (thread_current ()->cwd);
+#endif
 
   /* Prepare thread for first run by initializing its stack.
      Do this atomically so intermediate values for the 'stack' 
      member cannot be observed. */
   old_level = intr_disable ();
 
+  init_status (rec, t);
+  list_push_back (&thread_current ()->children, &rec->elem);
+
   /* Stack frame for kernel_thread(). */
   kf = alloc_frame (t, sizeof *kf);
   kf->eip = NULL;
@@ -209,9 +576,6 @@ thread_create (const char *name, int priority,
 
   intr_set_level (old_level);
 
-  //add this thread to current thread's children list
-  list_push_back ( &thread_current()->child_list, &t->child_elem );
-
   /* Add to run queue. */
   thread_unblock (t);
 
@@ -231,6 +595,7 @@ thread_block (void)
   ASSERT (intr_get_level () == INTR_OFF);
 
   thread_current ()->status = THREAD_BLOCKED;
+  trace (TRACE_BLOCK, thread_current (), thread_current ());
   schedule ();
 }
 
@@ -238,10 +603,12 @@ thread_block (void)
    This is an error if T is not blocked.  (Use thread_yield() to
    make the running thread ready.)
 
-   This function does not preempt the running thread.  This can
-   be important: if the caller had disabled interrupts itself,
-   it may expect that it can atomically unblock a thread and
-   update other data. */
+   If T has a higher priority than the running thread, the running
+   thread is preempted, but only once interrupts are on: if the
+   caller had disabled interrupts itself, it may expect that it
+   can atomically unblock a thread and update other data, and it
+   should call thread_preempt() when done.  In an interrupt
+   handler, the switch happens on return from the interrupt. */
 void
 thread_unblock (struct thread *t) 
 {
@@ -251,9 +618,38 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_push_back (&ready_list, &t->elem);
+  ready_push (t);
   t->status = THREAD_READY;
+  t->ready_tsc = timer_tsc ();
+  trace (intr_context () ? TRACE_WAKEUP : TRACE_UNBLOCK, t,
+         thread_current ());
+  intr_set_level (old_level);
+  thread_preempt ();
+}
+
+/* Yields the CPU if a ready thread has a higher priority than the
+   running one.  In an interrupt handler, yields on return from the
+   interrupt instead.  Does nothing if interrupts are off. */
+void
+thread_preempt (void)
+{
+  enum intr_level old_level;
+  bool higher;
+
+  if (intr_context ())
+    {
+      if (preempt_wanted ())
+        intr_yield_on_return ();
+      return;
+    }
+  if (intr_get_level () == INTR_OFF)
+    return;
+
+  old_level = intr_disable ();
+  higher = preempt_wanted ();
   intr_set_level (old_level);
+  if (higher)
+    thread_yield ();
 }
 
 /* Returns the name of the running thread. */
@@ -294,37 +690,58 @@ thread_tid (void)
 void
 thread_exit (void) 
 {
+  struct thread *cur = thread_current ();
+  struct child_status *rec = cur->status_rec;
+
   ASSERT (!intr_context ());
   
+#ifdef USERPROG
     /* MODIFIED print out exit info */
-  printf("%s: exit(%d)\n", thread_current() ->name, thread_current() ->return_status );
+  printf("%s: exit(%d)\n", cur->name, cur->return_status );
   /* MODIFIED close the executable file */
-  file_close(thread_current()->exec_file);
+  file_close(cur->exec_file);
   /* MODIFIED delete fd list */
   delete_fd_list();
-  notify_children();   
-  kill_children();
 
-#ifdef USERPROG
   process_exit ();
 #endif
+#ifdef FILESYS
+  dir_close (cur->cwd);
+  cur->cwd = NULL;
+#endif
+  arena_destroy ();
+
+  /* Our children's records are no longer needed by us. */
+  while (!list_empty (&cur->children))
+    {
+      struct child_status *child;
+
+      child = list_entry (list_pop_front (&cur->children),
+                          struct child_status, elem);
+      thread_unqueue_exited (child);
+      thread_release_status (child);
+    }
+
+  /* Tell our parent how we exited.  Everything it might observe
+     has been cleaned up by now. */
+  rec->exit_status = cur->return_status;
+  rec->exit_ticks = timer_ticks ();
+  rec->usage = cur->rusage;
+  intr_disable ();
+  rec->thread = NULL;
+  return_tickets (cur, rec);
+  queue_exited (rec);
+  intr_enable ();
+  sema_up (&rec->exit_sema);
+  thread_release_status (rec);
   
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
      when it calls thread_schedule_tail(). */
   intr_disable ();
-  list_remove (&thread_current()->allelem);
-
-  sema_up(&thread_current ()->child_sema);
-  
-  /*
-  if (strcmp(thread_current()->name, "main") != 0)
-  {
-    list_remove (&thread_current ()->child_elem);
-  }
-  */
-
-  thread_current ()->status = THREAD_DYING;
+  deadline_util -= deadline_share (cur);
+  list_remove (&cur->allelem);
+  cur->status = THREAD_DYING;
 
   schedule ();
   NOT_REACHED ();
@@ -342,8 +759,9 @@ thread_yield (void)
 
   old_level = intr_disable ();
   if (cur != idle_thread) 
-    list_push_back (&ready_list, &cur->elem);
+    ready_push (cur);
   cur->status = THREAD_READY;
+  cur->ready_tsc = timer_tsc ();
   schedule ();
   intr_set_level (old_level);
 }
@@ -365,11 +783,93 @@ thread_foreach (thread_action_func *func, void *aux)
     }
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
+/* Sets the current thread's base priority to NEW_PRIORITY,
+   yielding if it is no longer the highest.  A priority donated to
+   the thread stays in effect until the donor stops waiting. */
 void
 thread_set_priority (int new_priority) 
 {
-  thread_current ()->priority = new_priority;
+  enum intr_level old_level;
+
+  ASSERT (PRI_MIN <= new_priority && new_priority <= PRI_MAX);
+
+  if (thread_mlfqs)
+    return;
+
+  old_level = intr_disable ();
+  thread_current ()->base_priority = new_priority;
+  thread_update_priority (thread_current ());
+  intr_set_level (old_level);
+  thread_preempt ();
+}
+
+/* Raises T's effective priority to PRIORITY, if it is lower.
+   Interrupts must be off. */
+void
+thread_donate_priority (struct thread *t, int priority)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t->priority < priority)
+    change_priority (t, priority);
+}
+
+/* Recomputes T's effective priority as the higher of its base
+   priority and the priority of the highest-priority thread
+   waiting for any lock that T holds.  Interrupts must be off. */
+void
+thread_update_priority (struct thread *t)
+{
+  int priority = t->base_priority;
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (thread_mlfqs)
+    return;
+  for (e = list_begin (&t->locks); e != list_end (&t->locks);
+       e = list_next (e))
+    {
+      struct lock *lock = list_entry (e, struct lock, elem);
+      struct list *waiters = &lock->semaphore.waiters;
+
+      /* Waiters are kept in priority order, highest first. */
+      if (!list_empty (waiters))
+        {
+          struct thread *waiter = list_entry (list_front (waiters),
+                                              struct thread, elem);
+          if (waiter->priority > priority)
+            priority = waiter->priority;
+        }
+    }
+  if (priority != t->priority)
+    change_priority (t, priority);
+}
+
+/* Sets T's effective priority to PRIORITY, moving T to the
+   matching ready queue if it is ready, or to its new place in the
+   wait queue it is in, if any.  Interrupts must be off. */
+static void
+change_priority (struct thread *t, int priority)
+{
+
+  /* Neither the stride heap nor the deadline queue is ordered by
+     priority. */
+  if (t->status == THREAD_READY && !thread_stride && !t->dl_queued)
+    {
+      list_remove (&t->elem);
+      ready_cnt--;
+      if (list_empty (&ready_queues[t->priority]))
+        ready_mask &= ~((uint64_t) 1 << t->priority);
+      t->priority = priority;
+      ready_push (t);
+    }
+  else
+    t->priority = priority;
+
+  /* A thread in cond_wait() may be ready or running while it is
+     still among the condition's waiters. */
+  synch_requeue (t);
 }
 
 /* Returns the current thread's priority. */
@@ -379,35 +879,129 @@ thread_get_priority (void)
   return thread_current ()->priority;
 }
 
-/* Sets the current thread's nice value to NICE. */
+/* Sets the current thread's nice value to NICE and recomputes its
+   priority, yielding if it is no longer the highest. */
+void
+thread_set_nice (int nice) 
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (NICE_MIN <= nice && nice <= NICE_MAX);
+
+  old_level = intr_disable ();
+  cur->nice = nice;
+  if (thread_mlfqs)
+    change_priority (cur, mlfqs_priority (cur));
+  intr_set_level (old_level);
+  thread_preempt ();
+}
+
+/* Sets the current thread's tickets to TICKETS, for the stride
+   scheduler. */
 void
-thread_set_nice (int nice UNUSED) 
+thread_set_tickets (int tickets) 
 {
-  /* Not yet implemented. */
+  ASSERT (TICKETS_MIN <= tickets && tickets <= TICKETS_MAX);
+
+  thread_current ()->tickets = tickets;
+}
+
+/* Reserves RUNTIME timer ticks of CPU time for the running
+   thread in every PERIOD ticks, making it a deadline thread, or
+   returns it to ordinary scheduling if RUNTIME is 0.  Returns
+   false, changing nothing, if the reservation would take the
+   total reserved by all such threads past DEADLINE_UTIL_MAX.
+   Threads created afterward do not inherit the reservation. */
+bool
+thread_set_deadline (int64_t runtime, int64_t period)
+{
+  struct thread *t = thread_current ();
+  enum intr_level old_level;
+  int share;
+
+  ASSERT (runtime >= 0);
+  ASSERT (runtime == 0 || runtime <= period);
+
+  share = runtime > 0 ? DIV_ROUND_UP (runtime * 1000, period) : 0;
+  old_level = intr_disable ();
+  if (deadline_util - deadline_share (t) + share > DEADLINE_UTIL_MAX)
+    {
+      intr_set_level (old_level);
+      return false;
+    }
+  deadline_util += share - deadline_share (t);
+  t->dl_runtime = runtime;
+  t->dl_period = period;
+  t->dl_deadline = timer_ticks () + period;
+  t->dl_budget = runtime;
+  intr_set_level (old_level);
+  thread_preempt ();
+  return true;
+}
+
+/* Returns the current thread's tickets. */
+int
+thread_get_tickets (void) 
+{
+  return thread_current ()->tickets;
 }
 
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  return thread_current ()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int load = fp_round (load_avg * 100);
+  intr_set_level (old_level);
+  return load;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int recent = fp_round (thread_current ()->recent_cpu * 100);
+  intr_set_level (old_level);
+  return recent;
+}
+
+/* Returns the priority the multi-level feedback queue scheduler
+   assigns T, from its recent_cpu and nice values. */
+static int
+mlfqs_priority (const struct thread *t)
+{
+  int priority = PRI_MAX - fp_trunc (t->recent_cpu / 4) - t->nice * 2;
+
+  if (priority < PRI_MIN)
+    return PRI_MIN;
+  if (priority > PRI_MAX)
+    return PRI_MAX;
+  return priority;
+}
+
+/* Decays T's recent_cpu value by the load average and recomputes
+   its priority.  Called once per second for every thread. */
+static void
+mlfqs_update (struct thread *t, void *aux UNUSED)
+{
+  fixed_t twice_load = load_avg * 2;
+
+  if (t == idle_thread)
+    return;
+  t->recent_cpu = fp_add_int (fp_mul (fp_div (twice_load,
+                                              fp_add_int (twice_load, 1)),
+                                      t->recent_cpu),
+                              t->nice);
+  change_priority (t, mlfqs_priority (t));
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
@@ -423,6 +1017,7 @@ static void
 idle (void *idle_started_ UNUSED) 
 {
   struct semaphore *idle_started = idle_started_;
+
   idle_thread = thread_current ();
   sema_up (idle_started);
 
@@ -432,7 +1027,18 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
-      /* Re-enable interrupts and wait for the next one.
+      /* With nothing else to do, zero free user pages for later
+         PAL_ZERO allocations, one page at a time so that a thread
+         that becomes ready is not kept waiting. */
+      intr_enable ();
+      while (ready_cnt + dl_cnt == 0 && palloc_prezero ())
+        continue;
+      intr_disable ();
+      if (ready_cnt + dl_cnt != 0)
+        continue;
+
+      /* Re-enable interrupts and wait for the next one, which
+         with tickless idle may be several ticks away.
 
          The `sti' instruction disables interrupts until the
          completion of the next instruction, so these two
@@ -444,6 +1050,7 @@ idle (void *idle_started_ UNUSED)
 
          See [IA32-v2a] "HLT", [IA32-v2b] "STI", and [IA32-v3a]
          7.11.1 "HLT Instruction". */
+      timer_idle_begin ();
       asm volatile ("sti; hlt" : : : "memory");
     }
 }
@@ -493,26 +1100,107 @@ init_thread (struct thread *t, const char *name, int priority)
   t->status = THREAD_BLOCKED;
   strlcpy (t->name, name, sizeof t->name);
   t->stack = (uint8_t *) t + PGSIZE;
-  t->priority = priority;
+  t->priority = t->base_priority = priority;
+  list_init (&t->locks);
+  t->waiting_lock = NULL;
   t->magic = THREAD_MAGIC;
   
   // MODIFIED
   // -1 by default. If exited normally, it'll be assigned to other value.
   t->return_status = -1;
 
-  //init the parentDead
-  t->parentDead = false;
-
-  // when a thread tries to wait for it, it will be blocked.
-  sema_init(&t->child_sema, 0);
-  list_init(&t->child_list);
+  list_init (&t->children);
+  list_init (&t->exited);
+  sema_init (&t->child_exited, 0);
   list_push_back (&all_list, &t->allelem);
 
-  // wait for the result of execing a child
-  sema_init(&t->exec_sema, 0);
-  // initiate file_list
-  list_init(&t->file_list);
-  t->fd_index = 2;
+  // the fd table is allocated on the first open
+  t->fd_table = NULL;
+  t->fd_cap = 0;
+  t->fd_free = 2;
+
+  t->io_weight = IOPRIO_WEIGHT_DEFAULT;
+  t->io_rate = 0;
+  t->tickets = TICKETS_DEFAULT;
+
+#ifdef USERPROG
+  list_init (&t->aio_requests);
+  t->next_aio_ticket = 0;
+#endif
+}
+
+/* Returns a page for a new thread, from page_cache if it has one,
+   or a null pointer if memory is exhausted.  Only the struct
+   thread at its bottom needs to be zeroed, which init_thread()
+   does. */
+static struct thread *
+alloc_thread_page (void)
+{
+  struct thread *t = NULL;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (page_cache_cnt > 0)
+    {
+      t = page_cache[--page_cache_cnt];
+      page_hit_cnt++;
+    }
+  intr_set_level (old_level);
+  if (t != NULL)
+    return t;
+
+  t = palloc_get_page (0);
+  if (t != NULL)
+    page_miss_cnt++;
+  return t;
+}
+
+/* Frees T's page into page_cache, or back to the page allocator
+   if the cache is full or the page was borrowed from the user
+   pool, which wants it back. */
+static void
+free_thread_page (struct thread *t)
+{
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (page_cache_cnt < THREAD_PAGE_CNT && !palloc_is_borrowed (t))
+    {
+      page_cache[page_cache_cnt++] = t;
+      t = NULL;
+    }
+  intr_set_level (old_level);
+  if (t != NULL)
+    palloc_free_page (t);
+}
+
+/* Shrinker callback: returns the number of cached thread pages. */
+static size_t
+page_cache_count (void)
+{
+  return page_cache_cnt;
+}
+
+/* Shrinker callback: frees up to CNT cached thread pages and
+   returns the number freed. */
+static size_t
+page_cache_scan (size_t cnt)
+{
+  size_t freed = 0;
+
+  while (freed < cnt)
+    {
+      struct thread *t = NULL;
+      enum intr_level old_level = intr_disable ();
+      if (page_cache_cnt > 0)
+        t = page_cache[--page_cache_cnt];
+      intr_set_level (old_level);
+      if (t == NULL)
+        break;
+      palloc_free_page (t);
+      freed++;
+    }
+  return freed;
 }
 
 /* Allocates a SIZE-byte frame at the top of thread T's stack and
@@ -528,18 +1216,249 @@ alloc_frame (struct thread *t, size_t size)
   return t->stack;
 }
 
-/* Chooses and returns the next thread to be scheduled.  Should
-   return a thread from the run queue, unless the run queue is
-   empty.  (If the running thread can continue running, then it
-   will be in the run queue.)  If the run queue is empty, return
-   idle_thread. */
+/* Puts T in stride_heap[I], where it belongs in the heap. */
+static void
+heap_set (int i, struct thread *t)
+{
+  stride_heap[i] = t;
+  t->heap_idx = i;
+}
+
+/* Moves the thread in stride_heap[I] toward the root of the heap
+   until its parent's pass is no greater than its own. */
+static void
+heap_up (int i)
+{
+  struct thread *t = stride_heap[i];
+
+  while (i > 0 && t->pass < stride_heap[(i - 1) / 2]->pass)
+    {
+      heap_set (i, stride_heap[(i - 1) / 2]);
+      i = (i - 1) / 2;
+    }
+  heap_set (i, t);
+}
+
+/* Moves the thread in stride_heap[I] away from the root of the
+   heap until neither of its children has a lower pass. */
+static void
+heap_down (int i)
+{
+  struct thread *t = stride_heap[i];
+
+  for (;;)
+    {
+      int child = 2 * i + 1;
+
+      if (child >= ready_cnt)
+        break;
+      if (child + 1 < ready_cnt
+          && stride_heap[child + 1]->pass < stride_heap[child]->pass)
+        child++;
+      if (stride_heap[child]->pass >= t->pass)
+        break;
+      heap_set (i, stride_heap[child]);
+      i = child;
+    }
+  heap_set (i, t);
+}
+
+/* Returns true if deadline thread A's period ends before B's. */
+static bool
+deadline_less (const struct list_elem *a_, const struct list_elem *b_,
+               void *aux UNUSED)
+{
+  const struct thread *a = list_entry (a_, struct thread, elem);
+  const struct thread *b = list_entry (b_, struct thread, elem);
+
+  return a->dl_deadline < b->dl_deadline;
+}
+
+/* Adds T to the deadline queue if it is a deadline thread with
+   budget left, starting its next period first if its current one
+   is over.  Otherwise, adds T to the back of the ready queue for
+   its priority, or under the stride scheduler to the heap.
+   Interrupts must be off. */
+static void
+ready_push (struct thread *t)
+{
+
+  if (t->dl_runtime > 0)
+    {
+      int64_t now = timer_ticks ();
+
+      if (now >= t->dl_deadline)
+        {
+          t->dl_deadline = now + t->dl_period;
+          t->dl_budget = t->dl_runtime;
+        }
+      if (t->dl_budget > 0)
+        {
+          list_insert_ordered (&dl_queue, &t->elem, deadline_less, NULL);
+          t->dl_queued = true;
+          dl_cnt++;
+          return;
+        }
+    }
+
+  if (thread_stride)
+    {
+      if (t->status == THREAD_BLOCKED && t->pass < stride_pass)
+        t->pass = stride_pass;
+      heap_set (ready_cnt++, t);
+      heap_up (t->heap_idx);
+      return;
+    }
+
+  list_push_back (&ready_queues[t->priority], &t->elem);
+  ready_mask |= (uint64_t) 1 << t->priority;
+  ready_cnt++;
+}
+
+/* Returns the highest priority of any ready thread, or -1 if no
+   thread is ready.  Interrupts must be off. */
+static int
+ready_priority (void)
+{
+  uint64_t mask = ready_mask;
+
+  return mask != 0 ? 63 - __builtin_clzll (mask) : -1;
+}
+
+/* Returns true if T is a deadline thread with budget left. */
+static bool
+in_deadline_class (const struct thread *t)
+{
+  return t->dl_runtime > 0 && t->dl_budget > 0;
+}
+
+/* Returns the thousandths of the CPU reserved by T. */
+static int
+deadline_share (const struct thread *t)
+{
+  return (t->dl_runtime > 0
+          ? DIV_ROUND_UP (t->dl_runtime * 1000, t->dl_period) : 0);
+}
+
+/* Returns true if a ready thread should preempt the running one:
+   a deadline thread, if the running thread is not one or has a
+   later deadline, or else one with higher priority, or under the
+   stride scheduler one with a lower pass.  Interrupts must be
+   off. */
+static bool
+preempt_wanted (void)
+{
+  struct thread *cur = thread_current ();
+
+  if (!list_empty (&dl_queue))
+    {
+      struct thread *t = list_entry (list_front (&dl_queue),
+                                     struct thread, elem);
+      if (!in_deadline_class (cur) || t->dl_deadline < cur->dl_deadline)
+        return true;
+    }
+  if (in_deadline_class (cur))
+    return false;
+  if (thread_stride)
+    return ready_cnt > 0 && (cur == idle_thread
+                                || stride_heap[0]->pass < cur->pass);
+  return ready_priority () > cur->priority;
+}
+
+/* Gives the tickets of T, which is exiting, back to the parent
+   named in its status record REC, if T was funded by the parent
+   and the parent is still running.  Interrupts must be off. */
+static void
+return_tickets (struct thread *t, struct child_status *rec)
+{
+  struct child_status *parent;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t->borrowed_tickets == 0)
+    return;
+  parent = lookup_status (rec->parent_tid);
+  if (parent != NULL && parent->thread != NULL)
+    {
+      parent->thread->tickets += t->tickets;
+      if (parent->thread->tickets > TICKETS_MAX)
+        parent->thread->tickets = TICKETS_MAX;
+    }
+}
+
+/* Records a scheduling event of TYPE for thread T, caused by
+   OTHER, in the trace ring.  Interrupts must be off. */
+static void
+trace (enum trace_type type, struct thread *t, struct thread *other)
+{
+  struct trace_event *ev = &trace_ring[trace_cnt++ % TRACE_CNT];
+
+  ev->tsc = timer_tsc ();
+  ev->tid = t->tid;
+  ev->other = other->tid;
+  ev->type = type;
+}
+
+/* Counts the time T, about to run, spent ready to run in its own
+   and the global latency histogram.  Interrupts must be off. */
+static void
+account_latency (struct thread *t)
+{
+  uint64_t cycles = (timer_tsc () - t->ready_tsc) >> 10;
+  int bucket = 0;
+
+  while (cycles > 0 && bucket < SCHED_LATENCY_CNT - 1)
+    {
+      cycles >>= 1;
+      bucket++;
+    }
+  t->latency[bucket]++;
+  sched_latency[bucket]++;
+}
+
+/* Chooses and returns the next thread to be scheduled: the
+   deadline thread with the earliest deadline, if any is ready;
+   otherwise the thread at the front of the highest-priority
+   nonempty ready queue, or under the stride scheduler the ready
+   thread with the lowest pass.  (If the running thread can
+   continue running, then it will be ready.)  If no thread is
+   ready, returns idle_thread. */
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
+  int pri = ready_priority ();
+  struct thread *t;
+
+  if (!list_empty (&dl_queue))
+    {
+      t = list_entry (list_pop_front (&dl_queue), struct thread, elem);
+      t->dl_queued = false;
+      dl_cnt--;
+      return t;
+    }
+
+  if (thread_stride)
+    {
+      if (ready_cnt == 0)
+        return idle_thread;
+      t = stride_heap[0];
+      if (--ready_cnt > 0)
+        {
+          heap_set (0, stride_heap[ready_cnt]);
+          heap_down (0);
+        }
+      if (t->pass > stride_pass)
+        stride_pass = t->pass;
+      return t;
+    }
+
+  if (pri < 0)
     return idle_thread;
-  else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+  t = list_entry (list_pop_front (&ready_queues[pri]), struct thread, elem);
+  ready_cnt--;
+  if (list_empty (&ready_queues[pri]))
+    ready_mask &= ~((uint64_t) 1 << pri);
+  return t;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -581,10 +1500,10 @@ thread_schedule_tail (struct thread *prev)
      pull out the rug under itself.  (We don't free
      initial_thread because its memory was not obtained via
      palloc().) */
-  if (prev != NULL && prev->status == THREAD_DYING && prev != initial_thread && prev->parentDead) 
+  if (prev != NULL && prev->status == THREAD_DYING && prev != initial_thread) 
     {
       ASSERT (prev != cur);
-      palloc_free_page (prev);
+      free_thread_page (prev);
     }
 }
 
@@ -606,8 +1525,16 @@ schedule (void)
   ASSERT (cur->status != THREAD_RUNNING);
   ASSERT (is_thread (next));
 
+  if (cur == idle_thread)
+    timer_idle_end ();
+  if (next != idle_thread)
+    account_latency (next);
   if (cur != next)
-    prev = switch_threads (cur, next);
+    {
+      TRACEPOINT (TP_SCHEDULE, cur->tid, next->tid, 0);
+      trace (TRACE_SWITCH, cur, next);
+      prev = switch_threads (cur, next);
+    }
   thread_schedule_tail (prev);
 }
 
@@ -625,98 +1552,338 @@ allocate_tid (void)
   return tid;
 }
 
+/* Initializes REC as the status record of new thread T, with a
+   reference held by T and one by its parent, and adds it to the
+   tid table.  Interrupts must be off. */
+static void
+init_status (struct child_status *rec, struct thread *t)
+{
+  rec->tid = t->tid;
+  rec->parent_tid = thread_current ()->tid;
+  rec->thread = t;
+  rec->exit_status = -1;
+  rec->exit_ticks = 0;
+  rec->loaded = false;
+  rec->waited = false;
+  rec->exit_queued = false;
+  memset (&rec->usage, 0, sizeof rec->usage);
+  memset (&rec->child_usage, 0, sizeof rec->child_usage);
+  sema_init (&rec->load_sema, 0);
+  sema_init (&rec->exit_sema, 0);
+  rec->ref_cnt = 2;
+  list_push_back (&tid_buckets[t->tid % TID_BUCKET_CNT], &rec->tid_elem);
+  t->status_rec = rec;
+}
+
+/* Returns the status record of thread TID, or a null pointer if it
+   has none.  Interrupts must be off. */
+static struct child_status *
+lookup_status (tid_t tid)
+{
+  struct list *bucket = &tid_buckets[tid % TID_BUCKET_CNT];
+  struct list_elem *e;
+
+  if (tid < 0)
+    return NULL;
+  for (e = list_begin (bucket); e != list_end (bucket); e = list_next (e))
+    {
+      struct child_status *rec = list_entry (e, struct child_status,
+                                             tid_elem);
+      if (rec->tid == tid)
+        return rec;
+    }
+  return NULL;
+}
+
 /* MODIFIED.
-   Return the pointer to the thread whose thread id is tid
+   Return the pointer to the live thread whose thread id is tid.
    Return NULL if not found. */
 struct thread* get_thread (tid_t tid)
 {
-  struct list_elem *elem = list_head(&all_list);
-  struct thread *t;
+  enum intr_level old_level = intr_disable ();
+  struct child_status *rec = lookup_status (tid);
+  struct thread *t = rec != NULL ? rec->thread : NULL;
+  intr_set_level (old_level);
+  return t;
+}
 
-  while ((elem = list_next(elem)) != list_tail(&all_list))
-  {
-    t = list_entry(elem, struct thread, allelem);
+/* Returns the status record of the current thread's child TID, or
+   a null pointer if TID is not a child of the current thread.  The
+   record stays valid until the current thread releases it with
+   thread_release_status() or exits. */
+struct child_status *
+thread_get_child (tid_t tid)
+{
+  enum intr_level old_level = intr_disable ();
+  struct child_status *rec = lookup_status (tid);
+
+  if (rec != NULL && rec->parent_tid != thread_current ()->tid)
+    rec = NULL;
+  intr_set_level (old_level);
+  return rec;
+}
+
+/* Adds REC, the status record of a thread that is exiting, to
+   its parent's exited list, unless the parent has already begun
+   waiting for it or has exited itself.  Interrupts must be off. */
+static void
+queue_exited (struct child_status *rec)
+{
+  struct child_status *parent;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  parent = lookup_status (rec->parent_tid);
+  if (rec->waited || parent == NULL || parent->thread == NULL)
+    return;
+  list_push_back (&parent->thread->exited, &rec->exited_elem);
+  rec->exit_queued = true;
+  sema_up (&parent->thread->child_exited);
+}
+
+/* Removes REC, a child of the running thread, from its exited
+   list, if it is there. */
+void
+thread_unqueue_exited (struct child_status *rec)
+{
+  enum intr_level old_level = intr_disable ();
 
-    if (t->tid == tid)
+  if (rec->exit_queued)
     {
-      return t;
+      list_remove (&rec->exited_elem);
+      rec->exit_queued = false;
     }
-  }
+  intr_set_level (old_level);
+}
 
-  return NULL;
+/* Returns the status record of the child of the running thread
+   that exited first among those not yet waited for, marking it
+   waited for.  If none has exited, waits for one if BLOCK is
+   true, and otherwise returns a null pointer.  Also returns a
+   null pointer, setting *CHILDLESS to true, if there are no
+   children left to wait for; otherwise sets *CHILDLESS to
+   false. */
+struct child_status *
+thread_get_exited_child (bool block, bool *childless)
+{
+  struct thread *cur = thread_current ();
+  struct child_status *rec = NULL;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  for (;;)
+    {
+      struct list_elem *e;
+
+      if (!list_empty (&cur->exited))
+        {
+          rec = list_entry (list_pop_front (&cur->exited),
+                            struct child_status, exited_elem);
+          rec->exit_queued = false;
+          rec->waited = true;
+          *childless = false;
+          break;
+        }
+
+      /* Exits of children waited for by tid also up
+         child_exited, so check again each time. */
+      *childless = true;
+      for (e = list_begin (&cur->children); e != list_end (&cur->children);
+           e = list_next (e))
+        if (!list_entry (e, struct child_status, elem)->waited)
+          {
+            *childless = false;
+            break;
+          }
+      if (*childless || !block)
+        break;
+      sema_down (&cur->child_exited);
+    }
+  intr_set_level (old_level);
+  return rec;
 }
 
-/* notify the thread's children, parent dies */
-void  notify_children()
+/* Drops a reference to REC, freeing it once neither the thread it
+   describes nor that thread's parent refers to it.  A parent that
+   releases the record of one of its children must first remove it
+   from its children list. */
+void
+thread_release_status (struct child_status *rec)
+{
+  enum intr_level old_level = intr_disable ();
+  bool last = --rec->ref_cnt == 0;
+
+  if (last)
+    list_remove (&rec->tid_elem);
+  intr_set_level (old_level);
+  if (last && rec != &initial_status)
+    free (rec);
+}
+
+/* MODIFED.
+   return the file node with given fd, or NULL if fd is not open */
+struct file_node* get_file_node (int fd)
 {
   struct thread *t = thread_current();
-  struct list_elem *elem = list_head(&t->child_list);
-  struct thread *child;
-  while ((elem = list_next(elem)) != list_tail(&t->child_list))
-  {
-    child = list_entry(elem, struct thread, child_elem);
-    child->parentDead = true;
-  }
+
+  if (fd < 2 || fd >= t->fd_cap)
+    return NULL;
+  return t->fd_table[fd];
 }
 
-void  kill_children()
+/* Stores f_node in the lowest free slot of the current thread's
+   fd table, growing the table if it is full, and sets f_node->fd.
+   Returns the new fd, or -1 if memory is exhausted. */
+int add_file_node (struct file_node *f_node)
 {
   struct thread *t = thread_current();
-  struct list_elem *elem = list_head(&t->child_list);
-  struct list_elem *next_elem = list_next(elem);
-  struct thread *child;
-  while ( next_elem != list_tail(&t->child_list))
+  int fd = t->fd_free;
+
+  while (fd < t->fd_cap && t->fd_table[fd] != NULL)
+    fd++;
+  if (fd >= t->fd_cap)
   {
-    elem = next_elem;
-    next_elem = list_next(next_elem);
-    child = list_entry(elem, struct thread, child_elem);
-    if(child->status == THREAD_DYING )
-    {
-      list_remove(elem);
-      palloc_free_page(child);
-    }
+    int cap = t->fd_cap > 0 ? t->fd_cap * 2 : 16;
+    struct file_node **table = realloc(t->fd_table, cap * sizeof *table);
+    if (table == NULL)
+      return -1;
+    memset(table + t->fd_cap, 0, (cap - t->fd_cap) * sizeof *table);
+    t->fd_table = table;
+    t->fd_cap = cap;
   }
+
+  t->fd_table[fd] = f_node;
+  t->fd_free = fd + 1;
+  f_node->fd = fd;
+  return fd;
 }
 
-/* MODIFED.
-   return the file node with given fd */
-struct file_node* get_file_node (int fd)
+/* Clears fd's slot in the current thread's fd table so that the
+   fd can be reused.  Does not close or free the file node. */
+void remove_file_node (int fd)
 {
-  struct list_elem *elem = list_head(&thread_current()->file_list);
-  struct file_node *f_node;
+  struct thread *t = thread_current();
 
-  while ((elem = list_next(elem)) != list_tail(&thread_current()->file_list))
-  {
-    f_node = list_entry(elem, struct file_node, file_elem);
+  ASSERT (get_file_node(fd) != NULL);
+  t->fd_table[fd] = NULL;
+  if (fd < t->fd_free)
+    t->fd_free = fd;
+}
+
+#ifdef USERPROG
+/* Returns a new file node with no file or directory, or a null
+   pointer if memory is not available. */
+struct file_node *
+alloc_file_node (void)
+{
+  struct file_node *f_node = slab_alloc (&file_node_cache);
 
-    if (f_node->fd == fd)
+  if (f_node != NULL)
     {
-      return f_node;
+      f_node->fd = -1;
+      f_node->file = NULL;
+      f_node->dir = NULL;
+      f_node->pipe = NULL;
+      f_node->pipe_writer = false;
+      f_node->proc = NULL;
     }
-  }
+  return f_node;
+}
 
-  return NULL;
+/* Frees F_NODE, which must have been closed and removed from the
+   fd table. */
+void
+free_file_node (struct file_node *f_node)
+{
+  slab_free (&file_node_cache, f_node);
 }
 
 /* MODIFIED.
    close all fds of current thread. */
 void
-delete_fd_list ()
+delete_fd_list (void)
 {
-  struct list_elem *elem = list_head(&thread_current()->file_list);
-  struct file_node *f_node;
+  struct thread *t = thread_current();
+  int fd;
 
-  while ( !list_empty(&thread_current()->file_list)     )
+  for (fd = 2; fd < t->fd_cap; fd++)
   {
-    elem = list_pop_front(&thread_current()->file_list);
-    f_node = list_entry(elem, struct file_node, file_elem);
+    struct file_node *f_node = t->fd_table[fd];
+    if (f_node == NULL)
+      continue;
 
     file_close( f_node->file );
-    free( f_node );
+#ifdef FILESYS
+    dir_close( f_node->dir );
+#endif
+    if (f_node->pipe != NULL)
+      pipe_close (f_node->pipe, f_node->pipe_writer);
+    procfs_close (f_node->proc);
+    free_file_node( f_node );
   }
+  free(t->fd_table);
+  t->fd_table = NULL;
+  t->fd_cap = 0;
+  t->fd_free = 2;
+}
 
-  return NULL;
+/* Gives the current thread, just forked from PARENT, a copy of
+   PARENT's fd table: each open file or directory is reopened at
+   the same fd and position, each pipe end gets another
+   reference, and each file in /proc is copied.  Returns false if memory allocation
+   fails, leaving what was copied for delete_fd_list(). */
+bool
+copy_fd_list (struct thread *parent)
+{
+  struct thread *t = thread_current ();
+  int fd;
+
+  if (parent->fd_cap == 0)
+    return true;
+  t->fd_table = calloc (parent->fd_cap, sizeof *t->fd_table);
+  if (t->fd_table == NULL)
+    return false;
+  t->fd_cap = parent->fd_cap;
+  t->fd_free = parent->fd_free;
+
+  for (fd = 2; fd < parent->fd_cap; fd++)
+  {
+    struct file_node *orig = parent->fd_table[fd];
+    struct file_node *f_node;
+
+    if (orig == NULL)
+      continue;
+    f_node = alloc_file_node ();
+    if (f_node == NULL)
+      return false;
+    f_node->fd = fd;
+    t->fd_table[fd] = f_node;
+    if (orig->pipe != NULL)
+      {
+        pipe_dup (orig->pipe, orig->pipe_writer);
+        f_node->pipe = orig->pipe;
+        f_node->pipe_writer = orig->pipe_writer;
+        continue;
+      }
+    if (orig->proc != NULL)
+      {
+        f_node->proc = procfs_reopen (orig->proc);
+        if (f_node->proc == NULL)
+          return false;
+        continue;
+      }
+    f_node->file = file_reopen (orig->file);
+    if (f_node->file == NULL)
+      return false;
+    file_seek (f_node->file, file_tell (orig->file));
+#ifdef FILESYS
+    if (orig->dir != NULL && (f_node->dir = dir_dup (orig->dir)) == NULL)
+      return false;
+#endif
+  }
+  return true;
 }
+#endif
 
 
 /* Offset of `stack' member within `struct thread'.
@@ -2,9 +2,12 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <hash.h>
 #include <list.h>
 #include <stdint.h>
+#include <syscall-nr.h>
 #include "synch.h"
+#include "threads/fixed-point.h"
 
 /* States in a thread's life cycle. */
 enum thread_status
@@ -25,6 +28,22 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* Thread nice values, for the multi-level feedback queue
+   scheduler. */
+#define NICE_MIN -20                    /* Nicest to other threads. */
+#define NICE_MAX 20                     /* Least nice. */
+
+/* Thread tickets, for the stride scheduler. */
+#define TICKETS_MIN 1                   /* Smallest share. */
+#define TICKETS_DEFAULT 100             /* Share of the initial thread. */
+#define TICKETS_MAX 10000               /* Largest share. */
+
+/* Number of buckets in a thread's scheduling latency histogram. */
+#define SCHED_LATENCY_CNT 16
+
+/* Number of recently looked-up user pages a process remembers. */
+#define PAGE_CACHE_CNT 4
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -88,19 +107,109 @@ struct thread
     enum thread_status status;          /* Thread state. */
     char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
-    int priority;                       /* Priority. */
+    int priority;                       /* Effective priority. */
+    int nice;                           /* Niceness, for mlfqs. */
+    fixed_t recent_cpu;                 /* Recent CPU time, for mlfqs. */
+    int tickets;                        /* CPU share, for stride. */
+    int borrowed_tickets;               /* Tickets taken from parent. */
+    uint64_t pass;                      /* Virtual time, for stride. */
+    int heap_idx;                       /* Index in stride heap, if
+                                           ready under stride. */
+    int64_t dl_runtime;                 /* Ticks reserved per period,
+                                           or 0 if not a deadline
+                                           thread. */
+    int64_t dl_period;                  /* Period, in ticks. */
+    int64_t dl_deadline;                /* End of current period. */
+    int64_t dl_budget;                  /* Ticks left this period. */
+    bool dl_queued;                     /* In the deadline queue? */
+    int base_priority;                  /* Priority before donation. */
+    struct list locks;                  /* Locks held, for donation. */
+    struct lock *waiting_lock;          /* Lock being acquired, if any. */
+    uint64_t ready_tsc;                 /* CPU cycle count when last made
+                                           ready to run. */
+    unsigned latency[SCHED_LATENCY_CNT]; /* Times made ready to run, by
+                                            log2 cycles until run. */
     struct list_elem allelem;           /* List element for all threads list. */
-
-    int fd_index;
-    // hold the open files
-    struct list file_list;
+    struct child_status *status_rec;    /* Shared with parent. */
+    struct list children;               /* Children's child_status. */
+    struct list exited;                 /* Children's child_status,
+                                           once they exit, in order,
+                                           until waited for. */
+    struct semaphore child_exited;      /* Upped as each child exits. */
+
+    // open files, indexed by fd; fds 0 and 1 are never stored
+    struct file_node **fd_table;
+    int fd_cap;            /* Number of slots in fd_table. */
+    int fd_free;           /* No free slot below this fd. */
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
 
+    /* Owned by synch.c. */
+    struct list *wait_list;             /* Wait queue, kept in priority
+                                           order, that T is in, or
+                                           null. */
+    struct list_elem *wait_elem;        /* T's element in wait_list. */
+
+    /* Owned by threads/arena.c. */
+    uint8_t *arena;                     /* Scratch arena, or null. */
+    size_t arena_used;                  /* Bytes of it in use. */
+    unsigned arena_live;                /* Blocks in it not yet freed. */
+
+    /* Owned by lib/kernel/console.c. */
+    struct console_capture *capture;    /* Where console output goes
+                                           instead, or null. */
+
+    /* Shared among thread.c, devices/block.c, vm/page.c and
+       userprog/syscall.c, each updating its own members. */
+    struct rusage rusage;               /* Resource usage. */
+
+    /* Disk scheduling, set by SYS_IOPRIO, inherited by new
+       threads and used by devices/block.c. */
+    unsigned io_weight;                 /* Share of disk bandwidth. */
+    unsigned io_rate;                   /* Most sectors per second,
+                                           or 0 for no cap. */
+
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
+
+    /* Owned by userprog/aio.c. */
+    struct list aio_requests;           /* Asynchronous I/O requests. */
+    int next_aio_ticket;                /* Next request ticket. */
+
+#endif
+
+#ifdef VM
+    /* Owned by vm/page.c, vm/mmap.c and vm/shm.c. */
+    struct hash pages;                  /* Supplemental page table. */
+    struct list mappings;               /* Memory-mapped files. */
+    struct list attachments;            /* Shared memory segments. */
+    int next_mapid;                     /* Next mapping identifier. */
+    int pin_cnt;                        /* Pages pinned by page_pin(). */
+    struct page *page_cache[PAGE_CACHE_CNT]; /* Recent page_lookup()
+                                                results, by page
+                                                number. */
+    void *user_esp;                     /* User stack pointer on entry
+                                           to the current system call. */
+
+    /* Owned by vm/frame.c. */
+    size_t frame_cnt;                   /* Frames charged to the process. */
+    size_t ws_size;                     /* Working set estimate, in
+                                           pages. */
+    size_t ws_sample;                   /* Pages seen accessed in clock
+                                           revolution WS_EPOCH. */
+    unsigned ws_epoch;                  /* Revolution being sampled. */
+#endif
+
+#ifdef FILESYS
+    /* Owned by filesys/filesys.c. */
+    struct dir *cwd;                    /* Working directory, or null
+                                           for the root. */
+
+    /* Owned by filesys/journal.c. */
+    int journal_depth;                  /* Nested journal_begin() calls. */
+    size_t journal_credits;             /* Credits left in its handle. */
 #endif
 
     /* Owned by thread.c. */
@@ -108,29 +217,45 @@ struct thread
 
     /* MODIFIED:  status returned by exit() */
     int return_status;
-    struct list child_list;
-    struct list_elem child_elem;
-
-    /* 0 if its parent is waiting for it. 1 otherwise */
-    struct semaphore child_sema;
-    bool isWaited; // true if waited by its parent
-
-    /* flag to record whether its parent is dead */
-    bool parentDead;
-
-    /* To check whether exec successful */
-    struct semaphore exec_sema;
-    bool success;
 
     /* Executable file of this thread */
     struct file *exec_file;
   };
 
+/* What a thread's parent needs to know about it: whether it
+   loaded and how it exited.  Kept apart from struct thread, so
+   that a thread's page is freed as soon as it dies, and freed
+   when neither the thread nor its parent still refers to it. */
+struct child_status
+  {
+    tid_t tid;                  /* Child's thread identifier. */
+    tid_t parent_tid;           /* Parent's thread identifier. */
+    struct thread *thread;      /* Child, or null once it has died. */
+    int exit_status;            /* Status the child exited with. */
+    int64_t exit_ticks;         /* timer_ticks() when it exited. */
+    bool loaded;                /* Whether the child's program loaded. */
+    bool waited;                /* Whether the parent waited for it. */
+    struct semaphore load_sema; /* Upped when the load has finished. */
+    struct semaphore exit_sema; /* Upped when the child dies. */
+    int ref_cnt;                /* Threads referring to this record. */
+    struct rusage usage;        /* Child's usage, once it has died. */
+    struct rusage child_usage;  /* Usage of the children it has
+                                   waited for, and theirs. */
+    struct list_elem tid_elem;  /* Element in tid hash bucket. */
+    struct list_elem elem;      /* Element in parent's children list. */
+    struct list_elem exited_elem; /* Element in parent's exited list. */
+    bool exit_queued;           /* Whether in parent's exited list. */
+  };
+
 /*file_node contains the information about a file*/
 struct file_node{
   int fd;
   struct file *file;
-  struct list_elem file_elem; 
+  struct dir *dir;        /* Non-null if FILE is a directory. */
+  struct pipe *pipe;      /* Non-null, and FILE null, for a pipe end. */
+  bool pipe_writer;       /* Is PIPE's end the write end? */
+  struct proc_file *proc; /* Non-null, and FILE null, for /proc or a
+                             file in it. */
   };
 
 /* If false (default), use round-robin scheduler.
@@ -138,17 +263,25 @@ struct file_node{
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
+/* If true, use the stride scheduler instead.
+   Controlled by kernel command-line option "-stride". */
+extern bool thread_stride;
+
 void thread_init (void);
 void thread_start (void);
 
-void thread_tick (void);
+void thread_tick (bool user);
+void thread_tick_idle (int ticks);
+void thread_add_rusage (struct rusage *, const struct rusage *);
 void thread_print_stats (void);
+void thread_dump_trace (void);
 
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
 
 void thread_block (void);
 void thread_unblock (struct thread *);
+void thread_preempt (void);
 
 struct thread *thread_current (void);
 tid_t thread_tid (void);
@@ -163,13 +296,27 @@ void thread_foreach (thread_action_func *, void *);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
+void thread_donate_priority (struct thread *, int priority);
+void thread_update_priority (struct thread *);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
+int thread_get_tickets (void);
+void thread_set_tickets (int);
+bool thread_set_deadline (int64_t runtime, int64_t period);
 int thread_get_recent_cpu (void);
 int thread_get_load_avg (void);
 
 struct thread* get_thread (tid_t);
+struct child_status *thread_get_child (tid_t);
+struct child_status *thread_get_exited_child (bool block, bool *childless);
+void thread_unqueue_exited (struct child_status *);
+void thread_release_status (struct child_status *);
 struct file_node* get_file_node (int);
+int add_file_node (struct file_node *);
+void remove_file_node (int);
+struct file_node *alloc_file_node (void);
+void free_file_node (struct file_node *);
+bool copy_fd_list (struct thread *parent);
 
 #endif /* threads/thread.h */
@@ -0,0 +1,142 @@
+#include "threads/tracepoint.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Static tracepoints.
+
+   A TRACEPOINT() in the code is a named site that, while its
+   entry in tracepoint_enabled is set, records an event with the
+   CPU's cycle count and three arguments into a ring of the most
+   recent TP_RECORD_CNT events.  Sites are enabled at boot with
+   "-trace", and tracepoint_dump() prints the ring at shutdown,
+   one event per line, each starting with "tracepoint:".
+
+   Only one processor ever runs (see struct cpu in thread.c), so
+   the ring belongs to it, and claiming and filling a slot with
+   interrupts off makes recording atomic without a lock.  Events
+   from before tracepoint_init() are dropped. */
+
+/* Number of events kept. */
+#define TP_PAGES 16
+#define TP_RECORD_CNT (TP_PAGES * PGSIZE / sizeof (struct tp_record))
+
+bool tracepoint_enabled[TP_CNT];
+
+/* Names of the sites, as "-trace" gives them. */
+static const char *site_names[TP_CNT] =
+  {
+    "block_read", "block_write", "inode_read", "inode_write", "schedule",
+    "page_fault", "syscall", "palloc_get", "palloc_free",
+  };
+
+/* One event. */
+struct tp_record
+  {
+    uint64_t tsc;               /* CPU cycle count. */
+    uint32_t site;              /* enum tracepoint_site. */
+    uint32_t args[3];           /* Arguments. */
+  };
+
+static struct tp_record *records; /* Ring, indexed by record_cnt. */
+static unsigned record_cnt;     /* Events ever recorded. */
+
+/* Enables the sites named in NAMES, a comma-separated list, or
+   every site if NAMES is "all".  Returns false, enabling nothing,
+   if NAMES names an unknown site. */
+bool
+tracepoint_enable (const char *names)
+{
+  bool enable[TP_CNT];
+  const char *p = names;
+  int i;
+
+  memset (enable, 0, sizeof enable);
+  if (!strcmp (names, "all"))
+    memset (enable, 1, sizeof enable);
+  else
+    while (*p != '\0')
+      {
+        const char *comma = strchr (p, ',');
+        size_t len = comma != NULL ? (size_t) (comma - p) : strlen (p);
+
+        for (i = 0; i < TP_CNT; i++)
+          if (strlen (site_names[i]) == len && !memcmp (site_names[i], p, len))
+            break;
+        if (i == TP_CNT)
+          return false;
+        enable[i] = true;
+        p += len + (comma != NULL);
+      }
+
+  for (i = 0; i < TP_CNT; i++)
+    tracepoint_enabled[i] |= enable[i];
+  return true;
+}
+
+/* Allocates the event ring, if any site is enabled. */
+void
+tracepoint_init (void)
+{
+  int i;
+
+  for (i = 0; i < TP_CNT && !tracepoint_enabled[i]; i++)
+    continue;
+  if (i == TP_CNT)
+    return;
+  records = palloc_get_multiple (PAL_ZERO, TP_PAGES);
+  if (records == NULL)
+    {
+      printf ("tracepoint: no memory for events; tracing disabled\n");
+      memset (tracepoint_enabled, 0, sizeof tracepoint_enabled);
+    }
+}
+
+/* Records an event at SITE with arguments A, B and C.  Called
+   through TRACEPOINT(), from any context. */
+void
+tracepoint_record (enum tracepoint_site site, uint32_t a, uint32_t b,
+                   uint32_t c)
+{
+  enum intr_level old_level;
+  struct tp_record *r;
+
+  if (records == NULL)
+    return;
+  old_level = intr_disable ();
+  r = &records[record_cnt++ % TP_RECORD_CNT];
+  r->tsc = timer_tsc ();
+  r->site = site;
+  r->args[0] = a;
+  r->args[1] = b;
+  r->args[2] = c;
+  intr_set_level (old_level);
+}
+
+/* Prints the events in the ring, oldest first, one per line as
+   "tracepoint: NS SITE A B C", with the time-stamp counter in
+   nanoseconds and the arguments in hex.  Tracing is turned off first, so
+   that printing does not overwrite the events being printed. */
+void
+tracepoint_dump (void)
+{
+  unsigned i, first, end;
+
+  if (records == NULL)
+    return;
+  memset (tracepoint_enabled, 0, sizeof tracepoint_enabled);
+  end = record_cnt;
+  first = end > TP_RECORD_CNT ? end - TP_RECORD_CNT : 0;
+  printf ("tracepoint: %u events, %u kept\n", end, end - first);
+  for (i = first; i != end; i++)
+    {
+      struct tp_record *r = &records[i % TP_RECORD_CNT];
+      printf ("tracepoint: %llu %s %#"PRIx32" %#"PRIx32" %#"PRIx32"\n",
+              timer_tsc_to_ns (r->tsc), site_names[r->site],
+              r->args[0], r->args[1], r->args[2]);
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef THREADS_TRACEPOINT_H
+#define THREADS_TRACEPOINT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Static trace sites, each recording three arguments.
+   Must agree with site_names[] in tracepoint.c. */
+enum tracepoint_site
+  {
+    TP_BLOCK_READ,              /* Sector, count, block type. */
+    TP_BLOCK_WRITE,             /* Sector, count, block type. */
+    TP_INODE_READ,              /* Inumber, offset, size. */
+    TP_INODE_WRITE,             /* Inumber, offset, size. */
+    TP_SCHEDULE,                /* Tid switched from, to, 0. */
+    TP_PAGE_FAULT,              /* Address, eip, error code. */
+    TP_SYSCALL,                 /* Number, tid, 0. */
+    TP_PALLOC_GET,              /* Pages, count, flags. */
+    TP_PALLOC_FREE,             /* Pages, count, 0. */
+    TP_CNT                      /* Number of sites. */
+  };
+
+/* Whether each site records events.  Set by the kernel command
+   line option "-trace". */
+extern bool tracepoint_enabled[TP_CNT];
+
+bool tracepoint_enable (const char *names);
+void tracepoint_init (void);
+void tracepoint_record (enum tracepoint_site, uint32_t, uint32_t, uint32_t);
+void tracepoint_dump (void);
+
+/* Records an event at SITE with arguments A, B and C, if SITE is
+   enabled.  A disabled site costs one load and one branch, which
+   the compiler lays out as not taken. */
+#define TRACEPOINT(SITE, A, B, C)                                       \
+        do                                                              \
+          {                                                             \
+            if (__builtin_expect (tracepoint_enabled[SITE], 0))         \
+              tracepoint_record (SITE, (uint32_t) (A), (uint32_t) (B),  \
+                                 (uint32_t) (C));                       \
+          }                                                             \
+        while (0)
+
+#endif /* threads/tracepoint.h */
@@ -0,0 +1,118 @@
+#include "threads/workqueue.h"
+#include <debug.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Work queues.
+
+   Background jobs are queued as struct work and run by a fixed
+   pool of WORKER_CNT kernel threads, instead of each job getting
+   a thread of its own.  There is one FIFO queue per priority
+   class.  The queues are protected by disabling interrupts, so
+   that work may be queued from an interrupt handler.
+
+   A work item is queued at most once at a time: queuing it again
+   before a worker takes it does nothing, so a job that drains
+   some queue of its own may be queued on every addition to it.
+   Once a worker has taken it, it may be queued again, and may
+   then run on a second worker while the first is still running
+   it. */
+
+#define WORKER_CNT 2
+
+/* Thread priority at which each class runs. */
+static const int class_priority[WORK_CLASS_CNT] =
+  {
+    PRI_DEFAULT + 2,            /* WORK_HIGH. */
+    PRI_DEFAULT,                /* WORK_NORMAL. */
+    PRI_DEFAULT - 2,            /* WORK_LOW. */
+  };
+
+static struct list queues[WORK_CLASS_CNT];
+static struct semaphore work_sema;      /* Up'd once per queued work. */
+
+/* Statistics. */
+static unsigned long long queued_cnt[WORK_CLASS_CNT];
+
+static thread_func worker NO_RETURN;
+
+/* Initializes the work queues and starts the worker threads. */
+void
+workqueue_init (void)
+{
+  int i;
+
+  for (i = 0; i < WORK_CLASS_CNT; i++)
+    list_init (&queues[i]);
+  sema_init (&work_sema, 0);
+  for (i = 0; i < WORKER_CNT; i++)
+    {
+      char name[16];
+
+      snprintf (name, sizeof name, "worker%d", i);
+      thread_create (name, class_priority[WORK_NORMAL], worker, NULL);
+    }
+}
+
+/* Initializes W to run FUNC (AUX) each time it is queued. */
+void
+work_init (struct work *w, work_func *func, void *aux)
+{
+  w->func = func;
+  w->aux = aux;
+  w->queued = false;
+}
+
+/* Queues W in class CLASS, unless it is already queued.  May be
+   called from an interrupt handler. */
+void
+work_queue (struct work *w, enum work_class class)
+{
+  enum intr_level old_level;
+
+  ASSERT (class < WORK_CLASS_CNT);
+
+  old_level = intr_disable ();
+  if (!w->queued)
+    {
+      w->queued = true;
+      list_push_back (&queues[class], &w->elem);
+      queued_cnt[class]++;
+      sema_up (&work_sema);
+    }
+  intr_set_level (old_level);
+}
+
+/* Worker thread.  Runs queued work, highest class first. */
+static void
+worker (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct work *w;
+      enum intr_level old_level;
+      int class;
+
+      sema_down (&work_sema);
+      old_level = intr_disable ();
+      for (class = 0; list_empty (&queues[class]); class++)
+        ASSERT (class < WORK_CLASS_CNT - 1);
+      w = list_entry (list_pop_front (&queues[class]), struct work, elem);
+      w->queued = false;
+      intr_set_level (old_level);
+
+      thread_set_priority (class_priority[class]);
+      w->func (w->aux);
+    }
+}
+
+/* Prints work queue statistics. */
+void
+workqueue_print_stats (void)
+{
+  printf ("Workqueue: %llu high, %llu normal, %llu low priority jobs\n",
+          queued_cnt[WORK_HIGH], queued_cnt[WORK_NORMAL],
+          queued_cnt[WORK_LOW]);
+}
@@ -0,0 +1,33 @@
+#ifndef THREADS_WORKQUEUE_H
+#define THREADS_WORKQUEUE_H
+
+#include <list.h>
+#include <stdbool.h>
+
+/* Priority classes for queued work.  Workers always take work
+   from the highest nonempty class, and run it at that class's
+   thread priority. */
+enum work_class
+  {
+    WORK_HIGH,                  /* Latency matters, e.g. swap-out. */
+    WORK_NORMAL,                /* Ordinary background jobs. */
+    WORK_LOW,                   /* Speculative work, e.g. read-ahead. */
+    WORK_CLASS_CNT
+  };
+
+/* A job for the worker threads. */
+typedef void work_func (void *aux);
+struct work
+  {
+    struct list_elem elem;      /* Element in a class's queue. */
+    work_func *func;            /* Function to run. */
+    void *aux;                  /* Argument for FUNC. */
+    bool queued;                /* In a queue? */
+  };
+
+void workqueue_init (void);
+void work_init (struct work *, work_func *, void *aux);
+void work_queue (struct work *, enum work_class);
+void workqueue_print_stats (void);
+
+#endif /* threads/workqueue.h */
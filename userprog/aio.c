@@ -0,0 +1,212 @@
+#include "userprog/aio.h"
+#include <debug.h>
+#include <list.h>
+#include <stdio.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "threads/workqueue.h"
+#include "userprog/syscall.h"
+
+/* Asynchronous file I/O.
+
+   aio_submit() starts a read or write of an open file and returns
+   a ticket at once; the transfer runs on a worker thread of the
+   work queue while the process goes on computing.  A worker has no
+   access to the process's memory, so each request moves its data
+   through a kernel buffer: a write's data is copied in when it is
+   submitted, and a read's is copied out by aio_wait(), in the
+   process that asked for it.  Each request also has a handle of
+   its own on the file, so that closing the file descriptor does
+   not pull the file out from under it.  Because the buffer is
+   kernel memory, a large transfer also goes straight between it
+   and the disk, without the bounce pages that the file system
+   copies a user buffer through. */
+
+/* Largest transfer one request may make, in bytes. */
+#define AIO_MAX_SIZE (64 * 1024)
+
+/* Most requests one process may have outstanding. */
+#define AIO_MAX_PENDING 16
+
+/* An asynchronous read or write. */
+struct aio_request
+  {
+    int ticket;                 /* Identifier returned to the user. */
+    bool write;                 /* Write rather than read? */
+    struct file *file;          /* Private handle on the file. */
+    off_t ofs;                  /* File offset. */
+    void *ubuf;                 /* User buffer, for reads. */
+    size_t size;                /* Bytes to transfer. */
+    void *buffer;               /* SIZE-byte kernel buffer. */
+    off_t result;               /* Bytes transferred, once done. */
+    bool done;                  /* Finished by the worker? */
+    struct semaphore done_sema; /* Upped when DONE is set. */
+    struct work work;           /* Queued on the work queue. */
+    struct list_elem elem;      /* Element in thread's `aio_requests'. */
+  };
+
+/* Statistics. */
+static unsigned long long read_cnt;     /* Reads submitted. */
+static unsigned long long write_cnt;    /* Writes submitted. */
+static unsigned long long stall_cnt;    /* Waits that had to block. */
+
+static work_func aio_run;
+
+/* Starts reading or writing SIZE bytes of FILE at OFS, from or into
+   user buffer UBUF, and returns the request's ticket.  A write's
+   data is copied out of UBUF at once; a read's is copied into it
+   by aio_wait().  Returns -1 if SIZE or OFS is out of range, the
+   process has too many requests outstanding, memory allocation
+   fails, or a write's buffer cannot be read. */
+int
+aio_submit (struct file *file, bool write, void *ubuf, size_t size,
+            off_t ofs)
+{
+  struct thread *t = thread_current ();
+  struct aio_request *r;
+
+  if (size > AIO_MAX_SIZE || ofs < 0
+      || list_size (&t->aio_requests) >= AIO_MAX_PENDING)
+    return -1;
+  r = malloc (sizeof *r);
+  if (r == NULL)
+    return -1;
+  r->buffer = malloc (size > 0 ? size : 1);
+  r->file = file_reopen (file);
+  if (r->buffer == NULL || r->file == NULL
+      || (write && !copy_from_user (r->buffer, ubuf, size)))
+    {
+      file_close (r->file);
+      free (r->buffer);
+      free (r);
+      return -1;
+    }
+  r->ticket = t->next_aio_ticket++;
+  r->write = write;
+  r->ofs = ofs;
+  r->ubuf = ubuf;
+  r->size = size;
+  r->result = 0;
+  r->done = false;
+  sema_init (&r->done_sema, 0);
+  list_push_back (&t->aio_requests, &r->elem);
+  if (write)
+    write_cnt++;
+  else
+    read_cnt++;
+
+  work_init (&r->work, aio_run, r);
+  work_queue (&r->work, WORK_NORMAL);
+  return r->ticket;
+}
+
+/* Carries out request R_, on a worker thread. */
+static void
+aio_run (void *r_)
+{
+  struct aio_request *r = r_;
+
+  ASSERT (is_kernel_vaddr (r->buffer));
+  if (r->write)
+    r->result = file_write_at (r->file, r->buffer, r->size, r->ofs);
+  else
+    r->result = file_read_at (r->file, r->buffer, r->size, r->ofs);
+  r->done = true;
+  sema_up (&r->done_sema);
+}
+
+/* Returns the running process's request with TICKET, or a null
+   pointer if there is none. */
+static struct aio_request *
+lookup (int ticket)
+{
+  struct list *requests = &thread_current ()->aio_requests;
+  struct list_elem *e;
+
+  for (e = list_begin (requests); e != list_end (requests);
+       e = list_next (e))
+    {
+      struct aio_request *r = list_entry (e, struct aio_request, elem);
+      if (r->ticket == ticket)
+        return r;
+    }
+  return NULL;
+}
+
+/* Returns 1 if request TICKET has finished, 0 if it is still
+   running, or -1 if there is no such request. */
+int
+aio_poll (int ticket)
+{
+  struct aio_request *r = lookup (ticket);
+
+  if (r == NULL)
+    return -1;
+  return r->done;
+}
+
+/* Waits for request R to finish. */
+static void
+wait_done (struct aio_request *r)
+{
+  if (!r->done)
+    stall_cnt++;
+  sema_down (&r->done_sema);
+}
+
+/* Frees finished request R. */
+static void
+release (struct aio_request *r)
+{
+  list_remove (&r->elem);
+  file_close (r->file);
+  free (r->buffer);
+  free (r);
+}
+
+/* Waits for request TICKET to finish, copies a read's data into
+   its user buffer, and returns the number of bytes transferred.
+   The ticket is then no longer valid.  Returns -1 if there is no
+   such request or a read's buffer cannot be written. */
+int
+aio_wait (int ticket)
+{
+  struct aio_request *r = lookup (ticket);
+  int result;
+
+  if (r == NULL)
+    return -1;
+  wait_done (r);
+  result = r->result;
+  if (!r->write && !copy_to_user (r->ubuf, r->buffer, result))
+    result = -1;
+  release (r);
+  return result;
+}
+
+/* Waits for every request of the running process and frees them,
+   at exit. */
+void
+aio_wait_all (void)
+{
+  struct list *requests = &thread_current ()->aio_requests;
+
+  while (!list_empty (requests))
+    {
+      struct aio_request *r = list_entry (list_front (requests),
+                                          struct aio_request, elem);
+      wait_done (r);
+      release (r);
+    }
+}
+
+/* Prints asynchronous I/O statistics. */
+void
+aio_print_stats (void)
+{
+  printf ("Async I/O: %llu reads, %llu writes, %llu waits blocked\n",
+          read_cnt, write_cnt, stall_cnt);
+}
@@ -0,0 +1,17 @@
+#ifndef USERPROG_AIO_H
+#define USERPROG_AIO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+struct file;
+
+int aio_submit (struct file *, bool write, void *ubuf, size_t size,
+                off_t ofs);
+int aio_poll (int ticket);
+int aio_wait (int ticket);
+void aio_wait_all (void);
+void aio_print_stats (void);
+
+#endif /* userprog/aio.h */
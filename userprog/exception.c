@@ -4,6 +4,10 @@
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/tracepoint.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -11,6 +15,9 @@ static long long page_fault_cnt;
 static void kill (struct intr_frame *);
 static void page_fault (struct intr_frame *);
 
+/* Instructions in userprog/syscall.c that probe user memory. */
+extern char user_access_get[], user_access_put[];
+
 /* Registers handlers for interrupts that can be caused by user
    programs.
 
@@ -135,6 +142,7 @@ page_fault (struct intr_frame *f)
      [IA32-v3a] 5.15 "Interrupt 14--Page Fault Exception
      (#PF)". */
   asm ("movl %%cr2, %0" : "=r" (fault_addr));
+  TRACEPOINT (TP_PAGE_FAULT, fault_addr, f->eip, f->error_code);
 
   /* Turn interrupts back on (they were only off so that we could
      be assured of reading CR2 before it changed). */
@@ -148,6 +156,38 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+#ifdef VM
+  /* A user page that is not resident yet, touched by the process
+     itself or by one of the kernel's probes below, is brought in,
+     and the stack grows on demand.  In the kernel, f->esp is the
+     kernel stack, so use the user's from system call entry. */
+  if (not_present
+      && (user || (void *) f->eip == user_access_get
+          || (void *) f->eip == user_access_put)
+      && page_fault_in (fault_addr, user ? f->esp
+                                          : thread_current ()->user_esp,
+                        write))
+    return;
+
+  /* A write to a page still shared copy-on-write since fork()
+     gives the writer its own copy. */
+  if (!not_present && write
+      && (user || (void *) f->eip == user_access_put)
+      && page_write_fault (fault_addr))
+    return;
+#endif
+
+  /* A fault on one of the kernel's user-memory probes is not fatal:
+     resume after the probe with -1 in eax, as get_user() and
+     put_user() expect. */
+  if (!user && ((void *) f->eip == user_access_get
+                || (void *) f->eip == user_access_put))
+    {
+      f->eip = (void (*) (void)) f->eax;
+      f->eax = 0xffffffff;
+      return;
+    }
+
   /* To implement virtual memory, delete the rest of the function
      body, and replace it with code that brings in the page to
      which fault_addr refers. */
@@ -0,0 +1,149 @@
+#include "userprog/futex.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/syscall.h"
+#ifdef VM
+#include "vm/shm.h"
+#endif
+
+/* Futexes: wait queues keyed by a user address, on which a user
+   program sleeps until another thread changes the word there and
+   wakes it.  A lock built on them takes no system call unless it
+   is contended.
+
+   A word in shared memory is keyed by its page's identity and its
+   offset in the page, so that every process attached to the
+   segment finds the same queue whatever address it is mapped at.
+   Any other word is private to its process and keyed by page
+   directory and address. */
+
+/* Number of buckets in the wait queue hash. */
+#define FUTEX_BUCKETS 64
+
+/* Identifies a futex. */
+struct futex_key
+  {
+    const void *space;          /* Shared page or page directory. */
+    uintptr_t addr;             /* Offset in page or user address. */
+  };
+
+/* A thread waiting on a futex. */
+struct futex_waiter
+  {
+    struct futex_key key;       /* Futex waited on. */
+    struct semaphore sema;      /* Upped to wake the thread. */
+    struct list_elem elem;      /* Element in a bucket. */
+  };
+
+/* Waiters, hashed by key.  futex_lock protects them, and is held
+   from a waiter's check of the word until it is queued, so that a
+   wakeup cannot slip in between. */
+static struct list buckets[FUTEX_BUCKETS];
+static struct lock futex_lock;
+
+/* Statistics. */
+static unsigned long long wait_cnt;     /* Threads put to sleep. */
+static unsigned long long wake_cnt;     /* Threads woken. */
+
+/* Initializes the futex wait queues. */
+void
+futex_init (void)
+{
+  size_t i;
+
+  for (i = 0; i < FUTEX_BUCKETS; i++)
+    list_init (&buckets[i]);
+  lock_init (&futex_lock);
+}
+
+/* Stores in *KEY the key for the futex at UADDR in the running
+   process. */
+static void
+make_key (const int *uaddr, struct futex_key *key)
+{
+#ifdef VM
+  key->space = shm_page_id (uaddr);
+  if (key->space != NULL)
+    {
+      key->addr = pg_ofs (uaddr);
+      return;
+    }
+#endif
+  key->space = thread_current ()->pagedir;
+  key->addr = (uintptr_t) uaddr;
+}
+
+/* Returns the bucket for KEY. */
+static struct list *
+bucket (const struct futex_key *key)
+{
+  return &buckets[hash_bytes (key, sizeof *key) % FUTEX_BUCKETS];
+}
+
+/* If the word at UADDR, which must be aligned, holds VAL, sleeps
+   until futex_wake() is called on it.  Returns false at once if it
+   holds another value or cannot be read. */
+bool
+futex_wait (int *uaddr, int val)
+{
+  struct futex_waiter w;
+  int cur;
+
+  lock_acquire (&futex_lock);
+  if (!copy_from_user (&cur, uaddr, sizeof cur) || cur != val)
+    {
+      lock_release (&futex_lock);
+      return false;
+    }
+  make_key (uaddr, &w.key);
+  sema_init (&w.sema, 0);
+  list_push_back (bucket (&w.key), &w.elem);
+  wait_cnt++;
+  lock_release (&futex_lock);
+
+  sema_down (&w.sema);
+  return true;
+}
+
+/* Wakes up to CNT threads waiting on the futex at UADDR, in the
+   order they started waiting, and returns the number woken. */
+int
+futex_wake (int *uaddr, int cnt)
+{
+  struct futex_key key;
+  struct list *b;
+  struct list_elem *e;
+  int woken = 0;
+
+  lock_acquire (&futex_lock);
+  make_key (uaddr, &key);
+  b = bucket (&key);
+  for (e = list_begin (b); e != list_end (b) && woken < cnt; )
+    {
+      struct futex_waiter *w = list_entry (e, struct futex_waiter, elem);
+      if (w->key.space == key.space && w->key.addr == key.addr)
+        {
+          e = list_remove (e);
+          sema_up (&w->sema);
+          woken++;
+        }
+      else
+        e = list_next (e);
+    }
+  wake_cnt += woken;
+  lock_release (&futex_lock);
+  return woken;
+}
+
+/* Prints futex statistics. */
+void
+futex_print_stats (void)
+{
+  printf ("Futexes: %llu waits, %llu wakeups\n", wait_cnt, wake_cnt);
+}
@@ -0,0 +1,11 @@
+#ifndef USERPROG_FUTEX_H
+#define USERPROG_FUTEX_H
+
+#include <stdbool.h>
+
+void futex_init (void);
+bool futex_wait (int *uaddr, int val);
+int futex_wake (int *uaddr, int cnt);
+void futex_print_stats (void);
+
+#endif /* userprog/futex.h */
@@ -0,0 +1,208 @@
+#include "userprog/image.h"
+#include <debug.h>
+#include <list.h>
+#include <stdio.h>
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Executable image cache.
+
+   load() reads and validates an executable's ELF header and
+   program headers on every exec.  The result is remembered here,
+   keyed by the executable's inode, so that running the same
+   program again skips straight to mapping its segments.
+
+   Each entry holds its inode open, so that the in-memory inode,
+   and with it the inode's count of writes, lives as long as the
+   entry.  An entry whose inode has been written since is
+   discarded on sight.  Removing a file drops its entry at once,
+   through image_forget(), so that the cache does not keep a
+   removed executable's blocks allocated.
+
+   Entries are unlinked under the image lock but their inodes are
+   closed only after it is released, because the last close of a
+   removed inode starts a journal transaction and a thread in
+   dir_remove() may be waiting for the lock in the middle of one. */
+
+/* Most executables remembered at once. */
+#define IMAGE_CACHE_SIZE 16
+
+struct image_entry
+  {
+    struct list_elem elem;      /* Element in images, most recent first. */
+    struct inode *inode;        /* Executable, held open. */
+    unsigned write_gen;         /* inode_write_gen() when parsed. */
+    struct image image;         /* Parsed headers. */
+  };
+
+static struct list images;
+static size_t image_cnt;
+static struct lock image_lock;
+
+/* Statistics. */
+static unsigned long long hit_cnt;      /* Lookups that found an image. */
+static unsigned long long miss_cnt;     /* Lookups that did not. */
+static unsigned long long stale_cnt;    /* Images dropped after writes. */
+
+/* Initializes the executable image cache. */
+void
+image_init (void)
+{
+  list_init (&images);
+  lock_init (&image_lock);
+}
+
+/* Unlinks entry E and adds it to DEAD, to be passed to
+   reap() once the image lock is released.  The image lock must
+   be held. */
+static void
+drop (struct image_entry *e, struct list *dead)
+{
+  list_remove (&e->elem);
+  image_cnt--;
+  list_push_back (dead, &e->elem);
+}
+
+/* Closes the inodes of and frees the entries in DEAD.  The image
+   lock must not be held. */
+static void
+reap (struct list *dead)
+{
+  while (!list_empty (dead))
+    {
+      struct image_entry *e = list_entry (list_pop_front (dead),
+                                          struct image_entry, elem);
+      inode_close (e->inode);
+      free (e);
+    }
+}
+
+/* Returns true if entry E no longer describes its file. */
+static bool
+is_stale (const struct image_entry *e)
+{
+  return (inode_is_removed (e->inode)
+          || e->write_gen != inode_write_gen (e->inode));
+}
+
+/* Looks up the parsed headers of the executable in INODE.  If
+   they are cached and the file has not been written since,
+   copies them into *IMAGE and returns true.  Otherwise returns
+   false.  Also drops every other entry that is out of date. */
+bool
+image_lookup (struct inode *inode, struct image *image)
+{
+  struct list_elem *el, *next;
+  struct list dead;
+  bool found = false;
+
+  list_init (&dead);
+  lock_acquire (&image_lock);
+  for (el = list_begin (&images); el != list_end (&images); el = next)
+    {
+      struct image_entry *e = list_entry (el, struct image_entry, elem);
+
+      next = list_next (el);
+      if (is_stale (e))
+        {
+          stale_cnt++;
+          drop (e, &dead);
+        }
+      else if (e->inode == inode)
+        {
+          *image = e->image;
+          list_remove (&e->elem);
+          list_push_front (&images, &e->elem);
+          found = true;
+        }
+    }
+  if (found)
+    hit_cnt++;
+  else
+    miss_cnt++;
+  lock_release (&image_lock);
+  reap (&dead);
+  return found;
+}
+
+/* Remembers IMAGE as the parsed headers of the executable in
+   INODE, as they are now, replacing the least recently used entry
+   if the cache is full.  Does nothing if memory is short. */
+void
+image_insert (struct inode *inode, const struct image *image)
+{
+  struct image_entry *e = malloc (sizeof *e);
+  struct list_elem *el;
+  struct list dead;
+
+  if (e == NULL)
+    return;
+  e->inode = inode_reopen (inode);
+  e->write_gen = inode_write_gen (inode);
+  e->image = *image;
+
+  list_init (&dead);
+  lock_acquire (&image_lock);
+  for (el = list_begin (&images); el != list_end (&images);
+       el = list_next (el))
+    if (list_entry (el, struct image_entry, elem)->inode == inode)
+      {
+        /* Another exec of the same file got here first. */
+        drop (list_entry (el, struct image_entry, elem), &dead);
+        break;
+      }
+  if (image_cnt >= IMAGE_CACHE_SIZE)
+    drop (list_entry (list_back (&images), struct image_entry, elem),
+          &dead);
+  list_push_front (&images, &e->elem);
+  image_cnt++;
+  lock_release (&image_lock);
+  reap (&dead);
+}
+
+/* Drops the entry for INODE, if there is one.  Called when
+   INODE's file is removed, so that the cache does not hold it
+   open. */
+void
+image_forget (struct inode *inode)
+{
+  struct list_elem *el;
+  struct list dead;
+
+  list_init (&dead);
+  lock_acquire (&image_lock);
+  for (el = list_begin (&images); el != list_end (&images);
+       el = list_next (el))
+    if (list_entry (el, struct image_entry, elem)->inode == inode)
+      {
+        drop (list_entry (el, struct image_entry, elem), &dead);
+        break;
+      }
+  lock_release (&image_lock);
+  reap (&dead);
+}
+
+/* Drops every entry, closing the inodes they hold.  Must be
+   called before the file system shuts down. */
+void
+image_flush (void)
+{
+  struct list dead;
+
+  list_init (&dead);
+  lock_acquire (&image_lock);
+  while (!list_empty (&images))
+    drop (list_entry (list_front (&images), struct image_entry, elem),
+          &dead);
+  lock_release (&image_lock);
+  reap (&dead);
+}
+
+/* Prints executable image cache statistics. */
+void
+image_print_stats (void)
+{
+  printf ("Exec images: %llu hits, %llu misses, %llu stale\n",
+          hit_cnt, miss_cnt, stale_cnt);
+}
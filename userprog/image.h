@@ -0,0 +1,41 @@
+#ifndef USERPROG_IMAGE_H
+#define USERPROG_IMAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct inode;
+
+/* Most loadable segments in an executable. */
+#define IMAGE_SEGMENT_MAX 16
+
+/* One loadable segment of an executable, as load_segment()
+   wants it: page-aligned offsets and byte counts that cover
+   whole pages. */
+struct image_segment
+  {
+    uint32_t file_page;         /* Offset in file, page-aligned. */
+    uint32_t mem_page;          /* User virtual address. */
+    uint32_t read_bytes;        /* Bytes to read from the file. */
+    uint32_t zero_bytes;        /* Bytes to zero after them. */
+    bool writable;              /* Writable by the process? */
+  };
+
+/* What load() learns from an executable's ELF headers once they
+   have been read and validated. */
+struct image
+  {
+    uint32_t entry;                     /* Entry point. */
+    size_t segment_cnt;                 /* Number of segments. */
+    struct image_segment segments[IMAGE_SEGMENT_MAX];
+  };
+
+void image_init (void);
+bool image_lookup (struct inode *, struct image *);
+void image_insert (struct inode *, const struct image *);
+void image_forget (struct inode *);
+void image_flush (void);
+void image_print_stats (void);
+
+#endif /* userprog/image.h */
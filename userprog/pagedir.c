@@ -7,26 +7,62 @@
 #include "threads/palloc.h"
 
 static uint32_t *active_pd (void);
+static void load_pagedir (uint32_t *);
 static void invalidate_pagedir (uint32_t *);
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
    Returns the new page directory, or a null pointer if memory
-   allocation fails. */
+   allocation fails.
+
+   The kernel's page tables, and its 4 MB pages, are shared with
+   init_page_dir: only the directory entries that map RAM are
+   copied, and page tables for user addresses are allocated as
+   they are first needed, by lookup_page(). */
 uint32_t *
 pagedir_create (void) 
 {
-  uint32_t *pd = palloc_get_page (0);
+  uint32_t *pd = palloc_get_page (PAL_ZERO);
   if (pd != NULL)
-    memcpy (pd, init_page_dir, PGSIZE);
+    {
+      size_t first = pd_no (PHYS_BASE);
+      size_t last = pd_no (ptov (init_ram_pages * PGSIZE - 1));
+      memcpy (pd + first, init_page_dir + first,
+              (last - first + 1) * sizeof *pd);
+    }
   return pd;
 }
 
+/* A run of physically consecutive pages waiting to be freed. */
+struct page_run
+  {
+    uint8_t *start;             /* First page. */
+    size_t cnt;                 /* Number of pages. */
+  };
+
+/* Adds PAGE to the pages that R frees, freeing R's run first if
+   PAGE does not extend it. */
+static void
+run_add (struct page_run *r, void *page)
+{
+  if (r->cnt > 0 && page == r->start + r->cnt * PGSIZE)
+    r->cnt++;
+  else
+    {
+      palloc_free_multiple (r->start, r->cnt);
+      r->start = page;
+      r->cnt = 1;
+    }
+}
+
 /* Destroys page directory PD, freeing all the pages it
-   references. */
+   references.  Pages are handed back to the allocator in runs of
+   consecutive physical pages, which loaded processes tend to
+   have, rather than one at a time. */
 void
 pagedir_destroy (uint32_t *pd) 
 {
+  struct page_run frames = {NULL, 0}, tables = {NULL, 0};
   uint32_t *pde;
 
   if (pd == NULL)
@@ -41,9 +77,11 @@ pagedir_destroy (uint32_t *pd)
         
         for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
           if (*pte & PTE_P) 
-            palloc_free_page (pte_get_page (*pte));
-        palloc_free_page (pt);
+            run_add (&frames, pte_get_page (*pte));
+        run_add (&tables, pt);
       }
+  palloc_free_multiple (frames.start, frames.cnt);
+  palloc_free_multiple (tables.start, tables.cnt);
   palloc_free_page (pd);
 }
 
@@ -156,6 +194,64 @@ pagedir_clear_page (uint32_t *pd, void *upage)
     }
 }
 
+/* Makes user virtual page UPAGE in PD writable by the user
+   process if WRITABLE is true, read-only otherwise.  Other bits in
+   the page table entry are preserved.  UPAGE need not be mapped. */
+void
+pagedir_set_writable (uint32_t *pd, const void *upage, bool writable)
+{
+  uint32_t *pte = lookup_page (pd, upage, false);
+  if (pte != NULL)
+    {
+      if (writable)
+        *pte |= PTE_W;
+      else
+        {
+          *pte &= ~(uint32_t) PTE_W;
+          invalidate_pagedir (pd);
+        }
+    }
+}
+
+/* Maps a copy of every user page present in SRC at the same
+   address in DST, which must have no user pages yet, with the
+   same permissions.  Copies are allocated from the user pool.
+   On failure, returns false, and whatever was copied so far is
+   freed with DST by pagedir_destroy(). */
+bool
+pagedir_copy (uint32_t *dst, uint32_t *src)
+{
+  uint32_t *pde;
+
+  ASSERT (dst != init_page_dir && src != init_page_dir);
+
+  for (pde = src; pde < src + pd_no (PHYS_BASE); pde++)
+    if (*pde & PTE_P)
+      {
+        uint32_t *pt = pde_get_pt (*pde);
+        size_t i;
+
+        for (i = 0; i < PGSIZE / sizeof *pt; i++)
+          if (pt[i] & PTE_P)
+            {
+              void *upage = (void *) (((uintptr_t) (pde - src) << PDSHIFT)
+                                      | (i << PTSHIFT));
+              void *kpage = palloc_get_page (PAL_USER);
+
+              if (kpage == NULL)
+                return false;
+              memcpy (kpage, pte_get_page (pt[i]), PGSIZE);
+              if (!pagedir_set_page (dst, upage, kpage,
+                                     (pt[i] & PTE_W) != 0))
+                {
+                  palloc_free_page (kpage);
+                  return false;
+                }
+            }
+      }
+  return true;
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PD is dirty,
    that is, if the page has been modified since the PTE was
    installed.
@@ -215,13 +311,22 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
 }
 
 /* Loads page directory PD into the CPU's page directory base
-   register. */
+   register, unless it is already there.  Reloading it would only
+   flush the TLB. */
 void
 pagedir_activate (uint32_t *pd) 
 {
   if (pd == NULL)
     pd = init_page_dir;
+  if (active_pd () != pd)
+    load_pagedir (pd);
+}
 
+/* Loads page directory PD into the CPU's page directory base
+   register, flushing the TLB. */
+static void
+load_pagedir (uint32_t *pd)
+{
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
      new page tables immediately.  See [IA32-v2a] "MOV--Move
@@ -256,8 +361,8 @@ invalidate_pagedir (uint32_t *pd)
 {
   if (active_pd () == pd) 
     {
-      /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
+      /* Reloading PD clears the TLB.  See [IA32-v3a] 3.12
          "Translation Lookaside Buffers (TLBs)". */
-      pagedir_activate (pd);
+      load_pagedir (pd);
     } 
 }
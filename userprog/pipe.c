@@ -0,0 +1,223 @@
+#include "userprog/pipe.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include <syscall-nr.h>
+#include "threads/palloc.h"
+#include "threads/poll.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* A pipe: a PIPE_SIZE-byte ring buffer shared by the file nodes
+   of its read end and its write end.  A reader blocks while the
+   pipe is empty and a writer while it is full.  Once every write
+   end is closed, reads of an empty pipe return 0; once every read
+   end is closed, writes fail.  The pipe is freed when both ends
+   are gone.  Every change that could make an end ready is also
+   announced to poll() through POLLERS. */
+#define PIPE_SIZE PGSIZE
+
+struct pipe
+  {
+    struct lock lock;           /* Protects all of the below. */
+    struct condition not_empty; /* Signaled when data arrives. */
+    struct condition not_full;  /* Signaled when space frees up. */
+    uint8_t *buffer;            /* PIPE_SIZE bytes. */
+    size_t head;                /* Offset of the oldest byte. */
+    size_t used;                /* Bytes in BUFFER. */
+    int reader_cnt;             /* Open read ends. */
+    int writer_cnt;             /* Open write ends. */
+    struct poll_queue pollers;  /* Threads in poll(). */
+  };
+
+/* Statistics. */
+static unsigned long long pipe_cnt;     /* Pipes created. */
+static unsigned long long byte_cnt;     /* Bytes passed through pipes. */
+
+/* Returns a new empty pipe with one read end and one write end,
+   or a null pointer if memory is not available. */
+struct pipe *
+pipe_create (void)
+{
+  struct pipe *p = malloc (sizeof *p);
+
+  if (p == NULL)
+    return NULL;
+  p->buffer = palloc_get_page (0);
+  if (p->buffer == NULL)
+    {
+      free (p);
+      return NULL;
+    }
+  lock_init (&p->lock);
+  cond_init (&p->not_empty);
+  cond_init (&p->not_full);
+  p->head = 0;
+  p->used = 0;
+  p->reader_cnt = 1;
+  p->writer_cnt = 1;
+  poll_queue_init (&p->pollers);
+  pipe_cnt++;
+  return p;
+}
+
+/* Adds another read end, or write end if WRITER, to P. */
+void
+pipe_dup (struct pipe *p, bool writer)
+{
+  lock_acquire (&p->lock);
+  if (writer)
+    p->writer_cnt++;
+  else
+    p->reader_cnt++;
+  lock_release (&p->lock);
+}
+
+/* Closes one read end, or write end if WRITER, of P, and frees P
+   if that was the last end. */
+void
+pipe_close (struct pipe *p, bool writer)
+{
+  bool last;
+
+  lock_acquire (&p->lock);
+  if (writer)
+    {
+      ASSERT (p->writer_cnt > 0);
+      p->writer_cnt--;
+    }
+  else
+    {
+      ASSERT (p->reader_cnt > 0);
+      p->reader_cnt--;
+    }
+
+  /* Let blocked readers see end of file, and blocked writers see
+     that nobody will read. */
+  cond_broadcast (&p->not_empty, &p->lock);
+  cond_broadcast (&p->not_full, &p->lock);
+  poll_wake (&p->pollers);
+  last = p->reader_cnt == 0 && p->writer_cnt == 0;
+  lock_release (&p->lock);
+
+  if (last)
+    {
+      palloc_free_page (p->buffer);
+      free (p);
+    }
+}
+
+/* Reads up to SIZE bytes from P into BUFFER, waiting until at
+   least one byte is available.  Returns the number of bytes read,
+   which is 0 at end of file: P is empty and has no write ends. */
+int
+pipe_read (struct pipe *p, void *buffer_, size_t size)
+{
+  uint8_t *buffer = buffer_;
+  size_t done = 0;
+
+  if (size == 0)
+    return 0;
+
+  lock_acquire (&p->lock);
+  while (p->used == 0 && p->writer_cnt > 0)
+    cond_wait (&p->not_empty, &p->lock);
+  while (done < size && p->used > 0)
+    {
+      size_t chunk = size - done;
+
+      if (chunk > p->used)
+        chunk = p->used;
+      if (chunk > PIPE_SIZE - p->head)
+        chunk = PIPE_SIZE - p->head;
+      memcpy (buffer + done, p->buffer + p->head, chunk);
+      p->head = (p->head + chunk) % PIPE_SIZE;
+      p->used -= chunk;
+      done += chunk;
+    }
+  byte_cnt += done;
+  cond_broadcast (&p->not_full, &p->lock);
+  poll_wake (&p->pollers);
+  lock_release (&p->lock);
+  return done;
+}
+
+/* Writes all SIZE bytes from BUFFER into P, waiting for space as
+   needed.  Returns the number of bytes written, which is less
+   than SIZE only if every read end is closed meanwhile, or -1 if
+   it was closed before anything was written. */
+int
+pipe_write (struct pipe *p, const void *buffer_, size_t size)
+{
+  const uint8_t *buffer = buffer_;
+  size_t done = 0;
+
+  lock_acquire (&p->lock);
+  while (done < size)
+    {
+      size_t tail, chunk;
+
+      while (p->used == PIPE_SIZE && p->reader_cnt > 0)
+        cond_wait (&p->not_full, &p->lock);
+      if (p->reader_cnt == 0)
+        break;
+
+      tail = (p->head + p->used) % PIPE_SIZE;
+      chunk = size - done;
+      if (chunk > PIPE_SIZE - p->used)
+        chunk = PIPE_SIZE - p->used;
+      if (chunk > PIPE_SIZE - tail)
+        chunk = PIPE_SIZE - tail;
+      memcpy (p->buffer + tail, buffer + done, chunk);
+      p->used += chunk;
+      done += chunk;
+      cond_broadcast (&p->not_empty, &p->lock);
+      poll_wake (&p->pollers);
+    }
+  lock_release (&p->lock);
+  return done > 0 || size == 0 ? (int) done : -1;
+}
+
+/* Returns the POLL* events that hold for P's read end, or its
+   write end if WRITER. */
+int
+pipe_poll (struct pipe *p, bool writer)
+{
+  int events = 0;
+
+  lock_acquire (&p->lock);
+  if (writer)
+    {
+      if (p->reader_cnt == 0)
+        events = POLLOUT | POLLERR;
+      else if (p->used < PIPE_SIZE)
+        events = POLLOUT;
+    }
+  else
+    {
+      if (p->writer_cnt == 0)
+        events = POLLIN | POLLHUP;
+      else if (p->used > 0)
+        events = POLLIN;
+    }
+  lock_release (&p->lock);
+  return events;
+}
+
+/* Adds W to the waiters that any change to P wakes by upping
+   SEMA. */
+void
+pipe_poll_add (struct pipe *p, struct poll_waiter *w, struct semaphore *sema)
+{
+  poll_queue_add (&p->pollers, w, sema);
+}
+
+/* Prints pipe statistics. */
+void
+pipe_print_stats (void)
+{
+  printf ("Pipes: %llu created, %llu bytes transferred\n",
+          pipe_cnt, byte_cnt);
+}
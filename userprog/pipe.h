@@ -0,0 +1,20 @@
+#ifndef USERPROG_PIPE_H
+#define USERPROG_PIPE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct pipe;
+struct poll_waiter;
+struct semaphore;
+
+struct pipe *pipe_create (void);
+void pipe_dup (struct pipe *, bool writer);
+void pipe_close (struct pipe *, bool writer);
+int pipe_read (struct pipe *, void *, size_t);
+int pipe_write (struct pipe *, const void *, size_t);
+int pipe_poll (struct pipe *, bool writer);
+void pipe_poll_add (struct pipe *, struct poll_waiter *, struct semaphore *);
+void pipe_print_stats (void);
+
+#endif /* userprog/pipe.h */
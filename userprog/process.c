@@ -2,10 +2,13 @@
 #include <debug.h>
 #include <inttypes.h>
 #include <round.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "userprog/aio.h"
 #include "userprog/gdt.h"
+#include "userprog/image.h"
 #include "userprog/pagedir.h"
 #include "userprog/tss.h"
 #include "filesys/directory.h"
@@ -17,48 +20,136 @@
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/shm.h"
+#include "vm/page.h"
+#endif
+
+/* Most arguments in a command line, including the program name. */
+#define EXEC_ARGS_MAX 128
+
+/* A command line parsed once by process_execute() and handed to
+   the new thread in a single page.  The argument strings are
+   packed one after another, each null-terminated, in the order
+   they will be copied to the top of the user stack. */
+struct exec_args
+  {
+    int argc;                           /* Number of arguments. */
+    size_t len;                         /* Bytes used in STRINGS. */
+    char *argv[EXEC_ARGS_MAX];          /* Pointers into STRINGS. */
+    char strings[];                     /* Argument strings. */
+  };
+
+/* Room for argument strings in a struct exec_args page. */
+#define EXEC_STRINGS_MAX (PGSIZE - offsetof (struct exec_args, strings))
 
 static thread_func start_process NO_RETURN;
-static bool load (const char *cmdline, void (**eip) (void), void **esp);
+static thread_func start_fork NO_RETURN;
+static bool load (const struct exec_args *, void (**eip) (void), void **esp);
+static int reap (struct child_status *, int64_t *exit_ticks);
+
+/* Splits CMD_LINE at spaces into ARGS.  Returns false if it has no
+   program name, has too many arguments, or would not fit in the
+   initial user stack page along with argv[] and the rest of the
+   initial stack frame. */
+static bool
+parse_args (const char *cmd_line, struct exec_args *args)
+{
+  const char *p = cmd_line;
+
+  args->argc = 0;
+  args->len = 0;
+  for (;;)
+    {
+      size_t n;
+
+      while (*p == ' ')
+        p++;
+      if (*p == '\0')
+        break;
+      for (n = 0; p[n] != ' ' && p[n] != '\0'; n++)
+        continue;
+      if (args->argc >= EXEC_ARGS_MAX || args->len + n + 1 > EXEC_STRINGS_MAX)
+        return false;
+      args->argv[args->argc++] = args->strings + args->len;
+      memcpy (args->strings + args->len, p, n);
+      args->strings[args->len + n] = '\0';
+      args->len += n + 1;
+      p += n;
+    }
+
+  /* Strings, word alignment, argv[] with its null sentinel, argv,
+     argc and the fake return address. */
+  return (args->argc > 0
+          && (ROUND_UP (args->len, sizeof (char *))
+              + (args->argc + 1) * sizeof (char *)
+              + sizeof (char **) + sizeof (int) + sizeof (void *)
+              <= PGSIZE));
+}
+
+static tid_t execute (const char *file_name, bool wait_load);
 
 /* Starts a new thread running a user program loaded from
    FILENAME.  The new thread may be scheduled (and may even exit)
    before process_execute() returns.  Returns the new process's
-   thread id, or TID_ERROR if the thread cannot be created. */
+   thread id, or TID_ERROR if the thread cannot be created or the
+   program cannot be loaded. */
 tid_t
 process_execute (const char *file_name) 
 {
-  char *fn_copy_1, *fn_copy_2, *file_title, *delim = " ", *savestr;
-  struct thread *child_t;
-  tid_t tid;
+  return execute (file_name, true);
+}
 
-  /* Make a copy of FILE_NAME.
-     Otherwise there's a race between the caller and load(). */
-  fn_copy_1 = palloc_get_page (0);
-  fn_copy_2 = palloc_get_page (0);
-  file_title = palloc_get_page (0);
+/* Like process_execute(), but returns as soon as the new thread
+   exists, without waiting for it to load the program, so that
+   several programs can load at once.  A process that fails to
+   load exits with status -1, which process_wait() reports. */
+tid_t
+process_spawn (const char *file_name) 
+{
+  return execute (file_name, false);
+}
 
-  if (fn_copy_1 == NULL || fn_copy_2 == NULL || file_title == NULL)
-    return TID_ERROR;
-  strlcpy (fn_copy_1, file_name, PGSIZE);
+/* Starts a new thread running a user program loaded from
+   FILENAME, and, if WAIT_LOAD, waits for it to load the program.
+   Returns the new process's thread id, or TID_ERROR if the thread
+   cannot be created or, with WAIT_LOAD, the program cannot be
+   loaded. */
+static tid_t
+execute (const char *file_name, bool wait_load) 
+{
+  struct exec_args *args;
+  struct child_status *child;
+  tid_t tid;
 
-  // args[0] contains the file name which need to be executed
-  file_title = strtok_r(fn_copy_1, delim, &savestr);
+  /* Parse FILE_NAME into a page of our own, which the new thread
+     frees.  Otherwise there's a race between the caller and
+     load(). */
+  args = palloc_get_page (0);
+  if (args == NULL)
+    return TID_ERROR;
+  if (!parse_args (file_name, args))
+    {
+      palloc_free_page (args);
+      return TID_ERROR;
+    }
 
-  strlcpy (fn_copy_2, file_name, PGSIZE);
-  
   /* Create a new thread to execute FILE_NAME. */
-  tid = thread_create (file_title, PRI_DEFAULT, start_process, fn_copy_2);
+  tid = thread_create (args->argv[0], PRI_DEFAULT, start_process, args);
   if (tid == TID_ERROR)
-    palloc_free_page (fn_copy_2); 
+    {
+      palloc_free_page (args);
+      return TID_ERROR;
+    }
 
-  /* Free this resource */
-  palloc_free_page (fn_copy_1);
+  if (!wait_load)
+    return tid;
 
   /* block until the result of exec */
-  child_t = get_thread(tid);
-  sema_down(&child_t->exec_sema);
-  if (! child_t->success)
+  child = thread_get_child (tid);
+  sema_down(&child->load_sema);
+  if (! child->loaded)
   {
     // fail to load
     return -1;
@@ -70,9 +161,9 @@ process_execute (const char *file_name)
 /* A thread function that loads a user process and starts it
    running. */
 static void
-start_process (void *file_name_)
+start_process (void *args_)
 {
-  char *file_name = file_name_;
+  struct exec_args *args = args_;
   struct intr_frame if_;
   bool success;
   /* Initialize interrupt frame and load executable. */
@@ -80,13 +171,13 @@ start_process (void *file_name_)
   if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
   if_.cs = SEL_UCSEG;
   if_.eflags = FLAG_IF | FLAG_MBS;
-  success = load (file_name, &if_.eip, &if_.esp);
+  success = load (args, &if_.eip, &if_.esp);
 
-  thread_current()->success = success;
-  sema_up(&thread_current()->exec_sema);
+  thread_current()->status_rec->loaded = success;
+  sema_up(&thread_current()->status_rec->load_sema);
 
   /* If load failed, quit. */
-  palloc_free_page (file_name);
+  palloc_free_page (args);
   if (!success)
     thread_exit ();
 
@@ -100,54 +191,179 @@ start_process (void *file_name_)
   NOT_REACHED ();
 }
 
+/* Returns the interrupt frame through which user process T, which
+   must be in the kernel, entered it.  A user process enters the
+   kernel only by an interrupt, whose frame is pushed at the very
+   top of its kernel stack, where tss_update() points the CPU. */
+static struct intr_frame *
+user_frame (struct thread *t)
+{
+  return (struct intr_frame *) ((uint8_t *) t + PGSIZE) - 1;
+}
+
+/* Creates a copy of the running process, which must have entered
+   the kernel through a system call, and returns its thread id, or
+   TID_ERROR if it cannot be created.  The child returns from the
+   same system call with 0.
+
+   With VM, the child gets no copy of the parent's memory: the two
+   share every page copy-on-write, so that forking costs about as
+   much as copying the page tables.  Without it, every page is
+   copied at once. */
+tid_t
+process_fork (void)
+{
+  struct child_status *child;
+  tid_t tid;
+
+  tid = thread_create (thread_current ()->name, PRI_DEFAULT, start_fork,
+                       thread_current ());
+  if (tid == TID_ERROR)
+    return TID_ERROR;
+
+  /* We stay blocked, our address space unchanging, until the child
+     has copied it. */
+  child = thread_get_child (tid);
+  sema_down (&child->load_sema);
+  return child->loaded ? tid : TID_ERROR;
+}
+
+/* Copies the address space, executable and open files of PARENT,
+   blocked in process_fork(), into the running thread.  Returns
+   true if successful. */
+static bool
+copy_process (struct thread *parent)
+{
+  struct thread *t = thread_current ();
+
+  t->pagedir = pagedir_create ();
+  if (t->pagedir == NULL)
+    return false;
+#ifdef VM
+  if (!page_table_init ())
+    {
+      pagedir_destroy (t->pagedir);
+      t->pagedir = NULL;
+      return false;
+    }
+  mmap_init ();
+  shm_process_init ();
+#endif
+  process_activate ();
+
+  /* Our own handle on the executable keeps it open, and unwritable,
+     for as long as we run it. */
+  t->exec_file = file_reopen (parent->exec_file);
+  if (t->exec_file == NULL)
+    return false;
+  file_deny_write (t->exec_file);
+
+#ifdef VM
+  if (!page_table_fork (parent) || !mmap_fork (parent)
+      || !shm_fork (parent))
+    return false;
+#else
+  if (!pagedir_copy (t->pagedir, parent->pagedir))
+    return false;
+#endif
+  return copy_fd_list (parent);
+}
+
+/* A thread function that turns a new thread into a copy of
+   PARENT_, the process that called process_fork(), and starts it
+   running where the parent entered the kernel. */
+static void
+start_fork (void *parent_)
+{
+  struct thread *parent = parent_;
+  struct intr_frame if_ = *user_frame (parent);
+  bool success;
+
+  success = copy_process (parent);
+  thread_current ()->status_rec->loaded = success;
+  sema_up (&thread_current ()->status_rec->load_sema);
+  if (!success)
+    thread_exit ();
+
+  /* Return 0 from the system call. */
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
    child of the calling process, or if process_wait() has already
    been successfully called for the given TID, returns -1
-   immediately, without waiting.
+   immediately, without waiting. */
+int
+process_wait (tid_t child_tid) 
+{
+  return process_wait_timed (child_tid, NULL);
+}
 
-   This function will be implemented in problem 2-2.  For now, it
-   does nothing. */
+/* Like process_wait(), but also stores the value of
+   timer_ticks() when the child exited into *EXIT_TICKS, if
+   EXIT_TICKS is non-null and the wait succeeds. */
 int
-process_wait (tid_t child_tid UNUSED) 
+process_wait_timed (tid_t child_tid, int64_t *exit_ticks)
 {
-  /*
-   * Check: need to be in child list.
-   * process_exit
-   */
-  struct thread *t = thread_current(), *child_t;
-  struct list_elem *elem = list_head(&t->child_list); // head of list (dummy node)
-
-  while ( (elem = list_next(elem)) != list_tail(&t->child_list))
-  {
-    // next node is valid
-    child_t = list_entry(elem, struct thread, child_elem);
+  struct child_status *child = thread_get_child (child_tid);
 
-    if (child_t->tid == child_tid)
-    {
-      // wait for that child
-      if (! child_t->isWaited)
-      {
-        child_t->isWaited = true;
+  /* return -1 when no such child or already waiting */
+  if (child == NULL || child->waited)
+    return -1;
+  child->waited = true;
+  thread_unqueue_exited (child);
+  return reap (child, exit_ticks);
+}
 
-        sema_down(&child_t->child_sema); // parent (current thread) should be blocked here
+/* Waits for whichever child process exits first, among those not
+   already waited for, and returns its tid, storing its exit
+   status into *STATUS.  Returns -1 at once if no such child is
+   left.  If BLOCK is false and no such child has exited yet,
+   returns 0 at once instead of waiting. */
+tid_t
+process_wait_any (int *status, bool block)
+{
+  struct child_status *child;
+  bool childless;
+  tid_t tid;
 
-        int return_status = child_t->return_status;
+  child = thread_get_exited_child (block, &childless);
+  if (child == NULL)
+    return childless ? TID_ERROR : 0;
+  tid = child->tid;
+  *status = reap (child, NULL);
+  return tid;
+}
 
-	// free child memory and remove from child_list
-	list_remove(&child_t->child_elem);
-	palloc_free_page(child_t);
+/* Waits for CHILD, a child of the running process that is marked
+   waited for, to exit, and cleans up after it as described for
+   process_wait_timed(). */
+static int
+reap (struct child_status *child, int64_t *exit_ticks)
+{
+  struct rusage *usage;
+  int return_status;
 
-        return return_status;
-      }
+  sema_down(&child->exit_sema); // parent (current thread) should be blocked here
 
-      break;
-    }
-  }
+  return_status = child->exit_status;
+  if (exit_ticks != NULL)
+    *exit_ticks = child->exit_ticks;
 
-  /* return -1 when no such child or already waiting */
-  return -1;
+  /* Charge the child's usage, and its children's, to ours. */
+  usage = &thread_current ()->status_rec->child_usage;
+  thread_add_rusage (usage, &child->usage);
+  thread_add_rusage (usage, &child->child_usage);
+
+  // drop our reference to the child's record
+  list_remove(&child->elem);
+  thread_release_status(child);
+
+  return return_status;
 }
 
 /* Free the current process's resources. */
@@ -157,11 +373,22 @@ process_exit (void)
   struct thread *cur = thread_current ();
   uint32_t *pd;
 
+  /* Let the worker threads finish with our requests' buffers. */
+  aio_wait_all ();
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
   if (pd != NULL) 
     {
+#ifdef VM
+      /* Write back mapped files while their pages are still
+         mapped. */
+      shm_detach_all ();
+      mmap_unmap_all ();
+      page_table_destroy ();
+#endif
+
       /* Correct ordering here is crucial.  We must set
          cur->pagedir to NULL before switching page directories,
          so that a timer interrupt can't switch back to the
@@ -183,8 +410,14 @@ process_activate (void)
 {
   struct thread *t = thread_current ();
 
-  /* Activate thread's page tables. */
-  pagedir_activate (t->pagedir);
+  /* Activate thread's page tables.  A kernel thread has none of
+     its own.  The kernel's mappings are the same in every page
+     directory, so it just keeps running on whichever is loaded,
+     and switching to it and back to the same process costs no TLB
+     flush.  That directory cannot be freed under it: a process
+     loads init_page_dir before destroying its own. */
+  if (t->pagedir != NULL)
+    pagedir_activate (t->pagedir);
 
   /* Set thread's kernel stack for use in processing
      interrupts. */
@@ -254,58 +487,23 @@ struct Elf32_Phdr
 #define PF_W 2          /* Writable. */
 #define PF_R 4          /* Readable. */
 
-static bool setup_stack (void **esp, char **args, int argc);
+static bool setup_stack (void **esp, const struct exec_args *);
 static bool validate_segment (const struct Elf32_Phdr *, struct file *);
 static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
                           uint32_t read_bytes, uint32_t zero_bytes,
                           bool writable);
 
-/* Loads an ELF executable from FILE_NAME into the current thread.
-   Stores the executable's entry point into *EIP
-   and its initial stack pointer into *ESP.
-   Returns true if successful, false otherwise. */
-bool
-load (const char *file_name, void (**eip) (void), void **esp) 
+/* Reads and validates the ELF header and program headers of
+   executable FILE, named FILE_NAME, and stores what load() needs
+   from them into *IMAGE.  Returns true if successful, false if
+   FILE is not an executable that we can load. */
+static bool
+read_image (struct file *file, const char *file_name, struct image *image)
 {
-  // save the tokenized arguments from command line
-  char *args[128];
-  // length of arguments (including file name)
-  int argc;
-
-  // used by strtok_r
-  char *delim = " ", *savestr;
-
-  struct thread *t = thread_current ();
   struct Elf32_Ehdr ehdr;
-  struct file *file = NULL;
   off_t file_ofs;
-  bool success = false;
   int i;
 
-  /* Allocate and activate page directory. */
-  t->pagedir = pagedir_create ();
-  if (t->pagedir == NULL) 
-    goto done;
-  process_activate ();
-
-
-  /* MODIFIED split the file_name into arguments */
-  args[0] = strtok_r(file_name, delim, &savestr);
-
-  i = 1;
-  while( ( args[i] = strtok_r(NULL, delim, &savestr) ) != NULL ) {
-  	i++;
-  }
-  argc = i;
-  /* Open executable file. */
-  file = filesys_open (args[0]);
-
-  if (file == NULL) 
-    {
-      printf ("load: %s: open failed\n", file_name);
-      goto done; 
-    }
-
   /* Read and verify executable header. */
   if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
       || memcmp (ehdr.e_ident, "\177ELF\1\1\1", 7)
@@ -316,8 +514,10 @@ load (const char *file_name, void (**eip) (void), void **esp)
       || ehdr.e_phnum > 1024) 
     {
       printf ("load: %s: error loading executable\n", file_name);
-      goto done; 
+      return false;
     }
+  image->entry = ehdr.e_entry;
+  image->segment_cnt = 0;
 
   /* Read program headers. */
   file_ofs = ehdr.e_phoff;
@@ -326,11 +526,11 @@ load (const char *file_name, void (**eip) (void), void **esp)
       struct Elf32_Phdr phdr;
 
       if (file_ofs < 0 || file_ofs > file_length (file))
-        goto done;
+        return false;
       file_seek (file, file_ofs);
 
       if (file_read (file, &phdr, sizeof phdr) != sizeof phdr)
-        goto done;
+        return false;
       file_ofs += sizeof phdr;
       switch (phdr.p_type) 
         {
@@ -344,46 +544,111 @@ load (const char *file_name, void (**eip) (void), void **esp)
         case PT_DYNAMIC:
         case PT_INTERP:
         case PT_SHLIB:
-          goto done;
+          return false;
         case PT_LOAD:
-          if (validate_segment (&phdr, file)) 
+          if (validate_segment (&phdr, file)
+              && image->segment_cnt < IMAGE_SEGMENT_MAX)
             {
-              bool writable = (phdr.p_flags & PF_W) != 0;
-              uint32_t file_page = phdr.p_offset & ~PGMASK;
-              uint32_t mem_page = phdr.p_vaddr & ~PGMASK;
+              struct image_segment *seg
+                = &image->segments[image->segment_cnt++];
               uint32_t page_offset = phdr.p_vaddr & PGMASK;
-              uint32_t read_bytes, zero_bytes;
+
+              seg->writable = (phdr.p_flags & PF_W) != 0;
+              seg->file_page = phdr.p_offset & ~PGMASK;
+              seg->mem_page = phdr.p_vaddr & ~PGMASK;
               if (phdr.p_filesz > 0)
                 {
                   /* Normal segment.
                      Read initial part from disk and zero the rest. */
-                  read_bytes = page_offset + phdr.p_filesz;
-                  zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz, PGSIZE)
-                                - read_bytes);
+                  seg->read_bytes = page_offset + phdr.p_filesz;
+                  seg->zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz,
+                                               PGSIZE)
+                                     - seg->read_bytes);
                 }
               else 
                 {
                   /* Entirely zero.
                      Don't read anything from disk. */
-                  read_bytes = 0;
-                  zero_bytes = ROUND_UP (page_offset + phdr.p_memsz, PGSIZE);
+                  seg->read_bytes = 0;
+                  seg->zero_bytes = ROUND_UP (page_offset + phdr.p_memsz,
+                                              PGSIZE);
                 }
-              if (!load_segment (file, file_page, (void *) mem_page,
-                                 read_bytes, zero_bytes, writable))
-                goto done;
             }
           else
-            goto done;
+            return false;
           break;
         }
     }
+  return true;
+}
+
+/* Loads the ELF executable named by ARGS->argv[0] into the
+   current thread, with ARGS as its command line.
+   Stores the executable's entry point into *EIP
+   and its initial stack pointer into *ESP.
+   Returns true if successful, false otherwise.
+   The executable's parsed headers are looked up in the image
+   cache first, so that running a program again reads no more
+   than its segments, and with VM not even those until they are
+   touched. */
+static bool
+load (const struct exec_args *args, void (**eip) (void), void **esp) 
+{
+  const char *file_name = args->argv[0];
+  struct thread *t = thread_current ();
+  struct image image;
+  struct file *file = NULL;
+  bool success = false;
+  size_t i;
+
+  /* Allocate and activate page directory. */
+  t->pagedir = pagedir_create ();
+  if (t->pagedir == NULL) 
+    goto done;
+#ifdef VM
+  if (!page_table_init ())
+    {
+      pagedir_destroy (t->pagedir);
+      t->pagedir = NULL;
+      goto done;
+    }
+  mmap_init ();
+  shm_process_init ();
+#endif
+  process_activate ();
+
+  /* Open executable file. */
+  file = filesys_open (file_name);
+
+  if (file == NULL) 
+    {
+      printf ("load: %s: open failed\n", file_name);
+      goto done; 
+    }
+
+  /* Read and verify the headers, unless they are cached. */
+  if (!image_lookup (file_get_inode (file), &image))
+    {
+      if (!read_image (file, file_name, &image))
+        goto done;
+      image_insert (file_get_inode (file), &image);
+    }
+
+  /* Map the segments. */
+  for (i = 0; i < image.segment_cnt; i++)
+    {
+      const struct image_segment *seg = &image.segments[i];
+      if (!load_segment (file, seg->file_page, (void *) seg->mem_page,
+                         seg->read_bytes, seg->zero_bytes, seg->writable))
+        goto done;
+    }
 
   /* Set up stack. */
-  if (!setup_stack (esp, args, argc))
+  if (!setup_stack (esp, args))
     goto done;
 
   /* Start address. */
-  *eip = (void (*) (void)) ehdr.e_entry;
+  *eip = (void (*) (void)) image.entry;
 
   success = true;
   
@@ -395,10 +660,12 @@ load (const char *file_name, void (**eip) (void), void **esp)
     file_close (file);
   return success;
 }
-
+
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -457,6 +724,9 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
+   With VM, pages are only recorded in the supplemental page
+   table here and read from FILE on first access.
+
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
 static bool
@@ -476,6 +746,12 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
+#ifdef VM
+      if (!page_add (upage, page_read_bytes > 0 ? file : NULL, ofs,
+                     page_read_bytes, writable, false))
+        return false;
+      ofs += page_read_bytes;
+#else
       /* Get a page of memory. */
       uint8_t *kpage = palloc_get_page (PAL_USER);
       if (kpage == NULL)
@@ -495,6 +771,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
           palloc_free_page (kpage);
           return false; 
         }
+#endif
 
       /* Advance. */
       read_bytes -= page_read_bytes;
@@ -505,18 +782,25 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
-   user virtual memory. */
+   user virtual memory, and push the command line in ARGS onto
+   it: the argument strings, argv[], argv, argc and a fake return
+   address.  parse_args() made sure that all of it fits. */
 static bool
-setup_stack (void **esp, char **args, int argc) 
+setup_stack (void **esp, const struct exec_args *args) 
 {
   uint8_t *kpage;
   bool success = false;
-  char *ptr;
-  char *local[128];
-  char *argv_ptr;
   int i;
-  int return_addr = 0;
 
+#ifdef VM
+  /* The arguments are written through the user mapping, so the
+     page must stay resident until they are in place. */
+  kpage = ((uint8_t *) PHYS_BASE) - PGSIZE;
+  success = (page_add (kpage, NULL, 0, 0, true, false)
+             && page_pin (kpage));
+  if (success)
+    *esp = PHYS_BASE;
+#else
   kpage = palloc_get_page (PAL_USER | PAL_ZERO);
   if (kpage != NULL) 
     {
@@ -526,48 +810,32 @@ setup_stack (void **esp, char **args, int argc)
       else
         palloc_free_page (kpage);
     }
+#endif
 
-  if(success)
-  {
-    // intialize ptr
-    ptr = (char *)*esp;
-
-    // strings of arguments
-    for (i = argc - 1; i >= 0; i--)
-    {
-      ptr -= strlen(args[i]) + 1; // pointer operation, +1 for '\0'
-      local[i] = ptr;
-      memcpy(ptr, args[i], strlen(args[i]) + 1); // copy argv[i] to esp, deep copy
-    }
-
-    // word-align, make esp 4 * n
-    ptr = ROUND_DOWN((uintptr_t) ptr, 4);
-
-    // add argv[argc]
-    ptr -= sizeof(int);
-    memcpy(ptr, &return_addr, sizeof(int));
-
-    // pointer of arguments
-    for(i = argc -1; i >= 0; i--)
+  if (success)
     {
-      ptr -= sizeof(char *);
-      memcpy(ptr, &local[i], sizeof(char *));
+      /* The strings are already packed, so they are copied in one
+         go and argv[] is pointed at the copies. */
+      char *strings = (char *) PHYS_BASE - args->len;
+      char **argv;
+      uint32_t *ptr;
+
+      memcpy (strings, args->strings, args->len);
+      argv = ((char **) ROUND_DOWN ((uintptr_t) strings, sizeof (char *))
+              - (args->argc + 1));
+      for (i = 0; i < args->argc; i++)
+        argv[i] = strings + (args->argv[i] - args->strings);
+      argv[args->argc] = NULL;
+
+      ptr = (uint32_t *) argv;
+      *--ptr = (uint32_t) argv;
+      *--ptr = args->argc;
+      *--ptr = 0;
+      *esp = ptr;
     }
-  
-    // argv and argc
-    argv_ptr = ptr;
-    ptr -= sizeof(char **);
-    memcpy(ptr, &argv_ptr, sizeof(char **));
-    ptr -= sizeof(int);
-    memcpy(ptr, &argc, sizeof(int));
-
-    //return address
-    ptr -= sizeof(void (*)); // void (*f)() {}
-    memcpy(ptr, &return_addr, sizeof(void (*)));
-
-    // make the esp point to the top of stack
-    *esp = (void *)ptr;
-  }
+#ifdef VM
+  page_unpin_all ();
+#endif
 
   return success;
 }
@@ -581,6 +849,7 @@ setup_stack (void **esp, char **args, int argc)
    with palloc_get_page().
    Returns true on success, false if UPAGE is already mapped or
    if memory allocation fails. */
+#ifndef VM
 static bool
 install_page (void *upage, void *kpage, bool writable)
 {
@@ -591,3 +860,4 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
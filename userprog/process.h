@@ -4,7 +4,11 @@
 #include "threads/thread.h"
 
 tid_t process_execute (const char *file_name);
+tid_t process_spawn (const char *file_name);
+tid_t process_fork (void);
 int process_wait (tid_t);
+int process_wait_timed (tid_t, int64_t *exit_ticks);
+tid_t process_wait_any (int *status, bool block);
 void process_exit (void);
 void process_activate (void);
 
@@ -0,0 +1,227 @@
+#include "userprog/procfs.h"
+#include <console.h>
+#include <debug.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/timer.h"
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
+#include "filesys/directory.h"
+#include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/exception.h"
+#include "userprog/pipe.h"
+#include "userprog/syscall.h"
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+#endif
+
+/* A read-only directory named "/proc" whose files hold the
+   kernel's live statistics.  Each file's contents are what one of
+   the *_print_stats() functions would print at shutdown, produced
+   afresh by a read at offset 0, so a monitor samples a counter by
+   seeking back to the start and reading again.  A read elsewhere
+   continues the same sample, so that a file read in pieces is
+   consistent.
+
+   The directory is not on disk.  Only the absolute names "/proc"
+   and "/proc/NAME" reach it, and it hides any real directory of
+   the same name from open(). */
+
+/* Most bytes of one sample; the rest is cut off. */
+#define PROC_SIZE PGSIZE
+
+/* A file in /proc. */
+struct proc_entry
+  {
+    const char *name;           /* Name in /proc. */
+    void (*print) (void);       /* Prints its contents. */
+  };
+
+static const struct proc_entry entries[] =
+  {
+    {"block", block_print_stats},
+    {"cache", cache_print_stats},
+    {"dcache", dcache_print_stats},
+    {"directory", dir_print_stats},
+    {"exception", exception_print_stats},
+#ifdef VM
+    {"frame", frame_print_stats},
+#endif
+    {"inode", inode_print_stats},
+    {"interrupt", intr_print_stats},
+    {"journal", journal_print_stats},
+    {"malloc", malloc_print_stats},
+#ifdef VM
+    {"page", page_print_stats},
+#endif
+    {"palloc", palloc_print_stats},
+    {"pipe", pipe_print_stats},
+#ifdef VM
+    {"swap", swap_print_stats},
+#endif
+    {"syscall", syscall_print_stats},
+    {"thread", thread_print_stats},
+    {"timer", timer_print_stats},
+  };
+#define ENTRY_CNT (sizeof entries / sizeof *entries)
+
+/* An open file in /proc, or /proc itself. */
+struct proc_file
+  {
+    const struct proc_entry *entry; /* File, or null for /proc. */
+    char *buf;                  /* Current sample, PROC_SIZE bytes,
+                                   or null before the first. */
+    size_t len;                 /* Bytes in BUF. */
+    size_t pos;                 /* File position, or for /proc the
+                                   next entry for readdir. */
+  };
+
+/* Returns true if NAME is "/proc" or a name in it, whether or not
+   such a file exists. */
+bool
+procfs_owns (const char *name)
+{
+  size_t len = strnlen (name, 6);
+
+  return (len >= 5 && !memcmp (name, "/proc", 5)
+          && (name[5] == '\0' || name[5] == '/'));
+}
+
+/* Allocates a proc_file for ENTRY, which is null for /proc.
+   Returns a null pointer if memory is not available. */
+static struct proc_file *
+new_file (const struct proc_entry *entry)
+{
+  struct proc_file *p = malloc (sizeof *p);
+
+  if (p != NULL)
+    {
+      p->entry = entry;
+      p->buf = NULL;
+      p->len = 0;
+      p->pos = 0;
+    }
+  return p;
+}
+
+/* Opens NAME, for which procfs_owns() must be true.  Returns the
+   new proc_file, or a null pointer if there is no file of that
+   name in /proc or memory is not available. */
+struct proc_file *
+procfs_open (const char *name)
+{
+  size_t i;
+
+  ASSERT (procfs_owns (name));
+  name += 5;
+  name += strspn (name, "/");
+  if (*name == '\0')
+    return new_file (NULL);
+  for (i = 0; i < ENTRY_CNT; i++)
+    if (!strcmp (name, entries[i].name))
+      return new_file (&entries[i]);
+  return NULL;
+}
+
+/* Returns a copy of P, at the same position and with the same
+   sample, or a null pointer if memory is not available. */
+struct proc_file *
+procfs_reopen (struct proc_file *p)
+{
+  struct proc_file *copy = new_file (p->entry);
+
+  if (copy == NULL)
+    return NULL;
+  if (p->buf != NULL)
+    {
+      copy->buf = palloc_get_page (0);
+      if (copy->buf == NULL)
+        {
+          free (copy);
+          return NULL;
+        }
+      memcpy (copy->buf, p->buf, p->len);
+      copy->len = p->len;
+    }
+  copy->pos = p->pos;
+  return copy;
+}
+
+/* Closes P. */
+void
+procfs_close (struct proc_file *p)
+{
+  if (p != NULL)
+    {
+      palloc_free_page (p->buf);
+      free (p);
+    }
+}
+
+/* Returns true if P is /proc itself. */
+bool
+procfs_is_dir (const struct proc_file *p)
+{
+  return p->entry == NULL;
+}
+
+/* Reads up to SIZE bytes of P into BUFFER, taking a new sample
+   first if reading from offset 0.  Returns the number of bytes
+   read, or -1 if P is /proc or memory is not available. */
+int
+procfs_read (struct proc_file *p, void *buffer, size_t size)
+{
+  size_t cnt;
+
+  if (procfs_is_dir (p))
+    return -1;
+  if (p->pos == 0)
+    {
+      if (p->buf == NULL && (p->buf = palloc_get_page (0)) == NULL)
+        return -1;
+      p->len = console_capture (p->entry->print, p->buf, PROC_SIZE);
+    }
+  if (p->pos >= p->len)
+    return 0;
+  cnt = p->len - p->pos;
+  if (cnt > size)
+    cnt = size;
+  memcpy (buffer, p->buf + p->pos, cnt);
+  p->pos += cnt;
+  return cnt;
+}
+
+/* Sets P's file position to POS. */
+void
+procfs_seek (struct proc_file *p, size_t pos)
+{
+  if (!procfs_is_dir (p))
+    p->pos = pos;
+}
+
+/* Returns P's file position. */
+size_t
+procfs_tell (const struct proc_file *p)
+{
+  return procfs_is_dir (p) ? 0 : p->pos;
+}
+
+/* Stores the name of the next file in /proc, open as P, into
+   NAME, which must have room for NAME_MAX + 1 bytes.  Returns
+   false if P is not /proc or every name has been returned. */
+bool
+procfs_readdir (struct proc_file *p, char *name)
+{
+  if (!procfs_is_dir (p) || p->pos >= ENTRY_CNT)
+    return false;
+  strlcpy (name, entries[p->pos++].name, NAME_MAX + 1);
+  return true;
+}
@@ -0,0 +1,20 @@
+#ifndef USERPROG_PROCFS_H
+#define USERPROG_PROCFS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct proc_file;
+
+bool procfs_owns (const char *name);
+struct proc_file *procfs_open (const char *name);
+struct proc_file *procfs_reopen (struct proc_file *);
+void procfs_close (struct proc_file *);
+bool procfs_is_dir (const struct proc_file *);
+int procfs_read (struct proc_file *, void *, size_t);
+void procfs_seek (struct proc_file *, size_t);
+size_t procfs_tell (const struct proc_file *);
+bool procfs_readdir (struct proc_file *, char *name);
+
+#endif /* userprog/procfs.h */
@@ -1,322 +1,1343 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
 #include <syscall-nr.h>
+#include "threads/arena.h"
 #include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/poll.h"
+#include "threads/loader.h"
 #include "threads/thread.h"
+#include "threads/tracepoint.h"
 #include "threads/vaddr.h"
 #include "userprog/pagedir.h"
 #include "process.h"
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <round.h>
+#include "devices/block.h"
+#include "devices/input.h"
 #include "devices/shutdown.h"
+#include "devices/timer.h"
+#include "filesys/directory.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "userprog/aio.h"
+#include "userprog/futex.h"
+#include "userprog/pipe.h"
+#include "userprog/procfs.h"
+#include "userprog/tss.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/shm.h"
+#include "vm/page.h"
+#endif
+
+int valid_range(void *start, unsigned size);
+int valid_write_range(void *start, unsigned size);
+int valid_string(const char *str);
+
+/* Most arguments any system call takes. */
+#define SYSCALL_ARG_MAX 4
+
+/* A system call implementation.  ARGS holds the call's arguments,
+   already copied from the user stack.  Returns the value for eax. */
+typedef int syscall_func (const int *args);
+
+/* One entry of the dispatch table. */
+struct syscall_desc
+  {
+    const char *name;           /* Name, for statistics. */
+    syscall_func *func;         /* Implementation. */
+    int argc;                   /* Number of arguments. */
+    bool ring;                  /* May be queued on a ring? */
+  };
+
+static syscall_func sys_halt, sys_exit, sys_exec, sys_wait, sys_create,
+  sys_remove, sys_open, sys_filesize, sys_read, sys_write, sys_seek,
+  sys_tell, sys_close, sys_chdir, sys_mkdir, sys_readdir, sys_isdir,
+  sys_inumber, sys_readdir_batch, sys_blockstats, sys_pread, sys_pwrite,
+  sys_readv, sys_writev, sys_copy_file_range, sys_sched_trace,
+  sys_ticks, sys_fork, sys_pipe, sys_futex_wait, sys_futex_wake,
+  sys_aio_read, sys_aio_write, sys_aio_poll, sys_aio_wait, sys_ftruncate,
+  sys_fallocate, sys_clone_file, sys_compress, sys_fadvise, sys_fsync,
+  sys_fdatasync, sys_sync, sys_stat, sys_fstat, sys_getrusage,
+  sys_ioprio, sys_wait_any, sys_ring_enter, sys_spawn, sys_poll;
+#ifdef VM
+static syscall_func sys_mmap, sys_munmap, sys_shm_attach, sys_shm_detach;
+static syscall_func sys_madvise;
+#endif
+
+/* System calls, indexed by SYS_* number.  Numbers without an
+   implementation have a null FUNC. */
+static const struct syscall_desc syscall_table[] =
+  {
+    [SYS_HALT] = {"halt", sys_halt, 0},
+    [SYS_EXIT] = {"exit", sys_exit, 1},
+    [SYS_EXEC] = {"exec", sys_exec, 1},
+    [SYS_WAIT] = {"wait", sys_wait, 1},
+    [SYS_CREATE] = {"create", sys_create, 2, true},
+    [SYS_REMOVE] = {"remove", sys_remove, 1, true},
+    [SYS_OPEN] = {"open", sys_open, 1, true},
+    [SYS_FILESIZE] = {"filesize", sys_filesize, 1, true},
+    [SYS_READ] = {"read", sys_read, 3, true},
+    [SYS_WRITE] = {"write", sys_write, 3, true},
+    [SYS_SEEK] = {"seek", sys_seek, 2, true},
+    [SYS_TELL] = {"tell", sys_tell, 1, true},
+    [SYS_CLOSE] = {"close", sys_close, 1, true},
+#ifdef VM
+    [SYS_MMAP] = {"mmap", sys_mmap, 2},
+    [SYS_MUNMAP] = {"munmap", sys_munmap, 1},
+#endif
+    [SYS_CHDIR] = {"chdir", sys_chdir, 1},
+    [SYS_MKDIR] = {"mkdir", sys_mkdir, 1},
+    [SYS_READDIR] = {"readdir", sys_readdir, 2},
+    [SYS_ISDIR] = {"isdir", sys_isdir, 1},
+    [SYS_INUMBER] = {"inumber", sys_inumber, 1},
+    [SYS_READDIR_BATCH] = {"readdir_batch", sys_readdir_batch, 3},
+    [SYS_BLOCKSTATS] = {"blockstats", sys_blockstats, 2},
+    [SYS_PREAD] = {"pread", sys_pread, 4, true},
+    [SYS_PWRITE] = {"pwrite", sys_pwrite, 4, true},
+    [SYS_READV] = {"readv", sys_readv, 3, true},
+    [SYS_WRITEV] = {"writev", sys_writev, 3, true},
+    [SYS_COPY_FILE_RANGE] = {"copy_file_range", sys_copy_file_range, 3},
+    [SYS_SCHED_TRACE] = {"sched_trace", sys_sched_trace, 0},
+    [SYS_TICKS] = {"ticks", sys_ticks, 0},
+    [SYS_FORK] = {"fork", sys_fork, 0},
+    [SYS_PIPE] = {"pipe", sys_pipe, 1},
+#ifdef VM
+    [SYS_SHM_ATTACH] = {"shm_attach", sys_shm_attach, 3},
+    [SYS_SHM_DETACH] = {"shm_detach", sys_shm_detach, 1},
+#endif
+    [SYS_FUTEX_WAIT] = {"futex_wait", sys_futex_wait, 2},
+    [SYS_FUTEX_WAKE] = {"futex_wake", sys_futex_wake, 2},
+    [SYS_AIO_READ] = {"aio_read", sys_aio_read, 4},
+    [SYS_AIO_WRITE] = {"aio_write", sys_aio_write, 4},
+    [SYS_AIO_POLL] = {"aio_poll", sys_aio_poll, 1},
+    [SYS_AIO_WAIT] = {"aio_wait", sys_aio_wait, 1},
+    [SYS_FTRUNCATE] = {"ftruncate", sys_ftruncate, 2, true},
+    [SYS_FALLOCATE] = {"fallocate", sys_fallocate, 3, true},
+    [SYS_CLONE_FILE] = {"clone_file", sys_clone_file, 2},
+    [SYS_COMPRESS] = {"compress", sys_compress, 2},
+    [SYS_FADVISE] = {"fadvise", sys_fadvise, 4},
+#ifdef VM
+    [SYS_MADVISE] = {"madvise", sys_madvise, 3},
+#endif
+    [SYS_FSYNC] = {"fsync", sys_fsync, 1, true},
+    [SYS_FDATASYNC] = {"fdatasync", sys_fdatasync, 1, true},
+    [SYS_SYNC] = {"sync", sys_sync, 0},
+    [SYS_STAT] = {"stat", sys_stat, 2, true},
+    [SYS_FSTAT] = {"fstat", sys_fstat, 2, true},
+    [SYS_GETRUSAGE] = {"getrusage", sys_getrusage, 2},
+    [SYS_IOPRIO] = {"ioprio", sys_ioprio, 2},
+    [SYS_WAIT_ANY] = {"wait_any", sys_wait_any, 2},
+    [SYS_RING_ENTER] = {"ring_enter", sys_ring_enter, 1},
+    [SYS_SPAWN] = {"spawn", sys_spawn, 1},
+    [SYS_POLL] = {"poll", sys_poll, 3},
+  };
+
+#define SYSCALL_CNT (sizeof syscall_table / sizeof *syscall_table)
+
+/* Per-system-call statistics. */
+static struct
+  {
+    unsigned long long cnt;     /* Number of invocations. */
+    unsigned long long cycles;  /* CPU cycles spent in the handler. */
+  }
+syscall_stats[SYSCALL_CNT];
 
-int get_arg(struct intr_frame * f, int index);
-int valid_ptr(int *ptr);
-int valid_arg(struct intr_frame * f, int index);
 static void syscall_handler (struct intr_frame *);
+static int dispatch (int syscall_num, const int *args);
+
+/* SYSENTER configuration MSRs.  See [IA32-v3a] 5.8.7 "Performing
+   Fast Calls to System Procedures with the SYSENTER and SYSEXIT
+   Instructions". */
+#define MSR_SYSENTER_CS 0x174   /* Kernel code selector. */
+#define MSR_SYSENTER_ESP 0x175  /* Kernel stack pointer. */
+#define MSR_SYSENTER_EIP 0x176  /* Kernel entry point. */
+
+/* CPUID leaf 1 EDX flag for SYSENTER and SYSEXIT. */
+#define CPUID_SEP 0x00000800
+
+/* True if user processes may enter through SYSENTER. */
+static bool sysenter_enabled;
+
+/* Entry point for SYSENTER, in sysenter.S. */
+void sysenter_entry (void);
+
+/* Returns true if the CPU implements SYSENTER and SYSEXIT.  The
+   original Pentium Pro sets the CPUID flag without them, so it
+   is ruled out by family, model, and stepping, as [IA32-v2b]
+   "SYSENTER" directs.  lib/user/syscall.c makes the same
+   check. */
+static bool
+sysenter_supported (void)
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+
+  asm ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  if ((edx & CPUID_SEP) == 0)
+    return false;
+  return !(((eax >> 8) & 0xf) == 6 && ((eax >> 4) & 0xf) < 3
+           && (eax & 0xf) < 3);
+}
 
 void
 syscall_init (void) 
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
+
+  /* Set up the fast path, if the CPU has one.  SYSENTER loads
+     SEL_KCSEG and the SS after it; SYSEXIT returns to the user
+     segments that follow those in the GDT.  The stack is set
+     per thread by syscall_set_stack(). */
+  if (sysenter_supported ())
+    {
+      wrmsr (MSR_SYSENTER_CS, SEL_KCSEG);
+      wrmsr (MSR_SYSENTER_EIP, (uint32_t) sysenter_entry);
+      sysenter_enabled = true;
+      tss_update ();
+    }
+}
+
+/* Points SYSENTER at ESP0, the top of the running thread's
+   kernel stack.  sysenter_entry builds the same intr_frame
+   there that int $0x30 would, so the rest of the kernel cannot
+   tell the two entry paths apart. */
+void
+syscall_set_stack (void *esp0)
+{
+  if (sysenter_enabled)
+    wrmsr (MSR_SYSENTER_ESP, (uint32_t) esp0);
 }
 
 static void
-syscall_handler (struct intr_frame *f UNUSED) 
+syscall_handler (struct intr_frame *f) 
 {
+  const struct syscall_desc *d;
+  int args[SYSCALL_ARG_MAX];
   int syscall_num;
 
-  /* check f->frame_pointer validity */
-  struct thread *t = thread_current();
+#ifdef VM
+  thread_current ()->user_esp = f->esp;
+#endif
+  thread_current ()->rusage.syscall_cnt++;
+
+  /* Fetch the number and arguments once; a bad stack kills the
+     process. */
+  if (! copy_from_user (&syscall_num, f->esp, sizeof syscall_num))
+    thread_exit ();
+  TRACEPOINT (TP_SYSCALL, syscall_num, thread_current ()->tid, 0);
+  if (syscall_num < 0 || (unsigned) syscall_num >= SYSCALL_CNT
+      || syscall_table[syscall_num].func == NULL)
+    {
+      f->eax = -1;
+      return;
+    }
+  d = &syscall_table[syscall_num];
+  if (! copy_from_user (args, (int *) f->esp + 1, d->argc * sizeof *args))
+    thread_exit ();
+
+  f->eax = dispatch (syscall_num, args);
+  arena_reset ();
+}
+
+/* Makes system call SYSCALL_NUM, whose arguments have been
+   copied into ARGS, counts it in the statistics, and returns its
+   result. */
+static int
+dispatch (int syscall_num, const int *args)
+{
+  uint64_t start = timer_tsc ();
+  enum intr_level old_level;
+  int result;
+
+  result = syscall_table[syscall_num].func (args);
+#ifdef VM
+  page_unpin_all ();
+#endif
+
+  old_level = intr_disable ();
+  syscall_stats[syscall_num].cnt++;
+  syscall_stats[syscall_num].cycles += timer_tsc () - start;
+  intr_set_level (old_level);
+  return result;
+}
+
+/* Prints the invocation count and average cost of every system
+   call made so far. */
+void
+syscall_print_stats (void)
+{
+  size_t i;
+
+  printf ("Syscall entry: %s\n",
+          sysenter_enabled ? "sysenter, int $0x30" : "int $0x30");
+  for (i = 0; i < SYSCALL_CNT; i++)
+    if (syscall_stats[i].cnt > 0)
+      printf ("Syscall %s: %llu calls, %llu ns avg\n",
+              syscall_table[i].name, syscall_stats[i].cnt,
+              timer_tsc_to_ns (syscall_stats[i].cycles
+                               / syscall_stats[i].cnt));
+}
+
+static int
+sys_halt (const int *args UNUSED)
+{
+  shutdown_power_off ();
+}
+
+static int
+sys_exit (const int *args)
+{
+  thread_current ()->return_status = args[0];
+  thread_exit ();
+}
+
+static int
+sys_exec (const int *args)
+{
+  if (! valid_string ((const char *) args[0]))
+    thread_exit ();
+  return process_execute ((const char *) args[0]);
+}
+
+/* Starts a process like exec, but returns its pid before it has
+   loaded; if loading fails, waiting for it returns -1. */
+static int
+sys_spawn (const int *args)
+{
+  if (! valid_string ((const char *) args[0]))
+    thread_exit ();
+  return process_spawn ((const char *) args[0]);
+}
+
+static int
+sys_fork (const int *args UNUSED)
+{
+  return process_fork ();
+}
+
+static int
+sys_wait (const int *args)
+{
+  return process_wait ((tid_t) args[0]);
+}
+
+/* Waits for any child, storing its exit status into the int at
+   ARGS[0] unless it is null, or returns 0 at once if ARGS[1] is
+   zero and none has exited. */
+static int
+sys_wait_any (const int *args)
+{
+  int *status = (int *) args[0];
+  int exit_status;
+  tid_t tid;
+
+  if (status != NULL && ! valid_write_range (status, sizeof *status))
+    thread_exit ();
+  tid = process_wait_any (&exit_status, args[1] != 0);
+  if (tid > 0 && status != NULL)
+    *status = exit_status;
+  return tid;
+}
+
+static int
+sys_create (const int *args)
+{
+  if (! valid_string ((const char *) args[0]))
+    thread_exit ();
+  return filesys_create ((const char *) args[0], args[1]);
+}
+
+static int
+sys_remove (const int *args)
+{
+  if (! valid_string ((const char *) args[0]))
+    thread_exit ();
+  return filesys_remove ((const char *) args[0]);
+}
+
+static int
+sys_open (const int *args)
+{
   struct file_node *f_node;
+  struct inode *inode;
 
-  if( f->frame_pointer != NULL && is_user_vaddr( f->frame_pointer ) && valid_arg(f, 0) )
-  {
-    memcpy( &syscall_num, f->esp, sizeof(int));
-    switch( syscall_num )
+  if (! valid_string ((const char *) args[0]))
+    thread_exit ();
+
+  f_node = alloc_file_node ();
+  ASSERT (f_node != NULL);
+  if (procfs_owns ((const char *) args[0]))
     {
-      case SYS_HALT:
-        shutdown_power_off();
-        break;
+      f_node->proc = procfs_open ((const char *) args[0]);
+      if (f_node->proc == NULL)
+        {
+          free_file_node (f_node);
+          return -1;
+        }
+    }
+  else
+    {
+      f_node->file = filesys_open ((const char *) args[0]);
+      if (f_node->file == NULL)
+        {
+          free_file_node (f_node);
+          return -1;
+        }
 
-      case SYS_EXIT:
-        if (! valid_arg(f, 1))
-	{
-	  // if arg is invalid, exit with -1
-	  t->return_status = -1;
-	  f->eax = -1;
-          thread_exit();  
-	}
-	else
-	{
-	  // arg is valid, return that value
-          t->return_status = get_arg(f, 1);
-	  f->eax = get_arg(f, 1);
-	  thread_exit();
-	}
-	break;
-
-      case SYS_EXEC:
-        if (! valid_arg(f, 1) || ! valid_ptr(get_arg(f, 1)))
-	{
-	  // if arg is invalid, pid = -1
-	  f->eax = -1;
-          thread_exit();
-	}
-	else
-	{
-          // eax keeps the return value
-          f->eax = process_execute((char *)get_arg(f, 1));
-
-	}
-	break;
-      
-      case SYS_WAIT:
-        if (! valid_arg(f, 1))
-	{
-	  // if arg is invalid, pid = -1
-	  f->eax = -1;
-          thread_exit();  
-	}
-	else
-	{
-	  f->eax = process_wait((tid_t)get_arg(f, 1));
-	}
-	break;
-
-      case SYS_CREATE:
-        if (! valid_arg(f, 1) || ! valid_arg(f, 2) || ! valid_ptr(get_arg(f, 1)))
-	{
-	  // if arg is invalid, killed
-	  f->eax = -1;
-          thread_exit();  
-	}
-	else
-	{
-	  f->eax = filesys_create(get_arg(f, 1), get_arg(f, 2));
-	}
-        break;
+      /* A directory is also opened for readdir. */
+      inode = file_get_inode (f_node->file);
+      if (inode_is_dir (inode))
+        f_node->dir = dir_open (inode_reopen (inode));
+    }
+  if (add_file_node (f_node) < 0)
+    {
+      file_close (f_node->file);
+      dir_close (f_node->dir);
+      procfs_close (f_node->proc);
+      free_file_node (f_node);
+      return -1;
+    }
+  return f_node->fd;
+}
 
-      case SYS_REMOVE:
-        if (! valid_arg(f, 1))
-	{
-	  // if arg is invalid, killed
-	  f->eax = -1;
-          thread_exit();  
-	}
-	else
-	{
-	  f->eax = filesys_remove(get_arg(f, 1));
-	}
-        break;
+/* Returns the open regular file for FD, or a null pointer if FD is
+   not open or is a directory. */
+static struct file *
+lookup_file (int fd)
+{
+  struct file_node *f_node = get_file_node (fd);
+  return f_node != NULL && f_node->dir == NULL ? f_node->file : NULL;
+}
 
-      case SYS_OPEN:
-        if (! valid_arg(f, 1) || ! valid_ptr(get_arg(f, 1)))
-	{
-	  // if arg is invalid, killed
-	  f->eax = -1;
-          thread_exit();  
-	}
-	else
-	{
-	  f_node = calloc(1, sizeof (struct file_node));
-	  ASSERT ( f_node != NULL );
-	    
-	  if ( (f_node->file = filesys_open( get_arg(f, 1)) ) == NULL)
-	  {
-	    f->eax = -1;
-	  }
-	  else
-	  {
-	    f_node->fd = t->fd_index;
-	    t->fd_index++;
-	    list_push_front( &t->file_list, &f_node->file_elem );
-	    f->eax = f_node->fd;
-	  }
-	}
-        break;
+/* Returns the file in /proc, or /proc itself, open as FD, or a null
+   pointer if FD is not open or is something else. */
+static struct proc_file *
+lookup_proc (int fd)
+{
+  struct file_node *f_node = get_file_node (fd);
+  return f_node != NULL ? f_node->proc : NULL;
+}
 
-      case SYS_FILESIZE:
-        if (! valid_arg(f, 1))
-	{
-	  // if arg is invalid, killed
-	  f->eax = -1;
-          thread_exit();  
-	}
-	else
-	{
-	  // get the f_node with given fd
-	  f_node = get_file_node(get_arg(f, 1));
-
-	  ASSERT (f_node != NULL);
-
-	  f->eax = inode_length( file_get_inode(f_node->file) );
-	}
-        break;
+/* Returns the pipe end for FD, or a null pointer if FD is not open
+   or is not a pipe end.  Stores in *WRITER whether it is the
+   write end. */
+static struct pipe *
+lookup_pipe (int fd, bool *writer)
+{
+  struct file_node *f_node = get_file_node (fd);
 
-      case SYS_READ:
-        if (! valid_arg(f, 1) || ! valid_arg(f, 2) || ! valid_arg(f, 3) || ! valid_ptr(get_arg(f, 2)))
-	{
-	  f->eax = -1;
-          thread_exit();  
-	}
-	else
-	{
-	  int fd = get_arg(f, 1);
-
-	  if (fd == 0)
-	  {
-	    // input_getc();
-	  }
-	  else if (fd >= 2 && fd < t->fd_index)
-	  {
-	    f->eax = file_read(get_file_node(fd)->file, get_arg(f, 2), get_arg(f, 3));
-	  }
-	  else
-	  {
-	    f->eax = -1;
-	  }
-	}
-	break;
-       
-      case SYS_WRITE:
-        if (! valid_arg(f, 1) || ! valid_arg(f, 2) || ! valid_arg(f, 3) || ! valid_ptr(get_arg(f, 2)))
-	{
-	  f->eax = -1;
-          thread_exit();  
-	}
-	else
-	{
-	  int fd = get_arg(f, 1);
-
-	  if (fd == 1)
-	  {
-	    putbuf(get_arg(f, 2), get_arg(f, 3));
-	  }
-	  else if (fd >= 2 && fd < t->fd_index)
-	  {
-	    f->eax = file_write(get_file_node(fd)->file, get_arg(f, 2), get_arg(f, 3));
-	  }
-	  else
-	  {
-	    f->eax = 0;
-	  }
-	}
-	break;
-
-      case SYS_SEEK:
-        if (! valid_arg(f, 1) || ! valid_arg(f, 2)  )
-	{
-	  f->eax = -1;
-          thread_exit();  
-	}
-	else
-	{
-	  int fd = get_arg(f, 1);
-	  if ( fd >= 2 && fd < t->fd_index )
-	  {
-	    f_node = get_file_node(fd);
-	    file_seek( f_node->file , get_arg(f, 2) );
-	  }
-	}
-        break;
+  if (f_node == NULL || f_node->pipe == NULL)
+    return NULL;
+  *writer = f_node->pipe_writer;
+  return f_node->pipe;
+}
 
-      case SYS_TELL:
-        if (! valid_arg(f, 1))
-	{
-	  f->eax = -1;
-          thread_exit();  
-	}
-	else
-	{
-	  int fd = get_arg(f, 1);
-	  if ( fd >=2 && fd < t->fd_index )
-	  {
-	    f_node = get_file_node(fd);
-	    f->eax = file_tell( f_node->file ); 
-	  }
-	  else
-	  {
-	    f->eax = -1;
-	  }
-	}
-        break;
+static int
+sys_filesize (const int *args)
+{
+  struct file_node *f_node = get_file_node (args[0]);
 
-      case SYS_CLOSE:
-        if (! valid_arg(f, 1))
-	{
-	  f->eax = -1;
-          thread_exit();  
-	}
-	else
-	{
-	  int fd = get_arg(f, 1);
-	  if ( fd >=2 && fd < t->fd_index )
-	  {
-	    if ((f_node = get_file_node(fd)) != NULL)
-	    {
-	      file_close( f_node->file ); 
-	      list_remove( &f_node->file_elem );
-	    }
-	    else
-	    {
-	      f->eax = -1;
-	    }
-	  }
-	  else
-	  {
-	    f->eax = -1;
-	  }
-	}
-        break;
+  if (f_node == NULL || f_node->file == NULL)
+    return -1;
+  return inode_length (file_get_inode (f_node->file));
+}
 
-      
-      case SYS_CHDIR:		       /* Change the current directory. */
-        break;
+static int
+sys_read (const int *args)
+{
+  uint8_t *buffer = (uint8_t *) args[1];
+  unsigned size = args[2];
+  struct file *file;
+  struct proc_file *proc;
+  struct pipe *pipe;
+  bool writer;
 
-      case SYS_MKDIR:                  /* Create a directory. */
-        break;
+  if (! valid_write_range (buffer, size))
+    thread_exit ();
+  if (args[0] == STDIN_FILENO)
+    {
+      /* Wait for the first byte, then take what else has already
+         arrived, passing it through a kernel buffer because the
+         input buffer is drained with interrupts off. */
+      uint8_t chunk[256];
+      unsigned done = 0;
 
-      case SYS_READDIR:                /* Reads a directory entry. */
-        break;
+      while (done < size)
+        {
+          size_t cnt = input_read (chunk, size - done < sizeof chunk
+                                          ? size - done : sizeof chunk,
+                                   done == 0);
+          if (cnt == 0)
+            break;
+          memcpy (buffer + done, chunk, cnt);
+          done += cnt;
+        }
+      return done;
+    }
+  file = lookup_file (args[0]);
+  if (file != NULL)
+    return file_read (file, buffer, size);
+  proc = lookup_proc (args[0]);
+  if (proc != NULL)
+    return procfs_read (proc, buffer, size);
+  pipe = lookup_pipe (args[0], &writer);
+  return pipe != NULL && !writer ? pipe_read (pipe, buffer, size) : -1;
+}
 
-      case SYS_ISDIR:                  /* Tests if a fd represents a directory. */
-        break;
+static int
+sys_write (const int *args)
+{
+  const void *buffer = (const void *) args[1];
+  unsigned size = args[2];
+  struct file *file;
+  struct pipe *pipe;
+  bool writer;
 
-      case SYS_INUMBER:		       /* Returns the inode number for a fd. */
-        break;
+  if (! valid_range ((void *) buffer, size))
+    thread_exit ();
+  if (args[0] == STDOUT_FILENO)
+    {
+      putbuf (buffer, size);
+      return size;
+    }
+  file = lookup_file (args[0]);
+  if (file != NULL)
+    return file_write (file, buffer, size);
+  pipe = lookup_pipe (args[0], &writer);
+  if (pipe != NULL)
+    return writer ? pipe_write (pipe, buffer, size) : -1;
+  return get_file_node (args[0]) != NULL ? -1 : 0;
+}
+
+static int
+sys_seek (const int *args)
+{
+  struct file_node *f_node = get_file_node (args[0]);
+
+  if (f_node != NULL && f_node->file != NULL)
+    file_seek (f_node->file, args[1]);
+  else if (f_node != NULL && f_node->proc != NULL)
+    procfs_seek (f_node->proc, args[1]);
+  return 0;
+}
+
+static int
+sys_tell (const int *args)
+{
+  struct file_node *f_node = get_file_node (args[0]);
+
+  if (f_node != NULL && f_node->proc != NULL)
+    return procfs_tell (f_node->proc);
+  return f_node != NULL && f_node->file != NULL
+         ? file_tell (f_node->file) : -1;
+}
+
+static int
+sys_close (const int *args)
+{
+  struct file_node *f_node = get_file_node (args[0]);
+
+  if (f_node == NULL)
+    return -1;
+  file_close (f_node->file);
+  dir_close (f_node->dir);
+  if (f_node->pipe != NULL)
+    pipe_close (f_node->pipe, f_node->pipe_writer);
+  procfs_close (f_node->proc);
+  remove_file_node (args[0]);
+  free_file_node (f_node);
+  return 0;
+}
+
+/* Creates a pipe, and stores the fds of its read end and its write
+   end in the two-int user array ARGS[0]. */
+static int
+sys_pipe (const int *args)
+{
+  int *fds = (int *) args[0];
+  struct file_node *ends[2];
+  struct pipe *pipe;
+  int i;
+
+  if (! valid_write_range (fds, 2 * sizeof *fds))
+    thread_exit ();
+  pipe = pipe_create ();
+  if (pipe == NULL)
+    return -1;
+
+  for (i = 0; i < 2; i++)
+    {
+      ends[i] = alloc_file_node ();
+      if (ends[i] != NULL)
+        {
+          ends[i]->pipe = pipe;
+          ends[i]->pipe_writer = i == 1;
+          if (add_file_node (ends[i]) >= 0)
+            continue;
+          free_file_node (ends[i]);
+        }
 
-      default:
-        // TODO
-	;
+      /* Undo the end made so far, if any, and free the pipe. */
+      if (i == 1)
+        {
+          remove_file_node (ends[0]->fd);
+          free_file_node (ends[0]);
+        }
+      pipe_close (pipe, false);
+      pipe_close (pipe, true);
+      return -1;
     }
-  }
+  fds[0] = ends[0]->fd;
+  fds[1] = ends[1]->fd;
+  return 0;
+}
+
+/* Returns the POLL* events that hold for P's file descriptor,
+   masked by the ones it asks for. */
+static int
+poll_fd (const struct pollfd *p)
+{
+  struct file_node *f_node;
+  int events;
+
+  if (p->fd == STDIN_FILENO)
+    events = input_ready () ? POLLIN : 0;
+  else if (p->fd == STDOUT_FILENO)
+    events = POLLOUT;
+  else if ((f_node = get_file_node (p->fd)) == NULL)
+    events = POLLNVAL;
+  else if (f_node->pipe != NULL)
+    events = pipe_poll (f_node->pipe, f_node->pipe_writer);
   else
-  {
+    events = POLLIN | POLLOUT;
+  return events & (p->events | POLLERR | POLLHUP | POLLNVAL);
+}
+
+/* Waits until one of the ARGS[1] file descriptors described by
+   the pollfds at ARGS[0] is ready, or ARGS[2] milliseconds pass,
+   forever if ARGS[2] is negative.  Stores each one's events in its
+   `revents' and returns the number with any, or -1 if there are
+   more than POLL_MAX.  Pipes and the console input wake the
+   caller when they change; files are always ready. */
+static int
+sys_poll (const int *args)
+{
+  struct pollfd *fds = (struct pollfd *) args[0];
+  unsigned cnt = args[1], i;
+  int timeout = args[2];
+  struct poll_waiter *waiters;
+  struct semaphore sema;
+  int64_t deadline = 0;
+  bool expired = false;
+  int ready;
+
+  if (cnt > POLL_MAX)
+    return -1;
+  if (! valid_write_range (fds, cnt * sizeof *fds))
     thread_exit ();
-  }
+  waiters = arena_alloc (cnt * sizeof *waiters);
+  if (waiters == NULL)
+    return -1;
+  if (timeout > 0)
+    deadline = timer_ticks () + DIV_ROUND_UP ((int64_t) timeout * TIMER_FREQ,
+                                              1000);
+
+  /* Register before checking, so that no change is missed. */
+  sema_init (&sema, 0);
+  for (i = 0; i < cnt; i++)
+    {
+      struct file_node *f_node = get_file_node (fds[i].fd);
+
+      waiters[i].sema = NULL;
+      if (fds[i].fd == STDIN_FILENO)
+        input_poll_add (&waiters[i], &sema);
+      else if (f_node != NULL && f_node->pipe != NULL)
+        pipe_poll_add (f_node->pipe, &waiters[i], &sema);
+    }
+
+  for (;;)
+    {
+      ready = 0;
+      for (i = 0; i < cnt; i++)
+        {
+          fds[i].revents = poll_fd (&fds[i]);
+          if (fds[i].revents != 0)
+            ready++;
+        }
+      if (ready > 0 || timeout == 0 || expired)
+        break;
+      if (timeout < 0)
+        sema_down (&sema);
+      else
+        expired = !timer_sema_down (&sema, deadline - timer_ticks ());
+    }
+
+  for (i = 0; i < cnt; i++)
+    if (waiters[i].sema != NULL)
+      poll_queue_remove (&waiters[i]);
+  arena_free (waiters);
+  return ready;
+}
+
+/* Sleeps until woken if the aligned user word ARGS[0] holds
+   ARGS[1].  Returns 0 if woken, -1 if the word held another value
+   or is not readable.  The word is read without pinning it, so
+   that it can be paged out while we sleep. */
+static int
+sys_futex_wait (const int *args)
+{
+  int *uaddr = (int *) args[0];
+
+  if ((uintptr_t) uaddr % sizeof *uaddr != 0)
+    return -1;
+  return futex_wait (uaddr, args[1]) ? 0 : -1;
+}
+
+/* Wakes up to ARGS[1] threads waiting on the aligned user word
+   ARGS[0] and returns the number woken. */
+static int
+sys_futex_wake (const int *args)
+{
+  int *uaddr = (int *) args[0];
+
+  if ((uintptr_t) uaddr % sizeof *uaddr != 0 || ! is_user_vaddr (uaddr))
+    return -1;
+  return futex_wake (uaddr, args[1]);
+}
+
+#ifdef VM
+static int
+sys_mmap (const int *args)
+{
+  struct file *file = lookup_file (args[0]);
+
+  if (file == NULL)
+    return MAP_FAILED;
+  return mmap_map (file, (void *) args[1]);
+}
+
+static int
+sys_munmap (const int *args)
+{
+  mmap_unmap (args[0]);
+  return 0;
+}
+
+static int
+sys_madvise (const int *args)
+{
+  return mmap_advise ((void *) args[0], (unsigned) args[1], args[2]);
+}
+
+static int
+sys_shm_attach (const int *args)
+{
+  return shm_attach (args[0], (void *) args[1], (unsigned) args[2]);
+}
+
+static int
+sys_shm_detach (const int *args)
+{
+  return shm_detach ((void *) args[0]);
+}
+#endif
+
+static int
+sys_pread (const int *args)
+{
+  struct file *file;
+
+  if (! valid_write_range ((void *) args[1], args[2]))
+    thread_exit ();
+  file = lookup_file (args[0]);
+  if (file == NULL || args[3] < 0)
+    return -1;
+  return file_read_at (file, (void *) args[1], args[2], args[3]);
+}
+
+static int
+sys_pwrite (const int *args)
+{
+  struct file *file;
+
+  if (! valid_range ((void *) args[1], args[2]))
+    thread_exit ();
+  file = lookup_file (args[0]);
+  if (file == NULL || args[3] < 0)
+    return -1;
+  return file_write_at (file, (const void *) args[1], args[2], args[3]);
+}
+
+/* Starts reading ARGS[2] bytes of fd ARGS[0] at offset ARGS[3]
+   into user buffer ARGS[1], filled in by aio_wait(), and returns
+   a ticket for the request, or -1 on failure. */
+static int
+sys_aio_read (const int *args)
+{
+  struct file *file;
+
+  if (! valid_write_range ((void *) args[1], args[2]))
+    thread_exit ();
+  file = lookup_file (args[0]);
+  if (file == NULL)
+    return -1;
+  return aio_submit (file, false, (void *) args[1], args[2], args[3]);
+}
+
+/* Starts writing the ARGS[2] bytes of user buffer ARGS[1] to fd
+   ARGS[0] at offset ARGS[3], and returns a ticket for the request,
+   or -1 on failure. */
+static int
+sys_aio_write (const int *args)
+{
+  struct file *file;
+
+  if (! valid_range ((void *) args[1], args[2]))
+    thread_exit ();
+  file = lookup_file (args[0]);
+  if (file == NULL)
+    return -1;
+  return aio_submit (file, true, (void *) args[1], args[2], args[3]);
+}
+
+static int
+sys_aio_poll (const int *args)
+{
+  return aio_poll (args[0]);
+}
+
+static int
+sys_aio_wait (const int *args)
+{
+  return aio_wait (args[0]);
+}
+
+/* Validates the IOVCNT buffers of IOV, which the kernel writes into
+   if WRITABLE, killing the process if any is bad. */
+static void
+check_iovec (const struct iovec *iov, int iovcnt, bool writable)
+{
+  int i;
+
+  if ((unsigned) iovcnt > IOV_MAX
+      || ! valid_range ((void *) iov, iovcnt * sizeof *iov))
+    thread_exit ();
+  for (i = 0; i < iovcnt; i++)
+    if (! (writable
+           ? valid_write_range (iov[i].iov_base, iov[i].iov_len)
+           : valid_range (iov[i].iov_base, iov[i].iov_len)))
+      thread_exit ();
+}
+
+static int
+sys_readv (const int *args)
+{
+  const struct iovec *iov = (const struct iovec *) args[1];
+  struct file *file;
+
+  check_iovec (iov, args[2], true);
+  file = lookup_file (args[0]);
+  return file != NULL ? file_readv (file, iov, args[2]) : -1;
+}
+
+static int
+sys_writev (const int *args)
+{
+  const struct iovec *iov = (const struct iovec *) args[1];
+  struct file *file;
+
+  check_iovec (iov, args[2], false);
+  file = lookup_file (args[0]);
+  return file != NULL ? file_writev (file, iov, args[2]) : -1;
+}
+
+static int
+sys_copy_file_range (const int *args)
+{
+  struct file *in = lookup_file (args[0]);
+  struct file *out = lookup_file (args[1]);
+
+  if (in == NULL || out == NULL || args[2] < 0)
+    return -1;
+  return file_copy (out, in, args[2]);
+}
+
+static int
+sys_ftruncate (const int *args)
+{
+  struct file *file = lookup_file (args[0]);
+
+  if (file == NULL || args[1] < 0)
+    return false;
+  return file_truncate (file, args[1]);
+}
+
+static int
+sys_fallocate (const int *args)
+{
+  struct file *file = lookup_file (args[0]);
+
+  if (file == NULL || args[1] < 0 || args[2] <= 0
+      || args[2] > INT_MAX - args[1])
+    return false;
+  return file_allocate (file, args[1], args[2]);
+}
+
+static int
+sys_clone_file (const int *args)
+{
+  if (! valid_string ((const char *) args[0])
+      || ! valid_string ((const char *) args[1]))
+    thread_exit ();
+  return filesys_clone ((const char *) args[0], (const char *) args[1]);
+}
+
+static int
+sys_compress (const int *args)
+{
+  struct file *file = lookup_file (args[0]);
+
+  if (file == NULL)
+    return false;
+  return file_compress (file, args[1] != 0);
+}
+
+static int
+sys_fadvise (const int *args)
+{
+  struct file *file = lookup_file (args[0]);
+
+  if (file == NULL || args[1] < 0 || args[2] < 0)
+    return false;
+  return file_advise (file, args[1], args[2], args[3]);
+}
+
+/* Writes the file or directory open as FD to disk, skipping its
+   metadata if DATA_ONLY is true and the metadata is unchanged.
+   Returns false if FD is not open or is a pipe end. */
+static bool
+sync_fd (int fd, bool data_only)
+{
+  struct file_node *f_node = get_file_node (fd);
+  struct inode *inode;
+
+  if (f_node == NULL)
+    return false;
+  if (f_node->dir != NULL)
+    inode = dir_get_inode (f_node->dir);
+  else if (f_node->file != NULL)
+    inode = file_get_inode (f_node->file);
+  else
+    return false;
+  return inode_sync (inode, data_only);
+}
+
+static int
+sys_fsync (const int *args)
+{
+  return sync_fd (args[0], false);
+}
+
+static int
+sys_fdatasync (const int *args)
+{
+  return sync_fd (args[0], true);
+}
+
+static int
+sys_sync (const int *args UNUSED)
+{
+  filesys_sync ();
+  return 0;
+}
+
+static int
+sys_stat (const int *args)
+{
+  struct file *file;
+  bool success;
+
+  if (! valid_string ((const char *) args[0])
+      || ! valid_write_range ((void *) args[1], sizeof (struct stat)))
+    thread_exit ();
+  file = filesys_open ((const char *) args[0]);
+  if (file == NULL)
+    return false;
+  success = inode_stat (file_get_inode (file), (struct stat *) args[1]);
+  file_close (file);
+  return success;
+}
+
+static int
+sys_fstat (const int *args)
+{
+  struct file_node *f_node = get_file_node (args[0]);
+
+  if (! valid_write_range ((void *) args[1], sizeof (struct stat)))
+    thread_exit ();
+  if (f_node == NULL || f_node->file == NULL)
+    return false;
+  return inode_stat (file_get_inode (f_node->file), (struct stat *) args[1]);
+}
+
+static int
+sys_getrusage (const int *args)
+{
+  if (! valid_write_range ((void *) args[1], sizeof (struct rusage)))
+    thread_exit ();
+  if (args[0] == RUSAGE_SELF)
+    *(struct rusage *) args[1] = thread_current ()->rusage;
+  else if (args[0] == RUSAGE_CHILDREN)
+    *(struct rusage *) args[1] = thread_current ()->status_rec->child_usage;
+  else
+    return false;
+  return true;
+}
+
+/* Sets the calling process's share of disk bandwidth to WEIGHT
+   and caps it at KBPS kB per second, or not at all if KBPS is
+   0.  Both carry over to processes it starts afterward. */
+static int
+sys_ioprio (const int *args)
+{
+  unsigned weight = args[0], kbps = args[1];
+  struct thread *t = thread_current ();
+
+  if (weight < IOPRIO_WEIGHT_MIN || weight > IOPRIO_WEIGHT_MAX
+      || kbps > UINT_MAX / 2)
+    return false;
+  t->io_weight = weight;
+  t->io_rate = kbps * (1024 / BLOCK_SECTOR_SIZE);
+  return true;
+}
+
+/* Makes the calls queued on the ring at ARGS[0], as described in
+   lib/syscall-nr.h, and returns how many it made, or -1 if the
+   ring's counters are out of range.  A queued call that may not
+   be made from a ring completes with -1.  Each call runs as if
+   made on its own, so one with a bad pointer kills the process
+   just the same. */
+static int
+sys_ring_enter (const int *args)
+{
+  struct ring *ring = (struct ring *) args[0];
+  unsigned sq_head, sq_tail, cq_head, cq_tail;
+  int cnt = 0;
+
+  if (! copy_from_user (&sq_head, &ring->sq_head, sizeof sq_head)
+      || ! copy_from_user (&sq_tail, &ring->sq_tail, sizeof sq_tail)
+      || ! copy_from_user (&cq_head, &ring->cq_head, sizeof cq_head)
+      || ! copy_from_user (&cq_tail, &ring->cq_tail, sizeof cq_tail))
+    thread_exit ();
+  if (sq_tail - sq_head > RING_ENTRIES || cq_tail - cq_head > RING_ENTRIES)
+    return -1;
+
+  for (; sq_head != sq_tail && cq_tail - cq_head < RING_ENTRIES; cnt++)
+    {
+      struct ring_sqe sqe;
+      struct ring_cqe cqe;
+
+      if (! copy_from_user (&sqe, &ring->sq[sq_head++ % RING_ENTRIES],
+                            sizeof sqe))
+        thread_exit ();
+      cqe.user_data = sqe.user_data;
+      cqe.result = -1;
+      if (sqe.nr >= 0 && (unsigned) sqe.nr < SYSCALL_CNT
+          && syscall_table[sqe.nr].ring)
+        cqe.result = dispatch (sqe.nr, sqe.args);
+      if (! copy_to_user (&ring->cq[cq_tail++ % RING_ENTRIES], &cqe,
+                          sizeof cqe))
+        thread_exit ();
+    }
+
+  if (! copy_to_user (&ring->sq_head, &sq_head, sizeof sq_head)
+      || ! copy_to_user (&ring->cq_tail, &cq_tail, sizeof cq_tail))
+    thread_exit ();
+  return cnt;
+}
+
+static int
+sys_chdir (const int *args)
+{
+  if (! valid_string ((const char *) args[0]))
+    thread_exit ();
+  return filesys_chdir ((const char *) args[0]);
+}
+
+static int
+sys_mkdir (const int *args)
+{
+  if (! valid_string ((const char *) args[0]))
+    thread_exit ();
+  return filesys_mkdir ((const char *) args[0]);
+}
+
+static int
+sys_readdir (const int *args)
+{
+  struct file_node *f_node;
+
+  if (! valid_write_range ((void *) args[1], NAME_MAX + 1))
+    thread_exit ();
+  f_node = get_file_node (args[0]);
+  if (f_node != NULL && f_node->proc != NULL)
+    return procfs_readdir (f_node->proc, (char *) args[1]);
+  if (f_node == NULL || f_node->dir == NULL)
+    return false;
+  return dir_readdir (f_node->dir, (char *) args[1]);
+}
+
+static int
+sys_isdir (const int *args)
+{
+  struct file_node *f_node = get_file_node (args[0]);
+
+  if (f_node != NULL && f_node->proc != NULL)
+    return procfs_is_dir (f_node->proc);
+  return f_node != NULL && f_node->dir != NULL;
 }
 
+static int
+sys_inumber (const int *args)
+{
+  struct file_node *f_node = get_file_node (args[0]);
+
+  if (f_node == NULL || f_node->file == NULL)
+    return -1;
+  return inode_get_inumber (file_get_inode (f_node->file));
+}
+
+static int
+sys_readdir_batch (const int *args)
+{
+  struct file_node *f_node;
+
+  if ((unsigned) args[2] > PGSIZE
+      || ! valid_write_range ((void *) args[1],
+                              args[2] * sizeof (struct readdir_record)))
+    thread_exit ();
+  f_node = get_file_node (args[0]);
+  if (f_node == NULL || f_node->dir == NULL)
+    return -1;
+  return dir_readdir_batch (f_node->dir, (struct readdir_record *) args[1],
+                            args[2]);
+}
+
+/* A null device name stands for the file system device. */
+static int
+sys_blockstats (const int *args)
+{
+  struct block *block;
+
+  if ((args[0] != 0 && ! valid_string ((const char *) args[0]))
+      || ! valid_write_range ((void *) args[1], sizeof (struct block_stats)))
+    thread_exit ();
+  block = (args[0] == 0 ? block_get_role (BLOCK_FILESYS)
+           : block_get_by_name ((const char *) args[0]));
+  if (block == NULL)
+    return false;
+  block_get_stats (block, (struct block_stats *) args[1]);
+  return true;
+}
+
+static int
+sys_sched_trace (const int *args UNUSED)
+{
+  thread_dump_trace ();
+  return 0;
+}
+
+static int
+sys_ticks (const int *args UNUSED)
+{
+  return timer_ticks ();
+}
+
+/*
+Read a byte at user virtual address UADDR, which must be below PHYS_BASE.
+Returns the byte value if successful, -1 if a page fault occurred.
+The fault handler recognizes the faulting instruction by its label,
+stores -1 in eax and resumes at the address saved in eax beforehand.
+*/
+static int __attribute__ ((noinline, noclone))
+get_user (const uint8_t *uaddr)
+{
+  int result;
+  asm volatile ("movl $1f, %0\n"
+                ".globl user_access_get\n"
+                "user_access_get: movzbl %1, %0\n"
+                "1:"
+                : "=&a" (result) : "m" (*uaddr));
+  return result;
+}
+
+/*
+Write BYTE to user address UDST, which must be below PHYS_BASE.
+Returns true if successful, false if a page fault occurred.
+*/
+static bool __attribute__ ((noinline, noclone))
+put_user (uint8_t *udst, uint8_t byte)
+{
+  int error_code;
+  asm volatile ("movl $1f, %0\n"
+                ".globl user_access_put\n"
+                "user_access_put: movb %b2, %1\n"
+                "1:"
+                : "=&a" (error_code), "=m" (*udst) : "q" (byte));
+  return error_code != -1;
+}
+
+/* True if the SIZE bytes at START lie entirely below PHYS_BASE. */
+static bool
+is_user_range (const void *start, size_t size)
+{
+  uintptr_t p = (uintptr_t) start;
+  return p + size >= p && is_user_vaddr ((void *) (p + size - (size > 0)));
+}
+
+/*
+Copy SIZE bytes from user address USRC to kernel buffer DST.
+Returns false, leaving DST partly written, if any byte is invalid.
+*/
+bool
+copy_from_user (void *dst, const void *usrc, size_t size)
+{
+  uint8_t *d = dst;
+  const uint8_t *s = usrc;
+
+  if (! is_user_range (usrc, size))
+    return false;
+  for (; size > 0; size--)
+    {
+      int c = get_user (s++);
+      if (c == -1)
+        return false;
+      *d++ = c;
+    }
+  return true;
+}
+
+/*
+Copy SIZE bytes from kernel buffer SRC to user address UDST.
+Returns false if any destination byte is unmapped or read-only.
+*/
+bool
+copy_to_user (void *udst, const void *src, size_t size)
+{
+  uint8_t *d = udst;
+  const uint8_t *s = src;
+
+  if (! is_user_range (udst, size))
+    return false;
+  for (; size > 0; size--)
+    if (! put_user (d++, *s++))
+      return false;
+  return true;
+}
+
+/*
+Copy the null-terminated user string USRC into DST, which holds SIZE
+bytes.  Returns the string length, or -1 if USRC is invalid or the
+string (with its null terminator) does not fit.
+*/
 int
-valid_ptr(int *ptr)
+strncpy_from_user (char *dst, const char *usrc, size_t size)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    {
+      int c;
+      if (! is_user_vaddr (usrc + i) || (c = get_user ((const uint8_t *) usrc + i)) == -1)
+        return -1;
+      dst[i] = c;
+      if (c == '\0')
+        return i;
+    }
+  return -1;
+}
+
+/*
+Keep the page holding UADDR resident until the system call returns,
+so the kernel can access it directly while holding file system locks.
+*/
+static bool
+pin_user (const void *uaddr UNUSED)
 {
-  return ptr != NULL && is_user_vaddr( ptr ) && ( pagedir_get_page(thread_current()->pagedir, ptr) != NULL );
+#ifdef VM
+  return page_pin (uaddr);
+#else
+  return true;
+#endif
 }
 
 /*
-Check validity of ith argument.
-They may exit after calling this.
+Check that every page of the SIZE bytes at START is readable user memory.
 */
 int
-valid_arg(struct intr_frame * f, int index)
+valid_range(void *start, unsigned size)
 {
-  int *ptr = (int *)(f->esp) + index; // current point (to stack)
-  
-  return valid_ptr(ptr);
+  uint8_t *p = start;
+  uint8_t *end = p + size;
+
+  if (size == 0)
+    return 1;
+  if (! is_user_range (start, size) || get_user (end - 1) == -1)
+    return 0;
+  for (; p < end; p = (uint8_t *) pg_round_down (p) + PGSIZE)
+    if (get_user (p) == -1 || ! pin_user (p))
+      return 0;
+  return 1;
 }
 
-/* get the ith argument above esp */
+/*
+Check that every page of the SIZE bytes at START is writable user memory.
+Each probe writes back the byte it read, so the buffer is unchanged.
+*/
 int
-get_arg(struct intr_frame * f, int index)
+valid_write_range(void *start, unsigned size)
 {
-  return * ( (int *)(f->esp) + index ); // current point (to stack)
+  uint8_t *p = start;
+  uint8_t *end = p + size;
+  int c;
+
+  if (size == 0)
+    return 1;
+  if (! is_user_range (start, size))
+    return 0;
+  if ((c = get_user (end - 1)) == -1 || ! put_user (end - 1, c))
+    return 0;
+  for (; p < end; p = (uint8_t *) pg_round_down (p) + PGSIZE)
+    if ((c = get_user (p)) == -1 || ! put_user (p, c) || ! pin_user (p))
+      return 0;
+  return 1;
+}
+
+/*
+Check that STR is a null-terminated string in readable user memory,
+however many pages it spans.
+*/
+int
+valid_string(const char *str)
+{
+  const uint8_t *p = (const uint8_t *) str;
+  int c;
+
+  if (str == NULL)
+    return 0;
+  do
+    {
+      if (! is_user_vaddr (p) || (c = get_user (p)) == -1)
+        return 0;
+      if ((p == (const uint8_t *) str || pg_ofs (p) == 0) && ! pin_user (p))
+        return 0;
+      p++;
+    }
+  while (c != '\0');
+  return 1;
 }
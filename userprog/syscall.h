@@ -1,6 +1,15 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
 void syscall_init (void);
+void syscall_print_stats (void);
+void syscall_set_stack (void *esp0);
+
+bool copy_from_user (void *dst, const void *usrc, size_t size);
+bool copy_to_user (void *udst, const void *src, size_t size);
+int strncpy_from_user (char *dst, const char *usrc, size_t size);
 
 #endif /* userprog/syscall.h */
@@ -5,6 +5,7 @@
 #include "threads/thread.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
+#include "userprog/syscall.h"
 
 /* The Task-State Segment (TSS).
 
@@ -103,4 +104,5 @@ tss_update (void)
 {
   ASSERT (tss != NULL);
   tss->esp0 = (uint8_t *) thread_current () + PGSIZE;
+  syscall_set_stack (tss->esp0);
 }
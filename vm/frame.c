@@ -0,0 +1,299 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+
+struct lock frame_lock;
+
+/* Every frame in use, in clock order. */
+static struct list frames;
+
+/* Clock hand: the next frame to consider for eviction, or the
+   list end to restart from the beginning. */
+static struct list_elem *hand;
+
+/* Working set estimation.
+
+   Each process's working set is estimated from the accessed bits
+   that the clock tests anyway: the pages of a process found
+   accessed during one revolution of the hand are a sample of its
+   working set.  At the end of each revolution, counted by
+   CLOCK_EPOCH, the sample is folded into the process's estimate,
+   which rises to a larger sample at once and decays by a quarter
+   of the difference toward a smaller one, so that a process that
+   pauses for a revolution keeps most of its estimate.  Processes
+   are brought up to date lazily, when they are next sampled or
+   looked at, rather than all at each revolution.
+
+   The estimate serves as a soft frame quota.  On its first pass,
+   the clock passes over unaccessed pages of processes holding no
+   more frames than their working set, other than those of the
+   process that needs the frame, so that a process that thrashes
+   mostly replaces its own pages rather than everyone else's.
+   Only if that finds no victim are those pages taken too. */
+static unsigned clock_epoch;
+
+/* Revolutions after which an unsampled estimate is forgotten. */
+#define WS_EPOCH_MAX 8
+
+/* Statistics. */
+static unsigned long long evict_cnt;
+static unsigned long long reclaim_cnt;  /* Frames given back to the kernel. */
+static unsigned long long spared_cnt;   /* Pages spared as in a working
+                                           set. */
+
+static struct frame *evict (void);
+static void ws_update (struct thread *);
+static palloc_reclaim_func reclaim;
+
+/* Initializes the frame table. */
+void
+frame_init (void)
+{
+  lock_init (&frame_lock);
+  lock_set_name (&frame_lock, "frame table");
+  list_init (&frames);
+  hand = list_end (&frames);
+  palloc_set_reclaim (reclaim);
+}
+
+/* Returns a frame for page P owned by the running process, filled
+   with zeros if ZERO is true.  If the user pool is exhausted and
+   MAY_EVICT is true, evicts another page to make room.  Returns a
+   null pointer if no frame can be had.  The caller must hold
+   frame_lock; the frame comes back pinned. */
+struct frame *
+frame_alloc (struct page *p, bool zero, bool may_evict)
+{
+  struct frame *f;
+  void *kpage;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  kpage = palloc_get_page (PAL_USER | (zero ? PAL_ZERO : 0));
+  if (kpage != NULL)
+    {
+      f = malloc (sizeof *f);
+      if (f == NULL)
+        {
+          palloc_free_page (kpage);
+          return NULL;
+        }
+      f->kpage = kpage;
+      list_insert (hand, &f->elem);
+    }
+  else
+    {
+      if (!may_evict)
+        return NULL;
+      f = evict ();
+      if (f == NULL)
+        return NULL;
+      if (zero)
+        memset (f->kpage, 0, PGSIZE);
+      f->owner->frame_cnt--;
+    }
+  f->owner = thread_current ();
+  f->owner->frame_cnt++;
+  f->page = p;
+  f->pinned = true;
+  return f;
+}
+
+/* Releases frame F and its memory.  The caller must hold
+   frame_lock and have already unmapped F's page. */
+void
+frame_free (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  if (hand == &f->elem)
+    hand = list_next (hand);
+  list_remove (&f->elem);
+  f->owner->frame_cnt--;
+  palloc_free_page (f->kpage);
+  free (f);
+}
+
+/* Charges frame F to process T instead of its current owner.
+   The caller must hold frame_lock. */
+void
+frame_set_owner (struct frame *f, struct thread *t)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  f->owner->frame_cnt--;
+  f->owner = t;
+  t->frame_cnt++;
+}
+
+/* Folds the samples of T's working set from past revolutions of
+   the clock into its estimate. */
+static void
+ws_update (struct thread *t)
+{
+  if (clock_epoch - t->ws_epoch > WS_EPOCH_MAX)
+    {
+      t->ws_size = t->ws_sample = 0;
+      t->ws_epoch = clock_epoch;
+    }
+  for (; t->ws_epoch != clock_epoch; t->ws_epoch++)
+    {
+      if (t->ws_sample > t->ws_size)
+        t->ws_size = t->ws_sample;
+      else
+        t->ws_size -= (t->ws_size - t->ws_sample) / 4;
+      t->ws_sample = 0;
+    }
+}
+
+/* Returns true if process T holds more frames than its working
+   set estimate. */
+static bool
+over_working_set (struct thread *t)
+{
+  ws_update (t);
+  return t->frame_cnt > t->ws_size;
+}
+
+/* Advances the clock hand and returns the frame it passed. */
+static struct frame *
+advance (void)
+{
+  struct frame *f;
+
+  if (hand == list_end (&frames))
+    {
+      hand = list_begin (&frames);
+      clock_epoch++;
+    }
+  ASSERT (hand != list_end (&frames));
+  f = list_entry (hand, struct frame, elem);
+  hand = list_next (hand);
+  return f;
+}
+
+/* Chooses a victim with the clock algorithm: a recently accessed
+   page gets a second chance, its accessed bit cleared, and counts
+   toward its process's working set.  For one revolution, pages of
+   other processes within their working sets are spared too.
+
+   If the victim must go to swap, the clock looks a little further
+   for up to SWAP_CLUSTER - 1 more pages bound for swap and evicts
+   them in the same batch, so that swap is written in long runs;
+   their frames go back to the user pool.
+
+   Pages out the victims and returns the first one's frame, or a
+   null pointer if every frame is pinned or swap is full. */
+static struct frame *
+evict (void)
+{
+  struct frame *victims[SWAP_CLUSTER];
+  struct thread *cur = thread_current ();
+  size_t cnt = 0;
+  size_t passed = 0, frame_cnt = list_size (&frames);
+  size_t tries = 3 * frame_cnt;
+  size_t i;
+
+  for (; tries > 0 && cnt < SWAP_CLUSTER; tries--)
+    {
+      struct frame *f = advance ();
+      bool needs_swap;
+
+      if (f->pinned)
+        continue;
+      if (page_test_accessed (f))
+        {
+          ws_update (f->owner);
+          f->owner->ws_sample++;
+          continue;
+        }
+      if (passed++ < frame_cnt && f->owner != cur
+          && !over_working_set (f->owner))
+        {
+          spared_cnt++;
+          continue;
+        }
+      needs_swap = page_needs_swap (f->page, f->owner);
+      if (cnt > 0 && !needs_swap)
+        continue;
+      victims[cnt++] = f;
+      if (!needs_swap)
+        break;
+      if (cnt == 1 && tries > 2 * SWAP_CLUSTER)
+        tries = 2 * SWAP_CLUSTER;
+    }
+  if (cnt == 0)
+    return NULL;
+
+  /* If swap has no room for the whole batch, try the first victim
+     by itself. */
+  if (!page_evict (victims, cnt, true))
+    {
+      if (cnt == 1 || !page_evict (victims, 1, true))
+        return NULL;
+      cnt = 1;
+    }
+  evict_cnt += cnt;
+
+  for (i = 1; i < cnt; i++)
+    frame_free (victims[i]);
+
+  /* Memory is short: have the kernel caches give up a little
+     too. */
+  palloc_shrink (SHRINK_PRIORITY);
+  return victims[0];
+}
+
+/* Evicts up to CNT pages whose frames were borrowed from the
+   kernel pool, so that the kernel gets its memory back, and
+   returns the number evicted.  Called by palloc_get_multiple()
+   when the kernel pool runs low.  Pinned pages are left alone, and
+   so are pages that would be written back to a file, because the
+   allocating thread may hold file system locks.  Does nothing if
+   frame_lock is busy, for the same reason.  Evicted pages are not
+   kept compressed: that would take kernel memory while giving it
+   back, from inside the page allocator. */
+static size_t
+reclaim (size_t cnt)
+{
+  struct list_elem *e, *next;
+  size_t freed = 0;
+
+  if (lock_held_by_current_thread (&frame_lock)
+      || !lock_try_acquire (&frame_lock))
+    return 0;
+  for (e = list_begin (&frames); e != list_end (&frames) && freed < cnt;
+       e = next)
+    {
+      struct frame *f = list_entry (e, struct frame, elem);
+
+      next = list_next (e);
+      if (f->pinned || !palloc_is_borrowed (f->kpage)
+          || (f->page->file != NULL && f->page->write_back))
+        continue;
+      if (!page_evict (&f, 1, false))
+        break;
+      frame_free (f);
+      freed++;
+    }
+  reclaim_cnt += freed;
+  lock_release (&frame_lock);
+  return freed;
+}
+
+/* Prints frame table statistics. */
+void
+frame_print_stats (void)
+{
+  printf ("Frames: %zu in use, %llu evictions, %llu given back to the "
+          "kernel, %llu spared in working sets\n",
+          list_size (&frames), evict_cnt, reclaim_cnt, spared_cnt);
+}
@@ -0,0 +1,34 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <list.h>
+#include <stdbool.h>
+#include "threads/synch.h"
+
+struct page;
+struct thread;
+
+/* A frame holding one process page, from the user pool or
+   borrowed from the kernel pool. */
+struct frame
+  {
+    void *kpage;                /* Kernel virtual address. */
+    struct thread *owner;       /* Process the page belongs to.  For a
+                                   shared page, one of them. */
+    struct page *page;          /* Page held in the frame. */
+    bool pinned;                /* Exempt from eviction? */
+    struct list_elem elem;      /* Element in the frame table. */
+  };
+
+/* Protects the frame table and, through it, every process's
+   resident pages and swap slots: a frame may be evicted by any
+   thread, so paging state is only changed with this lock held. */
+extern struct lock frame_lock;
+
+void frame_init (void);
+struct frame *frame_alloc (struct page *, bool zero, bool may_evict);
+void frame_free (struct frame *);
+void frame_set_owner (struct frame *, struct thread *);
+void frame_print_stats (void);
+
+#endif /* vm/frame.h */
@@ -0,0 +1,207 @@
+#include "vm/mmap.h"
+#include <debug.h>
+#include <round.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/page.h"
+
+/* A memory-mapped file.  Its pages are faulted in from FILE on
+   first access and written back, if dirty, when unmapped. */
+struct mapping
+  {
+    mapid_t id;                 /* Identifier. */
+    struct file *file;          /* Private handle on the mapped file. */
+    uint8_t *base;              /* First mapped page. */
+    off_t length;               /* Bytes mapped. */
+    size_t page_cnt;            /* Number of mapped pages. */
+    struct list_elem elem;      /* Element in thread's `mappings'. */
+  };
+
+static bool add_pages (struct mapping *);
+static void unmap (struct mapping *);
+
+/* Initializes the running process's list of mappings. */
+void
+mmap_init (void)
+{
+  struct thread *t = thread_current ();
+  list_init (&t->mappings);
+  t->next_mapid = 0;
+}
+
+/* Maps FILE at ADDR in the running process.  Fails, returning
+   MAP_FAILED, if FILE is empty, ADDR is null or not page-aligned,
+   or any page of the range is already in use. */
+mapid_t
+mmap_map (struct file *file, void *addr)
+{
+  struct thread *t = thread_current ();
+  struct mapping *m;
+  off_t length = file_length (file);
+  size_t page_cnt = DIV_ROUND_UP (length, PGSIZE);
+  size_t i;
+
+  if (length == 0 || addr == NULL || pg_ofs (addr) != 0
+      || (uintptr_t) addr + page_cnt * PGSIZE > (uintptr_t) PHYS_BASE
+      || (uintptr_t) addr + page_cnt * PGSIZE < (uintptr_t) addr)
+    return MAP_FAILED;
+  for (i = 0; i < page_cnt; i++)
+    if (page_is_mapped ((uint8_t *) addr + i * PGSIZE))
+      return MAP_FAILED;
+
+  m = malloc (sizeof *m);
+  if (m == NULL)
+    return MAP_FAILED;
+  m->file = file_reopen (file);
+  if (m->file == NULL)
+    {
+      free (m);
+      return MAP_FAILED;
+    }
+  m->base = addr;
+  m->length = length;
+  if (!add_pages (m))
+    {
+      unmap (m);
+      return MAP_FAILED;
+    }
+
+  m->id = t->next_mapid++;
+  list_push_back (&t->mappings, &m->elem);
+  return m->id;
+}
+
+/* Applies access pattern ADVICE, one of the ADVICE_* values in
+   <syscall-nr.h>, to the files mapped in the LENGTH bytes of the
+   running process's memory starting at ADDR, through
+   file_advise() on the part of each mapped file that the range
+   covers.  Pages already resident are not affected.  Returns false
+   if ADVICE is not valid or the range covers no mapping. */
+bool
+mmap_advise (void *addr, size_t length, int advice)
+{
+  struct thread *t = thread_current ();
+  uintptr_t start = (uintptr_t) addr;
+  uintptr_t end = start + length;
+  bool found = false;
+  struct list_elem *e;
+
+  if (end < start)
+    return false;
+  for (e = list_begin (&t->mappings); e != list_end (&t->mappings);
+       e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      uintptr_t base = (uintptr_t) m->base;
+      uintptr_t lo = start > base ? start : base;
+      uintptr_t hi = end < base + m->length ? end : base + m->length;
+
+      if (lo >= hi)
+        continue;
+      if (!file_advise (m->file, lo - base, hi - lo, advice))
+        return false;
+      found = true;
+    }
+  return found;
+}
+
+/* Gives the running process, just forked from PARENT, a mapping of
+   its own for each of PARENT's, at the same address and with the
+   same identifier, on a new handle for the same file.  Its pages
+   are read from the file on first access; page_table_fork() has
+   written back what the parent changed.  Returns false if memory
+   allocation fails, leaving what was mapped for
+   mmap_unmap_all(). */
+bool
+mmap_fork (struct thread *parent)
+{
+  struct thread *t = thread_current ();
+  struct list_elem *e;
+
+  t->next_mapid = parent->next_mapid;
+  for (e = list_begin (&parent->mappings); e != list_end (&parent->mappings);
+       e = list_next (e))
+    {
+      struct mapping *pm = list_entry (e, struct mapping, elem);
+      struct mapping *m = malloc (sizeof *m);
+
+      if (m == NULL)
+        return false;
+      m->file = file_reopen (pm->file);
+      if (m->file == NULL)
+        {
+          free (m);
+          return false;
+        }
+      m->id = pm->id;
+      m->base = pm->base;
+      m->length = pm->length;
+      list_push_back (&t->mappings, &m->elem);
+      if (!add_pages (m))
+        return false;
+    }
+  return true;
+}
+
+/* Adds the pages of M, which has none yet, to the running
+   process's page table.  Returns false if memory allocation fails,
+   with M->page_cnt pages added. */
+static bool
+add_pages (struct mapping *m)
+{
+  size_t page_cnt = DIV_ROUND_UP (m->length, PGSIZE);
+
+  for (m->page_cnt = 0; m->page_cnt < page_cnt; m->page_cnt++)
+    {
+      off_t ofs = m->page_cnt * PGSIZE;
+      size_t read_bytes = m->length - ofs < PGSIZE ? m->length - ofs : PGSIZE;
+      if (!page_add (m->base + ofs, m->file, ofs, read_bytes, true, true))
+        return false;
+    }
+  return true;
+}
+
+/* Unmaps mapping ID of the running process.  Returns false if
+   there is no such mapping. */
+bool
+mmap_unmap (mapid_t id)
+{
+  struct list *mappings = &thread_current ()->mappings;
+  struct list_elem *e;
+
+  for (e = list_begin (mappings); e != list_end (mappings); e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      if (m->id == id)
+        {
+          list_remove (&m->elem);
+          unmap (m);
+          return true;
+        }
+    }
+  return false;
+}
+
+/* Unmaps every mapping of the running process, at exit. */
+void
+mmap_unmap_all (void)
+{
+  struct list *mappings = &thread_current ()->mappings;
+
+  while (!list_empty (mappings))
+    unmap (list_entry (list_pop_front (mappings), struct mapping, elem));
+}
+
+/* Writes back M's dirty pages and frees M. */
+static void
+unmap (struct mapping *m)
+{
+  size_t i;
+
+  for (i = 0; i < m->page_cnt; i++)
+    page_remove (page_lookup (m->base + i * PGSIZE));
+  file_close (m->file);
+  free (m);
+}
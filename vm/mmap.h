@@ -0,0 +1,21 @@
+#ifndef VM_MMAP_H
+#define VM_MMAP_H
+
+#include <list.h>
+#include <stddef.h>
+
+struct file;
+struct thread;
+
+/* Map region identifier, as returned by the mmap system call. */
+typedef int mapid_t;
+#define MAP_FAILED ((mapid_t) -1)
+
+void mmap_init (void);
+mapid_t mmap_map (struct file *, void *addr);
+bool mmap_unmap (mapid_t);
+bool mmap_advise (void *addr, size_t length, int advice);
+void mmap_unmap_all (void);
+bool mmap_fork (struct thread *parent);
+
+#endif /* vm/mmap.h */
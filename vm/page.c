@@ -0,0 +1,1107 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/share.h"
+#include "vm/swap.h"
+
+/* Largest size the user stack may grow to, in bytes. */
+size_t page_stack_max = 8 * 1024 * 1024;
+
+/* Pages per fault-around cluster: a page read from a file is read
+   together with the rest of its aligned cluster of user pages
+   that follow on from it in the file. */
+#define FAULT_AROUND 4
+
+/* The page of zeros that every process maps, read-only, for an
+   all-zero page it has only read so far. */
+static void *zero_page;
+
+/* Statistics. */
+static unsigned long long fork_cnt;     /* Page tables copied. */
+static unsigned long long cow_cnt;      /* Pages copied on write. */
+static unsigned long long zero_cnt;     /* Zero page mappings. */
+static unsigned long long around_cnt;   /* Pages read by fault-around. */
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static hash_action_func page_destroy;
+
+/* Allocates the shared zero page. */
+void
+page_init (void)
+{
+  zero_page = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+}
+
+/* Initializes the running process's supplemental page table.
+   Returns false if memory allocation fails. */
+bool
+page_table_init (void)
+{
+  struct thread *t = thread_current ();
+
+  t->pin_cnt = 0;
+  memset (t->page_cache, 0, sizeof t->page_cache);
+  if (!hash_init (&t->pages, page_hash, page_less, NULL))
+    return false;
+
+  /* Page faults insert into and search this table, so keep any one
+     insertion from having to rehash the whole of it. */
+  hash_set_incremental (&t->pages, true);
+  return true;
+}
+
+/* Frees every page of the running process, with their frames and
+   swap slots.  Must be called while its page directory is still
+   in place. */
+void
+page_table_destroy (void)
+{
+  struct thread *t = thread_current ();
+
+  lock_acquire (&frame_lock);
+  hash_destroy (&t->pages, page_destroy);
+  lock_release (&frame_lock);
+  memset (t->page_cache, 0, sizeof t->page_cache);
+}
+
+/* Records that UPAGE, which must be page-aligned and not yet
+   mapped, holds READ_BYTES bytes of FILE starting at OFS followed
+   by zeros.  FILE may be null if READ_BYTES is 0.  If WRITE_BACK,
+   modified contents are written back to FILE when the page is
+   evicted or removed.  Returns false if memory allocation fails. */
+bool
+page_add (void *upage, struct file *file, off_t ofs, size_t read_bytes,
+          bool writable, bool write_back)
+{
+  struct page *p;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (read_bytes <= PGSIZE);
+  ASSERT (file != NULL || read_bytes == 0);
+
+  p = malloc (sizeof *p);
+  if (p == NULL)
+    return false;
+  p->upage = upage;
+  p->file = file;
+  p->ofs = ofs;
+  p->read_bytes = read_bytes;
+  p->writable = writable;
+  p->write_back = write_back;
+  p->owner = thread_current ();
+  p->frame = NULL;
+  p->swap_slot = SWAP_ERROR;
+  p->pinned = false;
+  p->zero = false;
+  p->share = NULL;
+  if (hash_insert (&thread_current ()->pages, &p->elem) != NULL)
+    {
+      free (p);
+      return false;
+    }
+  return true;
+}
+
+/* Returns the slot of the running process's page cache that
+   would hold the page at UPAGE. */
+static struct page **
+cache_slot (const void *upage)
+{
+  return &thread_current ()->page_cache[pg_no (upage) % PAGE_CACHE_CNT];
+}
+
+/* Returns the running process's page containing UPAGE, or a null
+   pointer if there is none.
+
+   System calls validate and pin the same few stack and buffer
+   pages over and over, so the last page found for each of a few
+   page numbers is remembered and checked before the hash table.
+   page_remove() forgets a page before freeing it. */
+struct page *
+page_lookup (const void *upage)
+{
+  struct page **slot = cache_slot (upage);
+  struct page p;
+  struct hash_elem *e;
+
+  p.upage = pg_round_down (upage);
+  if (*slot != NULL && (*slot)->upage == p.upage)
+    return *slot;
+  e = hash_find (&thread_current ()->pages, &p.elem);
+  if (e == NULL)
+    return NULL;
+  *slot = hash_entry (e, struct page, elem);
+  return *slot;
+}
+
+/* Returns true if the page containing UPAGE is in use, whether
+   resident or not. */
+bool
+page_is_mapped (const void *upage)
+{
+  return (pagedir_get_page (thread_current ()->pagedir, upage) != NULL
+          || page_lookup (upage) != NULL);
+}
+
+/* Returns true if P is in a share whose contents exist only in
+   memory or swap: a copy-on-write or shared memory page. */
+static bool
+is_anonymous_share (const struct page *p)
+{
+  return p->share != NULL && p->share->inode == NULL;
+}
+
+/* Returns true if P is shared copy-on-write with another process,
+   after fork(). */
+static bool
+is_cow (const struct page *p)
+{
+  return is_anonymous_share (p) && !p->share->writable;
+}
+
+/* Writes resident page P of OWNER back to its file if it is dirty
+   and file-backed. */
+static void
+write_back (struct page *p, struct thread *owner)
+{
+  if (p->frame != NULL && p->write_back
+      && pagedir_is_dirty (owner->pagedir, p->upage))
+    file_write_page (p->file, p->frame->kpage, p->read_bytes, p->ofs);
+}
+
+/* Turns copy-on-write share S, which has only one page left, back
+   into a private page of that page's process, which may then write
+   it without faulting.  Its contents may differ from any copy on
+   disk, so a resident page is marked dirty.  Returns false,
+   leaving S alone, if memory allocation fails.  The caller must
+   hold frame_lock. */
+static bool
+unshare (struct share *s)
+{
+  struct page *q = list_entry (list_front (&s->pages), struct page,
+                               share_elem);
+  uint32_t *pd = q->owner->pagedir;
+
+  ASSERT (s->inode == NULL && list_size (&s->pages) == 1);
+
+  if (s->frame != NULL)
+    {
+      if (q->frame != NULL)
+        pagedir_set_writable (pd, q->upage, q->writable);
+      else if (pagedir_set_page (pd, q->upage, s->frame->kpage, q->writable))
+        q->frame = s->frame;
+      else
+        return false;
+      pagedir_set_dirty (pd, q->upage, true);
+      s->frame->page = q;
+      frame_set_owner (s->frame, q->owner);
+      s->frame->pinned = q->pinned;
+    }
+  q->swap_slot = s->swap_slot;
+  s->frame = NULL;
+  s->swap_slot = SWAP_ERROR;
+  share_leave (q);
+  return true;
+}
+
+/* Unmaps P and removes it from its share, freeing the share's
+   frame if P was its last page.  A copy-on-write share left with a
+   single page becomes that page's own.  The caller must hold
+   frame_lock. */
+static void
+leave_share (struct page *p)
+{
+  struct share *s = p->share;
+  size_t left = list_size (&s->pages) - 1;
+  bool cow = is_cow (p);
+  struct frame *f;
+
+  if (p->frame != NULL)
+    pagedir_clear_page (p->owner->pagedir, p->upage);
+  p->frame = NULL;
+
+  /* Hand a shared frame that lists P as its page over to another
+     of its pages. */
+  if (s->frame != NULL && s->frame->page == p)
+    {
+      struct list_elem *e;
+      for (e = list_begin (&s->pages); e != list_end (&s->pages);
+           e = list_next (e))
+        {
+          struct page *q = list_entry (e, struct page, share_elem);
+          if (q != p)
+            {
+              s->frame->page = q;
+              frame_set_owner (s->frame, q->owner);
+              break;
+            }
+        }
+    }
+
+  f = share_leave (p);
+  if (f != NULL)
+    frame_free (f);
+  else if (cow && left == 1)
+    unshare (s);
+}
+
+/* Unmaps and frees P's frame and swap slot, if any.  The caller
+   must hold frame_lock. */
+static void
+release (struct page *p)
+{
+  if (p->zero)
+    {
+      pagedir_clear_page (p->owner->pagedir, p->upage);
+      p->zero = false;
+    }
+  if (p->share != NULL)
+    leave_share (p);
+  else if (p->frame != NULL)
+    {
+      pagedir_clear_page (p->owner->pagedir, p->upage);
+      frame_free (p->frame);
+      p->frame = NULL;
+    }
+  if (p->swap_slot != SWAP_ERROR)
+    {
+      swap_free (p->swap_slot);
+      p->swap_slot = SWAP_ERROR;
+    }
+}
+
+/* Removes P from the running process, writing it back first if
+   needed. */
+void
+page_remove (struct page *p)
+{
+  struct page **slot = cache_slot (p->upage);
+
+  if (*slot == p)
+    *slot = NULL;
+  lock_acquire (&frame_lock);
+  write_back (p, thread_current ());
+  release (p);
+  hash_delete (&thread_current ()->pages, &p->elem);
+  lock_release (&frame_lock);
+  free (p);
+}
+
+/* Maps F, which holds P, into the running process and clears
+   P's swap slot.  A page read back from swap no longer matches any
+   copy on disk, so it is marked dirty to be written out again if
+   evicted.  Shared pages are mapped read-only, except for shared
+   memory. */
+static bool
+install (struct page *p, struct frame *f)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+
+  if (!pagedir_set_page (pd, p->upage, f->kpage,
+                         (p->writable
+                          && (p->share == NULL || p->share->writable))))
+    return false;
+  p->frame = f;
+  if (p->swap_slot != SWAP_ERROR)
+    {
+      swap_free (p->swap_slot);
+      p->swap_slot = SWAP_ERROR;
+      pagedir_set_dirty (pd, p->upage, true);
+    }
+  return true;
+}
+
+/* Reads swapped-out page P into frame F, together with other pages
+   of the running process in the same aligned cluster of swap
+   slots.  Those were most likely evicted with P and will be wanted
+   soon; they are read only into frames free without eviction, and
+   are left unaccessed and unpinned so that they are the first to
+   go again if unused.  The caller must hold frame_lock. */
+static bool
+swap_in_around (struct page *p, struct frame *f)
+{
+  struct thread *t = thread_current ();
+  size_t slots[SWAP_CLUSTER];
+  void *kpages[SWAP_CLUSTER];
+  struct page *pages[SWAP_CLUSTER];
+  struct frame *frames[SWAP_CLUSTER];
+  size_t base = p->swap_slot / SWAP_CLUSTER * SWAP_CLUSTER;
+  size_t cnt = 0, slot, i;
+
+  for (slot = base; slot < base + SWAP_CLUSTER; slot++)
+    {
+      struct page *q = slot == p->swap_slot ? p : swap_page (slot, t);
+      struct frame *qf = q == p ? f : NULL;
+
+      if (q == NULL)
+        continue;
+      if (qf == NULL && (qf = frame_alloc (q, false, false)) == NULL)
+        continue;
+      slots[cnt] = slot;
+      kpages[cnt] = qf->kpage;
+      pages[cnt] = q;
+      frames[cnt] = qf;
+      cnt++;
+    }
+  swap_in (slots, kpages, cnt);
+
+  for (i = 0; i < cnt; i++)
+    if (pages[i] != p)
+      {
+        if (install (pages[i], frames[i]))
+          frames[i]->pinned = false;
+        else
+          frame_free (frames[i]);
+      }
+  return install (p, f);
+}
+
+/* Returns true if P can be shared with other processes running the
+   same executable: a read-only page read from the executable. */
+static bool
+is_shareable (const struct page *p)
+{
+  return p->file != NULL && !p->writable && !p->write_back;
+}
+
+/* Returns true if Q, a page of the running process that may be
+   null, can be read in along with page P, which lies DELTA pages
+   after it: Q is in neither memory nor swap and holds the whole
+   page of P's file that DELTA pages before P's, with the same
+   protection.  A shareable Q joins its share first and must not be
+   resident for another process.  The caller must hold frame_lock. */
+static bool
+can_read_around (struct page *q, const struct page *p, int delta)
+{
+  if (q == NULL || q->frame != NULL || q->zero
+      || q->swap_slot != SWAP_ERROR || q->file != p->file
+      || q->read_bytes != PGSIZE || q->ofs != p->ofs - delta * PGSIZE
+      || q->writable != p->writable || q->write_back != p->write_back)
+    return false;
+  if (q->share == NULL && is_shareable (q))
+    q->share = share_join (q);
+  return q->share == NULL || q->share->frame == NULL;
+}
+
+/* Reads page P, which holds a whole page of its file, into frame
+   F, together with the pages of the running process around it in
+   the same aligned cluster of FAULT_AROUND user pages that hold
+   the neighbouring pages of the file.  Programs mostly touch code
+   and data in order, so those will be wanted soon, and all of
+   them are read with one batch of disk requests, which the block
+   layer merges.  As in swap_in_around(), the others are only read
+   into frames free without eviction, and are left unaccessed and
+   unpinned.  The caller must hold frame_lock. */
+static bool
+file_in_around (struct page *p, struct frame *f)
+{
+  struct page *pages[FAULT_AROUND];
+  struct frame *frames[FAULT_AROUND];
+  void *kpages[FAULT_AROUND];
+  size_t idx = pg_no (p->upage) % FAULT_AROUND;
+  uint8_t *base = (uint8_t *) p->upage - idx * PGSIZE;
+  size_t lo, hi, i;
+  bool success;
+
+  pages[idx] = p;
+  frames[idx] = f;
+  for (lo = idx; lo > 0; lo--)
+    {
+      struct page *q = page_lookup (base + (lo - 1) * PGSIZE);
+      if (!can_read_around (q, p, idx - (lo - 1))
+          || (frames[lo - 1] = frame_alloc (q, false, false)) == NULL)
+        break;
+      pages[lo - 1] = q;
+    }
+  for (hi = idx + 1; hi < FAULT_AROUND; hi++)
+    {
+      struct page *q = page_lookup (base + hi * PGSIZE);
+      if (!can_read_around (q, p, -(int) (hi - idx))
+          || (frames[hi] = frame_alloc (q, false, false)) == NULL)
+        break;
+      pages[hi] = q;
+    }
+  for (i = lo; i < hi; i++)
+    kpages[i - lo] = frames[i]->kpage;
+
+  success = (file_read_pages (p->file, kpages, hi - lo, pages[lo]->ofs)
+             == (off_t) ((hi - lo) * PGSIZE));
+  for (i = lo; i < hi; i++)
+    if (i != idx)
+      {
+        struct page *q = pages[i];
+        if (success && install (q, frames[i]))
+          {
+            if (q->share != NULL)
+              q->share->frame = frames[i];
+            frames[i]->pinned = false;
+            around_cnt++;
+          }
+        else
+          frame_free (frames[i]);
+      }
+  return success && install (p, f);
+}
+
+/* Maps the shared zero page, read-only, at P, a page of the
+   running process, if P is all zeros and can be written only by
+   giving it a frame of its own: P has no file contents, swap
+   slot or share, and nothing to write back.  Returns true if
+   successful.  The caller must hold frame_lock. */
+static bool
+map_zero (struct page *p)
+{
+  if (p->read_bytes != 0 || p->swap_slot != SWAP_ERROR
+      || p->share != NULL || p->write_back
+      || !pagedir_set_page (thread_current ()->pagedir, p->upage,
+                            zero_page, false))
+    return false;
+  p->zero = true;
+  zero_cnt++;
+  return true;
+}
+
+/* Gives P, a page of the running process, a frame and fills it,
+   and stores how into *TYPE.  A shareable page already resident
+   for another process is just mapped, and a copy-on-write page
+   evicted since fork() is read back from its share's swap slot.
+   The caller must hold frame_lock. */
+static bool
+load (struct page *p, enum fault_type *type)
+{
+  struct frame *f;
+  uint8_t *kpage;
+  bool cow_swapped, success;
+
+  ASSERT (p->frame == NULL);
+
+  if (p->zero)
+    {
+      pagedir_clear_page (thread_current ()->pagedir, p->upage);
+      p->zero = false;
+    }
+  if (p->share == NULL && is_shareable (p))
+    p->share = share_join (p);
+  if (p->share != NULL && p->share->frame != NULL)
+    {
+      f = p->share->frame;
+      if (!pagedir_set_page (thread_current ()->pagedir, p->upage,
+                             f->kpage, p->share->writable))
+        return false;
+      p->frame = f;
+      *type = FAULT_RESIDENT;
+      return true;
+    }
+
+  /* A page with nothing to read can use a frame the idle thread
+     has already zeroed. */
+  cow_swapped = p->share != NULL && p->share->swap_slot != SWAP_ERROR;
+  f = frame_alloc (p, (!cow_swapped && p->swap_slot == SWAP_ERROR
+                       && p->read_bytes == 0), true);
+  if (f == NULL)
+    return false;
+  kpage = f->kpage;
+
+  if (cow_swapped)
+    {
+      void *kpages[1];
+
+      *type = FAULT_SWAP;
+      kpages[0] = kpage;
+      swap_in (&p->share->swap_slot, kpages, 1);
+      if (!install (p, f))
+        {
+          frame_free (f);
+          return false;
+        }
+      swap_free (p->share->swap_slot);
+      p->share->swap_slot = SWAP_ERROR;
+      p->share->frame = f;
+      f->pinned = false;
+      return true;
+    }
+  if (p->swap_slot != SWAP_ERROR)
+    {
+      *type = FAULT_SWAP;
+      if (!swap_in_around (p, f))
+        {
+          frame_free (f);
+          return false;
+        }
+      f->pinned = false;
+      return true;
+    }
+
+  *type = p->read_bytes > 0 ? FAULT_FILE : FAULT_ZERO;
+  if (p->read_bytes == PGSIZE)
+    success = file_in_around (p, f);
+  else
+    {
+      success = (p->read_bytes == 0
+                 || (file_read_page (p->file, kpage, p->read_bytes, p->ofs)
+                     == (off_t) p->read_bytes));
+      if (success && p->read_bytes > 0)
+        memset (kpage + p->read_bytes, 0, PGSIZE - p->read_bytes);
+      success = success && install (p, f);
+    }
+  if (!success)
+    {
+      frame_free (f);
+      return false;
+    }
+  if (p->share != NULL)
+    p->share->frame = f;
+  f->pinned = false;
+  return true;
+}
+
+/* Counts a page fault of TYPE, taken by the running process and
+   served in the CPU cycles since START, in its resource usage. */
+static void
+account_fault (enum fault_type type, uint64_t start)
+{
+  struct rusage *ru = &thread_current ()->rusage;
+  uint64_t cycles = (timer_tsc () - start) >> 10;
+  bool major = type == FAULT_FILE || type == FAULT_SWAP;
+  int bucket = 0;
+
+  switch (type)
+    {
+    case FAULT_RESIDENT:
+      break;
+    case FAULT_ZERO:
+      ru->zero_faults++;
+      break;
+    case FAULT_COW:
+      ru->cow_faults++;
+      break;
+    case FAULT_FILE:
+      ru->file_faults++;
+      break;
+    case FAULT_SWAP:
+      ru->swap_faults++;
+      break;
+    }
+
+  while (cycles > 0 && bucket < RUSAGE_LATENCY_CNT - 1)
+    {
+      cycles >>= 1;
+      bucket++;
+    }
+  if (major)
+    {
+      ru->major_faults++;
+      ru->major_latency[bucket]++;
+    }
+  else
+    {
+      ru->minor_faults++;
+      ru->minor_latency[bucket]++;
+    }
+}
+
+/* Returns true if an access to ADDR, with the user stack pointer
+   at ESP, should grow the stack.  The access must lie within the
+   maximum stack size below PHYS_BASE and no more than 32 bytes
+   below ESP, as PUSHA may write. */
+static bool
+is_stack_access (const void *addr, const void *esp)
+{
+  const uint8_t *a = addr;
+
+  return (a >= (const uint8_t *) PHYS_BASE - page_stack_max
+          && a < (const uint8_t *) PHYS_BASE
+          && a + 32 >= (const uint8_t *) esp);
+}
+
+/* Brings in the page containing FAULT_ADDR if it belongs to the
+   running process but is not resident, or if it extends the stack,
+   whose user stack pointer is ESP.  WRITE tells whether the access
+   was a write; an all-zero page that is only read maps the shared
+   zero page instead.  Returns true if the faulting access can be
+   retried. */
+bool
+page_fault_in (void *fault_addr, void *esp, bool write)
+{
+  uint64_t start = timer_tsc ();
+  enum fault_type type = FAULT_RESIDENT;
+  struct page *p;
+  bool success = true;
+
+  if (!is_user_vaddr (fault_addr) || thread_current ()->pagedir == NULL)
+    return false;
+  p = page_lookup (fault_addr);
+  if (p == NULL)
+    {
+      /* Stack pages start out as zeros, like the first one. */
+      if (!is_stack_access (fault_addr, esp)
+          || !page_add (pg_round_down (fault_addr), NULL, 0, 0, true, false))
+        return false;
+      p = page_lookup (fault_addr);
+    }
+
+  lock_acquire (&frame_lock);
+  if (p->frame == NULL && !p->zero)
+    {
+      if (!write && map_zero (p))
+        type = FAULT_ZERO;
+      else
+        success = load (p, &type);
+    }
+  lock_release (&frame_lock);
+  if (success)
+    account_fault (type, start);
+  return success;
+}
+
+/* Gives P, a copy-on-write page that the running process is
+   writing, a private copy of the frame it shares, mapped
+   writable.  Stores FAULT_COW into *TYPE, unless the shared frame
+   had to be read back from disk first, in which case it stores
+   how.  The caller must hold frame_lock. */
+static bool
+break_cow (struct page *p, enum fault_type *type)
+{
+  struct frame *shared, *f;
+  bool pinned;
+
+  *type = FAULT_COW;
+  if (p->share->frame == NULL)
+    {
+      if (!load (p, type))
+        return false;
+      if (*type != FAULT_FILE && *type != FAULT_SWAP)
+        *type = FAULT_COW;
+    }
+
+  /* Keep the shared frame from being evicted while we get ours. */
+  shared = p->share->frame;
+  pinned = shared->pinned;
+  shared->pinned = true;
+  f = frame_alloc (p, false, true);
+  shared->pinned = pinned;
+  if (f == NULL)
+    return false;
+  memcpy (f->kpage, shared->kpage, PGSIZE);
+
+  leave_share (p);
+  if (!install (p, f))
+    {
+      frame_free (f);
+      return false;
+    }
+  pagedir_set_dirty (thread_current ()->pagedir, p->upage, true);
+  f->pinned = p->pinned;
+  cow_cnt++;
+  return true;
+}
+
+/* Handles a write by the running process to the page containing
+   FAULT_ADDR, which is mapped read-only.  If the page is writable
+   but still shared with another process since fork(), gives the
+   running process its own copy, and if it maps the zero page,
+   gives it a zeroed frame.  Returns true if the faulting
+   access can be retried. */
+bool
+page_write_fault (void *fault_addr)
+{
+  uint64_t start = timer_tsc ();
+  enum fault_type type = FAULT_RESIDENT;
+  struct page *p;
+  bool success;
+
+  if (!is_user_vaddr (fault_addr) || thread_current ()->pagedir == NULL)
+    return false;
+  p = page_lookup (fault_addr);
+  if (p == NULL || !p->writable)
+    return false;
+
+  lock_acquire (&frame_lock);
+  if (p->zero)
+    {
+      success = load (p, &type);
+      type = FAULT_COW;
+    }
+  else if (p->share == NULL || p->share->writable)
+    {
+      /* The other processes let go of the page since the fault, or
+         it is shared memory, which another process has just paged
+         back in. */
+      success = true;
+    }
+  else if (list_size (&p->share->pages) == 1)
+    success = unshare (p->share);
+  else
+    success = break_cow (p, &type);
+  lock_release (&frame_lock);
+  if (success)
+    account_fault (type, start);
+  return success;
+}
+
+/* Returns true if the page in frame F has been accessed by any
+   process mapping it since the last call, and clears the accessed
+   bits.  The caller must hold frame_lock. */
+bool
+page_test_accessed (struct frame *f)
+{
+  struct page *p = f->page;
+  bool accessed = false;
+  struct list_elem *e;
+
+  if (p->share == NULL)
+    {
+      accessed = pagedir_is_accessed (f->owner->pagedir, p->upage);
+      pagedir_set_accessed (f->owner->pagedir, p->upage, false);
+      return accessed;
+    }
+  for (e = list_begin (&p->share->pages); e != list_end (&p->share->pages);
+       e = list_next (e))
+    {
+      struct page *q = list_entry (e, struct page, share_elem);
+      if (q->frame == f && pagedir_is_accessed (q->owner->pagedir, q->upage))
+        {
+          pagedir_set_accessed (q->owner->pagedir, q->upage, false);
+          accessed = true;
+        }
+    }
+  return accessed;
+}
+
+/* Returns true if evicting resident page P of OWNER would write
+   it to swap. */
+bool
+page_needs_swap (struct page *p, struct thread *owner)
+{
+  return is_anonymous_share (p) || (!p->write_back
+                        && pagedir_is_dirty (owner->pagedir, p->upage));
+}
+
+/* Unmaps share S's frame from every page mapping it.  The caller
+   must hold frame_lock. */
+static void
+unmap_share (struct share *s)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&s->pages); e != list_end (&s->pages);
+       e = list_next (e))
+    {
+      struct page *q = list_entry (e, struct page, share_elem);
+      if (q->frame != NULL)
+        {
+          pagedir_clear_page (q->owner->pagedir, q->upage);
+          q->frame = NULL;
+        }
+    }
+}
+
+/* Pages out the CNT pages held in VICTIMS so that their frames can
+   be reused: a dirty file-backed page is written to its file, other
+   dirty pages, copy-on-write and shared memory pages to swap in one
+   batch, and clean pages are just dropped.  Pages going to swap
+   are kept compressed in memory only if COMPRESS is true.  Returns
+   false, leaving every page resident, if swap is full.  The caller
+   must hold frame_lock. */
+bool
+page_evict (struct frame *victims[], size_t cnt, bool compress)
+{
+  void *kpages[SWAP_CLUSTER];
+  struct page *pages[SWAP_CLUSTER];
+  struct thread *owners[SWAP_CLUSTER];
+  size_t slots[SWAP_CLUSTER];
+  size_t swap_cnt = 0;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+  ASSERT (cnt <= SWAP_CLUSTER);
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct frame *f = victims[i];
+      struct page *p = f->page;
+      uint32_t *pd = f->owner->pagedir;
+
+      /* Shared pages are unmapped below.  Executable pages are
+         clean; copy-on-write pages are mapped read-only, so they
+         cannot change while being written out.  Shared memory is
+         writable, so it is unmapped first; a page that then stays
+         resident is faulted back in by load().  Their slots belong
+         to the share, not to a process, so read-around leaves them
+         alone. */
+      if (p->share != NULL)
+        {
+          if (p->share->writable)
+            unmap_share (p->share);
+          if (is_anonymous_share (p))
+            {
+              kpages[swap_cnt] = f->kpage;
+              pages[swap_cnt] = p;
+              owners[swap_cnt] = NULL;
+              swap_cnt++;
+            }
+          continue;
+        }
+
+      /* Unmap first, so that the owner cannot dirty the page after
+         we have looked at its dirty bit. */
+      pagedir_clear_page (pd, p->upage);
+      if (!pagedir_is_dirty (pd, p->upage))
+        continue;
+      if (p->write_back)
+        {
+          file_write_page (p->file, f->kpage, p->read_bytes, p->ofs);
+          pagedir_set_dirty (pd, p->upage, false);
+        }
+      else
+        {
+          kpages[swap_cnt] = f->kpage;
+          pages[swap_cnt] = p;
+          owners[swap_cnt] = f->owner;
+          swap_cnt++;
+        }
+    }
+
+  if (swap_cnt > 0 && !swap_out (kpages, pages, owners, swap_cnt, slots,
+                                    compress))
+    {
+      for (i = 0; i < cnt; i++)
+        {
+          struct frame *f = victims[i];
+          if (f->page->share == NULL)
+            pagedir_set_page (f->owner->pagedir, f->page->upage, f->kpage,
+                              f->page->writable);
+        }
+      for (i = 0; i < swap_cnt; i++)
+        if (owners[i] != NULL)
+          pagedir_set_dirty (owners[i]->pagedir, pages[i]->upage, true);
+      return false;
+    }
+
+  for (i = 0; i < swap_cnt; i++)
+    if (pages[i]->share != NULL)
+      pages[i]->share->swap_slot = slots[i];
+    else
+      pages[i]->swap_slot = slots[i];
+  for (i = 0; i < cnt; i++)
+    {
+      struct page *p = victims[i]->page;
+      if (p->share != NULL)
+        {
+          unmap_share (p->share);
+          p->share->frame = NULL;
+        }
+      p->frame = NULL;
+    }
+  return true;
+}
+
+/* Makes the page containing user address UADDR resident and
+   exempts it from eviction until page_unpin_all().  The kernel
+   pins user buffers it will access directly, since a fault
+   taken while it holds file system locks could not be serviced.
+   Returns false if UADDR is not a page of the running process. */
+bool
+page_pin (const void *uaddr)
+{
+  struct page *p = page_lookup (uaddr);
+  bool success = true;
+
+  if (p == NULL)
+    return false;
+
+  lock_acquire (&frame_lock);
+  if (p->frame == NULL)
+    {
+      uint64_t start = timer_tsc ();
+      enum fault_type type;
+
+      success = load (p, &type);
+      if (success)
+        account_fault (type, start);
+    }
+  if (success)
+    {
+      p->frame->pinned = true;
+      p->pinned = true;
+      thread_current ()->pin_cnt++;
+    }
+  lock_release (&frame_lock);
+  return success;
+}
+
+/* Returns true if any page of share S, which may be null, is
+   pinned. */
+static bool
+share_pinned (struct share *s)
+{
+  struct list_elem *e;
+
+  if (s == NULL)
+    return false;
+  for (e = list_begin (&s->pages); e != list_end (&s->pages);
+       e = list_next (e))
+    if (list_entry (e, struct page, share_elem)->pinned)
+      return true;
+  return false;
+}
+
+/* Unpins every page of the running process. */
+void
+page_unpin_all (void)
+{
+  struct thread *t = thread_current ();
+  struct hash_iterator i;
+
+  if (t->pin_cnt == 0)
+    return;
+
+  lock_acquire (&frame_lock);
+  hash_first (&i, &t->pages);
+  while (hash_next (&i))
+    {
+      struct page *p = hash_entry (hash_cur (&i), struct page, elem);
+      if (p->pinned)
+        {
+          p->pinned = false;
+          if (p->frame != NULL && !share_pinned (p->share))
+            p->frame->pinned = false;
+        }
+    }
+  t->pin_cnt = 0;
+  lock_release (&frame_lock);
+}
+
+/* Makes the running process's page Q, just added as a copy of page
+   P of PARENT, share P's contents: both map P's frame read-only
+   until either writes it, and a swapped-out page's slot is handed
+   to their share.  A page not yet loaded needs nothing more.  A
+   page of shared memory just joins its share, mapped writable.
+   Returns false if memory allocation fails.  The caller must hold
+   frame_lock. */
+static bool
+fork_page (struct page *p, struct page *q, struct thread *parent)
+{
+  struct share *s = p->share;
+
+  if (s != NULL && s->inode != NULL)
+    {
+      /* An executable page: Q joins the same share. */
+      q->share = share_join (q);
+      s = q->share;
+    }
+  else if (s != NULL)
+    share_add (s, q);
+  else if (p->frame != NULL || p->swap_slot != SWAP_ERROR)
+    {
+      s = share_create ();
+      if (s == NULL)
+        return false;
+      share_add (s, p);
+      share_add (s, q);
+      if (p->frame != NULL)
+        {
+          s->frame = p->frame;
+          pagedir_set_writable (parent->pagedir, p->upage, false);
+        }
+      else
+        {
+          swap_disown (p->swap_slot);
+          s->swap_slot = p->swap_slot;
+          p->swap_slot = SWAP_ERROR;
+        }
+    }
+
+  /* Map a resident page right away, as the parent has it, rather
+     than on the child's first touch. */
+  if (s != NULL && s->frame != NULL
+      && pagedir_set_page (q->owner->pagedir, q->upage, s->frame->kpage,
+                           s->writable))
+    q->frame = s->frame;
+  return true;
+}
+
+/* Copies the supplemental page table of PARENT, which is blocked
+   in fork(), into the running process, which has just called
+   page_table_init() and opened its own handle on the executable.
+   No page is copied: resident and swapped-out pages are shared
+   copy-on-write, and the rest are loaded on demand as in the
+   parent.  Pages of memory-mapped files are left to mmap_fork();
+   dirty ones are written back first, so that the child reads what
+   the parent wrote.  Returns false if memory allocation fails. */
+bool
+page_table_fork (struct thread *parent)
+{
+  struct thread *t = thread_current ();
+  struct hash_iterator i;
+  bool success = true;
+
+  lock_acquire (&frame_lock);
+  hash_first (&i, &parent->pages);
+  while (success && hash_next (&i))
+    {
+      struct page *p = hash_entry (hash_cur (&i), struct page, elem);
+
+      if (p->write_back)
+        {
+          write_back (p, parent);
+          if (p->frame != NULL)
+            pagedir_set_dirty (parent->pagedir, p->upage, false);
+          continue;
+        }
+      success = (page_add (p->upage, p->file != NULL ? t->exec_file : NULL,
+                           p->ofs, p->read_bytes, p->writable, false)
+                 && fork_page (p, page_lookup (p->upage), parent));
+    }
+  if (success)
+    fork_cnt++;
+  lock_release (&frame_lock);
+  return success;
+}
+
+/* Prints paging statistics. */
+void
+page_print_stats (void)
+{
+  printf ("Paging: %llu forks, %llu pages copied on write, "
+          "%llu zero page maps, %llu pages faulted around\n",
+          fork_cnt, cow_cnt, zero_cnt, around_cnt);
+}
+
+/* Returns a hash value for page P. */
+static unsigned
+page_hash (const struct hash_elem *p_, void *aux UNUSED)
+{
+  const struct page *p = hash_entry (p_, struct page, elem);
+  return hash_bytes (&p->upage, sizeof p->upage);
+}
+
+/* Returns true if page A precedes page B. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct page *a = hash_entry (a_, struct page, elem);
+  const struct page *b = hash_entry (b_, struct page, elem);
+  return a->upage < b->upage;
+}
+
+/* Frees page P at process exit.  Mapped files have already been
+   written back by mmap_unmap_all(). */
+static void
+page_destroy (struct hash_elem *p_, void *aux UNUSED)
+{
+  struct page *p = hash_entry (p_, struct page, elem);
+  release (p);
+  free (p);
+}
@@ -0,0 +1,78 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+struct thread;
+
+/* A user page, resident or not.
+
+   Every page of a process under VM has an entry in its process's
+   supplemental page table.  A fault on a page with no frame reads
+   it back from swap if it was swapped out, and otherwise reads
+   READ_BYTES bytes from FILE at OFS and zeroes the rest.  A page
+   with no FILE is all zeros.  Until it is written, an all-zero
+   page that is only read maps the kernel's one shared zero page,
+   read-only, with no frame of its own.
+
+   Read-only executable pages are shared: every process running
+   the executable maps the same frame, found through SHARE.  So
+   are a forked process's pages and its parent's, copy-on-write,
+   until one of them writes. */
+struct page
+  {
+    void *upage;                /* User virtual address. */
+    struct file *file;          /* Backing file, or null. */
+    off_t ofs;                  /* Offset in FILE. */
+    size_t read_bytes;          /* Bytes read from FILE; rest zeroed. */
+    bool writable;              /* May the process write the page? */
+    bool write_back;            /* Write dirty contents back to FILE? */
+    struct thread *owner;       /* Process the page belongs to. */
+    struct frame *frame;        /* Frame holding the page, or null. */
+    size_t swap_slot;           /* Swap slot, or SWAP_ERROR. */
+    bool pinned;                /* Pinned by page_pin()? */
+    bool zero;                  /* Mapped to the shared zero page? */
+    struct share *share;        /* Shared executable page, or null. */
+    struct list_elem share_elem; /* Element in share's `pages'. */
+    struct hash_elem elem;      /* Element in thread's `pages'. */
+  };
+
+/* Largest size the user stack may grow to, in bytes. */
+extern size_t page_stack_max;
+
+void page_init (void);
+bool page_table_init (void);
+void page_table_destroy (void);
+
+bool page_add (void *upage, struct file *, off_t ofs, size_t read_bytes,
+               bool writable, bool write_back);
+struct page *page_lookup (const void *upage);
+bool page_is_mapped (const void *upage);
+void page_remove (struct page *);
+/* How a page was brought in, for resource usage accounting. */
+enum fault_type
+  {
+    FAULT_RESIDENT,             /* Already in memory, e.g. shared. */
+    FAULT_ZERO,                 /* Zero-filled. */
+    FAULT_COW,                  /* Copied on write. */
+    FAULT_FILE,                 /* Read from a file. */
+    FAULT_SWAP                  /* Read back from swap. */
+  };
+
+bool page_fault_in (void *fault_addr, void *esp, bool write);
+bool page_write_fault (void *fault_addr);
+bool page_test_accessed (struct frame *);
+bool page_needs_swap (struct page *, struct thread *owner);
+bool page_evict (struct frame *victims[], size_t cnt, bool compress);
+
+bool page_pin (const void *uaddr);
+void page_unpin_all (void);
+
+bool page_table_fork (struct thread *parent);
+void page_print_stats (void);
+
+#endif /* vm/page.h */
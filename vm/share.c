@@ -0,0 +1,143 @@
+#include "vm/share.h"
+#include <debug.h>
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+
+/* Shared executable pages, keyed by inode and offset.  Protected
+   by frame_lock. */
+static struct hash shares;
+
+static hash_hash_func share_hash;
+static hash_less_func share_less;
+
+/* Initializes the share table. */
+void
+share_init (void)
+{
+  if (!hash_init (&shares, share_hash, share_less, NULL))
+    PANIC ("share table creation failed");
+}
+
+/* Adds P, a read-only executable page, to the share for its inode
+   and offset, creating the share if this is the first process to
+   use it, and returns the share.  Returns a null pointer if memory
+   allocation fails, in which case P stays private.  The caller must
+   hold frame_lock. */
+struct share *
+share_join (struct page *p)
+{
+  struct share key, *s;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  key.inode = file_get_inode (p->file);
+  key.ofs = p->ofs;
+  e = hash_find (&shares, &key.elem);
+  if (e != NULL)
+    s = hash_entry (e, struct share, elem);
+  else
+    {
+      s = malloc (sizeof *s);
+      if (s == NULL)
+        return NULL;
+      /* Keep the inode open, so that it cannot be freed and its
+         address reused as another share's key. */
+      s->inode = inode_reopen (key.inode);
+      s->ofs = key.ofs;
+      s->frame = NULL;
+      s->swap_slot = SWAP_ERROR;
+      list_init (&s->pages);
+      s->writable = false;
+      hash_insert (&shares, &s->elem);
+    }
+  list_push_back (&s->pages, &p->share_elem);
+  return s;
+}
+
+/* Returns a new copy-on-write share with no pages, frame or swap
+   slot, or a null pointer if memory allocation fails.  The caller
+   must hold frame_lock. */
+struct share *
+share_create (void)
+{
+  struct share *s;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  s = malloc (sizeof *s);
+  if (s != NULL)
+    {
+      s->inode = NULL;
+      s->ofs = 0;
+      s->frame = NULL;
+      s->swap_slot = SWAP_ERROR;
+      list_init (&s->pages);
+      s->writable = false;
+    }
+  return s;
+}
+
+/* Adds P, which must not be in any share, to copy-on-write or
+   shared memory share S.  The caller must hold frame_lock. */
+void
+share_add (struct share *s, struct page *p)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+  ASSERT (s->inode == NULL && p->share == NULL);
+
+  list_push_back (&s->pages, &p->share_elem);
+  p->share = s;
+}
+
+/* Removes P from its share.  If P was the share's last page, frees
+   the share, with its swap slot, and returns its frame, if any,
+   for the caller to free; otherwise returns a null pointer.  The
+   caller must hold frame_lock. */
+struct frame *
+share_leave (struct page *p)
+{
+  struct share *s = p->share;
+  struct frame *f = s->frame;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  list_remove (&p->share_elem);
+  p->share = NULL;
+  if (!list_empty (&s->pages))
+    return NULL;
+  if (s->inode != NULL)
+    {
+      hash_delete (&shares, &s->elem);
+      inode_close (s->inode);
+    }
+  if (s->swap_slot != SWAP_ERROR)
+    swap_free (s->swap_slot);
+  free (s);
+  return f;
+}
+
+/* Returns a hash value for share S. */
+static unsigned
+share_hash (const struct hash_elem *s_, void *aux UNUSED)
+{
+  const struct share *s = hash_entry (s_, struct share, elem);
+  return hash_bytes (&s->inode, sizeof s->inode) ^ hash_int (s->ofs);
+}
+
+/* Returns true if share A precedes share B. */
+static bool
+share_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct share *a = hash_entry (a_, struct share, elem);
+  const struct share *b = hash_entry (b_, struct share, elem);
+
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  return a->ofs < b->ofs;
+}
@@ -0,0 +1,42 @@
+#ifndef VM_SHARE_H
+#define VM_SHARE_H
+
+#include <hash.h>
+#include <list.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+struct page;
+
+/* One read-only page of an executable, shared by every process
+   running it.  All of them map the same frame while it is
+   resident.  Protected by frame_lock.
+
+   A share with a null INODE is instead a copy-on-write page left
+   behind by fork(): the processes map its frame read-only until
+   one of them writes the page and is given a copy of its own.
+   Its contents exist nowhere else, so when evicted it goes to
+   SWAP_SLOT.  Such shares are not in the share table.
+
+   A WRITABLE share, also with a null INODE, is a page of a shared
+   memory segment (see shm.c).  Its processes map its frame
+   writable and are never given copies. */
+struct share
+  {
+    struct inode *inode;        /* Executable, held open, or null. */
+    off_t ofs;                  /* Offset of the page in INODE. */
+    struct frame *frame;        /* Frame holding the page, or null. */
+    size_t swap_slot;           /* Copy-on-write page's swap slot, or
+                                   SWAP_ERROR. */
+    struct list pages;          /* Process pages mapping it. */
+    bool writable;              /* Shared memory, mapped writable? */
+    struct hash_elem elem;      /* Element in the share table. */
+  };
+
+void share_init (void);
+struct share *share_join (struct page *);
+struct share *share_create (void);
+void share_add (struct share *, struct page *);
+struct frame *share_leave (struct page *);
+
+#endif /* vm/share.h */
@@ -0,0 +1,303 @@
+#include "vm/shm.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdio.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/share.h"
+
+/* A shared memory segment: PAGE_CNT pages of zero-filled memory,
+   named by KEY, that every process attached to it maps writable
+   at an address of its own choosing.  Each page is a writable
+   share, so that its frame is found, evicted and swapped like a
+   copy-on-write page's, but never copied.  A share is freed with
+   the last page leaving it, and the segment with the last process
+   detaching from it. */
+struct segment
+  {
+    int key;                    /* Key given to shm_attach(). */
+    size_t page_cnt;            /* Number of pages. */
+    struct share **shares;      /* PAGE_CNT shares, null until used. */
+    int attach_cnt;             /* Processes attached. */
+    struct list_elem elem;      /* Element in `segments'. */
+  };
+
+/* One process's attachment to a segment. */
+struct attachment
+  {
+    struct segment *seg;        /* Segment attached. */
+    uint8_t *base;              /* First page. */
+    struct list_elem elem;      /* Element in thread's `attachments'. */
+  };
+
+/* Every segment some process is attached to.  shm_lock also keeps
+   a segment's shares from being freed while a process attaches;
+   it is acquired before frame_lock. */
+static struct list segments;
+static struct lock shm_lock;
+
+/* Statistics. */
+static unsigned long long create_cnt;   /* Segments created. */
+static unsigned long long attach_total; /* Successful attaches. */
+
+static struct segment *lookup (int key);
+static bool add_pages (struct segment *, uint8_t *base, size_t *added);
+static void remove_pages (uint8_t *base, size_t cnt);
+static void detach (struct attachment *);
+
+/* Initializes the segment list. */
+void
+shm_init (void)
+{
+  list_init (&segments);
+  lock_init (&shm_lock);
+}
+
+/* Initializes the running process's list of attachments. */
+void
+shm_process_init (void)
+{
+  list_init (&thread_current ()->attachments);
+}
+
+/* Attaches the running process to the segment named KEY, mapping
+   it at ADDR.  If there is no such segment, creates one of SIZE
+   bytes, rounded up to whole pages; otherwise SIZE may not exceed
+   the segment's size.  Fails, returning false, if ADDR is null or
+   not page-aligned, any page of the range is already in use, or
+   memory allocation fails. */
+bool
+shm_attach (int key, void *addr, size_t size)
+{
+  struct thread *t = thread_current ();
+  struct segment *seg;
+  struct attachment *a = NULL;
+  bool created = false;
+  size_t page_cnt, added = 0, i;
+
+  lock_acquire (&shm_lock);
+  seg = lookup (key);
+  page_cnt = seg != NULL ? seg->page_cnt : DIV_ROUND_UP (size, PGSIZE);
+  if (page_cnt == 0 || size > page_cnt * PGSIZE
+      || addr == NULL || pg_ofs (addr) != 0
+      || (uintptr_t) addr + page_cnt * PGSIZE > (uintptr_t) PHYS_BASE
+      || (uintptr_t) addr + page_cnt * PGSIZE < (uintptr_t) addr)
+    goto fail;
+  for (i = 0; i < page_cnt; i++)
+    if (page_is_mapped ((uint8_t *) addr + i * PGSIZE))
+      goto fail;
+
+  if (seg == NULL)
+    {
+      seg = malloc (sizeof *seg);
+      if (seg == NULL)
+        goto fail;
+      seg->shares = calloc (page_cnt, sizeof *seg->shares);
+      if (seg->shares == NULL)
+        {
+          free (seg);
+          seg = NULL;
+          goto fail;
+        }
+      seg->key = key;
+      seg->page_cnt = page_cnt;
+      seg->attach_cnt = 0;
+      created = true;
+    }
+
+  a = malloc (sizeof *a);
+  if (a == NULL || !add_pages (seg, addr, &added))
+    goto fail;
+  a->seg = seg;
+  a->base = addr;
+  list_push_back (&t->attachments, &a->elem);
+  if (created)
+    {
+      list_push_back (&segments, &seg->elem);
+      create_cnt++;
+    }
+  seg->attach_cnt++;
+  attach_total++;
+  lock_release (&shm_lock);
+  return true;
+
+ fail:
+  /* A new segment's shares go with their only pages. */
+  remove_pages (addr, added);
+  free (a);
+  if (created)
+    {
+      free (seg->shares);
+      free (seg);
+    }
+  lock_release (&shm_lock);
+  return false;
+}
+
+/* Detaches the running process from the segment attached at
+   ADDR.  Returns false if none is. */
+bool
+shm_detach (void *addr)
+{
+  struct list *attachments = &thread_current ()->attachments;
+  struct list_elem *e;
+
+  for (e = list_begin (attachments); e != list_end (attachments);
+       e = list_next (e))
+    {
+      struct attachment *a = list_entry (e, struct attachment, elem);
+      if (a->base == addr)
+        {
+          list_remove (&a->elem);
+          detach (a);
+          return true;
+        }
+    }
+  return false;
+}
+
+/* Detaches the running process from every segment, at exit. */
+void
+shm_detach_all (void)
+{
+  struct list *attachments = &thread_current ()->attachments;
+
+  while (!list_empty (attachments))
+    detach (list_entry (list_pop_front (attachments),
+                        struct attachment, elem));
+}
+
+/* Attaches the running process, just forked from PARENT, to each
+   segment PARENT is attached to, at the same address.
+   page_table_fork() has already added the pages to their shares.
+   Returns false if memory allocation fails, leaving what was
+   attached for shm_detach_all(). */
+bool
+shm_fork (struct thread *parent)
+{
+  struct thread *t = thread_current ();
+  struct list_elem *e;
+  bool success = true;
+
+  lock_acquire (&shm_lock);
+  for (e = list_begin (&parent->attachments);
+       e != list_end (&parent->attachments); e = list_next (e))
+    {
+      struct attachment *pa = list_entry (e, struct attachment, elem);
+      struct attachment *a = malloc (sizeof *a);
+
+      if (a == NULL)
+        {
+          success = false;
+          break;
+        }
+      a->seg = pa->seg;
+      a->base = pa->base;
+      a->seg->attach_cnt++;
+      list_push_back (&t->attachments, &a->elem);
+    }
+  lock_release (&shm_lock);
+  return success;
+}
+
+/* Returns a value that identifies the shared memory page holding
+   UADDR, the same in every process attached to its segment, or a
+   null pointer if UADDR is not in shared memory in the running
+   process. */
+const void *
+shm_page_id (const void *uaddr)
+{
+  struct page *p = page_lookup (uaddr);
+
+  return p != NULL && p->share != NULL && p->share->writable ? p->share : NULL;
+}
+
+/* Returns the segment named KEY, or a null pointer if there is
+   none.  The caller must hold shm_lock. */
+static struct segment *
+lookup (int key)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&segments); e != list_end (&segments);
+       e = list_next (e))
+    {
+      struct segment *seg = list_entry (e, struct segment, elem);
+      if (seg->key == key)
+        return seg;
+    }
+  return NULL;
+}
+
+/* Adds the pages of SEG to the running process's page table at
+   BASE, creating the shares a new segment lacks.  Returns false if
+   memory allocation fails, with *ADDED pages added.  The caller
+   must hold shm_lock. */
+static bool
+add_pages (struct segment *seg, uint8_t *base, size_t *added)
+{
+  for (*added = 0; *added < seg->page_cnt; (*added)++)
+    {
+      struct share **s = &seg->shares[*added];
+      uint8_t *upage = base + *added * PGSIZE;
+      bool success;
+
+      if (!page_add (upage, NULL, 0, 0, true, false))
+        return false;
+      lock_acquire (&frame_lock);
+      if (*s == NULL && (*s = share_create ()) != NULL)
+        (*s)->writable = true;
+      success = *s != NULL;
+      if (success)
+        share_add (*s, page_lookup (upage));
+      lock_release (&frame_lock);
+      if (!success)
+        {
+          page_remove (page_lookup (upage));
+          return false;
+        }
+    }
+  return true;
+}
+
+/* Removes the CNT pages at BASE from the running process. */
+static void
+remove_pages (uint8_t *base, size_t cnt)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    page_remove (page_lookup (base + i * PGSIZE));
+}
+
+/* Unmaps A's pages, frees A, and frees its segment if no process
+   is attached to it any more. */
+static void
+detach (struct attachment *a)
+{
+  struct segment *seg = a->seg;
+
+  lock_acquire (&shm_lock);
+  remove_pages (a->base, seg->page_cnt);
+  if (--seg->attach_cnt == 0)
+    {
+      list_remove (&seg->elem);
+      free (seg->shares);
+      free (seg);
+    }
+  lock_release (&shm_lock);
+  free (a);
+}
+
+/* Prints shared memory statistics. */
+void
+shm_print_stats (void)
+{
+  printf ("Shared memory: %llu segments created, %llu attaches\n",
+          create_cnt, attach_total);
+}
@@ -0,0 +1,18 @@
+#ifndef VM_SHM_H
+#define VM_SHM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct thread;
+
+void shm_init (void);
+void shm_process_init (void);
+bool shm_attach (int key, void *addr, size_t size);
+bool shm_detach (void *addr);
+void shm_detach_all (void);
+bool shm_fork (struct thread *parent);
+const void *shm_page_id (const void *uaddr);
+void shm_print_stats (void);
+
+#endif /* vm/shm.h */
@@ -0,0 +1,349 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <list.h>
+#include <lz.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Sectors in one swap slot, which holds one page. */
+#define SLOT_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Swap device, or a null pointer if there is none. */
+static struct block *swap_block;
+static size_t slot_cnt;
+
+/* In-use swap slots.  Protected by frame_lock, like every other
+   piece of paging state. */
+static struct bitmap *swap_slots;
+
+/* The page held in each slot, for read-around. */
+struct slot_owner
+  {
+    struct thread *thread;      /* Owning process. */
+    struct page *page;          /* Page held in the slot. */
+  };
+static struct slot_owner *slot_owners;
+
+/* Most bytes of compressed pages to hold in memory, or 0 to send
+   every page straight to the swap device. */
+size_t swap_zpool_size = 256 * 1024;
+
+/* A swapped-out page held compressed in memory, in front of the
+   swap device.  It stands in for the contents of its slot, which
+   stays allocated so that the page keeps its place in the slot
+   clusters that read-around works on; the slot is only written
+   when the page is pushed out of the pool. */
+struct zpage
+  {
+    struct list_elem elem;      /* Element in zpool. */
+    size_t slot;                /* Slot it stands in for. */
+    size_t size;                /* Bytes of compressed data. */
+    uint8_t data[];             /* Compressed data. */
+  };
+
+/* Largest zpage, header included.  malloc() hands out bigger
+   blocks as whole pages, which would save nothing. */
+#define ZPAGE_MAX (PGSIZE * 3 / 8)
+
+/* The compressed pool.  Like the slots, protected by frame_lock. */
+static struct zpage **zpages;   /* Each slot's zpage, or null. */
+static struct list zpool;       /* All zpages, oldest first. */
+static size_t zpool_bytes;      /* Bytes in zpages, with headers. */
+static uint8_t *zbounce;        /* SWAP_CLUSTER pages for write-out. */
+static uint8_t zwork[LZ_WORK_SIZE];     /* lz_compress() scratch. */
+static uint8_t zbuf[ZPAGE_MAX];         /* lz_compress() output. */
+
+/* Statistics. */
+static unsigned long long write_cnt;    /* Slots written to disk. */
+static unsigned long long read_cnt;     /* Slots read from disk. */
+static unsigned long long zstore_cnt;   /* Pages put in the pool. */
+static unsigned long long zreject_cnt;  /* Pages that compressed badly. */
+static unsigned long long zhit_cnt;     /* Pages read from the pool. */
+static unsigned long long zspill_cnt;   /* Pages pushed out to disk. */
+
+static bool zpool_store (size_t slot, const void *kpage);
+static void zpool_load (const struct zpage *, void *kpage);
+static void zpool_drop (struct zpage *);
+static void zpool_shrink (void);
+static void transfer (const size_t slots[], void *kpages[], size_t cnt,
+                      bool write);
+
+/* Finds the swap device and sizes the slot map to it.  Without a
+   swap device every swap_out() fails. */
+void
+swap_init (void)
+{
+  swap_block = block_get_role (BLOCK_SWAP);
+  if (swap_block == NULL)
+    return;
+  slot_cnt = block_size (swap_block) / SLOT_SECTORS;
+  swap_slots = bitmap_create (slot_cnt);
+  slot_owners = calloc (slot_cnt, sizeof *slot_owners);
+  if (swap_slots == NULL || slot_owners == NULL)
+    PANIC ("swap slot map creation failed");
+
+  list_init (&zpool);
+  if (swap_zpool_size > 0)
+    {
+      zpages = calloc (slot_cnt, sizeof *zpages);
+      zbounce = palloc_get_multiple (PAL_ASSERT, SWAP_CLUSTER);
+      if (zpages == NULL)
+        PANIC ("compressed swap pool creation failed");
+    }
+}
+
+/* Writes the CNT pages at KPAGES, which hold PAGES of processes
+   OWNERS, to swap and stores their slots in SLOTS.
+
+   Pages evicted together are likely to be faulted back in
+   together, so they go to consecutive slots when such a run is
+   free.  The device queue then merges the writes into long
+   sequential transfers, and swap_in() can read the run back as
+   one.
+
+   Each page that compresses well is kept in memory instead, and
+   goes to its slot on disk only once it is among the oldest in a
+   pool grown past swap_zpool_size.  If COMPRESS is false, every
+   page goes straight to disk instead, so that nothing is
+   allocated.  Returns false, allocating nothing, if swap is
+   full. */
+bool
+swap_out (void *kpages[], struct page *pages[], struct thread *owners[],
+          size_t cnt, size_t slots[], bool compress)
+{
+  size_t disk_slots[SWAP_CLUSTER];
+  void *disk_kpages[SWAP_CLUSTER];
+  size_t disk_cnt = 0;
+  size_t first, i;
+
+  ASSERT (cnt <= SWAP_CLUSTER);
+
+  if (swap_slots == NULL)
+    return false;
+  first = bitmap_scan_and_flip (swap_slots, 0, cnt, false);
+  for (i = 0; i < cnt; i++)
+    {
+      slots[i] = (first != BITMAP_ERROR
+                  ? first + i
+                  : bitmap_scan_and_flip (swap_slots, 0, 1, false));
+      if (slots[i] == BITMAP_ERROR)
+        {
+          while (i-- > 0)
+            bitmap_reset (swap_slots, slots[i]);
+          return false;
+        }
+      slot_owners[slots[i]].thread = owners[i];
+      slot_owners[slots[i]].page = pages[i];
+    }
+
+  for (i = 0; i < cnt; i++)
+    if (!compress || !zpool_store (slots[i], kpages[i]))
+      {
+        disk_slots[disk_cnt] = slots[i];
+        disk_kpages[disk_cnt] = kpages[i];
+        disk_cnt++;
+      }
+  transfer (disk_slots, disk_kpages, disk_cnt, true);
+  zpool_shrink ();
+  return true;
+}
+
+/* Reads the CNT swap slots in SLOTS into KPAGES, decompressing
+   those held in the pool and reading the rest from disk.  The
+   slots, and their pool copies, stay allocated until swap_free(). */
+void
+swap_in (const size_t slots[], void *kpages[], size_t cnt)
+{
+  size_t disk_slots[SWAP_CLUSTER];
+  void *disk_kpages[SWAP_CLUSTER];
+  size_t disk_cnt = 0;
+  size_t i;
+
+  ASSERT (cnt <= SWAP_CLUSTER);
+
+  for (i = 0; i < cnt; i++)
+    {
+      ASSERT (bitmap_test (swap_slots, slots[i]));
+      if (zpages != NULL && zpages[slots[i]] != NULL)
+        {
+          zpool_load (zpages[slots[i]], kpages[i]);
+          zhit_cnt++;
+        }
+      else
+        {
+          disk_slots[disk_cnt] = slots[i];
+          disk_kpages[disk_cnt] = kpages[i];
+          disk_cnt++;
+        }
+    }
+  transfer (disk_slots, disk_kpages, disk_cnt, false);
+}
+
+/* Returns the page of OWNER held in SLOT, or a null pointer if
+   SLOT is out of range, free, or holds another process's page. */
+struct page *
+swap_page (size_t slot, struct thread *owner)
+{
+  if (slot >= slot_cnt || !bitmap_test (swap_slots, slot)
+      || slot_owners[slot].thread != owner)
+    return NULL;
+  return slot_owners[slot].page;
+}
+
+/* Forgets which page SLOT holds, so that swap_page() no longer
+   returns it for read-around.  Used when a slot passes from one
+   page to a copy-on-write share. */
+void
+swap_disown (size_t slot)
+{
+  ASSERT (bitmap_test (swap_slots, slot));
+
+  slot_owners[slot].thread = NULL;
+  slot_owners[slot].page = NULL;
+}
+
+/* Frees swap slot SLOT. */
+void
+swap_free (size_t slot)
+{
+  ASSERT (bitmap_test (swap_slots, slot));
+
+  bitmap_reset (swap_slots, slot);
+  slot_owners[slot].thread = NULL;
+  slot_owners[slot].page = NULL;
+  if (zpages != NULL && zpages[slot] != NULL)
+    zpool_drop (zpages[slot]);
+}
+
+/* Prints swap statistics. */
+void
+swap_print_stats (void)
+{
+  size_t used = (swap_slots != NULL
+                 ? bitmap_count (swap_slots, 0, slot_cnt, true) : 0);
+
+  printf ("Swap: %zu of %zu slots in use, %llu written, %llu read\n",
+          used, slot_cnt, write_cnt, read_cnt);
+  printf ("Swap pool: %zu pages in %zu bytes, %llu stored, %llu "
+          "incompressible, %llu hits, %llu pushed to disk\n",
+          list_size (&zpool), zpool_bytes, zstore_cnt, zreject_cnt,
+          zhit_cnt, zspill_cnt);
+}
+
+/* Compresses KPAGE into a new zpage standing in for SLOT.
+   Returns false if the pool is disabled or the page does not
+   compress to a small enough zpage. */
+static bool
+zpool_store (size_t slot, const void *kpage)
+{
+  struct zpage *z;
+  size_t size;
+
+  if (zpages == NULL)
+    return false;
+  size = lz_compress (kpage, PGSIZE, zbuf, ZPAGE_MAX - sizeof *z, zwork);
+  if (size == 0 || (z = malloc (sizeof *z + size)) == NULL)
+    {
+      zreject_cnt++;
+      return false;
+    }
+  z->slot = slot;
+  z->size = size;
+  memcpy (z->data, zbuf, size);
+  list_push_back (&zpool, &z->elem);
+  zpool_bytes += sizeof *z + size;
+  zpages[slot] = z;
+  zstore_cnt++;
+  return true;
+}
+
+/* Decompresses Z into KPAGE. */
+static void
+zpool_load (const struct zpage *z, void *kpage)
+{
+  size_t size = lz_decompress (z->data, z->size, kpage, PGSIZE);
+  if (size != PGSIZE)
+    PANIC ("swap slot %zu: corrupt compressed page", z->slot);
+}
+
+/* Removes Z from the pool and frees it. */
+static void
+zpool_drop (struct zpage *z)
+{
+  list_remove (&z->elem);
+  zpages[z->slot] = NULL;
+  zpool_bytes -= sizeof *z + z->size;
+  free (z);
+}
+
+/* While the pool holds more than swap_zpool_size bytes, writes its
+   oldest pages to their slots on disk, up to SWAP_CLUSTER at a
+   time, and drops them from the pool. */
+static void
+zpool_shrink (void)
+{
+  while (zpool_bytes > swap_zpool_size)
+    {
+      size_t slots[SWAP_CLUSTER];
+      void *kpages[SWAP_CLUSTER];
+      size_t cnt = 0;
+
+      while (cnt < SWAP_CLUSTER && zpool_bytes > swap_zpool_size)
+        {
+          struct zpage *z = list_entry (list_front (&zpool),
+                                        struct zpage, elem);
+          slots[cnt] = z->slot;
+          kpages[cnt] = zbounce + cnt * PGSIZE;
+          zpool_load (z, kpages[cnt]);
+          zpool_drop (z);
+          cnt++;
+        }
+      transfer (slots, kpages, cnt, true);
+      zspill_cnt += cnt;
+    }
+}
+
+/* Called by the block layer when a swap transfer completes. */
+static void
+transfer_done (struct block_request *r)
+{
+  sema_up (r->aux);
+}
+
+/* Submits a transfer between each of the CNT slots in SLOTS and the
+   corresponding page in KPAGES, then waits for all of them. */
+static void
+transfer (const size_t slots[], void *kpages[], size_t cnt, bool write)
+{
+  struct block_request reqs[SWAP_CLUSTER];
+  struct semaphore done;
+  size_t i;
+
+  ASSERT (cnt <= SWAP_CLUSTER);
+
+  if (write)
+    write_cnt += cnt;
+  else
+    read_cnt += cnt;
+  sema_init (&done, 0);
+  for (i = 0; i < cnt; i++)
+    {
+      struct block_request *r = &reqs[i];
+      r->block = swap_block;
+      r->sector = slots[i] * SLOT_SECTORS;
+      r->cnt = SLOT_SECTORS;
+      r->buffer = kpages[i];
+      r->write = write;
+      r->done = transfer_done;
+      r->aux = &done;
+      block_submit (r);
+    }
+  for (i = 0; i < cnt; i++)
+    sema_down (&done);
+}
@@ -0,0 +1,27 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct page;
+struct thread;
+
+/* Marks a page that has no swap slot. */
+#define SWAP_ERROR ((size_t) -1)
+
+/* Most pages written out or read around together. */
+#define SWAP_CLUSTER 8
+
+extern size_t swap_zpool_size;
+
+void swap_init (void);
+bool swap_out (void *kpages[], struct page *[], struct thread *owner[],
+               size_t cnt, size_t slots[], bool compress);
+void swap_in (const size_t slots[], void *kpages[], size_t cnt);
+struct page *swap_page (size_t slot, struct thread *owner);
+void swap_disown (size_t slot);
+void swap_free (size_t slot);
+void swap_print_stats (void);
+
+#endif /* vm/swap.h */